@@ -0,0 +1,220 @@
+// CudaDnnBench.cpp : Runs the benchmark suites built into the CudaDnnDll and
+// writes the results in the Google Benchmark JSON format.
+//
+//	Usage: CudaDnnBench [-dll <path>] [-device <id>] [-type float|double|both]
+//						[-suites <mask>] [-min_time <ms>] [-repetitions <n>]
+//						[-max_size <n>] [-out <file>]
+//
+//	The suites are run inside the DLL so that the handle lookups, wrappers,
+//	allocator and host side t-SNE code are timed exactly as they are built.
+//	Two result files can be diffed with the Google Benchmark compare.py tool.
+//
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+// These must match the values in CudaDnnDLL\Cuda Files\main.h
+const LONG CUDA_DLL_FREEMEM				= -1;
+const LONG CUDA_DLL_INITIALIZE			= -2;
+const LONG CUDA_DLL_CLEANUP				= -3;
+const LONG CUDA_FN_GET_BENCHMARK		= 1005;
+
+// These must match the values in CudaDnnDLL\Cuda Files\benchmark.h
+const int BENCH_SUITE_ALL				= 0x00FF;
+
+const LONG MAX_ERROR = 1024;
+const LPCSTR DEFAULT_DLL = "CudaDnnDll.9.dll";
+const LPCSTR CALLLOG_ENV_FILE = "MYCAFFE_CALL_LOG";
+
+typedef LONG (WINAPI *LPFNINVOKEFLOAT)(LONG, LONG, float*, LONG, float**, LONG*, LPTSTR, LONG);
+typedef LONG (WINAPI *LPFNINVOKEDOUBLE)(LONG, LONG, double*, LONG, double**, LONG*, LPTSTR, LONG);
+typedef LONG (WINAPI *LPFNQUERYSTRING)(LONG, LONG, LONG*, LONG, LPTSTR*, LPTSTR, LONG);
+
+
+//=============================================================================
+//	Local Function Prototypes
+//=============================================================================
+
+template <class T, class FN>
+LONG runBenchmarks(FN pfnInvoke, LPFNQUERYSTRING pfnQuery, int nDevice, LONG* rgParam, std::string& strJson);
+
+
+//=============================================================================
+//	Main Function
+//=============================================================================
+
+int main(int argc, char* argv[])
+{
+	LPCSTR pszDll = DEFAULT_DLL;
+	LPCSTR pszOut = NULL;
+	LPCSTR pszType = "both";
+	int nDevice = 0;
+	LONG rgParam[4] = { BENCH_SUITE_ALL, 0, 0, 0 };
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (_stricmp(argv[i], "-dll") == 0 && i + 1 < argc)
+			pszDll = argv[++i];
+		else if (_stricmp(argv[i], "-device") == 0 && i + 1 < argc)
+			nDevice = atoi(argv[++i]);
+		else if (_stricmp(argv[i], "-type") == 0 && i + 1 < argc)
+			pszType = argv[++i];
+		else if (_stricmp(argv[i], "-suites") == 0 && i + 1 < argc)
+			rgParam[0] = strtol(argv[++i], NULL, 0);
+		else if (_stricmp(argv[i], "-min_time") == 0 && i + 1 < argc)
+			rgParam[1] = atoi(argv[++i]);
+		else if (_stricmp(argv[i], "-repetitions") == 0 && i + 1 < argc)
+			rgParam[2] = atoi(argv[++i]);
+		else if (_stricmp(argv[i], "-max_size") == 0 && i + 1 < argc)
+			rgParam[3] = atoi(argv[++i]);
+		else if (_stricmp(argv[i], "-out") == 0 && i + 1 < argc)
+			pszOut = argv[++i];
+		else
+		{
+			printf("Usage: CudaDnnBench [-dll <path>] [-device <id>] [-type float|double|both] [-suites <mask>] [-min_time <ms>] [-repetitions <n>] [-max_size <n>] [-out <file>]\n");
+			return 1;
+		}
+	}
+
+	bool bFloat = (_stricmp(pszType, "float") == 0 || _stricmp(pszType, "both") == 0);
+	bool bDouble = (_stricmp(pszType, "double") == 0 || _stricmp(pszType, "both") == 0);
+
+	if (!bFloat && !bDouble)
+	{
+		printf("ERROR: Unknown type '%s'.\n", pszType);
+		return 1;
+	}
+
+	// Never record the benchmark calls.
+	SetEnvironmentVariableA(CALLLOG_ENV_FILE, NULL);
+
+	HMODULE hDll = LoadLibraryA(pszDll);
+	if (hDll == NULL)
+	{
+		printf("ERROR: Could not load '%s' (error %u).\n", pszDll, GetLastError());
+		return 3;
+	}
+
+	LPFNINVOKEFLOAT pfnFloat = (LPFNINVOKEFLOAT)GetProcAddress(hDll, "DLL_InvokeFloat");
+	LPFNINVOKEDOUBLE pfnDouble = (LPFNINVOKEDOUBLE)GetProcAddress(hDll, "DLL_InvokeDouble");
+	LPFNQUERYSTRING pfnQuery = (LPFNQUERYSTRING)GetProcAddress(hDll, "DLL_QueryString");
+
+	if (pfnFloat == NULL || pfnDouble == NULL || pfnQuery == NULL)
+	{
+		printf("ERROR: '%s' is missing the invoke exports.\n", pszDll);
+		FreeLibrary(hDll);
+		return 3;
+	}
+
+	// Each type writes a complete document, when both are run the float
+	// benchmarks are merged into the double document.
+	std::string strFloat;
+	std::string strDouble;
+	LONG lErr = 0;
+
+	if (bFloat)
+		lErr = runBenchmarks<float>(pfnFloat, pfnQuery, nDevice, rgParam, strFloat);
+
+	if (bDouble && !lErr)
+		lErr = runBenchmarks<double>(pfnDouble, pfnQuery, nDevice, rgParam, strDouble);
+
+	FreeLibrary(hDll);
+
+	if (lErr)
+		return 4;
+
+	std::string strJson = (bDouble) ? strDouble : strFloat;
+
+	if (bFloat && bDouble)
+	{
+		size_t nPos = strFloat.find("\"benchmarks\":[");
+		std::string strBody = strFloat.substr(nPos + strlen("\"benchmarks\":["));
+		strBody = strBody.substr(0, strBody.rfind("]}"));
+
+		if (strBody.length() > 0)
+		{
+			size_t nEnd = strJson.rfind("]}");
+			bool bEmpty = (strJson[nEnd - 1] == '[');
+
+			strJson = strJson.substr(0, nEnd) + ((bEmpty) ? "" : ",") + strBody + "]}";
+		}
+	}
+
+	if (pszOut == NULL)
+	{
+		printf("%s\n", strJson.c_str());
+		return 0;
+	}
+
+	FILE* pFile = fopen(pszOut, "w");
+	if (pFile == NULL)
+	{
+		printf("ERROR: Could not create '%s'.\n", pszOut);
+		return 2;
+	}
+
+	fprintf(pFile, "%s\n", strJson.c_str());
+	fclose(pFile);
+
+	printf("Wrote the benchmark results to '%s'.\n", pszOut);
+
+	return 0;
+}
+
+
+//=============================================================================
+//	Local Functions
+//=============================================================================
+
+template <class T, class FN>
+LONG runBenchmarks(FN pfnInvoke, LPFNQUERYSTRING pfnQuery, int nDevice, LONG* rgParam, std::string& strJson)
+{
+	TCHAR szErr[MAX_ERROR];
+	T rgInput[2] = { (T)nDevice, (T)0x0003 };	// CUBLAS | CURAND
+	T rgOutput[1];
+	T* pOutput = rgOutput;
+	LONG lOutput = 1;
+
+	LONG lErr = pfnInvoke(0, CUDA_DLL_INITIALIZE, rgInput, 2, &pOutput, &lOutput, szErr, MAX_ERROR);
+	if (lErr)
+	{
+		printf("ERROR: Could not initialize the %s kernel on device %d (error %d).\n", (sizeof(T) == sizeof(float)) ? "float" : "double", nDevice, lErr);
+		return lErr;
+	}
+
+	LONG lKernelIdx = (LONG)pOutput[0];
+	LPTSTR pszResult = NULL;
+
+	fprintf(stderr, "Running the %s benchmarks...\n", (sizeof(T) == sizeof(float)) ? "float" : "double");
+
+	lErr = pfnQuery(lKernelIdx, CUDA_FN_GET_BENCHMARK, rgParam, 4, &pszResult, szErr, MAX_ERROR);
+	if (lErr)
+	{
+		printf("ERROR: The benchmarks failed (error %d).\n", lErr);
+	}
+	else if (pszResult != NULL)
+	{
+		int nLen = WideCharToMultiByte(CP_UTF8, 0, pszResult, -1, NULL, 0, NULL, NULL);
+
+		if (nLen > 0)
+		{
+			strJson.resize(nLen);
+			WideCharToMultiByte(CP_UTF8, 0, pszResult, -1, &strJson[0], nLen, NULL, NULL);
+			strJson.resize(nLen - 1);
+		}
+
+		pfnQuery(lKernelIdx, CUDA_DLL_FREEMEM, (LONG*)pszResult, 1, NULL, szErr, MAX_ERROR);
+	}
+
+	pfnInvoke(lKernelIdx, CUDA_DLL_CLEANUP, NULL, 0, NULL, NULL, szErr, MAX_ERROR);
+
+	return lErr;
+}
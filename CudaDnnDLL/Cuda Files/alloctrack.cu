@@ -0,0 +1,316 @@
+//=============================================================================
+//	FILE:	alloctrack.cu
+//
+//	DESC:	This file implements the allocation tracker used to attribute the
+//			GPU memory handles to their owners.
+//=============================================================================
+
+#include "util.h"
+#include "alloctrack.h"
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+//=============================================================================
+//	Local Functions
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Appends the string to the JSON output, escaping the characters that
+//	cannot appear within a JSON string.
+//-----------------------------------------------------------------------------
+static void appendJsonString(std::string& str, const std::string& strVal)
+{
+	str += "\"";
+
+	for (size_t i = 0; i < strVal.length(); i++)
+	{
+		char ch = strVal[i];
+
+		if (ch == '"' || ch == '\\')
+			str += '\\';
+
+		if ((unsigned char)ch < 0x20)
+			continue;
+
+		str += ch;
+	}
+
+	str += "\"";
+}
+
+
+//=============================================================================
+//	AllocTracker Methods
+//=============================================================================
+
+void AllocTracker::CleanUp()
+{
+	m_bEnabled = false;
+
+	EnterCriticalSection(&m_lock);
+
+	if (m_rgEntries != NULL)
+	{
+		delete[] m_rgEntries;
+		m_rgEntries = NULL;
+	}
+
+	m_rgTags.clear();
+
+	LeaveCriticalSection(&m_lock);
+}
+
+//-----------------------------------------------------------------------------
+//	Enabling starts a new session, the handles allocated before then are not
+//	tracked.  Disabling keeps the stats so they can still be reported.
+//-----------------------------------------------------------------------------
+long AllocTracker::Enable(bool bEnable)
+{
+	if (!bEnable)
+	{
+		m_bEnabled = false;
+		return 0;
+	}
+
+	if (m_bEnabled)
+		return 0;
+
+	EnterCriticalSection(&m_lock);
+
+	if (m_rgEntries == NULL)
+	{
+		m_rgEntries = new AllocEntry[m_nMaxHandles];
+
+		if (m_rgEntries == NULL)
+		{
+			LeaveCriticalSection(&m_lock);
+			return ERROR_MEMORY_OUT;
+		}
+	}
+
+	memset(m_rgEntries, 0, sizeof(AllocEntry) * m_nMaxHandles);
+
+	// Keep the labels, they are set once by the owners.
+	for (std::map<int, TagStats>::iterator it = m_rgTags.begin(); it != m_rgTags.end(); it++)
+	{
+		std::string strLabel = it->second.m_strLabel;
+		it->second = TagStats();
+		it->second.m_strLabel = strLabel;
+	}
+
+	m_llSeq = 0;
+	m_llLiveBytes = 0;
+	m_llHighWaterBytes = 0;
+	m_bEnabled = true;
+
+	LeaveCriticalSection(&m_lock);
+
+	return 0;
+}
+
+long AllocTracker::EnableFromEnvironment()
+{
+	char szValue[MAX_PATH + 1];
+
+	DWORD dwLen = GetEnvironmentVariableA(ALLOCTRACK_ENV, szValue, MAX_PATH);
+	if (dwLen == 0 || dwLen >= MAX_PATH)
+		return 0;
+
+	if (strcmp(szValue, "1") != 0)
+		strcpy(m_szReportFile, szValue);
+
+	return Enable(true);
+}
+
+long AllocTracker::SetTag(int nTag, LPCSTR pszLabel)
+{
+	if (nTag < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	EnterCriticalSection(&m_lock);
+
+	m_nTag = nTag;
+
+	if (pszLabel != NULL && pszLabel[0] != 0)
+		m_rgTags[nTag].m_strLabel = std::string(pszLabel).substr(0, ALLOCTRACK_MAX_LABEL);
+
+	LeaveCriticalSection(&m_lock);
+
+	return 0;
+}
+
+void AllocTracker::OnAlloc(long hHandle, LONGLONG llBytes)
+{
+	if (hHandle < 0 || hHandle >= m_nMaxHandles)
+		return;
+
+	LARGE_INTEGER liNow;
+	QueryPerformanceCounter(&liNow);
+
+	EnterCriticalSection(&m_lock);
+
+	if (m_rgEntries != NULL)
+	{
+		AllocEntry* pEntry = &m_rgEntries[hHandle];
+		TagStats* pStats = &m_rgTags[m_nTag];
+
+		pEntry->m_llBytes = llBytes;
+		pEntry->m_llTime = liNow.QuadPart;
+		pEntry->m_llSeq = m_llSeq++;
+		pEntry->m_nTag = m_nTag;
+
+		pStats->m_llAllocs++;
+		pStats->m_llLiveCount++;
+		pStats->m_llLiveBytes += llBytes;
+		if (pStats->m_llLiveBytes > pStats->m_llHighWaterBytes)
+			pStats->m_llHighWaterBytes = pStats->m_llLiveBytes;
+
+		m_llLiveBytes += llBytes;
+		if (m_llLiveBytes > m_llHighWaterBytes)
+			m_llHighWaterBytes = m_llLiveBytes;
+	}
+
+	LeaveCriticalSection(&m_lock);
+}
+
+void AllocTracker::OnFree(long hHandle)
+{
+	if (hHandle < 0 || hHandle >= m_nMaxHandles)
+		return;
+
+	EnterCriticalSection(&m_lock);
+
+	if (m_rgEntries != NULL && m_rgEntries[hHandle].m_llBytes > 0)
+	{
+		AllocEntry* pEntry = &m_rgEntries[hHandle];
+		TagStats* pStats = &m_rgTags[pEntry->m_nTag];
+
+		pStats->m_llFrees++;
+		pStats->m_llLiveCount--;
+		pStats->m_llLiveBytes -= pEntry->m_llBytes;
+		m_llLiveBytes -= pEntry->m_llBytes;
+
+		pEntry->m_llBytes = 0;
+	}
+
+	LeaveCriticalSection(&m_lock);
+}
+
+long AllocTracker::ToJson(std::string& str, bool bOutstanding)
+{
+	char szBuffer[1024];
+	LARGE_INTEGER liNow;
+	bool bFirst = true;
+
+	QueryPerformanceCounter(&liNow);
+
+	EnterCriticalSection(&m_lock);
+
+	_snprintf(szBuffer, 1023, "{\"enabled\":%s,\"live_bytes\":%lld,\"high_water_bytes\":%lld,\"tags\":[", (m_bEnabled) ? "true" : "false", m_llLiveBytes, m_llHighWaterBytes);
+	szBuffer[1023] = NULL;
+	str = szBuffer;
+
+	for (std::map<int, TagStats>::iterator it = m_rgTags.begin(); it != m_rgTags.end(); it++)
+	{
+		TagStats* pStats = &it->second;
+
+		if (pStats->m_llAllocs == 0)
+			continue;
+
+		_snprintf(szBuffer, 1023, "%s{\"tag\":%d,\"label\":", (bFirst) ? "" : ",", it->first);
+		szBuffer[1023] = NULL;
+		str += szBuffer;
+		appendJsonString(str, pStats->m_strLabel);
+
+		_snprintf(szBuffer, 1023, ",\"live_count\":%lld,\"live_bytes\":%lld,\"high_water_bytes\":%lld,\"allocs\":%lld,\"frees\":%lld}",
+			pStats->m_llLiveCount,
+			pStats->m_llLiveBytes,
+			pStats->m_llHighWaterBytes,
+			pStats->m_llAllocs,
+			pStats->m_llFrees);
+		szBuffer[1023] = NULL;
+		str += szBuffer;
+		bFirst = false;
+	}
+
+	str += "]";
+
+	if (bOutstanding)
+	{
+		std::vector<std::pair<LONGLONG, int>> rgOrder;
+
+		for (int i = 0; m_rgEntries != NULL && i < m_nMaxHandles; i++)
+		{
+			if (m_rgEntries[i].m_llBytes > 0)
+				rgOrder.push_back(std::make_pair(m_rgEntries[i].m_llSeq, i));
+		}
+
+		// The oldest allocations are listed first.
+		std::sort(rgOrder.begin(), rgOrder.end());
+
+		str += ",\"outstanding\":[";
+
+		for (size_t i = 0; i < rgOrder.size(); i++)
+		{
+			AllocEntry* pEntry = &m_rgEntries[rgOrder[i].second];
+			double dfAgeMs = (double)(liNow.QuadPart - pEntry->m_llTime) * 1000.0 / (double)m_liFreq.QuadPart;
+
+			_snprintf(szBuffer, 1023, "%s{\"handle\":%d,\"tag\":%d,\"bytes\":%lld,\"seq\":%lld,\"age_ms\":%.3lf}",
+				(i == 0) ? "" : ",",
+				rgOrder[i].second,
+				pEntry->m_nTag,
+				pEntry->m_llBytes,
+				pEntry->m_llSeq,
+				dfAgeMs);
+			szBuffer[1023] = NULL;
+			str += szBuffer;
+		}
+
+		str += "]";
+	}
+
+	str += "}";
+
+	LeaveCriticalSection(&m_lock);
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+//	Writes the stats and outstanding handles to the report file named by
+//	MYCAFFE_ALLOC_TRACE, or to the debug output when no file was given.
+//-----------------------------------------------------------------------------
+long AllocTracker::Report(LPCSTR pszOwner)
+{
+	LONG lErr;
+	std::string str;
+
+	if (!m_bEnabled)
+		return 0;
+
+	if (lErr = ToJson(str, true))
+		return lErr;
+
+	if (m_szReportFile[0] != 0)
+	{
+		FILE* pFile = fopen(m_szReportFile, "a");
+		if (pFile == NULL)
+			return ERROR_PARAM_NULL;
+
+		fprintf(pFile, "{\"owner\":\"%s\",\"report\":%s}\n", pszOwner, str.c_str());
+		fclose(pFile);
+	}
+	else
+	{
+		OutputDebugStringA("MyCaffe allocations (");
+		OutputDebugStringA(pszOwner);
+		OutputDebugStringA("): ");
+		OutputDebugStringA(str.c_str());
+		OutputDebugStringA("\n");
+	}
+
+	return 0;
+}
+
+// end
\ No newline at end of file
@@ -0,0 +1,143 @@
+//=============================================================================
+//	FILE:	alloctrack.h
+//
+//	DESC:	This file manages the allocation tracker used to attribute the
+//			GPU memory handles to their owners.
+//=============================================================================
+#ifndef __ALLOCTRACK_CU__
+#define __ALLOCTRACK_CU__
+
+#include "util.h"
+#include <string>
+#include <map>
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int ALLOCTRACK_MAX_LABEL = 31;
+const int ALLOCTRACK_UNTAGGED = 0;
+
+const LPCSTR ALLOCTRACK_ENV = "MYCAFFE_ALLOC_TRACE";
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Allocation Entry Class
+//
+//	The allocation made for a single live handle.
+//-----------------------------------------------------------------------------
+class AllocEntry
+{
+public:
+	LONGLONG m_llBytes;		// 0 when the handle is not tracked.
+	LONGLONG m_llTime;		// performance counter at allocation.
+	LONGLONG m_llSeq;
+	int m_nTag;
+};
+
+
+//-----------------------------------------------------------------------------
+//	Tag Stats Class
+//
+//	The live bytes, high-water mark and counts of a single tag.
+//-----------------------------------------------------------------------------
+class TagStats
+{
+public:
+	std::string m_strLabel;
+	LONGLONG m_llLiveBytes;
+	LONGLONG m_llHighWaterBytes;
+	LONGLONG m_llLiveCount;
+	LONGLONG m_llAllocs;
+	LONGLONG m_llFrees;
+
+	TagStats()
+	{
+		m_llLiveBytes = 0;
+		m_llHighWaterBytes = 0;
+		m_llLiveCount = 0;
+		m_llAllocs = 0;
+		m_llFrees = 0;
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+//	Allocation Tracker Class
+//
+//	Attributes each memory handle to the tag that was current when it was
+//	allocated, so that the outstanding handles and the live and high-water
+//	bytes can be reported per owner.  Callers set the current tag (with an
+//	optional short label) before allocating for a layer, and 0 is used for
+//	untagged allocations.  The tracker is started when the handle table
+//	is created if MYCAFFE_ALLOC_TRACE is set, where a value other than 1
+//	names a file that the outstanding handles are appended to at CleanUp.
+//	When disabled, the cost to each allocation is the test of IsEnabled.
+//-----------------------------------------------------------------------------
+class AllocTracker
+{
+	volatile bool m_bEnabled;
+	int m_nMaxHandles;
+	int m_nTag;
+	AllocEntry* m_rgEntries;
+	std::map<int, TagStats> m_rgTags;
+	LONGLONG m_llSeq;
+	LONGLONG m_llLiveBytes;
+	LONGLONG m_llHighWaterBytes;
+	LARGE_INTEGER m_liFreq;
+	CRITICAL_SECTION m_lock;
+	char m_szReportFile[MAX_PATH + 1];
+
+public:
+	AllocTracker(int nMaxHandles)
+	{
+		m_bEnabled = false;
+		m_nMaxHandles = nMaxHandles;
+		m_nTag = ALLOCTRACK_UNTAGGED;
+		m_rgEntries = NULL;
+		m_llSeq = 0;
+		m_llLiveBytes = 0;
+		m_llHighWaterBytes = 0;
+		m_szReportFile[0] = 0;
+		QueryPerformanceFrequency(&m_liFreq);
+		InitializeCriticalSection(&m_lock);
+	}
+
+	~AllocTracker()
+	{
+		CleanUp();
+		DeleteCriticalSection(&m_lock);
+	}
+
+	void CleanUp();
+
+	bool IsEnabled()
+	{
+		return m_bEnabled;
+	}
+
+	long Enable(bool bEnable);
+	long EnableFromEnvironment();
+	long SetTag(int nTag, LPCSTR pszLabel);
+
+	void OnAlloc(long hHandle, LONGLONG llBytes);
+	void OnFree(long hHandle);
+
+	long ToJson(std::string& str, bool bOutstanding);
+	long Report(LPCSTR pszOwner);
+};
+
+
+//=============================================================================
+//	Inline Methods
+//=============================================================================
+
+
+#endif
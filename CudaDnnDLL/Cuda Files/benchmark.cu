@@ -0,0 +1,150 @@
+//=============================================================================
+//	FILE:	benchmark.cu
+//
+//	DESC:	This file implements the benchmark runner used to time the host
+//			side and dispatch hot paths of the kernel.
+//=============================================================================
+
+#include "util.h"
+#include "benchmark.h"
+#include <algorithm>
+#include <time.h>
+
+//=============================================================================
+//	BenchmarkRunner Methods
+//=============================================================================
+
+double BenchmarkRunner::cpuTime()
+{
+	FILETIME ftCreate;
+	FILETIME ftExit;
+	FILETIME ftKernel;
+	FILETIME ftUser;
+
+	if (!GetThreadTimes(GetCurrentThread(), &ftCreate, &ftExit, &ftKernel, &ftUser))
+		return 0;
+
+	ULARGE_INTEGER liKernel;
+	ULARGE_INTEGER liUser;
+
+	liKernel.LowPart = ftKernel.dwLowDateTime;
+	liKernel.HighPart = ftKernel.dwHighDateTime;
+	liUser.LowPart = ftUser.dwLowDateTime;
+	liUser.HighPart = ftUser.dwHighDateTime;
+
+	// FILETIME is in 100ns units.
+	return (double)(liKernel.QuadPart + liUser.QuadPart) * 100.0;
+}
+
+void BenchmarkRunner::addResult(LPCSTR pszName, LPCSTR pszType, long lSize, LONGLONG llIterations, std::vector<double>& rgdfRealNs, std::vector<double>& rgdfCpuNs, double dfItemsPerIteration)
+{
+	char szName[256];
+	char szBuffer[1024];
+	int nReps = (int)rgdfRealNs.size();
+
+	_snprintf(szName, 255, "%s<%s>/%ld", pszName, pszType, lSize);
+	szName[255] = NULL;
+
+	for (int i = 0; i < nReps; i++)
+	{
+		double dfItemsPerSec = (rgdfRealNs[i] > 0) ? dfItemsPerIteration * 1000000000.0 / rgdfRealNs[i] : 0;
+
+		_snprintf(szBuffer, 1023, "%s{\"name\":\"%s\",\"run_name\":\"%s\",\"run_type\":\"iteration\",\"repetitions\":%d,\"repetition_index\":%d,\"threads\":1,\"iterations\":%lld,\"real_time\":%.3lf,\"cpu_time\":%.3lf,\"time_unit\":\"ns\",\"items_per_second\":%.3lf}",
+			(m_nCount == 0) ? "" : ",",
+			szName,
+			szName,
+			nReps,
+			i,
+			llIterations,
+			rgdfRealNs[i],
+			rgdfCpuNs[i],
+			dfItemsPerSec);
+		szBuffer[1023] = NULL;
+		m_strResults += szBuffer;
+		m_nCount++;
+	}
+
+	if (nReps < 2)
+		return;
+
+	double dfRealMean = 0;
+	double dfCpuMean = 0;
+
+	for (int i = 0; i < nReps; i++)
+	{
+		dfRealMean += rgdfRealNs[i];
+		dfCpuMean += rgdfCpuNs[i];
+	}
+
+	dfRealMean /= nReps;
+	dfCpuMean /= nReps;
+
+	double dfRealVar = 0;
+	double dfCpuVar = 0;
+
+	for (int i = 0; i < nReps; i++)
+	{
+		dfRealVar += (rgdfRealNs[i] - dfRealMean) * (rgdfRealNs[i] - dfRealMean);
+		dfCpuVar += (rgdfCpuNs[i] - dfCpuMean) * (rgdfCpuNs[i] - dfCpuMean);
+	}
+
+	std::vector<double> rgdfRealSorted(rgdfRealNs);
+	std::vector<double> rgdfCpuSorted(rgdfCpuNs);
+	std::sort(rgdfRealSorted.begin(), rgdfRealSorted.end());
+	std::sort(rgdfCpuSorted.begin(), rgdfCpuSorted.end());
+
+	double rgdfReal[3] = { dfRealMean, rgdfRealSorted[nReps / 2], sqrt(dfRealVar / (nReps - 1)) };
+	double rgdfCpu[3] = { dfCpuMean, rgdfCpuSorted[nReps / 2], sqrt(dfCpuVar / (nReps - 1)) };
+	LPCSTR rgszAggregate[3] = { "mean", "median", "stddev" };
+
+	for (int i = 0; i < 3; i++)
+	{
+		_snprintf(szBuffer, 1023, ",{\"name\":\"%s_%s\",\"run_name\":\"%s\",\"run_type\":\"aggregate\",\"repetitions\":%d,\"threads\":1,\"aggregate_name\":\"%s\",\"iterations\":%d,\"real_time\":%.3lf,\"cpu_time\":%.3lf,\"time_unit\":\"ns\"}",
+			szName,
+			rgszAggregate[i],
+			szName,
+			nReps,
+			rgszAggregate[i],
+			nReps,
+			rgdfReal[i],
+			rgdfCpu[i]);
+		szBuffer[1023] = NULL;
+		m_strResults += szBuffer;
+	}
+}
+
+long BenchmarkRunner::ToJson(LPCSTR pszDevice, std::string& str)
+{
+	char szBuffer[1024];
+	char szDate[64];
+	SYSTEM_INFO si;
+	time_t t = time(NULL);
+	struct tm tmNow;
+
+	GetSystemInfo(&si);
+	localtime_s(&tmNow, &t);
+	strftime(szDate, 63, "%Y-%m-%dT%H:%M:%S", &tmNow);
+
+#ifdef _DEBUG
+	LPCSTR pszBuild = "debug";
+#else
+	LPCSTR pszBuild = "release";
+#endif
+
+	_snprintf(szBuffer, 1023, "{\"context\":{\"date\":\"%s\",\"executable\":\"CudaDnnDll\",\"device\":\"%s\",\"num_cpus\":%u,\"library_build_type\":\"%s\",\"min_time_ms\":%d,\"max_size\":%d},\"benchmarks\":[",
+		szDate,
+		(pszDevice == NULL) ? "" : pszDevice,
+		si.dwNumberOfProcessors,
+		pszBuild,
+		m_nMinTimeMs,
+		m_nMaxSize);
+	szBuffer[1023] = NULL;
+
+	str = szBuffer;
+	str += m_strResults;
+	str += "]}";
+
+	return 0;
+}
+
+// end
\ No newline at end of file
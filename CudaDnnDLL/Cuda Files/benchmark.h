@@ -0,0 +1,157 @@
+//=============================================================================
+//	FILE:	benchmark.h
+//
+//	DESC:	This file manages the benchmark runner used to time the host side
+//			and dispatch hot paths of the kernel.
+//=============================================================================
+#ifndef __BENCHMARK_CU__
+#define __BENCHMARK_CU__
+
+#include "util.h"
+#include <string>
+#include <vector>
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+const int BENCH_SUITE_DISPATCH		= 0x0001;
+const int BENCH_SUITE_HANDLES		= 0x0002;
+const int BENCH_SUITE_ALLOCATOR		= 0x0004;
+const int BENCH_SUITE_VPTREE		= 0x0008;
+const int BENCH_SUITE_SPTREE		= 0x0010;
+const int BENCH_SUITE_SYMMETRIZE	= 0x0020;
+const int BENCH_SUITE_TSNE_HOST		= 0x0040;
+const int BENCH_SUITE_HOST_BLAS		= 0x0080;
+const int BENCH_SUITE_ALL			= 0x00FF;
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int BENCH_DEFAULT_MIN_TIME_MS = 500;
+const int BENCH_DEFAULT_REPETITIONS = 3;
+const int BENCH_DEFAULT_MAX_SIZE = 4096;
+const int BENCH_MIN_SIZE = 64;
+const LONGLONG BENCH_MAX_ITERATIONS = 1000000000;
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Benchmark Runner Class
+//
+//	Times a benchmark body the way Google Benchmark does: the iteration count
+//	grows until a run takes at least the minimum time, then that count is
+//	run once per repetition.  The results are written in the Google
+//	Benchmark JSON format so that its compare tools can diff two runs.
+//
+//	The body is any callable taking the number of iterations to run and
+//	returning an error code, which ends the benchmark when not 0.
+//-----------------------------------------------------------------------------
+class BenchmarkRunner
+{
+	int m_nSuites;
+	int m_nMinTimeMs;
+	int m_nRepetitions;
+	int m_nMaxSize;
+	int m_nCount;
+	std::string m_strResults;
+	LARGE_INTEGER m_liFreq;
+
+	static double cpuTime();
+	void addResult(LPCSTR pszName, LPCSTR pszType, long lSize, LONGLONG llIterations, std::vector<double>& rgdfRealNs, std::vector<double>& rgdfCpuNs, double dfItemsPerIteration);
+
+public:
+	BenchmarkRunner(int nSuites, int nMinTimeMs, int nRepetitions, int nMaxSize)
+	{
+		m_nSuites = (nSuites <= 0) ? BENCH_SUITE_ALL : nSuites;
+		m_nMinTimeMs = (nMinTimeMs <= 0) ? BENCH_DEFAULT_MIN_TIME_MS : nMinTimeMs;
+		m_nRepetitions = (nRepetitions <= 0) ? BENCH_DEFAULT_REPETITIONS : nRepetitions;
+		m_nMaxSize = (nMaxSize < BENCH_MIN_SIZE) ? BENCH_DEFAULT_MAX_SIZE : nMaxSize;
+		m_nCount = 0;
+		QueryPerformanceFrequency(&m_liFreq);
+	}
+
+	bool IsSelected(int nSuite)
+	{
+		return (m_nSuites & nSuite) ? true : false;
+	}
+
+	int MinSize()
+	{
+		return BENCH_MIN_SIZE;
+	}
+
+	int MaxSize()
+	{
+		return m_nMaxSize;
+	}
+
+	template <class F>
+	long Run(LPCSTR pszName, LPCSTR pszType, long lSize, double dfItemsPerIteration, F fn);
+
+	long ToJson(LPCSTR pszDevice, std::string& str);
+};
+
+
+//=============================================================================
+//	Inline Methods
+//=============================================================================
+
+template <class F>
+inline long BenchmarkRunner::Run(LPCSTR pszName, LPCSTR pszType, long lSize, double dfItemsPerIteration, F fn)
+{
+	LONG lErr;
+	LONGLONG llIterations = 1;
+	LARGE_INTEGER liStart;
+	LARGE_INTEGER liEnd;
+	std::vector<double> rgdfRealNs;
+	std::vector<double> rgdfCpuNs;
+
+	// Find the iteration count that runs for at least the minimum time.
+	for (;;)
+	{
+		QueryPerformanceCounter(&liStart);
+		if (lErr = fn(llIterations))
+			return lErr;
+		QueryPerformanceCounter(&liEnd);
+
+		double dfMs = (double)(liEnd.QuadPart - liStart.QuadPart) * 1000.0 / (double)m_liFreq.QuadPart;
+
+		if (dfMs >= m_nMinTimeMs || llIterations >= BENCH_MAX_ITERATIONS)
+			break;
+
+		double dfScale = (dfMs <= 0) ? 10.0 : (m_nMinTimeMs * 1.4) / dfMs;
+
+		if (dfScale > 10.0)
+			dfScale = 10.0;
+		else if (dfScale < 2.0)
+			dfScale = 2.0;
+
+		llIterations = (LONGLONG)(llIterations * dfScale);
+
+		if (llIterations > BENCH_MAX_ITERATIONS)
+			llIterations = BENCH_MAX_ITERATIONS;
+	}
+
+	for (int i = 0; i < m_nRepetitions; i++)
+	{
+		double dfCpuStart = cpuTime();
+		QueryPerformanceCounter(&liStart);
+		if (lErr = fn(llIterations))
+			return lErr;
+		QueryPerformanceCounter(&liEnd);
+		double dfCpuEnd = cpuTime();
+
+		rgdfRealNs.push_back((double)(liEnd.QuadPart - liStart.QuadPart) * 1000000000.0 / (double)m_liFreq.QuadPart / (double)llIterations);
+		rgdfCpuNs.push_back((dfCpuEnd - dfCpuStart) / (double)llIterations);
+	}
+
+	addResult(pszName, pszType, lSize, llIterations, rgdfRealNs, rgdfCpuNs, dfItemsPerIteration);
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,476 @@
+//=============================================================================
+//	FILE:	convalgo.cu
+//
+//	DESC:	This file implements the persistent cache of the convolution
+//			algorithms chosen for each layer geometry.
+//=============================================================================
+
+#include "util.h"
+#include "convalgo.h"
+#include <stdio.h>
+#include <cudnn.h>
+
+//=============================================================================
+//	Globals
+//=============================================================================
+
+ConvAlgoCache g_convAlgoCache;
+
+
+//=============================================================================
+//	Local Functions
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Writes a new file holding just the header, replacing any existing file.
+//-----------------------------------------------------------------------------
+static long createFile(LPCSTR pszFile)
+{
+	FILE* pFile = fopen(pszFile, "wb");
+	if (pFile == NULL)
+		return ERROR_PARAM_NULL;
+
+	CONVALGO_HEADER hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.dwMagic = CONVALGO_MAGIC;
+	hdr.dwVersion = CONVALGO_VERSION;
+	hdr.dwCudnnVersion = (DWORD)cudnnGetVersion();
+	hdr.dwKeySize = sizeof(CONVALGO_KEY);
+	hdr.dwValueSize = sizeof(CONVALGO_VALUE);
+
+	fwrite(&hdr, sizeof(hdr), 1, pFile);
+	fclose(pFile);
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+//	Returns the size of a file in bytes, or -1 when it cannot be opened.
+//-----------------------------------------------------------------------------
+static long getFileSize(LPCSTR pszFile)
+{
+	FILE* pFile = fopen(pszFile, "rb");
+	if (pFile == NULL)
+		return -1;
+
+	fseek(pFile, 0, SEEK_END);
+	long lSize = ftell(pFile);
+	fclose(pFile);
+
+	return lSize;
+}
+
+
+//=============================================================================
+//	ConvAlgoCache Methods
+//=============================================================================
+
+long ConvAlgoCache::InitKey(int nDevice, CONVALGO_KEY* pKey)
+{
+	LONG lErr;
+
+	if (nDevice < 0 || nDevice >= CONVALGO_MAX_DEVICES)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	memset(pKey, 0, sizeof(CONVALGO_KEY));
+
+	EnterCriticalSection(&m_lock);
+
+	if (m_rgstrDevices[nDevice].length() == 0)
+	{
+		cudaDeviceProp prop;
+
+		if (lErr = cudaGetDeviceProperties(&prop, nDevice))
+		{
+			LeaveCriticalSection(&m_lock);
+			return lErr;
+		}
+
+		m_rgstrDevices[nDevice] = prop.name;
+	}
+
+	strncpy(pKey->szDevice, m_rgstrDevices[nDevice].c_str(), CONVALGO_MAX_DEVICE_NAME - 1);
+
+	LeaveCriticalSection(&m_lock);
+
+	return 0;
+}
+
+void ConvAlgoCache::load()
+{
+	EnterCriticalSection(&m_lock);
+
+	if (m_bLoaded)
+	{
+		LeaveCriticalSection(&m_lock);
+		return;
+	}
+
+	m_bPersist = false;
+	m_szFile[0] = 0;
+
+	char szFile[MAX_PATH + 1];
+	DWORD dwLen = GetEnvironmentVariableA(CONVALGO_ENV_FILE, szFile, MAX_PATH);
+
+	if (dwLen > 0 && dwLen < MAX_PATH)
+	{
+		if (strcmp(szFile, "0") != 0)
+		{
+			strcpy(m_szFile, szFile);
+			m_bPersist = true;
+		}
+	}
+	else
+	{
+		dwLen = GetEnvironmentVariableA("LOCALAPPDATA", szFile, MAX_PATH);
+
+		if (dwLen > 0 && dwLen + strlen(CONVALGO_DEFAULT_DIR) + strlen(CONVALGO_DEFAULT_FILE) + 2 < MAX_PATH)
+		{
+			strcat(szFile, "\\");
+			strcat(szFile, CONVALGO_DEFAULT_DIR);
+			CreateDirectoryA(szFile, NULL);
+
+			_snprintf(m_szFile, MAX_PATH, "%s\\%s", szFile, CONVALGO_DEFAULT_FILE);
+			m_szFile[MAX_PATH] = 0;
+			m_bPersist = true;
+		}
+	}
+
+	open();
+	m_bLoaded = true;
+
+	LeaveCriticalSection(&m_lock);
+}
+
+//-----------------------------------------------------------------------------
+//	Loads the entries of the current file, a missing or mismatched file is
+//	replaced with an empty one.  The lock must be held.
+//-----------------------------------------------------------------------------
+void ConvAlgoCache::open()
+{
+	if (m_bPersist && loadFile(m_szFile) != 0)
+	{
+		if (createFile(m_szFile) != 0)
+			m_bPersist = false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Clears the entries and stats.  The lock must be held.
+//-----------------------------------------------------------------------------
+void ConvAlgoCache::reset()
+{
+	m_rgEntries.clear();
+	m_llHits = 0;
+	m_llMisses = 0;
+	m_llLoaded = 0;
+	m_llSelectTicks = 0;
+}
+
+long ConvAlgoCache::loadFile(LPCSTR pszFile)
+{
+	FILE* pFile = fopen(pszFile, "rb");
+	if (pFile == NULL)
+		return ERROR_PARAM_NULL;
+
+	CONVALGO_HEADER hdr;
+
+	if (fread(&hdr, sizeof(hdr), 1, pFile) != 1 ||
+		hdr.dwMagic != CONVALGO_MAGIC ||
+		hdr.dwVersion != CONVALGO_VERSION ||
+		hdr.dwCudnnVersion != (DWORD)cudnnGetVersion() ||
+		hdr.dwKeySize != sizeof(CONVALGO_KEY) ||
+		hdr.dwValueSize != sizeof(CONVALGO_VALUE))
+	{
+		fclose(pFile);
+		return ERROR_PARAM_OUT_OF_RANGE;
+	}
+
+	CONVALGO_KEY key;
+	CONVALGO_VALUE val;
+	size_t lRead = 0;
+
+	// A partially written entry at the end is ignored, and the last
+	// entry wins when a key was selected again after a Clear.
+	while (fread(&key, sizeof(key), 1, pFile) == 1 && fread(&val, sizeof(val), 1, pFile) == 1)
+	{
+		m_rgEntries[key] = val;
+		lRead++;
+	}
+
+	fclose(pFile);
+
+	m_llLoaded = (LONGLONG)m_rgEntries.size();
+
+	if (lRead > m_rgEntries.size())
+		return rewriteFile(pszFile);
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+//	Replaces the file with the header followed by the current entries.
+//-----------------------------------------------------------------------------
+long ConvAlgoCache::rewriteFile(LPCSTR pszFile)
+{
+	LONG lErr;
+
+	if (lErr = createFile(pszFile))
+		return lErr;
+
+	FILE* pFile = fopen(pszFile, "ab");
+	if (pFile == NULL)
+		return ERROR_PARAM_NULL;
+
+	std::map<CONVALGO_KEY, CONVALGO_VALUE>::iterator it;
+
+	for (it = m_rgEntries.begin(); it != m_rgEntries.end(); it++)
+	{
+		fwrite(&it->first, sizeof(CONVALGO_KEY), 1, pFile);
+		fwrite(&it->second, sizeof(CONVALGO_VALUE), 1, pFile);
+	}
+
+	fclose(pFile);
+
+	return 0;
+}
+
+void ConvAlgoCache::append(const CONVALGO_KEY& key, const CONVALGO_VALUE& val)
+{
+	if (!m_bPersist)
+		return;
+
+	FILE* pFile = fopen(m_szFile, "ab");
+	if (pFile == NULL)
+		return;
+
+	fwrite(&key, sizeof(key), 1, pFile);
+	fwrite(&val, sizeof(val), 1, pFile);
+	fclose(pFile);
+}
+
+long ConvAlgoCache::Clear(bool bDeleteFile)
+{
+	LONG lErr = 0;
+
+	EnterCriticalSection(&m_lock);
+
+	reset();
+
+	if (bDeleteFile && m_bPersist)
+		lErr = createFile(m_szFile);
+
+	LeaveCriticalSection(&m_lock);
+
+	return lErr;
+}
+
+//-----------------------------------------------------------------------------
+//	Clears the entries and loads them from a new file, "0" only caches
+//	within the process and NULL or an empty name returns to the file named
+//	by the environment on the next lookup.
+//-----------------------------------------------------------------------------
+long ConvAlgoCache::SetFile(LPCSTR pszFile)
+{
+	if (pszFile != NULL && strlen(pszFile) >= MAX_PATH)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	EnterCriticalSection(&m_lock);
+
+	reset();
+
+	if (pszFile == NULL || pszFile[0] == 0)
+	{
+		m_bPersist = false;
+		m_szFile[0] = 0;
+		m_bLoaded = false;
+	}
+	else
+	{
+		m_bPersist = (strcmp(pszFile, "0") != 0) ? true : false;
+		strcpy(m_szFile, (m_bPersist) ? pszFile : "");
+		open();
+		m_bLoaded = true;
+	}
+
+	LeaveCriticalSection(&m_lock);
+
+	return 0;
+}
+
+long ConvAlgoCache::ToJson(std::string& str)
+{
+	char szBuffer[1024];
+
+	EnterCriticalSection(&m_lock);
+
+	double dfSelectMs = (double)m_llSelectTicks * 1000.0 / (double)m_liFreq.QuadPart;
+
+	_snprintf(szBuffer, 1023, "{\"entries\":%u,\"loaded\":%lld,\"hits\":%lld,\"misses\":%lld,\"select_ms\":%.3lf,\"persist\":%s,\"file\":\"",
+		(unsigned)m_rgEntries.size(),
+		m_llLoaded,
+		m_llHits,
+		m_llMisses,
+		dfSelectMs,
+		(m_bPersist) ? "true" : "false");
+	szBuffer[1023] = NULL;
+	str = szBuffer;
+
+	for (int i = 0; m_bPersist && m_szFile[i] != 0; i++)
+	{
+		if (m_szFile[i] == '\\' || m_szFile[i] == '"')
+			str += '\\';
+
+		str += m_szFile[i];
+	}
+
+	str += "\"}";
+
+	LeaveCriticalSection(&m_lock);
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+//	Runs the cache on a stub selector over separate instances that share the
+//	given file, and returns the number of the first check that failed, or 0
+//	when all pass.
+//-----------------------------------------------------------------------------
+int ConvAlgoCache::checkFile(LPCSTR pszFile)
+{
+	int nCalls = 0;
+	int nCheck = 0;
+	long lEntrySize = (long)(sizeof(CONVALGO_KEY) + sizeof(CONVALGO_VALUE));
+	CONVALGO_KEY key1;
+	CONVALGO_KEY key2;
+	CONVALGO_VALUE val;
+
+	memset(&key1, 0, sizeof(key1));
+	strcpy(key1.szDevice, "stub");
+	key1.rgBottom[0] = 1;
+	key2 = key1;
+	key2.rgBottom[0] = 2;
+
+	auto fnSelect = [&](CONVALGO_VALUE* pVal) -> long
+	{
+		nCalls++;
+		memset(pVal, 0, sizeof(CONVALGO_VALUE));
+		pVal->llAlgoFwd = nCalls;
+		pVal->llWsSizeFwd = 1024 * nCalls;
+		return 0;
+	};
+
+	auto fnFail = [&](CONVALGO_VALUE* pVal) -> long
+	{
+		nCalls++;
+		return ERROR_PARAM_OUT_OF_RANGE;
+	};
+
+	// Entries are selected once, errors from the selector are not cached.
+	{
+		ConvAlgoCache cache;
+
+		nCheck++;
+		if (cache.SetFile(pszFile) != 0)
+			return nCheck;
+
+		nCheck++;
+		if (cache.Find(key1, &val, fnSelect) != 0 || nCalls != 1 || val.llAlgoFwd != 1)
+			return nCheck;
+
+		nCheck++;
+		if (cache.Find(key1, &val, fnSelect) != 0 || nCalls != 1 || val.llAlgoFwd != 1 || cache.m_llHits != 1)
+			return nCheck;
+
+		nCheck++;
+		if (cache.Find(key2, &val, fnFail) == 0 || nCalls != 2 || cache.m_rgEntries.size() != 1)
+			return nCheck;
+
+		nCheck++;
+		if (cache.Find(key2, &val, fnSelect) != 0 || nCalls != 3 || val.llAlgoFwd != 3 || cache.m_llMisses != 2)
+			return nCheck;
+
+		nCheck++;
+		if (getFileSize(pszFile) != (long)sizeof(CONVALGO_HEADER) + 2 * lEntrySize)
+			return nCheck;
+
+		// Selecting again after a Clear appends the new entry.
+		cache.Clear(false);
+
+		nCheck++;
+		if (cache.Find(key1, &val, fnSelect) != 0 || nCalls != 4 || val.llAlgoFwd != 4)
+			return nCheck;
+	}
+
+	// A new instance loads the entries, keeping the last of the duplicates
+	// and rewriting the file without them.
+	{
+		ConvAlgoCache cache;
+
+		nCheck++;
+		if (cache.SetFile(pszFile) != 0)
+			return nCheck;
+
+		nCheck++;
+		if (cache.m_llLoaded != 2 || getFileSize(pszFile) != (long)sizeof(CONVALGO_HEADER) + 2 * lEntrySize)
+			return nCheck;
+
+		nCheck++;
+		if (cache.Find(key1, &val, fnSelect) != 0 || nCalls != 4 || val.llAlgoFwd != 4 || cache.m_llHits != 1)
+			return nCheck;
+
+		nCheck++;
+		if (cache.Find(key2, &val, fnSelect) != 0 || nCalls != 4 || val.llAlgoFwd != 3)
+			return nCheck;
+	}
+
+	// A file written by another version is discarded.
+	{
+		FILE* pFile = fopen(pszFile, "r+b");
+		CONVALGO_HEADER hdr;
+
+		nCheck++;
+		if (pFile == NULL)
+			return nCheck;
+
+		fread(&hdr, sizeof(hdr), 1, pFile);
+		hdr.dwVersion = CONVALGO_VERSION + 1;
+		fseek(pFile, 0, SEEK_SET);
+		fwrite(&hdr, sizeof(hdr), 1, pFile);
+		fclose(pFile);
+
+		ConvAlgoCache cache;
+
+		nCheck++;
+		if (cache.SetFile(pszFile) != 0)
+			return nCheck;
+
+		nCheck++;
+		if (cache.m_llLoaded != 0 || cache.m_rgEntries.size() != 0 || getFileSize(pszFile) != (long)sizeof(CONVALGO_HEADER))
+			return nCheck;
+
+		nCheck++;
+		if (cache.Find(key1, &val, fnSelect) != 0 || nCalls != 5 || val.llAlgoFwd != 5)
+			return nCheck;
+	}
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+//	Checks the cache on a stub selector, see checkFile.  The file is deleted
+//	before and after the checks.
+//-----------------------------------------------------------------------------
+long ConvAlgoCache::Check(LPCSTR pszFile, int* pnFailed)
+{
+	if (pszFile == NULL || pszFile[0] == 0)
+		return ERROR_PARAM_NULL;
+
+	DeleteFileA(pszFile);
+	*pnFailed = checkFile(pszFile);
+	DeleteFileA(pszFile);
+
+	return 0;
+}
+
+// end
\ No newline at end of file
@@ -0,0 +1,210 @@
+//=============================================================================
+//	FILE:	convalgo.h
+//
+//	DESC:	This file manages the persistent cache of the convolution
+//			algorithms chosen for each layer geometry.
+//=============================================================================
+#ifndef __CONVALGO_CU__
+#define __CONVALGO_CU__
+
+#include "util.h"
+#include <string>
+#include <map>
+#include <set>
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const DWORD CONVALGO_MAGIC = 0x43414D4D;		// 'MMAC'
+const DWORD CONVALGO_VERSION = 1;
+const int CONVALGO_MAX_DEVICES = 64;
+const int CONVALGO_MAX_DEVICE_NAME = 64;
+
+const LPCSTR CONVALGO_ENV_FILE = "MYCAFFE_CONV_ALGO_CACHE";
+const LPCSTR CONVALGO_DEFAULT_DIR = "MyCaffe";
+const LPCSTR CONVALGO_DEFAULT_FILE = "conv_algo.cache";
+
+//=============================================================================
+//	Types
+//=============================================================================
+
+#pragma pack(push, 1)
+
+//-----------------------------------------------------------------------------
+//	The file starts with a single header followed by one key and value per
+//	entry, entries are appended as they are selected.  A file written by
+//	a different version of this cache or of cuDNN is discarded.
+//-----------------------------------------------------------------------------
+typedef struct CONVALGO_HEADER
+{
+	DWORD dwMagic;
+	DWORD dwVersion;
+	DWORD dwCudnnVersion;
+	DWORD dwKeySize;
+	DWORD dwValueSize;
+	DWORD dwReserved;
+} CONVALGO_HEADER;
+
+typedef struct CONVALGO_KEY
+{
+	char szDevice[CONVALGO_MAX_DEVICE_NAME];
+	int nDataType;
+	int rgBottom[8];	// n, c, h, w, stride n, stride c, stride h, stride w
+	int rgFilter[5];	// k, c, h, w, format
+	int rgConv[8];		// pad h, pad w, stride h, stride w, dilation h, dilation w, mode, compute type
+	int rgTop[8];
+	LONGLONG llWsLimitInBytes;
+} CONVALGO_KEY;
+
+typedef struct CONVALGO_VALUE
+{
+	LONGLONG llAlgoFwd;
+	LONGLONG llWsSizeFwd;
+	LONGLONG llAlgoBwdFilter;
+	LONGLONG llWsSizeBwdFilter;
+	LONGLONG llAlgoBwdData;
+	LONGLONG llWsSizeBwdData;
+} CONVALGO_VALUE;
+
+#pragma pack(pop)
+
+inline bool operator<(const CONVALGO_KEY& a, const CONVALGO_KEY& b)
+{
+	return memcmp(&a, &b, sizeof(CONVALGO_KEY)) < 0;
+}
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Convolution Algorithm Cache Class
+//
+//	Memoises the algorithms and workspace sizes chosen for each convolution
+//	geometry so that they are only selected once per device, rather than on
+//	every net load and reshape.  The entries are shared by all kernels and
+//	persist to the file named by MYCAFFE_CONV_ALGO_CACHE (by default the
+//	MyCaffe folder under LOCALAPPDATA), set it to 0 to only cache within
+//	the process.  The file is loaded on the first lookup, SetFile switches
+//	to another file.  Entries selected again after a Clear are appended
+//	again, the last one wins when the file is loaded and the file is then
+//	rewritten without the duplicates.
+//
+//	The selector is any callable taking a CONVALGO_VALUE* to fill and
+//	returning an error code, entries are only added when it returns 0.
+//-----------------------------------------------------------------------------
+class ConvAlgoCache
+{
+	std::map<CONVALGO_KEY, CONVALGO_VALUE> m_rgEntries;
+	std::string m_rgstrDevices[CONVALGO_MAX_DEVICES];
+	CRITICAL_SECTION m_lock;
+	volatile bool m_bLoaded;
+	bool m_bPersist;
+	char m_szFile[MAX_PATH + 1];
+	LONGLONG m_llHits;
+	LONGLONG m_llMisses;
+	LONGLONG m_llLoaded;
+	LONGLONG m_llSelectTicks;
+	LARGE_INTEGER m_liFreq;
+
+	void load();
+	void open();
+	long loadFile(LPCSTR pszFile);
+	long rewriteFile(LPCSTR pszFile);
+	void append(const CONVALGO_KEY& key, const CONVALGO_VALUE& val);
+	void reset();
+
+	static int checkFile(LPCSTR pszFile);
+
+public:
+	ConvAlgoCache()
+	{
+		m_bLoaded = false;
+		m_bPersist = false;
+		m_szFile[0] = 0;
+		m_llHits = 0;
+		m_llMisses = 0;
+		m_llLoaded = 0;
+		m_llSelectTicks = 0;
+		QueryPerformanceFrequency(&m_liFreq);
+		InitializeCriticalSection(&m_lock);
+	}
+
+	~ConvAlgoCache()
+	{
+		DeleteCriticalSection(&m_lock);
+	}
+
+	long InitKey(int nDevice, CONVALGO_KEY* pKey);
+
+	template <class F>
+	long Find(const CONVALGO_KEY& key, CONVALGO_VALUE* pVal, F fnSelect);
+
+	long Clear(bool bDeleteFile);
+	long SetFile(LPCSTR pszFile);
+	long ToJson(std::string& str);
+
+	static long Check(LPCSTR pszFile, int* pnFailed);
+};
+
+extern ConvAlgoCache g_convAlgoCache;
+
+
+//=============================================================================
+//	Inline Methods
+//=============================================================================
+
+template <class F>
+inline long ConvAlgoCache::Find(const CONVALGO_KEY& key, CONVALGO_VALUE* pVal, F fnSelect)
+{
+	LONG lErr;
+
+	if (!m_bLoaded)
+		load();
+
+	EnterCriticalSection(&m_lock);
+
+	std::map<CONVALGO_KEY, CONVALGO_VALUE>::iterator it = m_rgEntries.find(key);
+	if (it != m_rgEntries.end())
+	{
+		*pVal = it->second;
+		m_llHits++;
+		LeaveCriticalSection(&m_lock);
+		return 0;
+	}
+
+	LeaveCriticalSection(&m_lock);
+
+	// Select outside of the lock, the selection may take a while.
+	LARGE_INTEGER liStart;
+	LARGE_INTEGER liEnd;
+
+	QueryPerformanceCounter(&liStart);
+	lErr = fnSelect(pVal);
+	QueryPerformanceCounter(&liEnd);
+
+	if (lErr)
+		return lErr;
+
+	EnterCriticalSection(&m_lock);
+
+	m_llMisses++;
+	m_llSelectTicks += liEnd.QuadPart - liStart.QuadPart;
+
+	if (m_rgEntries.find(key) == m_rgEntries.end())
+	{
+		m_rgEntries[key] = *pVal;
+		append(key, *pVal);
+	}
+
+	LeaveCriticalSection(&m_lock);
+
+	return 0;
+}
+
+#endif
@@ -6,6 +6,9 @@
 //=============================================================================
 
 #include "device.h"
+#include "benchmark.h"
+#include "hostblas.h"
+#include "hostkernels.h"
 #include <nvapi.h>
 
 
@@ -524,6 +527,42 @@ long Device<T>::GetDeviceInfo(long lInput, LONG* pInput, LPTSTR* ppOutput)
 template long Device<double>::GetDeviceInfo(long lInput, LONG* pInput, LPTSTR* ppOutput);
 template long Device<float>::GetDeviceInfo(long lInput, LONG* pInput, LPTSTR* ppOutput);
 
+
+//-----------------------------------------------------------------------------
+//	Returns the per tag stats of the allocation tracker as JSON, the optional
+//	input selects whether the outstanding handles are listed (default = 1).
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::GetAllocReport(long lInput, LONG* pInput, LPTSTR* ppOutput)
+{
+	LONG lErr;
+	std::string str;
+	bool bOutstanding = true;
+
+	if (pInput != NULL && lInput > 0)
+		bOutstanding = (pInput[0] != 0) ? true : false;
+
+	if (lErr = m_memory.GetAllocTracker()->ToJson(str, bOutstanding))
+		return lErr;
+
+	BSTR bstr = A2WBSTR(str.c_str());
+	if (bstr == NULL)
+		return ERROR_OUTOFMEMORY;
+
+	LPTSTR pDst = NULL;
+	lErr = m_memory.AllocHost(&pDst, bstr);
+
+	if (!lErr)
+		*ppOutput = pDst;
+
+	::SysFreeString(bstr);
+
+	return lErr;
+}
+
+template long Device<double>::GetAllocReport(long lInput, LONG* pInput, LPTSTR* ppOutput);
+template long Device<float>::GetAllocReport(long lInput, LONG* pInput, LPTSTR* ppOutput);
+
 template <class T>
 long Device<T>::SetDevice(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
 {
@@ -600,68 +639,1026 @@ long Device<T>::SetDevice(int nDeviceID, int nInitFlags, long lSeed)
 	return 0;
 }
 
-template long Device<double>::SetDevice(int nDeviceID, int nInitFlags, long lSeed);
-template long Device<float>::SetDevice(int nDeviceID, int nInitFlags, long lSeed);
+template long Device<double>::SetDevice(int nDeviceID, int nInitFlags, long lSeed);
+template long Device<float>::SetDevice(int nDeviceID, int nInitFlags, long lSeed);
+
+
+template <class T>
+long Device<T>::AllocMemory(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, INT_MAX))
+		return lErr;
+
+	long hHandle = 0;
+	long hStream = 0;
+	long lCount = (long)pfInput[0];
+	T* pSrc = NULL;
+
+	if (lInput > 1)
+	{
+		if (lInput == lCount + 1)
+		{
+			pSrc = &pfInput[1];
+		}
+		else if (lInput == lCount + 2)
+		{
+			hStream = (long)pfInput[1];
+			pSrc = &pfInput[2];
+		}
+		else
+		{
+			return ERROR_PARAM_OUT_OF_RANGE;
+		}
+	}
+
+	if (lErr = m_memory.AllocMemory(GetDevice(), lCount, pSrc, hStream, &hHandle))
+		return lErr;
+
+	if (lErr = setOutput(hHandle, plOutput, ppfOutput))
+		return lErr;
+
+	return 0;
+}
+
+template long Device<double>::AllocMemory(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::AllocMemory(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
+template <class T>
+long Device<T>::FreeMemory(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, 1))
+		return lErr;
+
+	long hHandle = (long)pfInput[0];
+
+	return m_memory.FreeMemory(hHandle);
+}
+
+template long Device<double>::FreeMemory(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::FreeMemory(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
+template <class T>
+long Device<T>::EnableAllocTracker(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, 1))
+		return lErr;
+
+	bool bEnable = (pfInput[0] != 0) ? true : false;
+
+	return m_memory.GetAllocTracker()->Enable(bEnable);
+}
+
+template long Device<double>::EnableAllocTracker(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::EnableAllocTracker(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
+//-----------------------------------------------------------------------------
+//	The inputs are [tag, label characters...] where the optional label is
+//	passed one character per input.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::SetAllocTag(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, ALLOCTRACK_MAX_LABEL + 1))
+		return lErr;
+
+	int nTag = (int)pfInput[0];
+	char szLabel[ALLOCTRACK_MAX_LABEL + 1];
+	int nLen = 0;
+
+	for (long i = 1; i < lInput; i++)
+	{
+		char ch = (char)(int)pfInput[i];
+
+		if (ch == 0)
+			break;
+
+		szLabel[nLen] = ch;
+		nLen++;
+	}
+
+	szLabel[nLen] = 0;
+
+	return m_memory.GetAllocTracker()->SetTag(nTag, szLabel);
+}
+
+template long Device<double>::SetAllocTag(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::SetAllocTag(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
+//-----------------------------------------------------------------------------
+//	Reports the outstanding handles when the tracker is enabled, then stops
+//	the tracker, this is called when the kernel is cleaned up.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::ReportAllocations()
+{
+	AllocTracker* pTracker = m_memory.GetAllocTracker();
+
+	if (!pTracker->IsEnabled())
+		return 0;
+
+	char szOwner[256];
+	_snprintf(szOwner, 255, "%s kernel on device %d", (sizeof(T) == sizeof(float)) ? "float" : "double", m_nDevice);
+	szOwner[255] = NULL;
+
+	LONG lErr = pTracker->Report(szOwner);
+	pTracker->Enable(false);
+
+	return lErr;
+}
+
+template long Device<double>::ReportAllocations();
+template long Device<float>::ReportAllocations();
+
+
+template <class T>
+long Device<T>::EnableHostMirror(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, 1))
+		return lErr;
+
+	bool bEnable = (pfInput[0] != 0) ? true : false;
+
+	m_memory.GetMemoryCollection()->EnableMirror(bEnable);
+
+	return 0;
+}
+
+template long Device<double>::EnableHostMirror(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::EnableHostMirror(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
+//-----------------------------------------------------------------------------
+//	The outputs are [hits, misses, mirrored bytes] since the mirror was last
+//	enabled.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::GetHostMirrorStats(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+	LONGLONG llHits;
+	LONGLONG llMisses;
+	LONGLONG llBytes;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	m_memory.GetMemoryCollection()->GetMirrorStats(&llHits, &llMisses, &llBytes);
+
+	T* pfOutput = NULL;
+
+	if (lErr = m_memory.AllocHost(3, &pfOutput, NULL, false))
+		return lErr;
+
+	pfOutput[0] = (T)llHits;
+	pfOutput[1] = (T)llMisses;
+	pfOutput[2] = (T)llBytes;
+
+	*ppfOutput = pfOutput;
+	*plOutput = 3;
+
+	return 0;
+}
+
+template long Device<double>::GetHostMirrorStats(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::GetHostMirrorStats(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
+//-----------------------------------------------------------------------------
+//	The thread counts each host BLAS check is run with, where 0 is the
+//	default count.
+//-----------------------------------------------------------------------------
+static const int s_rgnHostCheckThreads[] = { 1, 3, 7, 0 };
+static const int s_nHostCheckThreads = sizeof(s_rgnHostCheckThreads) / sizeof(int);
+
+//-----------------------------------------------------------------------------
+//	Holds the device copies of the buffers of a host BLAS check, which are
+//	freed when the check ends.
+//-----------------------------------------------------------------------------
+template <class T>
+class HostCheckData
+{
+	Memory<T>* m_pMemory;
+	int m_nDevice;
+	std::vector<long> m_rghHandles;
+
+public:
+	HostCheckData(Memory<T>* pMemory, int nDevice)
+	{
+		m_pMemory = pMemory;
+		m_nDevice = nDevice;
+	}
+
+	~HostCheckData()
+	{
+		for (size_t i = 0; i < m_rghHandles.size(); i++)
+		{
+			m_pMemory->FreeMemory(m_rghHandles[i]);
+		}
+	}
+
+	long Copy(std::vector<T>& rg, long* phHandle)
+	{
+		LONG lErr;
+
+		if (lErr = m_pMemory->AllocMemory(m_nDevice, (long)rg.size(), &rg[0], 0, phHandle))
+			return lErr;
+
+		m_rghHandles.push_back(*phHandle);
+		return 0;
+	}
+
+	long Read(long hHandle, std::vector<T>& rg)
+	{
+		return m_pMemory->ReadMemory(hHandle, (long)rg.size(), &rg[0]);
+	}
+};
+
+template <class T>
+static T getMaxDiff(const std::vector<T>& rgA, const std::vector<T>& rgB, T fMax)
+{
+	for (size_t i = 0; i < rgA.size(); i++)
+	{
+		T fDiff = (T)fabs(rgA[i] - rgB[i]);
+
+		// A NaN on one side only is a mismatch.
+		if (fDiff != fDiff)
+			fDiff = (rgA[i] != rgA[i] && rgB[i] != rgB[i]) ? T(0) : T(FLT_MAX);
+
+		if (fDiff > fMax)
+			fMax = fDiff;
+	}
+
+	return fMax;
+}
+
+template <class T>
+static T getRandom(T fMin, T fMax)
+{
+	return fMin + (fMax - fMin) * T(rand()) / T(RAND_MAX);
+}
+
+//-----------------------------------------------------------------------------
+//	Runs a host BLAS routine with each thread count of the check and
+//	compares the results to those of its Math routine on the device.  The
+//	inputs are: nCheck (HOSTBLAS_CHECK_*) and the option of the check, and
+//	the output is the largest absolute difference found.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::CheckHostBlas(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 2, 2))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	int nCheck = (int)pfInput[0];
+	int nOption = (int)pfInput[1];
+	T fDiff = 0;
+
+	srand(1701);
+
+	switch (nCheck)
+	{
+		case HOSTBLAS_CHECK_SOFTMAXLOSS:
+			lErr = checkHostSoftmaxLoss(nOption, &fDiff);
+			break;
+
+		case HOSTBLAS_CHECK_UPDATE_FOREACH:
+			lErr = checkHostUpdate(nOption, &fDiff);
+			break;
+
+		case HOSTBLAS_CHECK_LSTM_SEQ:
+			lErr = checkHostLstm(nOption, &fDiff);
+			break;
+
+		case HOSTBLAS_CHECK_RNG_PHILOX:
+			lErr = checkHostPhilox(nOption, &fDiff);
+			break;
+
+		case HOSTBLAS_CHECK_POOLING:
+			lErr = checkHostPooling(nOption, &fDiff);
+			break;
+
+		default:
+			return ERROR_PARAM_OUT_OF_RANGE;
+	}
+
+	HostBlas<T>::SetThreadCount(0);
+
+	if (lErr)
+		return lErr;
+
+	return setOutput(fDiff, plOutput, ppfOutput);
+}
+
+template long Device<double>::CheckHostBlas(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::CheckHostBlas(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
+//-----------------------------------------------------------------------------
+//	Checks HostKernels::softmaxloss against Math::softmaxloss_fused on rows of
+//	2000 classes (nShape = 0) or on maps of 1000 items (nShape = 1), where
+//	the map size is not a multiple of the vector width.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::checkHostSoftmaxLoss(int nShape, T* pfDiff)
+{
+	LONG lErr;
+	int nOuterNum = (nShape == 0) ? 256 : 32;
+	int nChannels = (nShape == 0) ? 2000 : 21;
+	int nInnerNum = (nShape == 0) ? 1 : 1000;
+	int nCount = nOuterNum * nInnerNum;
+	int nDim = nChannels * nInnerNum;
+	const int nIgnoreLabel = 3;
+	std::vector<T> rgX((size_t)nOuterNum * nDim);
+	std::vector<T> rgLabel(nCount);
+	std::vector<T> rgLoss(nCount, T(0));
+	std::vector<T> rgCounts(nCount, T(0));
+	std::vector<T> rgProb(rgX.size(), T(0));
+	std::vector<T> rgDiff(rgX.size(), T(0));
+	HostCheckData<T> data(&m_memory, GetDevice());
+	long hX;
+	long hLabel;
+	long hLoss;
+	long hCounts;
+	long hProb;
+	long hDiff;
+
+	if (nShape < 0 || nShape > 1)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	for (size_t i = 0; i < rgX.size(); i++)
+	{
+		rgX[i] = getRandom(T(-8), T(8));
+	}
+
+	for (int i = 0; i < nCount; i++)
+	{
+		rgLabel[i] = T(rand() % nChannels);
+	}
+
+	if (lErr = data.Copy(rgX, &hX))
+		return lErr;
+
+	if (lErr = data.Copy(rgLabel, &hLabel))
+		return lErr;
+
+	if (lErr = data.Copy(rgLoss, &hLoss))
+		return lErr;
+
+	if (lErr = data.Copy(rgCounts, &hCounts))
+		return lErr;
+
+	if (lErr = data.Copy(rgProb, &hProb))
+		return lErr;
+
+	if (lErr = data.Copy(rgDiff, &hDiff))
+		return lErr;
+
+	if (lErr = m_math.softmaxloss_fused(nCount, hX, hLabel, hLoss, nOuterNum, nDim, nInnerNum, hCounts, nIgnoreLabel, hProb, hDiff))
+		return lErr;
+
+	std::vector<T> rgLossD(nCount);
+	std::vector<T> rgCountsD(nCount);
+	std::vector<T> rgProbD(rgX.size());
+	std::vector<T> rgDiffD(rgX.size());
+
+	if (lErr = data.Read(hLoss, rgLossD))
+		return lErr;
+
+	if (lErr = data.Read(hCounts, rgCountsD))
+		return lErr;
+
+	if (lErr = data.Read(hProb, rgProbD))
+		return lErr;
+
+	if (lErr = data.Read(hDiff, rgDiffD))
+		return lErr;
+
+	for (int i = 0; i < s_nHostCheckThreads; i++)
+	{
+		if (lErr = HostBlas<T>::SetThreadCount(s_rgnHostCheckThreads[i]))
+			return lErr;
+
+		std::fill(rgLoss.begin(), rgLoss.end(), T(0));
+		std::fill(rgCounts.begin(), rgCounts.end(), T(0));
+		std::fill(rgProb.begin(), rgProb.end(), T(0));
+		std::fill(rgDiff.begin(), rgDiff.end(), T(0));
+
+		if (lErr = HostKernels<T>::softmaxloss(nOuterNum, nChannels, nInnerNum, &rgX[0], &rgLabel[0], nIgnoreLabel, &rgLoss[0], &rgCounts[0], &rgProb[0], &rgDiff[0]))
+			return lErr;
+
+		*pfDiff = getMaxDiff(rgLoss, rgLossD, *pfDiff);
+		*pfDiff = getMaxDiff(rgCounts, rgCountsD, *pfDiff);
+		*pfDiff = getMaxDiff(rgProb, rgProbD, *pfDiff);
+		*pfDiff = getMaxDiff(rgDiff, rgDiffD, *pfDiff);
+	}
+
+	return 0;
+}
+
+template long Device<double>::checkHostSoftmaxLoss(int nShape, double* pfDiff);
+template long Device<float>::checkHostSoftmaxLoss(int nShape, float* pfDiff);
+
+
+//-----------------------------------------------------------------------------
+//	Checks HostKernels::update_foreach against Math::update_foreach for the
+//	method (UPDATE_METHOD_*) with each regularization.  The tensors are
+//	sized below, at and across the chunk size so the host jobs split them.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::checkHostUpdate(int nMethod, T* pfDiff)
+{
+	LONG lErr;
+	const int nTensors = 3;
+	const int rgnCount[nTensors] = { 5, UPDATE_FOREACH_CHUNK * 20 + 7, 700001 };
+	const int nBuffers = 4;
+
+	if (nMethod < UPDATE_METHOD_SGD || nMethod > UPDATE_METHOD_RMSPROP)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	for (int nReg = UPDATE_REGULARIZATION_NONE; nReg <= UPDATE_REGULARIZATION_L1; nReg++)
+	{
+		UPDATE_PARAMS<T> p;
+		p.nMethod = nMethod;
+		p.nRegularization = nReg;
+		p.fGradScale = T(0.5);
+		p.fMomentum = T(0.9);
+		p.fMomentum2 = T(0.999);
+		p.fDelta = T(1e-6);
+		p.bUpdateData = true;
+
+		// The data, diff and both histories of each tensor.
+		std::vector<std::vector<T>> rgrgSrc(nTensors * nBuffers);
+		std::vector<std::vector<T>> rgrgHost(nTensors * nBuffers);
+		std::vector<std::vector<T>> rgrgDevice(nTensors * nBuffers);
+		std::vector<long> rghBuffers(nTensors * nBuffers);
+		std::vector<T> rgfLocalRate(nTensors);
+		std::vector<T> rgfLocalDecay(nTensors);
+		std::vector<int> rgnTensorCount(rgnCount, rgnCount + nTensors);
+		std::vector<UPDATE_TENSOR<T>> rgTensors(nTensors);
+		HostCheckData<T> data(&m_memory, GetDevice());
+
+		for (int i = 0; i < nTensors * nBuffers; i++)
+		{
+			T fMin = (i % nBuffers < 2) ? T(-1) : T(0);
+
+			rgrgSrc[i].resize(rgnCount[i / nBuffers]);
+			rgrgDevice[i].resize(rgnCount[i / nBuffers]);
+
+			for (size_t j = 0; j < rgrgSrc[i].size(); j++)
+			{
+				rgrgSrc[i][j] = getRandom(fMin, T(1));
+			}
+
+			rgrgHost[i] = rgrgSrc[i];
+
+			if (lErr = data.Copy(rgrgHost[i], &rghBuffers[i]))
+				return lErr;
+		}
+
+		std::vector<long> rghData(nTensors);
+		std::vector<long> rghDiff(nTensors);
+		std::vector<long> rghHistory1(nTensors);
+		std::vector<long> rghHistory2(nTensors);
+
+		for (int i = 0; i < nTensors; i++)
+		{
+			rghData[i] = rghBuffers[i * nBuffers + 0];
+			rghDiff[i] = rghBuffers[i * nBuffers + 1];
+			rghHistory1[i] = rghBuffers[i * nBuffers + 2];
+			rghHistory2[i] = rghBuffers[i * nBuffers + 3];
+			rgfLocalRate[i] = T(0.01) * (i + 1);
+			rgfLocalDecay[i] = T(0.0005) * (i + 1);
+		}
+
+		if (lErr = m_math.update_foreach(p, nTensors, &rghData[0], &rghDiff[0], &rghHistory1[0], &rghHistory2[0], &rgnTensorCount[0], &rgfLocalRate[0], &rgfLocalDecay[0]))
+			return lErr;
+
+		for (int i = 0; i < nTensors * nBuffers; i++)
+		{
+			if (lErr = data.Read(rghBuffers[i], rgrgDevice[i]))
+				return lErr;
+		}
+
+		for (int t = 0; t < s_nHostCheckThreads; t++)
+		{
+			if (lErr = HostBlas<T>::SetThreadCount(s_rgnHostCheckThreads[t]))
+				return lErr;
+
+			for (int i = 0; i < nTensors * nBuffers; i++)
+			{
+				rgrgHost[i] = rgrgSrc[i];
+			}
+
+			for (int i = 0; i < nTensors; i++)
+			{
+				rgTensors[i].data = &rgrgHost[i * nBuffers + 0][0];
+				rgTensors[i].diff = &rgrgHost[i * nBuffers + 1][0];
+				rgTensors[i].history1 = &rgrgHost[i * nBuffers + 2][0];
+				rgTensors[i].history2 = &rgrgHost[i * nBuffers + 3][0];
+				rgTensors[i].nCount = rgnCount[i];
+				rgTensors[i].fLocalRate = rgfLocalRate[i];
+				rgTensors[i].fLocalDecay = rgfLocalDecay[i];
+			}
+
+			if (lErr = HostKernels<T>::update_foreach(p, nTensors, &rgTensors[0]))
+				return lErr;
+
+			for (int i = 0; i < nTensors * nBuffers; i++)
+			{
+				*pfDiff = getMaxDiff(rgrgHost[i], rgrgDevice[i], *pfDiff);
+			}
+		}
+	}
+
+	return 0;
+}
+
+template long Device<double>::checkHostUpdate(int nMethod, double* pfDiff);
+template long Device<float>::checkHostUpdate(int nMethod, float* pfDiff);
+
+
+//-----------------------------------------------------------------------------
+//	Checks HostKernels::lstm_seq_fwd and lstm_seq_bwd against the Math versions
+//	without (nClip = 0) or with clip data, bias and gradient clipping.  Both
+//	backward passes start from the device forward results so each pass is
+//	checked on its own.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::checkHostLstm(int nClip, T* pfDiff)
+{
+	LONG lErr;
+	const int nT = 8;
+	const int nN = 32;
+	const int nH = 256;
+	const int nI = 100;
+	const int nCount = nN * nH;
+	bool bClip = (nClip != 0) ? true : false;
+	T fClip = (bClip) ? T(0.05) : T(0);
+	std::vector<T> rgWi((size_t)4 * nH * nI);
+	std::vector<T> rgWh((size_t)4 * nH * nH);
+	std::vector<T> rgBias(4 * nH);
+	std::vector<T> rgX((size_t)nT * nN * nI);
+	std::vector<T> rgClip(nT * nN);
+	std::vector<T> rgH0(nCount);
+	std::vector<T> rgC0(nCount);
+	std::vector<T> rgTopDiff((size_t)nT * nCount);
+	std::vector<T> rgCellDiff((size_t)nT * nCount);
+	HostCheckData<T> data(&m_memory, GetDevice());
+
+	if (nClip < 0 || nClip > 1)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	for (size_t i = 0; i < rgWi.size(); i++)
+	{
+		rgWi[i] = getRandom(T(-0.1), T(0.1));
+	}
+
+	for (size_t i = 0; i < rgWh.size(); i++)
+	{
+		rgWh[i] = getRandom(T(-0.1), T(0.1));
+	}
+
+	for (size_t i = 0; i < rgBias.size(); i++)
+	{
+		rgBias[i] = getRandom(T(-0.1), T(0.1));
+	}
+
+	for (size_t i = 0; i < rgX.size(); i++)
+	{
+		rgX[i] = getRandom(T(-1), T(1));
+	}
+
+	// The first step starts each sequence, later steps restart one in five.
+	for (int i = 0; i < nT * nN; i++)
+	{
+		rgClip[i] = (i < nN || rand() % 5 == 0) ? T(0) : T(1);
+	}
+
+	for (int i = 0; i < nCount; i++)
+	{
+		rgH0[i] = getRandom(T(-1), T(1));
+		rgC0[i] = getRandom(T(-1), T(1));
+	}
+
+	for (size_t i = 0; i < rgTopDiff.size(); i++)
+	{
+		rgTopDiff[i] = getRandom(T(-1), T(1));
+		rgCellDiff[i] = getRandom(T(-1), T(1));
+	}
+
+	// Forward pass on the device.
+	std::vector<T> rgTop((size_t)nT * nCount, T(0));
+	std::vector<T> rgCell((size_t)nT * nCount, T(0));
+	std::vector<T> rgPreGate((size_t)nT * 4 * nCount, T(0));
+	std::vector<T> rgGate((size_t)nT * 4 * nCount, T(0));
+	std::vector<T> rgHtoGate(4 * nCount, T(0));
+	long hWi;
+	long hWh;
+	long hBias = 0;
+	long hX;
+	long hClip = 0;
+	long hH0;
+	long hC0;
+	long hTop;
+	long hCell;
+	long hPreGate;
+	long hGate;
+	long hHtoGate;
+
+	if (lErr = data.Copy(rgWi, &hWi))
+		return lErr;
+
+	if (lErr = data.Copy(rgWh, &hWh))
+		return lErr;
+
+	if (bClip)
+	{
+		if (lErr = data.Copy(rgBias, &hBias))
+			return lErr;
+
+		if (lErr = data.Copy(rgClip, &hClip))
+			return lErr;
+	}
+
+	if (lErr = data.Copy(rgX, &hX))
+		return lErr;
+
+	if (lErr = data.Copy(rgH0, &hH0))
+		return lErr;
+
+	if (lErr = data.Copy(rgC0, &hC0))
+		return lErr;
+
+	if (lErr = data.Copy(rgTop, &hTop))
+		return lErr;
+
+	if (lErr = data.Copy(rgCell, &hCell))
+		return lErr;
+
+	if (lErr = data.Copy(rgPreGate, &hPreGate))
+		return lErr;
+
+	if (lErr = data.Copy(rgGate, &hGate))
+		return lErr;
+
+	if (lErr = data.Copy(rgHtoGate, &hHtoGate))
+		return lErr;
+
+	if (lErr = m_math.lstm_seq_fwd(nT, nN, nH, nI, hWi, hWh, hBias, hX, hClip, hH0, hC0, hTop, hCell, hPreGate, hGate, hHtoGate))
+		return lErr;
+
+	std::vector<T> rgTopD(rgTop.size());
+	std::vector<T> rgCellD(rgCell.size());
+	std::vector<T> rgPreGateD(rgPreGate.size());
+	std::vector<T> rgGateD(rgGate.size());
+
+	if (lErr = data.Read(hTop, rgTopD))
+		return lErr;
+
+	if (lErr = data.Read(hCell, rgCellD))
+		return lErr;
+
+	if (lErr = data.Read(hPreGate, rgPreGateD))
+		return lErr;
+
+	if (lErr = data.Read(hGate, rgGateD))
+		return lErr;
+
+	// Backward pass on the device.
+	std::vector<T> rgTopDiffD = rgTopDiff;
+	std::vector<T> rgCellDiffD = rgCellDiff;
+	std::vector<T> rgPreGateDiffD(rgPreGate.size(), T(0));
+	std::vector<T> rgGateDiffD(rgGate.size(), T(0));
+	std::vector<T> rgH0DiffD(nCount, T(0));
+	std::vector<T> rgC0DiffD(nCount, T(0));
+	std::vector<T> rgHtoH(nCount, T(0));
+	long hTopDiff;
+	long hCellDiff;
+	long hPreGateDiff;
+	long hGateDiff;
+	long hH0Diff;
+	long hC0Diff;
+	long hHtoH;
+
+	if (lErr = data.Copy(rgTopDiffD, &hTopDiff))
+		return lErr;
+
+	if (lErr = data.Copy(rgCellDiffD, &hCellDiff))
+		return lErr;
+
+	if (lErr = data.Copy(rgPreGateDiffD, &hPreGateDiff))
+		return lErr;
+
+	if (lErr = data.Copy(rgGateDiffD, &hGateDiff))
+		return lErr;
+
+	if (lErr = data.Copy(rgH0DiffD, &hH0Diff))
+		return lErr;
+
+	if (lErr = data.Copy(rgC0DiffD, &hC0Diff))
+		return lErr;
+
+	if (lErr = data.Copy(rgHtoH, &hHtoH))
+		return lErr;
+
+	if (lErr = m_math.lstm_seq_bwd(nT, nN, nH, fClip, hWh, hClip, hTopDiff, hCell, hCellDiff, hPreGateDiff, hGate, hGateDiff, hC0, hH0Diff, hC0Diff, hHtoH))
+		return lErr;
+
+	if (lErr = data.Read(hTopDiff, rgTopDiffD))
+		return lErr;
+
+	if (lErr = data.Read(hCellDiff, rgCellDiffD))
+		return lErr;
+
+	if (lErr = data.Read(hPreGateDiff, rgPreGateDiffD))
+		return lErr;
+
+	if (lErr = data.Read(hGateDiff, rgGateDiffD))
+		return lErr;
+
+	if (lErr = data.Read(hH0Diff, rgH0DiffD))
+		return lErr;
+
+	if (lErr = data.Read(hC0Diff, rgC0DiffD))
+		return lErr;
+
+	const T* clip = (bClip) ? &rgClip[0] : NULL;
+	const T* bias = (bClip) ? &rgBias[0] : NULL;
+
+	for (int t = 0; t < s_nHostCheckThreads; t++)
+	{
+		if (lErr = HostBlas<T>::SetThreadCount(s_rgnHostCheckThreads[t]))
+			return lErr;
+
+		std::fill(rgTop.begin(), rgTop.end(), T(0));
+		std::fill(rgCell.begin(), rgCell.end(), T(0));
+		std::fill(rgPreGate.begin(), rgPreGate.end(), T(0));
+		std::fill(rgGate.begin(), rgGate.end(), T(0));
+
+		if (lErr = HostKernels<T>::lstm_seq_fwd(nT, nN, nH, nI, &rgWi[0], &rgWh[0], bias, &rgX[0], clip, &rgH0[0], &rgC0[0], &rgTop[0], &rgCell[0], &rgPreGate[0], &rgGate[0]))
+			return lErr;
+
+		*pfDiff = getMaxDiff(rgTop, rgTopD, *pfDiff);
+		*pfDiff = getMaxDiff(rgCell, rgCellD, *pfDiff);
+		*pfDiff = getMaxDiff(rgPreGate, rgPreGateD, *pfDiff);
+		*pfDiff = getMaxDiff(rgGate, rgGateD, *pfDiff);
+
+		std::vector<T> rgTopDiffH = rgTopDiff;
+		std::vector<T> rgCellDiffH = rgCellDiff;
+		std::vector<T> rgPreGateDiffH(rgPreGate.size(), T(0));
+		std::vector<T> rgGateDiffH(rgGate.size(), T(0));
+		std::vector<T> rgH0DiffH(nCount, T(0));
+		std::vector<T> rgC0DiffH(nCount, T(0));
+
+		if (lErr = HostKernels<T>::lstm_seq_bwd(nT, nN, nH, fClip, &rgWh[0], clip, &rgTopDiffH[0], &rgCellD[0], &rgCellDiffH[0], &rgPreGateDiffH[0], &rgGateD[0], &rgGateDiffH[0], &rgC0[0], &rgH0DiffH[0], &rgC0DiffH[0]))
+			return lErr;
+
+		*pfDiff = getMaxDiff(rgTopDiffH, rgTopDiffD, *pfDiff);
+		*pfDiff = getMaxDiff(rgCellDiffH, rgCellDiffD, *pfDiff);
+		*pfDiff = getMaxDiff(rgPreGateDiffH, rgPreGateDiffD, *pfDiff);
+		*pfDiff = getMaxDiff(rgGateDiffH, rgGateDiffD, *pfDiff);
+		*pfDiff = getMaxDiff(rgH0DiffH, rgH0DiffD, *pfDiff);
+		*pfDiff = getMaxDiff(rgC0DiffH, rgC0DiffD, *pfDiff);
+	}
+
+	return 0;
+}
+
+template long Device<double>::checkHostLstm(int nClip, double* pfDiff);
+template long Device<float>::checkHostLstm(int nClip, float* pfDiff);
+
+
+//-----------------------------------------------------------------------------
+//	Checks HostKernels::rng_philox against Math::rng_philox for the method
+//	(RNG_PHILOX_*).  The device fills the whole range in one call, and the
+//	host fills it with each thread count in 1, 2 and 7 uneven parts, each
+//	starting at its own offset in the stream.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::checkHostPhilox(int nMethod, T* pfDiff)
+{
+	LONG lErr;
+	const int n = 200003;
+	const LONGLONG llSeed = 0x123456789ABLL;
+	const int nStream = 3;
+	const LONGLONG llOffset = 5000;
+	const int rgnSplits[] = { 1, 2, 7 };
+	const int nSplitCounts = sizeof(rgnSplits) / sizeof(int);
+	T fA = (nMethod == RNG_PHILOX_BERNOULLI) ? T(0.3) : T(-2);
+	T fB = T(3);
+	std::vector<T> rgY(n, T(0));
+	HostCheckData<T> data(&m_memory, GetDevice());
+	long hY;
+
+	if (nMethod < RNG_PHILOX_UNIFORM || nMethod > RNG_PHILOX_BERNOULLI)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (lErr = data.Copy(rgY, &hY))
+		return lErr;
+
+	if (lErr = m_math.rng_philox(nMethod, n, fA, fB, llSeed, nStream, llOffset, hY))
+		return lErr;
+
+	std::vector<T> rgYD(n);
+
+	if (lErr = data.Read(hY, rgYD))
+		return lErr;
+
+	for (int t = 0; t < s_nHostCheckThreads; t++)
+	{
+		if (lErr = HostBlas<T>::SetThreadCount(s_rgnHostCheckThreads[t]))
+			return lErr;
+
+		for (int s = 0; s < nSplitCounts; s++)
+		{
+			int nSplits = rgnSplits[s];
+			int nFirst = 0;
+
+			std::fill(rgY.begin(), rgY.end(), T(0));
+
+			for (int i = 0; i < nSplits; i++)
+			{
+				// The parts grow with i, so no two have the same size.
+				int nLast = (i == nSplits - 1) ? n : nFirst + (int)((LONGLONG)n * 2 * (i + 1) / (nSplits * (nSplits + 1)));
+
+				if (lErr = HostKernels<T>::rng_philox(nMethod, nLast - nFirst, fA, fB, llSeed, nStream, llOffset + nFirst, &rgY[nFirst]))
+					return lErr;
+
+				nFirst = nLast;
+			}
+
+			*pfDiff = getMaxDiff(rgY, rgYD, *pfDiff);
+		}
+	}
+
+	return 0;
+}
+
+template long Device<double>::checkHostPhilox(int nMethod, double* pfDiff);
+template long Device<float>::checkHostPhilox(int nMethod, float* pfDiff);
 
 
+//-----------------------------------------------------------------------------
+//	Checks HostKernels::pooling_fwd and pooling_bwd against Math::pooling_fwd
+//	and pooling_bwd for the max with the item mask, the max with the uint8
+//	mask and the average, on maps of 13 x 37 items.  The geometry selects
+//	the window: 2x2/s2 (0), 3x3/s2 (1), 3x3/s2 pad 1 (2), 3x3/s1 pad 1 (3),
+//	a generic 3x2 window with stride 2x1 and pad 1x0 (4), or a window over
+//	the whole map (5), which has no uint8 mask.
+//-----------------------------------------------------------------------------
 template <class T>
-long Device<T>::AllocMemory(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+long Device<T>::checkHostPooling(int nGeometry, T* pfDiff)
 {
 	LONG lErr;
+	const int rgGeometry[6][6] = { { 2, 2, 2, 2, 0, 0 }, { 3, 3, 2, 2, 0, 0 }, { 3, 3, 2, 2, 1, 1 }, { 3, 3, 1, 1, 1, 1 }, { 3, 2, 2, 1, 1, 0 }, { 13, 37, 1, 1, 0, 0 } };
+	const int nNum = 2;
+	const int nChannels = 5;
+	const int h = 13;
+	const int w = 37;
 
-	if (lErr = verifyInput(lInput, pfInput, 1, INT_MAX))
-		return lErr;
+	if (nGeometry < 0 || nGeometry > 5)
+		return ERROR_PARAM_OUT_OF_RANGE;
 
-	long hHandle = 0;
-	long hStream = 0;
-	long lCount = (long)pfInput[0];
-	T* pSrc = NULL;
+	const int* pG = rgGeometry[nGeometry];
+	int hPooled = (int)ceil((float)(h + 2 * pG[4] - pG[0]) / pG[2]) + 1;
+	int wPooled = (int)ceil((float)(w + 2 * pG[5] - pG[1]) / pG[3]) + 1;
+
+	// The last window must start inside the map, as in the PoolingLayer.
+	if (pG[4] > 0 && (hPooled - 1) * pG[2] >= h + pG[4])
+		hPooled--;
+
+	if (pG[5] > 0 && (wPooled - 1) * pG[3] >= w + pG[5])
+		wPooled--;
+
+	const int nBottom = nNum * nChannels * h * w;
+	const int nTop = nNum * nChannels * hPooled * wPooled;
+	std::vector<T> rgX(nBottom);
+	std::vector<T> rgTopDiff(nTop);
+	std::vector<T> rgTop(nTop, T(0));
+	std::vector<T> rgMask(nTop, T(0));
+	std::vector<T> rgBottomDiff(nBottom, T(0));
+	HostCheckData<T> data(&m_memory, GetDevice());
+	long hX;
+	long hTopDiff;
+	long hTop;
+	long hMask;
+	long hBottomDiff;
+
+	for (int i = 0; i < nBottom; i++)
+	{
+		// Every seventh item is the same so the max windows have ties.
+		rgX[i] = (i % 7 == 0) ? T(1) : getRandom(T(-8), T(8));
+	}
 
-	if (lInput > 1)
+	for (int i = 0; i < nTop; i++)
 	{
-		if (lInput == lCount + 1)
-		{
-			pSrc = &pfInput[1];
-		}
-		else if (lInput == lCount + 2)
-		{
-			hStream = (long)pfInput[1];
-			pSrc = &pfInput[2];
-		}
-		else
-		{
-			return ERROR_PARAM_OUT_OF_RANGE;
-		}
+		rgTopDiff[i] = getRandom(T(-1), T(1));
 	}
 
-	if (lErr = m_memory.AllocMemory(GetDevice(), lCount, pSrc, hStream, &hHandle))
+	if (lErr = data.Copy(rgX, &hX))
 		return lErr;
 
-	if (lErr = setOutput(hHandle, plOutput, ppfOutput))
+	if (lErr = data.Copy(rgTopDiff, &hTopDiff))
 		return lErr;
 
-	return 0;
-}
+	if (lErr = data.Copy(rgTop, &hTop))
+		return lErr;
 
-template long Device<double>::AllocMemory(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
-template long Device<float>::AllocMemory(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+	if (lErr = data.Copy(rgMask, &hMask))
+		return lErr;
 
+	if (lErr = data.Copy(rgBottomDiff, &hBottomDiff))
+		return lErr;
 
-template <class T>
-long Device<T>::FreeMemory(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
-{
-	LONG lErr;
+	// The max with the item mask (0), with the uint8 mask (1) and the average (2).
+	for (int nPass = 0; nPass < 3; nPass++)
+	{
+		int nMethod = (nPass < 2) ? POOLING_METHOD_MAX : POOLING_METHOD_AVE;
+		bool bMask8 = (nPass == 1);
 
-	if (lErr = verifyInput(lInput, pfInput, 1, 1))
-		return lErr;
+		if (bMask8 && pG[0] * pG[1] >= POOLING_MASK8_NONE)
+			continue;
 
-	long hHandle = (long)pfInput[0];
+		long hPassMask = (nMethod == POOLING_METHOD_MAX) ? hMask : 0;
 
-	return m_memory.FreeMemory(hHandle);
+		if (lErr = m_math.pooling_fwd(nMethod, nTop, hX, nNum, nChannels, h, w, hPooled, wPooled, pG[0], pG[1], pG[2], pG[3], pG[4], pG[5], hTop, hPassMask, 0, bMask8))
+			return lErr;
+
+		if (lErr = m_math.pooling_bwd(nMethod, nBottom, hTopDiff, nNum, nChannels, h, w, hPooled, wPooled, pG[0], pG[1], pG[2], pG[3], pG[4], pG[5], hBottomDiff, hPassMask, 0, bMask8))
+			return lErr;
+
+		std::vector<T> rgTopD(nTop);
+		std::vector<T> rgMaskD(nTop);
+		std::vector<T> rgBottomDiffD(nBottom);
+
+		if (lErr = data.Read(hTop, rgTopD))
+			return lErr;
+
+		if (lErr = data.Read(hMask, rgMaskD))
+			return lErr;
+
+		if (lErr = data.Read(hBottomDiff, rgBottomDiffD))
+			return lErr;
+
+		// The uint8 mask fills the first nTop bytes of the mask memory.
+		std::vector<unsigned char> rgMask8D(nTop);
+		std::vector<unsigned char> rgMask8(nTop);
+		memcpy(&rgMask8D[0], &rgMaskD[0], nTop);
+
+		for (int t = 0; t < s_nHostCheckThreads; t++)
+		{
+			if (lErr = HostBlas<T>::SetThreadCount(s_rgnHostCheckThreads[t]))
+				return lErr;
+
+			std::fill(rgTop.begin(), rgTop.end(), T(0));
+			std::fill(rgMask.begin(), rgMask.end(), T(0));
+			std::fill(rgMask8.begin(), rgMask8.end(), 0);
+			std::fill(rgBottomDiff.begin(), rgBottomDiff.end(), T(0));
+
+			T* pMask = (nPass == 0) ? &rgMask[0] : NULL;
+			unsigned char* pMask8 = (bMask8) ? &rgMask8[0] : NULL;
+
+			if (lErr = HostKernels<T>::pooling_fwd(nMethod, nNum, nChannels, h, w, hPooled, wPooled, pG[0], pG[1], pG[2], pG[3], pG[4], pG[5], &rgX[0], &rgTop[0], pMask, pMask8))
+				return lErr;
+
+			if (lErr = HostKernels<T>::pooling_bwd(nMethod, nNum, nChannels, h, w, hPooled, wPooled, pG[0], pG[1], pG[2], pG[3], pG[4], pG[5], &rgTopDiff[0], &rgBottomDiff[0], pMask, pMask8))
+				return lErr;
+
+			*pfDiff = getMaxDiff(rgTop, rgTopD, *pfDiff);
+			*pfDiff = getMaxDiff(rgBottomDiff, rgBottomDiffD, *pfDiff);
+
+			if (nPass == 0)
+				*pfDiff = getMaxDiff(rgMask, rgMaskD, *pfDiff);
+
+			if (bMask8)
+				*pfDiff = getMaxDiff(std::vector<T>(rgMask8.begin(), rgMask8.end()), std::vector<T>(rgMask8D.begin(), rgMask8D.end()), *pfDiff);
+		}
+	}
+
+	return 0;
 }
 
-template long Device<double>::FreeMemory(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
-template long Device<float>::FreeMemory(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+template long Device<double>::checkHostPooling(int nGeometry, double* pfDiff);
+template long Device<float>::checkHostPooling(int nGeometry, float* pfDiff);
 
 
 template <class T>
@@ -682,7 +1679,7 @@ long Device<T>::GetMemory(long lInput, T* pfInput, long* plOutput, T** ppfOutput
 	if (lInput > 1)
 		lCount = (long)pfInput[1];
 
-	if (lErr = m_memory.GetMemory(hHandle, &pItem))
+	if (lErr = m_memory.GetMemory(hHandle, &pItem, false))
 		return lErr;
 
 	long lAllocatedCount = pItem->Size() / sizeof(T);
@@ -696,15 +1693,21 @@ long Device<T>::GetMemory(long lInput, T* pfInput, long* plOutput, T** ppfOutput
 	{
 		T* pfOutput = *ppfOutput;
 
-		if (lErr = m_memory.CopyToHost(lCount, pfOutput, (T*)pItem->Data(), true))
+		if (lErr = m_memory.ReadMemory(hHandle, lCount, pfOutput))
 			return lErr;
 	}
 	else
 	{
 		T* pfOutput = NULL;
 
-		if (lErr = m_memory.AllocHost(lCount, &pfOutput, (T*)pItem->Data(), true))
+		if (lErr = m_memory.AllocHost(lCount, &pfOutput, NULL, false))
+			return lErr;
+
+		if (lErr = m_memory.ReadMemory(hHandle, lCount, pfOutput))
+		{
+			m_memory.FreeHost(pfOutput);
 			return lErr;
+		}
 
 		*ppfOutput = pfOutput;
 	}
@@ -1816,13 +2819,28 @@ long Device<T>::cuda_minmaxval(long lInput, T* pfInput, long* plOutput, T** ppfO
 	if (lInput > 5)
 		nAOff = (int)pfInput[5];
 
-	if (lErr = m_math.minmaxval(n, hA, hWork1, hWork2, &fMin, &fMax, nAOff))
-		return lErr;
-
-	if (bDetectNans)
+	// The work handles are no longer used, but their size is still
+	// returned when hA = 0 for the callers that allocate them.
+	if (hA == 0)
+	{
+		if (lErr = m_math.minmaxval(n, hA, hWork1, hWork2, &fMin, &fMax, nAOff))
+			return lErr;
+	}
+	else
 	{
-		if (lErr = m_math.naninfval(n, hA, hWork1, hWork2, &fNan, &fInf, nAOff))
+		T rgStats[STATS_COUNT];
+
+		if (lErr = m_math.stats(n, hA, rgStats, nAOff))
 			return lErr;
+
+		fMin = rgStats[STATS_MIN];
+		fMax = rgStats[STATS_MAX];
+
+		if (bDetectNans)
+		{
+			fNan = rgStats[STATS_NAN];
+			fInf = rgStats[STATS_INF];
+		}
 	}
 
 	T* pfOutput = NULL;
@@ -1845,6 +2863,45 @@ template long Device<double>::cuda_minmaxval(long lInput, double* pfInput, long*
 template long Device<float>::cuda_minmaxval(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
 
 
+template <class T>
+long Device<T>::cuda_stats(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 2, 3))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	int n = (int)pfInput[0];
+	long hA = (long)pfInput[1];
+	int nAOff = 0;
+
+	if (lInput > 2)
+		nAOff = (int)pfInput[2];
+
+	T* pfOutput = NULL;
+
+	if (lErr = m_memory.AllocHost(STATS_COUNT, &pfOutput, NULL, false))
+		return lErr;
+
+	if (lErr = m_math.stats(n, hA, pfOutput, nAOff))
+	{
+		m_memory.FreeHost(pfOutput);
+		return lErr;
+	}
+
+	*ppfOutput = pfOutput;
+	*plOutput = STATS_COUNT;
+
+	return 0;
+}
+
+template long Device<double>::cuda_stats(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::cuda_stats(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
 template <class T>
 long Device<T>::cuda_sumsq(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
 {
@@ -1906,6 +2963,120 @@ template long Device<double>::cuda_sumsqdiff(long lInput, double* pfInput, long*
 template long Device<float>::cuda_sumsqdiff(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
 
 
+//-----------------------------------------------------------------------------
+//	The inputs are: n, hY, nYOff, nReduce, nInputs, then the handle and offset
+//	of each input, then nOps followed by the code and argument of each op.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::cuda_fused_expr(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 7, 6 + FUSEDEXPR_MAX_INPUTS * 2 + FUSEDEXPR_MAX_OPS * 2))
+		return lErr;
+
+	int n = (int)pfInput[0];
+	long hY = (long)pfInput[1];
+	int nYOff = (int)pfInput[2];
+	int nReduce = (int)pfInput[3];
+	int nInputs = (int)pfInput[4];
+	long rghIn[FUSEDEXPR_MAX_INPUTS];
+	int rgnInOff[FUSEDEXPR_MAX_INPUTS];
+	int rgOp[FUSEDEXPR_MAX_OPS];
+	T rgArg[FUSEDEXPR_MAX_OPS];
+
+	if (nInputs < 0 || nInputs > FUSEDEXPR_MAX_INPUTS || lInput < 6 + nInputs * 2)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	for (int i = 0; i < nInputs; i++)
+	{
+		rghIn[i] = (long)pfInput[5 + i * 2];
+		rgnInOff[i] = (int)pfInput[5 + i * 2 + 1];
+	}
+
+	int nIdx = 5 + nInputs * 2;
+	int nOps = (int)pfInput[nIdx];
+	nIdx++;
+
+	if (nOps < 1 || nOps > FUSEDEXPR_MAX_OPS || lInput != nIdx + nOps * 2)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	for (int i = 0; i < nOps; i++)
+	{
+		rgOp[i] = (int)pfInput[nIdx + i * 2];
+		rgArg[i] = pfInput[nIdx + i * 2 + 1];
+	}
+
+	T fOutput = 0;
+
+	if (lErr = m_math.fused_expr(n, nInputs, rghIn, rgnInOff, nOps, rgOp, rgArg, hY, nYOff, nReduce, &fOutput))
+		return lErr;
+
+	return setOutput(fOutput, plOutput, ppfOutput);
+}
+
+template long Device<double>::cuda_fused_expr(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::cuda_fused_expr(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
+//-----------------------------------------------------------------------------
+//	The inputs are: nMethod, nRegularization, fGradScale, fMomentum,
+//	fMomentum2, fDelta, bUpdateData, nTensors, then the data, diff, history1
+//	and history2 handles, count, local rate and local decay of each tensor.
+//-----------------------------------------------------------------------------
+template <class T>
+long Device<T>::cuda_update_foreach(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+	const int nItems = 7;
+
+	if (lErr = verifyInput(lInput, pfInput, 8, 8 + UPDATE_FOREACH_MAX_TENSORS * nItems))
+		return lErr;
+
+	UPDATE_PARAMS<T> p;
+	p.nMethod = (int)pfInput[0];
+	p.nRegularization = (int)pfInput[1];
+	p.fGradScale = pfInput[2];
+	p.fMomentum = pfInput[3];
+	p.fMomentum2 = pfInput[4];
+	p.fDelta = pfInput[5];
+	p.bUpdateData = (pfInput[6] == 0) ? false : true;
+	int nTensors = (int)pfInput[7];
+
+	if (nTensors < 0 || nTensors > UPDATE_FOREACH_MAX_TENSORS || lInput != 8 + nTensors * nItems)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	std::vector<long> rghData(nTensors);
+	std::vector<long> rghDiff(nTensors);
+	std::vector<long> rghHistory1(nTensors);
+	std::vector<long> rghHistory2(nTensors);
+	std::vector<int> rgnCount(nTensors);
+	std::vector<T> rgfLocalRate(nTensors);
+	std::vector<T> rgfLocalDecay(nTensors);
+
+	for (int i = 0; i < nTensors; i++)
+	{
+		T* pf = pfInput + 8 + i * nItems;
+
+		rghData[i] = (long)pf[0];
+		rghDiff[i] = (long)pf[1];
+		rghHistory1[i] = (long)pf[2];
+		rghHistory2[i] = (long)pf[3];
+		rgnCount[i] = (int)pf[4];
+		rgfLocalRate[i] = pf[5];
+		rgfLocalDecay[i] = pf[6];
+	}
+
+	if (nTensors == 0)
+		return 0;
+
+	return m_math.update_foreach(p, nTensors, rghData.data(), rghDiff.data(), rghHistory1.data(), rghHistory2.data(), rgnCount.data(), rgfLocalRate.data(), rgfLocalDecay.data());
+}
+
+template long Device<double>::cuda_update_foreach(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::cuda_update_foreach(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
 template <class T>
 long Device<T>::cuda_width(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
 {
@@ -2323,6 +3494,30 @@ template long Device<double>::cuda_rng_bernoulli(long lInput, double* pfInput, l
 template long Device<float>::cuda_rng_bernoulli(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
 
 
+template <class T>
+long Device<T>::cuda_rng_philox(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 12, 12))
+		return lErr;
+
+	int nMethod = (int)pfInput[0];
+	int n = (int)pfInput[1];
+	T fA = pfInput[2];
+	T fB = pfInput[3];
+	LONGLONG llSeed = getLongLong(&pfInput[4]);
+	int nStream = (int)pfInput[7];
+	LONGLONG llOffset = getLongLong(&pfInput[8]);
+	long hY = (long)pfInput[11];
+
+	return m_math.rng_philox(nMethod, n, fA, fB, llSeed, nStream, llOffset, hY);
+}
+
+template long Device<double>::cuda_rng_philox(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
+template long Device<float>::cuda_rng_philox(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
+
+
 template <class T>
 long Device<T>::cuda_sgd_update(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
 {
@@ -3074,4 +4269,234 @@ long Device<T>::cuda_calc_batch_dist(long lInput, T* pfInput, long* plOutput, T*
 template long Device<double>::cuda_calc_batch_dist(long lInput, double* pfInput, long* plOutput, double** ppfOutput);
 template long Device<float>::cuda_calc_batch_dist(long lInput, float* pfInput, long* plOutput, float** ppfOutput);
 
+template <class T>
+long Device<T>::Benchmark(BenchmarkRunner* pRunner)
+{
+	LONG lErr = 0;
+	LPCSTR pszType = (sizeof(T) == sizeof(float)) ? "float" : "double";
+
+	//-------------------------------------------------
+	//	Handle lookup over N live handles.
+	//-------------------------------------------------
+
+	if (pRunner->IsSelected(BENCH_SUITE_HANDLES))
+	{
+		for (long lSize = pRunner->MinSize(); lSize <= pRunner->MaxSize() && !lErr; lSize *= 4)
+		{
+			std::vector<long> rgHandles;
+
+			for (long i = 0; i < lSize && !lErr; i++)
+			{
+				long hHandle = 0;
+
+				if (!(lErr = m_memory.AllocMemory(m_nDevice, 1, NULL, 0, &hHandle)))
+					rgHandles.push_back(hHandle);
+			}
+
+			if (!lErr)
+			{
+				lErr = pRunner->Run("memory_get_data", pszType, lSize, (double)lSize, [&](LONGLONG llIterations)
+				{
+					MemoryItem* pItem;
+
+					for (LONGLONG i = 0; i < llIterations; i++)
+					{
+						for (size_t j = 0; j < rgHandles.size(); j++)
+						{
+							if (m_memory.GetMemory(rgHandles[j], &pItem))
+								return ERROR_PARAM_OUT_OF_RANGE;
+						}
+					}
+
+					return 0;
+				});
+			}
+
+			for (size_t j = 0; j < rgHandles.size(); j++)
+			{
+				m_memory.FreeMemory(rgHandles[j]);
+			}
+		}
+	}
+
+	//-------------------------------------------------
+	//	Allocator churn, directly and through the
+	//	wrappers that unpack their arguments.
+	//-------------------------------------------------
+
+	if (pRunner->IsSelected(BENCH_SUITE_ALLOCATOR) && !lErr)
+	{
+		for (long lSize = pRunner->MinSize(); lSize <= pRunner->MaxSize() && !lErr; lSize *= 4)
+		{
+			long lCount = lSize * 256;
+
+			lErr = pRunner->Run("alloc_free_device", pszType, lCount, 1, [&](LONGLONG llIterations)
+			{
+				LONG lErr1;
+				long hHandle;
+
+				for (LONGLONG i = 0; i < llIterations; i++)
+				{
+					if (lErr1 = m_memory.AllocMemory(m_nDevice, lCount, NULL, 0, &hHandle))
+						return lErr1;
+
+					if (lErr1 = m_memory.FreeMemory(hHandle))
+						return lErr1;
+				}
+
+				return 0;
+			});
+
+			if (lErr)
+				break;
+
+			lErr = pRunner->Run("alloc_free_device_wrapper", pszType, lCount, 1, [&](LONGLONG llIterations)
+			{
+				LONG lErr1;
+				T rgIn[1];
+				T rgOut[1];
+				T* pOut = rgOut;
+				long lOut = 1;
+
+				for (LONGLONG i = 0; i < llIterations; i++)
+				{
+					rgIn[0] = (T)lCount;
+					if (lErr1 = AllocMemory(1, rgIn, &lOut, &pOut))
+						return lErr1;
+
+					rgIn[0] = rgOut[0];
+					if (lErr1 = FreeMemory(1, rgIn, NULL, NULL))
+						return lErr1;
+				}
+
+				return 0;
+			});
+
+			if (lErr)
+				break;
+
+			lErr = pRunner->Run("alloc_free_host", pszType, lCount, 1, [&](LONGLONG llIterations)
+			{
+				LONG lErr1;
+				T* pData;
+
+				for (LONGLONG i = 0; i < llIterations; i++)
+				{
+					if (lErr1 = m_memory.AllocHost(lCount, &pData, NULL, false))
+						return lErr1;
+
+					if (lErr1 = m_memory.FreeHost(pData))
+						return lErr1;
+				}
+
+				return 0;
+			});
+		}
+	}
+
+	//-------------------------------------------------
+	//	Host t-SNE routines.
+	//-------------------------------------------------
+
+	if (pRunner->IsSelected(BENCH_SUITE_TSNE_HOST) && !lErr)
+	{
+		const unsigned int nD = 2;
+
+		// The exact routines are O(N^2) in time and memory.
+		for (unsigned int nN = pRunner->MinSize(); nN <= (unsigned int)pRunner->MaxSize() && nN <= 4096 && !lErr; nN *= 4)
+		{
+			std::vector<T> rgY(nN * nD);
+			std::vector<T> rgDD(nN * nN);
+			std::vector<T> rgQ(nN * nN);
+			std::vector<T> rgP(nN * nN);
+			std::vector<T> rgdC(nN * nD);
+			T fSumQ = 0;
+
+			srand(1701);
+
+			for (size_t i = 0; i < rgY.size(); i++)
+			{
+				rgY[i] = T(rand()) / T(RAND_MAX) - T(0.5);
+			}
+
+			for (size_t i = 0; i < rgP.size(); i++)
+			{
+				rgP[i] = T(1) / T(nN * nN);
+			}
+
+			lErr = pRunner->Run("tsne_compute_squared_euclidean_distance", pszType, nN, (double)nN * nN, [&](LONGLONG llIterations)
+			{
+				LONG lErr1;
+
+				for (LONGLONG i = 0; i < llIterations; i++)
+				{
+					if (lErr1 = m_math.tsne_compute_squared_euclidean_distance(nN, nD, &rgY[0], &rgDD[0]))
+						return lErr1;
+				}
+
+				return 0;
+			});
+
+			if (!lErr)
+			{
+				lErr = pRunner->Run("tsne_compute_q_matrix", pszType, nN, (double)nN * nN, [&](LONGLONG llIterations)
+				{
+					LONG lErr1;
+
+					for (LONGLONG i = 0; i < llIterations; i++)
+					{
+						if (lErr1 = m_math.tsne_compute_q_matrix(nN, &rgDD[0], &rgQ[0], &fSumQ))
+							return lErr1;
+					}
+
+					return 0;
+				});
+			}
+
+			if (!lErr)
+			{
+				lErr = pRunner->Run("tsne_compute_exact_gradient", pszType, nN, (double)nN * nN, [&](LONGLONG llIterations)
+				{
+					LONG lErr1;
+
+					for (LONGLONG i = 0; i < llIterations; i++)
+					{
+						memset(&rgdC[0], 0, sizeof(T) * rgdC.size());
+
+						if (lErr1 = m_math.tsne_compute_exact_gradient(nN, nD, &rgY[0], &rgP[0], &rgQ[0], &rgdC[0], fSumQ))
+							return lErr1;
+					}
+
+					return 0;
+				});
+			}
+		}
+	}
+
+	//-------------------------------------------------
+	//	The tree based t-SNE routines.
+	//-------------------------------------------------
+
+	if (!lErr)
+		lErr = tsnegpHandle<T>::Benchmark(pRunner);
+
+	if (!lErr)
+		lErr = tsnegHandle<T>::Benchmark(pRunner);
+
+	//-------------------------------------------------
+	//	The host BLAS engine and host kernels.
+	//-------------------------------------------------
+
+	if (!lErr)
+		lErr = HostBlas<T>::Benchmark(pRunner);
+
+	if (!lErr)
+		lErr = HostKernels<T>::Benchmark(pRunner);
+
+	return lErr;
+}
+
+template long Device<double>::Benchmark(BenchmarkRunner* pRunner);
+template long Device<float>::Benchmark(BenchmarkRunner* pRunner);
+
 //end device.cu
\ No newline at end of file
@@ -26,6 +26,8 @@ const int DEVPROP_DEVICECOUNT			= 1;
 const int DEVPROP_NAME					= 2;
 const int DEVPROP_MULTIGPUBOARDGROUPID	= 3;
 
+class BenchmarkRunner;
+
 
 //-----------------------------------------------------------------------------
 //	Device Class
@@ -48,6 +50,12 @@ class Device
 		long verifyOutput(long* plOutput, T** ppfOutput);
 		long setOutput(long hHandle, long* plOutput, T** ppfOutput);
 		long setOutput(T fVal, long* plOutput, T** ppfOutput);
+		LONGLONG getLongLong(T* pfInput);
+		long checkHostSoftmaxLoss(int nShape, T* pfDiff);
+		long checkHostUpdate(int nMethod, T* pfDiff);
+		long checkHostLstm(int nClip, T* pfDiff);
+		long checkHostPhilox(int nMethod, T* pfDiff);
+		long checkHostPooling(int nGeometry, T* pfDiff);
 
 	public:
 		Device();
@@ -62,6 +70,8 @@ class Device
 		long ResetDevice();
 		long SynchronizeDevice();
 
+		long Benchmark(BenchmarkRunner* pRunner);
+
 		long GetMemory(long hHandle, MemoryItem** ppItem)
 		{
 			return m_memory.GetMemory(hHandle, ppItem);
@@ -80,6 +90,7 @@ class Device
 		long GetDeviceName(long lInput, LONG* pfInput, LPTSTR* ppfOutput);
 		long GetDeviceP2PInfo(long lInput, LONG* pfInput, LPTSTR* ppfOutput);
 		long GetDeviceInfo(long lInput, LONG* pfInput, LPTSTR* ppfOutput);
+		long GetAllocReport(long lInput, LONG* pfInput, LPTSTR* ppfOutput);
 
 		long SetDevice(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long SetRandomSeed(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
@@ -97,6 +108,12 @@ class Device
 		long FreeMemory(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long GetMemory(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long SetMemory(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long EnableAllocTracker(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long SetAllocTag(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long ReportAllocations();
+		long EnableHostMirror(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long GetHostMirrorStats(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long CheckHostBlas(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long SetMemoryAt(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		
 		long AllocHostBuffer(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
@@ -122,6 +139,11 @@ class Device
 			return m_memory.AllocHost(lCount, ppDst, pSrc, bSrcOnDevice);
 		}
 
+		long AllocHost(LPTSTR* ppDst, LPTSTR pSrc)
+		{
+			return m_memory.AllocHost(ppDst, pSrc);
+		}
+
 		long CreateMemoryPointer(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long FreeMemoryPointer(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
@@ -133,6 +155,9 @@ class Device
 		long CreateMemoryTest(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long FreeMemoryTest(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long RunMemoryTest(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long StartMemoryTestScrub(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long StopMemoryTestScrub(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long GetMemoryTestScrubStatus(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
 		ncclHandle<T>* GetNccl(long hNccl);
 		long SetNccl(ncclHandle<T>* pNccl, long* plOutput, T** ppfOutput);
@@ -143,6 +168,13 @@ class Device
 		long NcclInitMultiProcess(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long NcclBroadcast(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long NcclAllReduce(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long NcclSetBuckets(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long NcclMarkReady(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long NcclAllReduceBuckets(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long NcclSetCompression(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long NcclGetCompressionStats(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long NcclInitHierarchical(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long NcclGetHierarchy(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
 		long CreateCuDNN(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long FreeCuDNN(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
@@ -204,6 +236,13 @@ class Device
 		long FreePCA(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long RunPCA(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
+		long CreateModelAvg(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long FreeModelAvg(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long ModelAvgPush(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long ModelAvgPull(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long ModelAvgSetWeight(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long ModelAvgGetStats(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+
 		long CreateTsneGaussianPerplexity(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long FreeTsneGaussianPerplexity(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long FindTsneGaussianPerplexity(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
@@ -253,8 +292,10 @@ class Device
 		long cuda_maxval(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_minval(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_minmaxval(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long cuda_stats(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_sumsq(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_sumsqdiff(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long cuda_fused_expr(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_width(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_contains_point(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_denan(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
@@ -275,6 +316,7 @@ class Device
 		long cuda_rng_uniform(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_rng_gaussian(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_rng_bernoulli(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long cuda_rng_philox(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
 		long cuda_batchreidx_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_batchreidx_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
@@ -302,6 +344,8 @@ class Device
 
 		long cuda_dropout_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_dropout_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long cuda_dropout_fwd_bits(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long cuda_dropout_bwd_bits(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
 		long cuda_bnll_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_bnll_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
@@ -312,6 +356,7 @@ class Device
 
 		long cuda_softmaxloss_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_softmaxloss_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long cuda_softmaxloss_fused(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
 		long cuda_max_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_max_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
@@ -344,6 +389,8 @@ class Device
 		long cuda_lstm_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_lstm_unit_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_lstm_unit_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long cuda_lstm_seq_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long cuda_lstm_seq_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
 		long cuda_coeff_sum_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_coeff_sum_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
@@ -357,6 +404,7 @@ class Device
 		long cuda_adadelta_update(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_adam_update(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 		long cuda_rmsprop_update(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
+		long cuda_update_foreach(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
 		long cuda_combine_data(long lInput, T* pfInput, long* plOutput, T** ppfOutput);
 
@@ -439,6 +487,20 @@ inline long Device<T>::setOutput(T fVal, long* plOutput, T** ppfOutput)
 	return 0;
 }
 
+//-----------------------------------------------------------------------------
+//	Returns the 64-bit value passed in three 22-bit parts, low part first,
+//	so that the value is exact in the float parameters too.
+//-----------------------------------------------------------------------------
+template <class T>
+inline LONGLONG Device<T>::getLongLong(T* pfInput)
+{
+	unsigned long long ll0 = (unsigned long long)pfInput[0];
+	unsigned long long ll1 = (unsigned long long)pfInput[1];
+	unsigned long long ll2 = (unsigned long long)pfInput[2];
+
+	return (LONGLONG)(ll0 | (ll1 << 22) | (ll2 << 44));
+}
+
 
 //=============================================================================
 //	Device Methods
@@ -492,7 +554,12 @@ inline long Device<T>::ResetDevice()
 template <class T>
 inline long Device<T>::SynchronizeDevice()
 {
-	return cudaDeviceSynchronize();
+	TraceScope trace("cudaDeviceSynchronize", TRACE_CAT_SYNC);
+
+	LONG lErr = cudaDeviceSynchronize();
+	m_memory.GetMemoryCollection()->InvalidateMirrors();
+
+	return lErr;
 }
 
 template <class T>
@@ -681,20 +748,21 @@ inline long Device<T>::CreateMemoryTest(long lInput, T* pfInput, long* plOutput,
 	LONG lErr;
 	long hHandle = 0;
 
-	if (lErr = verifyInput(lInput, pfInput, 1, 1))
+	if (lErr = verifyInput(lInput, pfInput, 1, 2))
 		return lErr;
 
 	if (lErr = verifyOutput(plOutput, ppfOutput))
 		return lErr;
 
 	T fPctToAllocate = pfInput[0];
+	bool bHost = (lInput > 1 && pfInput[1] != 0) ? true : false;
 
 	size_t szTotalNumBlocks = 0;
 	T fMemAllocated = 0;
 	T fMemStartAddr = 0;
 	T fMemBlockSize = 0;
 
-	if (lErr = m_memory.CreateMemoryTest(fPctToAllocate, &hHandle, &szTotalNumBlocks, &fMemAllocated, &fMemStartAddr, &fMemBlockSize))
+	if (lErr = m_memory.CreateMemoryTest(fPctToAllocate, bHost, &hHandle, &szTotalNumBlocks, &fMemAllocated, &fMemStartAddr, &fMemBlockSize))
 		return lErr;
 
 	T* pfOutput = NULL;
@@ -727,6 +795,73 @@ inline long Device<T>::FreeMemoryTest(long lInput, T* pfInput, long* plOutput, T
 	return m_memory.FreeMemoryTest(hHandle);
 }
 
+template <class T>
+inline long Device<T>::StartMemoryTestScrub(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 5, 7))
+		return lErr;
+
+	long hHandle = (long)pfInput[0];
+	MEMTEST_TYPE memTestType = (MEMTEST_TYPE)(int)pfInput[1];
+	int nMsPerSec = (int)pfInput[2];
+	T fMBPerSec = pfInput[3];
+	size_t szBlocksPerSlice = (size_t)pfInput[4];
+	size_t szStartBlock = 0;
+	int nPasses = 0;
+
+	if (lInput > 5)
+		szStartBlock = (size_t)pfInput[5];
+
+	if (lInput > 6)
+		nPasses = (int)pfInput[6];
+
+	return m_memory.StartMemoryTestScrub(hHandle, memTestType, nMsPerSec, fMBPerSec, szBlocksPerSlice, szStartBlock, nPasses);
+}
+
+template <class T>
+inline long Device<T>::StopMemoryTestScrub(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, 1))
+		return lErr;
+
+	long hHandle = (long)pfInput[0];
+
+	return m_memory.StopMemoryTestScrub(hHandle);
+}
+
+template <class T>
+inline long Device<T>::GetMemoryTestScrubStatus(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, 1))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	long hHandle = (long)pfInput[0];
+	T* pfOutput = NULL;
+
+	if (lErr = m_memory.AllocHost(MEMTEST_SCRUB_STATUS_COUNT, &pfOutput, NULL, false))
+		return lErr;
+
+	if (lErr = m_memory.GetMemoryTestScrubStatus(hHandle, pfOutput, MEMTEST_SCRUB_STATUS_COUNT))
+	{
+		m_memory.FreeHost(pfOutput);
+		return lErr;
+	}
+
+	*ppfOutput = pfOutput;
+	*plOutput = MEMTEST_SCRUB_STATUS_COUNT;
+
+	return 0;
+}
+
 
 //=============================================================================
 //	Cuda Methods
@@ -1293,7 +1428,7 @@ inline long Device<T>::cuda_pooling_fwd(long lInput, T* pfInput, long* plOutput,
 {
 	LONG lErr;
 
-	if (lErr = verifyInput(lInput, pfInput, 18, 18))
+	if (lErr = verifyInput(lInput, pfInput, 18, 19))
 		return lErr;
 
 	int nMethod = (int)pfInput[0];
@@ -1314,8 +1449,12 @@ inline long Device<T>::cuda_pooling_fwd(long lInput, T* pfInput, long* plOutput,
 	long hTopData = (long)pfInput[15];
 	long hMask = (long)pfInput[16];
 	long hTopMask = (long)pfInput[17];
+	bool bMask8 = false;
 
-	return m_math.pooling_fwd(nMethod, nCount, hBottomData, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, hTopData, hMask, hTopMask);
+	if (lInput > 18)
+		bMask8 = (pfInput[18] == 0) ? false : true;
+
+	return m_math.pooling_fwd(nMethod, nCount, hBottomData, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, hTopData, hMask, hTopMask, bMask8);
 }
 
 template <class T>
@@ -1323,7 +1462,7 @@ inline long Device<T>::cuda_pooling_bwd(long lInput, T* pfInput, long* plOutput,
 {
 	LONG lErr;
 
-	if (lErr = verifyInput(lInput, pfInput, 18, 18))
+	if (lErr = verifyInput(lInput, pfInput, 18, 19))
 		return lErr;
 
 	int nMethod = (int)pfInput[0];
@@ -1344,8 +1483,12 @@ inline long Device<T>::cuda_pooling_bwd(long lInput, T* pfInput, long* plOutput,
 	long hBottomDiff = (long)pfInput[15];
 	long hMask = (long)pfInput[16];
 	long hTopMask = (long)pfInput[17];
+	bool bMask8 = false;
+
+	if (lInput > 18)
+		bMask8 = (pfInput[18] == 0) ? false : true;
 
-	return m_math.pooling_bwd(nMethod, nCount, hTopDiff, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, hBottomDiff, hMask, hTopMask);
+	return m_math.pooling_bwd(nMethod, nCount, hTopDiff, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, hBottomDiff, hMask, hTopMask, bMask8);
 }
 
 
@@ -1741,6 +1884,144 @@ inline long Device<T>::RunPCA(long lInput, T* pfInput, long* plOutput, T** ppfOu
 }
 
 
+template <class T>
+inline long Device<T>::CreateModelAvg(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+	long hHandle = 0;
+
+	if (lErr = verifyInput(lInput, pfInput, 5, 5 + MODELAVG_MAX_WORKERS))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	int nCount = (int)pfInput[0];
+	int nWorkers = (int)pfInput[1];
+	int nMaxStaleness = (int)pfInput[2];
+	int nQueueDepth = (int)pfInput[3];
+	long hInitialWeights = (long)pfInput[4];
+	T* rgfWeight = NULL;
+
+	// The per-worker mixing weights are optional, they default to 1/nWorkers.
+	if (lInput > 5)
+	{
+		if (lInput != 5 + nWorkers)
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		rgfWeight = &pfInput[5];
+	}
+
+	if (lErr = m_memory.CreateModelAvg(nCount, nWorkers, nMaxStaleness, nQueueDepth, hInitialWeights, rgfWeight, &m_math, &hHandle))
+		return lErr;
+
+	return setOutput(hHandle, plOutput, ppfOutput);
+}
+
+template <class T>
+inline long Device<T>::FreeModelAvg(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, 1))
+		return lErr;
+
+	long hHandle = (long)pfInput[0];
+
+	return m_memory.FreeModelAvg(hHandle);
+}
+
+template <class T>
+inline long Device<T>::ModelAvgPush(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 5, 5))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	long hHandle = (long)pfInput[0];
+	long hStream = (long)pfInput[1];
+	int nWorker = (int)pfInput[2];
+	long hDelta = (long)pfInput[3];
+	long lBaseVersion = (long)pfInput[4];
+	bool bAccepted = false;
+
+	if (lErr = m_memory.ModelAvgPush(hHandle, hStream, nWorker, hDelta, lBaseVersion, &bAccepted))
+		return lErr;
+
+	return setOutput((bAccepted) ? T(1) : T(0), plOutput, ppfOutput);
+}
+
+template <class T>
+inline long Device<T>::ModelAvgPull(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 3, 3))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	long hHandle = (long)pfInput[0];
+	long hStream = (long)pfInput[1];
+	long hDst = (long)pfInput[2];
+	long lVersion = 0;
+
+	if (lErr = m_memory.ModelAvgPull(hHandle, hStream, hDst, &lVersion))
+		return lErr;
+
+	return setOutput(lVersion, plOutput, ppfOutput);
+}
+
+template <class T>
+inline long Device<T>::ModelAvgSetWeight(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 3, 3))
+		return lErr;
+
+	long hHandle = (long)pfInput[0];
+	int nWorker = (int)pfInput[1];
+	T fWeight = pfInput[2];
+
+	return m_memory.ModelAvgSetWeight(hHandle, nWorker, fWeight);
+}
+
+template <class T>
+inline long Device<T>::ModelAvgGetStats(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, 1))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	long hHandle = (long)pfInput[0];
+	T* pfOutput = NULL;
+
+	if (lErr = m_memory.AllocHost(MODELAVG_STATS_COUNT, &pfOutput, NULL, false))
+		return lErr;
+
+	if (lErr = m_memory.ModelAvgGetStats(hHandle, pfOutput, MODELAVG_STATS_COUNT))
+	{
+		m_memory.FreeHost(pfOutput);
+		return lErr;
+	}
+
+	*ppfOutput = pfOutput;
+	*plOutput = MODELAVG_STATS_COUNT;
+
+	return 0;
+}
+
+
 template <class T>
 inline long Device<T>::CreateTsneGaussianPerplexity(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
 {
@@ -2042,6 +2323,270 @@ inline long Device<T>::NcclAllReduce(long lInput, T* pfInput, long* plOutput, T*
 	return m_memory.NcclAllReduce(hNccl, hStream, hX, nCount, op, fScale);
 }
 
+template <class T>
+inline long Device<T>::NcclSetBuckets(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 5, INT_MAX))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	long hNccl = (long)pfInput[0];
+	long lBucketSizeInBytes = (long)pfInput[1];
+	NCCL_OP op = (NCCL_OP)(int)pfInput[2];
+	T fScale = pfInput[3];
+	int nCount = (int)pfInput[4];
+
+	if (lInput != 5 + nCount * 2)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	long* rghGrad = NULL;
+	long* rglGradCount = NULL;
+
+	if (nCount > 0)
+	{
+		rghGrad = new long[nCount];
+		if (rghGrad == NULL)
+			return ERROR_MEMORY_OUT;
+
+		rglGradCount = new long[nCount];
+		if (rglGradCount == NULL)
+		{
+			delete rghGrad;
+			return ERROR_MEMORY_OUT;
+		}
+
+		for (int i = 0; i < nCount; i++)
+		{
+			rghGrad[i] = (long)pfInput[5 + i * 2];
+			rglGradCount[i] = (long)pfInput[5 + i * 2 + 1];
+		}
+	}
+
+	int nBucketCount = 0;
+	lErr = m_memory.NcclSetBuckets(hNccl, lBucketSizeInBytes, op, fScale, nCount, rghGrad, rglGradCount, &nBucketCount);
+
+	if (rghGrad != NULL)
+		delete rghGrad;
+
+	if (rglGradCount != NULL)
+		delete rglGradCount;
+
+	if (lErr)
+		return lErr;
+
+	return setOutput((long)nBucketCount, plOutput, ppfOutput);
+}
+
+template <class T>
+inline long Device<T>::NcclMarkReady(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 3, 3))
+		return lErr;
+
+	long hNccl = (long)pfInput[0];
+	long hStream = (long)pfInput[1];
+	int nIdx = (int)pfInput[2];
+
+	return m_memory.NcclMarkReady(hNccl, hStream, nIdx);
+}
+
+template <class T>
+inline long Device<T>::NcclAllReduceBuckets(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 2, 2))
+		return lErr;
+
+	long hNccl = (long)pfInput[0];
+	long hStream = (long)pfInput[1];
+
+	return m_memory.NcclAllReduceBuckets(hNccl, hStream);
+}
+
+template <class T>
+inline long Device<T>::NcclSetCompression(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 3, 3))
+		return lErr;
+
+	long hNccl = (long)pfInput[0];
+	NCCL_COMPRESSION type = (NCCL_COMPRESSION)(int)pfInput[1];
+	double dfParam = (double)pfInput[2];
+
+	return m_memory.NcclSetCompression(hNccl, type, dfParam);
+}
+
+template <class T>
+inline long Device<T>::NcclGetCompressionStats(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 1, 1))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	long hNccl = (long)pfInput[0];
+	T* pfOutput = NULL;
+
+	if (lErr = m_memory.AllocHost(NCCL_COMPRESSION_STATS_COUNT, &pfOutput, NULL, false))
+		return lErr;
+
+	if (lErr = m_memory.NcclGetCompressionStats(hNccl, pfOutput, NCCL_COMPRESSION_STATS_COUNT))
+	{
+		m_memory.FreeHost(pfOutput);
+		return lErr;
+	}
+
+	*ppfOutput = pfOutput;
+	*plOutput = NCCL_COMPRESSION_STATS_COUNT;
+
+	return 0;
+}
+
+template <class T>
+inline long Device<T>::NcclInitHierarchical(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 3, INT_MAX))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	long lBufferCount = (long)pfInput[0];
+	int nCount = (int)pfInput[1];
+
+	// The group ids are optional, when missing the groups are found from the peer access.
+	bool bGroups = (lInput == 2 + nCount * 2) ? true : false;
+	if (!bGroups && lInput != 2 + nCount)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	long* rgHandles = new long[nCount];
+	if (rgHandles == NULL)
+		return ERROR_MEMORY_OUT;
+
+	int* rgGroupId = NULL;
+	if (bGroups)
+	{
+		rgGroupId = new int[nCount];
+		if (rgGroupId == NULL)
+		{
+			delete rgHandles;
+			return ERROR_MEMORY_OUT;
+		}
+	}
+
+	for (int i = 0; i < nCount; i++)
+	{
+		rgHandles[i] = (long)pfInput[i + 2];
+
+		if (rgGroupId != NULL)
+			rgGroupId[i] = (int)pfInput[i + 2 + nCount];
+	}
+
+	int nGroups = 0;
+	lErr = m_memory.NcclInitHierarchical(lBufferCount, rgHandles, rgGroupId, nCount, &nGroups);
+	delete rgHandles;
+
+	if (rgGroupId != NULL)
+		delete rgGroupId;
+
+	if (lErr)
+		return lErr;
+
+	return setOutput((long)nGroups, plOutput, ppfOutput);
+}
+
+//-----------------------------------------------------------------------------
+//	Returns the hierarchy that NcclInitHierarchical would build, without
+//	any GPUs.  The inputs are: nCount, bPeer and then either the nCount x
+//	nCount peer access flags (bPeer = 1) or the group id of each rank.  The
+//	outputs are: nGroups, bUniform, nCrossSets and then the group, local
+//	rank and cross set of each rank, where -1 marks a rank in no cross set.
+//-----------------------------------------------------------------------------
+template <class T>
+inline long Device<T>::NcclGetHierarchy(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 3, INT_MAX))
+		return lErr;
+
+	if (lErr = verifyOutput(plOutput, ppfOutput))
+		return lErr;
+
+	int nCount = (int)pfInput[0];
+	bool bPeer = (pfInput[1] != 0) ? true : false;
+
+	if (nCount <= 0 || lInput != 2 + ((bPeer) ? nCount * nCount : nCount))
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	std::vector<int> rgGroupId(nCount);
+
+	if (bPeer)
+	{
+		bool* rgbPeer = new bool[nCount * nCount];
+		if (rgbPeer == NULL)
+			return ERROR_MEMORY_OUT;
+
+		for (int i = 0; i < nCount * nCount; i++)
+		{
+			rgbPeer[i] = (pfInput[2 + i] != 0) ? true : false;
+		}
+
+		lErr = ncclHierarchy::FindGroups(nCount, rgbPeer, &rgGroupId[0]);
+		delete [] rgbPeer;
+
+		if (lErr)
+			return lErr;
+	}
+	else
+	{
+		for (int i = 0; i < nCount; i++)
+		{
+			rgGroupId[i] = (int)pfInput[2 + i];
+		}
+	}
+
+	ncclHierarchy hier;
+	if (lErr = hier.Build(nCount, &rgGroupId[0]))
+		return lErr;
+
+	T* pfOutput = NULL;
+	long lCount = 3 + nCount * 3;
+
+	if (lErr = m_memory.AllocHost(lCount, &pfOutput, NULL, false))
+		return lErr;
+
+	pfOutput[0] = (T)hier.m_rgGroups.size();
+	pfOutput[1] = (T)((hier.m_bUniform) ? 1 : 0);
+	pfOutput[2] = (T)hier.m_rgCross.size();
+
+	for (int i = 0; i < nCount; i++)
+	{
+		pfOutput[3 + i * 3 + 0] = (T)hier.GroupOf(i);
+		pfOutput[3 + i * 3 + 1] = (T)hier.LocalRank(i);
+		pfOutput[3 + i * 3 + 2] = (T)hier.CrossOf(i);
+	}
+
+	*ppfOutput = pfOutput;
+	*plOutput = lCount;
+
+	return 0;
+}
+
 
 template <class T>
 inline long Device<T>::cuda_sigmoid_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
@@ -2354,6 +2899,48 @@ inline long Device<T>::cuda_dropout_bwd(long lInput, T* pfInput, long* plOutput,
 	return m_math.dropout_bwd(nCount, hTopDiff, hMask, uiThreshold, fScale, hBottomDiff);
 }
 
+template <class T>
+inline long Device<T>::cuda_dropout_fwd_bits(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 13, 13))
+		return lErr;
+
+	int nCount = (int)pfInput[0];
+	long hBottomData = (long)pfInput[1];
+	long hMaskBits = (long)pfInput[2];
+	unsigned int uiThreshold = (unsigned int)pfInput[3];
+	T fScale = pfInput[4];
+	LONGLONG llSeed = getLongLong(&pfInput[5]);
+	int nStream = (int)pfInput[8];
+	LONGLONG llOffset = getLongLong(&pfInput[9]);
+	long hTopData = (long)pfInput[12];
+
+	return m_math.dropout_fwd_bits(nCount, hBottomData, hMaskBits, uiThreshold, fScale, llSeed, nStream, llOffset, hTopData);
+}
+
+template <class T>
+inline long Device<T>::cuda_dropout_bwd_bits(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 13, 13))
+		return lErr;
+
+	int nCount = (int)pfInput[0];
+	long hTopDiff = (long)pfInput[1];
+	long hMaskBits = (long)pfInput[2];
+	unsigned int uiThreshold = (unsigned int)pfInput[3];
+	T fScale = pfInput[4];
+	LONGLONG llSeed = getLongLong(&pfInput[5]);
+	int nStream = (int)pfInput[8];
+	LONGLONG llOffset = getLongLong(&pfInput[9]);
+	long hBottomDiff = (long)pfInput[12];
+
+	return m_math.dropout_bwd_bits(nCount, hTopDiff, hMaskBits, uiThreshold, fScale, llSeed, nStream, llOffset, hBottomDiff);
+}
+
 template <class T>
 inline long Device<T>::cuda_bnll_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
 {
@@ -2492,6 +3079,35 @@ inline long Device<T>::cuda_softmaxloss_bwd(long lInput, T* pfInput, long* plOut
 	return m_math.softmaxloss_bwd(nCount, hTopData, hLabels, hBottomDiff, nOuterNum, nDim, nInnerNum, hCounts, nIgnoreLabel);
 }
 
+template <class T>
+inline long Device<T>::cuda_softmaxloss_fused(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 9, 11))
+		return lErr;
+
+	int nCount = (int)pfInput[0];
+	long hBottomData = (long)pfInput[1];
+	long hLabels = (long)pfInput[2];
+	long hLossData = (long)pfInput[3];
+	int nOuterNum = (int)pfInput[4];
+	int nDim = (int)pfInput[5];
+	int nInnerNum = (int)pfInput[6];
+	long hCounts = (long)pfInput[7];
+	int nIgnoreLabel = (int)pfInput[8];
+	long hProbData = 0;
+	long hBottomDiff = 0;
+
+	if (lInput > 9)
+		hProbData = (long)pfInput[9];
+
+	if (lInput > 10)
+		hBottomDiff = (long)pfInput[10];
+
+	return m_math.softmaxloss_fused(nCount, hBottomData, hLabels, hLossData, nOuterNum, nDim, nInnerNum, hCounts, nIgnoreLabel, hProbData, hBottomDiff);
+}
+
 
 template <class T>
 inline long Device<T>::cuda_max_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
@@ -2910,6 +3526,64 @@ inline long Device<T>::cuda_lstm_bwd(long lInput, T* pfInput, long* plOutput, T*
 }
 
 
+template <class T>
+inline long Device<T>::cuda_lstm_seq_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 16, 16))
+		return lErr;
+
+	int nT = (int)pfInput[0];
+	int nN = (int)pfInput[1];
+	int nH = (int)pfInput[2];
+	int nI = (int)pfInput[3];
+	long hWeight_i = (long)pfInput[4];
+	long hWeight_h = (long)pfInput[5];
+	long hBias = (long)pfInput[6];
+	long hBottomData = (long)pfInput[7];
+	long hClipData = (long)pfInput[8];
+	long hH0Data = (long)pfInput[9];
+	long hC0Data = (long)pfInput[10];
+	long hTopData = (long)pfInput[11];
+	long hCellData = (long)pfInput[12];
+	long hPreGateData = (long)pfInput[13];
+	long hGateData = (long)pfInput[14];
+	long hHtoGateData = (long)pfInput[15];
+
+	return m_math.lstm_seq_fwd(nT, nN, nH, nI, hWeight_i, hWeight_h, hBias, hBottomData, hClipData, hH0Data, hC0Data, hTopData, hCellData, hPreGateData, hGateData, hHtoGateData);
+}
+
+
+template <class T>
+inline long Device<T>::cuda_lstm_seq_bwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
+{
+	LONG lErr;
+
+	if (lErr = verifyInput(lInput, pfInput, 16, 16))
+		return lErr;
+
+	int nT = (int)pfInput[0];
+	int nN = (int)pfInput[1];
+	int nH = (int)pfInput[2];
+	T fClip = pfInput[3];
+	long hWeight_h = (long)pfInput[4];
+	long hClipData = (long)pfInput[5];
+	long hTopDiff = (long)pfInput[6];
+	long hCellData = (long)pfInput[7];
+	long hCellDiff = (long)pfInput[8];
+	long hPreGateDiff = (long)pfInput[9];
+	long hGateData = (long)pfInput[10];
+	long hGateDiff = (long)pfInput[11];
+	long hC0Data = (long)pfInput[12];
+	long hH0Diff = (long)pfInput[13];
+	long hC0Diff = (long)pfInput[14];
+	long hHtoHData = (long)pfInput[15];
+
+	return m_math.lstm_seq_bwd(nT, nN, nH, fClip, hWeight_h, hClipData, hTopDiff, hCellData, hCellDiff, hPreGateDiff, hGateData, hGateDiff, hC0Data, hH0Diff, hC0Diff, hHtoHData);
+}
+
+
 template <class T>
 inline long Device<T>::cuda_lstm_unit_fwd(long lInput, T* pfInput, long* plOutput, T** ppfOutput)
 {
@@ -0,0 +1,179 @@
+//=============================================================================
+//	FILE:	hazard.h
+//
+//	DESC:	This file implements the hazard tracker used by the stream pool to
+//			find the dependencies between the operations run on its lanes.
+//
+//			NOTE: this file does not depend on the CUDA headers so that the
+//			hazard tracking can be tested on the host.
+//=============================================================================
+#ifndef __HAZARD_CU__
+#define __HAZARD_CU__
+
+#include <windows.h>
+#include <limits.h>
+#include <vector>
+#include <map>
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int HAZARD_MAX_LANES = 32;
+const LONGLONG HAZARD_WHOLE_HANDLE = LLONG_MAX;
+
+//=============================================================================
+//	Types
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	A range of items [llBegin, llEnd) within a memory handle, use an end of
+//	HAZARD_WHOLE_HANDLE to cover the rest of the handle.
+//-----------------------------------------------------------------------------
+typedef struct HAZARD_RANGE
+{
+	long hHandle;
+	LONGLONG llBegin;
+	LONGLONG llEnd;
+} HAZARD_RANGE;
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Hazard Tracker Class
+//
+//	Remembers which lane last read and wrote each handle range.  When an
+//	operation is scheduled on a lane, it must wait for the other lanes that
+//	wrote a range it reads (read after write), or that read or wrote a range
+//	it writes (write after read, write after write).  Operations on the same
+//	lane are already ordered, so they never wait on each other.
+//-----------------------------------------------------------------------------
+class HazardTracker
+{
+	class Access
+	{
+	public:
+		LONGLONG m_llBegin;
+		LONGLONG m_llEnd;
+		int m_nLane;
+		bool m_bWrite;
+	};
+
+	std::map<long, std::vector<Access>> m_rgAccess;
+
+	static bool overlaps(const Access& a, const HAZARD_RANGE& r)
+	{
+		return a.m_llBegin < r.llEnd && r.llBegin < a.m_llEnd;
+	}
+
+	static bool covers(const HAZARD_RANGE& r, const Access& a)
+	{
+		return r.llBegin <= a.m_llBegin && a.m_llEnd <= r.llEnd;
+	}
+
+	void add(const HAZARD_RANGE& r, int nLane, bool bWrite)
+	{
+		std::vector<Access>& rgAccess = m_rgAccess[r.hHandle];
+
+		// A write replaces all accesses it covers, which are ordered before
+		// it by the waits.  A read replaces the reads of its lane it covers.
+		for (size_t i = 0; i < rgAccess.size(); )
+		{
+			Access& a = rgAccess[i];
+
+			if (covers(r, a) && (bWrite || (!a.m_bWrite && a.m_nLane == nLane)))
+			{
+				rgAccess[i] = rgAccess.back();
+				rgAccess.pop_back();
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		Access a;
+		a.m_llBegin = r.llBegin;
+		a.m_llEnd = r.llEnd;
+		a.m_nLane = nLane;
+		a.m_bWrite = bWrite;
+		rgAccess.push_back(a);
+	}
+
+public:
+	HazardTracker()
+	{
+	}
+
+	//-------------------------------------------------------------------------
+	//	Records the accesses of an operation on the lane and returns the mask
+	//	of the other lanes that it must wait for.
+	//-------------------------------------------------------------------------
+	DWORD Schedule(int nLane, const HAZARD_RANGE* rgIn, int nIn, const HAZARD_RANGE* rgOut, int nOut)
+	{
+		DWORD dwWait = 0;
+
+		for (int i = 0; i < nIn; i++)
+		{
+			std::map<long, std::vector<Access>>::iterator it = m_rgAccess.find(rgIn[i].hHandle);
+			if (it == m_rgAccess.end())
+				continue;
+
+			for (size_t j = 0; j < it->second.size(); j++)
+			{
+				const Access& a = it->second[j];
+
+				if (a.m_bWrite && a.m_nLane != nLane && overlaps(a, rgIn[i]))
+					dwWait |= (1 << a.m_nLane);
+			}
+		}
+
+		for (int i = 0; i < nOut; i++)
+		{
+			std::map<long, std::vector<Access>>::iterator it = m_rgAccess.find(rgOut[i].hHandle);
+			if (it == m_rgAccess.end())
+				continue;
+
+			for (size_t j = 0; j < it->second.size(); j++)
+			{
+				const Access& a = it->second[j];
+
+				if (a.m_nLane != nLane && overlaps(a, rgOut[i]))
+					dwWait |= (1 << a.m_nLane);
+			}
+		}
+
+		for (int i = 0; i < nIn; i++)
+		{
+			add(rgIn[i], nLane, false);
+		}
+
+		for (int i = 0; i < nOut; i++)
+		{
+			add(rgOut[i], nLane, true);
+		}
+
+		return dwWait;
+	}
+
+	//-------------------------------------------------------------------------
+	//	Forgets all accesses, called once all lanes have been synchronized.
+	//-------------------------------------------------------------------------
+	void Reset()
+	{
+		m_rgAccess.clear();
+	}
+
+	int GetAccessCount(long hHandle)
+	{
+		std::map<long, std::vector<Access>>::iterator it = m_rgAccess.find(hHandle);
+		if (it == m_rgAccess.end())
+			return 0;
+
+		return (int)it->second.size();
+	}
+};
+
+#endif
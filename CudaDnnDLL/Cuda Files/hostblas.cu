@@ -0,0 +1,1108 @@
+//=============================================================================
+//	FILE:	hostblas.cu
+//
+//	DESC:	This file implements the host BLAS engine, which implements the
+//			BLAS routines of the Math class on host memory.
+//=============================================================================
+
+#include "util.h"
+#include "hostblas.h"
+#include "hostengine.h"
+#include "math.h"
+#include "benchmark.h"
+#include <algorithm>
+
+//=============================================================================
+//	Local Functions
+//=============================================================================
+
+template <class T, class VT, int MR, int NV>
+static void tileKernel(int k, const T* pA, const T* pB, T* pC, int ldc, T fAlpha, T fBeta)
+{
+	typedef typename VT::V V;
+	V rgAcc[MR][NV];
+
+	for (int i = 0; i < MR; i++)
+	{
+		for (int j = 0; j < NV; j++)
+		{
+			rgAcc[i][j] = VT::zero();
+		}
+	}
+
+	for (int p = 0; p < k; p++)
+	{
+		V rgB[NV];
+
+		for (int j = 0; j < NV; j++)
+		{
+			rgB[j] = VT::load(pB + j * VT::W);
+		}
+
+		for (int i = 0; i < MR; i++)
+		{
+			V a = VT::set1(pA[i]);
+
+			for (int j = 0; j < NV; j++)
+			{
+				rgAcc[i][j] = VT::fmadd(a, rgB[j], rgAcc[i][j]);
+			}
+		}
+
+		pA += MR;
+		pB += NV * VT::W;
+	}
+
+	V vAlpha = VT::set1(fAlpha);
+
+	if (fBeta == 0)
+	{
+		for (int i = 0; i < MR; i++)
+		{
+			for (int j = 0; j < NV; j++)
+			{
+				VT::store(pC + i * ldc + j * VT::W, VT::mul(vAlpha, rgAcc[i][j]));
+			}
+		}
+	}
+	else
+	{
+		V vBeta = VT::set1(fBeta);
+
+		for (int i = 0; i < MR; i++)
+		{
+			for (int j = 0; j < NV; j++)
+			{
+				T* pDst = pC + i * ldc + j * VT::W;
+				VT::store(pDst, VT::fmadd(vAlpha, rgAcc[i][j], VT::mul(vBeta, VT::load(pDst))));
+			}
+		}
+	}
+
+	VT::cleanup();
+}
+
+template <class T, class VT>
+static T dotKernel(int n, const T* x, const T* y)
+{
+	typedef typename VT::V V;
+	V v0 = VT::zero();
+	V v1 = VT::zero();
+	V v2 = VT::zero();
+	V v3 = VT::zero();
+	int i = 0;
+
+	for (; i + 4 * VT::W <= n; i += 4 * VT::W)
+	{
+		v0 = VT::fmadd(VT::load(x + i), VT::load(y + i), v0);
+		v1 = VT::fmadd(VT::load(x + i + VT::W), VT::load(y + i + VT::W), v1);
+		v2 = VT::fmadd(VT::load(x + i + 2 * VT::W), VT::load(y + i + 2 * VT::W), v2);
+		v3 = VT::fmadd(VT::load(x + i + 3 * VT::W), VT::load(y + i + 3 * VT::W), v3);
+	}
+
+	for (; i + VT::W <= n; i += VT::W)
+	{
+		v0 = VT::fmadd(VT::load(x + i), VT::load(y + i), v0);
+	}
+
+	T fSum = reduce<T, VT>(VT::add(VT::add(v0, v1), VT::add(v2, v3)));
+
+	for (; i < n; i++)
+	{
+		fSum += x[i] * y[i];
+	}
+
+	VT::cleanup();
+
+	return fSum;
+}
+
+template <class T, class VT>
+static void axpyKernel(int n, T fAlpha, const T* x, T* y)
+{
+	typedef typename VT::V V;
+	V vAlpha = VT::set1(fAlpha);
+	int i = 0;
+
+	for (; i + 2 * VT::W <= n; i += 2 * VT::W)
+	{
+		VT::store(y + i, VT::fmadd(vAlpha, VT::load(x + i), VT::load(y + i)));
+		VT::store(y + i + VT::W, VT::fmadd(vAlpha, VT::load(x + i + VT::W), VT::load(y + i + VT::W)));
+	}
+
+	for (; i + VT::W <= n; i += VT::W)
+	{
+		VT::store(y + i, VT::fmadd(vAlpha, VT::load(x + i), VT::load(y + i)));
+	}
+
+	for (; i < n; i++)
+	{
+		y[i] += fAlpha * x[i];
+	}
+
+	VT::cleanup();
+}
+
+template <class T, class VT>
+static T asumKernel(int n, const T* x)
+{
+	typedef typename VT::V V;
+	V v0 = VT::zero();
+	V v1 = VT::zero();
+	int i = 0;
+
+	for (; i + 2 * VT::W <= n; i += 2 * VT::W)
+	{
+		v0 = VT::add(v0, VT::abs(VT::load(x + i)));
+		v1 = VT::add(v1, VT::abs(VT::load(x + i + VT::W)));
+	}
+
+	for (; i + VT::W <= n; i += VT::W)
+	{
+		v0 = VT::add(v0, VT::abs(VT::load(x + i)));
+	}
+
+	T fSum = reduce<T, VT>(VT::add(v0, v1));
+
+	for (; i < n; i++)
+	{
+		fSum += (x[i] < 0) ? -x[i] : x[i];
+	}
+
+	VT::cleanup();
+
+	return fSum;
+}
+
+template <class T, class VT, int MR, int NV>
+static void initKernel(HostBlasKernel<T>* pKernel, int nIsa, int nMC, int nKC, int nNC)
+{
+	pKernel->m_nIsa = nIsa;
+	pKernel->m_nW = VT::W;
+	pKernel->m_nMR = MR;
+	pKernel->m_nNR = NV * VT::W;
+	pKernel->m_nMC = nMC;
+	pKernel->m_nKC = nKC;
+	pKernel->m_nNC = nNC;
+	pKernel->m_pfnTile = &tileKernel<T, VT, MR, NV>;
+	pKernel->m_pfnDot = &dotKernel<T, VT>;
+	pKernel->m_pfnAxpy = &axpyKernel<T, VT>;
+	pKernel->m_pfnAsum = &asumKernel<T, VT>;
+}
+
+// MC is a multiple of MR and NC a multiple of NR.
+static void selectKernel(int nIsa, HostBlasKernel<float>* pKernel)
+{
+	if (nIsa == HOSTBLAS_ISA_AVX512)
+		initKernel<float, VecAvx512Float, 8, 2>(pKernel, nIsa, 128, 256, 2048);
+	else if (nIsa == HOSTBLAS_ISA_AVX2)
+		initKernel<float, VecAvx2Float, 6, 2>(pKernel, nIsa, 144, 256, 2048);
+	else
+		initKernel<float, VecScalar<float>, 4, 4>(pKernel, nIsa, 64, 256, 1024);
+}
+
+static void selectKernel(int nIsa, HostBlasKernel<double>* pKernel)
+{
+	if (nIsa == HOSTBLAS_ISA_AVX512)
+		initKernel<double, VecAvx512Double, 8, 2>(pKernel, nIsa, 96, 256, 1024);
+	else if (nIsa == HOSTBLAS_ISA_AVX2)
+		initKernel<double, VecAvx2Double, 6, 2>(pKernel, nIsa, 96, 256, 1024);
+	else
+		initKernel<double, VecScalar<double>, 4, 4>(pKernel, nIsa, 64, 256, 1024);
+}
+
+//-----------------------------------------------------------------------------
+//	AVX2 also requires FMA, and both require the OS to save the YMM (and for
+//	AVX-512 the ZMM and mask) registers.
+//-----------------------------------------------------------------------------
+static int detectIsa()
+{
+	int rgInfo[4];
+
+	__cpuid(rgInfo, 0);
+	if (rgInfo[0] < 7)
+		return HOSTBLAS_ISA_SCALAR;
+
+	__cpuid(rgInfo, 1);
+	bool bOsXSave = (rgInfo[2] & (1 << 27)) ? true : false;
+	bool bAvx = (rgInfo[2] & (1 << 28)) ? true : false;
+	bool bFma = (rgInfo[2] & (1 << 12)) ? true : false;
+
+	if (!bOsXSave || !bAvx || !bFma)
+		return HOSTBLAS_ISA_SCALAR;
+
+	unsigned __int64 ullXcr0 = _xgetbv(0);
+	if ((ullXcr0 & 0x06) != 0x06)
+		return HOSTBLAS_ISA_SCALAR;
+
+	__cpuidex(rgInfo, 7, 0);
+	bool bAvx2 = (rgInfo[1] & (1 << 5)) ? true : false;
+	bool bAvx512F = (rgInfo[1] & (1 << 16)) ? true : false;
+
+	if (bAvx512F && (ullXcr0 & 0xE6) == 0xE6)
+		return HOSTBLAS_ISA_AVX512;
+
+	if (bAvx2)
+		return HOSTBLAS_ISA_AVX2;
+
+	return HOSTBLAS_ISA_SCALAR;
+}
+
+int getIsa()
+{
+	static int s_nIsa = -1;
+
+	if (s_nIsa < 0)
+	{
+		int nIsa = detectIsa();
+		char szValue[32];
+
+		DWORD dwLen = GetEnvironmentVariableA(HOSTBLAS_ENV_ISA, szValue, 31);
+		if (dwLen > 0 && dwLen < 31)
+		{
+			if (_stricmp(szValue, "scalar") == 0)
+				nIsa = HOSTBLAS_ISA_SCALAR;
+			else if (_stricmp(szValue, "avx2") == 0 && nIsa > HOSTBLAS_ISA_AVX2)
+				nIsa = HOSTBLAS_ISA_AVX2;
+		}
+
+		s_nIsa = nIsa;
+	}
+
+	return s_nIsa;
+}
+
+LPCSTR getIsaName(int nIsa)
+{
+	if (nIsa == HOSTBLAS_ISA_AVX512)
+		return "avx512";
+	else if (nIsa == HOSTBLAS_ISA_AVX2)
+		return "avx2";
+	else
+		return "scalar";
+}
+
+static volatile int s_nThreadOverride = 0;
+
+int getThreadCount()
+{
+	static int s_nThreads = 0;
+
+	if (s_nThreadOverride > 0)
+		return s_nThreadOverride;
+
+	if (s_nThreads == 0)
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		int nThreads = (int)si.dwNumberOfProcessors;
+		char szValue[32];
+
+		DWORD dwLen = GetEnvironmentVariableA(HOSTBLAS_ENV_THREADS, szValue, 31);
+		if (dwLen > 0 && dwLen < 31 && atoi(szValue) > 0)
+			nThreads = atoi(szValue);
+
+		if (nThreads > HOSTBLAS_MAX_THREADS)
+			nThreads = HOSTBLAS_MAX_THREADS;
+
+		if (nThreads < 1)
+			nThreads = 1;
+
+		s_nThreads = nThreads;
+	}
+
+	return s_nThreads;
+}
+
+template <class T>
+const HostBlasKernel<T>* getKernel()
+{
+	static HostBlasKernel<T> s_kernel;
+	static volatile bool s_bInit = false;
+
+	// Selecting twice on a race is harmless, both select the same kernels.
+	if (!s_bInit)
+	{
+		selectKernel(getIsa(), &s_kernel);
+		s_bInit = true;
+	}
+
+	return &s_kernel;
+}
+
+template const HostBlasKernel<double>* getKernel<double>();
+template const HostBlasKernel<float>* getKernel<float>();
+
+//-----------------------------------------------------------------------------
+//	Returns the number of jobs to split the work over, each job gets at
+//	least the minimum work and one unit.
+//-----------------------------------------------------------------------------
+int getJobCount(double dfFlops, int nUnits)
+{
+	int nJobs = (int)(dfFlops / HOSTBLAS_MIN_FLOPS_PER_THREAD);
+
+	nJobs = MIN(nJobs, getThreadCount());
+	nJobs = MIN(nJobs, nUnits);
+
+	return (nJobs < 1) ? 1 : nJobs;
+}
+
+//-----------------------------------------------------------------------------
+//	Runs the jobs, the first on the calling thread.  The other jobs are
+//	handed to idle pool workers, and a job that finds no idle worker is run
+//	on the calling thread instead.
+//-----------------------------------------------------------------------------
+void runJobs(std::vector<std::function<void()>>& rgJobs)
+{
+	HostBatch batch;
+	std::vector<size_t> rgInline;
+
+	for (size_t i = 1; i < rgJobs.size(); i++)
+	{
+		if (!HostPool::Get()->Dispatch(&rgJobs[i], &batch))
+			rgInline.push_back(i);
+	}
+
+	if (rgJobs.size() > 0)
+		rgJobs[0]();
+
+	for (size_t i = 0; i < rgInline.size(); i++)
+	{
+		rgJobs[rgInline[i]]();
+	}
+
+	batch.Wait();
+}
+
+//-----------------------------------------------------------------------------
+//	Runs a team of up to nJobs members, the first on the calling thread.
+//	The team only holds the members that were handed to idle pool workers,
+//	so each member must split its work by the team Size.
+//-----------------------------------------------------------------------------
+void runTeam(int nJobs, std::function<void(int nMember, HostTeam* pTeam)> fn)
+{
+	HostBatch batch;
+	HostTeam team;
+	int nMembers = 1;
+
+	nJobs = MIN(nJobs, HOSTBLAS_MAX_THREADS);
+	std::vector<std::function<void()>> rgJobs(nJobs);
+
+	for (int i = 1; i < nJobs; i++)
+	{
+		rgJobs[i] = [&fn, &team, i]() { fn(i, &team); };
+
+		if (!HostPool::Get()->Dispatch(&rgJobs[i], &batch))
+			break;
+
+		nMembers++;
+	}
+
+	team.Start(nMembers);
+	fn(0, &team);
+
+	batch.Wait();
+}
+
+template <class T>
+static void scaleMatrix(int m, int n, T fBeta, T* c, int ldc)
+{
+	for (int i = 0; i < m; i++)
+	{
+		T* pC = c + (size_t)i * ldc;
+
+		for (int j = 0; j < n; j++)
+		{
+			pC[j] = (fBeta == 0) ? T(0) : fBeta * pC[j];
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Packs the mc x kc block of op(A) starting at a into panels of MR rows,
+//	each stored column by column and padded with zeros.
+//-----------------------------------------------------------------------------
+template <class T>
+static void packA(bool bTransA, int mc, int kc, const T* a, int lda, int nMR, T* pDst)
+{
+	for (int ir = 0; ir < mc; ir += nMR)
+	{
+		int mr = MIN(nMR, mc - ir);
+
+		for (int p = 0; p < kc; p++)
+		{
+			int i = 0;
+
+			if (bTransA)
+			{
+				const T* pSrc = a + (size_t)p * lda + ir;
+
+				for (; i < mr; i++)
+				{
+					pDst[i] = pSrc[i];
+				}
+			}
+			else
+			{
+				for (; i < mr; i++)
+				{
+					pDst[i] = a[(size_t)(ir + i) * lda + p];
+				}
+			}
+
+			for (; i < nMR; i++)
+			{
+				pDst[i] = 0;
+			}
+
+			pDst += nMR;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Packs the kc x nc block of op(B) starting at b into panels of NR columns,
+//	each stored row by row and padded with zeros.
+//-----------------------------------------------------------------------------
+template <class T>
+static void packB(bool bTransB, int kc, int nc, const T* b, int ldb, int nNR, T* pDst)
+{
+	for (int jr = 0; jr < nc; jr += nNR)
+	{
+		int nr = MIN(nNR, nc - jr);
+
+		for (int p = 0; p < kc; p++)
+		{
+			int j = 0;
+
+			if (bTransB)
+			{
+				for (; j < nr; j++)
+				{
+					pDst[j] = b[(size_t)(jr + j) * ldb + p];
+				}
+			}
+			else
+			{
+				const T* pSrc = b + (size_t)p * ldb + jr;
+
+				for (; j < nr; j++)
+				{
+					pDst[j] = pSrc[j];
+				}
+			}
+
+			for (; j < nNR; j++)
+			{
+				pDst[j] = 0;
+			}
+
+			pDst += nNR;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Computes C = alpha * op(A) op(B) + beta * C on a single thread, where all
+//	matrices are row major.
+//-----------------------------------------------------------------------------
+template <class T>
+static long gemmSingle(const HostBlasKernel<T>* pK, bool bTransA, bool bTransB, int m, int n, int k, T fAlpha, const T* a, int lda, const T* b, int ldb, T fBeta, T* c, int ldc)
+{
+	int nMR = pK->m_nMR;
+	int nNR = pK->m_nNR;
+	int nMC = pK->m_nMC;
+	int nKC = pK->m_nKC;
+	int nNC = pK->m_nNC;
+	size_t szPackA = (size_t)MIN(nMC, ((m + nMR - 1) / nMR) * nMR) * MIN(nKC, k);
+	size_t szPackB = (size_t)MIN(nNC, ((n + nNR - 1) / nNR) * nNR) * MIN(nKC, k);
+	T rgTile[HOSTBLAS_MAX_TILE];
+
+	T* pPackA = (T*)_aligned_malloc(sizeof(T) * szPackA, 64);
+	T* pPackB = (T*)_aligned_malloc(sizeof(T) * szPackB, 64);
+
+	if (pPackA == NULL || pPackB == NULL)
+	{
+		if (pPackA != NULL)
+			_aligned_free(pPackA);
+
+		if (pPackB != NULL)
+			_aligned_free(pPackB);
+
+		return ERROR_MEMORY_OUT;
+	}
+
+	for (int jc = 0; jc < n; jc += nNC)
+	{
+		int nc = MIN(nNC, n - jc);
+
+		for (int pc = 0; pc < k; pc += nKC)
+		{
+			int kc = MIN(nKC, k - pc);
+			T fBetaBlock = (pc == 0) ? fBeta : T(1);
+			const T* pB = (bTransB) ? b + (size_t)jc * ldb + pc : b + (size_t)pc * ldb + jc;
+
+			packB(bTransB, kc, nc, pB, ldb, nNR, pPackB);
+
+			for (int ic = 0; ic < m; ic += nMC)
+			{
+				int mc = MIN(nMC, m - ic);
+				const T* pA = (bTransA) ? a + (size_t)pc * lda + ic : a + (size_t)ic * lda + pc;
+
+				packA(bTransA, mc, kc, pA, lda, nMR, pPackA);
+
+				for (int jr = 0; jr < nc; jr += nNR)
+				{
+					int nr = MIN(nNR, nc - jr);
+					const T* pPanelB = pPackB + (size_t)jr * kc;
+
+					for (int ir = 0; ir < mc; ir += nMR)
+					{
+						int mr = MIN(nMR, mc - ir);
+						const T* pPanelA = pPackA + (size_t)ir * kc;
+						T* pC = c + (size_t)(ic + ir) * ldc + jc + jr;
+
+						if (mr == nMR && nr == nNR)
+						{
+							pK->m_pfnTile(kc, pPanelA, pPanelB, pC, ldc, fAlpha, fBetaBlock);
+							continue;
+						}
+
+						// The edge tiles are computed into the tile buffer
+						// so that the kernel never writes outside of C.
+						pK->m_pfnTile(kc, pPanelA, pPanelB, rgTile, nNR, T(1), T(0));
+
+						for (int i = 0; i < mr; i++)
+						{
+							for (int j = 0; j < nr; j++)
+							{
+								T* pDst = pC + (size_t)i * ldc + j;
+								T fVal = fAlpha * rgTile[i * nNR + j];
+
+								if (fBetaBlock != 0)
+									fVal += fBetaBlock * (*pDst);
+
+								*pDst = fVal;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	_aligned_free(pPackA);
+	_aligned_free(pPackB);
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+//	Splits the row major product over the larger of M or N, in whole panels,
+//	across the threads.
+//-----------------------------------------------------------------------------
+template <class T>
+static long gemmRowMajor(bool bTransA, bool bTransB, int m, int n, int k, T fAlpha, const T* a, int lda, const T* b, int ldb, T fBeta, T* c, int ldc)
+{
+	if (m == 0 || n == 0)
+		return 0;
+
+	if (k == 0 || fAlpha == 0)
+	{
+		scaleMatrix(m, n, fBeta, c, ldc);
+		return 0;
+	}
+
+	const HostBlasKernel<T>* pK = getKernel<T>();
+	int nMPanels = (m + pK->m_nMR - 1) / pK->m_nMR;
+	int nNPanels = (n + pK->m_nNR - 1) / pK->m_nNR;
+	bool bSplitN = (nNPanels >= nMPanels) ? true : false;
+	int nPanels = (bSplitN) ? nNPanels : nMPanels;
+	int nUnit = (bSplitN) ? pK->m_nNR : pK->m_nMR;
+	int nJobs = getJobCount(2.0 * m * n * k, nPanels);
+
+	if (nJobs == 1)
+		return gemmSingle(pK, bTransA, bTransB, m, n, k, fAlpha, a, lda, b, ldb, fBeta, c, ldc);
+
+	std::vector<long> rgErr(nJobs, 0);
+	std::vector<std::function<void()>> rgJobs;
+
+	for (int i = 0; i < nJobs; i++)
+	{
+		int nFirst = (int)((LONGLONG)nPanels * i / nJobs) * nUnit;
+		int nLast = MIN((int)((LONGLONG)nPanels * (i + 1) / nJobs) * nUnit, (bSplitN) ? n : m);
+		int mSub = (bSplitN) ? m : nLast - nFirst;
+		int nSub = (bSplitN) ? nLast - nFirst : n;
+		const T* aSub = a;
+		const T* bSub = b;
+		T* cSub = c;
+		long* plErr = &rgErr[i];
+
+		if (bSplitN)
+		{
+			bSub = (bTransB) ? b + (size_t)nFirst * ldb : b + nFirst;
+			cSub = c + nFirst;
+		}
+		else
+		{
+			aSub = (bTransA) ? a + nFirst : a + (size_t)nFirst * lda;
+			cSub = c + (size_t)nFirst * ldc;
+		}
+
+		rgJobs.push_back([=]()
+		{
+			*plErr = gemmSingle(pK, bTransA, bTransB, mSub, nSub, k, fAlpha, aSub, lda, bSub, ldb, fBeta, cSub, ldc);
+		});
+	}
+
+	runJobs(rgJobs);
+
+	for (int i = 0; i < nJobs; i++)
+	{
+		if (rgErr[i])
+			return rgErr[i];
+	}
+
+	return 0;
+}
+
+template <class T>
+static void gemmNaive(bool bTransA, bool bTransB, int m, int n, int k, T fAlpha, const T* a, const T* b, T fBeta, T* c)
+{
+	for (int i = 0; i < m; i++)
+	{
+		for (int j = 0; j < n; j++)
+		{
+			T fSum = 0;
+
+			for (int p = 0; p < k; p++)
+			{
+				T fA = (bTransA) ? a[p * m + i] : a[i * k + p];
+				T fB = (bTransB) ? b[j * k + p] : b[p * n + j];
+				fSum += fA * fB;
+			}
+
+			c[i * n + j] = fAlpha * fSum + ((fBeta == 0) ? T(0) : fBeta * c[i * n + j]);
+		}
+	}
+}
+
+
+
+
+//=============================================================================
+//	HostBlas Methods
+//=============================================================================
+
+template <class T>
+int HostBlas<T>::GetIsa()
+{
+	return getKernel<T>()->m_nIsa;
+}
+
+template int HostBlas<double>::GetIsa();
+template int HostBlas<float>::GetIsa();
+
+
+template <class T>
+int HostBlas<T>::GetThreadCount()
+{
+	return getThreadCount();
+}
+
+template int HostBlas<double>::GetThreadCount();
+template int HostBlas<float>::GetThreadCount();
+
+
+//-----------------------------------------------------------------------------
+//	Overrides the thread count of all later calls, where 0 restores the
+//	count of MYCAFFE_HOST_BLAS_THREADS or the number of processors.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostBlas<T>::SetThreadCount(int nThreads)
+{
+	if (nThreads < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	s_nThreadOverride = MIN(nThreads, HOSTBLAS_MAX_THREADS);
+
+	return 0;
+}
+
+template long HostBlas<double>::SetThreadCount(int nThreads);
+template long HostBlas<float>::SetThreadCount(int nThreads);
+
+
+//-----------------------------------------------------------------------------
+//	C (m x n) = alpha * op(A) (m x k) * op(B) (k x n) + beta * C, all row
+//	major as in Math::gemm.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostBlas<T>::gemm(bool bTransA, bool bTransB, int m, int n, int k, T fAlpha, const T* a, const T* b, T fBeta, T* c, int nAOff, int nBOff, int nCOff)
+{
+	if (m < 0 || n < 0 || k < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (a == NULL || b == NULL || c == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nAOff > 0)
+		a += nAOff;
+
+	if (nBOff > 0)
+		b += nBOff;
+
+	if (nCOff > 0)
+		c += nCOff;
+
+	int lda = (!bTransA) ? k : m;
+	int ldb = (!bTransB) ? n : k;
+
+	return gemmRowMajor(bTransA, bTransB, m, n, k, fAlpha, a, lda, b, ldb, fBeta, c, n);
+}
+
+template long HostBlas<double>::gemm(bool bTransA, bool bTransB, int m, int n, int k, double fAlpha, const double* a, const double* b, double fBeta, double* c, int nAOff, int nBOff, int nCOff);
+template long HostBlas<float>::gemm(bool bTransA, bool bTransB, int m, int n, int k, float fAlpha, const float* a, const float* b, float fBeta, float* c, int nAOff, int nBOff, int nCOff);
+
+
+//-----------------------------------------------------------------------------
+//	Like Math::gemm2 the matrices are column major with the leading dimensions
+//	given, which is the row major product of the transposes with A and B
+//	swapped.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostBlas<T>::gemm2(bool bTransA, bool bTransB, int m, int n, int k, T fAlpha, const T* a, int lda, const T* b, int ldb, T fBeta, T* c, int ldc)
+{
+	if (m < 0 || n < 0 || k < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (lda < ((!bTransA) ? m : k) || ldb < ((!bTransB) ? k : n) || ldc < m)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (a == NULL || b == NULL || c == NULL)
+		return ERROR_PARAM_NULL;
+
+	return gemmRowMajor(bTransB, bTransA, n, m, k, fAlpha, b, ldb, a, lda, fBeta, c, ldc);
+}
+
+template long HostBlas<double>::gemm2(bool bTransA, bool bTransB, int m, int n, int k, double fAlpha, const double* a, int lda, const double* b, int ldb, double fBeta, double* c, int ldc);
+template long HostBlas<float>::gemm2(bool bTransA, bool bTransB, int m, int n, int k, float fAlpha, const float* a, int lda, const float* b, int ldb, float fBeta, float* c, int ldc);
+
+
+//-----------------------------------------------------------------------------
+//	y = alpha * op(A) x + beta * y where A is m x n row major, the rows (or
+//	the columns when transposed) are split across the threads.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostBlas<T>::gemv(bool bTransA, int m, int n, T fAlpha, const T* a, const T* x, T fBeta, T* y, int nAOff, int nXOff, int nYOff)
+{
+	if (m < 0 || n < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (a == NULL || x == NULL || y == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nAOff > 0)
+		a += nAOff;
+
+	if (nXOff > 0)
+		x += nXOff;
+
+	if (nYOff > 0)
+		y += nYOff;
+
+	const HostBlasKernel<T>* pK = getKernel<T>();
+	const int nColUnit = 256;
+	int nUnits = (!bTransA) ? m : (n + nColUnit - 1) / nColUnit;
+	int nJobs = getJobCount(2.0 * m * n, nUnits);
+	std::vector<std::function<void()>> rgJobs;
+
+	for (int i = 0; i < nJobs; i++)
+	{
+		int nFirst = (int)((LONGLONG)nUnits * i / nJobs);
+		int nLast = (int)((LONGLONG)nUnits * (i + 1) / nJobs);
+
+		if (!bTransA)
+		{
+			rgJobs.push_back([=]()
+			{
+				for (int r = nFirst; r < nLast; r++)
+				{
+					T fVal = fAlpha * pK->m_pfnDot(n, a + (size_t)r * n, x);
+					y[r] = (fBeta == 0) ? fVal : fVal + fBeta * y[r];
+				}
+			});
+		}
+		else
+		{
+			int nCol = nFirst * nColUnit;
+			int nCols = MIN(nLast * nColUnit, n) - nCol;
+
+			rgJobs.push_back([=]()
+			{
+				scaleMatrix(1, nCols, fBeta, y + nCol, nCols);
+
+				for (int r = 0; r < m; r++)
+				{
+					pK->m_pfnAxpy(nCols, fAlpha * x[r], a + (size_t)r * n + nCol, y + nCol);
+				}
+			});
+		}
+	}
+
+	runJobs(rgJobs);
+
+	return 0;
+}
+
+template long HostBlas<double>::gemv(bool bTransA, int m, int n, double fAlpha, const double* a, const double* x, double fBeta, double* y, int nAOff, int nXOff, int nYOff);
+template long HostBlas<float>::gemv(bool bTransA, int m, int n, float fAlpha, const float* a, const float* x, float fBeta, float* y, int nAOff, int nXOff, int nYOff);
+
+
+//-----------------------------------------------------------------------------
+//	A (m x n, row major) += alpha * x y'
+//-----------------------------------------------------------------------------
+template <class T>
+long HostBlas<T>::ger(int m, int n, T fAlpha, const T* x, const T* y, T* a, int nXOff, int nYOff, int nAOff)
+{
+	if (m < 0 || n < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (x == NULL || y == NULL || a == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nXOff > 0)
+		x += nXOff;
+
+	if (nYOff > 0)
+		y += nYOff;
+
+	if (nAOff > 0)
+		a += nAOff;
+
+	const HostBlasKernel<T>* pK = getKernel<T>();
+	int nJobs = getJobCount(2.0 * m * n, m);
+	std::vector<std::function<void()>> rgJobs;
+
+	for (int i = 0; i < nJobs; i++)
+	{
+		int nFirst = (int)((LONGLONG)m * i / nJobs);
+		int nLast = (int)((LONGLONG)m * (i + 1) / nJobs);
+
+		rgJobs.push_back([=]()
+		{
+			for (int r = nFirst; r < nLast; r++)
+			{
+				pK->m_pfnAxpy(n, fAlpha * x[r], y, a + (size_t)r * n);
+			}
+		});
+	}
+
+	runJobs(rgJobs);
+
+	return 0;
+}
+
+template long HostBlas<double>::ger(int m, int n, double fAlpha, const double* x, const double* y, double* a, int nXOff, int nYOff, int nAOff);
+template long HostBlas<float>::ger(int m, int n, float fAlpha, const float* x, const float* y, float* a, int nXOff, int nYOff, int nAOff);
+
+
+template <class T>
+long HostBlas<T>::axpy(int n, T fAlpha, const T* x, T* y, int nXOff, int nYOff)
+{
+	if (n < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (x == NULL || y == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nXOff > 0)
+		x += nXOff;
+
+	if (nYOff > 0)
+		y += nYOff;
+
+	getKernel<T>()->m_pfnAxpy(n, fAlpha, x, y);
+
+	return 0;
+}
+
+template long HostBlas<double>::axpy(int n, double fAlpha, const double* x, double* y, int nXOff, int nYOff);
+template long HostBlas<float>::axpy(int n, float fAlpha, const float* x, float* y, int nXOff, int nYOff);
+
+
+template <class T>
+long HostBlas<T>::dot(int n, const T* x, const T* y, T* pOut, int nXOff, int nYOff)
+{
+	if (n < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (x == NULL || y == NULL || pOut == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nXOff > 0)
+		x += nXOff;
+
+	if (nYOff > 0)
+		y += nYOff;
+
+	*pOut = getKernel<T>()->m_pfnDot(n, x, y);
+
+	return 0;
+}
+
+template long HostBlas<double>::dot(int n, const double* x, const double* y, double* pOut, int nXOff, int nYOff);
+template long HostBlas<float>::dot(int n, const float* x, const float* y, float* pOut, int nXOff, int nYOff);
+
+
+template <class T>
+long HostBlas<T>::asum(int n, const T* x, T* pOut, int nXOff)
+{
+	if (n < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (x == NULL || pOut == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nXOff > 0)
+		x += nXOff;
+
+	*pOut = getKernel<T>()->m_pfnAsum(n, x);
+
+	return 0;
+}
+
+template long HostBlas<double>::asum(int n, const double* x, double* pOut, int nXOff);
+template long HostBlas<float>::asum(int n, const float* x, float* pOut, int nXOff);
+
+
+template <class T>
+long HostBlas<T>::nrm2(int n, const T* x, T* pOut, int nXOff)
+{
+	if (n < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (x == NULL || pOut == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nXOff > 0)
+		x += nXOff;
+
+	*pOut = (T)sqrt(getKernel<T>()->m_pfnDot(n, x, x));
+
+	return 0;
+}
+
+template long HostBlas<double>::nrm2(int n, const double* x, double* pOut, int nXOff);
+template long HostBlas<float>::nrm2(int n, const float* x, float* pOut, int nXOff);
+
+
+//-----------------------------------------------------------------------------
+//	Times the gemm on square and skinny shapes against the naive reference,
+//	where the items per second are the FLOP/s.  The result of each shape is
+//	first checked against the reference.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostBlas<T>::Benchmark(BenchmarkRunner* pRunner)
+{
+	LONG lErr = 0;
+	LPCSTR pszType = (sizeof(T) == sizeof(float)) ? "float" : "double";
+	const int nSkinny = 32;
+	const int nMaxNaive = 512;
+	char szName[64];
+
+	if (!pRunner->IsSelected(BENCH_SUITE_HOST_BLAS))
+		return 0;
+
+	_snprintf(szName, 63, "host_gemm_%s", getIsaName(GetIsa()));
+	szName[63] = NULL;
+
+	for (int nSize = pRunner->MinSize(); nSize <= pRunner->MaxSize() && nSize <= 2048 && !lErr; nSize *= 2)
+	{
+		// square, tall-skinny (M x 32 x K) and short-wide (32 x N x K).
+		int rgShape[3][3] = { { nSize, nSize, nSize }, { nSize, nSkinny, nSize }, { nSkinny, nSize, nSize } };
+		LPCSTR rgszShape[3] = { "", "_tall", "_wide" };
+
+		for (int s = 0; s < 3 && !lErr; s++)
+		{
+			int m = rgShape[s][0];
+			int n = rgShape[s][1];
+			int k = rgShape[s][2];
+			double dfFlops = 2.0 * m * n * k;
+			std::vector<T> rgA((size_t)m * k);
+			std::vector<T> rgB((size_t)k * n);
+			std::vector<T> rgC((size_t)m * n);
+			std::vector<T> rgRef((size_t)m * n);
+			char szShapeName[128];
+
+			srand(1701);
+
+			for (size_t i = 0; i < rgA.size(); i++)
+			{
+				rgA[i] = T(rand()) / T(RAND_MAX) - T(0.5);
+			}
+
+			for (size_t i = 0; i < rgB.size(); i++)
+			{
+				rgB[i] = T(rand()) / T(RAND_MAX) - T(0.5);
+			}
+
+			if (m <= nMaxNaive && n <= nMaxNaive)
+			{
+				gemmNaive(false, false, m, n, k, T(1), &rgA[0], &rgB[0], T(0), &rgRef[0]);
+
+				if (lErr = gemm(false, false, m, n, k, T(1), &rgA[0], &rgB[0], T(0), &rgC[0]))
+					return lErr;
+
+				T fTol = (sizeof(T) == sizeof(float)) ? T(1e-3) * k : T(1e-10) * k;
+
+				for (size_t i = 0; i < rgC.size(); i++)
+				{
+					T fDiff = rgC[i] - rgRef[i];
+
+					if (fDiff > fTol || fDiff < -fTol)
+						return ERROR_MATRIX_DIMENSIONS_DONT_MATCH;
+				}
+
+				_snprintf(szShapeName, 127, "host_gemm_naive%s", rgszShape[s]);
+				szShapeName[127] = NULL;
+
+				lErr = pRunner->Run(szShapeName, pszType, nSize, dfFlops, [&](LONGLONG llIterations)
+				{
+					for (LONGLONG i = 0; i < llIterations; i++)
+					{
+						gemmNaive(false, false, m, n, k, T(1), &rgA[0], &rgB[0], T(0), &rgRef[0]);
+					}
+
+					return 0;
+				});
+			}
+
+			if (!lErr)
+			{
+				_snprintf(szShapeName, 127, "%s%s", szName, rgszShape[s]);
+				szShapeName[127] = NULL;
+
+				lErr = pRunner->Run(szShapeName, pszType, nSize, dfFlops, [&](LONGLONG llIterations)
+				{
+					LONG lErr1;
+
+					for (LONGLONG i = 0; i < llIterations; i++)
+					{
+						if (lErr1 = gemm(false, false, m, n, k, T(1), &rgA[0], &rgB[0], T(0), &rgC[0]))
+							return lErr1;
+					}
+
+					return 0;
+				});
+			}
+		}
+	}
+
+	return lErr;
+}
+
+template long HostBlas<double>::Benchmark(BenchmarkRunner* pRunner);
+template long HostBlas<float>::Benchmark(BenchmarkRunner* pRunner);
+
+// end
\ No newline at end of file
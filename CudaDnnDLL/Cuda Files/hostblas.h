@@ -0,0 +1,71 @@
+//=============================================================================
+//	FILE:	hostblas.h
+//
+//	DESC:	This file manages the host BLAS engine, which implements the BLAS
+//			routines of the Math class on host memory.
+//=============================================================================
+#ifndef __HOSTBLAS_CU__
+#define __HOSTBLAS_CU__
+
+#include "util.h"
+
+class BenchmarkRunner;
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+const int HOSTBLAS_ISA_SCALAR = 0;
+const int HOSTBLAS_ISA_AVX2 = 1;
+const int HOSTBLAS_ISA_AVX512 = 2;
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int HOSTBLAS_MAX_THREADS = 64;
+const int HOSTBLAS_MAX_TILE = 8 * 32;
+const double HOSTBLAS_MIN_FLOPS_PER_THREAD = 2.0e6;
+
+const LPCSTR HOSTBLAS_ENV_ISA = "MYCAFFE_HOST_BLAS_ISA";
+const LPCSTR HOSTBLAS_ENV_THREADS = "MYCAFFE_HOST_BLAS_THREADS";
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Host BLAS Class
+//
+//	Implements the BLAS routines used by the Math class with the same row
+//	major calling conventions, on host memory.  The gemm packs the blocks of
+//	A and B into panels sized for the caches and runs a register blocked
+//	micro-kernel on each tile, using the AVX-512 or AVX2 kernels when the
+//	processor and OS support them.  The large products are split over M or
+//	N across threads.
+//
+//	The instruction set is detected on first use and may be lowered with
+//	MYCAFFE_HOST_BLAS_ISA (scalar, avx2 or avx512), and the thread count,
+//	which defaults to the number of processors, may be set with the
+//	MYCAFFE_HOST_BLAS_THREADS variable or overridden with SetThreadCount.
+//-----------------------------------------------------------------------------
+template <class T>
+class HostBlas
+{
+public:
+	static int GetIsa();
+	static int GetThreadCount();
+	static long SetThreadCount(int nThreads);
+
+	static long gemm(bool bTransA, bool bTransB, int m, int n, int k, T fAlpha, const T* a, const T* b, T fBeta, T* c, int nAOff = 0, int nBOff = 0, int nCOff = 0);
+	static long gemm2(bool bTransA, bool bTransB, int m, int n, int k, T fAlpha, const T* a, int lda, const T* b, int ldb, T fBeta, T* c, int ldc);
+	static long gemv(bool bTransA, int m, int n, T fAlpha, const T* a, const T* x, T fBeta, T* y, int nAOff = 0, int nXOff = 0, int nYOff = 0);
+	static long ger(int m, int n, T fAlpha, const T* x, const T* y, T* a, int nXOff = 0, int nYOff = 0, int nAOff = 0);
+	static long axpy(int n, T fAlpha, const T* x, T* y, int nXOff = 0, int nYOff = 0);
+	static long dot(int n, const T* x, const T* y, T* pOut, int nXOff = 0, int nYOff = 0);
+	static long asum(int n, const T* x, T* pOut, int nXOff = 0);
+	static long nrm2(int n, const T* x, T* pOut, int nXOff = 0);
+	static long Benchmark(BenchmarkRunner* pRunner);
+};
+
+#endif
@@ -0,0 +1,393 @@
+//=============================================================================
+//	FILE:	hostengine.h
+//
+//	DESC:	This file holds the vector traits, kernel table and thread pool of
+//			the host BLAS engine, shared with the host kernels.
+//=============================================================================
+#ifndef __HOSTENGINE_CU__
+#define __HOSTENGINE_CU__
+
+#include "util.h"
+#include "hostblas.h"
+#include <intrin.h>
+#include <immintrin.h>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef MIN
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#endif
+
+//=============================================================================
+//	Types
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	The vector traits used to build the kernels of each instruction set,
+//	the scalar traits treat a single value as a vector of width 1.
+//-----------------------------------------------------------------------------
+template <class T>
+struct VecScalar
+{
+	typedef T V;
+	enum { W = 1 };
+	static V zero() { return 0; }
+	static V set1(T f) { return f; }
+	static V load(const T* p) { return *p; }
+	static void store(T* p, V v) { *p = v; }
+	static V add(V a, V b) { return a + b; }
+	static V sub(V a, V b) { return a - b; }
+	static V mul(V a, V b) { return a * b; }
+	static V fmadd(V a, V b, V c) { return a * b + c; }
+	static V abs(V a) { return (a < 0) ? -a : a; }
+	static V vmin(V a, V b) { return (a < b) ? a : b; }
+	static V vmax(V a, V b) { return (a > b) ? a : b; }
+	static V selgt(V a, V b, V x, V y) { return (a > b) ? x : y; }
+	static V round(V a) { return (V)floor(a + V(0.5)); }
+	static V scale2(V a, V k) { return (V)ldexp(a, (int)k); }
+	static void cleanup() {}
+};
+
+struct VecAvx2Float
+{
+	typedef __m256 V;
+	enum { W = 8 };
+	static V zero() { return _mm256_setzero_ps(); }
+	static V set1(float f) { return _mm256_set1_ps(f); }
+	static V load(const float* p) { return _mm256_loadu_ps(p); }
+	static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+	static V add(V a, V b) { return _mm256_add_ps(a, b); }
+	static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+	static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+	static V fmadd(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+	static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+	static V vmin(V a, V b) { return _mm256_min_ps(a, b); }
+	static V vmax(V a, V b) { return _mm256_max_ps(a, b); }
+	static V selgt(V a, V b, V x, V y) { return _mm256_blendv_ps(y, x, _mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+	static V round(V a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	static V scale2(V a, V k) { return _mm256_mul_ps(a, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127)), 23))); }
+	static void cleanup() { _mm256_zeroupper(); }
+};
+
+struct VecAvx2Double
+{
+	typedef __m256d V;
+	enum { W = 4 };
+	static V zero() { return _mm256_setzero_pd(); }
+	static V set1(double f) { return _mm256_set1_pd(f); }
+	static V load(const double* p) { return _mm256_loadu_pd(p); }
+	static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+	static V add(V a, V b) { return _mm256_add_pd(a, b); }
+	static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+	static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+	static V fmadd(V a, V b, V c) { return _mm256_fmadd_pd(a, b, c); }
+	static V abs(V a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+	static V vmin(V a, V b) { return _mm256_min_pd(a, b); }
+	static V vmax(V a, V b) { return _mm256_max_pd(a, b); }
+	static V selgt(V a, V b, V x, V y) { return _mm256_blendv_pd(y, x, _mm256_cmp_pd(a, b, _CMP_GT_OQ)); }
+	static V round(V a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	static V scale2(V a, V k) { return _mm256_mul_pd(a, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k)), _mm256_set1_epi64x(1023)), 52))); }
+	static void cleanup() { _mm256_zeroupper(); }
+};
+
+struct VecAvx512Float
+{
+	typedef __m512 V;
+	enum { W = 16 };
+	static V zero() { return _mm512_setzero_ps(); }
+	static V set1(float f) { return _mm512_set1_ps(f); }
+	static V load(const float* p) { return _mm512_loadu_ps(p); }
+	static void store(float* p, V v) { _mm512_storeu_ps(p, v); }
+	static V add(V a, V b) { return _mm512_add_ps(a, b); }
+	static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+	static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+	static V fmadd(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+	static V abs(V a) { return _mm512_abs_ps(a); }
+	static V vmin(V a, V b) { return _mm512_min_ps(a, b); }
+	static V vmax(V a, V b) { return _mm512_max_ps(a, b); }
+	static V selgt(V a, V b, V x, V y) { return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_GT_OQ), y, x); }
+	static V round(V a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	static V scale2(V a, V k) { return _mm512_scalef_ps(a, k); }
+	static void cleanup() { _mm256_zeroupper(); }
+};
+
+struct VecAvx512Double
+{
+	typedef __m512d V;
+	enum { W = 8 };
+	static V zero() { return _mm512_setzero_pd(); }
+	static V set1(double f) { return _mm512_set1_pd(f); }
+	static V load(const double* p) { return _mm512_loadu_pd(p); }
+	static void store(double* p, V v) { _mm512_storeu_pd(p, v); }
+	static V add(V a, V b) { return _mm512_add_pd(a, b); }
+	static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+	static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+	static V fmadd(V a, V b, V c) { return _mm512_fmadd_pd(a, b, c); }
+	static V abs(V a) { return _mm512_abs_pd(a); }
+	static V vmin(V a, V b) { return _mm512_min_pd(a, b); }
+	static V vmax(V a, V b) { return _mm512_max_pd(a, b); }
+	static V selgt(V a, V b, V x, V y) { return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(a, b, _CMP_GT_OQ), y, x); }
+	static V round(V a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	static V scale2(V a, V k) { return _mm512_scalef_pd(a, k); }
+	static void cleanup() { _mm256_zeroupper(); }
+};
+
+//-----------------------------------------------------------------------------
+//	The kernels and block sizes chosen for the instruction set.  The tile
+//	kernel multiplies a packed MR x k panel of A by a packed k x NR panel of
+//	B into C, where C = alpha * AB + beta * C and C is not read when beta is
+//	0.  The MC x KC block of A is sized for the L2 cache and each KC x NR
+//	panel of B for the L1 cache.
+//-----------------------------------------------------------------------------
+template <class T>
+class HostBlasKernel
+{
+public:
+	int m_nIsa;
+	int m_nW;
+	int m_nMR;
+	int m_nNR;
+	int m_nMC;
+	int m_nKC;
+	int m_nNC;
+	void (*m_pfnTile)(int k, const T* pA, const T* pB, T* pC, int ldc, T fAlpha, T fBeta);
+	T (*m_pfnDot)(int n, const T* x, const T* y);
+	void (*m_pfnAxpy)(int n, T fAlpha, const T* x, T* y);
+	T (*m_pfnAsum)(int n, const T* x);
+};
+
+//-----------------------------------------------------------------------------
+//	A team of threads that run the steps of a sequence together.  The size
+//	is set once all of the threads are started, and Sync returns once every
+//	member of the team has reached it.
+//-----------------------------------------------------------------------------
+class HostTeam
+{
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	int m_nSize;
+	int m_nWaiting;
+	int m_nGeneration;
+
+public:
+	HostTeam() : m_nSize(0), m_nWaiting(0), m_nGeneration(0)
+	{
+	}
+
+	void Start(int nSize)
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_nSize = nSize;
+		m_cv.notify_all();
+	}
+
+	int Size()
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_cv.wait(lock, [this]() { return m_nSize > 0; });
+		return m_nSize;
+	}
+
+	void Sync()
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		int nGeneration = m_nGeneration;
+
+		if (++m_nWaiting == m_nSize)
+		{
+			m_nWaiting = 0;
+			m_nGeneration++;
+			m_cv.notify_all();
+		}
+		else
+		{
+			m_cv.wait(lock, [this, nGeneration]() { return m_nGeneration != nGeneration; });
+		}
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+//	The jobs handed to the pool workers by one call, Wait returns once all
+//	of them have finished.
+//-----------------------------------------------------------------------------
+class HostBatch
+{
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	int m_nPending;
+
+public:
+	HostBatch() : m_nPending(0)
+	{
+	}
+
+	void Add()
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_nPending++;
+	}
+
+	void Done()
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+
+		if (--m_nPending == 0)
+			m_cv.notify_all();
+	}
+
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_cv.wait(lock, [this]() { return m_nPending == 0; });
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	The persistent worker threads that run the jobs and team members, so
+//	that the small per-step calls do not make and join a thread for each
+//	job.  The workers are made as they are first needed, up to one less
+//	than HOSTBLAS_MAX_THREADS, and then wait for their next job.  Dispatch
+//	only hands a job to an idle worker, so a call made from within a job
+//	runs its jobs on its own thread when all workers are busy.
+//
+//	The pool is never freed, for the workers may still be waiting on it
+//	when the globals are destroyed.
+//-----------------------------------------------------------------------------
+class HostPool
+{
+	class Worker
+	{
+	public:
+		HostPool* m_pPool;
+		std::condition_variable m_cv;
+		std::function<void()>* m_pJob;
+		HostBatch* m_pBatch;
+
+		Worker(HostPool* pPool) : m_pPool(pPool), m_pJob(NULL), m_pBatch(NULL)
+		{
+		}
+	};
+
+	std::mutex m_mtx;
+	std::vector<Worker*> m_rgIdle;
+	int m_nWorkers;
+
+	HostPool() : m_nWorkers(0)
+	{
+	}
+
+	static DWORD WINAPI workerProc(LPVOID pParam)
+	{
+		Worker* pWorker = (Worker*)pParam;
+		HostPool* pPool = pWorker->m_pPool;
+
+		for (;;)
+		{
+			std::function<void()>* pJob;
+			HostBatch* pBatch;
+
+			{
+				std::unique_lock<std::mutex> lock(pPool->m_mtx);
+				pWorker->m_cv.wait(lock, [pWorker]() { return pWorker->m_pJob != NULL; });
+				pJob = pWorker->m_pJob;
+				pBatch = pWorker->m_pBatch;
+			}
+
+			(*pJob)();
+
+			// The worker is idle again before the batch is done, so that
+			// the next call of the same thread finds it.
+			{
+				std::unique_lock<std::mutex> lock(pPool->m_mtx);
+				pWorker->m_pJob = NULL;
+				pWorker->m_pBatch = NULL;
+				pPool->m_rgIdle.push_back(pWorker);
+			}
+
+			pBatch->Done();
+		}
+
+		return 0;
+	}
+
+public:
+	static HostPool* Get()
+	{
+		static HostPool* s_pPool = new HostPool();
+		return s_pPool;
+	}
+
+	//-------------------------------------------------------------------------
+	//	Hands the job to an idle worker, making one when none is idle and the
+	//	pool is not full.  Returns false when no worker can take the job.
+	//-------------------------------------------------------------------------
+	bool Dispatch(std::function<void()>* pJob, HostBatch* pBatch)
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+
+		if (m_rgIdle.empty())
+		{
+			if (m_nWorkers >= HOSTBLAS_MAX_THREADS - 1)
+				return false;
+
+			Worker* pWorker = new Worker(this);
+			HANDLE hThread = CreateThread(NULL, 0, &workerProc, pWorker, 0, NULL);
+
+			if (hThread == NULL)
+			{
+				delete pWorker;
+				return false;
+			}
+
+			CloseHandle(hThread);
+			m_rgIdle.push_back(pWorker);
+			m_nWorkers++;
+		}
+
+		Worker* pWorker = m_rgIdle.back();
+		m_rgIdle.pop_back();
+
+		pBatch->Add();
+		pWorker->m_pJob = pJob;
+		pWorker->m_pBatch = pBatch;
+		pWorker->m_cv.notify_one();
+
+		return true;
+	}
+};
+
+//=============================================================================
+//	Functions
+//=============================================================================
+
+template <class T, class VT>
+inline T reduce(typename VT::V v)
+{
+	T rgSum[VT::W];
+	T fSum = 0;
+
+	VT::store(rgSum, v);
+
+	for (int i = 0; i < VT::W; i++)
+	{
+		fSum += rgSum[i];
+	}
+
+	return fSum;
+}
+
+int getIsa();
+LPCSTR getIsaName(int nIsa);
+int getThreadCount();
+
+template <class T>
+const HostBlasKernel<T>* getKernel();
+
+int getJobCount(double dfFlops, int nUnits);
+void runJobs(std::vector<std::function<void()>>& rgJobs);
+void runTeam(int nJobs, std::function<void(int nMember, HostTeam* pTeam)> fn);
+
+#endif
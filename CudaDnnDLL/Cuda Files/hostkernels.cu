@@ -0,0 +1,1677 @@
+//=============================================================================
+//	FILE:	hostkernels.cu
+//
+//	DESC:	This file implements the host kernels, which run the stats, update,
+//			random, LSTM, softmax loss and pooling routines on host memory.
+//=============================================================================
+
+#include "util.h"
+#include "hostkernels.h"
+#include "hostengine.h"
+#include "math.h"
+#include "benchmark.h"
+#include <algorithm>
+
+//=============================================================================
+//	Local Types
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	The pooling window geometries with compile time host kernels, the same
+//	as those of the fixed GPU kernels in math.cu.
+//-----------------------------------------------------------------------------
+struct HostPoolGeometry
+{
+	int nKernelH;
+	int nKernelW;
+	int nStrideH;
+	int nStrideW;
+	int nPadH;
+	int nPadW;
+};
+
+const int HOSTBLAS_POOL_FIXED = 4;
+
+static const HostPoolGeometry s_rgPoolFixed[HOSTBLAS_POOL_FIXED] =
+{
+	{ 2, 2, 2, 2, 0, 0 },
+	{ 3, 3, 2, 2, 0, 0 },
+	{ 3, 3, 2, 2, 1, 1 },
+	{ 3, 3, 1, 1, 1, 1 }
+};
+
+//-----------------------------------------------------------------------------
+//	The host kernels chosen for the instruction set, built on the same
+//	vector traits as the kernels of the host BLAS engine.
+//-----------------------------------------------------------------------------
+template <class T>
+class HostKernelTable
+{
+public:
+	int m_nW;
+	void (*m_pfnStats)(int n, const T* x, double* rgStats);
+	void (*m_pfnSoftmaxRow)(int nChannels, int nInner, const T* x, const T* pLabel, int nIgnoreLabel, T* pLoss, T* pCounts, T* pProb, T* pDiff);
+	void (*m_pfnSoftmaxCols)(int nChannels, int nInner, const T* x, const T* pLabel, int nIgnoreLabel, T* pLoss, T* pCounts, T* pProb, T* pDiff);
+	T (*m_pfnSum)(int n, const T* x);
+	void (*m_rgpfnPoolFwd[HOSTBLAS_POOL_FIXED])(int nMethod, int h, int w, int hPooled, int wPooled, const T* x, T* y, T* mask, unsigned char* mask8, T* pWork);
+	void (*m_rgpfnPoolBwd[HOSTBLAS_POOL_FIXED])(int nMethod, int h, int w, int hPooled, int wPooled, const T* dy, T* dx, const T* mask, const unsigned char* mask8, T* pWork);
+};
+
+//=============================================================================
+//	Local Functions
+//=============================================================================
+
+template <class T, class VT>
+static T sumKernel(int n, const T* x)
+{
+	typedef typename VT::V V;
+	V v0 = VT::zero();
+	V v1 = VT::zero();
+	int i = 0;
+
+	for (; i + 2 * VT::W <= n; i += 2 * VT::W)
+	{
+		v0 = VT::add(v0, VT::load(x + i));
+		v1 = VT::add(v1, VT::load(x + i + VT::W));
+	}
+
+	for (; i + VT::W <= n; i += VT::W)
+	{
+		v0 = VT::add(v0, VT::load(x + i));
+	}
+
+	T fSum = reduce<T, VT>(VT::add(v0, v1));
+
+	for (; i < n; i++)
+	{
+		fSum += x[i];
+	}
+
+	VT::cleanup();
+
+	return fSum;
+}
+
+//-----------------------------------------------------------------------------
+//	Accumulates the min, max, sum, sum of squares, NaN and Inf counts of x
+//	into rgStats.  The vector pass assumes every value is finite, which holds
+//	when the sum of squares is finite, otherwise the values are rescanned one
+//	at a time to count the NaN and Inf values and keep them out of the sums.
+//-----------------------------------------------------------------------------
+template <class T, class VT>
+static void statsKernel(int n, const T* x, double* rgStats)
+{
+	typedef typename VT::V V;
+	int i = 0;
+	T fMin = x[0];
+	T fMax = x[0];
+	T fSum = 0;
+	T fSumSq = 0;
+
+	if (n >= 2 * VT::W)
+	{
+		V vMin = VT::load(x);
+		V vMax = vMin;
+		V vSum0 = VT::zero();
+		V vSum1 = VT::zero();
+		V vSumSq0 = VT::zero();
+		V vSumSq1 = VT::zero();
+
+		for (; i + 2 * VT::W <= n; i += 2 * VT::W)
+		{
+			V v0 = VT::load(x + i);
+			V v1 = VT::load(x + i + VT::W);
+
+			vMin = VT::vmin(vMin, VT::vmin(v0, v1));
+			vMax = VT::vmax(vMax, VT::vmax(v0, v1));
+			vSum0 = VT::add(vSum0, v0);
+			vSum1 = VT::add(vSum1, v1);
+			vSumSq0 = VT::fmadd(v0, v0, vSumSq0);
+			vSumSq1 = VT::fmadd(v1, v1, vSumSq1);
+		}
+
+		T rgMin[VT::W];
+		T rgMax[VT::W];
+
+		VT::store(rgMin, vMin);
+		VT::store(rgMax, vMax);
+
+		for (int j = 0; j < VT::W; j++)
+		{
+			fMin = (rgMin[j] < fMin) ? rgMin[j] : fMin;
+			fMax = (rgMax[j] > fMax) ? rgMax[j] : fMax;
+		}
+
+		fSum = reduce<T, VT>(VT::add(vSum0, vSum1));
+		fSumSq = reduce<T, VT>(VT::add(vSumSq0, vSumSq1));
+	}
+
+	VT::cleanup();
+
+	for (; i < n; i++)
+	{
+		fMin = (x[i] < fMin) ? x[i] : fMin;
+		fMax = (x[i] > fMax) ? x[i] : fMax;
+		fSum += x[i];
+		fSumSq += x[i] * x[i];
+	}
+
+	if (_finite(fSumSq))
+	{
+		rgStats[STATS_MIN] = (fMin < rgStats[STATS_MIN]) ? fMin : rgStats[STATS_MIN];
+		rgStats[STATS_MAX] = (fMax > rgStats[STATS_MAX]) ? fMax : rgStats[STATS_MAX];
+		rgStats[STATS_SUM] += fSum;
+		rgStats[STATS_SUMSQ] += fSumSq;
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		T fVal = x[i];
+
+		if (_isnan(fVal))
+		{
+			rgStats[STATS_NAN]++;
+		}
+		else
+		{
+			rgStats[STATS_MIN] = (fVal < rgStats[STATS_MIN]) ? fVal : rgStats[STATS_MIN];
+			rgStats[STATS_MAX] = (fVal > rgStats[STATS_MAX]) ? fVal : rgStats[STATS_MAX];
+
+			if (!_finite(fVal))
+			{
+				rgStats[STATS_INF]++;
+			}
+			else
+			{
+				rgStats[STATS_SUM] += fVal;
+				rgStats[STATS_SUMSQ] += (double)fVal * fVal;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Calculates exp(x) as 2^k * exp(r) with r = x - k ln(2) and |r| <= ln(2)/2,
+//	where exp(r) is the Taylor series to degree 7 for float and 12 for double.
+//	The arguments are clamped to the range with normal results.
+//-----------------------------------------------------------------------------
+template <class T, class VT>
+static typename VT::V expKernel(typename VT::V x)
+{
+	typedef typename VT::V V;
+	const bool bFloat = (sizeof(T) == sizeof(float));
+	const int nDegree = (bFloat) ? 7 : 12;
+	const T fLn2Hi = (bFloat) ? T(0.693359375) : T(6.93145751953125e-1);
+	const T fLn2Lo = (bFloat) ? T(-2.12194440e-4) : T(1.42860682030941723212e-6);
+
+	x = VT::vmax(VT::vmin(x, VT::set1((bFloat) ? T(88.3) : T(709.0))), VT::set1((bFloat) ? T(-87.3) : T(-708.0)));
+
+	V k = VT::round(VT::mul(x, VT::set1(T(1.44269504088896341))));
+	V r = VT::fmadd(k, VT::set1(-fLn2Hi), x);
+	r = VT::fmadd(k, VT::set1(-fLn2Lo), r);
+
+	T fCoef = T(1);
+
+	for (int i = 2; i <= nDegree; i++)
+	{
+		fCoef /= T(i);
+	}
+
+	V p = VT::set1(fCoef);
+
+	for (int i = nDegree - 1; i >= 0; i--)
+	{
+		fCoef *= T(i + 1);
+		p = VT::fmadd(p, r, VT::set1(fCoef));
+	}
+
+	return VT::scale2(p, k);
+}
+
+//-----------------------------------------------------------------------------
+//	Calculates the softmax loss of one item with nChannels contiguous values
+//	(the inner num is 1) as in Math::softmaxloss_fused.  The log-sum-exp is
+//	kept as a running max and sum over blocks of the row that stay in the
+//	L1 cache, so the row is only read once from memory for the loss.
+//-----------------------------------------------------------------------------
+template <class T, class VT>
+static void softmaxRowKernel(int nChannels, int nInner, const T* x, const T* pLabel, int nIgnoreLabel, T* pLoss, T* pCounts, T* pProb, T* pDiff)
+{
+	typedef typename VT::V V;
+	const int nBlock = 1024;
+	T fMax = -FLT_MAX;
+	T fSum = 0;
+
+	for (int j = 0; j < nChannels; j += nBlock)
+	{
+		int nLen = MIN(nBlock, nChannels - j);
+		const T* pX = x + j;
+		T fBlockMax = pX[0];
+		int i = 0;
+
+		if (nLen >= VT::W)
+		{
+			V vMax = VT::load(pX);
+			T rgMax[VT::W];
+
+			for (i = VT::W; i + VT::W <= nLen; i += VT::W)
+			{
+				vMax = VT::vmax(vMax, VT::load(pX + i));
+			}
+
+			VT::store(rgMax, vMax);
+
+			for (int k = 0; k < VT::W; k++)
+			{
+				fBlockMax = (rgMax[k] > fBlockMax) ? rgMax[k] : fBlockMax;
+			}
+		}
+
+		for (; i < nLen; i++)
+		{
+			fBlockMax = (pX[i] > fBlockMax) ? pX[i] : fBlockMax;
+		}
+
+		if (fBlockMax > fMax)
+		{
+			fSum *= (T)exp(fMax - fBlockMax);
+			fMax = fBlockMax;
+		}
+
+		V vMax = VT::set1(fMax);
+		V vSum = VT::zero();
+
+		for (i = 0; i + VT::W <= nLen; i += VT::W)
+		{
+			vSum = VT::add(vSum, expKernel<T, VT>(VT::sub(VT::load(pX + i), vMax)));
+		}
+
+		fSum += reduce<T, VT>(vSum);
+
+		for (; i < nLen; i++)
+		{
+			fSum += (T)exp(pX[i] - fMax);
+		}
+	}
+
+	int nLabel = (int)pLabel[0];
+	bool bIgnore = (nIgnoreLabel != -1 && nLabel == nIgnoreLabel);
+
+	if (bIgnore)
+	{
+		pLoss[0] = 0;
+		pCounts[0] = 0;
+	}
+	else
+	{
+		T fLoss = fMax + (T)log(fSum) - x[nLabel];
+		pLoss[0] = (fLoss < (T)SOFTMAXLOSS_MAX_LOSS) ? fLoss : (T)SOFTMAXLOSS_MAX_LOSS;
+		pCounts[0] = 1;
+	}
+
+	if (pProb != NULL || pDiff != NULL)
+	{
+		T fInvSum = 1 / fSum;
+		V vMax = VT::set1(fMax);
+		V vInvSum = VT::set1(fInvSum);
+		int i = 0;
+
+		for (; i + VT::W <= nChannels; i += VT::W)
+		{
+			V vProb = VT::mul(expKernel<T, VT>(VT::sub(VT::load(x + i), vMax)), vInvSum);
+
+			if (pProb != NULL)
+				VT::store(pProb + i, vProb);
+
+			if (pDiff != NULL)
+				VT::store(pDiff + i, vProb);
+		}
+
+		for (; i < nChannels; i++)
+		{
+			T fProb = (T)exp(x[i] - fMax) * fInvSum;
+
+			if (pProb != NULL)
+				pProb[i] = fProb;
+
+			if (pDiff != NULL)
+				pDiff[i] = fProb;
+		}
+
+		if (pDiff != NULL)
+		{
+			if (bIgnore)
+				memset(pDiff, 0, sizeof(T) * nChannels);
+			else
+				pDiff[nLabel] -= 1;
+		}
+	}
+
+	VT::cleanup();
+}
+
+//-----------------------------------------------------------------------------
+//	Calculates the softmax loss of VT::W neighbouring spatial items, each
+//	with nChannels values nInner apart, with one item per vector lane.
+//-----------------------------------------------------------------------------
+template <class T, class VT>
+static void softmaxColsKernel(int nChannels, int nInner, const T* x, const T* pLabel, int nIgnoreLabel, T* pLoss, T* pCounts, T* pProb, T* pDiff)
+{
+	typedef typename VT::V V;
+	T rgMax[VT::W];
+	T rgSum[VT::W];
+	V vMax = VT::load(x);
+
+	for (int c = 1; c < nChannels; c++)
+	{
+		vMax = VT::vmax(vMax, VT::load(x + (size_t)c * nInner));
+	}
+
+	V vSum = VT::zero();
+
+	for (int c = 0; c < nChannels; c++)
+	{
+		vSum = VT::add(vSum, expKernel<T, VT>(VT::sub(VT::load(x + (size_t)c * nInner), vMax)));
+	}
+
+	VT::store(rgMax, vMax);
+	VT::store(rgSum, vSum);
+
+	for (int k = 0; k < VT::W; k++)
+	{
+		int nLabel = (int)pLabel[k];
+
+		if (nIgnoreLabel != -1 && nLabel == nIgnoreLabel)
+		{
+			pLoss[k] = 0;
+			pCounts[k] = 0;
+		}
+		else
+		{
+			T fLoss = rgMax[k] + (T)log(rgSum[k]) - x[(size_t)nLabel * nInner + k];
+			pLoss[k] = (fLoss < (T)SOFTMAXLOSS_MAX_LOSS) ? fLoss : (T)SOFTMAXLOSS_MAX_LOSS;
+			pCounts[k] = 1;
+		}
+
+		rgSum[k] = 1 / rgSum[k];
+	}
+
+	if (pProb != NULL || pDiff != NULL)
+	{
+		V vInvSum = VT::load(rgSum);
+
+		for (int c = 0; c < nChannels; c++)
+		{
+			size_t nOffset = (size_t)c * nInner;
+			V vProb = VT::mul(expKernel<T, VT>(VT::sub(VT::load(x + nOffset), vMax)), vInvSum);
+
+			if (pProb != NULL)
+				VT::store(pProb + nOffset, vProb);
+
+			if (pDiff != NULL)
+				VT::store(pDiff + nOffset, vProb);
+		}
+
+		if (pDiff != NULL)
+		{
+			for (int k = 0; k < VT::W; k++)
+			{
+				int nLabel = (int)pLabel[k];
+
+				if (nIgnoreLabel != -1 && nLabel == nIgnoreLabel)
+				{
+					for (int c = 0; c < nChannels; c++)
+					{
+						pDiff[(size_t)c * nInner + k] = 0;
+					}
+				}
+				else
+				{
+					pDiff[(size_t)nLabel * nInner + k] -= 1;
+				}
+			}
+		}
+	}
+
+	VT::cleanup();
+}
+
+//-----------------------------------------------------------------------------
+//	Pools the window of the output item (ph, pw) of one channel as the
+//	generic GPU kernels do, where the max keeps the first largest item and
+//	the average divides by the window size including the padding.
+//-----------------------------------------------------------------------------
+template <class T>
+static void poolFwdItem(int nMethod, int h, int w, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, int ph, int pw, const T* x, T* y, T* mask, unsigned char* mask8)
+{
+	const int hwin = ph * hStride - hPad;
+	const int wwin = pw * wStride - wPad;
+	const int nIdx = ph * wPooled + pw;
+
+	if (nMethod == POOLING_METHOD_MAX)
+	{
+		const int hend = MIN(hwin + hKernel, h);
+		const int wend = MIN(wwin + wKernel, w);
+		T fMax = (T)-FLT_MAX;
+		int nMaxIdx = -1;
+
+		for (int r = (hwin < 0) ? 0 : hwin; r < hend; r++)
+		{
+			for (int c = (wwin < 0) ? 0 : wwin; c < wend; c++)
+			{
+				if (x[r * w + c] > fMax)
+				{
+					nMaxIdx = r * w + c;
+					fMax = x[nMaxIdx];
+				}
+			}
+		}
+
+		y[nIdx] = fMax;
+
+		if (mask8 != NULL)
+			mask8[nIdx] = (nMaxIdx < 0) ? POOLING_MASK8_NONE : (unsigned char)((nMaxIdx / w - hwin) * wKernel + (nMaxIdx % w - wwin));
+		else if (mask != NULL)
+			mask[nIdx] = (T)nMaxIdx;
+	}
+	else
+	{
+		const int hend = MIN(hwin + hKernel, h + hPad);
+		const int wend = MIN(wwin + wKernel, w + wPad);
+		const int nPoolSize = (hend - hwin) * (wend - wwin);
+		T fSum = 0;
+
+		for (int r = (hwin < 0) ? 0 : hwin; r < MIN(hend, h); r++)
+		{
+			for (int c = (wwin < 0) ? 0 : wwin; c < MIN(wend, w); c++)
+			{
+				fSum += x[r * w + c];
+			}
+		}
+
+		y[nIdx] = fSum / nPoolSize;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Adds the gradient of the output item (ph, pw) of one channel to the
+//	items of its window, for the max only to the item of the mask.
+//-----------------------------------------------------------------------------
+template <class T>
+static void poolBwdItem(int nMethod, int h, int w, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, int ph, int pw, const T* dy, T* dx, const T* mask, const unsigned char* mask8)
+{
+	const int hwin = ph * hStride - hPad;
+	const int wwin = pw * wStride - wPad;
+	const int nIdx = ph * wPooled + pw;
+
+	if (nMethod == POOLING_METHOD_MAX)
+	{
+		int nMaxIdx = -1;
+
+		if (mask8 != NULL)
+		{
+			if (mask8[nIdx] != POOLING_MASK8_NONE)
+				nMaxIdx = (hwin + mask8[nIdx] / wKernel) * w + wwin + mask8[nIdx] % wKernel;
+		}
+		else
+		{
+			nMaxIdx = (int)mask[nIdx];
+		}
+
+		if (nMaxIdx >= 0)
+			dx[nMaxIdx] += dy[nIdx];
+	}
+	else
+	{
+		const int hend = MIN(hwin + hKernel, h + hPad);
+		const int wend = MIN(wwin + wKernel, w + wPad);
+		const T fDiff = dy[nIdx] / ((hend - hwin) * (wend - wwin));
+
+		for (int r = (hwin < 0) ? 0 : hwin; r < MIN(hend, h); r++)
+		{
+			for (int c = (wwin < 0) ? 0 : wwin; c < MIN(wend, w); c++)
+			{
+				dx[r * w + c] += fDiff;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Returns the output columns [nFirst, nLast) of a row whose windows lie
+//	inside the columns of the image, rounded down to whole vectors of nW.
+//-----------------------------------------------------------------------------
+static void getPoolInterior(int w, int wPooled, int wKernel, int wStride, int wPad, int nW, int* pnFirst, int* pnLast)
+{
+	int nFirst = MIN((wPad + wStride - 1) / wStride, wPooled);
+	int nLast = (w + wPad >= wKernel) ? MIN((w + wPad - wKernel) / wStride + 1, wPooled) : 0;
+
+	if (nLast < nFirst)
+		nLast = nFirst;
+
+	*pnFirst = nFirst;
+	*pnLast = nFirst + (nLast - nFirst) / nW * nW;
+}
+
+//-----------------------------------------------------------------------------
+//	Max and average pooling of one channel with the window known at compile
+//	time.  The windows inside the image are pooled VT::W neighbouring output
+//	items at a time, with each window item loaded for all lanes at once, and
+//	the windows on the border one item at a time.  With a stride over 1 the
+//	rows are first split into SW phases in pWork, holding the columns c with
+//	c % SW = p in phase p, so the items of neighbouring windows are adjacent.
+//-----------------------------------------------------------------------------
+template <class T, class VT, int KH, int KW, int SH, int SW, int PH, int PW>
+static void poolFwdFixed(int nMethod, int h, int w, int hPooled, int wPooled, const T* x, T* y, T* mask, unsigned char* mask8, T* pWork)
+{
+	typedef typename VT::V V;
+	const int nLd = (SW == 1) ? w : (w + SW - 1) / SW;
+	const T* pRows = x;
+	int nFirst;
+	int nLast;
+
+	if (SW > 1)
+	{
+		for (int r = 0; r < h; r++)
+		{
+			for (int c = 0; c < w; c++)
+			{
+				pWork[((size_t)r * SW + c % SW) * nLd + c / SW] = x[(size_t)r * w + c];
+			}
+		}
+
+		pRows = pWork;
+	}
+
+	getPoolInterior(w, wPooled, KW, SW, PW, VT::W, &nFirst, &nLast);
+
+	for (int ph = 0; ph < hPooled; ph++)
+	{
+		const int hstart = ph * SH - PH;
+		T* pY = y + (size_t)ph * wPooled;
+		int pw = 0;
+
+		if (hstart >= 0 && hstart + KH <= h)
+		{
+			for (; pw < nFirst; pw++)
+			{
+				poolFwdItem(nMethod, h, w, wPooled, KH, KW, SH, SW, PH, PW, ph, pw, x, y, mask, mask8);
+			}
+
+			for (; pw < nLast; pw += VT::W)
+			{
+				V vMax = VT::set1((T)-FLT_MAX);
+				V vK = VT::set1(T(POOLING_MASK8_NONE));
+				V vSum = VT::zero();
+
+				for (int kh = 0; kh < KH; kh++)
+				{
+					for (int kw = 0; kw < KW; kw++)
+					{
+						const int nPhase = ((kw - PW) % SW + SW) % SW;
+						const int nShift = (kw - PW - nPhase) / SW;
+						V v = VT::load(pRows + ((size_t)(hstart + kh) * SW + nPhase) * nLd + pw + nShift);
+
+						if (nMethod == POOLING_METHOD_MAX)
+						{
+							vK = VT::selgt(v, vMax, VT::set1(T(kh * KW + kw)), vK);
+							vMax = VT::selgt(v, vMax, v, vMax);
+						}
+						else
+						{
+							vSum = VT::add(vSum, v);
+						}
+					}
+				}
+
+				if (nMethod != POOLING_METHOD_MAX)
+				{
+					VT::store(pY + pw, VT::mul(vSum, VT::set1(T(1) / T(KH * KW))));
+					continue;
+				}
+
+				VT::store(pY + pw, vMax);
+
+				if (mask8 == NULL && mask == NULL)
+					continue;
+
+				T rgK[VT::W];
+				VT::store(rgK, vK);
+
+				for (int l = 0; l < VT::W; l++)
+				{
+					const int k = (int)rgK[l];
+					const size_t nIdx = (size_t)ph * wPooled + pw + l;
+
+					if (mask8 != NULL)
+						mask8[nIdx] = (unsigned char)k;
+					else
+						mask[nIdx] = (k == POOLING_MASK8_NONE) ? T(-1) : T((hstart + k / KW) * w + (pw + l) * SW - PW + k % KW);
+				}
+			}
+		}
+
+		for (; pw < wPooled; pw++)
+		{
+			poolFwdItem(nMethod, h, w, wPooled, KH, KW, SH, SW, PH, PW, ph, pw, x, y, mask, mask8);
+		}
+	}
+
+	VT::cleanup();
+}
+
+//-----------------------------------------------------------------------------
+//	The backward pass of poolFwdFixed.  The max gradients go to the items
+//	of the mask one at a time.  The average gradients of the windows inside
+//	the image are added in vectors to the rows, split into phases in pWork
+//	when the stride is over 1, and those on the border one item at a time.
+//-----------------------------------------------------------------------------
+template <class T, class VT, int KH, int KW, int SH, int SW, int PH, int PW>
+static void poolBwdFixed(int nMethod, int h, int w, int hPooled, int wPooled, const T* dy, T* dx, const T* mask, const unsigned char* mask8, T* pWork)
+{
+	typedef typename VT::V V;
+	const int nLd = (SW == 1) ? w : (w + SW - 1) / SW;
+	T* pRows = (SW == 1) ? dx : pWork;
+	int nFirst;
+	int nLast;
+
+	std::fill(dx, dx + (size_t)h * w, T(0));
+
+	if (nMethod == POOLING_METHOD_MAX)
+	{
+		for (int ph = 0; ph < hPooled; ph++)
+		{
+			for (int pw = 0; pw < wPooled; pw++)
+			{
+				poolBwdItem(nMethod, h, w, wPooled, KH, KW, SH, SW, PH, PW, ph, pw, dy, dx, mask, mask8);
+			}
+		}
+
+		return;
+	}
+
+	if (SW > 1)
+		std::fill(pWork, pWork + (size_t)h * SW * nLd, T(0));
+
+	getPoolInterior(w, wPooled, KW, SW, PW, VT::W, &nFirst, &nLast);
+
+	const V vScale = VT::set1(T(1) / T(KH * KW));
+
+	for (int ph = 0; ph < hPooled; ph++)
+	{
+		const int hstart = ph * SH - PH;
+
+		if (hstart < 0 || hstart + KH > h)
+			continue;
+
+		for (int pw = nFirst; pw < nLast; pw += VT::W)
+		{
+			V v = VT::mul(VT::load(dy + (size_t)ph * wPooled + pw), vScale);
+
+			for (int kh = 0; kh < KH; kh++)
+			{
+				for (int kw = 0; kw < KW; kw++)
+				{
+					const int nPhase = ((kw - PW) % SW + SW) % SW;
+					const int nShift = (kw - PW - nPhase) / SW;
+					T* p = pRows + ((size_t)(hstart + kh) * SW + nPhase) * nLd + pw + nShift;
+
+					VT::store(p, VT::add(VT::load(p), v));
+				}
+			}
+		}
+	}
+
+	VT::cleanup();
+
+	if (SW > 1)
+	{
+		for (int r = 0; r < h; r++)
+		{
+			for (int c = 0; c < w; c++)
+			{
+				dx[(size_t)r * w + c] = pWork[((size_t)r * SW + c % SW) * nLd + c / SW];
+			}
+		}
+	}
+
+	for (int ph = 0; ph < hPooled; ph++)
+	{
+		const int hstart = ph * SH - PH;
+		const bool bInside = (hstart >= 0 && hstart + KH <= h);
+
+		for (int pw = 0; pw < wPooled; pw++)
+		{
+			if (!bInside || pw < nFirst || pw >= nLast)
+				poolBwdItem(nMethod, h, w, wPooled, KH, KW, SH, SW, PH, PW, ph, pw, dy, dx, mask, mask8);
+		}
+	}
+}
+
+template <class T, class VT>
+static void initTable(HostKernelTable<T>* pTable)
+{
+	pTable->m_nW = VT::W;
+	pTable->m_pfnStats = &statsKernel<T, VT>;
+	pTable->m_pfnSoftmaxRow = &softmaxRowKernel<T, VT>;
+	pTable->m_pfnSoftmaxCols = &softmaxColsKernel<T, VT>;
+	pTable->m_pfnSum = &sumKernel<T, VT>;
+
+	// In the order of s_rgPoolFixed.
+	pTable->m_rgpfnPoolFwd[0] = &poolFwdFixed<T, VT, 2, 2, 2, 2, 0, 0>;
+	pTable->m_rgpfnPoolFwd[1] = &poolFwdFixed<T, VT, 3, 3, 2, 2, 0, 0>;
+	pTable->m_rgpfnPoolFwd[2] = &poolFwdFixed<T, VT, 3, 3, 2, 2, 1, 1>;
+	pTable->m_rgpfnPoolFwd[3] = &poolFwdFixed<T, VT, 3, 3, 1, 1, 1, 1>;
+	pTable->m_rgpfnPoolBwd[0] = &poolBwdFixed<T, VT, 2, 2, 2, 2, 0, 0>;
+	pTable->m_rgpfnPoolBwd[1] = &poolBwdFixed<T, VT, 3, 3, 2, 2, 0, 0>;
+	pTable->m_rgpfnPoolBwd[2] = &poolBwdFixed<T, VT, 3, 3, 2, 2, 1, 1>;
+	pTable->m_rgpfnPoolBwd[3] = &poolBwdFixed<T, VT, 3, 3, 1, 1, 1, 1>;
+}
+
+static void selectTable(int nIsa, HostKernelTable<float>* pTable)
+{
+	if (nIsa == HOSTBLAS_ISA_AVX512)
+		initTable<float, VecAvx512Float>(pTable);
+	else if (nIsa == HOSTBLAS_ISA_AVX2)
+		initTable<float, VecAvx2Float>(pTable);
+	else
+		initTable<float, VecScalar<float>>(pTable);
+}
+
+static void selectTable(int nIsa, HostKernelTable<double>* pTable)
+{
+	if (nIsa == HOSTBLAS_ISA_AVX512)
+		initTable<double, VecAvx512Double>(pTable);
+	else if (nIsa == HOSTBLAS_ISA_AVX2)
+		initTable<double, VecAvx2Double>(pTable);
+	else
+		initTable<double, VecScalar<double>>(pTable);
+}
+
+template <class T>
+static const HostKernelTable<T>* getTable()
+{
+	static HostKernelTable<T> s_table;
+	static volatile bool s_bInit = false;
+
+	// Selecting twice on a race is harmless, both select the same kernels.
+	if (!s_bInit)
+	{
+		selectTable(getIsa(), &s_table);
+		s_bInit = true;
+	}
+
+	return &s_table;
+}
+
+//-----------------------------------------------------------------------------
+//	Splits the team into a grid over the hidden and batch items of an LSTM
+//	step, giving the hidden items [nD0, nD1) of batch items [nN0, nN1) to
+//	the member.  Splitting over the hidden items first keeps the same rows
+//	of the recurrent weights with the same member at every step.
+//-----------------------------------------------------------------------------
+static void getLstmSlice(int nMember, int nSize, int nN, int nH, int* pnN0, int* pnN1, int* pnD0, int* pnD1)
+{
+	int nSlicesH = MIN(nSize, nH);
+	int nSlicesN = MIN(nSize / nSlicesH, nN);
+	int nSliceH = nMember % nSlicesH;
+	int nSliceN = nMember / nSlicesH;
+
+	if (nSliceN >= nSlicesN)
+	{
+		*pnN0 = *pnN1 = *pnD0 = *pnD1 = 0;
+		return;
+	}
+
+	*pnD0 = (int)((LONGLONG)nH * nSliceH / nSlicesH);
+	*pnD1 = (int)((LONGLONG)nH * (nSliceH + 1) / nSlicesH);
+	*pnN0 = (int)((LONGLONG)nN * nSliceN / nSlicesN);
+	*pnN1 = (int)((LONGLONG)nN * (nSliceN + 1) / nSlicesN);
+}
+
+template <class T>
+static T hostSigmoid(T x)
+{
+	return T(1) / (T(1) + exp(-x));
+}
+
+template <class T>
+static T hostTanh(T x)
+{
+	return T(2) * hostSigmoid(T(2) * x) - T(1);
+}
+
+//-----------------------------------------------------------------------------
+//	Returns the error of a host pooling geometry, only the max and average
+//	methods are supported and the uint8 mask needs a max window of less
+//	than POOLING_MASK8_NONE items.
+//-----------------------------------------------------------------------------
+static long verifyPooling(int nMethod, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, bool bMask8)
+{
+	if (nMethod != POOLING_METHOD_MAX && nMethod != POOLING_METHOD_AVE)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (nNum < 0 || nChannels < 0 || h <= 0 || w <= 0 || hPooled <= 0 || wPooled <= 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (hKernel <= 0 || wKernel <= 0 || hStride <= 0 || wStride <= 0 || hPad < 0 || wPad < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (bMask8 && (nMethod != POOLING_METHOD_MAX || hKernel * wKernel >= POOLING_MASK8_NONE))
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+//	Returns the index of the geometry in s_rgPoolFixed, or -1 when it has
+//	no compile time kernels.
+//-----------------------------------------------------------------------------
+static int findPoolFixed(int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad)
+{
+	for (int i = 0; i < HOSTBLAS_POOL_FIXED; i++)
+	{
+		const HostPoolGeometry* p = &s_rgPoolFixed[i];
+
+		if (p->nKernelH == hKernel && p->nKernelW == wKernel && p->nStrideH == hStride && p->nStrideW == wStride && p->nPadH == hPad && p->nPadW == wPad)
+			return i;
+	}
+
+	return -1;
+}
+
+//=============================================================================
+//	HostKernels Methods
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Calculates the same STATS_COUNT statistics as Math::stats over a host
+//	buffer, split over the threads in blocks that stay in the L2 cache.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostKernels<T>::stats(int n, const T* x, T* rgStats, int nXOff)
+{
+	if (n < 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (x == NULL || rgStats == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nXOff > 0)
+		x += nXOff;
+
+	const HostKernelTable<T>* pK = getTable<T>();
+	const int nBlock = 16384;
+	int nUnits = (n + nBlock - 1) / nBlock;
+	int nJobs = getJobCount(2.0 * n, nUnits);
+	std::vector<double> rgPartials((size_t)nJobs * STATS_COUNT);
+	std::vector<std::function<void()>> rgJobs;
+
+	for (int i = 0; i < nJobs; i++)
+	{
+		int nFirst = (int)((LONGLONG)nUnits * i / nJobs) * nBlock;
+		int nLast = MIN((int)((LONGLONG)nUnits * (i + 1) / nJobs) * nBlock, n);
+		double* pStats = &rgPartials[(size_t)i * STATS_COUNT];
+
+		pStats[STATS_MIN] = HUGE_VAL;
+		pStats[STATS_MAX] = -HUGE_VAL;
+
+		rgJobs.push_back([=]()
+		{
+			for (int j = nFirst; j < nLast; j += nBlock)
+			{
+				pK->m_pfnStats(MIN(nBlock, nLast - j), x + j, pStats);
+			}
+		});
+	}
+
+	runJobs(rgJobs);
+
+	double rgTotal[STATS_COUNT] = { HUGE_VAL, -HUGE_VAL, 0, 0, 0, 0 };
+
+	for (int i = 0; i < nJobs; i++)
+	{
+		double* pStats = &rgPartials[(size_t)i * STATS_COUNT];
+
+		rgTotal[STATS_MIN] = (pStats[STATS_MIN] < rgTotal[STATS_MIN]) ? pStats[STATS_MIN] : rgTotal[STATS_MIN];
+		rgTotal[STATS_MAX] = (pStats[STATS_MAX] > rgTotal[STATS_MAX]) ? pStats[STATS_MAX] : rgTotal[STATS_MAX];
+
+		for (int j = STATS_SUM; j < STATS_COUNT; j++)
+		{
+			rgTotal[j] += pStats[j];
+		}
+	}
+
+	// The min and max are 0 when all values are NaN.
+	if (rgTotal[STATS_MIN] > rgTotal[STATS_MAX])
+	{
+		rgTotal[STATS_MIN] = 0;
+		rgTotal[STATS_MAX] = 0;
+	}
+
+	for (int i = 0; i < STATS_COUNT; i++)
+	{
+		rgStats[i] = (T)rgTotal[i];
+	}
+
+	return 0;
+}
+
+template long HostKernels<double>::stats(int n, const double* x, double* rgStats, int nXOff);
+template long HostKernels<float>::stats(int n, const float* x, float* rgStats, int nXOff);
+
+
+//-----------------------------------------------------------------------------
+//	Calculates the fused softmax loss of Math::softmaxloss_fused over host
+//	buffers laid out as nOuterNum x nChannels x nInnerNum, where the loss and
+//	counts hold nOuterNum x nInnerNum items.  The probabilities and the
+//	unscaled gradient are only written when prob and diff are set.  Each
+//	row is vectorised over its channels when nInnerNum is 1, and over the
+//	spatial items otherwise.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostKernels<T>::softmaxloss(int nOuterNum, int nChannels, int nInnerNum, const T* x, const T* label, int nIgnoreLabel, T* loss, T* counts, T* prob, T* diff)
+{
+	if (nOuterNum < 0 || nChannels <= 0 || nInnerNum <= 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (x == NULL || label == NULL || loss == NULL || counts == NULL)
+		return ERROR_PARAM_NULL;
+
+	const HostKernelTable<T>* pK = getTable<T>();
+	const int nW = pK->m_nW;
+	const size_t nDim = (size_t)nChannels * nInnerNum;
+	int nJobs = getJobCount(20.0 * nOuterNum * nDim, nOuterNum);
+	std::vector<std::function<void()>> rgJobs;
+
+	for (int i = 0; i < nJobs; i++)
+	{
+		int nFirst = (int)((LONGLONG)nOuterNum * i / nJobs);
+		int nLast = (int)((LONGLONG)nOuterNum * (i + 1) / nJobs);
+
+		rgJobs.push_back([=]()
+		{
+			for (int n = nFirst; n < nLast; n++)
+			{
+				size_t nOffset = n * nDim;
+				size_t nItem = (size_t)n * nInnerNum;
+				T* pProb = (prob == NULL) ? NULL : prob + nOffset;
+				T* pDiff = (diff == NULL) ? NULL : diff + nOffset;
+
+				if (nInnerNum == 1)
+				{
+					pK->m_pfnSoftmaxRow(nChannels, 1, x + nOffset, label + nItem, nIgnoreLabel, loss + nItem, counts + nItem, pProb, pDiff);
+					continue;
+				}
+
+				int s = 0;
+
+				for (; s + nW <= nInnerNum; s += nW)
+				{
+					pK->m_pfnSoftmaxCols(nChannels, nInnerNum, x + nOffset + s, label + nItem + s, nIgnoreLabel, loss + nItem + s, counts + nItem + s, (pProb == NULL) ? NULL : pProb + s, (pDiff == NULL) ? NULL : pDiff + s);
+				}
+
+				for (; s < nInnerNum; s++)
+				{
+					softmaxColsKernel<T, VecScalar<T>>(nChannels, nInnerNum, x + nOffset + s, label + nItem + s, nIgnoreLabel, loss + nItem + s, counts + nItem + s, (pProb == NULL) ? NULL : pProb + s, (pDiff == NULL) ? NULL : pDiff + s);
+				}
+			}
+		});
+	}
+
+	runJobs(rgJobs);
+
+	return 0;
+}
+
+template long HostKernels<double>::softmaxloss(int nOuterNum, int nChannels, int nInnerNum, const double* x, const double* label, int nIgnoreLabel, double* loss, double* counts, double* prob, double* diff);
+template long HostKernels<float>::softmaxloss(int nOuterNum, int nChannels, int nInnerNum, const float* x, const float* label, int nIgnoreLabel, float* loss, float* counts, float* prob, float* diff);
+
+
+//-----------------------------------------------------------------------------
+//	Calculates the max (POOLING_METHOD_MAX) or average (POOLING_METHOD_AVE)
+//	pooling of Math::pooling_fwd over host buffers, with the channels split
+//	over the threads.  The max writes the index of each maximum within its
+//	channel to mask, or the index within its window to the uint8 mask8,
+//	when set.  The geometries of s_rgPoolFixed use their compile time
+//	kernels, a window covering each whole channel is averaged as one sum,
+//	and all other geometries are pooled one item at a time.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostKernels<T>::pooling_fwd(int nMethod, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, const T* bottom_data, T* top_data, T* mask, unsigned char* mask8)
+{
+	LONG lErr;
+
+	if (lErr = verifyPooling(nMethod, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, mask8 != NULL))
+		return lErr;
+
+	if (bottom_data == NULL || top_data == NULL)
+		return ERROR_PARAM_NULL;
+
+	const HostKernelTable<T>* pK = getTable<T>();
+	const int nPlanes = nNum * nChannels;
+	const size_t nSpatial = (size_t)h * w;
+	const size_t nPooled = (size_t)hPooled * wPooled;
+	const bool bGlobal = (nMethod == POOLING_METHOD_AVE && hPooled == 1 && wPooled == 1 && hPad == 0 && wPad == 0 && hKernel >= h && wKernel >= w);
+	const int nFixed = findPoolFixed(hKernel, wKernel, hStride, wStride, hPad, wPad);
+	const size_t nWork = (nFixed >= 0 && wStride > 1) ? (size_t)h * (w + wStride) : 0;
+	int nJobs = getJobCount(2.0 * nPlanes * (double)nPooled * hKernel * wKernel, nPlanes);
+	std::vector<std::function<void()>> rgJobs;
+
+	for (int i = 0; i < nJobs; i++)
+	{
+		int nFirst = (int)((LONGLONG)nPlanes * i / nJobs);
+		int nLast = (int)((LONGLONG)nPlanes * (i + 1) / nJobs);
+
+		rgJobs.push_back([=]()
+		{
+			std::vector<T> rgWork(nWork);
+
+			for (int n = nFirst; n < nLast; n++)
+			{
+				const T* x = bottom_data + n * nSpatial;
+				T* y = top_data + n * nPooled;
+				T* pMask = (mask == NULL) ? NULL : mask + n * nPooled;
+				unsigned char* pMask8 = (mask8 == NULL) ? NULL : mask8 + n * nPooled;
+
+				if (bGlobal)
+				{
+					y[0] = pK->m_pfnSum((int)nSpatial, x) / (T)nSpatial;
+				}
+				else if (nFixed >= 0)
+				{
+					pK->m_rgpfnPoolFwd[nFixed](nMethod, h, w, hPooled, wPooled, x, y, pMask, pMask8, (nWork > 0) ? &rgWork[0] : NULL);
+				}
+				else
+				{
+					for (int ph = 0; ph < hPooled; ph++)
+					{
+						for (int pw = 0; pw < wPooled; pw++)
+						{
+							poolFwdItem(nMethod, h, w, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, ph, pw, x, y, pMask, pMask8);
+						}
+					}
+				}
+			}
+		});
+	}
+
+	runJobs(rgJobs);
+
+	return 0;
+}
+
+template long HostKernels<double>::pooling_fwd(int nMethod, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, const double* bottom_data, double* top_data, double* mask, unsigned char* mask8);
+template long HostKernels<float>::pooling_fwd(int nMethod, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, const float* bottom_data, float* top_data, float* mask, unsigned char* mask8);
+
+
+//-----------------------------------------------------------------------------
+//	Calculates the bottom diff of the pooling of Math::pooling_bwd over host
+//	buffers, with the channels split over the threads.  The max needs the
+//	mask or the uint8 mask8 written by the forward pass.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostKernels<T>::pooling_bwd(int nMethod, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, const T* top_diff, T* bottom_diff, const T* mask, const unsigned char* mask8)
+{
+	LONG lErr;
+
+	if (lErr = verifyPooling(nMethod, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, mask8 != NULL))
+		return lErr;
+
+	if (top_diff == NULL || bottom_diff == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nMethod == POOLING_METHOD_MAX && mask == NULL && mask8 == NULL)
+		return ERROR_PARAM_NULL;
+
+	const HostKernelTable<T>* pK = getTable<T>();
+	const int nPlanes = nNum * nChannels;
+	const size_t nSpatial = (size_t)h * w;
+	const size_t nPooled = (size_t)hPooled * wPooled;
+	const bool bGlobal = (nMethod == POOLING_METHOD_AVE && hPooled == 1 && wPooled == 1 && hPad == 0 && wPad == 0 && hKernel >= h && wKernel >= w);
+	const int nFixed = findPoolFixed(hKernel, wKernel, hStride, wStride, hPad, wPad);
+	const size_t nWork = (nFixed >= 0 && wStride > 1) ? (size_t)h * (w + wStride) : 0;
+	int nJobs = getJobCount(2.0 * nPlanes * (double)nPooled * hKernel * wKernel, nPlanes);
+	std::vector<std::function<void()>> rgJobs;
+
+	for (int i = 0; i < nJobs; i++)
+	{
+		int nFirst = (int)((LONGLONG)nPlanes * i / nJobs);
+		int nLast = (int)((LONGLONG)nPlanes * (i + 1) / nJobs);
+
+		rgJobs.push_back([=]()
+		{
+			std::vector<T> rgWork(nWork);
+
+			for (int n = nFirst; n < nLast; n++)
+			{
+				const T* dy = top_diff + n * nPooled;
+				T* dx = bottom_diff + n * nSpatial;
+				const T* pMask = (mask == NULL) ? NULL : mask + n * nPooled;
+				const unsigned char* pMask8 = (mask8 == NULL) ? NULL : mask8 + n * nPooled;
+
+				if (bGlobal)
+				{
+					std::fill(dx, dx + nSpatial, dy[0] / (T)nSpatial);
+				}
+				else if (nFixed >= 0)
+				{
+					pK->m_rgpfnPoolBwd[nFixed](nMethod, h, w, hPooled, wPooled, dy, dx, pMask, pMask8, (nWork > 0) ? &rgWork[0] : NULL);
+				}
+				else
+				{
+					std::fill(dx, dx + nSpatial, T(0));
+
+					for (int ph = 0; ph < hPooled; ph++)
+					{
+						for (int pw = 0; pw < wPooled; pw++)
+						{
+							poolBwdItem(nMethod, h, w, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, ph, pw, dy, dx, pMask, pMask8);
+						}
+					}
+				}
+			}
+		});
+	}
+
+	runJobs(rgJobs);
+
+	return 0;
+}
+
+template long HostKernels<double>::pooling_bwd(int nMethod, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, const double* top_diff, double* bottom_diff, const double* mask, const unsigned char* mask8);
+template long HostKernels<float>::pooling_bwd(int nMethod, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, const float* top_diff, float* bottom_diff, const float* mask, const unsigned char* mask8);
+
+
+//-----------------------------------------------------------------------------
+//	Applies the foreach update of Math::update_foreach to host tensors.  The
+//	items of all tensors are split evenly over the threads, so a job may
+//	cover the end of one tensor and the start of the next, and each run of
+//	items is updated with the rule of update_item.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostKernels<T>::update_foreach(const UPDATE_PARAMS<T>& p, int nTensors, const UPDATE_TENSOR<T>* rgTensors)
+{
+	if (nTensors < 0 || p.nMethod < UPDATE_METHOD_SGD || p.nMethod > UPDATE_METHOD_RMSPROP)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (nTensors > 0 && rgTensors == NULL)
+		return ERROR_PARAM_NULL;
+
+	std::vector<LONGLONG> rgStart(nTensors + 1);
+
+	rgStart[0] = 0;
+
+	for (int i = 0; i < nTensors; i++)
+	{
+		if (rgTensors[i].nCount < 0)
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		rgStart[i + 1] = rgStart[i] + rgTensors[i].nCount;
+	}
+
+	LONGLONG llTotal = rgStart[nTensors];
+	int nUnits = (int)((llTotal + UPDATE_FOREACH_CHUNK - 1) / UPDATE_FOREACH_CHUNK);
+	int nJobs = getJobCount(10.0 * llTotal, nUnits);
+	std::vector<std::function<void()>> rgJobs;
+
+	for (int j = 0; j < nJobs; j++)
+	{
+		LONGLONG llFirst = llTotal * j / nJobs;
+		LONGLONG llLast = llTotal * (j + 1) / nJobs;
+
+		rgJobs.push_back([=, &rgStart]()
+		{
+			// Find the tensor holding the first item of the job.
+			int nTensor = (int)(std::upper_bound(rgStart.begin(), rgStart.end(), llFirst) - rgStart.begin()) - 1;
+
+			for (LONGLONG ll = llFirst; ll < llLast && nTensor < nTensors; nTensor++)
+			{
+				const UPDATE_TENSOR<T>& t = rgTensors[nTensor];
+				int nStart = (int)(ll - rgStart[nTensor]);
+				int nEnd = (int)(MIN(llLast, rgStart[nTensor + 1]) - rgStart[nTensor]);
+
+				for (int i = nStart; i < nEnd; i++)
+				{
+					T fUpdate = update_item(p, t, i);
+
+					t.diff[i] = fUpdate;
+
+					if (p.bUpdateData)
+						t.data[i] -= fUpdate;
+				}
+
+				ll = rgStart[nTensor + 1];
+			}
+		});
+	}
+
+	runJobs(rgJobs);
+
+	return 0;
+}
+
+template long HostKernels<double>::update_foreach(const UPDATE_PARAMS<double>& p, int nTensors, const UPDATE_TENSOR<double>* rgTensors);
+template long HostKernels<float>::update_foreach(const UPDATE_PARAMS<float>& p, int nTensors, const UPDATE_TENSOR<float>* rgTensors);
+
+
+//-----------------------------------------------------------------------------
+//	Fills y with items llOffset to llOffset + n - 1 of a Philox stream, the
+//	same items as Math::rng_philox.  Each item only depends on its index so
+//	the items are split over the threads without changing the result.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostKernels<T>::rng_philox(int nMethod, int n, T fA, T fB, LONGLONG llSeed, int nStream, LONGLONG llOffset, T* y)
+{
+	if (n < 0 || nMethod < RNG_PHILOX_UNIFORM || nMethod > RNG_PHILOX_BERNOULLI)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (n > 0 && y == NULL)
+		return ERROR_PARAM_NULL;
+
+	int nJobs = getJobCount(100.0 * n, (n + 1023) / 1024);
+	std::vector<std::function<void()>> rgJobs;
+
+	for (int j = 0; j < nJobs; j++)
+	{
+		int nFirst = (int)((LONGLONG)n * j / nJobs);
+		int nLast = (int)((LONGLONG)n * (j + 1) / nJobs);
+
+		rgJobs.push_back([=]()
+		{
+			for (int i = nFirst; i < nLast; i++)
+			{
+				y[i] = philox_item<T>(nMethod, fA, fB, (unsigned long long)llSeed, (unsigned int)nStream, (unsigned long long)(llOffset + i));
+			}
+		});
+	}
+
+	runJobs(rgJobs);
+
+	return 0;
+}
+
+template long HostKernels<double>::rng_philox(int nMethod, int n, double fA, double fB, LONGLONG llSeed, int nStream, LONGLONG llOffset, double* y);
+template long HostKernels<float>::rng_philox(int nMethod, int n, float fA, float fB, LONGLONG llSeed, int nStream, LONGLONG llOffset, float* y);
+
+
+//-----------------------------------------------------------------------------
+//	Runs the forward pass of a whole LSTM sequence on host memory, the same
+//	as Math::lstm_seq_fwd.  The input projection of all steps is made with
+//	one gemm, then a team of threads runs the steps, each member computing
+//	the recurrent products, gates and cell update of its slice of the
+//	hidden and batch items.  A member keeps the same rows of the recurrent
+//	weights at every step so they stay in its caches.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostKernels<T>::lstm_seq_fwd(int nT, int nN, int nH, int nI, const T* weight_i, const T* weight_h, const T* bias, const T* x, const T* clip, const T* h0, const T* c0, T* top, T* cell, T* pre_gate, T* gate)
+{
+	LONG lErr;
+
+	if (nT < 0 || nN <= 0 || nH <= 0 || nI <= 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (weight_i == NULL || weight_h == NULL || x == NULL || h0 == NULL || c0 == NULL || top == NULL || cell == NULL || pre_gate == NULL || gate == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nT == 0)
+		return 0;
+
+	if (lErr = HostBlas<T>::gemm(false, true, nT * nN, 4 * nH, nI, T(1), x, weight_i, T(0), pre_gate))
+		return lErr;
+
+	const HostBlasKernel<T>* pK = getKernel<T>();
+	int nCount = nN * nH;
+	int nJobs = getJobCount(8.0 * nN * nH * nH, nH * nN);
+
+	runTeam(nJobs, [=](int nMember, HostTeam* pTeam)
+	{
+		int nN0, nN1, nD0, nD1;
+
+		getLstmSlice(nMember, pTeam->Size(), nN, nH, &nN0, &nN1, &nD0, &nD1);
+
+		for (int t = 0; t < nT; t++)
+		{
+			const T* h_t_1 = (t > 0) ? top + (size_t)(t - 1) * nCount : h0;
+			const T* c_t_1 = (t > 0) ? cell + (size_t)(t - 1) * nCount : c0;
+			T* pre_gate_t = pre_gate + (size_t)t * 4 * nCount;
+			T* gate_t = gate + (size_t)t * 4 * nCount;
+			T* c_t = cell + (size_t)t * nCount;
+			T* h_t = top + (size_t)t * nCount;
+
+			for (int n = nN0; n < nN1; n++)
+			{
+				T fClip = (clip != NULL) ? clip[t * nN + n] : T(t > 0);
+
+				for (int d = nD0; d < nD1; d++)
+				{
+					T rgGate[4];
+
+					for (int g = 0; g < 4; g++)
+					{
+						int j = g * nH + d;
+						T fPre = pre_gate_t[n * 4 * nH + j];
+
+						if (bias != NULL)
+							fPre += bias[j];
+
+						// Without clip data the first step has no recurrent input.
+						if (t > 0 || clip != NULL)
+							fPre += fClip * pK->m_pfnDot(nH, weight_h + (size_t)j * nH, h_t_1 + n * nH);
+
+						pre_gate_t[n * 4 * nH + j] = fPre;
+						rgGate[g] = (g < 3) ? hostSigmoid(fPre) : hostTanh(fPre);
+						gate_t[n * 4 * nH + j] = rgGate[g];
+					}
+
+					int idx = n * nH + d;
+					T c = fClip * rgGate[1] * c_t_1[idx] + rgGate[0] * rgGate[3];
+					c_t[idx] = c;
+					h_t[idx] = rgGate[2] * hostTanh(c);
+				}
+			}
+
+			// The next step reads all of h(t).
+			pTeam->Sync();
+		}
+	});
+
+	return 0;
+}
+
+template long HostKernels<double>::lstm_seq_fwd(int nT, int nN, int nH, int nI, const double* weight_i, const double* weight_h, const double* bias, const double* x, const double* clip, const double* h0, const double* c0, double* top, double* cell, double* pre_gate, double* gate);
+template long HostKernels<float>::lstm_seq_fwd(int nT, int nN, int nH, int nI, const float* weight_i, const float* weight_h, const float* bias, const float* x, const float* clip, const float* h0, const float* c0, float* top, float* cell, float* pre_gate, float* gate);
+
+
+//-----------------------------------------------------------------------------
+//	Runs the backward pass of a whole LSTM sequence on host memory, the
+//	same as Math::lstm_seq_bwd.  A team of threads runs the steps from the
+//	last to the first, each member computing the cell and gate diffs of
+//	its slice of the hidden and batch items, and then the recurrent diff
+//	of the same slice from its columns of the recurrent weights.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostKernels<T>::lstm_seq_bwd(int nT, int nN, int nH, T fClip, const T* weight_h, const T* clip, T* top_diff, const T* cell, T* cell_diff, T* pre_gate_diff, const T* gate, T* gate_diff, const T* c0, T* h0_diff, T* c0_diff)
+{
+	if (nT < 0 || nN <= 0 || nH <= 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (weight_h == NULL || top_diff == NULL || cell == NULL || cell_diff == NULL || pre_gate_diff == NULL || gate == NULL || gate_diff == NULL || c0 == NULL || h0_diff == NULL || c0_diff == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nT == 0)
+		return 0;
+
+	const HostBlasKernel<T>* pK = getKernel<T>();
+	int nCount = nN * nH;
+	int nJobs = getJobCount(8.0 * nN * nH * nH, nH * nN);
+	std::vector<T> rgHtoH(nCount);
+	T* h_to_h = &rgHtoH[0];
+
+	runTeam(nJobs, [=](int nMember, HostTeam* pTeam)
+	{
+		int nN0, nN1, nD0, nD1;
+
+		getLstmSlice(nMember, pTeam->Size(), nN, nH, &nN0, &nN1, &nD0, &nD1);
+
+		for (int t = nT - 1; t >= 0; t--)
+		{
+			const T* c_t_1 = (t > 0) ? cell + (size_t)(t - 1) * nCount : c0;
+			const T* c_t = cell + (size_t)t * nCount;
+			const T* gate_t = gate + (size_t)t * 4 * nCount;
+			T* dh_t = top_diff + (size_t)t * nCount;
+			T* dc_t = cell_diff + (size_t)t * nCount;
+			T* dc_t_1 = (t > 0) ? cell_diff + (size_t)(t - 1) * nCount : c0_diff;
+			T* gate_diff_t = gate_diff + (size_t)t * 4 * nCount;
+			T* pre_gate_diff_t = pre_gate_diff + (size_t)t * 4 * nCount;
+
+			for (int n = nN0; n < nN1; n++)
+			{
+				T fClipT = (clip != NULL) ? clip[t * nN + n] : T(t > 0);
+				T fClipNext = (clip != NULL && t < nT - 1) ? clip[(t + 1) * nN + n] : T(1);
+
+				for (int d = nD0; d < nD1; d++)
+				{
+					int idx = n * nH + d;
+					const T* pGate = gate_t + n * 4 * nH;
+					T dh = dh_t[idx];
+
+					// Add the recurrent diff of step t + 1, made by this member.
+					if (t < nT - 1)
+					{
+						dh += fClipNext * h_to_h[idx];
+						dh_t[idx] = dh;
+					}
+
+					T tanh_c = hostTanh(c_t[idx]);
+					T dc = dc_t[idx] + dh * pGate[2 * nH + d] * (T(1) - tanh_c * tanh_c);
+					dc_t[idx] = dc;
+					dc_t_1[idx] = fClipT * dc * pGate[nH + d];
+
+					T rgDiff[4];
+					rgDiff[0] = dc * pGate[3 * nH + d];
+					rgDiff[1] = fClipT * dc * c_t_1[idx];
+					rgDiff[2] = dh * tanh_c;
+					rgDiff[3] = dc * pGate[d];
+
+					for (int g = 0; g < 4; g++)
+					{
+						int j = n * 4 * nH + g * nH + d;
+						T fGate = pGate[g * nH + d];
+						T fDiff = (g < 3) ? rgDiff[g] * fGate * (T(1) - fGate) : rgDiff[g] * (T(1) - fGate * fGate);
+
+						if (fClip > T(0))
+						{
+							if (fDiff < -fClip)
+								fDiff = -fClip;
+							else if (fDiff > fClip)
+								fDiff = fClip;
+						}
+
+						gate_diff_t[j] = rgDiff[g];
+						pre_gate_diff_t[j] = fDiff;
+					}
+				}
+			}
+
+			// The recurrent diff reads all of the pre-gate diffs of step t.
+			pTeam->Sync();
+
+			// Without clip data the first step passes no diff back to H0.
+			if (t == 0 && clip == NULL)
+				break;
+
+			for (int n = nN0; n < nN1; n++)
+			{
+				T* pHtoH = h_to_h + n * nH + nD0;
+
+				memset(pHtoH, 0, sizeof(T) * (nD1 - nD0));
+
+				for (int j = 0; j < 4 * nH; j++)
+				{
+					pK->m_pfnAxpy(nD1 - nD0, pre_gate_diff_t[n * 4 * nH + j], weight_h + (size_t)j * nH + nD0, pHtoH);
+				}
+
+				if (t == 0)
+				{
+					for (int d = nD0; d < nD1; d++)
+					{
+						h0_diff[n * nH + d] += clip[n] * h_to_h[n * nH + d];
+					}
+				}
+			}
+		}
+	});
+
+	return 0;
+}
+
+template long HostKernels<double>::lstm_seq_bwd(int nT, int nN, int nH, double fClip, const double* weight_h, const double* clip, double* top_diff, const double* cell, double* cell_diff, double* pre_gate_diff, const double* gate, double* gate_diff, const double* c0, double* h0_diff, double* c0_diff);
+template long HostKernels<float>::lstm_seq_bwd(int nT, int nN, int nH, float fClip, const float* weight_h, const float* clip, float* top_diff, const float* cell, float* cell_diff, float* pre_gate_diff, const float* gate, float* gate_diff, const float* c0, float* h0_diff, float* c0_diff);
+
+//-----------------------------------------------------------------------------
+//	Times the host kernels with the instruction set chosen by the host BLAS
+//	engine.  The stats are timed on n x n items.
+//-----------------------------------------------------------------------------
+template <class T>
+long HostKernels<T>::Benchmark(BenchmarkRunner* pRunner)
+{
+	LONG lErr = 0;
+	LPCSTR pszType = (sizeof(T) == sizeof(float)) ? "float" : "double";
+	char szName[64];
+
+	if (!pRunner->IsSelected(BENCH_SUITE_HOST_BLAS))
+		return 0;
+
+	_snprintf(szName, 63, "host_stats_%s", getIsaName(getIsa()));
+	szName[63] = NULL;
+
+	for (int nSize = pRunner->MinSize(); nSize <= pRunner->MaxSize() && nSize <= 4096 && !lErr; nSize *= 4)
+	{
+		int nCount = nSize * nSize;
+		std::vector<T> rgX(nCount);
+		T rgStats[STATS_COUNT];
+
+		for (int i = 0; i < nCount; i++)
+		{
+			rgX[i] = T(i % 1000) / T(1000) - T(0.5);
+		}
+
+		lErr = pRunner->Run(szName, pszType, nCount, (double)nCount, [&](LONGLONG llIterations)
+		{
+			LONG lErr1;
+
+			for (LONGLONG i = 0; i < llIterations; i++)
+			{
+				if (lErr1 = stats(nCount, &rgX[0], rgStats))
+					return lErr1;
+			}
+
+			return 0;
+		});
+	}
+
+	// The softmax loss is timed on rows of 32k classes, the items are the
+	// logits read.
+	_snprintf(szName, 63, "host_softmaxloss_%s", getIsaName(getIsa()));
+	szName[63] = NULL;
+
+	for (int nSize = pRunner->MinSize(); nSize <= pRunner->MaxSize() && nSize <= 4096 && !lErr; nSize *= 4)
+	{
+		const int nChannels = 32768;
+		int nOuterNum = (nSize * nSize + nChannels - 1) / nChannels;
+		int nCount = nOuterNum * nChannels;
+		std::vector<T> rgX(nCount);
+		std::vector<T> rgDiff(nCount);
+		std::vector<T> rgLabel(nOuterNum);
+		std::vector<T> rgLoss(nOuterNum);
+		std::vector<T> rgCounts(nOuterNum);
+
+		for (int i = 0; i < nCount; i++)
+		{
+			rgX[i] = T(i % 1000) / T(100) - T(5);
+		}
+
+		for (int i = 0; i < nOuterNum; i++)
+		{
+			rgLabel[i] = T((i * 7919) % nChannels);
+		}
+
+		lErr = pRunner->Run(szName, pszType, nCount, (double)nCount, [&](LONGLONG llIterations)
+		{
+			LONG lErr1;
+
+			for (LONGLONG i = 0; i < llIterations; i++)
+			{
+				if (lErr1 = softmaxloss(nOuterNum, nChannels, 1, &rgX[0], &rgLabel[0], -1, &rgLoss[0], &rgCounts[0], NULL, &rgDiff[0]))
+					return lErr1;
+			}
+
+			return 0;
+		});
+	}
+
+	// The pooling is timed as the 3x3 stride 2 max with the uint8 mask over
+	// 64 channels of nSize x nSize, the items are the inputs read.
+	_snprintf(szName, 63, "host_pooling_%s", getIsaName(getIsa()));
+	szName[63] = NULL;
+
+	for (int nSize = pRunner->MinSize(); nSize <= pRunner->MaxSize() && nSize <= 1024 && !lErr; nSize *= 2)
+	{
+		const int nChannels = 64;
+		int nPooled = (nSize - 3 + 1) / 2 + 1;
+		int nCount = nChannels * nSize * nSize;
+		std::vector<T> rgX(nCount);
+		std::vector<T> rgY((size_t)nChannels * nPooled * nPooled);
+		std::vector<unsigned char> rgMask(rgY.size());
+
+		for (int i = 0; i < nCount; i++)
+		{
+			rgX[i] = T(((LONGLONG)i * 7919) % 1000) / T(100) - T(5);
+		}
+
+		lErr = pRunner->Run(szName, pszType, nCount, (double)nCount, [&](LONGLONG llIterations)
+		{
+			LONG lErr1;
+
+			for (LONGLONG i = 0; i < llIterations; i++)
+			{
+				if (lErr1 = pooling_fwd(POOLING_METHOD_MAX, 1, nChannels, nSize, nSize, nPooled, nPooled, 3, 3, 2, 2, 0, 0, &rgX[0], &rgY[0], NULL, &rgMask[0]))
+					return lErr1;
+			}
+
+			return 0;
+		});
+	}
+
+	// The LSTM sequence is timed with 32 steps of 32 items and equal input
+	// and hidden sizes, the items are the FLOPs of the products.
+	_snprintf(szName, 63, "host_lstm_seq_fwd_%s", getIsaName(getIsa()));
+	szName[63] = NULL;
+
+	for (int nSize = pRunner->MinSize(); nSize <= pRunner->MaxSize() && nSize <= 1024 && !lErr; nSize *= 2)
+	{
+		const int nT = 32;
+		const int nN = 32;
+		int nH = nSize;
+		int nCount = nN * nH;
+		double dfFlops = 2.0 * nT * nN * 4 * nH * (nH + nH);
+		std::vector<T> rgWi((size_t)4 * nH * nH);
+		std::vector<T> rgWh((size_t)4 * nH * nH);
+		std::vector<T> rgX((size_t)nT * nCount);
+		std::vector<T> rgState(nCount, T(0));
+		std::vector<T> rgTop((size_t)nT * nCount);
+		std::vector<T> rgCell((size_t)nT * nCount);
+		std::vector<T> rgPreGate((size_t)nT * 4 * nCount);
+		std::vector<T> rgGate((size_t)nT * 4 * nCount);
+
+		for (size_t i = 0; i < rgWi.size(); i++)
+		{
+			rgWi[i] = rgWh[i] = T(i % 1000) / T(1000 * nH) - T(0.5) / nH;
+		}
+
+		for (size_t i = 0; i < rgX.size(); i++)
+		{
+			rgX[i] = T(i % 100) / T(100) - T(0.5);
+		}
+
+		lErr = pRunner->Run(szName, pszType, nSize, dfFlops, [&](LONGLONG llIterations)
+		{
+			LONG lErr1;
+
+			for (LONGLONG i = 0; i < llIterations; i++)
+			{
+				if (lErr1 = lstm_seq_fwd(nT, nN, nH, nH, &rgWi[0], &rgWh[0], NULL, &rgX[0], NULL, &rgState[0], &rgState[0], &rgTop[0], &rgCell[0], &rgPreGate[0], &rgGate[0]))
+					return lErr1;
+			}
+
+			return 0;
+		});
+	}
+
+	return lErr;
+}
+
+template long HostKernels<double>::Benchmark(BenchmarkRunner* pRunner);
+template long HostKernels<float>::Benchmark(BenchmarkRunner* pRunner);
@@ -0,0 +1,61 @@
+//=============================================================================
+//	FILE:	hostkernels.h
+//
+//	DESC:	This file manages the host kernels, which run the non-BLAS routines
+//			of the Math class on host memory using the host BLAS engine.
+//=============================================================================
+#ifndef __HOSTKERNELS_CU__
+#define __HOSTKERNELS_CU__
+
+#include "util.h"
+#include "hostblas.h"
+
+class BenchmarkRunner;
+
+template <class T>
+struct UPDATE_PARAMS;
+
+template <class T>
+struct UPDATE_TENSOR;
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+const int HOSTBLAS_CHECK_SOFTMAXLOSS = 0;
+const int HOSTBLAS_CHECK_UPDATE_FOREACH = 1;
+const int HOSTBLAS_CHECK_LSTM_SEQ = 2;
+const int HOSTBLAS_CHECK_RNG_PHILOX = 3;
+const int HOSTBLAS_CHECK_POOLING = 4;
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Host Kernels Class
+//
+//	Implements the stats, optimizer update, random number, LSTM sequence,
+//	softmax loss and pooling routines of the Math class on host memory.  The
+//	kernels use the same instruction set, vector traits and threads as the
+//	host BLAS engine, and the LSTM sequence runs its input product on the
+//	host BLAS gemm.
+//-----------------------------------------------------------------------------
+template <class T>
+class HostKernels
+{
+public:
+	static long stats(int n, const T* x, T* rgStats, int nXOff = 0);
+	static long update_foreach(const UPDATE_PARAMS<T>& p, int nTensors, const UPDATE_TENSOR<T>* rgTensors);
+	static long rng_philox(int nMethod, int n, T fA, T fB, LONGLONG llSeed, int nStream, LONGLONG llOffset, T* y);
+	static long lstm_seq_fwd(int nT, int nN, int nH, int nI, const T* weight_i, const T* weight_h, const T* bias, const T* x, const T* clip, const T* h0, const T* c0, T* top, T* cell, T* pre_gate, T* gate);
+	static long lstm_seq_bwd(int nT, int nN, int nH, T fClip, const T* weight_h, const T* clip, T* top_diff, const T* cell, T* cell_diff, T* pre_gate_diff, const T* gate, T* gate_diff, const T* c0, T* h0_diff, T* c0_diff);
+	static long softmaxloss(int nOuterNum, int nChannels, int nInnerNum, const T* x, const T* label, int nIgnoreLabel, T* loss, T* counts, T* prob = NULL, T* diff = NULL);
+	static long pooling_fwd(int nMethod, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, const T* bottom_data, T* top_data, T* mask = NULL, unsigned char* mask8 = NULL);
+	static long pooling_bwd(int nMethod, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, const T* top_diff, T* bottom_diff, const T* mask = NULL, const unsigned char* mask8 = NULL);
+
+
+	static long Benchmark(BenchmarkRunner* pRunner);
+};
+
+#endif
@@ -0,0 +1,199 @@
+//=============================================================================
+//	FILE:	im2coltab.cu
+//
+//	DESC:	This file implements the cache of the index tables used by the
+//			N-d im2col and col2im kernels.
+//=============================================================================
+
+#include "util.h"
+#include "im2coltab.h"
+
+//=============================================================================
+//	Im2ColTableCache Methods
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Builds the tables of a geometry on the host, the shapes hold the spatial
+//	axes only.  The tables are packed into rgData as the gather table, the
+//	scatter starts and the scatter table, only the counts of pTable are set.
+//	Returns ERROR_PARAM_OUT_OF_RANGE when the tables would be too large.
+//-----------------------------------------------------------------------------
+long Im2ColTableCache::Build(int nNumSpatialAxes, const int* rgImShape, const int* rgColShape, const int* rgKernelShape, const int* rgPad, const int* rgStride, const int* rgDilation, std::vector<int>& rgData, IM2COL_TABLE* pTable)
+{
+	if (nNumSpatialAxes < 1 || nNumSpatialAxes > IM2COL_MAX_AXES)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	LONGLONG llKernel = 1;
+	LONGLONG llCol = 1;
+	LONGLONG llIm = 1;
+
+	for (int i = 0; i < nNumSpatialAxes; i++)
+	{
+		if (rgImShape[i] <= 0 || rgColShape[i] <= 0 || rgKernelShape[i] <= 0 || rgStride[i] <= 0 || rgDilation[i] <= 0)
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		llKernel *= rgKernelShape[i];
+		llCol *= rgColShape[i];
+		llIm *= rgImShape[i];
+	}
+
+	LONGLONG llGather = llKernel * llCol;
+
+	if (2 * llGather + llIm + 1 > IM2COL_MAX_TABLE_ITEMS)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	int nGather = (int)llGather;
+	int nIm = (int)llIm;
+	int nCol = (int)llCol;
+	int rgK[IM2COL_MAX_AXES];
+	int rgC[IM2COL_MAX_AXES];
+
+	rgData.resize(nGather + nIm + 1);
+	int* pGather = rgData.data();
+	int* pStart = pGather + nGather;
+
+	memset(pStart, 0, sizeof(int) * (nIm + 1));
+	memset(rgK, 0, sizeof(rgK));
+
+	// Walk the kernel and column positions with the last axis fastest, the
+	// same order as the column buffer.
+	for (int k = 0, r = 0; k < (int)llKernel; k++)
+	{
+		memset(rgC, 0, sizeof(rgC));
+
+		for (int c = 0; c < nCol; c++, r++)
+		{
+			int nOffset = 0;
+
+			for (int i = 0; i < nNumSpatialAxes; i++)
+			{
+				int nPos = rgC[i] * rgStride[i] - rgPad[i] + rgK[i] * rgDilation[i];
+
+				if (nPos < 0 || nPos >= rgImShape[i])
+				{
+					nOffset = -1;
+					break;
+				}
+
+				nOffset = nOffset * rgImShape[i] + nPos;
+			}
+
+			pGather[r] = nOffset;
+
+			if (nOffset >= 0)
+				pStart[nOffset + 1]++;
+
+			for (int i = nNumSpatialAxes - 1; i >= 0; i--)
+			{
+				if (++rgC[i] < rgColShape[i])
+					break;
+
+				rgC[i] = 0;
+			}
+		}
+
+		for (int i = nNumSpatialAxes - 1; i >= 0; i--)
+		{
+			if (++rgK[i] < rgKernelShape[i])
+				break;
+
+			rgK[i] = 0;
+		}
+	}
+
+	for (int i = 0; i < nIm; i++)
+	{
+		pStart[i + 1] += pStart[i];
+	}
+
+	int nScatter = pStart[nIm];
+	rgData.resize(nGather + nIm + 1 + nScatter);
+	pGather = rgData.data();
+	pStart = pGather + nGather;
+	int* pScatter = pStart + nIm + 1;
+
+	// Fill in increasing column order, so each sum is always taken in the
+	// same order.
+	std::vector<int> rgNext(pStart, pStart + nIm);
+
+	for (int r = 0; r < nGather; r++)
+	{
+		if (pGather[r] >= 0)
+			pScatter[rgNext[pGather[r]]++] = r;
+	}
+
+	pTable->nKernelCount = (int)llKernel;
+	pTable->nColCount = nCol;
+	pTable->nImCount = nIm;
+	pTable->pGather = NULL;
+	pTable->pScatterStart = NULL;
+	pTable->pScatter = NULL;
+
+	return 0;
+}
+
+bool Im2ColTableCache::Find(const IM2COL_KEY& key, const LONGLONG* rgllVersion, IM2COL_TABLE* pTable)
+{
+	std::map<IM2COL_KEY, Entry>::iterator it = m_rgEntries.find(key);
+	if (it == m_rgEntries.end())
+		return false;
+
+	if (memcmp(it->second.m_rgllVersion, rgllVersion, sizeof(LONGLONG) * IM2COL_HANDLE_COUNT) != 0)
+		return false;
+
+	*pTable = it->second.m_table;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//	Copies the tables built by Build to the current device and caches them,
+//	replacing any older tables of the same shape handles.
+//-----------------------------------------------------------------------------
+long Im2ColTableCache::Add(const IM2COL_KEY& key, const LONGLONG* rgllVersion, const std::vector<int>& rgData, const IM2COL_TABLE& table, IM2COL_TABLE* pTable)
+{
+	LONG lErr;
+	int* pData;
+
+	std::map<IM2COL_KEY, Entry>::iterator it = m_rgEntries.find(key);
+	if (it != m_rgEntries.end())
+	{
+		cudaFree(it->second.m_pData);
+		m_rgEntries.erase(it);
+	}
+
+	if (m_rgEntries.size() >= IM2COL_MAX_TABLES)
+		Clear();
+
+	if (lErr = cudaMalloc(&pData, sizeof(int) * rgData.size()))
+		return lErr;
+
+	if (lErr = cudaMemcpy(pData, rgData.data(), sizeof(int) * rgData.size(), cudaMemcpyHostToDevice))
+	{
+		cudaFree(pData);
+		return lErr;
+	}
+
+	Entry& entry = m_rgEntries[key];
+	memcpy(entry.m_rgllVersion, rgllVersion, sizeof(LONGLONG) * IM2COL_HANDLE_COUNT);
+	entry.m_pData = pData;
+	entry.m_table = table;
+	entry.m_table.pGather = pData;
+	entry.m_table.pScatterStart = pData + table.nKernelCount * table.nColCount;
+	entry.m_table.pScatter = entry.m_table.pScatterStart + table.nImCount + 1;
+
+	*pTable = entry.m_table;
+
+	return 0;
+}
+
+void Im2ColTableCache::Clear()
+{
+	for (std::map<IM2COL_KEY, Entry>::iterator it = m_rgEntries.begin(); it != m_rgEntries.end(); it++)
+	{
+		cudaFree(it->second.m_pData);
+	}
+
+	m_rgEntries.clear();
+}
+
+// end
\ No newline at end of file
@@ -0,0 +1,105 @@
+//=============================================================================
+//	FILE:	im2coltab.h
+//
+//	DESC:	This file manages the cache of the index tables used by the N-d
+//			im2col and col2im kernels.
+//=============================================================================
+#ifndef __IM2COLTAB_CU__
+#define __IM2COLTAB_CU__
+
+#include "util.h"
+#include <vector>
+#include <map>
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int IM2COL_MAX_AXES = 10;
+const int IM2COL_HANDLE_COUNT = 6;
+const int IM2COL_MAX_TABLES = 128;
+const LONGLONG IM2COL_MAX_TABLE_ITEMS = 16 * 1024 * 1024;
+
+//=============================================================================
+//	Types
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Identifies the shape handles of a geometry, the key is compared as raw
+//	memory so it must be cleared before it is filled.  The handles are the
+//	image shape, column shape, kernel shape, pad, stride and dilation.
+//-----------------------------------------------------------------------------
+typedef struct IM2COL_KEY
+{
+	int nDevice;
+	int nNumSpatialAxes;
+	int nChannelAxis;
+	long rghShape[IM2COL_HANDLE_COUNT];
+} IM2COL_KEY;
+
+inline bool operator<(const IM2COL_KEY& a, const IM2COL_KEY& b)
+{
+	return memcmp(&a, &b, sizeof(IM2COL_KEY)) < 0;
+}
+
+//-----------------------------------------------------------------------------
+//	The index tables of one geometry, where K is the kernel size, C the
+//	column spatial size and I the image spatial size of a single channel.
+//
+//	pGather[k * C + c] holds the image offset read by column item (k, c),
+//	or -1 when it falls in the padding.  pScatterStart[i] to
+//	pScatterStart[i + 1] index the items of pScatter holding the column
+//	items (k * C + c) that read image offset i, in increasing order.
+//-----------------------------------------------------------------------------
+typedef struct IM2COL_TABLE
+{
+	int nKernelCount;
+	int nColCount;
+	int nImCount;
+	const int* pGather;
+	const int* pScatterStart;
+	const int* pScatter;
+} IM2COL_TABLE;
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Im2Col Table Cache Class
+//
+//	Holds the device index tables of each im2col_nd geometry so that the
+//	N-d index arithmetic and the reads of the shape handles are only done
+//	once per geometry.  Each entry keeps the versions of the shape handles
+//	it was built from and is rebuilt when any of them are written.
+//-----------------------------------------------------------------------------
+class Im2ColTableCache
+{
+	class Entry
+	{
+	public:
+		LONGLONG m_rgllVersion[IM2COL_HANDLE_COUNT];
+		IM2COL_TABLE m_table;
+		int* m_pData;
+	};
+
+	std::map<IM2COL_KEY, Entry> m_rgEntries;
+
+public:
+	Im2ColTableCache()
+	{
+	}
+
+	~Im2ColTableCache()
+	{
+		Clear();
+	}
+
+	static long Build(int nNumSpatialAxes, const int* rgImShape, const int* rgColShape, const int* rgKernelShape, const int* rgPad, const int* rgStride, const int* rgDilation, std::vector<int>& rgData, IM2COL_TABLE* pTable);
+
+	bool Find(const IM2COL_KEY& key, const LONGLONG* rgllVersion, IM2COL_TABLE* pTable);
+	long Add(const IM2COL_KEY& key, const LONGLONG* rgllVersion, const std::vector<int>& rgData, const IM2COL_TABLE& table, IM2COL_TABLE* pTable);
+	void Clear();
+};
+
+#endif
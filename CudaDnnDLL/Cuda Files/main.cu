@@ -17,6 +17,7 @@
 
 // includes, project
 #include "main.h"
+#include "benchmark.h"
 
 
 //=============================================================================
@@ -24,7 +25,7 @@
 //=============================================================================
 
 template <class T>
-long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* plCount)
+long Kernel<T>::run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* plCount)
 {
 	cudaGetLastError();
 
@@ -117,6 +118,15 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_FN_RUN_MEMTEST:
 			return m_device.RunMemoryTest(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_START_MEMTEST_SCRUB:
+			return m_device.StartMemoryTestScrub(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_STOP_MEMTEST_SCRUB:
+			return m_device.StopMemoryTestScrub(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_GET_MEMTEST_SCRUB_STATUS:
+			return m_device.GetMemoryTestScrubStatus(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDA_FN_CREATE_NCCL:
 			return m_device.CreateNCCL(lCount, pfInput, plCount, ppfOutput);
 
@@ -135,6 +145,27 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_FN_NCCL_ALLREDUCE:
 			return m_device.NcclAllReduce(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_NCCL_SET_BUCKETS:
+			return m_device.NcclSetBuckets(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_NCCL_MARK_READY:
+			return m_device.NcclMarkReady(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_NCCL_ALLREDUCE_BUCKETS:
+			return m_device.NcclAllReduceBuckets(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_NCCL_SET_COMPRESSION:
+			return m_device.NcclSetCompression(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_NCCL_GET_COMPRESSION_STATS:
+			return m_device.NcclGetCompressionStats(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_NCCL_INIT_HIERARCHICAL:
+			return m_device.NcclInitHierarchical(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_NCCL_GET_HIERARCHY:
+			return m_device.NcclGetHierarchy(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDNN_FN_CREATE_CUDNN:
 			return m_device.CreateCuDNN(lCount, pfInput, plCount, ppfOutput);
 
@@ -294,6 +325,24 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_FN_TSNE_COMPUTE_ERROR1:
 			return m_device.EvaluateTsneError(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_CREATE_MODELAVG:
+			return m_device.CreateModelAvg(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_FREE_MODELAVG:
+			return m_device.FreeModelAvg(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_MODELAVG_PUSH:
+			return m_device.ModelAvgPush(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_MODELAVG_PULL:
+			return m_device.ModelAvgPull(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_MODELAVG_SET_WEIGHT:
+			return m_device.ModelAvgSetWeight(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_MODELAVG_GET_STATS:
+			return m_device.ModelAvgGetStats(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDA_FN_SET:
 			return m_device.cuda_set(lCount, pfInput, plCount, ppfOutput);
 
@@ -399,12 +448,18 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_FN_MINMAXVAL:
 			return m_device.cuda_minmaxval(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_STATS:
+			return m_device.cuda_stats(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDA_FN_SUMSQ:
 			return m_device.cuda_sumsq(lCount, pfInput, plCount, ppfOutput);
 
 		case CUDA_FN_SUMSQDIFF:
 			return m_device.cuda_sumsqdiff(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_FUSED_EXPR:
+			return m_device.cuda_fused_expr(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDA_FN_WIDTH:
 			return m_device.cuda_width(lCount, pfInput, plCount, ppfOutput);
 
@@ -453,6 +508,9 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_RNG_BERNOULLI:
 			return m_device.cuda_rng_bernoulli(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_RNG_PHILOX:
+			return m_device.cuda_rng_philox(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDA_FN_BATCHREIDX_FWD:
 			return m_device.cuda_batchreidx_fwd(lCount, pfInput, plCount, ppfOutput);
 
@@ -507,6 +565,12 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_FN_DROPOUT_BWD:
 			return m_device.cuda_dropout_bwd(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_DROPOUT_FWD_BITS:
+			return m_device.cuda_dropout_fwd_bits(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_DROPOUT_BWD_BITS:
+			return m_device.cuda_dropout_bwd_bits(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDA_FN_BNLL_FWD:
 			return m_device.cuda_bnll_fwd(lCount, pfInput, plCount, ppfOutput);
 
@@ -528,6 +592,9 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_FN_SOFTMAXLOSS_BWD:
 			return m_device.cuda_softmaxloss_bwd(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_SOFTMAXLOSS_FUSED:
+			return m_device.cuda_softmaxloss_fused(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDA_FN_MAX_FWD:
 			return m_device.cuda_max_fwd(lCount, pfInput, plCount, ppfOutput);
 
@@ -591,6 +658,12 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_FN_LSTM_UNIT_BWD:
 			return m_device.cuda_lstm_unit_bwd(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_LSTM_SEQ_FWD:
+			return m_device.cuda_lstm_seq_fwd(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_LSTM_SEQ_BWD:
+			return m_device.cuda_lstm_seq_bwd(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDA_FN_COEFF_SUM_FWD:
 			return m_device.cuda_coeff_sum_fwd(lCount, pfInput, plCount, ppfOutput);
 
@@ -621,6 +694,9 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_FN_RMSPROP_UPDATE:
 			return m_device.cuda_rmsprop_update(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_UPDATE_FOREACH:
+			return m_device.cuda_update_foreach(lCount, pfInput, plCount, ppfOutput);
+
 		case CUDA_FN_COMBINE_DATA:
 			return m_device.cuda_combine_data(lCount, pfInput, plCount, ppfOutput);
 
@@ -687,13 +763,427 @@ long Kernel<T>::Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* p
 		case CUDA_FN_CALC_BATCH_DIST:
 			return m_device.cuda_calc_batch_dist(lCount, pfInput, plCount, ppfOutput);
 
+		case CUDA_FN_PROFILER_ENABLE:
+			return enableProfiler(lCount, pfInput);
+
+		case CUDA_FN_PROFILER_RESET:
+			m_profiler.Reset();
+			return 0;
+
+		case CUDA_FN_TRACE_ENABLE:
+			return enableTracer(lCount, pfInput);
+
+		case CUDA_FN_ALLOC_TRACE_ENABLE:
+			return m_device.EnableAllocTracker(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_SET_ALLOC_TAG:
+			return m_device.SetAllocTag(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_CONV_ALGO_CACHE_CLEAR:
+			return clearConvAlgoCache(lCount, pfInput);
+
+		case CUDA_FN_CONV_ALGO_CACHE_SET_FILE:
+			return setConvAlgoCacheFile(lCount, pfInput);
+
+		case CUDA_FN_CONV_ALGO_CACHE_CHECK:
+			return checkConvAlgoCache(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_HOST_MIRROR_ENABLE:
+			return m_device.EnableHostMirror(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_GET_HOST_MIRROR_STATS:
+			return m_device.GetHostMirrorStats(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_HOST_BLAS_CHECK:
+			return m_device.CheckHostBlas(lCount, pfInput, plCount, ppfOutput);
+
+		case CUDA_FN_STREAM_POOL_CHECK:
+			return checkStreamPool(lCount, pfInput, plCount, ppfOutput);
+
 		default:
 			return ERROR_PARAM_OUT_OF_RANGE;
 	}
 }
 
-template long Kernel<double>::Run(long lfnIdx, double* pfInput, long lCount, double** ppfOutput, long* plCount);
-template long Kernel<float>::Run(long lfnIdx, float* pfInput, long lCount, float** ppfOutput, long* plCount);
+template long Kernel<double>::run(long lfnIdx, double* pfInput, long lCount, double** ppfOutput, long* plCount);
+template long Kernel<float>::run(long lfnIdx, float* pfInput, long lCount, float** ppfOutput, long* plCount);
+
+
+template <class T>
+long Kernel<T>::runInstrumented(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* plCount)
+{
+	LONGLONG llStart = m_profiler.Now();
+	long lErr = run(lfnIdx, pfInput, lCount, ppfOutput, plCount);
+	LONGLONG llEnd = m_profiler.Now();
+	LONGLONG llBytes = 0;
+
+	switch (lfnIdx)
+	{
+		case CUDA_FN_GETMEM:
+			if (lErr == 0 && plCount != NULL)
+				llBytes = (LONGLONG)*plCount * sizeof(T);
+			break;
+
+		case CUDA_FN_SETMEM:
+		case CUDA_FN_SETMEMAT:
+			if (lCount > 1)
+				llBytes = (LONGLONG)pfInput[1] * sizeof(T);
+			break;
+
+		case CUDA_FN_COPY:
+			if (lCount > 0)
+				llBytes = (LONGLONG)pfInput[0] * sizeof(T);
+			break;
+	}
+
+	if (m_profiler.IsEnabled())
+		m_profiler.Record(lfnIdx, llStart, llEnd, llBytes, lErr);
+
+	// Both use the performance counter, so the call events line up with the
+	// transfer and sync events recorded inside of them.
+	if (m_bTraceCalls && g_tracer.IsEnabled())
+	{
+		long h1 = (lCount > 0 && pfInput != NULL) ? (long)pfInput[0] : 0;
+		g_tracer.Add(NULL, TRACE_CAT_CALL, lfnIdx, h1, 0, llBytes, llStart, llEnd);
+	}
+
+	return lErr;
+}
+
+template long Kernel<double>::runInstrumented(long lfnIdx, double* pfInput, long lCount, double** ppfOutput, long* plCount);
+template long Kernel<float>::runInstrumented(long lfnIdx, float* pfInput, long lCount, float** ppfOutput, long* plCount);
+
+
+template <class T>
+long Kernel<T>::enableProfiler(long lCount, T* pfInput)
+{
+	if (lCount < 1 || pfInput == NULL)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	m_profiler.Enable((pfInput[0] != 0) ? true : false);
+	m_bInstrumented = m_profiler.IsEnabled() || m_bTraceCalls;
+
+	return 0;
+}
+
+template long Kernel<double>::enableProfiler(long lCount, double* pfInput);
+template long Kernel<float>::enableProfiler(long lCount, float* pfInput);
+
+
+template <class T>
+long Kernel<T>::enableTracer(long lCount, T* pfInput)
+{
+	if (lCount < 1 || pfInput == NULL)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	bool bEnable = (pfInput[0] != 0) ? true : false;
+	int nCapacity = 0;
+
+	if (lCount > 1)
+	{
+		nCapacity = (int)pfInput[1];
+
+		if (nCapacity < 0)
+			return ERROR_PARAM_OUT_OF_RANGE;
+	}
+
+	// The tracer is shared by all kernels, the calls are only traced on
+	// the kernels that enabled it.
+	g_tracer.Enable(bEnable, nCapacity);
+	m_bTraceCalls = bEnable;
+	m_bInstrumented = m_profiler.IsEnabled() || m_bTraceCalls;
+
+	return 0;
+}
+
+template long Kernel<double>::enableTracer(long lCount, double* pfInput);
+template long Kernel<float>::enableTracer(long lCount, float* pfInput);
+
+
+template <class T>
+long Kernel<T>::getProfilerStats(LPTSTR* ppOutput)
+{
+	LONG lErr;
+	std::string str;
+
+	if (lErr = m_profiler.ToJson(str))
+		return lErr;
+
+	BSTR bstr = A2WBSTR(str.c_str());
+	if (bstr == NULL)
+		return ERROR_OUTOFMEMORY;
+
+	LPTSTR pDst = NULL;
+	lErr = m_device.AllocHost(&pDst, bstr);
+
+	if (!lErr)
+		*ppOutput = pDst;
+
+	::SysFreeString(bstr);
+
+	return lErr;
+}
+
+template long Kernel<double>::getProfilerStats(LPTSTR* ppOutput);
+template long Kernel<float>::getProfilerStats(LPTSTR* ppOutput);
+
+
+template <class T>
+long Kernel<T>::getTrace(LPTSTR* ppOutput)
+{
+	LONG lErr;
+	std::string str;
+
+	if (lErr = g_tracer.Flush(str))
+		return lErr;
+
+	BSTR bstr = A2WBSTR(str.c_str());
+	if (bstr == NULL)
+		return ERROR_OUTOFMEMORY;
+
+	LPTSTR pDst = NULL;
+	lErr = m_device.AllocHost(&pDst, bstr);
+
+	if (!lErr)
+		*ppOutput = pDst;
+
+	::SysFreeString(bstr);
+
+	return lErr;
+}
+
+template long Kernel<double>::getTrace(LPTSTR* ppOutput);
+template long Kernel<float>::getTrace(LPTSTR* ppOutput);
+
+
+//-----------------------------------------------------------------------------
+//	Runs the benchmark suites and returns the results in the Google Benchmark
+//	JSON format.  The inputs are [suites, min time ms, repetitions, max size]
+//	where a value of 0 (or a missing value) selects the default.
+//-----------------------------------------------------------------------------
+template <class T>
+long Kernel<T>::getBenchmarks(long lCount, LONG* pfInput, LPTSTR* ppOutput)
+{
+	LONG lErr = 0;
+	int rgParam[4] = { 0, 0, 0, 0 };
+
+	for (long i = 0; i < lCount && i < 4 && pfInput != NULL; i++)
+	{
+		rgParam[i] = (int)pfInput[i];
+	}
+
+	BenchmarkRunner runner(rgParam[0], rgParam[1], rgParam[2], rgParam[3]);
+	LPCSTR pszType = (sizeof(T) == sizeof(float)) ? "float" : "double";
+
+	// Measure the cost of the dispatch itself using the cheapest function,
+	// both directly and through the instrumented Run entry point.
+	if (runner.IsSelected(BENCH_SUITE_DISPATCH))
+	{
+		T rgOutput[1];
+		T* pOutput = rgOutput;
+		long lOutput = 1;
+
+		lErr = runner.Run("kernel_run_getdevice", pszType, 1, 1, [&](LONGLONG llIterations)
+		{
+			LONG lErr1;
+
+			for (LONGLONG i = 0; i < llIterations; i++)
+			{
+				if (lErr1 = run(CUDA_FN_GETDEVICE, NULL, 0, &pOutput, &lOutput))
+					return lErr1;
+			}
+
+			return 0;
+		});
+
+		if (!lErr)
+		{
+			lErr = runner.Run("kernel_Run_getdevice", pszType, 1, 1, [&](LONGLONG llIterations)
+			{
+				LONG lErr1;
+
+				for (LONGLONG i = 0; i < llIterations; i++)
+				{
+					if (lErr1 = Run(CUDA_FN_GETDEVICE, NULL, 0, &pOutput, &lOutput))
+						return lErr1;
+				}
+
+				return 0;
+			});
+		}
+	}
+
+	if (!lErr)
+		lErr = m_device.Benchmark(&runner);
+
+	if (lErr)
+		return lErr;
+
+	cudaDeviceProp prop;
+	std::string str;
+
+	if (lErr = cudaGetDeviceProperties(&prop, m_device.GetDevice()))
+		return lErr;
+
+	if (lErr = runner.ToJson(prop.name, str))
+		return lErr;
+
+	BSTR bstr = A2WBSTR(str.c_str());
+	if (bstr == NULL)
+		return ERROR_OUTOFMEMORY;
+
+	LPTSTR pDst = NULL;
+	lErr = m_device.AllocHost(&pDst, bstr);
+
+	if (!lErr)
+		*ppOutput = pDst;
+
+	::SysFreeString(bstr);
+
+	return lErr;
+}
+
+template long Kernel<double>::getBenchmarks(long lCount, LONG* pfInput, LPTSTR* ppOutput);
+template long Kernel<float>::getBenchmarks(long lCount, LONG* pfInput, LPTSTR* ppOutput);
+
+
+//-----------------------------------------------------------------------------
+//	Clears the convolution algorithm cache shared by all kernels, the input
+//	[delete file] also empties the persisted file when not 0.
+//-----------------------------------------------------------------------------
+template <class T>
+long Kernel<T>::clearConvAlgoCache(long lCount, T* pfInput)
+{
+	bool bDeleteFile = false;
+
+	if (lCount > 0 && pfInput != NULL)
+		bDeleteFile = (pfInput[0] != 0) ? true : false;
+
+	return g_convAlgoCache.Clear(bDeleteFile);
+}
+
+template long Kernel<double>::clearConvAlgoCache(long lCount, double* pfInput);
+template long Kernel<float>::clearConvAlgoCache(long lCount, float* pfInput);
+
+
+//-----------------------------------------------------------------------------
+//	Copies a file name passed as one character per input item.
+//-----------------------------------------------------------------------------
+template <class T>
+static void getFileName(long lCount, T* pfInput, char* szFile)
+{
+	int nLen = 0;
+
+	for (long i = 0; i < lCount && i < MAX_PATH; i++)
+	{
+		char ch = (char)(int)pfInput[i];
+
+		if (ch == 0)
+			break;
+
+		szFile[nLen] = ch;
+		nLen++;
+	}
+
+	szFile[nLen] = 0;
+}
+
+//-----------------------------------------------------------------------------
+//	Points the convolution algorithm cache at the file named by the input,
+//	one character per item, and loads its entries.  An empty name returns
+//	to the file named by the environment.
+//-----------------------------------------------------------------------------
+template <class T>
+long Kernel<T>::setConvAlgoCacheFile(long lCount, T* pfInput)
+{
+	char szFile[MAX_PATH + 1];
+
+	if (lCount > MAX_PATH)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	getFileName(lCount, pfInput, szFile);
+
+	return g_convAlgoCache.SetFile(szFile);
+}
+
+template long Kernel<double>::setConvAlgoCacheFile(long lCount, double* pfInput);
+template long Kernel<float>::setConvAlgoCacheFile(long lCount, float* pfInput);
+
+
+//-----------------------------------------------------------------------------
+//	Checks the convolution algorithm cache on a stub selector using the
+//	temporary file named by the input, and outputs the number of the first
+//	check that failed, or 0 when all pass.
+//-----------------------------------------------------------------------------
+template <class T>
+long Kernel<T>::checkConvAlgoCache(long lCount, T* pfInput, long* plCount, T** ppfOutput)
+{
+	LONG lErr;
+	char szFile[MAX_PATH + 1];
+	int nFailed = 0;
+
+	if (lCount < 1 || lCount > MAX_PATH || pfInput == NULL)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	getFileName(lCount, pfInput, szFile);
+
+	if (lErr = ConvAlgoCache::Check(szFile, &nFailed))
+		return lErr;
+
+	*plCount = 1;
+	(*ppfOutput)[0] = (T)nFailed;
+
+	return 0;
+}
+
+template long Kernel<double>::checkConvAlgoCache(long lCount, double* pfInput, long* plCount, double** ppfOutput);
+template long Kernel<float>::checkConvAlgoCache(long lCount, float* pfInput, long* plCount, float** ppfOutput);
+
+
+//-----------------------------------------------------------------------------
+//	Checks the hazard tracking and lane assignment of the stream pool on the
+//	host, and outputs the number of the first check that failed, or 0 when
+//	all pass.
+//-----------------------------------------------------------------------------
+template <class T>
+long Kernel<T>::checkStreamPool(long lCount, T* pfInput, long* plCount, T** ppfOutput)
+{
+	*plCount = 1;
+	(*ppfOutput)[0] = (T)StreamPool::Check();
+
+	return 0;
+}
+
+template long Kernel<double>::checkStreamPool(long lCount, double* pfInput, long* plCount, double** ppfOutput);
+template long Kernel<float>::checkStreamPool(long lCount, float* pfInput, long* plCount, float** ppfOutput);
+
+
+template <class T>
+long Kernel<T>::getConvAlgoCache(LPTSTR* ppOutput)
+{
+	LONG lErr;
+	std::string str;
+
+	if (lErr = g_convAlgoCache.ToJson(str))
+		return lErr;
+
+	BSTR bstr = A2WBSTR(str.c_str());
+	if (bstr == NULL)
+		return ERROR_OUTOFMEMORY;
+
+	LPTSTR pDst = NULL;
+	lErr = m_device.AllocHost(&pDst, bstr);
+
+	if (!lErr)
+		*ppOutput = pDst;
+
+	::SysFreeString(bstr);
+
+	return lErr;
+}
+
+template long Kernel<double>::getConvAlgoCache(LPTSTR* ppOutput);
+template long Kernel<float>::getConvAlgoCache(LPTSTR* ppOutput);
 
 
 template <class T>
@@ -712,6 +1202,21 @@ long Kernel<T>::Query(long lfnIdx, LONG* pfInput, long lCount, LPTSTR* ppOutput)
 		case CUDA_FN_GET_DEVICE_INFO:
 			return m_device.GetDeviceInfo(lCount, pfInput, ppOutput);
 
+		case CUDA_FN_GET_PROFILER_STATS:
+			return getProfilerStats(ppOutput);
+
+		case CUDA_FN_GET_TRACE:
+			return getTrace(ppOutput);
+
+		case CUDA_FN_GET_BENCHMARK:
+			return getBenchmarks(lCount, pfInput, ppOutput);
+
+		case CUDA_FN_GET_ALLOC_REPORT:
+			return m_device.GetAllocReport(lCount, pfInput, ppOutput);
+
+		case CUDA_FN_GET_CONV_ALGO_CACHE:
+			return getConvAlgoCache(ppOutput);
+
 		default:
 			return ERROR_PARAM_OUT_OF_RANGE;
 	}
@@ -11,6 +11,7 @@
 //=============================================================================
 #include "util.h"
 #include "device.h"
+#include "profiler.h"
 
 
 //=============================================================================
@@ -66,6 +67,9 @@ const int CUDA_FN_SYNCHRONIZE_THREAD = 33;
 const int CUDA_FN_CREATE_MEMTEST    = 34;
 const int CUDA_FN_FREE_MEMTEST      = 35;
 const int CUDA_FN_RUN_MEMTEST       = 36;
+const int CUDA_FN_START_MEMTEST_SCRUB = 37;
+const int CUDA_FN_STOP_MEMTEST_SCRUB = 38;
+const int CUDA_FN_GET_MEMTEST_SCRUB_STATUS = 39;
 
 const int CUDA_FN_CREATE_NCCL		= 40;
 const int CUDA_FN_FREE_NCCL			= 41;
@@ -73,6 +77,13 @@ const int CUDA_FN_NCCL_INIT_SINGLEPROCESS = 42;
 const int CUDA_FN_NCCL_INIT_MULTIPROCESS = 43;
 const int CUDA_FN_NCCL_BROADCAST	= 44;
 const int CUDA_FN_NCCL_ALLREDUCE	= 45;
+const int CUDA_FN_NCCL_SET_BUCKETS	= 130;
+const int CUDA_FN_NCCL_MARK_READY	= 131;
+const int CUDA_FN_NCCL_ALLREDUCE_BUCKETS = 132;
+const int CUDA_FN_NCCL_SET_COMPRESSION = 133;
+const int CUDA_FN_NCCL_GET_COMPRESSION_STATS = 134;
+const int CUDA_FN_NCCL_INIT_HIERARCHICAL = 135;
+const int CUDA_FN_NCCL_GET_HIERARCHY = 136;
 
 const int CUDNN_FN_CREATE_CUDNN		= 47;
 const int CUDNN_FN_FREE_CUDNN		= 48;
@@ -169,6 +180,8 @@ const int CUDA_FN_CONTAINS_POINT	= 251;
 const int CUDA_FN_DENAN				= 252;
 const int CUDA_FN_SUB_AND_DOT		= 253;
 const int CUDA_FN_MINMAXVAL			= 254;
+const int CUDA_FN_FUSED_EXPR		= 255;
+const int CUDA_FN_STATS				= 256;
 
 const int CUDA_FN_IM2COL			= 280;
 const int CUDA_FN_IM2COL_ND			= 281;
@@ -186,6 +199,7 @@ const int CUDA_RNG_SETSEED			= 349;
 const int CUDA_RNG_UNIFORM			= 350;
 const int CUDA_RNG_GAUSSIAN			= 351;
 const int CUDA_RNG_BERNOULLI		= 352;
+const int CUDA_RNG_PHILOX			= 353;
 
 const int CUDA_FN_BATCHREIDX_FWD	= 386;
 const int CUDA_FN_BATCHREIDX_BWD	= 387;
@@ -205,6 +219,9 @@ const int CUDA_FN_TANH_BWD			= 421;
 const int CUDA_FN_SIGMOID_FWD		= 424;
 const int CUDA_FN_SIGMOID_BWD		= 425;
 
+const int CUDA_FN_DROPOUT_FWD_BITS	= 426;
+const int CUDA_FN_DROPOUT_BWD_BITS	= 427;
+
 const int CUDA_FN_RELU_FWD			= 428;
 const int CUDA_FN_RELU_BWD			= 429;
 
@@ -223,6 +240,7 @@ const int CUDA_FN_PRELU_BWD_PARAM	= 440;
 
 const int CUDA_FN_SOFTMAXLOSS_FWD	= 444;
 const int CUDA_FN_SOFTMAXLOSS_BWD	= 445;
+const int CUDA_FN_SOFTMAXLOSS_FUSED	= 446;
 
 const int CUDA_FN_MAX_FWD			= 448;
 const int CUDA_FN_MAX_BWD			= 449;
@@ -255,6 +273,8 @@ const int CUDA_FN_LSTM_FWD			= 480;
 const int CUDA_FN_LSTM_BWD			= 481;
 const int CUDA_FN_LSTM_UNIT_FWD		= 482;
 const int CUDA_FN_LSTM_UNIT_BWD		= 483;
+const int CUDA_FN_LSTM_SEQ_FWD		= 484;
+const int CUDA_FN_LSTM_SEQ_BWD		= 485;
 
 const int CUDA_FN_COEFF_SUM_FWD		= 490;
 const int CUDA_FN_COEFF_SUM_BWD		= 491;
@@ -268,6 +288,7 @@ const int CUDA_FN_ADAGRAD_UPDATE	= 502;
 const int CUDA_FN_ADADELTA_UPDATE	= 503;
 const int CUDA_FN_ADAM_UPDATE		= 504;
 const int CUDA_FN_RMSPROP_UPDATE	= 505;
+const int CUDA_FN_UPDATE_FOREACH	= 506;
 
 const int CUDA_FN_COMBINE_DATA		= 550;
 
@@ -304,6 +325,27 @@ const int CUDA_FN_FREE_TSNE					= 876;
 const int CUDA_FN_TSNE_COMPUTE_GRADIENT1	= 877;
 const int CUDA_FN_TSNE_COMPUTE_ERROR1		= 878;
 
+const int CUDA_FN_CREATE_MODELAVG			= 880;
+const int CUDA_FN_FREE_MODELAVG				= 881;
+const int CUDA_FN_MODELAVG_PUSH				= 882;
+const int CUDA_FN_MODELAVG_PULL				= 883;
+const int CUDA_FN_MODELAVG_SET_WEIGHT		= 884;
+const int CUDA_FN_MODELAVG_GET_STATS		= 885;
+
+const int CUDA_FN_CONV_ALGO_CACHE_SET_FILE	= 888;
+const int CUDA_FN_CONV_ALGO_CACHE_CHECK		= 889;
+
+const int CUDA_FN_PROFILER_ENABLE			= 890;
+const int CUDA_FN_PROFILER_RESET			= 891;
+const int CUDA_FN_TRACE_ENABLE				= 892;
+const int CUDA_FN_ALLOC_TRACE_ENABLE		= 893;
+const int CUDA_FN_SET_ALLOC_TAG				= 894;
+const int CUDA_FN_CONV_ALGO_CACHE_CLEAR		= 895;
+const int CUDA_FN_HOST_MIRROR_ENABLE		= 896;
+const int CUDA_FN_GET_HOST_MIRROR_STATS		= 897;
+const int CUDA_FN_HOST_BLAS_CHECK			= 898;
+const int CUDA_FN_STREAM_POOL_CHECK			= 899;
+
 const int CUDA_FN_GUASSIAN_BLUR     = 900;
 const int CUDA_FN_HAMMING_DIFF      = 901;
 const int CUDA_FN_CALC_BATCH_DIST   = 902;
@@ -311,6 +353,11 @@ const int CUDA_FN_CALC_BATCH_DIST   = 902;
 const int CUDA_FN_GET_DEVICE_NAME	= 1000;
 const int CUDA_FN_GET_P2P_INFO		= 1001;
 const int CUDA_FN_GET_DEVICE_INFO   = 1002;
+const int CUDA_FN_GET_PROFILER_STATS = 1003;
+const int CUDA_FN_GET_TRACE			= 1004;
+const int CUDA_FN_GET_BENCHMARK		= 1005;
+const int CUDA_FN_GET_ALLOC_REPORT	= 1006;
+const int CUDA_FN_GET_CONV_ALGO_CACHE	= 1007;
 
 
 //=============================================================================
@@ -321,10 +368,28 @@ template <class T>
 class Kernel
 {
 	Device<T> m_device;
+	Profiler m_profiler;
+	bool m_bTraceCalls;
+	volatile bool m_bInstrumented;
+
+	long run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* plCount);
+	long runInstrumented(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* plCount);
+	long enableProfiler(long lCount, T* pfInput);
+	long enableTracer(long lCount, T* pfInput);
+	long getProfilerStats(LPTSTR* ppOutput);
+	long getTrace(LPTSTR* ppOutput);
+	long getBenchmarks(long lCount, LONG* pfInput, LPTSTR* ppOutput);
+	long clearConvAlgoCache(long lCount, T* pfInput);
+	long setConvAlgoCacheFile(long lCount, T* pfInput);
+	long checkConvAlgoCache(long lCount, T* pfInput, long* plCount, T** ppfOutput);
+	long checkStreamPool(long lCount, T* pfInput, long* plCount, T** ppfOutput);
+	long getConvAlgoCache(LPTSTR* ppOutput);
 
 public:
 	Kernel() : m_device()
 	{
+		m_bTraceCalls = false;
+		m_bInstrumented = false;
 	}
 
 	~Kernel()
@@ -339,6 +404,7 @@ public:
 
 	void CleanUp()
 	{
+		m_device.ReportAllocations();
 	}
 
 	int GetDevice()
@@ -386,7 +452,14 @@ public:
 		return m_device.SetNccl(pNccl, plCount, ppfOutput);
 	}
 
-	long Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* plCount);
+	long Run(long lfnIdx, T* pfInput, long lCount, T** ppfOutput, long* plCount)
+	{
+		// Keep the disabled cost to this one test, the profiled and traced path is out of line.
+		if (!m_bInstrumented)
+			return run(lfnIdx, pfInput, lCount, ppfOutput, plCount);
+
+		return runInstrumented(lfnIdx, pfInput, lCount, ppfOutput, plCount);
+	}
 
 	long Query(long lfnIdx, LONG* pfInput, long lCount, LPTSTR* ppfOutput);
 };
@@ -52,6 +52,7 @@
 #include "math.h"
 #include "memory.h"
 #include <cfloat>
+#include <math_constants.h>
 #include <thrust/device_vector.h>
 #include <thrust/extrema.h>
 #include "tsne_g.h"
@@ -905,6 +906,8 @@ long Math<double>::dot(int n, long hX, long hY, double* pOut, int nXOff, int nYO
 	if (nYOff > 0)
 		y += nYOff;
 
+	TraceScope trace("dot", TRACE_CAT_READBACK, hX, hY, (LONGLONG)n * sizeof(double));
+
 	return cublasDdot(m_cublas, n, x, 1, y, 1, (double*)pOut);
 }
 
@@ -936,6 +939,8 @@ long Math<float>::dot(int n, long hX, long hY, float* pOut, int nXOff, int nYOff
 	if (nYOff > 0)
 		y += nYOff;
 
+	TraceScope trace("dot", TRACE_CAT_READBACK, hX, hY, (LONGLONG)n * sizeof(float));
+
 	return cublasSdot(m_cublas, n, x, 1, y, 1, (float*)pOut);
 }
 
@@ -959,6 +964,8 @@ long Math<double>::asum(int n, long hX, double* pOut, int nXOff)
 	if (nXOff > 0)
 		x += nXOff;
 
+	TraceScope trace("asum", TRACE_CAT_READBACK, hX, 0, (LONGLONG)n * sizeof(double));
+
 	return cublasDasum(m_cublas, n, x, 1, (double*)pOut);
 }
 
@@ -982,6 +989,8 @@ long Math<float>::asum(int n, long hX, float* pOut, int nXOff)
 	if (nXOff > 0)
 		x += nXOff;
 
+	TraceScope trace("asum", TRACE_CAT_READBACK, hX, 0, (LONGLONG)n * sizeof(float));
+
 	return cublasSasum(m_cublas, n, x, 1, (float*)pOut);
 }
 
@@ -1314,6 +1323,8 @@ long Math<T>::maxval(int n, long hA, T* pOut, int nAOff)
 	if (nAOff > 0)
 		a += nAOff;
 
+	TraceScope trace("maxval", TRACE_CAT_READBACK, hA, 0, (LONGLONG)n * sizeof(T));
+
 	thrust::device_ptr<T> d_ptr = thrust::device_pointer_cast(a);
 	*pOut = *(thrust::max_element(d_ptr, d_ptr + n));
 
@@ -1629,6 +1640,164 @@ template long Math<double>::naninfval(int n, long hA, long hWork1, long hWork2,
 template long Math<float>::naninfval(int n, long hA, long hWork1, long hWork2, float* pNan, float* pInf, int nAOff);
 
 
+template <class T>
+__global__ void stats_kernel(const int n, const T* x, T* partials)
+{
+	__shared__ T rgMin[CAFFE_CUDA_NUM_THREADS];
+	__shared__ T rgMax[CAFFE_CUDA_NUM_THREADS];
+	__shared__ T rgSum[CAFFE_CUDA_NUM_THREADS];
+	__shared__ T rgSumSq[CAFFE_CUDA_NUM_THREADS];
+	__shared__ int rgNan[CAFFE_CUDA_NUM_THREADS];
+	__shared__ int rgInf[CAFFE_CUDA_NUM_THREADS];
+	T fMin = (T)CUDART_INF;
+	T fMax = (T)-CUDART_INF;
+	T fSum = 0;
+	T fSumSq = 0;
+	int nNan = 0;
+	int nInf = 0;
+	int tid = threadIdx.x;
+
+	for (int i=blockIdx.x * blockDim.x + tid; i<n; i += blockDim.x * gridDim.x)
+	{
+		T fVal = x[i];
+
+		if (isnan(fVal))
+		{
+			nNan++;
+		}
+		else
+		{
+			fMin = min(fMin, fVal);
+			fMax = max(fMax, fVal);
+
+			if (isinf(fVal))
+			{
+				nInf++;
+			}
+			else
+			{
+				fSum += fVal;
+				fSumSq += fVal * fVal;
+			}
+		}
+	}
+
+	rgMin[tid] = fMin;
+	rgMax[tid] = fMax;
+	rgSum[tid] = fSum;
+	rgSumSq[tid] = fSumSq;
+	rgNan[tid] = nNan;
+	rgInf[tid] = nInf;
+	__syncthreads();
+
+	for (int nStride = blockDim.x / 2; nStride > 0; nStride /= 2)
+	{
+		if (tid < nStride)
+		{
+			rgMin[tid] = min(rgMin[tid], rgMin[tid + nStride]);
+			rgMax[tid] = max(rgMax[tid], rgMax[tid + nStride]);
+			rgSum[tid] += rgSum[tid + nStride];
+			rgSumSq[tid] += rgSumSq[tid + nStride];
+			rgNan[tid] += rgNan[tid + nStride];
+			rgInf[tid] += rgInf[tid + nStride];
+		}
+
+		__syncthreads();
+	}
+
+	if (tid == 0)
+	{
+		T* pOut = partials + blockIdx.x * STATS_COUNT;
+		pOut[STATS_MIN] = rgMin[0];
+		pOut[STATS_MAX] = rgMax[0];
+		pOut[STATS_SUM] = rgSum[0];
+		pOut[STATS_SUMSQ] = rgSumSq[0];
+		pOut[STATS_NAN] = (T)rgNan[0];
+		pOut[STATS_INF] = (T)rgInf[0];
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Calculates the min, max, sum, sum of squares, NaN count and Inf count of
+//	A in a single pass and a single readback.  The min and max include the
+//	Inf values, as minmaxval did, and are 0 when all values are NaN.  The
+//	sums only include the finite values.
+//-----------------------------------------------------------------------------
+template <class T>
+long Math<T>::stats(int n, long hA, T* rgStats, int nAOff)
+{
+	LONG lErr;
+	MemoryItem* pA;
+	T* pWork;
+
+	memset(rgStats, 0, sizeof(T) * STATS_COUNT);
+
+	if (n <= 0)
+		return 0;
+
+	if (lErr = m_pMemCol->GetData(hA, &pA))
+		return lErr;
+
+	if (lErr = getReduceWork(&pWork))
+		return lErr;
+
+	T* a = (T*)pA->Data();
+	if (nAOff > 0)
+		a += nAOff;
+
+	int nBlocks = CAFFE_GET_BLOCKS(n);
+	if (nBlocks > REDUCE_MAX_BLOCKS)
+		nBlocks = REDUCE_MAX_BLOCKS;
+
+	stats_kernel<T><<<nBlocks, CAFFE_CUDA_NUM_THREADS>>>(n, a, pWork);
+
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	T rgPartials[REDUCE_MAX_BLOCKS * STATS_COUNT];
+
+	if (lErr = cudaMemcpy(rgPartials, pWork, sizeof(T) * nBlocks * STATS_COUNT, cudaMemcpyDeviceToHost))
+		return lErr;
+
+	T fMin = rgPartials[STATS_MIN];
+	T fMax = rgPartials[STATS_MAX];
+	double dfSum = 0;
+	double dfSumSq = 0;
+	double dfNan = 0;
+	double dfInf = 0;
+
+	for (int i = 0; i < nBlocks; i++)
+	{
+		T* pPartial = rgPartials + i * STATS_COUNT;
+
+		fMin = min(fMin, pPartial[STATS_MIN]);
+		fMax = max(fMax, pPartial[STATS_MAX]);
+		dfSum += pPartial[STATS_SUM];
+		dfSumSq += pPartial[STATS_SUMSQ];
+		dfNan += pPartial[STATS_NAN];
+		dfInf += pPartial[STATS_INF];
+	}
+
+	if (fMin > fMax)
+	{
+		fMin = 0;
+		fMax = 0;
+	}
+
+	rgStats[STATS_MIN] = fMin;
+	rgStats[STATS_MAX] = fMax;
+	rgStats[STATS_SUM] = (T)dfSum;
+	rgStats[STATS_SUMSQ] = (T)dfSumSq;
+	rgStats[STATS_NAN] = (T)dfNan;
+	rgStats[STATS_INF] = (T)dfInf;
+
+	return 0;
+}
+
+template long Math<double>::stats(int n, long hA, double* rgStats, int nAOff);
+template long Math<float>::stats(int n, long hA, float* rgStats, int nAOff);
+
+
 
 template <typename T>
 __global__ void width_kernel(const int n, const T* mean, const T* minv, const T* maxv, T fAlpha, T* width)
@@ -2325,12 +2494,10 @@ template long Math<float>::sqrt(int n, long hA, long hY);
 template <class T>
 long Math<T>::sumsq(int n, long hW, long hA, int nAOff, T* pOut)
 {
-	LONG lErr;
-
-	if (lErr = mul(n, hA, hA, hW, nAOff, nAOff))
-		return lErr;
+	int rgOp[2] = { FUSEDEXPR_OP_LOAD, FUSEDEXPR_OP_SQUARE };
+	T rgArg[2] = { 0, 0 };
 
-	return asum(n, hW, pOut);
+	return fused_expr(n, 1, &hA, &nAOff, 2, rgOp, rgArg, hW, 0, FUSEDEXPR_REDUCE_SUM, pOut);
 }
 
 template long Math<double>::sumsq(int n, long hW, long hA, int nAOff, double* pOut);
@@ -2340,15 +2507,12 @@ template long Math<float>::sumsq(int n, long hW, long hA, int nAOff, float* pOut
 template <class T>
 long Math<T>::sumsqdiff(int n, long hW, long hA, long hB, int nAOff, int nBOff, T* pOut)
 {
-	LONG lErr;
-
-	if (lErr = sub(n, hA, hB, hW, nAOff, nBOff))
-		return lErr;
-
-	if (lErr = mul(n, hW, hW, hW))
-		return lErr;
+	long rghIn[2] = { hA, hB };
+	int rgnInOff[2] = { nAOff, nBOff };
+	int rgOp[4] = { FUSEDEXPR_OP_LOAD, FUSEDEXPR_OP_LOAD, FUSEDEXPR_OP_SUB, FUSEDEXPR_OP_SQUARE };
+	T rgArg[4] = { 0, 1, 0, 0 };
 
-	return asum(n, hW, pOut);
+	return fused_expr(n, 2, rghIn, rgnInOff, 4, rgOp, rgArg, hW, 0, FUSEDEXPR_REDUCE_SUM, pOut);
 }
 
 template long Math<double>::sumsqdiff(int n, long hW, long hA, long hB, int nAOff, int nBOff, double* pOut);
@@ -2383,177 +2547,616 @@ template long Math<double>::sumsqdiff(int n, double* w, double* x, double* y, do
 template long Math<float>::sumsqdiff(int n, float* w, float* x, float* y, float* pOut, cudaStream_t stream);
 
 
-template <typename T>
-__global__ void reciprocol_kernel(const int n, T* x, T* y)
+//-----------------------------------------------------------------------------
+//	Returns the device buffer that holds the partial results of each block
+//	for the single pass reductions, allocated on first use.
+//-----------------------------------------------------------------------------
+template <class T>
+long Math<T>::getReduceWork(T** ppWork)
 {
-	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	LONG lErr;
+
+	if (m_pReduceWork != NULL && m_nReduceWorkDevice != m_nDeviceID)
 	{
-		y[i] = (x[i] == 0) ? 0 : (1.0 / x[i]);
+		cudaFree(m_pReduceWork);
+		m_pReduceWork = NULL;
 	}
-}
-
-template <typename T>
-long Math<T>::reciprocol(int n, long hX, long hY)
-{
-	LONG lErr;
-	MemoryItem* pX;
-	MemoryItem* pY;
 
-	if (lErr = m_pMemCol->GetData(hX, &pX))
-		return lErr;
+	if (m_pReduceWork == NULL)
+	{
+		if (lErr = cudaMalloc(&m_pReduceWork, sizeof(T) * REDUCE_MAX_BLOCKS * STATS_COUNT))
+			return lErr;
 
-	if (lErr = m_pMemCol->GetData(hY, &pY))
-		return lErr;
+		m_nReduceWorkDevice = m_nDeviceID;
+	}
 
-	reciprocol_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, (T*)pX->Data(), (T*)pY->Data());
+	*ppWork = m_pReduceWork;
 
-	return cudaGetLastError();
+	return 0;
 }
 
-template long Math<double>::reciprocol(int n, long hA, long hY);
-template long Math<float>::reciprocol(int n, long hA, long hY);
-
+template long Math<double>::getReduceWork(double** ppWork);
+template long Math<float>::getReduceWork(float** ppWork);
 
 
-template <typename T>
-__global__ void student_kernel(const int n, T* x, T* y)
+//-----------------------------------------------------------------------------
+//	Returns the device buffer that holds the tensor and chunk tables of the
+//	foreach update, grown as needed.
+//-----------------------------------------------------------------------------
+template <class T>
+long Math<T>::getUpdateTable(size_t lSize, void** ppTable)
 {
-	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	LONG lErr;
+
+	if (m_pUpdateTable != NULL && (m_nUpdateTableDevice != m_nDeviceID || m_lUpdateTableSize < lSize))
 	{
-		T fVal = 1.0 + x[i];
-		y[i] = (fVal == 0) ? 0 : 1.0 / fVal;
+		cudaFree(m_pUpdateTable);
+		m_pUpdateTable = NULL;
+		m_lUpdateTableSize = 0;
 	}
-}
-
-template <typename T>
-long Math<T>::student(int n, long hX, long hY)
-{
-	LONG lErr;
-	MemoryItem* pX;
-	MemoryItem* pY;
 
-	if (lErr = m_pMemCol->GetData(hX, &pX))
-		return lErr;
+	if (m_pUpdateTable == NULL)
+	{
+		if (lErr = cudaMalloc(&m_pUpdateTable, lSize))
+			return lErr;
 
-	if (lErr = m_pMemCol->GetData(hY, &pY))
-		return lErr;
+		m_lUpdateTableSize = lSize;
+		m_nUpdateTableDevice = m_nDeviceID;
+	}
 
-	student_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, (T*)pX->Data(), (T*)pY->Data());
+	*ppTable = m_pUpdateTable;
 
-	return cudaGetLastError();
+	return 0;
 }
 
-template long Math<double>::student(int n, long hA, long hY);
-template long Math<float>::student(int n, long hA, long hY);
-
+template long Math<double>::getUpdateTable(size_t lSize, void** ppTable);
+template long Math<float>::getUpdateTable(size_t lSize, void** ppTable);
 
 
+//-----------------------------------------------------------------------------
+//	Checks the postfix program, fills in the kernel program and finds the
+//	common shapes that have their own kernels.
+//-----------------------------------------------------------------------------
 template <typename T>
-__global__ void logistic1_kernel(const int n, T* x, T* y)
+long fusedexpr_compile(int nInputs, int nOps, int* rgOp, T* rgArg, FUSEDEXPR_PROGRAM<T>* pProg)
 {
-	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	int nDepth = 0;
+
+	if (nOps < 1 || nOps > FUSEDEXPR_MAX_OPS)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	memset(pProg, 0, sizeof(FUSEDEXPR_PROGRAM<T>));
+	pProg->nOps = nOps;
+
+	for (int i = 0; i < nOps; i++)
 	{
-		y[i] = (1 + tanh(x[i] / 2)) / 2;
-	}
-}
+		int nOp = rgOp[i];
 
-template <typename T>
-long Math<T>::logistic1(int n, long hX, long hY)
-{
-	LONG lErr;
-	MemoryItem* pX;
-	MemoryItem* pY;
+		switch (nOp)
+		{
+			case FUSEDEXPR_OP_LOAD:
+				if ((int)rgArg[i] < 0 || (int)rgArg[i] >= nInputs)
+					return ERROR_PARAM_OUT_OF_RANGE;
+				nDepth++;
+				break;
 
-	if (lErr = m_pMemCol->GetData(hX, &pX))
-		return lErr;
+			case FUSEDEXPR_OP_CONST:
+				nDepth++;
+				break;
 
-	if (lErr = m_pMemCol->GetData(hY, &pY))
-		return lErr;
+			case FUSEDEXPR_OP_ADD:
+			case FUSEDEXPR_OP_SUB:
+			case FUSEDEXPR_OP_MUL:
+			case FUSEDEXPR_OP_DIV:
+				if (nDepth < 2)
+					return ERROR_PARAM_OUT_OF_RANGE;
+				nDepth--;
+				break;
 
-	logistic1_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, (T*)pX->Data(), (T*)pY->Data());
+			case FUSEDEXPR_OP_ADD_SCALAR:
+			case FUSEDEXPR_OP_MUL_SCALAR:
+			case FUSEDEXPR_OP_EXP:
+			case FUSEDEXPR_OP_LOG:
+			case FUSEDEXPR_OP_POWX:
+			case FUSEDEXPR_OP_SQRT:
+			case FUSEDEXPR_OP_RECIPROCOL:
+			case FUSEDEXPR_OP_ABS:
+			case FUSEDEXPR_OP_SQUARE:
+			case FUSEDEXPR_OP_NEG:
+				if (nDepth < 1)
+					return ERROR_PARAM_OUT_OF_RANGE;
+				break;
 
-	return cudaGetLastError();
-}
+			default:
+				return ERROR_PARAM_OUT_OF_RANGE;
+		}
 
-template long Math<double>::logistic1(int n, long hA, long hY);
-template long Math<float>::logistic1(int n, long hA, long hY);
+		if (nDepth > FUSEDEXPR_MAX_STACK)
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		pProg->rgOp[i] = nOp;
+		pProg->rgArg[i] = rgArg[i];
+	}
 
+	if (nDepth != 1)
+		return ERROR_PARAM_OUT_OF_RANGE;
 
+	int nLoad = 0;
+	char szShape[FUSEDEXPR_MAX_OPS + 1];
 
-template <typename T>
-__global__ void logistic2_kernel(const int n, T* x, T* y)
-{
-	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	// The loads must be in input order for the shapes to match.
+	for (int i = 0; i < nOps; i++)
 	{
-		y[i] = 1 / (1 + exp(-x[i]));
+		if (rgOp[i] == FUSEDEXPR_OP_LOAD && (int)rgArg[i] != nLoad++)
+			return 0;
+
+		szShape[i] = (char)('a' + rgOp[i]);
 	}
-}
 
-template <typename T>
-long Math<T>::logistic2(int n, long hX, long hY)
-{
-	LONG lErr;
-	MemoryItem* pX;
-	MemoryItem* pY;
+	szShape[nOps] = 0;
 
-	if (lErr = m_pMemCol->GetData(hX, &pX))
-		return lErr;
+	if (strcmp(szShape, "ao") == 0)
+		pProg->nShape = FUSEDEXPR_SHAPE_SQUARE;
+	else if (strcmp(szShape, "aado") == 0)
+		pProg->nShape = FUSEDEXPR_SHAPE_SUBSQ;
+	else if (strcmp(szShape, "ahahc") == 0)
+		pProg->nShape = FUSEDEXPR_SHAPE_AXPBY;
+	else if (strcmp(szShape, "aaeac") == 0)
+		pProg->nShape = FUSEDEXPR_SHAPE_MULADD;
 
-	if (lErr = m_pMemCol->GetData(hY, &pY))
-		return lErr;
+	return 0;
+}
 
-	logistic2_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, (T*)pX->Data(), (T*)pY->Data());
+template <typename T, int SHAPE>
+__device__ inline T fusedexpr_eval(const FUSEDEXPR_PROGRAM<T>& prog, const int i)
+{
+	if (SHAPE == FUSEDEXPR_SHAPE_SQUARE)
+	{
+		T fX = prog.rgIn[0][i];
+		return fX * fX;
+	}
 
-	return cudaGetLastError();
-}
+	if (SHAPE == FUSEDEXPR_SHAPE_SUBSQ)
+	{
+		T fDiff = prog.rgIn[0][i] - prog.rgIn[1][i];
+		return fDiff * fDiff;
+	}
 
-template long Math<double>::logistic2(int n, long hA, long hY);
-template long Math<float>::logistic2(int n, long hA, long hY);
+	if (SHAPE == FUSEDEXPR_SHAPE_AXPBY)
+		return prog.rgArg[1] * prog.rgIn[0][i] + prog.rgArg[3] * prog.rgIn[1][i];
 
+	if (SHAPE == FUSEDEXPR_SHAPE_MULADD)
+		return prog.rgIn[0][i] * prog.rgIn[1][i] + prog.rgIn[2][i];
 
-template <typename T>
-__global__ void channel_max_kernel(const int num, const int channels, const int spatial_dim, const T* x, T* y)
-{
-	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<num * spatial_dim; i += blockDim.x * gridDim.x)
+	T rgStack[FUSEDEXPR_MAX_STACK];
+	int nTop = -1;
+
+	for (int j = 0; j < prog.nOps; j++)
 	{
-		int n = i / spatial_dim;
-		int s = i % spatial_dim;
-		T val = -FLT_MAX;
+		T fArg = prog.rgArg[j];
 
-		for (int c=0; c<channels; c++)
+		switch (prog.rgOp[j])
 		{
-			val = max(x[(n * channels + c) * spatial_dim + s], val);
-		}
+			case FUSEDEXPR_OP_LOAD:
+				rgStack[++nTop] = prog.rgIn[(int)fArg][i];
+				break;
 
-		y[i] = val;
-	}
-}
+			case FUSEDEXPR_OP_CONST:
+				rgStack[++nTop] = fArg;
+				break;
 
-template <typename T> 
-long Math<T>::channel_max(int n, int nOutNum, int nChannels, int nInNum, long hX, long hY)
-{
-	LONG lErr;
-	MemoryItem* pX;
-	MemoryItem* pY;
+			case FUSEDEXPR_OP_ADD:
+				nTop--;
+				rgStack[nTop] = rgStack[nTop] + rgStack[nTop + 1];
+				break;
 
-	if (lErr = m_pMemCol->GetData(hX, &pX))
-		return lErr;
+			case FUSEDEXPR_OP_SUB:
+				nTop--;
+				rgStack[nTop] = rgStack[nTop] - rgStack[nTop + 1];
+				break;
 
-	if (lErr = m_pMemCol->GetData(hY, &pY))
-		return lErr;
+			case FUSEDEXPR_OP_MUL:
+				nTop--;
+				rgStack[nTop] = rgStack[nTop] * rgStack[nTop + 1];
+				break;
 
-	channel_max_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(nOutNum, nChannels, nInNum, (T*)pX->Data(), (T*)pY->Data());
+			case FUSEDEXPR_OP_DIV:
+				nTop--;
+				rgStack[nTop] = rgStack[nTop] / rgStack[nTop + 1];
+				break;
 
-	return cudaGetLastError();
-}
+			case FUSEDEXPR_OP_ADD_SCALAR:
+				rgStack[nTop] += fArg;
+				break;
 
-template long Math<double>::channel_max(int n, int nOutNum, int nChannels, int nInNum, long hX, long hY);
-template long Math<float>::channel_max(int n, int nOutNum, int nChannels, int nInNum, long hX, long hY);
+			case FUSEDEXPR_OP_MUL_SCALAR:
+				rgStack[nTop] *= fArg;
+				break;
 
+			case FUSEDEXPR_OP_EXP:
+				rgStack[nTop] = exp(rgStack[nTop]);
+				break;
 
+			case FUSEDEXPR_OP_LOG:
+				rgStack[nTop] = log(rgStack[nTop]);
+				break;
 
-template <typename T>
-__global__ void channel_sub_kernel(const int count, const int num, const int channels, const int spatial_dim, const T* x, T* y)
+			case FUSEDEXPR_OP_POWX:
+				rgStack[nTop] = pow(rgStack[nTop], fArg);
+				break;
+
+			case FUSEDEXPR_OP_SQRT:
+				rgStack[nTop] = sqrt(rgStack[nTop]);
+				break;
+
+			case FUSEDEXPR_OP_RECIPROCOL:
+				rgStack[nTop] = (rgStack[nTop] == 0) ? 0 : (1.0 / rgStack[nTop]);
+				break;
+
+			case FUSEDEXPR_OP_ABS:
+				rgStack[nTop] = fabs(rgStack[nTop]);
+				break;
+
+			case FUSEDEXPR_OP_SQUARE:
+				rgStack[nTop] = rgStack[nTop] * rgStack[nTop];
+				break;
+
+			case FUSEDEXPR_OP_NEG:
+				rgStack[nTop] = -rgStack[nTop];
+				break;
+		}
+	}
+
+	return rgStack[0];
+}
+
+template <typename T, int SHAPE, bool bWrite, int REDUCE>
+__global__ void fusedexpr_kernel(const int n, const FUSEDEXPR_PROGRAM<T> prog, T* y, T* partials)
+{
+	__shared__ T rgSum[CAFFE_CUDA_NUM_THREADS];
+	T fSum = 0;
+
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		T fVal = fusedexpr_eval<T, SHAPE>(prog, i);
+
+		if (bWrite)
+			y[i] = fVal;
+
+		if (REDUCE == FUSEDEXPR_REDUCE_SUM)
+			fSum += fVal;
+		else if (REDUCE == FUSEDEXPR_REDUCE_ASUM)
+			fSum += fabs(fVal);
+	}
+
+	if (REDUCE == FUSEDEXPR_REDUCE_NONE)
+		return;
+
+	rgSum[threadIdx.x] = fSum;
+	__syncthreads();
+
+	for (int nStride = blockDim.x / 2; nStride > 0; nStride /= 2)
+	{
+		if (threadIdx.x < nStride)
+			rgSum[threadIdx.x] += rgSum[threadIdx.x + nStride];
+
+		__syncthreads();
+	}
+
+	if (threadIdx.x == 0)
+		partials[blockIdx.x] = rgSum[0];
+}
+
+template <typename T, int SHAPE>
+void fusedexpr_launch(int n, int nBlocks, const FUSEDEXPR_PROGRAM<T>& prog, T* y, int nReduce, T* partials)
+{
+	if (nReduce == FUSEDEXPR_REDUCE_SUM)
+	{
+		if (y != NULL)
+			fusedexpr_kernel<T, SHAPE, true, FUSEDEXPR_REDUCE_SUM><<<nBlocks, CAFFE_CUDA_NUM_THREADS>>>(n, prog, y, partials);
+		else
+			fusedexpr_kernel<T, SHAPE, false, FUSEDEXPR_REDUCE_SUM><<<nBlocks, CAFFE_CUDA_NUM_THREADS>>>(n, prog, y, partials);
+	}
+	else if (nReduce == FUSEDEXPR_REDUCE_ASUM)
+	{
+		if (y != NULL)
+			fusedexpr_kernel<T, SHAPE, true, FUSEDEXPR_REDUCE_ASUM><<<nBlocks, CAFFE_CUDA_NUM_THREADS>>>(n, prog, y, partials);
+		else
+			fusedexpr_kernel<T, SHAPE, false, FUSEDEXPR_REDUCE_ASUM><<<nBlocks, CAFFE_CUDA_NUM_THREADS>>>(n, prog, y, partials);
+	}
+	else
+	{
+		fusedexpr_kernel<T, SHAPE, true, FUSEDEXPR_REDUCE_NONE><<<nBlocks, CAFFE_CUDA_NUM_THREADS>>>(n, prog, y, partials);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Evaluates the postfix expression over the inputs in a single pass, writing
+//	the result to Y (when hY is not 0) and optionally reducing it, so that a
+//	chain of element-wise operations reads each input and writes Y just once.
+//-----------------------------------------------------------------------------
+template <class T>
+long Math<T>::fused_expr(int n, int nInputs, long* rghIn, int* rgnInOff, int nOps, int* rgOp, T* rgArg, long hY, int nYOff, int nReduce, T* pOut)
+{
+	LONG lErr;
+	FUSEDEXPR_PROGRAM<T> prog;
+	MemoryItem* pItem;
+	T* y = NULL;
+
+	if (n < 0 || nInputs < 0 || nInputs > FUSEDEXPR_MAX_INPUTS)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (nReduce < FUSEDEXPR_REDUCE_NONE || nReduce > FUSEDEXPR_REDUCE_ASUM)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (hY == 0 && nReduce == FUSEDEXPR_REDUCE_NONE)
+		return ERROR_PARAM_NULL;
+
+	if (lErr = fusedexpr_compile(nInputs, nOps, rgOp, rgArg, &prog))
+		return lErr;
+
+	for (int i = 0; i < nInputs; i++)
+	{
+		if (lErr = m_pMemCol->GetData(rghIn[i], &pItem))
+			return lErr;
+
+		prog.rgIn[i] = (T*)pItem->Data();
+		if (rgnInOff[i] > 0)
+			prog.rgIn[i] += rgnInOff[i];
+	}
+
+	if (hY != 0)
+	{
+		if (lErr = m_pMemCol->GetData(hY, &pItem))
+			return lErr;
+
+		y = (T*)pItem->Data();
+		if (nYOff > 0)
+			y += nYOff;
+	}
+
+	if (pOut != NULL)
+		*pOut = 0;
+
+	if (n == 0)
+		return 0;
+
+	int nBlocks = CAFFE_GET_BLOCKS(n);
+	T* pWork = NULL;
+
+	if (nReduce != FUSEDEXPR_REDUCE_NONE)
+	{
+		if (nBlocks > REDUCE_MAX_BLOCKS)
+			nBlocks = REDUCE_MAX_BLOCKS;
+
+		if (lErr = getReduceWork(&pWork))
+			return lErr;
+	}
+
+	switch (prog.nShape)
+	{
+		case FUSEDEXPR_SHAPE_SQUARE:
+			fusedexpr_launch<T, FUSEDEXPR_SHAPE_SQUARE>(n, nBlocks, prog, y, nReduce, pWork);
+			break;
+
+		case FUSEDEXPR_SHAPE_SUBSQ:
+			fusedexpr_launch<T, FUSEDEXPR_SHAPE_SUBSQ>(n, nBlocks, prog, y, nReduce, pWork);
+			break;
+
+		case FUSEDEXPR_SHAPE_AXPBY:
+			fusedexpr_launch<T, FUSEDEXPR_SHAPE_AXPBY>(n, nBlocks, prog, y, nReduce, pWork);
+			break;
+
+		case FUSEDEXPR_SHAPE_MULADD:
+			fusedexpr_launch<T, FUSEDEXPR_SHAPE_MULADD>(n, nBlocks, prog, y, nReduce, pWork);
+			break;
+
+		default:
+			fusedexpr_launch<T, FUSEDEXPR_SHAPE_GENERIC>(n, nBlocks, prog, y, nReduce, pWork);
+			break;
+	}
+
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	if (nReduce == FUSEDEXPR_REDUCE_NONE)
+		return 0;
+
+	// The partial sums are added in order on the host so that the
+	// result does not depend on the scheduling of the blocks.
+	T rgPartials[REDUCE_MAX_BLOCKS];
+
+	if (lErr = cudaMemcpy(rgPartials, pWork, sizeof(T) * nBlocks, cudaMemcpyDeviceToHost))
+		return lErr;
+
+	double dfSum = 0;
+
+	for (int i = 0; i < nBlocks; i++)
+	{
+		dfSum += rgPartials[i];
+	}
+
+	if (pOut != NULL)
+		*pOut = (T)dfSum;
+
+	return 0;
+}
+
+template long Math<double>::fused_expr(int n, int nInputs, long* rghIn, int* rgnInOff, int nOps, int* rgOp, double* rgArg, long hY, int nYOff, int nReduce, double* pOut);
+template long Math<float>::fused_expr(int n, int nInputs, long* rghIn, int* rgnInOff, int nOps, int* rgOp, float* rgArg, long hY, int nYOff, int nReduce, float* pOut);
+
+
+template <typename T>
+__global__ void reciprocol_kernel(const int n, T* x, T* y)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		y[i] = (x[i] == 0) ? 0 : (1.0 / x[i]);
+	}
+}
+
+template <typename T>
+long Math<T>::reciprocol(int n, long hX, long hY)
+{
+	LONG lErr;
+	MemoryItem* pX;
+	MemoryItem* pY;
+
+	if (lErr = m_pMemCol->GetData(hX, &pX))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hY, &pY))
+		return lErr;
+
+	reciprocol_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, (T*)pX->Data(), (T*)pY->Data());
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::reciprocol(int n, long hA, long hY);
+template long Math<float>::reciprocol(int n, long hA, long hY);
+
+
+
+template <typename T>
+__global__ void student_kernel(const int n, T* x, T* y)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		T fVal = 1.0 + x[i];
+		y[i] = (fVal == 0) ? 0 : 1.0 / fVal;
+	}
+}
+
+template <typename T>
+long Math<T>::student(int n, long hX, long hY)
+{
+	LONG lErr;
+	MemoryItem* pX;
+	MemoryItem* pY;
+
+	if (lErr = m_pMemCol->GetData(hX, &pX))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hY, &pY))
+		return lErr;
+
+	student_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, (T*)pX->Data(), (T*)pY->Data());
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::student(int n, long hA, long hY);
+template long Math<float>::student(int n, long hA, long hY);
+
+
+
+template <typename T>
+__global__ void logistic1_kernel(const int n, T* x, T* y)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		y[i] = (1 + tanh(x[i] / 2)) / 2;
+	}
+}
+
+template <typename T>
+long Math<T>::logistic1(int n, long hX, long hY)
+{
+	LONG lErr;
+	MemoryItem* pX;
+	MemoryItem* pY;
+
+	if (lErr = m_pMemCol->GetData(hX, &pX))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hY, &pY))
+		return lErr;
+
+	logistic1_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, (T*)pX->Data(), (T*)pY->Data());
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::logistic1(int n, long hA, long hY);
+template long Math<float>::logistic1(int n, long hA, long hY);
+
+
+
+template <typename T>
+__global__ void logistic2_kernel(const int n, T* x, T* y)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		y[i] = 1 / (1 + exp(-x[i]));
+	}
+}
+
+template <typename T>
+long Math<T>::logistic2(int n, long hX, long hY)
+{
+	LONG lErr;
+	MemoryItem* pX;
+	MemoryItem* pY;
+
+	if (lErr = m_pMemCol->GetData(hX, &pX))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hY, &pY))
+		return lErr;
+
+	logistic2_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, (T*)pX->Data(), (T*)pY->Data());
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::logistic2(int n, long hA, long hY);
+template long Math<float>::logistic2(int n, long hA, long hY);
+
+
+template <typename T>
+__global__ void channel_max_kernel(const int num, const int channels, const int spatial_dim, const T* x, T* y)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<num * spatial_dim; i += blockDim.x * gridDim.x)
+	{
+		int n = i / spatial_dim;
+		int s = i % spatial_dim;
+		T val = -FLT_MAX;
+
+		for (int c=0; c<channels; c++)
+		{
+			val = max(x[(n * channels + c) * spatial_dim + s], val);
+		}
+
+		y[i] = val;
+	}
+}
+
+template <typename T> 
+long Math<T>::channel_max(int n, int nOutNum, int nChannels, int nInNum, long hX, long hY)
+{
+	LONG lErr;
+	MemoryItem* pX;
+	MemoryItem* pY;
+
+	if (lErr = m_pMemCol->GetData(hX, &pX))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hY, &pY))
+		return lErr;
+
+	channel_max_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(nOutNum, nChannels, nInNum, (T*)pX->Data(), (T*)pY->Data());
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::channel_max(int n, int nOutNum, int nChannels, int nInNum, long hX, long hY);
+template long Math<float>::channel_max(int n, int nOutNum, int nChannels, int nInNum, long hX, long hY);
+
+
+
+template <typename T>
+__global__ void channel_sub_kernel(const int count, const int num, const int channels, const int spatial_dim, const T* x, T* y)
 {
 	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<count; i += blockDim.x * gridDim.x)
 	{
@@ -2881,46 +3484,171 @@ __global__ void col2im_kernel(int n, T* data_col, int height, int width, int ker
 			}
 		}
 
-		data_im[i] = fVal;
+		data_im[i] = fVal;
+	}
+}
+
+template<typename T>
+long Math<T>::col2im(long hDataCol, int nDataColOffset, int nChannels, int nHeight, int nWidth, int nKernelH, int nKernelW, int nPadH, int nPadW, int nStrideH, int nStrideW, int nDilationH, int nDilationW, long hDataIm, int nDataImOffset)
+{
+	LONG lErr;
+	MemoryItem* pDataIm;
+	MemoryItem* pDataCol;
+
+	if (lErr = m_pMemCol->GetData(hDataIm, &pDataIm))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hDataCol, &pDataCol))
+		return lErr;
+
+	// To avoid involving atomic operations, we will launch one kernel per
+	// bottom dimension, and then in the kernel add up the top dimensions.
+	int height_col = (nHeight + 2 * nPadH - (nDilationH * (nKernelH - 1) + 1)) / nStrideH + 1;
+	int width_col = (nWidth + 2 * nPadW - (nDilationW * (nKernelW - 1) + 1)) / nStrideW + 1;
+	int num_kernels = nChannels * nHeight * nWidth;
+
+	T* data_col = (T*)pDataCol->Data();
+	T* data_im = (T*)pDataIm->Data();
+
+	if (nDataColOffset > 0)
+		data_col += nDataColOffset;
+
+	if (nDataImOffset > 0)
+		data_im += nDataImOffset;
+
+	col2im_kernel<T><<<CAFFE_GET_BLOCKS(num_kernels), CAFFE_CUDA_NUM_THREADS>>>(num_kernels, data_col, nHeight, nWidth, nKernelH, nKernelW, nPadH, nPadW, nStrideH, nStrideW, nDilationH, nDilationW, height_col, width_col, data_im);
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::col2im(long hDataCol, int nDataColOffset, int nChannels, int nHeight, int nWidth, int nKernelH, int nKernelW, int nPadH, int nPadW, int nStrideH, int nStrideW, int nDilationH, int nDilationW, long hDataIm, int nDataImOffset);
+template long Math<float>::col2im(long hDataCol, int nDataColOffset, int nChannels, int nHeight, int nWidth, int nKernelH, int nKernelW, int nPadH, int nPadW, int nStrideH, int nStrideW, int nDilationH, int nDilationW, long hDataIm, int nDataImOffset);
+
+
+
+//-----------------------------------------------------------------------------
+//	Returns the cached index tables of the im2col_nd geometry held by the
+//	shape handles, building them on the first use and after any of the
+//	shape handles are written.  pbFound is false when the geometry must
+//	use the per call kernels instead, for its shape handles are memory
+//	pointers or shared, or its tables would be too large.
+//-----------------------------------------------------------------------------
+template <typename T>
+long Math<T>::getIm2ColTable(int nNumSpatialAxes, int nChannelAxis, long hImShape, long hColShape, long hKernelShape, long hPad, long hStride, long hDilation, IM2COL_TABLE* pTable, bool* pbFound)
+{
+	LONG lErr;
+	long rgh[IM2COL_HANDLE_COUNT] = { hImShape, hColShape, hKernelShape, hPad, hStride, hDilation };
+	MemoryItem* rgpItem[IM2COL_HANDLE_COUNT];
+	LONGLONG rgllVersion[IM2COL_HANDLE_COUNT];
+	IM2COL_KEY key;
+
+	*pbFound = false;
+
+	if (nNumSpatialAxes < 1 || nNumSpatialAxes > IM2COL_MAX_AXES || nChannelAxis < 0)
+		return 0;
+
+	memset(&key, 0, sizeof(key));
+	key.nDevice = m_nDeviceID;
+	key.nNumSpatialAxes = nNumSpatialAxes;
+	key.nChannelAxis = nChannelAxis;
+
+	for (int i = 0; i < IM2COL_HANDLE_COUNT; i++)
+	{
+		if (rgh[i] > MAX_ITEMS)
+			return 0;
+
+		if (lErr = m_pMemCol->GetData(rgh[i], &rgpItem[i], false))
+			return lErr;
+
+		if (rgpItem[i]->IsShared())
+			return 0;
+
+		key.rghShape[i] = rgh[i];
+		rgllVersion[i] = rgpItem[i]->Version();
+	}
+
+	if (m_im2colTables.Find(key, rgllVersion, pTable))
+	{
+		*pbFound = true;
+		return 0;
+	}
+
+	// The image and column shapes start with the channels.
+	T rgShape[IM2COL_MAX_AXES];
+	int rgnShape[IM2COL_HANDLE_COUNT][IM2COL_MAX_AXES];
+
+	for (int i = 0; i < IM2COL_HANDLE_COUNT; i++)
+	{
+		int nOffset = (i < 2) ? nChannelAxis + 1 : 0;
+
+		if ((size_t)rgpItem[i]->Size() < sizeof(T) * (nOffset + nNumSpatialAxes))
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		if (lErr = cudaMemcpy(rgShape, (T*)rgpItem[i]->Data() + nOffset, sizeof(T) * nNumSpatialAxes, cudaMemcpyDeviceToHost))
+			return lErr;
+
+		for (int j = 0; j < nNumSpatialAxes; j++)
+		{
+			rgnShape[i][j] = (int)rgShape[j];
+		}
 	}
-}
 
-template<typename T>
-long Math<T>::col2im(long hDataCol, int nDataColOffset, int nChannels, int nHeight, int nWidth, int nKernelH, int nKernelW, int nPadH, int nPadW, int nStrideH, int nStrideW, int nDilationH, int nDilationW, long hDataIm, int nDataImOffset)
-{
-	LONG lErr;
-	MemoryItem* pDataIm;
-	MemoryItem* pDataCol;
+	std::vector<int> rgData;
+	IM2COL_TABLE table;
 
-	if (lErr = m_pMemCol->GetData(hDataIm, &pDataIm))
-		return lErr;
+	if (Im2ColTableCache::Build(nNumSpatialAxes, rgnShape[0], rgnShape[1], rgnShape[2], rgnShape[3], rgnShape[4], rgnShape[5], rgData, &table))
+		return 0;
 
-	if (lErr = m_pMemCol->GetData(hDataCol, &pDataCol))
-		return lErr;
+	if (m_im2colTables.Add(key, rgllVersion, rgData, table, pTable))
+		return 0;
 
-	// To avoid involving atomic operations, we will launch one kernel per
-	// bottom dimension, and then in the kernel add up the top dimensions.
-	int height_col = (nHeight + 2 * nPadH - (nDilationH * (nKernelH - 1) + 1)) / nStrideH + 1;
-	int width_col = (nWidth + 2 * nPadW - (nDilationW * (nKernelW - 1) + 1)) / nStrideW + 1;
-	int num_kernels = nChannels * nHeight * nWidth;
+	*pbFound = true;
 
-	T* data_col = (T*)pDataCol->Data();
-	T* data_im = (T*)pDataIm->Data();
+	return 0;
+}
 
-	if (nDataColOffset > 0)
-		data_col += nDataColOffset;
+template long Math<double>::getIm2ColTable(int nNumSpatialAxes, int nChannelAxis, long hImShape, long hColShape, long hKernelShape, long hPad, long hStride, long hDilation, IM2COL_TABLE* pTable, bool* pbFound);
+template long Math<float>::getIm2ColTable(int nNumSpatialAxes, int nChannelAxis, long hImShape, long hColShape, long hKernelShape, long hPad, long hStride, long hDilation, IM2COL_TABLE* pTable, bool* pbFound);
 
-	if (nDataImOffset > 0)
-		data_im += nDataImOffset;
 
-	col2im_kernel<T><<<CAFFE_GET_BLOCKS(num_kernels), CAFFE_CUDA_NUM_THREADS>>>(num_kernels, data_col, nHeight, nWidth, nKernelH, nKernelW, nPadH, nPadW, nStrideH, nStrideW, nDilationH, nDilationW, height_col, width_col, data_im);
+//-----------------------------------------------------------------------------
+//	Each column item gathers its image item through the table, n is the
+//	channel count times the column items per channel, nColCount.
+//-----------------------------------------------------------------------------
+template<typename T>
+__global__ void im2col_nd_gather_kernel(int n, int nColCount, int nImCount, const T* data_im, const int* gather, T* data_col)
+{
+	for (int index=blockIdx.x * blockDim.x + threadIdx.x; index<n; index += blockDim.x * gridDim.x)
+	{
+		int c = index / nColCount;
+		int nIdx = gather[index - c * nColCount];
 
-	return cudaGetLastError();
+		data_col[index] = (nIdx >= 0) ? data_im[c * nImCount + nIdx] : (T)0;
+	}
 }
 
-template long Math<double>::col2im(long hDataCol, int nDataColOffset, int nChannels, int nHeight, int nWidth, int nKernelH, int nKernelW, int nPadH, int nPadW, int nStrideH, int nStrideW, int nDilationH, int nDilationW, long hDataIm, int nDataImOffset);
-template long Math<float>::col2im(long hDataCol, int nDataColOffset, int nChannels, int nHeight, int nWidth, int nKernelH, int nKernelW, int nPadH, int nPadW, int nStrideH, int nStrideW, int nDilationH, int nDilationW, long hDataIm, int nDataImOffset);
+//-----------------------------------------------------------------------------
+//	Each image item sums the column items that read it, in the fixed order
+//	of the table, so the result is deterministic without atomics.
+//-----------------------------------------------------------------------------
+template<typename T>
+__global__ void col2im_nd_scatter_kernel(int n, int nColCount, int nImCount, const T* data_col, const int* start, const int* scatter, T* data_im)
+{
+	for (int index=blockIdx.x * blockDim.x + threadIdx.x; index<n; index += blockDim.x * gridDim.x)
+	{
+		int c = index / nImCount;
+		int i = index - c * nImCount;
+		const T* col = data_col + c * nColCount;
+		T fVal = 0;
+
+		for (int j = start[i]; j < start[i + 1]; j++)
+		{
+			fVal += col[scatter[j]];
+		}
 
+		data_im[index] = fVal;
+	}
+}
 
 
 template<typename T, int num_axes>
@@ -3050,6 +3778,8 @@ long Math<T>::im2col_nd(long hDataIm, int nDataImOffset, int nNumSpatialAxes, in
 	MemoryItem* pPad;
 	MemoryItem* pStride;
 	MemoryItem* pDilation;
+	IM2COL_TABLE table;
+	bool bFound;
 
 	if (lErr = m_pMemCol->GetData(hDataIm, &pDataIm))
 		return lErr;
@@ -3057,6 +3787,27 @@ long Math<T>::im2col_nd(long hDataIm, int nDataImOffset, int nNumSpatialAxes, in
 	if (lErr = m_pMemCol->GetData(hDataCol, &pDataCol))
 		return lErr;
 
+	T* data_im = (T*)pDataIm->Data();
+	T* data_col = (T*)pDataCol->Data();
+
+	if (nDataImOffset > 0)
+		data_im += nDataImOffset;
+
+	if (nDataColOffset > 0)
+		data_col += nDataColOffset;
+
+	if (lErr = getIm2ColTable(nNumSpatialAxes, nChannelAxis, hImShape, hColShape, hKernelShape, hPad, hStride, hDilation, &table, &bFound))
+		return lErr;
+
+	if (bFound && nNumKernels % table.nColCount == 0)
+	{
+		int nColCount = table.nKernelCount * table.nColCount;
+		int nCount = (nNumKernels / table.nColCount) * nColCount;
+
+		im2col_nd_gather_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nColCount, table.nImCount, data_im, table.pGather, data_col);
+		return cudaGetLastError();
+	}
+
 	if (lErr = m_pMemCol->GetData(hImShape, &pImShape))
 		return lErr;
 
@@ -3075,8 +3826,6 @@ long Math<T>::im2col_nd(long hDataIm, int nDataImOffset, int nNumSpatialAxes, in
 	if (lErr = m_pMemCol->GetData(hDilation, &pDilation))
 		return lErr;
 
-	T* data_im = (T*)pDataIm->Data();
-	T* data_col = (T*)pDataCol->Data();
 	T* im_shape = (T*)pImShape->Data();
 	T* col_shape = (T*)pColShape->Data();
 	T* kernel_shape = (T*)pKernelShape->Data();
@@ -3084,12 +3833,6 @@ long Math<T>::im2col_nd(long hDataIm, int nDataImOffset, int nNumSpatialAxes, in
 	T* stride = (T*)pStride->Data();
 	T* dilation = (T*)pDilation->Data();
 
-	if (nDataImOffset > 0)
-		data_im += nDataImOffset;
-
-	if (nDataColOffset > 0)
-		data_col += nDataColOffset;
-
 	if (nChannelAxis > 0)
 	{
 		im_shape += nChannelAxis;
@@ -3296,6 +4039,8 @@ long Math<T>::col2im_nd(long hDataCol, int nDataColOffset, int nNumSpatialAxes,
 	MemoryItem* pPad;
 	MemoryItem* pStride;
 	MemoryItem* pDilation;
+	IM2COL_TABLE table;
+	bool bFound;
 
 	if (lErr = m_pMemCol->GetData(hDataIm, &pDataIm))
 		return lErr;
@@ -3303,6 +4048,26 @@ long Math<T>::col2im_nd(long hDataCol, int nDataColOffset, int nNumSpatialAxes,
 	if (lErr = m_pMemCol->GetData(hDataCol, &pDataCol))
 		return lErr;
 
+	T* data_im = (T*)pDataIm->Data();
+	T* data_col = (T*)pDataCol->Data();
+
+	if (nDataImOffset > 0)
+		data_im += nDataImOffset;
+
+	if (nDataColOffset > 0)
+		data_col += nDataColOffset;
+
+	if (lErr = getIm2ColTable(nNumSpatialAxes, nChannelAxis, hImShape, hColShape, hKernelShape, hPad, hStride, hDilation, &table, &bFound))
+		return lErr;
+
+	if (bFound && nImCount % table.nImCount == 0)
+	{
+		int nColCount = table.nKernelCount * table.nColCount;
+
+		col2im_nd_scatter_kernel<T><<<CAFFE_GET_BLOCKS(nImCount), CAFFE_CUDA_NUM_THREADS>>>(nImCount, nColCount, table.nImCount, data_col, table.pScatterStart, table.pScatter, data_im);
+		return cudaGetLastError();
+	}
+
 	if (lErr = m_pMemCol->GetData(hImShape, &pImShape))
 		return lErr;
 
@@ -3321,8 +4086,6 @@ long Math<T>::col2im_nd(long hDataCol, int nDataColOffset, int nNumSpatialAxes,
 	if (lErr = m_pMemCol->GetData(hDilation, &pDilation))
 		return lErr;
 
-	T* data_im = (T*)pDataIm->Data();
-	T* data_col = (T*)pDataCol->Data();
 	T* im_shape = (T*)pImShape->Data();
 	T* col_shape = (T*)pColShape->Data();
 	T* kernel_shape = (T*)pKernelShape->Data();
@@ -3330,12 +4093,6 @@ long Math<T>::col2im_nd(long hDataCol, int nDataColOffset, int nNumSpatialAxes,
 	T* stride = (T*)pStride->Data();
 	T* dilation = (T*)pDilation->Data();
 
-	if (nDataImOffset > 0)
-		data_im += nDataImOffset;
-
-	if (nDataColOffset > 0)
-		data_col += nDataColOffset;
-
 	if (nChannelAxis > 0)
 	{
 		im_shape += nChannelAxis;
@@ -3545,6 +4302,44 @@ long Math<float>::rng_bernoulli(int n, float fNonZeroProb, long hY)
 }
 
 
+template<typename T>
+__global__ void rng_philox_kernel(int n, int nMethod, T fA, T fB, unsigned long long llSeed, unsigned int nStream, unsigned long long llOffset, T* y)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		y[i] = philox_item<T>(nMethod, fA, fB, llSeed, nStream, llOffset + i);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Fills y with items llOffset to llOffset + n - 1 of the Philox stream
+//	nStream of the seed.  Each item only depends on the seed, stream and
+//	its index, so the items match those of HostKernels::rng_philox and do not
+//	depend on how a range is split between calls.
+//-----------------------------------------------------------------------------
+template <class T>
+long Math<T>::rng_philox(int nMethod, int n, T fA, T fB, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hY)
+{
+	LONG lErr;
+	MemoryItem* pY;
+
+	if (nMethod < RNG_PHILOX_UNIFORM || nMethod > RNG_PHILOX_BERNOULLI)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (lErr = m_pMemCol->GetData(hY, &pY))
+		return lErr;
+
+	T* y = (T*)pY->Data();
+
+	rng_philox_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, nMethod, fA, fB, (unsigned long long)llSeed, (unsigned int)nStream, (unsigned long long)llOffset, y);
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::rng_philox(int nMethod, int n, double fA, double fB, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hY);
+template long Math<float>::rng_philox(int nMethod, int n, float fA, float fB, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hY);
+
+
 template<typename T>
 __global__ void batchreidx_fwd_kernel(int nCount, const int inner_dim, const T* in, const T* permut, T* out)
 {
@@ -3731,7 +4526,7 @@ template long Math<float>::embed_bwd(int nCount, long hBottomData, long hWeight,
 
 
 template<typename T>
-__global__ void pooling_fwd_max_kernel(int nCount, T* bottom_data, int num, int channels, int height, int width, int pooled_height, int pooled_width, int kernel_h, int kernel_w, int stride_h, int stride_w, int pad_h, int pad_w, T* top_data, T* mask, T* top_mask)
+__global__ void pooling_fwd_max_kernel(int nCount, T* bottom_data, int num, int channels, int height, int width, int pooled_height, int pooled_width, int kernel_h, int kernel_w, int stride_h, int stride_w, int pad_h, int pad_w, T* top_data, T* mask, T* top_mask, unsigned char* mask8)
 {
 	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<nCount; i += blockDim.x * gridDim.x)
 	{
@@ -3739,12 +4534,12 @@ __global__ void pooling_fwd_max_kernel(int nCount, T* bottom_data, int num, int
 		int ph = (i / pooled_width) % pooled_height;
 		int c = (i / pooled_width / pooled_height) % channels;
 		int n = i / pooled_width / pooled_height / channels;
-		int hstart = ph * stride_h - pad_h;
-		int wstart = pw * stride_w - pad_w;
-		const int hend = min(hstart + kernel_h, height);
-		const int wend = min(wstart + kernel_w, width);
-		hstart = max(hstart, 0);
-		wstart = max(wstart, 0);
+		const int hwin = ph * stride_h - pad_h;
+		const int wwin = pw * stride_w - pad_w;
+		const int hend = min(hwin + kernel_h, height);
+		const int wend = min(wwin + kernel_w, width);
+		const int hstart = max(hwin, 0);
+		const int wstart = max(wwin, 0);
 		T maxval = (T)-FLT_MAX;
 		int maxidx = -1;
 		const T* const bottom_slice = bottom_data + (n * channels + c) * height * width;
@@ -3763,7 +4558,9 @@ __global__ void pooling_fwd_max_kernel(int nCount, T* bottom_data, int num, int
 
 		top_data[i] = maxval;
 
-		if (mask != NULL)
+		if (mask8 != NULL)
+			mask8[i] = (maxidx < 0) ? POOLING_MASK8_NONE : (unsigned char)((maxidx / width - hwin) * kernel_w + (maxidx % width - wwin));
+		else if (mask != NULL)
 			mask[i] = maxidx;
 		else
 			top_mask[i] = maxidx;
@@ -3879,13 +4676,299 @@ __global__ void pooling_fwd_sto_test_kernel(int nCount, T* bottom_data, int num,
 			}
 		}
 
-		top_data[i] = (cumsum > 0.0) ? cumvalues / cumsum : 0.0;
+		top_data[i] = (cumsum > 0.0) ? cumvalues / cumsum : 0.0;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+//	Max and average pooling with the window known at compile time, so the
+//	window loops unroll and the divisions by the stride become shifts.  The
+//	bounds checks are skipped for windows inside the image.
+//-----------------------------------------------------------------------------
+template<typename T, int KH, int KW, int SH, int SW, int PH, int PW>
+__global__ void pooling_fwd_max_fixed_kernel(int nCount, const T* bottom_data, int height, int width, int pooled_height, int pooled_width, T* top_data, T* mask, T* top_mask, unsigned char* mask8)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<nCount; i += blockDim.x * gridDim.x)
+	{
+		const int pw = i % pooled_width;
+		const int ph = (i / pooled_width) % pooled_height;
+		const int nc = i / pooled_width / pooled_height;
+		const int hstart = ph * SH - PH;
+		const int wstart = pw * SW - PW;
+		const bool bInside = (hstart >= 0 && wstart >= 0 && hstart + KH <= height && wstart + KW <= width);
+		const T* const bottom_slice = bottom_data + nc * height * width;
+		T maxval = (T)-FLT_MAX;
+		int maxidx = -1;
+		int maxk = POOLING_MASK8_NONE;
+
+#pragma unroll
+		for (int kh=0; kh<KH; kh++)
+		{
+#pragma unroll
+			for (int kw=0; kw<KW; kw++)
+			{
+				const int h = hstart + kh;
+				const int w = wstart + kw;
+
+				if (bInside || (h >= 0 && h < height && w >= 0 && w < width))
+				{
+					const T val = bottom_slice[h * width + w];
+
+					if (val > maxval)
+					{
+						maxval = val;
+						maxidx = h * width + w;
+						maxk = kh * KW + kw;
+					}
+				}
+			}
+		}
+
+		top_data[i] = maxval;
+
+		if (mask8 != NULL)
+			mask8[i] = (unsigned char)maxk;
+		else if (mask != NULL)
+			mask[i] = maxidx;
+		else
+			top_mask[i] = maxidx;
+	}
+}
+
+template<typename T, int KH, int KW, int SH, int SW, int PH, int PW>
+__global__ void pooling_fwd_ave_fixed_kernel(int nCount, const T* bottom_data, int height, int width, int pooled_height, int pooled_width, T* top_data)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<nCount; i += blockDim.x * gridDim.x)
+	{
+		const int pw = i % pooled_width;
+		const int ph = (i / pooled_width) % pooled_height;
+		const int nc = i / pooled_width / pooled_height;
+		const int hstart = ph * SH - PH;
+		const int wstart = pw * SW - PW;
+		const int pool_size = (min(hstart + KH, height + PH) - hstart) * (min(wstart + KW, width + PW) - wstart);
+		const bool bInside = (hstart >= 0 && wstart >= 0 && hstart + KH <= height && wstart + KW <= width);
+		const T* const bottom_slice = bottom_data + nc * height * width;
+		T aveval = 0;
+
+#pragma unroll
+		for (int kh=0; kh<KH; kh++)
+		{
+#pragma unroll
+			for (int kw=0; kw<KW; kw++)
+			{
+				const int h = hstart + kh;
+				const int w = wstart + kw;
+
+				if (bInside || (h >= 0 && h < height && w >= 0 && w < width))
+					aveval += bottom_slice[h * width + w];
+			}
+		}
+
+		top_data[i] = aveval / pool_size;
+	}
+}
+
+template<typename T, int KH, int KW, int SH, int SW, int PH, int PW>
+__global__ void pooling_bwd_max_fixed_kernel(int nCount, const T* top_diff, int height, int width, int pooled_height, int pooled_width, T* bottom_diff, const T* mask, const T* top_mask, const unsigned char* mask8)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<nCount; i += blockDim.x * gridDim.x)
+	{
+		const int w = i % width;
+		const int h = (i / width) % height;
+		const int nc = i / width / height;
+		const int phstart = (h + PH < KH) ? 0 : (h + PH - KH) / SH + 1;
+		const int phend = min((h + PH) / SH + 1, pooled_height);
+		const int pwstart = (w + PW < KW) ? 0 : (w + PW - KW) / SW + 1;
+		const int pwend = min((w + PW) / SW + 1, pooled_width);
+		const int offset = nc * pooled_height * pooled_width;
+		const T* const top_diff_slice = top_diff + offset;
+		const int nCompare = h * width + w;
+		T gradient = 0;
+
+		// At most ceil(K/S) windows cover each item along an axis.
+#pragma unroll
+		for (int dph=0; dph<(KH + SH - 1) / SH; dph++)
+		{
+#pragma unroll
+			for (int dpw=0; dpw<(KW + SW - 1) / SW; dpw++)
+			{
+				const int ph = phstart + dph;
+				const int pw = pwstart + dpw;
+
+				if (ph < phend && pw < pwend)
+				{
+					const int nIdx = offset + ph * pooled_width + pw;
+					bool bMatch;
+
+					if (mask8 != NULL)
+						bMatch = (mask8[nIdx] == (h + PH - ph * SH) * KW + (w + PW - pw * SW));
+					else if (mask != NULL)
+						bMatch = (mask[nIdx] == nCompare);
+					else
+						bMatch = (top_mask[nIdx] == nCompare);
+
+					if (bMatch)
+						gradient += top_diff_slice[ph * pooled_width + pw];
+				}
+			}
+		}
+
+		bottom_diff[i] = gradient;
+	}
+}
+
+template<typename T, int KH, int KW, int SH, int SW, int PH, int PW>
+__global__ void pooling_bwd_ave_fixed_kernel(int nCount, const T* top_diff, int height, int width, int pooled_height, int pooled_width, T* bottom_diff)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<nCount; i += blockDim.x * gridDim.x)
+	{
+		const int w = i % width + PW;
+		const int h = (i / width) % height + PH;
+		const int nc = i / width / height;
+		const int phstart = (h < KH) ? 0 : (h - KH) / SH + 1;
+		const int phend = min(h / SH + 1, pooled_height);
+		const int pwstart = (w < KW) ? 0 : (w - KW) / SW + 1;
+		const int pwend = min(w / SW + 1, pooled_width);
+		const T* const top_diff_slice = top_diff + nc * pooled_height * pooled_width;
+		T gradient = 0;
+
+#pragma unroll
+		for (int dph=0; dph<(KH + SH - 1) / SH; dph++)
+		{
+#pragma unroll
+			for (int dpw=0; dpw<(KW + SW - 1) / SW; dpw++)
+			{
+				const int ph = phstart + dph;
+				const int pw = pwstart + dpw;
+
+				if (ph < phend && pw < pwend)
+				{
+					const int hstart = ph * SH - PH;
+					const int wstart = pw * SW - PW;
+					const int pool_size = (min(hstart + KH, height + PH) - hstart) * (min(wstart + KW, width + PW) - wstart);
+					gradient += top_diff_slice[ph * pooled_width + pw] / pool_size;
+				}
+			}
+		}
+
+		bottom_diff[i] = gradient;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Global average pooling, each block sums the items of one channel.
+//-----------------------------------------------------------------------------
+template<typename T>
+__global__ void pooling_fwd_global_ave_kernel(int nCount, const T* bottom_data, int nSpatial, T* top_data)
+{
+	__shared__ T rgSum[POOLING_GLOBAL_THREADS];
+
+	for (int i=blockIdx.x; i<nCount; i += gridDim.x)
+	{
+		const T* const bottom_slice = bottom_data + i * nSpatial;
+		T fSum = 0;
+
+		for (int j=threadIdx.x; j<nSpatial; j += POOLING_GLOBAL_THREADS)
+		{
+			fSum += bottom_slice[j];
+		}
+
+		rgSum[threadIdx.x] = fSum;
+		__syncthreads();
+
+		for (int s=POOLING_GLOBAL_THREADS / 2; s>0; s >>= 1)
+		{
+			if (threadIdx.x < s)
+				rgSum[threadIdx.x] += rgSum[threadIdx.x + s];
+
+			__syncthreads();
+		}
+
+		if (threadIdx.x == 0)
+			top_data[i] = rgSum[0] / nSpatial;
+
+		__syncthreads();
+	}
+}
+
+template<typename T>
+__global__ void pooling_bwd_global_ave_kernel(int nCount, const T* top_diff, int nSpatial, T* bottom_diff)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<nCount; i += blockDim.x * gridDim.x)
+	{
+		bottom_diff[i] = top_diff[i / nSpatial] / nSpatial;
+	}
+}
+
+template<typename T, int KH, int KW, int SH, int SW, int PH, int PW>
+void pooling_fwd_fixed(int nMethod, int n, const T* bottom_data, int h, int w, int hPooled, int wPooled, T* top_data, T* mask, T* top_mask, unsigned char* mask8)
+{
+	if (nMethod == POOLING_METHOD_MAX)
+		pooling_fwd_max_fixed_kernel<T, KH, KW, SH, SW, PH, PW><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, bottom_data, h, w, hPooled, wPooled, top_data, mask, top_mask, mask8);
+	else
+		pooling_fwd_ave_fixed_kernel<T, KH, KW, SH, SW, PH, PW><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, bottom_data, h, w, hPooled, wPooled, top_data);
+}
+
+template<typename T, int KH, int KW, int SH, int SW, int PH, int PW>
+void pooling_bwd_fixed(int nMethod, int n, const T* top_diff, int h, int w, int hPooled, int wPooled, T* bottom_diff, const T* mask, const T* top_mask, const unsigned char* mask8)
+{
+	if (nMethod == POOLING_METHOD_MAX)
+		pooling_bwd_max_fixed_kernel<T, KH, KW, SH, SW, PH, PW><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_diff, h, w, hPooled, wPooled, bottom_diff, mask, top_mask, mask8);
+	else
+		pooling_bwd_ave_fixed_kernel<T, KH, KW, SH, SW, PH, PW><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_diff, h, w, hPooled, wPooled, bottom_diff);
+}
+
+//-----------------------------------------------------------------------------
+//	The window geometries with compile time max and average kernels, all
+//	other geometries use the generic kernels.
+//-----------------------------------------------------------------------------
+template<typename T>
+struct POOLING_FIXED
+{
+	int nKernelH;
+	int nKernelW;
+	int nStrideH;
+	int nStrideW;
+	int nPadH;
+	int nPadW;
+	void (*pfnFwd)(int nMethod, int n, const T* bottom_data, int h, int w, int hPooled, int wPooled, T* top_data, T* mask, T* top_mask, unsigned char* mask8);
+	void (*pfnBwd)(int nMethod, int n, const T* top_diff, int h, int w, int hPooled, int wPooled, T* bottom_diff, const T* mask, const T* top_mask, const unsigned char* mask8);
+};
+
+template<typename T>
+const POOLING_FIXED<T>* pooling_find_fixed(int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad)
+{
+	static const POOLING_FIXED<T> s_rgFixed[] =
+	{
+		{ 2, 2, 2, 2, 0, 0, pooling_fwd_fixed<T, 2, 2, 2, 2, 0, 0>, pooling_bwd_fixed<T, 2, 2, 2, 2, 0, 0> },
+		{ 3, 3, 2, 2, 0, 0, pooling_fwd_fixed<T, 3, 3, 2, 2, 0, 0>, pooling_bwd_fixed<T, 3, 3, 2, 2, 0, 0> },
+		{ 3, 3, 2, 2, 1, 1, pooling_fwd_fixed<T, 3, 3, 2, 2, 1, 1>, pooling_bwd_fixed<T, 3, 3, 2, 2, 1, 1> },
+		{ 3, 3, 1, 1, 1, 1, pooling_fwd_fixed<T, 3, 3, 1, 1, 1, 1>, pooling_bwd_fixed<T, 3, 3, 1, 1, 1, 1> }
+	};
+
+	for (int i=0; i<(int)(sizeof(s_rgFixed) / sizeof(s_rgFixed[0])); i++)
+	{
+		const POOLING_FIXED<T>* p = &s_rgFixed[i];
+
+		if (p->nKernelH == hKernel && p->nKernelW == wKernel && p->nStrideH == hStride && p->nStrideW == wStride && p->nPadH == hPad && p->nPadW == wPad)
+			return p;
 	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+//	A single window covering each whole channel, which averages it.
+//-----------------------------------------------------------------------------
+inline bool pooling_is_global(int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hPad, int wPad)
+{
+	return (hPooled == 1 && wPooled == 1 && hPad == 0 && wPad == 0 && hKernel >= h && wKernel >= w);
 }
 
 
 template <class T>
-long Math<T>::pooling_fwd(int nMethod, int n, long hBottomData, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hTopData, long hMask, long hTopMask)
+long Math<T>::pooling_fwd(int nMethod, int n, long hBottomData, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hTopData, long hMask, long hTopMask, bool bMask8)
 {
 	LONG lErr;
 	MemoryItem* pBottomData;
@@ -3919,13 +5002,42 @@ long Math<T>::pooling_fwd(int nMethod, int n, long hBottomData, int nNum, int nC
 		top_mask = (T*)pTopMask->Data();
 	}
 
+	// The uint8 mask holds the index of the maximum within each window.
+	unsigned char* mask8 = NULL;
+
+	if (bMask8)
+	{
+		if (nMethod != POOLING_METHOD_MAX || mask == NULL || hKernel * wKernel >= POOLING_MASK8_NONE)
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		mask8 = (unsigned char*)mask;
+		mask = NULL;
+	}
+
 	T* bottom_data = (T*)pBottomData->Data();
 	T* top_data = (T*)pTopData->Data();
 
+	if (nMethod == POOLING_METHOD_AVE && pooling_is_global(h, w, hPooled, wPooled, hKernel, wKernel, hPad, wPad))
+	{
+		pooling_fwd_global_ave_kernel<T><<<min(n, 65535), POOLING_GLOBAL_THREADS>>>(n, bottom_data, h * w, top_data);
+		return cudaGetLastError();
+	}
+
+	if (nMethod == POOLING_METHOD_MAX || nMethod == POOLING_METHOD_AVE)
+	{
+		const POOLING_FIXED<T>* pFixed = pooling_find_fixed<T>(hKernel, wKernel, hStride, wStride, hPad, wPad);
+
+		if (pFixed != NULL)
+		{
+			(*pFixed->pfnFwd)(nMethod, n, bottom_data, h, w, hPooled, wPooled, top_data, mask, top_mask, mask8);
+			return cudaGetLastError();
+		}
+	}
+
 	switch (nMethod)
 	{
 		case POOLING_METHOD_MAX:
-			pooling_fwd_max_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, bottom_data, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, top_data, mask, top_mask);
+			pooling_fwd_max_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, bottom_data, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, top_data, mask, top_mask, mask8);
 			break;
 
 		case POOLING_METHOD_AVE:
@@ -3944,12 +5056,12 @@ long Math<T>::pooling_fwd(int nMethod, int n, long hBottomData, int nNum, int nC
 	return cudaGetLastError();
 }
 
-template long Math<double>::pooling_fwd(int nMethod, int nCount, long hBottomData, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hTopData, long hMask, long hTopMask);
-template long Math<float>::pooling_fwd(int nMethod, int nCount, long hBottomData, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hTopData, long hMask, long hTopMask);
+template long Math<double>::pooling_fwd(int nMethod, int nCount, long hBottomData, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hTopData, long hMask, long hTopMask, bool bMask8);
+template long Math<float>::pooling_fwd(int nMethod, int nCount, long hBottomData, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hTopData, long hMask, long hTopMask, bool bMask8);
 
 
 template<typename T>
-__global__ void pooling_bwd_max_kernel(int nCount, T* top_diff, int num, int channels, int height, int width, int pooled_height, int pooled_width, int kernel_h, int kernel_w, int stride_h, int stride_w, int pad_h, int pad_w, T* bottom_diff, T* mask, T* top_mask)
+__global__ void pooling_bwd_max_kernel(int nCount, T* top_diff, int num, int channels, int height, int width, int pooled_height, int pooled_width, int kernel_h, int kernel_w, int stride_h, int stride_w, int pad_h, int pad_w, T* bottom_diff, T* mask, T* top_mask, unsigned char* mask8)
 {
 	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<nCount; i += blockDim.x * gridDim.x)
 	{
@@ -3968,7 +5080,22 @@ __global__ void pooling_bwd_max_kernel(int nCount, T* top_diff, int num, int cha
 		const T* const top_diff_slice = top_diff + offset;
 		const int nCompare = h * width + w;
 
-		if (mask != NULL)
+		if (mask8 != NULL)
+		{
+			const unsigned char* const mask_slice = mask8 + offset;
+
+			for (int ph = phstart; ph<phend; ph++)
+			{
+				for (int pw = pwstart; pw<pwend; pw++)
+				{
+					int nIdx = ph * pooled_width + pw;
+
+					if (mask_slice[nIdx] == (h + pad_h - ph * stride_h) * kernel_w + (w + pad_w - pw * stride_w))
+						gradient += top_diff_slice[nIdx];
+				}
+			}
+		}
+		else if (mask != NULL)
 		{
 			const T* const mask_slice = mask + offset;
 
@@ -4078,7 +5205,7 @@ __global__ void pooling_bwd_sto_kernel(int nCount, T* top_diff, int num, int cha
 
 
 template <class T>
-long Math<T>::pooling_bwd(int nMethod, int n, long hTopDiff, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hBottomDiff, long hMask, long hTopMask)
+long Math<T>::pooling_bwd(int nMethod, int n, long hTopDiff, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hBottomDiff, long hMask, long hTopMask, bool bMask8)
 {
 	LONG lErr;
 	MemoryItem* pBottomDiff;
@@ -4112,13 +5239,41 @@ long Math<T>::pooling_bwd(int nMethod, int n, long hTopDiff, int nNum, int nChan
 		top_mask = (T*)pTopMask->Data();
 	}
 
+	unsigned char* mask8 = NULL;
+
+	if (bMask8)
+	{
+		if (nMethod != POOLING_METHOD_MAX || mask == NULL || hKernel * wKernel >= POOLING_MASK8_NONE)
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		mask8 = (unsigned char*)mask;
+		mask = NULL;
+	}
+
 	T* bottom_diff = (T*)pBottomDiff->Data();
 	T* top_diff = (T*)pTopDiff->Data();
 
+	if (nMethod == POOLING_METHOD_AVE && pooling_is_global(h, w, hPooled, wPooled, hKernel, wKernel, hPad, wPad))
+	{
+		pooling_bwd_global_ave_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_diff, h * w, bottom_diff);
+		return cudaGetLastError();
+	}
+
+	if (nMethod == POOLING_METHOD_MAX || nMethod == POOLING_METHOD_AVE)
+	{
+		const POOLING_FIXED<T>* pFixed = pooling_find_fixed<T>(hKernel, wKernel, hStride, wStride, hPad, wPad);
+
+		if (pFixed != NULL)
+		{
+			(*pFixed->pfnBwd)(nMethod, n, top_diff, h, w, hPooled, wPooled, bottom_diff, mask, top_mask, mask8);
+			return cudaGetLastError();
+		}
+	}
+
 	switch (nMethod)
 	{
 		case POOLING_METHOD_MAX:
-			pooling_bwd_max_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_diff, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, bottom_diff, mask, top_mask);
+			pooling_bwd_max_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_diff, nNum, nChannels, h, w, hPooled, wPooled, hKernel, wKernel, hStride, wStride, hPad, wPad, bottom_diff, mask, top_mask, mask8);
 			break;
 
 		case POOLING_METHOD_AVE:
@@ -4133,8 +5288,8 @@ long Math<T>::pooling_bwd(int nMethod, int n, long hTopDiff, int nNum, int nChan
 	return cudaGetLastError();
 }
 
-template long Math<double>::pooling_bwd(int nMethod, int nCount, long hTopDiff, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hBottomDiff, long hMask, long hTopMask);
-template long Math<float>::pooling_bwd(int nMethod, int nCount, long hTopDiff, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hBottomDiff, long hMask, long hTopMask);
+template long Math<double>::pooling_bwd(int nMethod, int nCount, long hTopDiff, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hBottomDiff, long hMask, long hTopMask, bool bMask8);
+template long Math<float>::pooling_bwd(int nMethod, int nCount, long hTopDiff, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hBottomDiff, long hMask, long hTopMask, bool bMask8);
 
 
 template<typename T>
@@ -4737,6 +5892,136 @@ template long Math<double>::dropout_bwd(int n, long hTopDiff, long hMask, unsign
 template long Math<float>::dropout_bwd(int n, long hTopDiff, long hMask, unsigned int uiThreshold, float fScale, long hBottomDiff);
 
 
+//-----------------------------------------------------------------------------
+//	The loop runs while any item of the warp is in range so that the whole
+//	warp takes part in the ballot, which packs the keep bits of its 32 items
+//	into one mask word.
+//-----------------------------------------------------------------------------
+template<typename T>
+__global__ void dropout_fwd_bits_kernel(int n, const T* in, unsigned int uiThreshold, T fScale, unsigned long long llSeed, unsigned int nStream, unsigned long long llOffset, unsigned int* mask, T* out)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; (i & ~31) < n; i += blockDim.x * gridDim.x)
+	{
+		bool bKeep = false;
+
+		if (i < n)
+		{
+			bKeep = philox_word(llSeed, nStream, llOffset + i) > uiThreshold;
+			out[i] = in[i] * bKeep * fScale;
+		}
+
+		if (mask != NULL)
+		{
+#if __CUDACC_VER_MAJOR__ >= 9
+			unsigned int nBits = __ballot_sync(0xFFFFFFFF, bKeep);
+#else
+			unsigned int nBits = __ballot(bKeep);
+#endif
+			if ((threadIdx.x & 31) == 0)
+				mask[i >> 5] = nBits;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Runs the dropout with the keep mask made from the Philox stream, where
+//	item i is kept when word llOffset + i of the stream is above the
+//	threshold, just as the mask of dropout_fwd filled by rng_uniform.  When
+//	hMaskBits is not 0 the mask is also stored with one bit per item.
+//-----------------------------------------------------------------------------
+template <class T>
+long Math<T>::dropout_fwd_bits(int n, long hBottomData, long hMaskBits, unsigned int uiThreshold, T fScale, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hTopData)
+{
+	LONG lErr;
+	MemoryItem* pBottomData;
+	MemoryItem* pTopData;
+	unsigned int* mask = NULL;
+
+	if (lErr = m_pMemCol->GetData(hBottomData, &pBottomData))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hTopData, &pTopData))
+		return lErr;
+
+	if (hMaskBits != 0)
+	{
+		MemoryItem* pMaskBits;
+
+		if (lErr = m_pMemCol->GetData(hMaskBits, &pMaskBits))
+			return lErr;
+
+		if (pMaskBits->Size() < ((n + 31) / 32) * sizeof(unsigned int))
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		mask = (unsigned int*)pMaskBits->Data();
+	}
+
+	T* bottom_data = (T*)pBottomData->Data();
+	T* top_data = (T*)pTopData->Data();
+
+	dropout_fwd_bits_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, bottom_data, uiThreshold, fScale, (unsigned long long)llSeed, (unsigned int)nStream, (unsigned long long)llOffset, mask, top_data);
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::dropout_fwd_bits(int n, long hBottomData, long hMaskBits, unsigned int uiThreshold, double fScale, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hTopData);
+template long Math<float>::dropout_fwd_bits(int n, long hBottomData, long hMaskBits, unsigned int uiThreshold, float fScale, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hTopData);
+
+
+template<typename T>
+__global__ void dropout_bwd_bits_kernel(int n, const T* in_diff, const unsigned int* mask, unsigned int uiThreshold, T fScale, unsigned long long llSeed, unsigned int nStream, unsigned long long llOffset, T* out_diff)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		bool bKeep = (mask != NULL) ? ((mask[i >> 5] >> (i & 31)) & 1) : (philox_word(llSeed, nStream, llOffset + i) > uiThreshold);
+		out_diff[i] = in_diff[i] * fScale * bKeep;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Runs the dropout backward pass with the bit mask stored by
+//	dropout_fwd_bits, or when hMaskBits is 0 with the mask made again from
+//	the same seed, stream and offset used by the forward pass.
+//-----------------------------------------------------------------------------
+template <class T>
+long Math<T>::dropout_bwd_bits(int n, long hTopDiff, long hMaskBits, unsigned int uiThreshold, T fScale, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hBottomDiff)
+{
+	LONG lErr;
+	MemoryItem* pTopDiff;
+	MemoryItem* pBottomDiff;
+	const unsigned int* mask = NULL;
+
+	if (lErr = m_pMemCol->GetData(hTopDiff, &pTopDiff))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hBottomDiff, &pBottomDiff))
+		return lErr;
+
+	if (hMaskBits != 0)
+	{
+		MemoryItem* pMaskBits;
+
+		if (lErr = m_pMemCol->GetData(hMaskBits, &pMaskBits))
+			return lErr;
+
+		if (pMaskBits->Size() < ((n + 31) / 32) * sizeof(unsigned int))
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		mask = (const unsigned int*)pMaskBits->Data();
+	}
+
+	T* top_diff = (T*)pTopDiff->Data();
+	T* bottom_diff = (T*)pBottomDiff->Data();
+
+	dropout_bwd_bits_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_diff, mask, uiThreshold, fScale, (unsigned long long)llSeed, (unsigned int)nStream, (unsigned long long)llOffset, bottom_diff);
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::dropout_bwd_bits(int n, long hTopDiff, long hMaskBits, unsigned int uiThreshold, double fScale, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hBottomDiff);
+template long Math<float>::dropout_bwd_bits(int n, long hTopDiff, long hMaskBits, unsigned int uiThreshold, float fScale, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hBottomDiff);
+
+
 template<typename T>
 __global__ void bnll_fwd_kernel(int n, T* in, T* out)
 {
@@ -5068,33 +6353,245 @@ long Math<T>::softmaxloss_bwd(int n, long hTopData, long hLabels, long hBottomDi
 	MemoryItem* pBottomDiff;
 	MemoryItem* pCounts;
 
-	if (lErr = m_pMemCol->GetData(hTopData, &pTopData))
+	if (lErr = m_pMemCol->GetData(hTopData, &pTopData))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hLabels, &pLabels))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hBottomDiff, &pBottomDiff))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hCounts, &pCounts))
+		return lErr;
+
+	T* top_data = (T*)pTopData->Data();
+	T* labels = (T*)pLabels->Data();
+	T* bottom_diff = (T*)pBottomDiff->Data();
+	T* counts = (T*)pCounts->Data();
+
+	if (nIgnoreLabel == -1)
+		softmaxloss_bwd_param_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_data, labels, bottom_diff, nOuterNum, nDim, nInnerNum, counts);
+	else
+		softmaxloss_bwd_param_kernel1<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_data, labels, bottom_diff, nOuterNum, nDim, nInnerNum, counts, nIgnoreLabel);
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::softmaxloss_bwd(int n, long hTopData, long hLabels, long hBottomDiff, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel);
+template long Math<float>::softmaxloss_bwd(int n, long hTopData, long hLabels, long hBottomDiff, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel);
+
+
+//-----------------------------------------------------------------------------
+//	Adds a value to a running log-sum-exp held as the max and the sum of
+//	exp(x - max), rescaling the sum when the max changes.
+//-----------------------------------------------------------------------------
+template<typename T>
+__device__ inline void softmaxloss_online(T& fMax, T& fSum, T fVal)
+{
+	if (fVal > fMax)
+	{
+		fSum = fSum * exp(fMax - fVal) + 1;
+		fMax = fVal;
+	}
+	else
+	{
+		fSum += exp(fVal - fMax);
+	}
+}
+
+template<typename T>
+__device__ inline void softmaxloss_merge(T& fMax, T& fSum, T fMax2, T fSum2)
+{
+	T fNewMax = max(fMax, fMax2);
+	fSum = fSum * exp(fMax - fNewMax) + fSum2 * exp(fMax2 - fNewMax);
+	fMax = fNewMax;
+}
+
+//-----------------------------------------------------------------------------
+//	Each block reduces the contiguous channels of one item when the inner
+//	num is 1, the usual classifier head.
+//-----------------------------------------------------------------------------
+template<typename T>
+__global__ void softmaxloss_fused_row_kernel(int nOuterNum, int nChannels, const T* bottom_data, const T* label, T* loss, T* counts, int nIgnoreLabel, T* prob_data, T* bottom_diff)
+{
+	__shared__ T rgMax[SOFTMAXLOSS_THREADS];
+	__shared__ T rgSum[SOFTMAXLOSS_THREADS];
+
+	for (int n=blockIdx.x; n<nOuterNum; n += gridDim.x)
+	{
+		const T* const x = bottom_data + n * nChannels;
+		T fMax = (T)-FLT_MAX;
+		T fSum = 0;
+
+		for (int c=threadIdx.x; c<nChannels; c += SOFTMAXLOSS_THREADS)
+		{
+			softmaxloss_online(fMax, fSum, x[c]);
+		}
+
+		rgMax[threadIdx.x] = fMax;
+		rgSum[threadIdx.x] = fSum;
+		__syncthreads();
+
+		for (int s=SOFTMAXLOSS_THREADS / 2; s>0; s >>= 1)
+		{
+			if (threadIdx.x < s)
+				softmaxloss_merge(rgMax[threadIdx.x], rgSum[threadIdx.x], rgMax[threadIdx.x + s], rgSum[threadIdx.x + s]);
+
+			__syncthreads();
+		}
+
+		fMax = rgMax[0];
+		fSum = rgSum[0];
+
+		const int label_value = (int)label[n];
+		const bool bIgnore = (nIgnoreLabel != -1 && label_value == nIgnoreLabel);
+
+		if (threadIdx.x == 0)
+		{
+			loss[n] = (bIgnore) ? 0 : min(fMax + log(fSum) - x[label_value], (T)SOFTMAXLOSS_MAX_LOSS);
+			counts[n] = (bIgnore) ? 0 : 1;
+		}
+
+		if (prob_data != NULL || bottom_diff != NULL)
+		{
+			const T fInvSum = 1 / fSum;
+
+			for (int c=threadIdx.x; c<nChannels; c += SOFTMAXLOSS_THREADS)
+			{
+				const T fProb = exp(x[c] - fMax) * fInvSum;
+
+				if (prob_data != NULL)
+					prob_data[n * nChannels + c] = fProb;
+
+				if (bottom_diff != NULL)
+					bottom_diff[n * nChannels + c] = (bIgnore) ? 0 : (c == label_value) ? fProb - 1 : fProb;
+			}
+		}
+
+		__syncthreads();
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Each thread reduces the channels of one spatial item, so the reads of
+//	neighbouring threads are coalesced.
+//-----------------------------------------------------------------------------
+template<typename T>
+__global__ void softmaxloss_fused_col_kernel(int nthreads, const T* bottom_data, const T* label, T* loss, int dim, int spatial_dim, T* counts, int nIgnoreLabel, T* prob_data, T* bottom_diff)
+{
+	const int channels = dim / spatial_dim;
+
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<nthreads; i += blockDim.x * gridDim.x)
+	{
+		const int n = i / spatial_dim;
+		const int s = i % spatial_dim;
+		const int nOffset = n * dim + s;
+		const T* const x = bottom_data + nOffset;
+		T fMax = (T)-FLT_MAX;
+		T fSum = 0;
+
+		for (int c=0; c<channels; c++)
+		{
+			softmaxloss_online(fMax, fSum, x[c * spatial_dim]);
+		}
+
+		const int label_value = (int)label[i];
+		const bool bIgnore = (nIgnoreLabel != -1 && label_value == nIgnoreLabel);
+
+		loss[i] = (bIgnore) ? 0 : min(fMax + log(fSum) - x[label_value * spatial_dim], (T)SOFTMAXLOSS_MAX_LOSS);
+		counts[i] = (bIgnore) ? 0 : 1;
+
+		if (prob_data != NULL || bottom_diff != NULL)
+		{
+			const T fInvSum = 1 / fSum;
+
+			for (int c=0; c<channels; c++)
+			{
+				const T fProb = exp(x[c * spatial_dim] - fMax) * fInvSum;
+
+				if (prob_data != NULL)
+					prob_data[nOffset + c * spatial_dim] = fProb;
+
+				if (bottom_diff != NULL)
+					bottom_diff[nOffset + c * spatial_dim] = (bIgnore) ? 0 : (c == label_value) ? fProb - 1 : fProb;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Calculates the softmax loss straight from the bottom data with a running
+//	log-sum-exp, so the probabilities are not written and read back.  The
+//	loss and counts are the same as softmax followed by softmaxloss_fwd, and
+//	when hBottomDiff is set it receives the unscaled gradient of the
+//	softmax and softmaxloss_bwd.  The probabilities are only written when
+//	hProbData is set.
+//-----------------------------------------------------------------------------
+template <class T> 
+long Math<T>::softmaxloss_fused(int n, long hBottomData, long hLabels, long hLossData, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel, long hProbData, long hBottomDiff)
+{
+	LONG lErr;
+	MemoryItem* pBottomData;
+	MemoryItem* pLabels;
+	MemoryItem* pLossData;
+	MemoryItem* pCounts;
+	T* prob_data = NULL;
+	T* bottom_diff = NULL;
+
+	if (nInnerNum <= 0 || nDim % nInnerNum != 0 || n != nOuterNum * nInnerNum)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (n == 0)
+		return 0;
+
+	if (lErr = m_pMemCol->GetData(hBottomData, &pBottomData))
 		return lErr;
 
 	if (lErr = m_pMemCol->GetData(hLabels, &pLabels))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hBottomDiff, &pBottomDiff))
+	if (lErr = m_pMemCol->GetData(hLossData, &pLossData))
 		return lErr;
 
 	if (lErr = m_pMemCol->GetData(hCounts, &pCounts))
 		return lErr;
 
-	T* top_data = (T*)pTopData->Data();
+	if (hProbData != 0)
+	{
+		MemoryItem* pProbData;
+
+		if (lErr = m_pMemCol->GetData(hProbData, &pProbData))
+			return lErr;
+
+		prob_data = (T*)pProbData->Data();
+	}
+
+	if (hBottomDiff != 0)
+	{
+		MemoryItem* pBottomDiff;
+
+		if (lErr = m_pMemCol->GetData(hBottomDiff, &pBottomDiff))
+			return lErr;
+
+		bottom_diff = (T*)pBottomDiff->Data();
+	}
+
+	T* bottom_data = (T*)pBottomData->Data();
 	T* labels = (T*)pLabels->Data();
-	T* bottom_diff = (T*)pBottomDiff->Data();
+	T* loss_data = (T*)pLossData->Data();
 	T* counts = (T*)pCounts->Data();
 
-	if (nIgnoreLabel == -1)
-		softmaxloss_bwd_param_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_data, labels, bottom_diff, nOuterNum, nDim, nInnerNum, counts);
+	if (nInnerNum == 1)
+		softmaxloss_fused_row_kernel<T><<<min(nOuterNum, 65535), SOFTMAXLOSS_THREADS>>>(nOuterNum, nDim, bottom_data, labels, loss_data, counts, nIgnoreLabel, prob_data, bottom_diff);
 	else
-		softmaxloss_bwd_param_kernel1<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, top_data, labels, bottom_diff, nOuterNum, nDim, nInnerNum, counts, nIgnoreLabel);
+		softmaxloss_fused_col_kernel<T><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(n, bottom_data, labels, loss_data, nDim, nInnerNum, counts, nIgnoreLabel, prob_data, bottom_diff);
 
 	return cudaGetLastError();
 }
 
-template long Math<double>::softmaxloss_bwd(int n, long hTopData, long hLabels, long hBottomDiff, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel);
-template long Math<float>::softmaxloss_bwd(int n, long hTopData, long hLabels, long hBottomDiff, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel);
+template long Math<double>::softmaxloss_fused(int n, long hBottomData, long hLabels, long hLossData, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel, long hProbData, long hBottomDiff);
+template long Math<float>::softmaxloss_fused(int n, long hBottomData, long hLabels, long hLossData, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel, long hProbData, long hBottomDiff);
 
 
 template<typename T>
@@ -6086,9 +7583,271 @@ __global__ void lstm_fwd_kernel(const int nthreads, const int H, const int t, co
 	}
 }
 
-
+
+template <typename T>
+__global__ void lstm_bwd_kernel(const int nthreads, const int H, const int t, const T* c_prev, const T* gate, const T* c_t, const T* clip, T* dc_t, T* dh_t, T* dc_prev, T* gate_diff)
+{
+	for (int idx=blockIdx.x * blockDim.x + threadIdx.x; idx<nthreads; idx += blockDim.x * gridDim.x)
+	{
+		const int n = idx / H;
+		const int d = idx % H;
+		const T* gate_t = gate + 4*H*n;
+		const T i_t = gate_t[d];
+		const T f_t = gate_t[H + d];
+		const T o_t = gate_t[2*H + d];
+		const T g_t = gate_t[3*H + d];
+		const T c_t_1 = c_prev[idx];
+		const T c = c_t[idx];
+		const T tanh_c = tanh(c);
+		const T clip_t = clip ? clip[n] : T(t > 0);
+		T* dc_t_1 = dc_prev + idx;
+		T* gate_diff_t = gate_diff + 4*H*n;
+		T* di_t = gate_diff_t + d;
+		T* df_t = gate_diff_t + H + d;
+		T* do_t = gate_diff_t + 2*H + d;
+		T* dg_t = gate_diff_t + 3*H + d;
+
+		// Output gate: tanh(c(t)) * h_diff(t)
+		*do_t = dh_t[idx] * tanh_c;
+		// Cell state: o(t) * tanh'(c(t)) * h_diff(t) + f(t+1) * c_diff(t+1)
+		dc_t[idx] += dh_t[idx] * o_t * (T(1) - tanh_c * tanh_c);
+		// c_diff(t-1) += f(t) * c_diff(t)
+		*dc_t_1 = clip_t * dc_t[idx] * f_t;
+		// Forget gate: c(t-1) * c_diff(t)
+		*df_t = clip_t * dc_t[idx] * c_t_1;
+		// Input gate: g(t) * c_diff(t)
+		*di_t = dc_t[idx] * g_t;
+		// Input modulation gate: i(t) * c_diff(t)
+		*dg_t = dc_t[idx] * i_t;
+	}
+}
+
+
+template <class T>
+long Math<T>::lstm_fwd(int t, int nN, int nH, long hWeight_h, long hWeight_i, long hClipData, int nClipOffset, long hTopData, int nTopOffset, long hCellData, int nCellOffset, long hPreGateData, int nPreGateOffset, long hGateData, int nGateOffset, long hHT1Data, int nHT1Offset, long hCT1Data, int nCT1Offset, long hHtoGateData)
+{
+	LONG lErr;
+	int nCount;
+	MemoryItem* pWeight_h;
+	MemoryItem* pWeight_i;
+	MemoryItem* pClipData = NULL;
+	MemoryItem* pTopData;
+	MemoryItem* pCellData;
+	MemoryItem* pPreGateData;
+	MemoryItem* pGateData;
+	MemoryItem* pHT1Data;
+	MemoryItem* pCT1Data;
+	MemoryItem* pHtoGateData;
+
+	if (lErr = m_pMemCol->GetData(hWeight_h, &pWeight_h))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hWeight_i, &pWeight_i))
+		return lErr;
+
+	if (hClipData > 0)
+	{
+		if (lErr = m_pMemCol->GetData(hClipData, &pClipData))
+			return lErr;
+	}
+
+	if (lErr = m_pMemCol->GetData(hTopData, &pTopData))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hCellData, &pCellData))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hPreGateData, &pPreGateData))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hGateData, &pGateData))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hHT1Data, &pHT1Data))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hCT1Data, &pCT1Data))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hHtoGateData, &pHtoGateData))
+		return lErr;
+
+	T* weight_h = (T*)pWeight_h->Data();
+	T* weight_i = (T*)pWeight_i->Data();
+	T* clip_t = (pClipData == NULL) ? NULL : ((T*)pClipData->Data()) + nClipOffset;
+	T* h_t = ((T*)pTopData->Data()) + nTopOffset;
+	T* c_t = ((T*)pCellData->Data()) + nCellOffset;
+	T* pre_gate_t = ((T*)pPreGateData->Data()) + nPreGateOffset;
+	T* gate_t = ((T*)pGateData->Data()) + nGateOffset;
+	T* h_t_1 = (t > 0) ? h_t + nHT1Offset : ((T*)pHT1Data->Data()) + nHT1Offset;
+	T* c_t_1 = (t > 0) ? c_t + nCT1Offset : ((T*)pCT1Data->Data()) + nCT1Offset;
+	T* h_to_gate = (T*)pHtoGateData->Data();
+
+	if (lErr = gemm(false, true, nN, 4 * nH, nH, T(1.0), h_t_1, weight_h, T(0.0), h_to_gate))
+		return lErr;
+
+	nCount = 4 * nN * nH;
+	clip_add_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, 4 * nH, t, clip_t, h_to_gate, pre_gate_t);
+
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	nCount = 4 * nN * nH;
+	activation_fwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, pre_gate_t, gate_t);
+
+	nCount = nN * nH;
+	lstm_fwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, t, c_t_1, gate_t, clip_t, c_t, h_t);
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::lstm_fwd(int t, int nN, int nH, long hWeight_h, long hWeight_i, long hClipData, int nClipOffset, long hTopData, int nTopOffset, long hCellData, int nCellOffset, long hPreGateData, int nPreGateOffset, long hGateData, int nGateOffset, long hHT1Data, int nHT1Offset, long hCT1Data, int nCT1Offset, long hHtoGateData);
+template long Math<float>::lstm_fwd(int t, int nN, int nH, long hWeight_h, long hWeight_i, long hClipData, int nClipOffset, long hTopData, int nTopOffset, long hCellData, int nCellOffset, long hPreGateData, int nPreGateOffset, long hGateData, int nGateOffset, long hHT1Data, int nHT1Offset, long hCT1Data, int nCT1Offset, long hHtoGateData);
+
+
+
+template <class T>
+long Math<T>::lstm_bwd(int t, int nN, int nH, T fClip, long hWeight_h, long hClipData, int nClipOffset, long hTopDiff, int nTopOffset, long hCellData, long hCellDiff, int nCellOffset, long hPreGateDiff, int nPreGateOffset, long hGateData, long hGateDiff, int nGateOffset, long hCT1Data, int nCT1Offset, long hDHT1Diff, int nDHT1Offset, long hDCT1Diff, int nDCT1Offset, long hHtoHData)
+{
+	LONG lErr;
+	int nCount;
+	MemoryItem* pWeight_h;
+	MemoryItem* pClipData = NULL;
+	MemoryItem* pTopDiff;
+	MemoryItem* pCellData;
+	MemoryItem* pCellDiff;
+	MemoryItem* pPreGateDiff;
+	MemoryItem* pGateData;
+	MemoryItem* pGateDiff;
+	MemoryItem* pCT1Data;
+	MemoryItem* pDHT1Diff;
+	MemoryItem* pDCT1Diff;
+	MemoryItem* pHtoHData;
+
+	if (lErr = m_pMemCol->GetData(hWeight_h, &pWeight_h))
+		return lErr;
+
+	if (hClipData > 0)
+	{
+		if (lErr = m_pMemCol->GetData(hClipData, &pClipData))
+			return lErr;
+	}
+
+	if (lErr = m_pMemCol->GetData(hTopDiff, &pTopDiff))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hCellData, &pCellData))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hCellDiff, &pCellDiff))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hPreGateDiff, &pPreGateDiff))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hGateData, &pGateData))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hGateDiff, &pGateDiff))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hCT1Data, &pCT1Data))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hDHT1Diff, &pDHT1Diff))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hDCT1Diff, &pDCT1Diff))
+		return lErr;
+
+	if (lErr = m_pMemCol->GetData(hHtoHData, &pHtoHData))
+		return lErr;
+
+	T* weight_h = (T*)pWeight_h->Data();
+	T* clip_t = (pClipData == NULL) ? NULL : ((T*)pClipData->Data()) + nClipOffset;
+	T* dh_t = ((T*)pTopDiff->Data()) + nTopOffset;
+	T* dc_t = ((T*)pCellDiff->Data()) + nCellOffset;
+	T* gate_diff_t = ((T*)pGateDiff->Data()) + nGateOffset;
+	T* pre_gate_diff_t = ((T*)pPreGateDiff->Data()) + nPreGateOffset;
+	T* dh_t_1 = ((T*)pDHT1Diff->Data()) + nDHT1Offset;
+	T* dc_t_1 = ((T*)pDCT1Diff->Data()) + nDCT1Offset;
+	T* c_t = ((T*)pCellData->Data()) + nCellOffset;
+	T* c_t_1 = ((T*)pCT1Data->Data()) + nCT1Offset;
+	T* gate_t = ((T*)pGateData->Data()) + nGateOffset;
+	T* h_to_h = (T*)pHtoHData->Data();
+
+	nCount = nN * nH;
+	lstm_bwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, t, c_t_1, gate_t, c_t, clip_t, dc_t, dh_t, dc_t_1, gate_diff_t);
+
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	nCount = 4 * nN * nH;
+	activation_bwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, fClip, gate_t, gate_diff_t, pre_gate_diff_t);
+
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	// Backprop errors to previous time step.
+	if (lErr = gemm(false, false, nN, nH, 4 * nH, T(1.), pre_gate_diff_t, weight_h, T(0.), h_to_h))
+		return lErr;
+
+	nCount = nN * nH;
+	clip_add_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, t, clip_t, h_to_h, dh_t_1);
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::lstm_bwd(int t, int nN, int nH, double fClip, long hWeight_h, long hClipData, int nClipOffset, long hTopDiff, int nTopOffset, long hCellData, long hCellDiff, int nCellOffset, long hPreGateDiff, int nPreGateOffset, long hGateData, long hGateDiff, int nGateOffset, long hCT1Data, int nCT1Offset, long hDHT1Diff, int nDHT1Offset, long hDCT1Diff, int nDCT1Offset, long hHtoHData);
+template long Math<float>::lstm_bwd(int t, int nN, int nH, float fClip, long hWeight_h, long hClipData, int nClipOffset, long hTopDiff, int nTopOffset, long hCellData, long hCellDiff, int nCellOffset, long hPreGateDiff, int nPreGateOffset, long hGateData, long hGateDiff, int nGateOffset, long hCT1Data, int nCT1Offset, long hDHT1Diff, int nDHT1Offset, long hDCT1Diff, int nDCT1Offset, long hHtoHData);
+
+
+//-----------------------------------------------------------------------------
+//	One step of the sequence forward pass, each thread handles hidden item
+//	d of batch item n.  The recurrent product (when not NULL) and the bias
+//	(when not NULL) are added to the four input projections, and the gate
+//	activations and cell update of lstm_fwd are fused into one pass.
+//-----------------------------------------------------------------------------
+template <typename T>
+__global__ void lstm_seq_fwd_kernel(const int nthreads, const int H, const int t, const T* clip, const T* bias, const T* h_to_gate, T* pre_gate, T* gate, const T* c_prev, T* c_t, T* h_t)
+{
+	for (int idx=blockIdx.x * blockDim.x + threadIdx.x; idx<nthreads; idx += blockDim.x * gridDim.x)
+	{
+		const int n = idx / H;
+		const int d = idx % H;
+		const T clip_t = clip ? clip[n] : T(t > 0);
+		T rgGate[4];
+
+		for (int g=0; g<4; g++)
+		{
+			const int j = 4*H*n + g*H + d;
+			T fPre = pre_gate[j];
+
+			if (bias)
+				fPre += bias[g*H + d];
+
+			if (h_to_gate)
+				fPre += clip_t * h_to_gate[j];
+
+			pre_gate[j] = fPre;
+			rgGate[g] = (g < 3) ? sigmoid(fPre) : tanh(fPre);
+			gate[j] = rgGate[g];
+		}
+
+		const T c = clip_t * rgGate[1] * c_prev[idx] + rgGate[0] * rgGate[3];
+		c_t[idx] = c;
+		h_t[idx] = rgGate[2] * tanh(c);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	One step of the sequence backward pass, each thread handles hidden item
+//	d of batch item n.  The recurrent diff of step t + 1 (when not NULL) is
+//	first added to the top diff, then the cell and gate diffs of lstm_bwd
+//	and the clipped activation diffs are computed in one pass.
+//-----------------------------------------------------------------------------
 template <typename T>
-__global__ void lstm_bwd_kernel(const int nthreads, const int H, const int t, const T* c_prev, const T* gate, const T* c_t, const T* clip, T* dc_t, T* dh_t, T* dc_prev, T* gate_diff)
+__global__ void lstm_seq_bwd_kernel(const int nthreads, const int H, const int t, const T clip_threshold, const T* clip, const T* clip_next, const T* h_to_h, const T* c_prev, const T* gate, const T* c_t, T* dh_t, T* dc_t, T* dc_prev, T* gate_diff, T* pre_gate_diff)
 {
 	for (int idx=blockIdx.x * blockDim.x + threadIdx.x; idx<nthreads; idx += blockDim.x * gridDim.x)
 	{
@@ -6099,53 +7858,86 @@ __global__ void lstm_bwd_kernel(const int nthreads, const int H, const int t, co
 		const T f_t = gate_t[H + d];
 		const T o_t = gate_t[2*H + d];
 		const T g_t = gate_t[3*H + d];
-		const T c_t_1 = c_prev[idx];
-		const T c = c_t[idx];
-		const T tanh_c = tanh(c);
 		const T clip_t = clip ? clip[n] : T(t > 0);
-		T* dc_t_1 = dc_prev + idx;
-		T* gate_diff_t = gate_diff + 4*H*n;
-		T* di_t = gate_diff_t + d;
-		T* df_t = gate_diff_t + H + d;
-		T* do_t = gate_diff_t + 2*H + d;
-		T* dg_t = gate_diff_t + 3*H + d;
+		T dh = dh_t[idx];
 
-		// Output gate: tanh(c(t)) * h_diff(t)
-		*do_t = dh_t[idx] * tanh_c;
-		// Cell state: o(t) * tanh'(c(t)) * h_diff(t) + f(t+1) * c_diff(t+1)
-		dc_t[idx] += dh_t[idx] * o_t * (T(1) - tanh_c * tanh_c);
-		// c_diff(t-1) += f(t) * c_diff(t)
-		*dc_t_1 = clip_t * dc_t[idx] * f_t;
-		// Forget gate: c(t-1) * c_diff(t)
-		*df_t = clip_t * dc_t[idx] * c_t_1;
-		// Input gate: g(t) * c_diff(t)
-		*di_t = dc_t[idx] * g_t;
-		// Input modulation gate: i(t) * c_diff(t)
-		*dg_t = dc_t[idx] * i_t;
+		if (h_to_h)
+		{
+			dh += (clip_next ? clip_next[n] : T(1)) * h_to_h[idx];
+			dh_t[idx] = dh;
+		}
+
+		const T tanh_c = tanh(c_t[idx]);
+		const T dc = dc_t[idx] + dh * o_t * (T(1) - tanh_c * tanh_c);
+		dc_t[idx] = dc;
+		dc_prev[idx] = clip_t * dc * f_t;
+
+		T rgDiff[4];
+		rgDiff[0] = dc * g_t;
+		rgDiff[1] = clip_t * dc * c_prev[idx];
+		rgDiff[2] = dh * tanh_c;
+		rgDiff[3] = dc * i_t;
+
+		for (int g=0; g<4; g++)
+		{
+			const int j = 4*H*n + g*H + d;
+			const T gate_val = gate[j];
+			T fDiff = (g < 3) ? rgDiff[g] * gate_val * (T(1) - gate_val) : rgDiff[g] * (T(1) - gate_val * gate_val);
+
+			if (clip_threshold > T(0))
+			{
+				if (fDiff < -clip_threshold)
+					fDiff = -clip_threshold;
+				else if (fDiff > clip_threshold)
+					fDiff = clip_threshold;
+			}
+
+			gate_diff[j] = rgDiff[g];
+			pre_gate_diff[j] = fDiff;
+		}
 	}
 }
 
-
+//-----------------------------------------------------------------------------
+//	Runs the forward pass of the whole sequence, the same as calling
+//	lstm_fwd for each step after the input projection.  The input
+//	projection of all steps is made with one gemm, and each step then runs
+//	the recurrent gemm and a single fused kernel.  The data is ordered
+//	(T, N, ...) as in the LSTMSimple layer, the bias and clip are optional.
+//-----------------------------------------------------------------------------
 template <class T>
-long Math<T>::lstm_fwd(int t, int nN, int nH, long hWeight_h, long hWeight_i, long hClipData, int nClipOffset, long hTopData, int nTopOffset, long hCellData, int nCellOffset, long hPreGateData, int nPreGateOffset, long hGateData, int nGateOffset, long hHT1Data, int nHT1Offset, long hCT1Data, int nCT1Offset, long hHtoGateData)
+long Math<T>::lstm_seq_fwd(int nT, int nN, int nH, int nI, long hWeight_i, long hWeight_h, long hBias, long hBottomData, long hClipData, long hH0Data, long hC0Data, long hTopData, long hCellData, long hPreGateData, long hGateData, long hHtoGateData)
 {
 	LONG lErr;
-	int nCount;
-	MemoryItem* pWeight_h;
 	MemoryItem* pWeight_i;
+	MemoryItem* pWeight_h;
+	MemoryItem* pBias = NULL;
+	MemoryItem* pBottomData;
 	MemoryItem* pClipData = NULL;
+	MemoryItem* pH0Data;
+	MemoryItem* pC0Data;
 	MemoryItem* pTopData;
 	MemoryItem* pCellData;
 	MemoryItem* pPreGateData;
 	MemoryItem* pGateData;
-	MemoryItem* pHT1Data;
-	MemoryItem* pCT1Data;
 	MemoryItem* pHtoGateData;
 
+	if (nT < 0 || nN <= 0 || nH <= 0 || nI <= 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (lErr = m_pMemCol->GetData(hWeight_i, &pWeight_i))
+		return lErr;
+
 	if (lErr = m_pMemCol->GetData(hWeight_h, &pWeight_h))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hWeight_i, &pWeight_i))
+	if (hBias > 0)
+	{
+		if (lErr = m_pMemCol->GetData(hBias, &pBias))
+			return lErr;
+	}
+
+	if (lErr = m_pMemCol->GetData(hBottomData, &pBottomData))
 		return lErr;
 
 	if (hClipData > 0)
@@ -6154,66 +7946,86 @@ long Math<T>::lstm_fwd(int t, int nN, int nH, long hWeight_h, long hWeight_i, lo
 			return lErr;
 	}
 
-	if (lErr = m_pMemCol->GetData(hTopData, &pTopData))
+	if (lErr = m_pMemCol->GetData(hH0Data, &pH0Data))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hCellData, &pCellData))
+	if (lErr = m_pMemCol->GetData(hC0Data, &pC0Data))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hPreGateData, &pPreGateData))
+	if (lErr = m_pMemCol->GetData(hTopData, &pTopData))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hGateData, &pGateData))
+	if (lErr = m_pMemCol->GetData(hCellData, &pCellData))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hHT1Data, &pHT1Data))
+	if (lErr = m_pMemCol->GetData(hPreGateData, &pPreGateData))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hCT1Data, &pCT1Data))
+	if (lErr = m_pMemCol->GetData(hGateData, &pGateData))
 		return lErr;
 
 	if (lErr = m_pMemCol->GetData(hHtoGateData, &pHtoGateData))
 		return lErr;
 
-	T* weight_h = (T*)pWeight_h->Data();
 	T* weight_i = (T*)pWeight_i->Data();
-	T* clip_t = (pClipData == NULL) ? NULL : ((T*)pClipData->Data()) + nClipOffset;
-	T* h_t = ((T*)pTopData->Data()) + nTopOffset;
-	T* c_t = ((T*)pCellData->Data()) + nCellOffset;
-	T* pre_gate_t = ((T*)pPreGateData->Data()) + nPreGateOffset;
-	T* gate_t = ((T*)pGateData->Data()) + nGateOffset;
-	T* h_t_1 = (t > 0) ? h_t + nHT1Offset : ((T*)pHT1Data->Data()) + nHT1Offset;
-	T* c_t_1 = (t > 0) ? c_t + nCT1Offset : ((T*)pCT1Data->Data()) + nCT1Offset;
+	T* weight_h = (T*)pWeight_h->Data();
+	T* bias = (pBias == NULL) ? NULL : (T*)pBias->Data();
+	T* x = (T*)pBottomData->Data();
+	T* clip = (pClipData == NULL) ? NULL : (T*)pClipData->Data();
+	T* h_0 = (T*)pH0Data->Data();
+	T* c_0 = (T*)pC0Data->Data();
+	T* h = (T*)pTopData->Data();
+	T* c = (T*)pCellData->Data();
+	T* pre_gate = (T*)pPreGateData->Data();
+	T* gate = (T*)pGateData->Data();
 	T* h_to_gate = (T*)pHtoGateData->Data();
+	int nCount = nN * nH;
 
-	if (lErr = gemm(false, true, nN, 4 * nH, nH, T(1.0), h_t_1, weight_h, T(0.0), h_to_gate))
+	// Input projection of all steps.
+	if (lErr = gemm(false, true, nT * nN, 4 * nH, nI, T(1.0), x, weight_i, T(0.0), pre_gate))
 		return lErr;
 
-	nCount = 4 * nN * nH;
-	clip_add_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, 4 * nH, t, clip_t, h_to_gate, pre_gate_t);
+	for (int t=0; t<nT; t++)
+	{
+		T* clip_t = (clip == NULL) ? NULL : clip + t * nN;
+		T* h_t_1 = (t > 0) ? h + (t - 1) * nCount : h_0;
+		T* c_t_1 = (t > 0) ? c + (t - 1) * nCount : c_0;
+		T* h_to_gate_t = NULL;
 
-	if (lErr = cudaGetLastError())
-		return lErr;
+		// Without clip data the first step has no recurrent input.
+		if (t > 0 || clip != NULL)
+		{
+			if (lErr = gemm(false, true, nN, 4 * nH, nH, T(1.0), h_t_1, weight_h, T(0.0), h_to_gate))
+				return lErr;
 
-	nCount = 4 * nN * nH;
-	activation_fwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, pre_gate_t, gate_t);
+			h_to_gate_t = h_to_gate;
+		}
 
-	nCount = nN * nH;
-	lstm_fwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, t, c_t_1, gate_t, clip_t, c_t, h_t);
+		lstm_seq_fwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, t, clip_t, bias, h_to_gate_t, pre_gate + t * 4 * nCount, gate + t * 4 * nCount, c_t_1, c + t * nCount, h + t * nCount);
 
-	return cudaGetLastError();
-}
+		if (lErr = cudaGetLastError())
+			return lErr;
+	}
 
-template long Math<double>::lstm_fwd(int t, int nN, int nH, long hWeight_h, long hWeight_i, long hClipData, int nClipOffset, long hTopData, int nTopOffset, long hCellData, int nCellOffset, long hPreGateData, int nPreGateOffset, long hGateData, int nGateOffset, long hHT1Data, int nHT1Offset, long hCT1Data, int nCT1Offset, long hHtoGateData);
-template long Math<float>::lstm_fwd(int t, int nN, int nH, long hWeight_h, long hWeight_i, long hClipData, int nClipOffset, long hTopData, int nTopOffset, long hCellData, int nCellOffset, long hPreGateData, int nPreGateOffset, long hGateData, int nGateOffset, long hHT1Data, int nHT1Offset, long hCT1Data, int nCT1Offset, long hHtoGateData);
+	return 0;
+}
 
+template long Math<double>::lstm_seq_fwd(int nT, int nN, int nH, int nI, long hWeight_i, long hWeight_h, long hBias, long hBottomData, long hClipData, long hH0Data, long hC0Data, long hTopData, long hCellData, long hPreGateData, long hGateData, long hHtoGateData);
+template long Math<float>::lstm_seq_fwd(int nT, int nN, int nH, int nI, long hWeight_i, long hWeight_h, long hBias, long hBottomData, long hClipData, long hH0Data, long hC0Data, long hTopData, long hCellData, long hPreGateData, long hGateData, long hHtoGateData);
 
 
+//-----------------------------------------------------------------------------
+//	Runs the backward pass of the whole sequence, the same as calling
+//	lstm_bwd for each step from the last to the first.  Each step runs a
+//	single fused kernel, which also adds in the recurrent diff of the step
+//	after it, and the recurrent gemm.  The diff of the last cell must
+//	already be in the cell diff, and the recurrent diff of the first step
+//	is added to the H0 diff.
+//-----------------------------------------------------------------------------
 template <class T>
-long Math<T>::lstm_bwd(int t, int nN, int nH, T fClip, long hWeight_h, long hClipData, int nClipOffset, long hTopDiff, int nTopOffset, long hCellData, long hCellDiff, int nCellOffset, long hPreGateDiff, int nPreGateOffset, long hGateData, long hGateDiff, int nGateOffset, long hCT1Data, int nCT1Offset, long hDHT1Diff, int nDHT1Offset, long hDCT1Diff, int nDCT1Offset, long hHtoHData)
+long Math<T>::lstm_seq_bwd(int nT, int nN, int nH, T fClip, long hWeight_h, long hClipData, long hTopDiff, long hCellData, long hCellDiff, long hPreGateDiff, long hGateData, long hGateDiff, long hC0Data, long hH0Diff, long hC0Diff, long hHtoHData)
 {
 	LONG lErr;
-	int nCount;
 	MemoryItem* pWeight_h;
 	MemoryItem* pClipData = NULL;
 	MemoryItem* pTopDiff;
@@ -6222,11 +8034,14 @@ long Math<T>::lstm_bwd(int t, int nN, int nH, T fClip, long hWeight_h, long hCli
 	MemoryItem* pPreGateDiff;
 	MemoryItem* pGateData;
 	MemoryItem* pGateDiff;
-	MemoryItem* pCT1Data;
-	MemoryItem* pDHT1Diff;
-	MemoryItem* pDCT1Diff;
+	MemoryItem* pC0Data;
+	MemoryItem* pH0Diff;
+	MemoryItem* pC0Diff;
 	MemoryItem* pHtoHData;
 
+	if (nT < 0 || nN <= 0 || nH <= 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
 	if (lErr = m_pMemCol->GetData(hWeight_h, &pWeight_h))
 		return lErr;
 
@@ -6254,55 +8069,67 @@ long Math<T>::lstm_bwd(int t, int nN, int nH, T fClip, long hWeight_h, long hCli
 	if (lErr = m_pMemCol->GetData(hGateDiff, &pGateDiff))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hCT1Data, &pCT1Data))
+	if (lErr = m_pMemCol->GetData(hC0Data, &pC0Data))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hDHT1Diff, &pDHT1Diff))
+	if (lErr = m_pMemCol->GetData(hH0Diff, &pH0Diff))
 		return lErr;
 
-	if (lErr = m_pMemCol->GetData(hDCT1Diff, &pDCT1Diff))
+	if (lErr = m_pMemCol->GetData(hC0Diff, &pC0Diff))
 		return lErr;
 
 	if (lErr = m_pMemCol->GetData(hHtoHData, &pHtoHData))
 		return lErr;
 
 	T* weight_h = (T*)pWeight_h->Data();
-	T* clip_t = (pClipData == NULL) ? NULL : ((T*)pClipData->Data()) + nClipOffset;
-	T* dh_t = ((T*)pTopDiff->Data()) + nTopOffset;
-	T* dc_t = ((T*)pCellDiff->Data()) + nCellOffset;
-	T* gate_diff_t = ((T*)pGateDiff->Data()) + nGateOffset;
-	T* pre_gate_diff_t = ((T*)pPreGateDiff->Data()) + nPreGateOffset;
-	T* dh_t_1 = ((T*)pDHT1Diff->Data()) + nDHT1Offset;
-	T* dc_t_1 = ((T*)pDCT1Diff->Data()) + nDCT1Offset;
-	T* c_t = ((T*)pCellData->Data()) + nCellOffset;
-	T* c_t_1 = ((T*)pCT1Data->Data()) + nCT1Offset;
-	T* gate_t = ((T*)pGateData->Data()) + nGateOffset;
+	T* clip = (pClipData == NULL) ? NULL : (T*)pClipData->Data();
+	T* dh = (T*)pTopDiff->Data();
+	T* c = (T*)pCellData->Data();
+	T* dc = (T*)pCellDiff->Data();
+	T* pre_gate_diff = (T*)pPreGateDiff->Data();
+	T* gate = (T*)pGateData->Data();
+	T* gate_diff = (T*)pGateDiff->Data();
+	T* c_0 = (T*)pC0Data->Data();
+	T* dh_0 = (T*)pH0Diff->Data();
+	T* dc_0 = (T*)pC0Diff->Data();
 	T* h_to_h = (T*)pHtoHData->Data();
+	int nCount = nN * nH;
 
-	nCount = nN * nH;
-	lstm_bwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, t, c_t_1, gate_t, c_t, clip_t, dc_t, dh_t, dc_t_1, gate_diff_t);
+	for (int t=nT-1; t>=0; t--)
+	{
+		T* clip_t = (clip == NULL) ? NULL : clip + t * nN;
+		T* clip_next = (clip == NULL || t == nT - 1) ? NULL : clip + (t + 1) * nN;
+		T* h_to_h_next = (t == nT - 1) ? NULL : h_to_h;
+		T* c_t_1 = (t > 0) ? c + (t - 1) * nCount : c_0;
+		T* dc_t_1 = (t > 0) ? dc + (t - 1) * nCount : dc_0;
+		T* pre_gate_diff_t = pre_gate_diff + t * 4 * nCount;
 
-	if (lErr = cudaGetLastError())
-		return lErr;
+		lstm_seq_bwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, t, fClip, clip_t, clip_next, h_to_h_next, c_t_1, gate + t * 4 * nCount, c + t * nCount, dh + t * nCount, dc + t * nCount, dc_t_1, gate_diff + t * 4 * nCount, pre_gate_diff_t);
 
-	nCount = 4 * nN * nH;
-	activation_bwd_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, fClip, gate_t, gate_diff_t, pre_gate_diff_t);
+		if (lErr = cudaGetLastError())
+			return lErr;
 
-	if (lErr = cudaGetLastError())
-		return lErr;
+		// Without clip data the first step passes no diff back to H0.
+		if (t > 0 || clip != NULL)
+		{
+			if (lErr = gemm(false, false, nN, nH, 4 * nH, T(1.), pre_gate_diff_t, weight_h, T(0.), h_to_h))
+				return lErr;
+		}
+	}
 
-	// Backprop errors to previous time step.
-	if (lErr = gemm(false, false, nN, nH, 4 * nH, T(1.), pre_gate_diff_t, weight_h, T(0.), h_to_h))
-		return lErr;
+	if (nT > 0 && clip != NULL)
+	{
+		clip_add_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, 0, clip, h_to_h, dh_0);
 
-	nCount = nN * nH;
-	clip_add_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, nH, t, clip_t, h_to_h, dh_t_1);
+		if (lErr = cudaGetLastError())
+			return lErr;
+	}
 
-	return cudaGetLastError();
+	return 0;
 }
 
-template long Math<double>::lstm_bwd(int t, int nN, int nH, double fClip, long hWeight_h, long hClipData, int nClipOffset, long hTopDiff, int nTopOffset, long hCellData, long hCellDiff, int nCellOffset, long hPreGateDiff, int nPreGateOffset, long hGateData, long hGateDiff, int nGateOffset, long hCT1Data, int nCT1Offset, long hDHT1Diff, int nDHT1Offset, long hDCT1Diff, int nDCT1Offset, long hHtoHData);
-template long Math<float>::lstm_bwd(int t, int nN, int nH, float fClip, long hWeight_h, long hClipData, int nClipOffset, long hTopDiff, int nTopOffset, long hCellData, long hCellDiff, int nCellOffset, long hPreGateDiff, int nPreGateOffset, long hGateData, long hGateDiff, int nGateOffset, long hCT1Data, int nCT1Offset, long hDHT1Diff, int nDHT1Offset, long hDCT1Diff, int nDCT1Offset, long hHtoHData);
+template long Math<double>::lstm_seq_bwd(int nT, int nN, int nH, double fClip, long hWeight_h, long hClipData, long hTopDiff, long hCellData, long hCellDiff, long hPreGateDiff, long hGateData, long hGateDiff, long hC0Data, long hH0Diff, long hC0Diff, long hHtoHData);
+template long Math<float>::lstm_seq_bwd(int nT, int nN, int nH, float fClip, long hWeight_h, long hClipData, long hTopDiff, long hCellData, long hCellDiff, long hPreGateDiff, long hGateData, long hGateDiff, long hC0Data, long hH0Diff, long hC0Diff, long hHtoHData);
 
 
 template <typename T>
@@ -6946,11 +8773,136 @@ template long Math<float>::rmsprop_update(int nCount, long hNetParamDiff, long h
 
 
 template <typename T>
-__global__ void combine_data_kernel(int n, T* o, T* u, T updtPct, T* s, T srvrPct, T* out)
+__global__ void update_foreach_kernel(int nChunks, UPDATE_PARAMS<T> p, const UPDATE_TENSOR<T>* tensors, const UPDATE_CHUNK* chunks)
+{
+	for (int c=blockIdx.x; c<nChunks; c += gridDim.x)
+	{
+		const UPDATE_CHUNK chunk = chunks[c];
+		const UPDATE_TENSOR<T> t = tensors[chunk.nTensor];
+		const int nEnd = chunk.nStart + chunk.nCount;
+
+		for (int i=chunk.nStart + threadIdx.x; i<nEnd; i += blockDim.x)
+		{
+			T fUpdate = update_item(p, t, i);
+
+			t.diff[i] = fUpdate;
+
+			if (p.bUpdateData)
+				t.data[i] -= fUpdate;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Runs the gradient scale, weight decay, optimizer step and (optionally)
+//	the data update of many tensors with one kernel.  The tensors are split
+//	into chunks of at most UPDATE_FOREACH_CHUNK items, so the blocks get the
+//	same amount of work whatever the tensor sizes, and the chunk table is
+//	copied to the device with each call.
+//-----------------------------------------------------------------------------
+template <class T>
+long Math<T>::update_foreach(const UPDATE_PARAMS<T>& p, int nTensors, const long* rghData, const long* rghDiff, const long* rghHistory1, const long* rghHistory2, const int* rgnCount, const T* rgfLocalRate, const T* rgfLocalDecay)
+{
+	LONG lErr;
+
+	if (nTensors < 0 || nTensors > UPDATE_FOREACH_MAX_TENSORS)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (p.nMethod < UPDATE_METHOD_SGD || p.nMethod > UPDATE_METHOD_RMSPROP)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	bool bNeedData = (p.bUpdateData || p.nRegularization != UPDATE_REGULARIZATION_NONE);
+	bool bNeedHistory2 = (p.nMethod == UPDATE_METHOD_ADADELTA || p.nMethod == UPDATE_METHOD_ADAM);
+	std::vector<UPDATE_TENSOR<T>> rgTensors(nTensors);
+	std::vector<UPDATE_CHUNK> rgChunks;
+
+	for (int i=0; i<nTensors; i++)
+	{
+		UPDATE_TENSOR<T>& t = rgTensors[i];
+		MemoryItem* pItem;
+
+		memset(&t, 0, sizeof(UPDATE_TENSOR<T>));
+
+		if (rgnCount[i] < 0)
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		if (lErr = m_pMemCol->GetData(rghDiff[i], &pItem))
+			return lErr;
+
+		t.diff = (T*)pItem->Data();
+
+		if (lErr = m_pMemCol->GetData(rghHistory1[i], &pItem))
+			return lErr;
+
+		t.history1 = (T*)pItem->Data();
+
+		if (bNeedHistory2)
+		{
+			if (lErr = m_pMemCol->GetData(rghHistory2[i], &pItem))
+				return lErr;
+
+			t.history2 = (T*)pItem->Data();
+		}
+
+		if (bNeedData)
+		{
+			if (lErr = m_pMemCol->GetData(rghData[i], &pItem))
+				return lErr;
+
+			t.data = (T*)pItem->Data();
+		}
+
+		t.nCount = rgnCount[i];
+		t.fLocalRate = rgfLocalRate[i];
+		t.fLocalDecay = rgfLocalDecay[i];
+
+		for (int nStart=0; nStart<t.nCount; nStart += UPDATE_FOREACH_CHUNK)
+		{
+			UPDATE_CHUNK chunk;
+			chunk.nTensor = i;
+			chunk.nStart = nStart;
+			chunk.nCount = min(UPDATE_FOREACH_CHUNK, t.nCount - nStart);
+			rgChunks.push_back(chunk);
+		}
+	}
+
+	if (rgChunks.size() == 0)
+		return 0;
+
+	size_t lTensorSize = sizeof(UPDATE_TENSOR<T>) * nTensors;
+	size_t lChunkSize = sizeof(UPDATE_CHUNK) * rgChunks.size();
+	void* pTable;
+
+	if (lErr = getUpdateTable(lTensorSize + lChunkSize, &pTable))
+		return lErr;
+
+	UPDATE_TENSOR<T>* tensors = (UPDATE_TENSOR<T>*)pTable;
+	UPDATE_CHUNK* chunks = (UPDATE_CHUNK*)((char*)pTable + lTensorSize);
+
+	if (lErr = cudaMemcpy(tensors, rgTensors.data(), lTensorSize, cudaMemcpyHostToDevice))
+		return lErr;
+
+	if (lErr = cudaMemcpy(chunks, rgChunks.data(), lChunkSize, cudaMemcpyHostToDevice))
+		return lErr;
+
+	int nChunks = (int)rgChunks.size();
+
+	update_foreach_kernel<T><<<min(nChunks, 65535), CAFFE_CUDA_NUM_THREADS>>>(nChunks, p, tensors, chunks);
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::update_foreach(const UPDATE_PARAMS<double>& p, int nTensors, const long* rghData, const long* rghDiff, const long* rghHistory1, const long* rghHistory2, const int* rgnCount, const double* rgfLocalRate, const double* rgfLocalDecay);
+template long Math<float>::update_foreach(const UPDATE_PARAMS<float>& p, int nTensors, const long* rghData, const long* rghDiff, const long* rghHistory1, const long* rghHistory2, const int* rgnCount, const float* rgfLocalRate, const float* rgfLocalDecay);
+
+
+template <typename T>
+__global__ void combine_data_kernel(int n, const T* o, const T* u, T updtPct, const T* s, T srvrPct, T* out)
 {
 	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
 	{
-		out[i] = o[i] + ((u[i] - o[i]) * updtPct) + ((s[i] - o[i]) * srvrPct);
+		const T oi = (o == NULL) ? T(0) : o[i];
+		out[i] = oi + ((u[i] - oi) * updtPct) + ((s[i] - oi) * srvrPct);
 	}
 }
 
@@ -6980,15 +8932,33 @@ long Math<T>::combine_data(int nCount, long hOriginal, long hUpdated, T fUpdated
 	T* server = (T*)pServer->Data();
 	T* newdata = (T*)pNewData->Data();
 
-	combine_data_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, original, updated, fUpdatedPct, server, fServerPct, newdata);
-
-	return cudaGetLastError();
+	return combine_data(nCount, original, updated, fUpdatedPct, server, fServerPct, newdata);
 }
 
 template long Math<double>::combine_data(int nCount, long hOriginal, long hUpdated, double fUpdatedPct, long hServer, double fServerPct, long hNewData);
 template long Math<float>::combine_data(int nCount, long hOriginal, long hUpdated, float fUpdatedPct, long hServer, float fServerPct, long hNewData);
 
 
+//-----------------------------------------------------------------------------
+//	Combines the data on the stream, where a NULL original counts as zeros,
+//	so (NULL, delta, fPct, data, 1, data) adds fPct * delta to the data in
+//	place.
+//-----------------------------------------------------------------------------
+template <class T>
+long Math<T>::combine_data(int nCount, const T* original, const T* updated, T fUpdatedPct, const T* server, T fServerPct, T* newdata, cudaStream_t stream)
+{
+	if (stream != NULL)
+		combine_data_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, original, updated, fUpdatedPct, server, fServerPct, newdata);
+	else
+		combine_data_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS>>>(nCount, original, updated, fUpdatedPct, server, fServerPct, newdata);
+
+	return cudaGetLastError();
+}
+
+template long Math<double>::combine_data(int nCount, const double* original, const double* updated, double fUpdatedPct, const double* server, double fServerPct, double* newdata, cudaStream_t stream);
+template long Math<float>::combine_data(int nCount, const float* original, const float* updated, float fUpdatedPct, const float* server, float fServerPct, float* newdata, cudaStream_t stream);
+
+
 template <typename T>
 __global__ void mtx_set_diagonal_kernel(int n, int height, T fVal, T* data)
 {
@@ -8279,46 +10249,54 @@ long Math<T>::calc_batch_dist(int nDistMethod, T fThreshold, int nItemDim, long
 	T* s = (T*)pS->Data();
 	T* t = (T*)pT->Data();
 	T* w = (T*)pW->Data();
-	int nCreatedCount = 0;
-	cudaStream_t* streams = new cudaStream_t[nDim0];
+	StreamPool* pPool = m_pMem->GetStreamPool();
 	bool bReset = true;
 
-	if (streams == NULL)
-		goto cleanup;
+	if (lErr = pPool->Initialize(m_nDeviceID))
+		return lErr;
 
+	// Items only wait on each other when their work ranges overlap.
 	for (int i = 0; i < nDim0; i++)
 	{
-		if (lErr = cudaStreamCreate(&streams[i]))
-			goto cleanup;
-
-		nCreatedCount++;
-
-		if (lErr = cublasSetStream(m_cublas, streams[i]))
-			goto cleanup;
-
 		int nOffset1 = (int)rgOffsets[i * 2 + 0];
 		int nOffset2 = (int)rgOffsets[i * 2 + 1];
 		T* s1 = s + nOffset1;
 		T* t1 = t + nOffset2;
 		T* w1 = w + nOffset2;
+		HAZARD_RANGE rgIn[2] = { { hS, nOffset1, nOffset1 + nItemDim }, { hT, nOffset2, nOffset2 + nItemDim } };
+		HAZARD_RANGE rgOut[1] = { { hW, nOffset2, nOffset2 + nItemDim } };
+		int nLane = pPool->Lease();
+		cudaStream_t stream = pPool->GetStream(nLane);
+
+		if (lErr = pPool->Begin(nLane, rgIn, 2, rgOut, 1))
+			goto cleanup;
+
+		if (lErr = cublasSetStream(m_cublas, stream))
+			goto cleanup;
 
 		if (nDistMethod == DISTANCE_METHOD_HAMMING)
 		{
-			hamming_diff_kernel<T><<<CAFFE_GET_BLOCKS(nItemDim), CAFFE_CUDA_NUM_THREADS, 0, streams[i]>>>(nItemDim, fThreshold, s1, t1, w1);
+			hamming_diff_kernel<T><<<CAFFE_GET_BLOCKS(nItemDim), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nItemDim, fThreshold, s1, t1, w1);
 			if (lErr = cudaGetLastError())
 				goto cleanup;
 		}
 		else
 		{
-			if (lErr = sumsqdiff(nItemDim, w1, s1, t1, &rgDist[i], streams[i]))
+			if (lErr = sumsqdiff(nItemDim, w1, s1, t1, &rgDist[i], stream))
 				goto cleanup;
 		}
+
+		if (lErr = pPool->End(nLane))
+			goto cleanup;
 	}
 
-	cudaDeviceSynchronize();
+	lErr = pPool->Synchronize();
 	cublasSetStream(m_cublas, NULL);
 	bReset = false;
 
+	if (lErr)
+		return lErr;
+
 	for (int i = 0; i < nDim0; i++)
 	{
 		int nOffset2 = (int)rgOffsets[i * 2 + 1];
@@ -8334,20 +10312,10 @@ long Math<T>::calc_batch_dist(int nDistMethod, T fThreshold, int nItemDim, long
 cleanup:
 	if (bReset)
 	{
-		cudaDeviceSynchronize();
+		pPool->Synchronize();
 		cublasSetStream(m_cublas, NULL);
 	}
 
-	if (streams != NULL)
-	{
-		for (int j = nCreatedCount-1; j >= 0; j--)
-		{
-			cudaStreamDestroy(streams[j]);
-		}
-
-		delete streams;
-	}
-
 	return lErr;
 }
 
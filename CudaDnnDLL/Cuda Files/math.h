@@ -9,6 +9,7 @@
 #include "util.h"
 #include "memorycol.h"
 #include "handlecol.h"
+#include "im2coltab.h"
 
 
 //=============================================================================
@@ -34,6 +35,284 @@ const int AGGREGATION_MIN = 2;
 const int DISTANCE_METHOD_HAMMING = 0;
 const int DISTANCE_METHOD_EUCLIDEAN = 1;
 
+const int FUSEDEXPR_OP_LOAD = 0;			// push input[arg]
+const int FUSEDEXPR_OP_CONST = 1;			// push arg
+const int FUSEDEXPR_OP_ADD = 2;
+const int FUSEDEXPR_OP_SUB = 3;
+const int FUSEDEXPR_OP_MUL = 4;
+const int FUSEDEXPR_OP_DIV = 5;
+const int FUSEDEXPR_OP_ADD_SCALAR = 6;		// top + arg
+const int FUSEDEXPR_OP_MUL_SCALAR = 7;		// top * arg
+const int FUSEDEXPR_OP_EXP = 8;
+const int FUSEDEXPR_OP_LOG = 9;
+const int FUSEDEXPR_OP_POWX = 10;			// top ^ arg
+const int FUSEDEXPR_OP_SQRT = 11;
+const int FUSEDEXPR_OP_RECIPROCOL = 12;
+const int FUSEDEXPR_OP_ABS = 13;
+const int FUSEDEXPR_OP_SQUARE = 14;
+const int FUSEDEXPR_OP_NEG = 15;
+
+const int FUSEDEXPR_REDUCE_NONE = 0;
+const int FUSEDEXPR_REDUCE_SUM = 1;
+const int FUSEDEXPR_REDUCE_ASUM = 2;
+
+const int FUSEDEXPR_SHAPE_GENERIC = 0;
+const int FUSEDEXPR_SHAPE_SQUARE = 1;		// x0^2
+const int FUSEDEXPR_SHAPE_SUBSQ = 2;		// (x0 - x1)^2
+const int FUSEDEXPR_SHAPE_AXPBY = 3;		// a * x0 + b * x1
+const int FUSEDEXPR_SHAPE_MULADD = 4;		// x0 * x1 + x2
+
+const int STATS_MIN = 0;
+const int STATS_MAX = 1;
+const int STATS_SUM = 2;
+const int STATS_SUMSQ = 3;
+const int STATS_NAN = 4;
+const int STATS_INF = 5;
+const int STATS_COUNT = 6;
+
+const int UPDATE_METHOD_SGD = 0;
+const int UPDATE_METHOD_NESTEROV = 1;
+const int UPDATE_METHOD_ADAGRAD = 2;
+const int UPDATE_METHOD_ADADELTA = 3;
+const int UPDATE_METHOD_ADAM = 4;
+const int UPDATE_METHOD_RMSPROP = 5;
+
+const int UPDATE_REGULARIZATION_NONE = 0;
+const int UPDATE_REGULARIZATION_L2 = 1;
+const int UPDATE_REGULARIZATION_L1 = 2;
+
+const int RNG_PHILOX_UNIFORM = 0;
+const int RNG_PHILOX_GAUSSIAN = 1;
+const int RNG_PHILOX_BERNOULLI = 2;
+
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int FUSEDEXPR_MAX_INPUTS = 8;
+const int FUSEDEXPR_MAX_OPS = 32;
+const int FUSEDEXPR_MAX_STACK = 8;
+const int REDUCE_MAX_BLOCKS = 256;
+const int POOLING_MASK8_NONE = 255;			// uint8 mask of an empty window
+const int POOLING_GLOBAL_THREADS = 128;
+const int SOFTMAXLOSS_THREADS = 256;
+const float SOFTMAXLOSS_MAX_LOSS = 87.3365447f;	// -log(FLT_MIN)
+const int UPDATE_FOREACH_CHUNK = 16384;
+const int UPDATE_FOREACH_MAX_TENSORS = 4096;
+const unsigned int PHILOX_M0 = 0xD2511F53;
+const unsigned int PHILOX_M1 = 0xCD9E8D57;
+const unsigned int PHILOX_W0 = 0x9E3779B9;
+const unsigned int PHILOX_W1 = 0xBB67AE85;
+const int PHILOX_ROUNDS = 10;
+
+
+//=============================================================================
+//	Types
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	The fused expression program is a postfix list of operations evaluated
+//	on a small stack for each item, it is passed to the kernel by value.
+//-----------------------------------------------------------------------------
+template <class T>
+struct FUSEDEXPR_PROGRAM
+{
+	int nOps;
+	int nShape;
+	int rgOp[FUSEDEXPR_MAX_OPS];
+	T rgArg[FUSEDEXPR_MAX_OPS];
+	T* rgIn[FUSEDEXPR_MAX_INPUTS];
+};
+
+
+//-----------------------------------------------------------------------------
+//	The settings shared by all tensors of a foreach update, where fMomentum
+//	is the momentum, Adam beta1 or RmsProp decay, fMomentum2 the Adam beta2
+//	and fDelta the delta or Adam eps_hat.  The diffs are scaled by
+//	fGradScale, the clipping and iteration size scale, before the weight
+//	decay is added.
+//-----------------------------------------------------------------------------
+template <class T>
+struct UPDATE_PARAMS
+{
+	int nMethod;
+	int nRegularization;
+	T fGradScale;
+	T fMomentum;
+	T fMomentum2;
+	T fDelta;
+	bool bUpdateData;
+};
+
+//-----------------------------------------------------------------------------
+//	One tensor of a foreach update, the local rate and decay already include
+//	the learning rate and weight decay multipliers of the parameter.  The
+//	second history is only used by AdaDelta and Adam.
+//-----------------------------------------------------------------------------
+template <class T>
+struct UPDATE_TENSOR
+{
+	T* data;
+	T* diff;
+	T* history1;
+	T* history2;
+	int nCount;
+	T fLocalRate;
+	T fLocalDecay;
+};
+
+//-----------------------------------------------------------------------------
+//	A run of up to UPDATE_FOREACH_CHUNK items of one tensor, the unit of
+//	work of the foreach update kernel.
+//-----------------------------------------------------------------------------
+struct UPDATE_CHUNK
+{
+	int nTensor;
+	int nStart;
+	int nCount;
+};
+
+//-----------------------------------------------------------------------------
+//	Applies the weight decay and optimizer step to item i of a tensor, the
+//	same as the regularization followed by the separate *_update kernels,
+//	and returns the update value written to the diff.
+//-----------------------------------------------------------------------------
+template <class T>
+inline __host__ __device__ T update_item(const UPDATE_PARAMS<T>& p, const UPDATE_TENSOR<T>& t, int i)
+{
+	T fGi = t.diff[i] * p.fGradScale;
+
+	if (p.nRegularization == UPDATE_REGULARIZATION_L2)
+		fGi += t.fLocalDecay * t.data[i];
+	else if (p.nRegularization == UPDATE_REGULARIZATION_L1)
+		fGi += t.fLocalDecay * (T)((t.data[i] > 0) - (t.data[i] < 0));
+
+	switch (p.nMethod)
+	{
+		case UPDATE_METHOD_SGD:
+			return t.history1[i] = p.fMomentum * t.history1[i] + t.fLocalRate * fGi;
+
+		case UPDATE_METHOD_NESTEROV:
+		{
+			T fHi = t.history1[i];
+			T fHiNew = t.history1[i] = p.fMomentum * fHi + t.fLocalRate * fGi;
+			return (1 + p.fMomentum) * fHiNew - p.fMomentum * fHi;
+		}
+
+		case UPDATE_METHOD_ADAGRAD:
+		{
+			T fHi = t.history1[i] = t.history1[i] + fGi * fGi;
+			return t.fLocalRate * fGi / (sqrt(fHi) + p.fDelta);
+		}
+
+		case UPDATE_METHOD_ADADELTA:
+		{
+			T fHi = t.history1[i] = p.fMomentum * t.history1[i] + (1 - p.fMomentum) * fGi * fGi;
+			fGi = fGi * sqrt((t.history2[i] + p.fDelta) / (fHi + p.fDelta));
+			t.history2[i] = p.fMomentum * t.history2[i] + (1 - p.fMomentum) * fGi * fGi;
+			return t.fLocalRate * fGi;
+		}
+
+		case UPDATE_METHOD_ADAM:
+		{
+			T fMi = t.history1[i] = t.history1[i] * p.fMomentum + fGi * (1 - p.fMomentum);
+			T fVi = t.history2[i] = t.history2[i] * p.fMomentum2 + fGi * fGi * (1 - p.fMomentum2);
+			return t.fLocalRate * fMi / (sqrt(fVi) + p.fDelta);
+		}
+
+		case UPDATE_METHOD_RMSPROP:
+		{
+			T fHi = t.history1[i] = p.fMomentum * t.history1[i] + (1 - p.fMomentum) * fGi * fGi;
+			return t.fLocalRate * fGi / (sqrt(fHi) + p.fDelta);
+		}
+
+		default:
+			return 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Runs the Philox4x32-10 counter based generator on the four counter
+//	words, which are replaced by the four random words of the counter.
+//-----------------------------------------------------------------------------
+inline __host__ __device__ void philox4x32(unsigned int* rgCtr, unsigned int nKey0, unsigned int nKey1)
+{
+	for (int i = 0; i < PHILOX_ROUNDS; i++)
+	{
+		unsigned long long llP0 = (unsigned long long)PHILOX_M0 * rgCtr[0];
+		unsigned long long llP1 = (unsigned long long)PHILOX_M1 * rgCtr[2];
+		unsigned int nHi0 = (unsigned int)(llP0 >> 32);
+		unsigned int nHi1 = (unsigned int)(llP1 >> 32);
+
+		rgCtr[0] = nHi1 ^ rgCtr[1] ^ nKey0;
+		rgCtr[1] = (unsigned int)llP1;
+		rgCtr[2] = nHi0 ^ rgCtr[3] ^ nKey1;
+		rgCtr[3] = (unsigned int)llP0;
+
+		nKey0 += PHILOX_W0;
+		nKey1 += PHILOX_W1;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Returns the four random words of block llBlock of a stream, the key is
+//	the seed and the counter holds the block and stream.
+//-----------------------------------------------------------------------------
+inline __host__ __device__ void philox_block(unsigned long long llSeed, unsigned int nStream, unsigned long long llBlock, unsigned int* rgWords)
+{
+	rgWords[0] = (unsigned int)llBlock;
+	rgWords[1] = (unsigned int)(llBlock >> 32);
+	rgWords[2] = nStream;
+	rgWords[3] = 0;
+	philox4x32(rgWords, (unsigned int)llSeed, (unsigned int)(llSeed >> 32));
+}
+
+//-----------------------------------------------------------------------------
+//	Returns the random word of item llItem of a stream, where each block
+//	holds the words of four items.
+//-----------------------------------------------------------------------------
+inline __host__ __device__ unsigned int philox_word(unsigned long long llSeed, unsigned int nStream, unsigned long long llItem)
+{
+	unsigned int rgWords[4];
+	philox_block(llSeed, nStream, llItem >> 2, rgWords);
+	return rgWords[llItem & 3];
+}
+
+//-----------------------------------------------------------------------------
+//	Returns item llItem of a Philox stream, the uniform and Bernoulli items
+//	use word llItem and lie in (fA, fB] and {0, 1} with P(1) = fA.  The
+//	gaussian items have mean fA and standard deviation fB and come in pairs,
+//	items 2k and 2k+1 are the cosine and sine outputs of the Box-Muller
+//	transform of words 2k and 2k+1, so every method uses one word per item.
+//	The methods share the words of a stream, so they must not be used on
+//	the same range of the same stream.
+//-----------------------------------------------------------------------------
+template <class T>
+inline __host__ __device__ T philox_item(int nMethod, T fA, T fB, unsigned long long llSeed, unsigned int nStream, unsigned long long llItem)
+{
+	const double dfInv32 = 1.0 / 4294967296.0;
+
+	if (nMethod == RNG_PHILOX_GAUSSIAN)
+	{
+		unsigned int rgWords[4];
+		philox_block(llSeed, nStream, llItem >> 2, rgWords);
+		int nPair = (int)(llItem & 2);
+		T fU1 = (T)((rgWords[nPair] + 0.5) * dfInv32);
+		T fU2 = (T)((rgWords[nPair + 1] + 0.5) * dfInv32);
+		T fR = sqrt(T(-2) * log(fU1));
+		T fTheta = T(6.283185307179586) * fU2;
+		return fA + fB * fR * ((llItem & 1) ? sin(fTheta) : cos(fTheta));
+	}
+
+	double dfU = (philox_word(llSeed, nStream, llItem) + 1.0) * dfInv32;
+
+	if (nMethod == RNG_PHILOX_BERNOULLI)
+		return (dfU <= (double)fA) ? T(1) : T(0);
+
+	return fA + (fB - fA) * (T)dfU;
+}
+
 
 //=============================================================================
 //	Forward References
@@ -58,6 +337,16 @@ class Math
 		HandleCollection<MAX_HANDLES>* m_pStreamCol;
 		cublasHandle_t m_cublas;
 		curandGenerator_t m_curand;
+		T* m_pReduceWork;
+		int m_nReduceWorkDevice;
+		Im2ColTableCache m_im2colTables;
+		void* m_pUpdateTable;
+		size_t m_lUpdateTableSize;
+		int m_nUpdateTableDevice;
+
+		long getReduceWork(T** ppWork);
+		long getUpdateTable(size_t lSize, void** ppTable);
+		long getIm2ColTable(int nNumSpatialAxes, int nChannelAxis, long hImShape, long hColShape, long hKernelShape, long hPad, long hStride, long hDilation, IM2COL_TABLE* pTable, bool* pbFound);
 
 	public:
 		Math()
@@ -68,10 +357,26 @@ class Math
 			m_pStreamCol = NULL;
 			m_cublas = NULL;
 			m_curand = NULL;
+			m_pReduceWork = NULL;
+			m_nReduceWorkDevice = -1;
+			m_pUpdateTable = NULL;
+			m_lUpdateTableSize = 0;
+			m_nUpdateTableDevice = -1;
 		}
 
 		~Math()
 		{
+			if (m_pReduceWork != NULL)
+			{
+				cudaFree(m_pReduceWork);
+				m_pReduceWork = NULL;
+			}
+
+			if (m_pUpdateTable != NULL)
+			{
+				cudaFree(m_pUpdateTable);
+				m_pUpdateTable = NULL;
+			}
 		}
 
 		cublasHandle_t GetCublasHandle()
@@ -133,9 +438,11 @@ class Math
 		long minval(int n, long hA, T* pOut, int nAOff = 0);
 		long minmaxval(int n, long hA, long hWork1, long hWork2, T* pMin, T* pMax, int nAOff = 0);
 		long naninfval(int n, long hA, long hWork1, long hWork2, T* pNan, T* pInf, int nAOff = 0);
+		long stats(int n, long hA, T* rgStats, int nAOff = 0);
 		long sumsq(int n, long hW, long hA, int nAOff, T* pOut);
 		long sumsqdiff(int n, long hW, long hA, long hB, int nAOff, int nBOff, T* pOut);
 		long sumsqdiff(int n, T* w, T* x, T* y, T* pOut, cudaStream_t stream = NULL);
+		long fused_expr(int n, int nInputs, long* rghIn, int* rgnInOff, int nOps, int* rgOp, T* rgArg, long hY, int nYOff, int nReduce, T* pOut);
 		long width(int n, long hMean, long hMin, long hMax, T fAlpha, long hWidth);
 		long contains_point(int n, long hMean, long hWidth, long hX, long hWork, T* pOut, int nXOff = 0);
 		long denan(int n, long hX, T fReplacement);
@@ -156,6 +463,7 @@ class Math
 		long rng_uniform(int n, T fMin, T fMax, long hY);
 		long rng_gaussian(int n, T fMu, T fSigma, long hY);
 		long rng_bernoulli(int n, T fNonZeroProb, long hY);
+		long rng_philox(int nMethod, int n, T fA, T fB, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hY);
 
 		long batchreidx_fwd(int nCount, int nInnerDim, long hBottomData, long hPermutData, long hTopData);
 		long batchreidx_bwd(int nCount, int nInnerDim, long hTopDiff, long hTopIdx, long hBegin, long hCounts, long hBottomDiff);
@@ -163,8 +471,8 @@ class Math
 		long embed_fwd(int nCount, long hBottomData, long hWeight, int nM, int nN, int nK, long hTopData);
 		long embed_bwd(int nCount, long hBottomData, long hTopDiff, int nM, int nN, int nK, long hWeightDiff);
 
-		long pooling_fwd(int nMethod, int nCount, long hBottomData, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hTopData, long hMask, long hTopMask);
-		long pooling_bwd(int nMethod, int nCount, long hTopDiff, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hBottomDiff, long hMask, long hTopMask);
+		long pooling_fwd(int nMethod, int nCount, long hBottomData, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hTopData, long hMask, long hTopMask, bool bMask8 = false);
+		long pooling_bwd(int nMethod, int nCount, long hTopDiff, int nNum, int nChannels, int h, int w, int hPooled, int wPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hBottomDiff, long hMask, long hTopMask, bool bMask8 = false);
 
 		long unpooling_fwd(int nMethod, int nCount, long hBottomData, int nNum, int nChannels, int h, int w, int hUnPooled, int wUnPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hTopData, long hBottomMask);
 		long unpooling_bwd(int nMethod, int nCount, long hTopDiff, int nNum, int nChannels, int h, int w, int hUnPooled, int wUnPooled, int hKernel, int wKernel, int hStride, int wStride, int hPad, int wPad, long hBottomDiff, long hBottomMask);
@@ -183,6 +491,8 @@ class Math
 
 		long dropout_fwd(int nCount, long hBottomData, long hMask, unsigned int uiThreshold, T fScale, long hTopData);
 		long dropout_bwd(int nCount, long hTopDiff, long hMask, unsigned int uiThreshold, T fScale, long hBottomDiff);
+		long dropout_fwd_bits(int nCount, long hBottomData, long hMaskBits, unsigned int uiThreshold, T fScale, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hTopData);
+		long dropout_bwd_bits(int nCount, long hTopDiff, long hMaskBits, unsigned int uiThreshold, T fScale, LONGLONG llSeed, int nStream, LONGLONG llOffset, long hBottomDiff);
 
 		long bnll_fwd(int nCount, long hBottomData, long hTopData);
 		long bnll_bwd(int nCount, long hTopDiff, long hBottomData, long hBottomDiff);
@@ -193,6 +503,7 @@ class Math
 
 		long softmaxloss_fwd(int nCount, long hProbData, long hLabels, long hLossData, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel);
 		long softmaxloss_bwd(int nCount, long hTopData, long hLabels, long hBottomDiff, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel);
+		long softmaxloss_fused(int nCount, long hBottomData, long hLabels, long hLossData, int nOuterNum, int nDim, int nInnerNum, long hCounts, int nIgnoreLabel, long hProbData, long hBottomDiff);
 
 		long max_fwd(int nCount, long hA, long hB, int nIdx, long hY, long hMask);
 		long max_bwd(int nCount, long hX, int nIdx, long hMask, long hY);
@@ -224,6 +535,9 @@ class Math
 		long lstm_fwd(int t, int nN, int nH, long hWeight_h, long hWeight_i, long hClipData, int nClipOffset, long hTopData, int nTopOffset, long hCellData, int nCellOffset, long hPreGateData, int nPreGateOffset, long hGateData, int nGateOffset, long hHT1Data, int nHT1Offset, long hCT1Data, int nCT1Offset, long hHtoGateData);
 		long lstm_bwd(int t, int nN, int nH, T fClip, long hWeight_h, long hClipData, int nClipOffset, long hTopDiff, int nTopOffset, long hCellData, long hCellDiff, int nCellOffset, long hPreGateDiff, int nPreGateOffset, long hGateData, long hGateDiff, int nGateOffset, long hCT1Data, int nCT1Offset, long hDHT1Diff, int nDHT1Offset, long hDCT1Diff, int nDCT1Offset, long hHtoHData);
 
+		long lstm_seq_fwd(int nT, int nN, int nH, int nI, long hWeight_i, long hWeight_h, long hBias, long hBottomData, long hClipData, long hH0Data, long hC0Data, long hTopData, long hCellData, long hPreGateData, long hGateData, long hHtoGateData);
+		long lstm_seq_bwd(int nT, int nN, int nH, T fClip, long hWeight_h, long hClipData, long hTopDiff, long hCellData, long hCellDiff, long hPreGateDiff, long hGateData, long hGateDiff, long hC0Data, long hH0Diff, long hC0Diff, long hHtoHData);
+
 		long lstm_unit_fwd(int nCount, int nHiddenDim, int nXCount, long hX, long hX_acts, long hC_prev, long hCont, long hC, long hH);
 		long lstm_unit_bwd(int nCount, int nHiddenDim, int nXCount, long hC_prev, long hX_acts, long hC, long hH, long hCont, long hC_diff, long hH_diff, long hC_prev_diff, long hX_acts_diff, long hX_diff);
 
@@ -239,8 +553,10 @@ class Math
 		long adadelta_update(int nCount, long hNetParamDiff, long hHistoryData1, long hHistoryData2, T fMomentum, T fDelta, T fLearningRate);
 		long adam_update(int nCount, long hNetParamDiff, long hValM, long hValV, T fBeta1, T fBeta2, T fEpsHat, T fCorrectedLearningRate);
 		long rmsprop_update(int nCount, long hNetParamDiff, long hHistoryData, T fRmsDecay, T fDelta, T fLearningRate);
+		long update_foreach(const UPDATE_PARAMS<T>& p, int nTensors, const long* rghData, const long* rghDiff, const long* rghHistory1, const long* rghHistory2, const int* rgnCount, const T* rgfLocalRate, const T* rgfLocalDecay);
 
 		long combine_data(int nCount, long hOriginal, long hUpdated, T fUpdatedPct, long hServer, T fServerPct, long hNewData);
+		long combine_data(int nCount, const T* original, const T* updated, T fUpdatedPct, const T* server, T fServerPct, T* newdata, cudaStream_t stream = NULL);
 
 		long mtx_set_diagonal(int nCount, int nRows, T fVal, long hData);
 		long mtx_set_diagonal(int nCount, int nRows, long hDiagonal, T fScaleA, T fScaleB, long hData);
@@ -11,9 +11,11 @@
 //=============================================================================
 
 template <class T>
-Memory<T>::Memory() : m_memory(), m_memoryPointers(), m_hostbuffers(), m_streams(), m_tensorDesc(), m_filterDesc(), m_convDesc(), m_poolDesc(), m_lrnDesc(), m_cudnn(), m_pca(), m_tsnegp(), m_tsneg(), m_memtest(), m_nccl()
+Memory<T>::Memory() : m_memory(), m_memoryPointers(), m_allocTracker(MAX_ITEMS), m_hostbuffers(), m_streams(), m_tensorDesc(), m_filterDesc(), m_convDesc(), m_poolDesc(), m_lrnDesc(), m_cudnn(), m_pca(), m_tsnegp(), m_tsneg(), m_memtest(), m_nccl()
 {
 	m_memory.SetMemoryPointers(&m_memoryPointers);
+	m_allocTracker.EnableFromEnvironment();
+	m_memory.EnableMirrorFromEnvironment();
 
 	m_tOne = (T)1;
 	m_tZero = (T)0;
@@ -96,6 +98,11 @@ Memory<T>::~Memory()
 		FreePCA(i);
 	}
 
+	for (int i = 0; i < m_modelavg.GetCount(); i++)
+	{
+		FreeModelAvg(i);
+	}
+
 	for (int i=0; i<m_tsnegp.GetCount(); i++)
 	{
 		FreeTsneGaussianPerplexity(i);
@@ -401,6 +408,7 @@ template <class T>
 long Memory<T>::SynchronizeThread()
 {
 	synchronize_thread_kernel<T><<<1, 1>>>();
+	m_memory.InvalidateMirrors();
 	return cudaGetLastError();
 }
 
@@ -562,16 +570,69 @@ template long Memory<double>::CreateConvolutionDesc(long* phHandle);
 template long Memory<float>::CreateConvolutionDesc(long* phHandle);
 
 
+//-----------------------------------------------------------------------------
+//	Fills the cache key from the current device and the parameters held by
+//	the descriptors, so that layers with the same geometry share an entry.
+//-----------------------------------------------------------------------------
 template <class T>
-long Memory<T>::GetConvolutionInfo(long hHandle, long hBottomDesc, long hFilterDesc, long hConvDesc, long hTopDesc, long lWsLimitInBytes, long* palgoFwd, long* plWsSizeFwd, long* palgoBwdFilter, long* plWsSizeBwdFilter, long* palgoBwdData, long* plWsSizeBwdData)
+long Memory<T>::getConvolutionKey(cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long lWsLimitInBytes, CONVALGO_KEY* pKey)
 {
-	cudnnStatus_t err;	
-	cudnnHandle_t cudnn = GetCuDNN(hHandle);
-	cudnnTensorDescriptor_t bottom = GetTensorDesc(hBottomDesc);
-	cudnnFilterDescriptor_t filter = GetFilterDesc(hFilterDesc);
-	cudnnConvolutionDescriptor_t conv = GetConvolutionDesc(hConvDesc);
-	cudnnTensorDescriptor_t top = GetTensorDesc(hTopDesc);
+	LONG lErr;
+	int nDevice;
+	cudnnDataType_t type;
+
+	if (lErr = cudaGetDevice(&nDevice))
+		return lErr;
+
+	if (lErr = g_convAlgoCache.InitKey(nDevice, pKey))
+		return lErr;
 
+	pKey->nDataType = (int)sizeof(T);
+	pKey->llWsLimitInBytes = lWsLimitInBytes;
+
+	int* pB = pKey->rgBottom;
+	if (lErr = cudnnGetTensor4dDescriptor(bottom, &type, &pB[0], &pB[1], &pB[2], &pB[3], &pB[4], &pB[5], &pB[6], &pB[7]))
+		return lErr;
+
+	int* pT = pKey->rgTop;
+	if (lErr = cudnnGetTensor4dDescriptor(top, &type, &pT[0], &pT[1], &pT[2], &pT[3], &pT[4], &pT[5], &pT[6], &pT[7]))
+		return lErr;
+
+	int* pF = pKey->rgFilter;
+#ifdef CUDNN_5
+	cudnnTensorFormat_t fmt;
+	if (lErr = cudnnGetFilter4dDescriptor(filter, &type, &fmt, &pF[0], &pF[1], &pF[2], &pF[3]))
+		return lErr;
+	pF[4] = (int)fmt;
+#else
+	if (lErr = cudnnGetFilter4dDescriptor(filter, &type, &pF[0], &pF[1], &pF[2], &pF[3]))
+		return lErr;
+#endif
+
+	int* pC = pKey->rgConv;
+	cudnnConvolutionMode_t mode;
+#ifdef CUDNN_6
+	cudnnDataType_t computeType;
+	if (lErr = cudnnGetConvolution2dDescriptor(conv, &pC[0], &pC[1], &pC[2], &pC[3], &pC[4], &pC[5], &mode, &computeType))
+		return lErr;
+	pC[7] = (int)computeType;
+#else
+	if (lErr = cudnnGetConvolution2dDescriptor(conv, &pC[0], &pC[1], &pC[2], &pC[3], &pC[4], &pC[5], &mode))
+		return lErr;
+#endif
+	pC[6] = (int)mode;
+
+	return 0;
+}
+
+template long Memory<double>::getConvolutionKey(cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long lWsLimitInBytes, CONVALGO_KEY* pKey);
+template long Memory<float>::getConvolutionKey(cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long lWsLimitInBytes, CONVALGO_KEY* pKey);
+
+
+template <class T>
+long Memory<T>::selectConvolutionInfo(cudnnHandle_t cudnn, cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long lWsLimitInBytes, CONVALGO_VALUE* pVal)
+{
+	cudnnStatus_t err;
 
 	// Setup the algorithm preference.
 	cudnnConvolutionFwdPreference_t fwdPref = CUDNN_CONVOLUTION_FWD_SPECIFY_WORKSPACE_LIMIT;
@@ -623,12 +684,172 @@ long Memory<T>::GetConvolutionInfo(long hHandle, long hBottomDesc, long hFilterD
 	if (err = cudnnGetConvolutionBackwardDataWorkspaceSize(cudnn, filter, top, conv, bottom, algoBwdData, &szBwdData))
 		return err;
 
-	*palgoFwd = (long)algoFwd;
-	*plWsSizeFwd = (long)szFwd;
-	*palgoBwdFilter = (long)algoBwdFilter;
-	*plWsSizeBwdFilter = (long)szBwdFilter;
-	*palgoBwdData = (long)algoBwdData;
-	*plWsSizeBwdData = (long)szBwdData;
+	pVal->llAlgoFwd = (LONGLONG)algoFwd;
+	pVal->llWsSizeFwd = (LONGLONG)szFwd;
+	pVal->llAlgoBwdFilter = (LONGLONG)algoBwdFilter;
+	pVal->llWsSizeBwdFilter = (LONGLONG)szBwdFilter;
+	pVal->llAlgoBwdData = (LONGLONG)algoBwdData;
+	pVal->llWsSizeBwdData = (LONGLONG)szBwdData;
+
+	return cudaSuccess;
+}
+
+template long Memory<double>::selectConvolutionInfo(cudnnHandle_t cudnn, cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long lWsLimitInBytes, CONVALGO_VALUE* pVal);
+template long Memory<float>::selectConvolutionInfo(cudnnHandle_t cudnn, cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long lWsLimitInBytes, CONVALGO_VALUE* pVal);
+
+
+//-----------------------------------------------------------------------------
+//	Runs the convolution forward (src = bottom data, dst = top data) or
+//	backward data (src = top diff, dst = bottom diff) pass with the host
+//	Winograd engine, on host copies of the tensors.  Only 3x3 stride 1
+//	cross correlations of packed NCHW tensors are supported.
+//
+//	The weight is only read, so its version is left as is and the cached
+//	filter transform stays valid until the weight is next written.  Shared
+//	items and memory pointer handles are transformed on every call.
+//-----------------------------------------------------------------------------
+template <class T>
+long Memory<T>::convolutionHost(bool bBackward, T fAlpha, cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long hSrc, int nSrcOffset, long hWeight, int nWeightOffset, T fBeta, long hDst, int nDstOffset)
+{
+	LONG lErr;
+	CONVALGO_KEY geom;
+	MemoryItem* pSrc;
+	MemoryItem* pWeight;
+	MemoryItem* pDst;
+
+	if (lErr = getConvolutionKey(bottom, filter, conv, top, 0, &geom))
+		return lErr;
+
+	int* pB = geom.rgBottom;
+	int* pF = geom.rgFilter;
+	int* pC = geom.rgConv;
+	int* pT = geom.rgTop;
+	int nN = pB[0];
+	int nC = pB[1];
+	int nH = pB[2];
+	int nW = pB[3];
+	int nK = pF[0];
+
+	if (pF[1] != nC || pF[2] != 3 || pF[3] != 3 || pF[4] != (int)CUDNN_TENSOR_NCHW)
+		return ERROR_NOT_IMPLEMENTED;
+
+	if (pC[2] != 1 || pC[3] != 1 || pC[4] != 1 || pC[5] != 1 || pC[6] != (int)CUDNN_CROSS_CORRELATION)
+		return ERROR_NOT_IMPLEMENTED;
+
+	if (pT[0] != nN || pT[1] != nK || pT[2] != nH + 2 * pC[0] - 2 || pT[3] != nW + 2 * pC[1] - 2)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (pB[4] != nC * nH * nW || pB[5] != nH * nW || pB[6] != nW || pB[7] != 1 ||
+		pT[4] != nK * pT[2] * pT[3] || pT[5] != pT[2] * pT[3] || pT[6] != pT[3] || pT[7] != 1)
+		return ERROR_NOT_IMPLEMENTED;
+
+	if (lErr = m_memory.GetData(hSrc, &pSrc, false))
+		return lErr;
+
+	if (lErr = m_memory.GetData(hWeight, &pWeight, false))
+		return lErr;
+
+	if (lErr = m_memory.GetData(hDst, &pDst))
+		return lErr;
+
+	int nTile = Winograd<T>::GetTile();
+	size_t lBtmCount = (size_t)nN * nC * nH * nW;
+	size_t lTopCount = (size_t)nN * nK * pT[2] * pT[3];
+	size_t lSrcCount = (bBackward) ? lTopCount : lBtmCount;
+	size_t lDstCount = (bBackward) ? lBtmCount : lTopCount;
+	size_t lWtCount = (size_t)nK * nC * 9;
+	T* src = (T*)pSrc->Data() + nSrcOffset;
+	T* weight = (T*)pWeight->Data() + nWeightOffset;
+	T* dst = (T*)pDst->Data() + nDstOffset;
+
+	WINOGRAD_KEY key;
+	memset(&key, 0, sizeof(key));
+	key.hWeight = hWeight;
+	key.nWeightOffset = nWeightOffset;
+	key.nTile = nTile;
+	key.nBackward = (bBackward) ? 1 : 0;
+	key.nK = nK;
+	key.nC = nC;
+
+	bool bCache = (hWeight <= MAX_ITEMS && !pWeight->IsShared());
+	LONGLONG llVersion = pWeight->Version();
+	const T* u = (bCache) ? m_winograd.FindFilter(key, llVersion) : NULL;
+	std::vector<T> rgU;
+
+	if (u == NULL)
+	{
+		std::vector<T> rgW(lWtCount);
+
+		if (lErr = cudaMemcpy(rgW.data(), weight, lWtCount * sizeof(T), cudaMemcpyDeviceToHost))
+			return lErr;
+
+		if (bCache)
+		{
+			if ((u = m_winograd.AddFilter(key, llVersion, rgW.data())) == NULL)
+				return ERROR_PARAM_OUT_OF_RANGE;
+		}
+		else
+		{
+			if (lErr = Winograd<T>::TransformFilter(nTile, nK, nC, rgW.data(), bBackward, rgU))
+				return lErr;
+
+			u = rgU.data();
+		}
+	}
+
+	std::vector<T> rgSrc(lSrcCount);
+	std::vector<T> rgDst(lDstCount);
+
+	if (lErr = cudaMemcpy(rgSrc.data(), src, lSrcCount * sizeof(T), cudaMemcpyDeviceToHost))
+		return lErr;
+
+	if (fBeta != 0)
+	{
+		if (lErr = cudaMemcpy(rgDst.data(), dst, lDstCount * sizeof(T), cudaMemcpyDeviceToHost))
+			return lErr;
+	}
+
+	// The backward data pass is the forward pass of the top diff with the
+	// flipped and transposed filter, padded by 2 - pad.
+	if (!bBackward)
+		lErr = m_winograd.Forward(nTile, nN, nC, nH, nW, nK, pC[0], pC[1], pT[2], pT[3], fAlpha, rgSrc.data(), u, fBeta, rgDst.data());
+	else
+		lErr = m_winograd.Forward(nTile, nN, nK, pT[2], pT[3], nC, 2 - pC[0], 2 - pC[1], nH, nW, fAlpha, rgSrc.data(), u, fBeta, rgDst.data());
+
+	if (lErr)
+		return lErr;
+
+	return cudaMemcpy(dst, rgDst.data(), lDstCount * sizeof(T), cudaMemcpyHostToDevice);
+}
+
+template long Memory<double>::convolutionHost(bool bBackward, double fAlpha, cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long hSrc, int nSrcOffset, long hWeight, int nWeightOffset, double fBeta, long hDst, int nDstOffset);
+template long Memory<float>::convolutionHost(bool bBackward, float fAlpha, cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long hSrc, int nSrcOffset, long hWeight, int nWeightOffset, float fBeta, long hDst, int nDstOffset);
+
+
+template <class T>
+long Memory<T>::GetConvolutionInfo(long hHandle, long hBottomDesc, long hFilterDesc, long hConvDesc, long hTopDesc, long lWsLimitInBytes, long* palgoFwd, long* plWsSizeFwd, long* palgoBwdFilter, long* plWsSizeBwdFilter, long* palgoBwdData, long* plWsSizeBwdData)
+{
+	LONG lErr;
+	cudnnHandle_t cudnn = GetCuDNN(hHandle);
+	cudnnTensorDescriptor_t bottom = GetTensorDesc(hBottomDesc);
+	cudnnFilterDescriptor_t filter = GetFilterDesc(hFilterDesc);
+	cudnnConvolutionDescriptor_t conv = GetConvolutionDesc(hConvDesc);
+	cudnnTensorDescriptor_t top = GetTensorDesc(hTopDesc);
+	CONVALGO_KEY key;
+	CONVALGO_VALUE val;
+
+	if (lErr = getConvolutionKey(bottom, filter, conv, top, lWsLimitInBytes, &key))
+		return lErr;
+
+	if (lErr = g_convAlgoCache.Find(key, &val, [&](CONVALGO_VALUE* pVal) { return selectConvolutionInfo(cudnn, bottom, filter, conv, top, lWsLimitInBytes, pVal); }))
+		return lErr;
+
+	*palgoFwd = (long)val.llAlgoFwd;
+	*plWsSizeFwd = (long)val.llWsSizeFwd;
+	*palgoBwdFilter = (long)val.llAlgoBwdFilter;
+	*plWsSizeBwdFilter = (long)val.llWsSizeBwdFilter;
+	*palgoBwdData = (long)val.llAlgoBwdData;
+	*plWsSizeBwdData = (long)val.llWsSizeBwdData;
 
 	return cudaSuccess;
 }
@@ -651,6 +872,9 @@ long Memory<T>::ConvolutionForward(long hHandle, T fAlpha, long hBottomDesc, lon
 	MemoryItem* pWeight;
 	MemoryItem* pWorkspace = NULL;
 
+	if (algo == CONV_ALGO_HOST_WINOGRAD)
+		return convolutionHost(false, fAlpha, btmdesc, filterdesc, convdesc, topdesc, hBottomData, nBottomOffset, hWeight, nWeightOffset, fBeta, hTopData, nTopOffset);
+
 	if (lErr = m_memory.GetData(hBottomData, &pBtmData))
 		return lErr;
 
@@ -808,6 +1032,9 @@ long Memory<T>::ConvolutionBackwardData(long hHandle, T fAlpha, long hFilterDesc
 	MemoryItem* pBtmDiff;
 	MemoryItem* pWorkspace = NULL;
 
+	if (algo == CONV_ALGO_HOST_WINOGRAD)
+		return convolutionHost(true, fAlpha, btmdesc, filterdesc, convdesc, topdesc, hTopDiff, nTopOffset, hWeight, nWeightOffset, fBeta, hBottomDiff, nBottomOffset);
+
 	if (lErr = m_memory.GetData(hWeight, &pWeight))
 		return lErr;
 
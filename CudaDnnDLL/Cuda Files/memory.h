@@ -9,11 +9,16 @@
 #include "util.h"
 #include "handlecol.h"
 #include "memorycol.h"
+#include "alloctrack.h"
+#include "convalgo.h"
+#include "streampool.h"
 #include "memtest.h"
 #include "pca.h"
 #include "tsne_gp.h"
 #include "tsne_g.h"
 #include "nccl.h"
+#include "modelavg.h"
+#include "winograd.h"
 #include <vector>
 #include <algorithm>
 
@@ -47,12 +52,70 @@ enum ActivationMethod
 //	Classes
 //=============================================================================
 
+//-----------------------------------------------------------------------------
+//	The destination stream and the events of the pipelined copy staged
+//	through a host buffer from one device to another.  The staged events
+//	belong to the source device, the stream and the free events to the
+//	destination device.
+//-----------------------------------------------------------------------------
+struct HostStaging
+{
+	int nSrcDeviceID;
+	int nDstDeviceID;
+	cudaStream_t streamDst;
+	cudaEvent_t rgevtStaged[2];
+	cudaEvent_t rgevtFree[2];
+};
+
 template <class T>
 class HostBuffer
 {
 	private:
 		long m_lCount;
 		T* m_pMemory;
+		std::vector<HostStaging> m_rgStaging;
+
+		long createStaging(int nSrcDeviceID, int nDstDeviceID, HostStaging* pStaging)
+		{
+			LONG lErr;
+
+			memset(pStaging, 0, sizeof(HostStaging));
+			pStaging->nSrcDeviceID = nSrcDeviceID;
+			pStaging->nDstDeviceID = nDstDeviceID;
+
+			for (int i = 0; i < 2; i++)
+			{
+				if (lErr = cudaSetDevice(nSrcDeviceID))
+					return lErr;
+
+				if (lErr = cudaEventCreateWithFlags(&pStaging->rgevtStaged[i], cudaEventDisableTiming))
+					return lErr;
+
+				if (lErr = cudaSetDevice(nDstDeviceID))
+					return lErr;
+
+				if (lErr = cudaEventCreateWithFlags(&pStaging->rgevtFree[i], cudaEventDisableTiming))
+					return lErr;
+			}
+
+			return cudaStreamCreateWithFlags(&pStaging->streamDst, cudaStreamNonBlocking);
+		}
+
+		void freeStaging(HostStaging* pStaging)
+		{
+			// Streams and events with pending work are released once it completes.
+			if (pStaging->streamDst != NULL)
+				cudaStreamDestroy(pStaging->streamDst);
+
+			for (int i = 0; i < 2; i++)
+			{
+				if (pStaging->rgevtStaged[i] != NULL)
+					cudaEventDestroy(pStaging->rgevtStaged[i]);
+
+				if (pStaging->rgevtFree[i] != NULL)
+					cudaEventDestroy(pStaging->rgevtFree[i]);
+			}
+		}
 
 	public:
 		HostBuffer(T* pMem, long lCount)
@@ -61,6 +124,14 @@ class HostBuffer
 			m_lCount = lCount;
 		}
 
+		~HostBuffer()
+		{
+			for (size_t i = 0; i < m_rgStaging.size(); i++)
+			{
+				freeStaging(&m_rgStaging[i]);
+			}
+		}
+
 		T* Data()
 		{
 			return m_pMemory;
@@ -70,6 +141,38 @@ class HostBuffer
 		{
 			return m_lCount;
 		}
+
+		//---------------------------------------------------------------------
+		//	Returns the staging stream and events of the device pair, which
+		//	are created on the first copy between the two and kept with the
+		//	buffer.  The current device may be changed.
+		//---------------------------------------------------------------------
+		long GetStaging(int nSrcDeviceID, int nDstDeviceID, HostStaging** ppStaging)
+		{
+			LONG lErr;
+
+			for (size_t i = 0; i < m_rgStaging.size(); i++)
+			{
+				if (m_rgStaging[i].nSrcDeviceID == nSrcDeviceID && m_rgStaging[i].nDstDeviceID == nDstDeviceID)
+				{
+					*ppStaging = &m_rgStaging[i];
+					return 0;
+				}
+			}
+
+			HostStaging staging;
+
+			if (lErr = createStaging(nSrcDeviceID, nDstDeviceID, &staging))
+			{
+				freeStaging(&staging);
+				return lErr;
+			}
+
+			m_rgStaging.push_back(staging);
+			*ppStaging = &m_rgStaging.back();
+
+			return 0;
+		}
 };
 
 
@@ -85,6 +188,8 @@ class Memory
 		std::vector<HostBuffer<T>*> m_rgActiveHostBuffers;
 		MemoryCollection m_memory;
 		MemoryCollection m_memoryPointers;
+		AllocTracker m_allocTracker;
+		StreamPool m_streamPool;
 		HandleCollection<MAX_HANDLES> m_hostbuffers;
 		HandleCollection<MAX_HANDLES> m_streams;
 		HandleCollection<MAX_HANDLES> m_tensorDesc;
@@ -98,6 +203,8 @@ class Memory
 		HandleCollection<MIN_HANDLES> m_tsneg;
 		HandleCollection<MIN_HANDLES> m_memtest;
 		HandleCollection<MIN_HANDLES> m_nccl;
+		HandleCollection<MIN_HANDLES> m_modelavg;
+		Winograd<T> m_winograd;
 		T m_tOne;
 		T m_tZero;
 #ifdef CUDNN_5
@@ -108,6 +215,10 @@ class Memory
 		long m_hGlobalActivationTanh;
 #endif
 
+		long getConvolutionKey(cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long lWsLimitInBytes, CONVALGO_KEY* pKey);
+		long selectConvolutionInfo(cudnnHandle_t cudnn, cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long lWsLimitInBytes, CONVALGO_VALUE* pVal);
+		long convolutionHost(bool bBackward, T fAlpha, cudnnTensorDescriptor_t bottom, cudnnFilterDescriptor_t filter, cudnnConvolutionDescriptor_t conv, cudnnTensorDescriptor_t top, long hSrc, int nSrcOffset, long hWeight, int nWeightOffset, T fBeta, long hDst, int nDstOffset);
+
 	public:
 		Memory();
 		~Memory();
@@ -122,12 +233,24 @@ class Memory
 			return &m_streams;
 		}
 
+		AllocTracker* GetAllocTracker()
+		{
+			return &m_allocTracker;
+		}
+
+		StreamPool* GetStreamPool()
+		{
+			return &m_streamPool;
+		}
+
 		long CheckMemoryAttributes(long hSrc, int nSrcDeviceID, long hDst, int nDstDeviceID, bool* pbResult);
 		long GetDeviceMemory(int nDeviceID, T* plTotal, T* plFree, T* plUsed, bool* pbEstimate);
 
 		long AllocMemory(int nDeviceID, long lCount, T* pSrc, long hStream, long* phHandle);
 		long FreeMemory(long hHandle);
-		long GetMemory(long hHandle, MemoryItem** ppItem);
+		long GetMemory(long hHandle, MemoryItem** ppItem, bool bWrite = true);
+		long GetSharedMemory(long hHandle, MemoryItem** ppItem);
+		long ReadMemory(long hHandle, long lCount, T* pDst);
 		long SetMemory(long hHandle, T* pSrc, long lCount, long hStream);
 		long SetMemoryAt(long hHandle, T* pSrc, long lCount, int nOffset);
 
@@ -241,10 +364,13 @@ class Memory
 		long ComputeTsneGradient(long hHandle, bool bValPUpdated);
 		long EvaluateTsneError(long hHandle, T* fErr);
 
-		long CreateMemoryTest(T pfPctToAllocate, long* phHandle, size_t* pszTotalNumBlocks, T* pfMemAllocated, T* pfMemStartAddr, T* pfMemBlockSize);
+		long CreateMemoryTest(T pfPctToAllocate, bool bHost, long* phHandle, size_t* pszTotalNumBlocks, T* pfMemAllocated, T* pfMemStartAddr, T* pfMemBlockSize);
 		long FreeMemoryTest(long hHandle);
 		memtestHandle<T>* GetMemoryTest(long hHandle);
 		long RunMemoryTest(long hHandle, MEMTEST_TYPE memTestType, size_t szStartOffset, size_t szCount, long* plCount, T** ppfData, bool bVerbose, bool bWrite, bool bReadWrite, bool bRead);
+		long StartMemoryTestScrub(long hHandle, MEMTEST_TYPE memTestType, int nMsPerSec, T fMBPerSec, size_t szBlocksPerSlice, size_t szStartBlock, int nPasses);
+		long StopMemoryTestScrub(long hHandle);
+		long GetMemoryTestScrubStatus(long hHandle, T* rgStatus, int nCount);
 
 		long CreateNCCL(int nGpuID, int nCount, int nRank, char* szId, Math<T>* pMath, long* phHandle);
 		long FreeNCCL(long hHandle);
@@ -254,6 +380,20 @@ class Memory
 		long NcclInitMultiProcess(long lBufferCount, long hNccl);
 		long NcclBroadcast(long hNccl, long hStream, long hX, int nCount);
 		long NcclAllReduce(long hNccl, long hStream, long hX, int nCount, NCCL_OP op, T fScale);
+		long NcclSetBuckets(long hNccl, long lBucketSizeInBytes, NCCL_OP op, T fScale, int nCount, long* rghGrad, long* rglGradCount, int* pnBucketCount);
+		long NcclMarkReady(long hNccl, long hStream, int nIdx);
+		long NcclAllReduceBuckets(long hNccl, long hStream);
+		long NcclSetCompression(long hNccl, NCCL_COMPRESSION type, double dfParam);
+		long NcclGetCompressionStats(long hNccl, T* rgStats, int nCount);
+		long NcclInitHierarchical(long lBufferCount, long rgNcclHandle[], int* rgGroupId, int nCount, int* pnGroups);
+
+		long CreateModelAvg(int nCount, int nWorkers, int nMaxStaleness, int nQueueDepth, long hInitialWeights, T* rgfWeight, Math<T>* pMath, long* phHandle);
+		long FreeModelAvg(long hHandle);
+		modelAvgHandle<T>* GetModelAvg(long hHandle);
+		long ModelAvgPush(long hHandle, long hStream, int nWorker, long hDelta, long lBaseVersion, bool* pbAccepted);
+		long ModelAvgPull(long hHandle, long hStream, long hDst, long* plVersion);
+		long ModelAvgSetWeight(long hHandle, int nWorker, T fWeight);
+		long ModelAvgGetStats(long hHandle, T* rgStats, int nCount);
 };
 
 
@@ -319,6 +459,14 @@ long Memory<T>::CreateMemoryPointer(long hData, long lOffset, long lCount, long*
 	if (lErr = m_memoryPointers.Allocate(pData->DeviceID(), data, lSize, &hHandle))
 		return lErr;
 
+	// Writes through the pointer bump the version of the item it points into.
+	MemoryItem* pPtr = NULL;
+
+	if (lErr = m_memoryPointers.GetData(hHandle, &pPtr, false))
+		return lErr;
+
+	pPtr->SetParent((hData > MAX_ITEMS) ? pData->Parent() : hData);
+
 	// Move the handle into the range [MAX_HANDLES, MAX_HANDLES*2]
 	// to indicate that it is a memory pointer reference.
 	hHandle += MAX_ITEMS;
@@ -343,20 +491,50 @@ inline long Memory<T>::AllocMemory(int nDeviceID, long lCount, T* pSrc, long hSt
 		pStream = (cudaStream_t)m_streams.GetData(hStream);
 
 	long lSize = m_memory.GetSize(lCount, sizeof(T));
+	LONG lErr = m_memory.Allocate(nDeviceID, lSize, pSrc, pStream, phHandle);
 
-	return m_memory.Allocate(nDeviceID, lSize, pSrc, pStream, phHandle);
+	if (!lErr && m_allocTracker.IsEnabled())
+		m_allocTracker.OnAlloc(*phHandle, lSize);
+
+	return lErr;
 }
 
 template <class T>
 inline long Memory<T>::FreeMemory(long hHandle)
 {
+	if (m_allocTracker.IsEnabled())
+		m_allocTracker.OnFree(hHandle);
+
 	return m_memory.Free(hHandle);
 }
 
 template <class T>
-inline long Memory<T>::GetMemory(long hHandle, MemoryItem** ppItem)
+inline long Memory<T>::GetMemory(long hHandle, MemoryItem** ppItem, bool bWrite)
+{
+	return m_memory.GetData(hHandle, ppItem, bWrite);
+}
+
+//-----------------------------------------------------------------------------
+//	Used by the owners that keep the device pointer across calls, the writes
+//	made through it cannot be seen so the item is no longer mirrored.
+//-----------------------------------------------------------------------------
+template <class T>
+inline long Memory<T>::GetSharedMemory(long hHandle, MemoryItem** ppItem)
+{
+	LONG lErr;
+
+	if (lErr = m_memory.GetData(hHandle, ppItem))
+		return lErr;
+
+	(*ppItem)->Share();
+
+	return 0;
+}
+
+template <class T>
+inline long Memory<T>::ReadMemory(long hHandle, long lCount, T* pDst)
 {
-	return m_memory.GetData(hHandle, ppItem);
+	return m_memory.GetDataToHost(hHandle, lCount * sizeof(T), pDst);
 }
 
 template <class T>
@@ -364,14 +542,20 @@ inline T* Memory<T>::GetMemoryToHost(long hHandle, long* plCount)
 {
 	MemoryItem *pItem;
 
-	if (m_memory.GetData(hHandle, &pItem))
+	if (m_memory.GetData(hHandle, &pItem, false))
 		return NULL;
 
 	T* pHost = NULL;
 	long lCount = pItem->Size() / sizeof(T);
 
-	if (AllocHost(lCount, &pHost, (T*)pItem->Data(), TRUE))
+	if (AllocHost(lCount, &pHost, NULL, false))
+		return NULL;
+
+	if (ReadMemory(hHandle, lCount, pHost))
+	{
+		FreeHost(pHost);
 		return NULL;
+	}
 
 	if (plCount != NULL)
 		*plCount = lCount;
@@ -385,12 +569,12 @@ inline long Memory<T>::SetMemoryToHost(long hHandle, T* pDst)
 	LONG lErr;
 	MemoryItem *pItem;
 
-	if (lErr = m_memory.GetData(hHandle, &pItem))
+	if (lErr = m_memory.GetData(hHandle, &pItem, false))
 		return lErr;
 
 	long lSize = pItem->Size();
 
-	return pItem->GetData(lSize, pDst);
+	return m_memory.GetDataToHost(hHandle, lSize, pDst);
 }
 
 template <class T>
@@ -479,7 +663,12 @@ inline long Memory<T>::SynchronizeStream(long hHandle)
 	if (hHandle > 0)
 		h = (cudaStream_t)m_streams.GetData(hHandle);
 
-	return cudaStreamSynchronize(h);
+	TraceScope trace("cudaStreamSynchronize", TRACE_CAT_SYNC, hHandle);
+
+	LONG lErr = cudaStreamSynchronize(h);
+	m_memory.InvalidateMirrors();
+
+	return lErr;
 }
 
 template <class T>
@@ -712,6 +901,101 @@ inline cudnnDropoutDescriptor_t Memory<T>::GetDropoutDesc(long hHandle)
 #endif // CUDNN_5
 
 
+template <class T>
+inline long Memory<T>::CreateModelAvg(int nCount, int nWorkers, int nMaxStaleness, int nQueueDepth, long hInitialWeights, T* rgfWeight, Math<T>* pMath, long* phHandle)
+{
+	LONG lErr;
+	modelAvgHandle<T>* avg = NULL;
+
+	if (phHandle == NULL)
+		return ERROR_PARAM_NULL;
+
+	if ((avg = new modelAvgHandle<T>(nCount, nWorkers, nMaxStaleness, nQueueDepth)) == NULL)
+		return ERROR_MEMORY_OUT;
+
+	if (lErr = avg->Initialize(this, pMath, hInitialWeights, rgfWeight))
+	{
+		delete avg;
+		return lErr;
+	}
+
+	long hHandle = m_modelavg.Allocate(avg);
+	if (hHandle < 0)
+	{
+		avg->CleanUp();
+		delete avg;
+		return ERROR_MEMORY_OUT;
+	}
+
+	*phHandle = hHandle;
+	return 0;
+}
+
+template <class T>
+inline long Memory<T>::FreeModelAvg(long hHandle)
+{
+	modelAvgHandle<T>* avg = (modelAvgHandle<T>*)m_modelavg.Free(hHandle);
+
+	if (avg != NULL)
+	{
+		avg->CleanUp();
+		delete avg;
+	}
+
+	return 0;
+}
+
+template <class T>
+inline modelAvgHandle<T>* Memory<T>::GetModelAvg(long hHandle)
+{
+	return (modelAvgHandle<T>*)m_modelavg.GetData(hHandle);
+}
+
+template <class T>
+inline long Memory<T>::ModelAvgPush(long hHandle, long hStream, int nWorker, long hDelta, long lBaseVersion, bool* pbAccepted)
+{
+	modelAvgHandle<T>* avg = GetModelAvg(hHandle);
+
+	if (avg == NULL)
+		return ERROR_PARAM_NULL;
+
+	return avg->Push(hStream, nWorker, hDelta, lBaseVersion, pbAccepted);
+}
+
+template <class T>
+inline long Memory<T>::ModelAvgPull(long hHandle, long hStream, long hDst, long* plVersion)
+{
+	modelAvgHandle<T>* avg = GetModelAvg(hHandle);
+
+	if (avg == NULL)
+		return ERROR_PARAM_NULL;
+
+	return avg->Pull(hStream, hDst, plVersion);
+}
+
+template <class T>
+inline long Memory<T>::ModelAvgSetWeight(long hHandle, int nWorker, T fWeight)
+{
+	modelAvgHandle<T>* avg = GetModelAvg(hHandle);
+
+	if (avg == NULL)
+		return ERROR_PARAM_NULL;
+
+	return avg->SetWeight(nWorker, fWeight);
+}
+
+template <class T>
+inline long Memory<T>::ModelAvgGetStats(long hHandle, T* rgStats, int nCount)
+{
+	modelAvgHandle<T>* avg = GetModelAvg(hHandle);
+
+	if (avg == NULL)
+		return ERROR_PARAM_NULL;
+
+	return avg->GetStats(rgStats, nCount);
+}
+
+
 template <class T>
 inline long Memory<T>::CreatePCA(int nMaxIterations, int nM, int nN, int nK, long hData, long hScoresResult, long hLoadsResult, long hResiduals, long hEigenvalues, Math<T>* pMath, long* phHandle)
 {
@@ -907,7 +1191,7 @@ inline long Memory<T>::EvaluateTsneError(long hHandle, T* pfErr)
 
 
 template <class T>
-inline long Memory<T>::CreateMemoryTest(T fPctToAllocate, long* phHandle, size_t* pszTotalNumBlocks, T* pfMemAllocated, T* pfMemStartAddr, T* pfMemBlockSize)
+inline long Memory<T>::CreateMemoryTest(T fPctToAllocate, bool bHost, long* phHandle, size_t* pszTotalNumBlocks, T* pfMemAllocated, T* pfMemStartAddr, T* pfMemBlockSize)
 {
 	LONG lErr;
 	memtestHandle<T>* memtest = NULL;
@@ -918,7 +1202,7 @@ inline long Memory<T>::CreateMemoryTest(T fPctToAllocate, long* phHandle, size_t
 	if ((memtest = new memtestHandle<T>()) == NULL)
 		return ERROR_MEMORY_OUT;
 
-	if (lErr = memtest->Initialize(this, fPctToAllocate, pszTotalNumBlocks, pfMemAllocated, pfMemStartAddr, pfMemBlockSize))
+	if (lErr = memtest->Initialize(this, fPctToAllocate, bHost, pszTotalNumBlocks, pfMemAllocated, pfMemStartAddr, pfMemBlockSize))
 	{
 		delete memtest;
 		return lErr;
@@ -966,6 +1250,39 @@ inline long Memory<T>::RunMemoryTest(long hHandle, MEMTEST_TYPE memtestType, siz
 	return memtest->Run(memtestType, szStartOffset, szCount, plCount, ppfData, bVerbose, bWrite, bReadWrite, bRead);
 }
 
+template <class T>
+inline long Memory<T>::StartMemoryTestScrub(long hHandle, MEMTEST_TYPE memtestType, int nMsPerSec, T fMBPerSec, size_t szBlocksPerSlice, size_t szStartBlock, int nPasses)
+{
+	memtestHandle<T>* memtest = GetMemoryTest(hHandle);
+
+	if (memtest == NULL)
+		return ERROR_PARAM_NULL;
+
+	return memtest->StartScrub(memtestType, nMsPerSec, fMBPerSec, szBlocksPerSlice, szStartBlock, nPasses);
+}
+
+template <class T>
+inline long Memory<T>::StopMemoryTestScrub(long hHandle)
+{
+	memtestHandle<T>* memtest = GetMemoryTest(hHandle);
+
+	if (memtest == NULL)
+		return ERROR_PARAM_NULL;
+
+	return memtest->StopScrub();
+}
+
+template <class T>
+inline long Memory<T>::GetMemoryTestScrubStatus(long hHandle, T* rgStatus, int nCount)
+{
+	memtestHandle<T>* memtest = GetMemoryTest(hHandle);
+
+	if (memtest == NULL)
+		return ERROR_PARAM_NULL;
+
+	return memtest->GetScrubStatus(rgStatus, nCount);
+}
+
 
 template <class T>
 inline long Memory<T>::CreateNCCL(int nGpuID, int nCount, int nRank, char* szId, Math<T>* pMath, long* phHandle)
@@ -1050,6 +1367,24 @@ long Memory<T>::NcclInitSingleProcess(long lBufferCount, long rgNcclHandle[], in
 	return lErr;
 }
 
+template <class T>
+long Memory<T>::NcclInitHierarchical(long lBufferCount, long rgNcclHandle[], int* rgGroupId, int nCount, int* pnGroups)
+{
+	ncclHandle<T>** rgNccl = new ncclHandle<T>*[nCount];
+	if (rgNccl == NULL)
+		return ERROR_MEMORY_OUT;
+
+	for (int i = 0; i < nCount; i++)
+	{
+		rgNccl[i] = GetNCCL(rgNcclHandle[i]);
+	}
+
+	LONG lErr = rgNccl[0]->InitHierarchical(lBufferCount, nCount, rgNccl, rgGroupId, pnGroups);
+	delete rgNccl;
+
+	return lErr;
+}
+
 template <class T>
 long Memory<T>::NcclInitMultiProcess(long lBufferCount, long hNccl)
 {
@@ -1068,4 +1403,34 @@ inline long Memory<T>::NcclAllReduce(long hNccl, long hStream, long hX, int nCou
 	return GetNCCL(hNccl)->AllReduce(hStream, hX, nCount, op, fScale);
 }
 
+template <class T>
+inline long Memory<T>::NcclSetBuckets(long hNccl, long lBucketSizeInBytes, NCCL_OP op, T fScale, int nCount, long* rghGrad, long* rglGradCount, int* pnBucketCount)
+{
+	return GetNCCL(hNccl)->SetBuckets(lBucketSizeInBytes, op, fScale, nCount, rghGrad, rglGradCount, pnBucketCount);
+}
+
+template <class T>
+inline long Memory<T>::NcclMarkReady(long hNccl, long hStream, int nIdx)
+{
+	return GetNCCL(hNccl)->MarkReady(hStream, nIdx);
+}
+
+template <class T>
+inline long Memory<T>::NcclAllReduceBuckets(long hNccl, long hStream)
+{
+	return GetNCCL(hNccl)->AllReduceBuckets(hStream);
+}
+
+template <class T>
+inline long Memory<T>::NcclSetCompression(long hNccl, NCCL_COMPRESSION type, double dfParam)
+{
+	return GetNCCL(hNccl)->SetCompression(type, dfParam);
+}
+
+template <class T>
+inline long Memory<T>::NcclGetCompressionStats(long hNccl, T* rgStats, int nCount)
+{
+	return GetNCCL(hNccl)->GetCompressionStats(rgStats, nCount);
+}
+
 #endif // __MEMORY_CU__
\ No newline at end of file
@@ -108,5 +108,80 @@ long MemoryCollection::Free(long hHandle)
 	return m_rgHandles[hHandle].Free();
 }
 
+long MemoryItem::GetDataMirrored(long lSize, void* pDst, LONGLONG llAliasVersion, bool* pbHit)
+{
+	LONG lErr;
+
+	*pbHit = false;
+
+	if (pDst == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (m_pData == NULL)
+		return ERROR_MEMORY_OUT;
+
+	if (lSize <= 0 || lSize > m_lSize)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (m_bShared)
+		return GetData(lSize, pDst);
+
+	if (m_pMirror != NULL && lSize <= m_lMirrorSize && m_llMirrorVersion == m_llVersion && m_llMirrorAliasVersion == llAliasVersion)
+	{
+		memcpy(pDst, m_pMirror, lSize);
+		*pbHit = true;
+		return 0;
+	}
+
+	// The mirror buffer is sized for the whole item, when it cannot be
+	// allocated the data is read without being mirrored.
+	if (m_pMirror == NULL)
+	{
+		if (cudaMallocHost(&m_pMirror, m_lSize) != cudaSuccess)
+		{
+			m_pMirror = NULL;
+			return GetData(lSize, pDst);
+		}
+	}
+
+	if (lErr = GetData(lSize, m_pMirror))
+	{
+		FreeMirror();
+		return lErr;
+	}
+
+	m_lMirrorSize = lSize;
+	m_llMirrorVersion = m_llVersion;
+	m_llMirrorAliasVersion = llAliasVersion;
+	memcpy(pDst, m_pMirror, lSize);
+
+	return 0;
+}
+
+void MemoryCollection::EnableMirrorFromEnvironment()
+{
+	char szValue[16];
+
+	DWORD dwLen = GetEnvironmentVariableA(HOSTMIRROR_ENV, szValue, 15);
+	if (dwLen == 0 || dwLen >= 15)
+		return;
+
+	EnableMirror((strcmp(szValue, "0") != 0) ? true : false);
+}
+
+void MemoryCollection::GetMirrorStats(LONGLONG* pllHits, LONGLONG* pllMisses, LONGLONG* pllBytes)
+{
+	LONGLONG llBytes = 0;
+
+	for (int i=0; i<MAX_ITEMS; i++)
+	{
+		llBytes += m_rgHandles[i].MirrorSize();
+	}
+
+	*pllHits = m_llMirrorHits;
+	*pllMisses = m_llMirrorMisses;
+	*pllBytes = llBytes;
+}
+
 
 //end memorycol.cu
\ No newline at end of file
@@ -8,6 +8,7 @@
 #define __MEMORYCOL_CU__
 
 #include "util.h"
+#include "tracer.h"
 
 
 //=============================================================================
@@ -16,8 +17,15 @@
 
 const int MAX_ITEMS = 4096 * 4;
 
+const LPCSTR HOSTMIRROR_ENV = "MYCAFFE_HOST_MIRROR";
+
 //-----------------------------------------------------------------------------
 //	MemoryItem class
+//
+//	Each item keeps a version that is bumped on every access that may write
+//	to it, and optionally a host mirror of its data tagged with the version
+//	it was read at.  Items whose device pointer is held across calls (see
+//	Share) are never mirrored, for their writes cannot be seen.
 //-----------------------------------------------------------------------------
 class MemoryItem
 {
@@ -26,6 +34,13 @@ class MemoryItem
 		long m_lSize;
 		int m_nDeviceID;
 		bool m_bOwner;
+		bool m_bShared;
+		LONGLONG m_llVersion;
+		void* m_pMirror;
+		long m_lMirrorSize;
+		LONGLONG m_llMirrorVersion;
+		LONGLONG m_llMirrorAliasVersion;
+		long m_hParent;
 
 	public:
 		MemoryItem()
@@ -34,6 +49,13 @@ class MemoryItem
 			m_pData = NULL;
 			m_lSize = 0;
 			m_nDeviceID = -1;
+			m_bShared = false;
+			m_llVersion = 0;
+			m_pMirror = NULL;
+			m_lMirrorSize = 0;
+			m_llMirrorVersion = 0;
+			m_llMirrorAliasVersion = 0;
+			m_hParent = 0;
 		}
 
 		~MemoryItem()
@@ -64,6 +86,54 @@ class MemoryItem
 			return m_nDeviceID;
 		}
 
+		void Touch()
+		{
+			m_llVersion++;
+		}
+
+		LONGLONG Version()
+		{
+			return m_llVersion;
+		}
+
+		void SetParent(long hParent)
+		{
+			m_hParent = hParent;
+		}
+
+		long Parent()
+		{
+			return m_hParent;
+		}
+
+		bool IsShared()
+		{
+			return m_bShared;
+		}
+
+		void Share()
+		{
+			m_bShared = true;
+			FreeMirror();
+		}
+
+		long MirrorSize()
+		{
+			return (m_pMirror != NULL) ? m_lSize : 0;
+		}
+
+		void FreeMirror()
+		{
+			if (m_pMirror != NULL)
+			{
+				cudaFreeHost(m_pMirror);
+				m_pMirror = NULL;
+				m_lMirrorSize = 0;
+			}
+		}
+
+		long GetDataMirrored(long lSize, void* pDst, LONGLONG llAliasVersion, bool* pbHit);
+
 		long Allocate(int nDeviceID, long lSize, void* pSrc = NULL, cudaStream_t pStream = NULL)
 		{
 			if (lSize == 0)
@@ -112,6 +182,11 @@ class MemoryItem
 
 		long Free()
 		{
+			FreeMirror();
+			m_bShared = false;
+			m_llVersion++;
+			m_hParent = 0;
+
 			if (m_pData != NULL)
 			{
 				if (m_bOwner)
@@ -134,6 +209,8 @@ class MemoryItem
 			if (lSize <= 0 || lSize > m_lSize)
 				return ERROR_PARAM_OUT_OF_RANGE;
 
+			TraceScope trace("GetData", TRACE_CAT_COPY_D2H, 0, 0, lSize);
+
 			return cudaMemcpy(pDst, m_pData, lSize, cudaMemcpyDeviceToHost);
 		}
 
@@ -154,6 +231,10 @@ class MemoryItem
 			if (lSize > m_lSize)
 				return ERROR_PARAM_OUT_OF_RANGE;
 
+			TraceScope trace("SetData", TRACE_CAT_COPY_H2D, 0, 0, lSize);
+
+			Touch();
+
 			if (lSize < m_lSize)
 				cudaMemset(m_pData, 0, m_lSize);
 
@@ -179,6 +260,8 @@ class MemoryItem
 
 			byte* pData = ((byte*)m_pData) + nOffsetInBytes;
 
+			Touch();
+
 			return cudaMemcpy(pData, pSrc, lSize, cudaMemcpyHostToDevice);
 		}
 
@@ -192,6 +275,8 @@ class MemoryItem
 			if (m_lSize == 0)
 				return ERROR_MEMORY_OUT;
 
+			Touch();
+
 			if (lErr = cudaMemset(m_pData, nVal, m_lSize))
 				return lErr;
 
@@ -212,6 +297,19 @@ class MemoryItem
 //	HandleCollection Class
 //
 //	The HandleCollection class manages a set of generic handles.
+//
+//	Every handed out item is assumed to be written, for the kernels taking
+//	the handle may write through its device pointer, so GetData bumps the
+//	item version unless the caller only reads it.  Writes through the memory
+//	pointer handles also bump the version of the item they point into, and
+//	the alias version, as the other items they may overlap are not known.  When the host mirror is enabled, GetDataToHost
+//	returns the mirrored copy of an item while both versions are unchanged.
+//
+//	The item version is bumped when the device pointer is handed out, not
+//	when the write finishes, so a read made while a write is still running
+//	on another stream may mirror partial data.  InvalidateMirrors is called
+//	on each stream and device synchronize so that such a copy is not used
+//	once the write is known to be done.
 //-----------------------------------------------------------------------------
 class MemoryCollection
 {
@@ -220,6 +318,10 @@ class MemoryCollection
 		MemoryItem m_rgHandles[MAX_ITEMS];
 		long m_nLastIdx;
 		unsigned long m_lTotalMem;
+		bool m_bMirror;
+		LONGLONG m_llAliasVersion;
+		LONGLONG m_llMirrorHits;
+		LONGLONG m_llMirrorMisses;
 
 	public:
 		MemoryCollection();
@@ -241,11 +343,27 @@ class MemoryCollection
 		long Allocate(int nDeviceID, long lSize, void* pSrc, cudaStream_t pStream, long* phHandle);
 		long Allocate(int nDeviceID, void* pData, long lSize, long* phHandle);
 		long Free(long hHandle);
-		long GetData(long hHandle, MemoryItem** ppItem);
+		long GetData(long hHandle, MemoryItem** ppItem, bool bWrite = true);
+		long GetDataToHost(long hHandle, long lSize, void* pDst);
 		long SetData(long hHandle, long lSize, void* pSrc, cudaStream_t pStream);
 		long SetDataAt(long hHandle, long lSize, void* pSrc, int nOffsetInBytes);
 		long GetCount();
 		unsigned long GetTotalUsed();
+		void TouchParent(MemoryItem* pAlias);
+
+		LONGLONG GetAliasVersion()
+		{
+			return m_llAliasVersion;
+		}
+
+		void InvalidateMirrors()
+		{
+			m_llAliasVersion++;
+		}
+
+		void EnableMirror(bool bEnable);
+		void EnableMirrorFromEnvironment();
+		void GetMirrorStats(LONGLONG* pllHits, LONGLONG* pllMisses, LONGLONG* pllBytes);
 };
 
 
@@ -260,6 +378,10 @@ inline MemoryCollection::MemoryCollection()
 	// Skip 0 index, so that this handle can be treated as NULL.
 	m_nLastIdx = 1;
 	m_lTotalMem = 0;
+	m_bMirror = false;
+	m_llAliasVersion = 0;
+	m_llMirrorHits = 0;
+	m_llMirrorMisses = 0;
 }
 
 inline long MemoryCollection::GetCount()
@@ -267,7 +389,7 @@ inline long MemoryCollection::GetCount()
 	return MAX_ITEMS;
 }
 
-inline long MemoryCollection::GetData(long hHandle, MemoryItem** ppItem)
+inline long MemoryCollection::GetData(long hHandle, MemoryItem** ppItem, bool bWrite)
 {
 	if (hHandle < 1 || hHandle >= MAX_ITEMS * 2)
 		return ERROR_PARAM_OUT_OF_RANGE;
@@ -287,13 +409,46 @@ inline long MemoryCollection::GetData(long hHandle, MemoryItem** ppItem)
 
 		LONG lErr;
 
-		if (lErr = m_pMemPtrs->GetData(hHandle - MAX_ITEMS, ppItem))
+		if (lErr = m_pMemPtrs->GetData(hHandle - MAX_ITEMS, ppItem, bWrite))
 			return lErr;
 
+		if (bWrite)
+			TouchParent(*ppItem);
+
 		return 0;
 	}
 
 	*ppItem = &m_rgHandles[hHandle];
+
+	if (bWrite)
+		m_rgHandles[hHandle].Touch();
+
+	return 0;
+}
+
+inline long MemoryCollection::GetDataToHost(long hHandle, long lSize, void* pDst)
+{
+	LONG lErr;
+	MemoryItem* pItem;
+
+	if (lErr = GetData(hHandle, &pItem, false))
+		return lErr;
+
+	// The memory pointers are not mirrored, for any write to the items they
+	// point into would not be seen.
+	if (!m_bMirror || hHandle > MAX_ITEMS)
+		return pItem->GetData(lSize, pDst);
+
+	bool bHit;
+
+	if (lErr = pItem->GetDataMirrored(lSize, pDst, m_llAliasVersion, &bHit))
+		return lErr;
+
+	if (bHit)
+		m_llMirrorHits++;
+	else
+		m_llMirrorMisses++;
+
 	return 0;
 }
 
@@ -317,6 +472,8 @@ inline long MemoryCollection::SetData(long hHandle, long lSize, void* pSrc, cuda
 		if (lErr = m_pMemPtrs->GetData(hHandle - MAX_ITEMS, &pItem))
 			return lErr;
 
+		TouchParent(pItem);
+
 		return pItem->SetData(lSize, pSrc, pStream);
 	}
 
@@ -328,6 +485,8 @@ inline long MemoryCollection::SetDataAt(long hHandle, long lSize, void* pSrc, in
 	if (hHandle < 1 || hHandle >= MAX_ITEMS * 2)
 		return ERROR_PARAM_OUT_OF_RANGE;
 
+	TraceScope trace("SetDataAt", TRACE_CAT_COPY_H2D, hHandle, 0, lSize);
+
 	//--------------------------------------------------------
 	//	If the handle is in the range [MAX_ITEM, MAX_ITEM*2]
 	//	then it is a ponter into already existing memory.
@@ -343,15 +502,42 @@ inline long MemoryCollection::SetDataAt(long hHandle, long lSize, void* pSrc, in
 		if (lErr = m_pMemPtrs->GetData(hHandle - MAX_ITEMS, &pItem))
 			return lErr;
 
+		TouchParent(pItem);
+
 		return pItem->SetDataAt(lSize, pSrc, nOffsetInBytes);
 	}
 
 	return m_rgHandles[hHandle].SetDataAt(lSize, pSrc, nOffsetInBytes);
 }
 
+inline void MemoryCollection::TouchParent(MemoryItem* pAlias)
+{
+	long hParent = pAlias->Parent();
+
+	if (hParent > 0 && hParent < MAX_ITEMS)
+		m_rgHandles[hParent].Touch();
+
+	m_llAliasVersion++;
+}
+
 inline unsigned long MemoryCollection::GetTotalUsed()
 {
 	return m_lTotalMem;
 }
 
+inline void MemoryCollection::EnableMirror(bool bEnable)
+{
+	m_bMirror = bEnable;
+	m_llMirrorHits = 0;
+	m_llMirrorMisses = 0;
+
+	if (!bEnable)
+	{
+		for (int i=0; i<MAX_ITEMS; i++)
+		{
+			m_rgHandles[i].FreeMirror();
+		}
+	}
+}
+
 #endif // __HANDLECOL_CU__
\ No newline at end of file
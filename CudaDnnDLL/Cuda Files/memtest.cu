@@ -51,6 +51,7 @@
 #include "util.h"
 #include "memory.h"
 #include "memtest.h"
+#include <emmintrin.h>
 
 //=============================================================================
 //	Defines and Constants
@@ -59,8 +60,207 @@
 const unsigned long BLOCKSIZE = ((unsigned long)1024 * (unsigned long)1024);
 const unsigned long GRIDSIZE = 128;
 const unsigned long MAX_ERR_RECORD_COUNT = BLOCKSIZE;
+const size_t HOST_HEADROOM = (size_t)1024 * (size_t)1024 * (size_t)1024;
 
 #define MIN(x, y) (x < y ? x : y)
+#define MAX(x, y) (x > y ? x : y)
+
+
+//=============================================================================
+//	Private Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Host Region Class
+//
+//	A block range of host memory allocated on (and tested from) one NUMA node.
+//-----------------------------------------------------------------------------
+class HostRegion
+{
+public:
+	unsigned char* m_pData;
+	size_t m_szFirstBlock;
+	size_t m_szBlocks;
+	USHORT m_nNode;
+	bool m_bLargePages;
+
+	HostRegion()
+	{
+		m_pData = NULL;
+		m_szFirstBlock = 0;
+		m_szBlocks = 0;
+		m_nNode = 0;
+		m_bLargePages = false;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Host Test Job Class
+//
+//	The work given to the thread testing a host region.
+//-----------------------------------------------------------------------------
+class HostTestJob
+{
+public:
+	void* m_pOwner;
+	void (*m_pfnRecord)(void* pOwner, int nHostIdx, void* pAddr);
+	HostRegion* m_pRegion;
+	MEMTEST_TYPE m_testType;
+	size_t m_szStartBlock;	// relative to the region.
+	size_t m_szBlockCount;
+	bool m_bWrite;
+	bool m_bReadWrite;
+	bool m_bRead;
+	unsigned int m_nSeed;
+	LONG m_lErr;
+};
+
+
+//=============================================================================
+//	Host Patterns
+//
+//	Each pattern returns the 4 words stored at vector index k (counted from
+//	the start of the region) so that the verify pass can regenerate them.
+//=============================================================================
+
+class PatternUniform
+{
+	__m128i m_v;
+public:
+	PatternUniform(unsigned int p)
+	{
+		m_v = _mm_set1_epi32((int)p);
+	}
+
+	inline __m128i get(size_t k) const
+	{
+		return m_v;
+	}
+};
+
+class PatternModulo20
+{
+	__m128i m_rg[5];
+public:
+	// p1 is stored at every 20th word starting at nOffset, p2 everywhere else.
+	PatternModulo20(int nOffset, unsigned int p1, unsigned int p2)
+	{
+		unsigned int rgWords[20];
+
+		for (int i = 0; i < 20; i++)
+		{
+			rgWords[i] = (i == nOffset) ? p1 : p2;
+		}
+
+		for (int i = 0; i < 5; i++)
+		{
+			m_rg[i] = _mm_setr_epi32((int)rgWords[i * 4 + 0], (int)rgWords[i * 4 + 1], (int)rgWords[i * 4 + 2], (int)rgWords[i * 4 + 3]);
+		}
+	}
+
+	inline __m128i get(size_t k) const
+	{
+		return m_rg[k % 5];
+	}
+};
+
+class PatternRandom
+{
+	unsigned int m_nSeed;
+
+	static inline unsigned int hash(unsigned int x)
+	{
+		x ^= x >> 16;
+		x *= 0x85EBCA6B;
+		x ^= x >> 13;
+		x *= 0xC2B2AE35;
+		x ^= x >> 16;
+		return x;
+	}
+
+public:
+	PatternRandom(unsigned int nSeed)
+	{
+		m_nSeed = nSeed;
+	}
+
+	inline __m128i get(size_t k) const
+	{
+		unsigned int w = (unsigned int)(k * 4);
+		return _mm_setr_epi32((int)hash((w + 0) ^ m_nSeed), (int)hash((w + 1) ^ m_nSeed), (int)hash((w + 2) ^ m_nSeed), (int)hash((w + 3) ^ m_nSeed));
+	}
+};
+
+
+//=============================================================================
+//	Host Test Functions
+//=============================================================================
+
+template <class P>
+static void host_write(unsigned char* pBase, size_t szStart, size_t szEnd, const P& pattern, bool bInvert)
+{
+	__m128i* ptr = (__m128i*)pBase;
+	__m128i inv = (bInvert) ? _mm_set1_epi32(-1) : _mm_setzero_si128();
+
+	for (size_t k = szStart; k < szEnd; k++)
+	{
+		_mm_stream_si128(&ptr[k], _mm_xor_si128(pattern.get(k), inv));
+	}
+
+	_mm_sfence();
+}
+
+template <class P>
+static void host_verify(HostTestJob* pJob, int nHostIdx, unsigned char* pBase, size_t szStart, size_t szEnd, const P& pattern, bool bInvert, bool bRewrite)
+{
+	__m128i* ptr = (__m128i*)pBase;
+	__m128i inv = (bInvert) ? _mm_set1_epi32(-1) : _mm_setzero_si128();
+	__m128i ones = _mm_set1_epi32(-1);
+
+	for (size_t k = szStart; k < szEnd; k++)
+	{
+		__m128i expected = _mm_xor_si128(pattern.get(k), inv);
+		__m128i current = _mm_load_si128(&ptr[k]);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(current, expected)) != 0xFFFF)
+		{
+			unsigned int* pWords = (unsigned int*)&ptr[k];
+			unsigned int rgExpected[4];
+			_mm_storeu_si128((__m128i*)rgExpected, expected);
+
+			for (int j = 0; j < 4; j++)
+			{
+				if (pWords[j] != rgExpected[j])
+					(*pJob->m_pfnRecord)(pJob->m_pOwner, nHostIdx, &pWords[j]);
+			}
+		}
+
+		// Moving inversions - write the complement right after checking.
+		if (bRewrite)
+			_mm_stream_si128(&ptr[k], _mm_xor_si128(expected, ones));
+	}
+
+	if (bRewrite)
+		_mm_sfence();
+}
+
+template <class P>
+static void host_test_pattern(HostTestJob* pJob, const P& pattern)
+{
+	size_t szVecPerBlock = BLOCKSIZE / sizeof(__m128i);
+	size_t szStart = pJob->m_szStartBlock * szVecPerBlock;
+	size_t szEnd = (pJob->m_szStartBlock + pJob->m_szBlockCount) * szVecPerBlock;
+	unsigned char* pBase = pJob->m_pRegion->m_pData;
+
+	if (pJob->m_bWrite)
+		host_write(pBase, szStart, szEnd, pattern, false);
+
+	if (pJob->m_bReadWrite)
+		host_verify(pJob, 0, pBase, szStart, szEnd, pattern, false, true);
+
+	if (pJob->m_bRead)
+		host_verify(pJob, 1, pBase, szStart, szEnd, pattern, true, false);
+}
 
 
 //=============================================================================
@@ -72,20 +272,24 @@ long memtestHandle<T>::allocate_small_mem()
 {
 	LONG lErr;
 
-	if (lErr = cudaMalloc((void**)&m_perr_count, sizeof(unsigned int) * GRIDSIZE))
-		return lErr;
+	// The host memory test records its errors directly into the host lists.
+	if (!m_bHost)
+	{
+		if (lErr = cudaMalloc((void**)&m_perr_count, sizeof(unsigned int) * GRIDSIZE))
+			return lErr;
 
-	if (lErr = cudaMalloc((void**)&m_rgerr_addr, sizeof(size_t) * MAX_ERR_RECORD_COUNT))
-		return lErr;
+		if (lErr = cudaMalloc((void**)&m_rgerr_addr, sizeof(size_t) * MAX_ERR_RECORD_COUNT))
+			return lErr;
 
-	if (lErr = cudaMalloc((void**)&m_rgerr_expect, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
-		return lErr;
+		if (lErr = cudaMalloc((void**)&m_rgerr_expect, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
+			return lErr;
 
-	if (lErr = cudaMalloc((void**)&m_rgerr_current, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
-		return lErr;
+		if (lErr = cudaMalloc((void**)&m_rgerr_current, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
+			return lErr;
 
-	if (lErr = cudaMalloc((void**)&m_rgerr_second_read, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
-		return lErr;
+		if (lErr = cudaMalloc((void**)&m_rgerr_second_read, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
+			return lErr;
+	}
 
 	if (lErr = cudaMallocHost((void**)&m_rgerr_addr_host1, sizeof(size_t) * MAX_ERR_RECORD_COUNT))
 		return lErr;
@@ -115,26 +319,34 @@ long memtestHandle<T>::reset_small_mem()
 {
 	LONG lErr;
 
-	if (lErr = cudaMemset(m_perr_count, 0, sizeof(unsigned int)))
-		return lErr;
+	if (!m_bHost)
+	{
+		if (lErr = cudaMemsetAsync(m_perr_count, 0, sizeof(unsigned int), m_stream))
+			return lErr;
 
-	if (lErr = cudaMemset(m_rgerr_addr, 0, sizeof(size_t) * MAX_ERR_RECORD_COUNT))
-		return lErr;
+		if (lErr = cudaMemsetAsync(m_rgerr_addr, 0, sizeof(size_t) * MAX_ERR_RECORD_COUNT, m_stream))
+			return lErr;
 
-	if (lErr = cudaMemset(m_rgerr_expect, 0, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
-		return lErr;
+		if (lErr = cudaMemsetAsync(m_rgerr_expect, 0, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT, m_stream))
+			return lErr;
 
-	if (lErr = cudaMemset(m_rgerr_current, 0, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
-		return lErr;
+		if (lErr = cudaMemsetAsync(m_rgerr_current, 0, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT, m_stream))
+			return lErr;
 
-	if (lErr = cudaMemset(m_rgerr_second_read, 0, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
-		return lErr;
+		if (lErr = cudaMemsetAsync(m_rgerr_second_read, 0, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT, m_stream))
+			return lErr;
+
+		if (lErr = cudaStreamSynchronize(m_stream))
+			return lErr;
+	}
 
 	memset(m_rgerr_addr_host1, 0, sizeof(size_t) * MAX_ERR_RECORD_COUNT);
 	memset(m_rgerr_addr_host2, 0, sizeof(size_t) * MAX_ERR_RECORD_COUNT);
 
 	m_rgerr_count_host[0] = 0;
 	m_rgerr_count_host[1] = 0;
+	m_rglHostErrCount[0] = 0;
+	m_rglHostErrCount[1] = 0;
 
 	//if (lErr = memset(m_rgerr_expect_host, 0, sizeof(unsigned long) * MAX_ERR_RECORD_COUNT))
 	//	return lErr;
@@ -149,18 +361,50 @@ long memtestHandle<T>::reset_small_mem()
 }
 
 template <class T>
-long memtestHandle<T>::Initialize(Memory<T>* pMem, T fPctToAllocate, size_t* pszTotalNumBlocks, T* pfMemAllocated, T* pfMemStartAddress, T* pfMemBlockSize)
+long memtestHandle<T>::Initialize(Memory<T>* pMem, T fPctToAllocate, bool bHost, size_t* pszTotalNumBlocks, T* pfMemAllocated, T* pfMemStartAddress, T* pfMemBlockSize)
 {
 	LONG lErr;
 	int nDeviceID;
 
 	m_pMem = pMem;
+	m_bHost = bHost;
+
+	// The write and read passes of the random data test run in separate
+	// calls, so both must see the same seed.
+	m_nRandomSeed = GetTickCount() | 1;
+
+	if (m_bHost)
+	{
+		if (lErr = allocate_small_mem())
+		{
+			CleanUp();
+			return lErr;
+		}
+
+		if (lErr = alloc_host_regions(fPctToAllocate))
+		{
+			CleanUp();
+			return lErr;
+		}
+
+		*pszTotalNumBlocks = m_szTotalNumBlocks;
+		*pfMemAllocated = T(m_szTotalNumBlocks / 1000.0);
+		*pfMemStartAddress = T((long long)m_rgHostRegions[0].m_pData);
+		*pfMemBlockSize = T((long long)BLOCKSIZE);
+
+		return 0;
+	}
 
 	try
 	{
 		if (lErr = cudaGetDevice(&nDeviceID))
 			throw lErr;
 
+		m_nDeviceID = nDeviceID;
+
+		if (lErr = cudaStreamCreateWithFlags(&m_stream, cudaStreamNonBlocking))
+			throw lErr;
+
 		cudaDeviceProp prop;
 		if (lErr = cudaGetDeviceProperties(&prop, nDeviceID))
 			throw lErr;
@@ -187,10 +431,11 @@ long memtestHandle<T>::Initialize(Memory<T>* pMem, T fPctToAllocate, size_t* psz
 
 		do
 		{
-			m_szTotalNumBlocks -= 16; // magic number 16MB
+			// The block count is unsigned, so check before it wraps.
+			if (m_szTotalNumBlocks <= 16)
+				throw ERROR_MEMORY_OUT;
 
-			if (m_szTotalNumBlocks <= 0)
-				throw ERROR_OUTOFMEMORY;
+			m_szTotalNumBlocks -= 16; // magic number 16MB
 
 			size_t szBytes = m_szTotalNumBlocks * BLOCKSIZE;
 			lErr = cudaMalloc((void**)&m_pTestMem, szBytes);
@@ -210,13 +455,15 @@ long memtestHandle<T>::Initialize(Memory<T>* pMem, T fPctToAllocate, size_t* psz
 	return 0;
 }
 
-template long memtestHandle<double>::Initialize(Memory<double>* pMem, double dfPctToAllocate, size_t* pszTotalNumBlocks, double* pfMemAllocated, double* pfMemStartAddr, double* pfMemBlockSize);
-template long memtestHandle<float>::Initialize(Memory<float>* pMem, float fPctToAllocate, size_t* pszTotalNumBlocks, float* pfMemAllocated, float* pfMemStartAddr, float* pfMemBlockSize);
+template long memtestHandle<double>::Initialize(Memory<double>* pMem, double dfPctToAllocate, bool bHost, size_t* pszTotalNumBlocks, double* pfMemAllocated, double* pfMemStartAddr, double* pfMemBlockSize);
+template long memtestHandle<float>::Initialize(Memory<float>* pMem, float fPctToAllocate, bool bHost, size_t* pszTotalNumBlocks, float* pfMemAllocated, float* pfMemStartAddr, float* pfMemBlockSize);
 
 
 template <class T>
 long memtestHandle<T>::CleanUp()
 {
+	StopScrub();
+
 	m_pTestingStartAddress = NULL;
 	m_szAddressesTested = 0;
 
@@ -226,6 +473,8 @@ long memtestHandle<T>::CleanUp()
 		m_pTestMem = NULL;
 	}
 
+	free_host_regions();
+
 	m_szTotalNumBlocks = 0;
 
 	if (m_rgerr_addr != NULL)
@@ -293,6 +542,12 @@ long memtestHandle<T>::CleanUp()
 	m_rgerr_count_host[0] = 0;
 	m_rgerr_count_host[1] = 0;
 
+	if (m_stream != NULL)
+	{
+		cudaStreamDestroy(m_stream);
+		m_stream = NULL;
+	}
+
 	return 0;
 }
 
@@ -305,27 +560,283 @@ long memtestHandle<T>::Run(MEMTEST_TYPE testType, size_t szStartOffset, size_t s
 {
 	LONG lErr = 0;
 
-	reset_small_mem();
+	EnterCriticalSection(&m_lock);
+
+	if ((lErr = run_test(testType, szStartOffset, szCount, bWrite, bReadWrite, bRead)) == 0)
+		lErr = load_error_data(plCount, ppfData, bVerbose);
+
+	LeaveCriticalSection(&m_lock);
+
+	return lErr;
+}
+
+template long memtestHandle<double>::Run(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, long* plCount, double** ppfData, bool bVerbose, bool bWrite, bool bReadWrite, bool bRead);
+template long memtestHandle<float>::Run(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, long* plCount, float** ppfData, bool bVerbose, bool bWrite, bool bReadWrite, bool bRead);
+
+
+template <class T>
+long memtestHandle<T>::run_test(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, bool bWrite, bool bReadWrite, bool bRead)
+{
+	LONG lErr;
+
+	if (lErr = reset_small_mem())
+		return lErr;
+
+	if (m_bHost)
+		return run_host_test(testType, szStartOffset, szCount, bWrite, bReadWrite, bRead);
 
 	switch (testType)
 	{
 		case MOV_INV_8:
-			lErr = run_move_inv_8_test(szStartOffset, szCount, bWrite, bReadWrite, bRead);
-			break;
+			return run_move_inv_8_test(szStartOffset, szCount, bWrite, bReadWrite, bRead);
 
 		default:
-			lErr = ERROR_PARAM_OUT_OF_RANGE;
-			break;
+			return ERROR_PARAM_OUT_OF_RANGE;
 	}
+}
+
+template long memtestHandle<double>::run_test(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, bool bWrite, bool bReadWrite, bool bRead);
+template long memtestHandle<float>::run_test(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, bool bWrite, bool bReadWrite, bool bRead);
+
+
+template <class T>
+long memtestHandle<T>::StartScrub(MEMTEST_TYPE testType, int nMsPerSec, T fMBPerSec, size_t szBlocksPerSlice, size_t szStartBlock, int nPasses)
+{
+	LONG lErr;
+
+	if (m_szTotalNumBlocks == 0)
+		return ERROR_PARAM_NULL;
 
-	if (lErr = load_error_data(plCount, ppfData, bVerbose))
+	if (nMsPerSec <= 0 || nMsPerSec > 1000 || szBlocksPerSlice == 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (!m_bHost && testType != MOV_INV_8)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (lErr = StopScrub())
 		return lErr;
 
-	return lErr;
+	m_scrubType = testType;
+	m_nScrubMsPerSec = nMsPerSec;
+	m_fScrubMBPerSec = fMBPerSec;
+	m_szScrubBlocksPerSlice = szBlocksPerSlice;
+
+	// The caller may resume from the progress it saved from an earlier scrub.
+	m_llScrubCursor = (LONGLONG)((szStartBlock < m_szTotalNumBlocks) ? szStartBlock : 0);
+	m_lScrubPasses = nPasses;
+	m_llScrubBlocksTested = 0;
+	m_lScrubErrorCount = 0;
+	m_llScrubErrorAddr = 0;
+	m_lScrubErr = 0;
+	m_lScrubBusyMs = 0;
+
+	if ((m_hScrubCancel = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL)
+		return ERROR_PARAM_NULL;
+
+	if ((m_hScrubThread = CreateThread(NULL, 0, &memtestHandle<T>::scrub_thread, this, 0, NULL)) == NULL)
+	{
+		CloseHandle(m_hScrubCancel);
+		m_hScrubCancel = NULL;
+		return ERROR_PARAM_NULL;
+	}
+
+	// The scrubber only runs when the foreground work leaves the cores idle.
+	SetThreadPriority(m_hScrubThread, THREAD_PRIORITY_BELOW_NORMAL);
+
+	return 0;
 }
 
-template long memtestHandle<double>::Run(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, long* plCount, double** ppfData, bool bVerbose, bool bWrite, bool bReadWrite, bool bRead);
-template long memtestHandle<float>::Run(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, long* plCount, float** ppfData, bool bVerbose, bool bWrite, bool bReadWrite, bool bRead);
+template long memtestHandle<double>::StartScrub(MEMTEST_TYPE testType, int nMsPerSec, double fMBPerSec, size_t szBlocksPerSlice, size_t szStartBlock, int nPasses);
+template long memtestHandle<float>::StartScrub(MEMTEST_TYPE testType, int nMsPerSec, float fMBPerSec, size_t szBlocksPerSlice, size_t szStartBlock, int nPasses);
+
+
+template <class T>
+long memtestHandle<T>::StopScrub()
+{
+	if (m_hScrubThread != NULL)
+	{
+		SetEvent(m_hScrubCancel);
+		WaitForSingleObject(m_hScrubThread, INFINITE);
+		CloseHandle(m_hScrubThread);
+		m_hScrubThread = NULL;
+	}
+
+	if (m_hScrubCancel != NULL)
+	{
+		CloseHandle(m_hScrubCancel);
+		m_hScrubCancel = NULL;
+	}
+
+	m_lScrubBusyMs = 0;
+
+	return 0;
+}
+
+template long memtestHandle<double>::StopScrub();
+template long memtestHandle<float>::StopScrub();
+
+
+template <class T>
+long memtestHandle<T>::GetScrubStatus(T* rgStatus, int nCount)
+{
+	if (rgStatus == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nCount < MEMTEST_SCRUB_STATUS_COUNT)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	bool bRunning = (m_hScrubThread != NULL && WaitForSingleObject(m_hScrubThread, 0) == WAIT_TIMEOUT) ? true : false;
+
+	rgStatus[0] = T((bRunning) ? 1 : 0);
+	rgStatus[1] = T((double)m_llScrubCursor);
+	rgStatus[2] = T(m_lScrubPasses);
+	rgStatus[3] = T((double)m_llScrubBlocksTested);
+	rgStatus[4] = T(m_lScrubErrorCount);
+	rgStatus[5] = T((double)m_llScrubErrorAddr);
+	rgStatus[6] = T(m_lScrubErr);
+	rgStatus[7] = T(m_lScrubBusyMs);
+	rgStatus[8] = T((double)m_szTotalNumBlocks);
+	rgStatus[9] = T((m_lScrubErrorCount > 0) ? 1 : 0);
+
+	return 0;
+}
+
+template long memtestHandle<double>::GetScrubStatus(double* rgStatus, int nCount);
+template long memtestHandle<float>::GetScrubStatus(float* rgStatus, int nCount);
+
+
+template <class T>
+long memtestHandle<T>::scrub_slice(size_t szStartOffset, size_t szCount, unsigned int* pnErrCount, size_t* pszErrAddr)
+{
+	LONG lErr;
+
+	*pnErrCount = 0;
+	*pszErrAddr = 0;
+
+	if (lErr = run_test(m_scrubType, szStartOffset, szCount, true, true, true))
+		return lErr;
+
+	// The device error count accumulates across the passes of one test, whereas
+	// the host threads count each pass separately.
+	if (m_bHost)
+		*pnErrCount = m_rglHostErrCount[0] + m_rglHostErrCount[1];
+	else
+		*pnErrCount = MAX(m_rgerr_count_host[0], m_rgerr_count_host[1]);
+
+	if (m_rgerr_count_host[0] > 0)
+		*pszErrAddr = m_rgerr_addr_host[0][0];
+	else if (m_rgerr_count_host[1] > 0)
+		*pszErrAddr = m_rgerr_addr_host[1][0];
+
+	return 0;
+}
+
+template long memtestHandle<double>::scrub_slice(size_t szStartOffset, size_t szCount, unsigned int* pnErrCount, size_t* pszErrAddr);
+template long memtestHandle<float>::scrub_slice(size_t szStartOffset, size_t szCount, unsigned int* pnErrCount, size_t* pszErrAddr);
+
+
+static double elapsed_ms(LARGE_INTEGER liStart, LARGE_INTEGER liFreq)
+{
+	LARGE_INTEGER liNow;
+	QueryPerformanceCounter(&liNow);
+	return (double)(liNow.QuadPart - liStart.QuadPart) * 1000.0 / (double)liFreq.QuadPart;
+}
+
+template <class T>
+long memtestHandle<T>::scrub()
+{
+	LONG lErr;
+	LARGE_INTEGER liFreq;
+	double dfBytesPerSec = (m_fScrubMBPerSec > 0) ? (double)m_fScrubMBPerSec * 1024.0 * 1024.0 : 0;
+
+	if (!m_bHost)
+	{
+		if (lErr = cudaSetDevice(m_nDeviceID))
+			return lErr;
+	}
+
+	QueryPerformanceFrequency(&liFreq);
+
+	while (true)
+	{
+		LARGE_INTEGER liWindow;
+		double dfBusyMs = 0;
+		double dfBytes = 0;
+
+		QueryPerformanceCounter(&liWindow);
+
+		// Test slices until this second's budget is used up.
+		while (dfBusyMs < m_nScrubMsPerSec && (dfBytesPerSec == 0 || dfBytes < dfBytesPerSec))
+		{
+			if (WaitForSingleObject(m_hScrubCancel, 0) == WAIT_OBJECT_0)
+				return 0;
+
+			size_t szStart = (size_t)m_llScrubCursor;
+			size_t szCount = MIN(m_szScrubBlocksPerSlice, m_szTotalNumBlocks - szStart);
+			unsigned int nErrCount = 0;
+			size_t szErrAddr = 0;
+			LARGE_INTEGER liStart;
+
+			EnterCriticalSection(&m_lock);
+			QueryPerformanceCounter(&liStart);
+			lErr = scrub_slice(szStart, szCount, &nErrCount, &szErrAddr);
+			dfBusyMs += elapsed_ms(liStart, liFreq);
+			LeaveCriticalSection(&m_lock);
+
+			if (lErr)
+				return lErr;
+
+			dfBytes += (double)szCount * BLOCKSIZE;
+			InterlockedExchangeAdd64(&m_llScrubBlocksTested, (LONGLONG)szCount);
+
+			if (nErrCount > 0)
+			{
+				if (InterlockedExchangeAdd(&m_lScrubErrorCount, (LONG)nErrCount) == 0)
+					InterlockedExchange64(&m_llScrubErrorAddr, (LONGLONG)szErrAddr);
+			}
+
+			if (szStart + szCount >= m_szTotalNumBlocks)
+			{
+				InterlockedExchange64(&m_llScrubCursor, 0);
+				InterlockedIncrement(&m_lScrubPasses);
+			}
+			else
+			{
+				InterlockedExchange64(&m_llScrubCursor, (LONGLONG)(szStart + szCount));
+			}
+
+			if (elapsed_ms(liWindow, liFreq) >= 1000.0)
+				break;
+		}
+
+		InterlockedExchange(&m_lScrubBusyMs, (LONG)dfBusyMs);
+
+		double dfRemaining = 1000.0 - elapsed_ms(liWindow, liFreq);
+		DWORD dwWait = (dfRemaining > 0) ? (DWORD)dfRemaining : 0;
+
+		if (WaitForSingleObject(m_hScrubCancel, dwWait) == WAIT_OBJECT_0)
+			return 0;
+	}
+}
+
+template long memtestHandle<double>::scrub();
+template long memtestHandle<float>::scrub();
+
+
+template <class T>
+DWORD WINAPI memtestHandle<T>::scrub_thread(LPVOID pParam)
+{
+	memtestHandle<T>* pThis = (memtestHandle<T>*)pParam;
+	LONG lErr = pThis->scrub();
+
+	if (lErr)
+		InterlockedExchange(&pThis->m_lScrubErr, lErr);
+
+	return 0;
+}
+
+template DWORD WINAPI memtestHandle<double>::scrub_thread(LPVOID pParam);
+template DWORD WINAPI memtestHandle<float>::scrub_thread(LPVOID pParam);
 
 
 template <class T>
@@ -388,7 +899,7 @@ long memtestHandle<T>::load_error_data(long* plCount, T** ppfData, bool bVerbose
 		unsigned int nIdx1 = 0;
 		unsigned int nIdx2 = 0;
 
-		while (nIdx1 < m_rgerr_count_host[0] && nIdx2 < m_rgerr_count_host[1])
+		while (nIdx1 < m_rgerr_count_host[0] || nIdx2 < m_rgerr_count_host[1])
 		{
 			if (nIdx1 < m_rgerr_count_host[0] && nIdx2 < m_rgerr_count_host[1])
 			{
@@ -581,8 +1092,8 @@ long memtestHandle<T>::move_inv_test(size_t szStartOffset, size_t szCount, unsig
 		{
 			size_t szOffset = i * BLOCKSIZE;
 
-			kernel_move_inv_write<T> << <grid, 1 >> > (ptr + szOffset, end_ptr, p1);
-			cudaThreadSynchronize();
+			kernel_move_inv_write<T> << <grid, 1, 0, m_stream >> > (ptr + szOffset, end_ptr, p1);
+			cudaStreamSynchronize(m_stream);
 			if (lErr = cudaGetLastError())
 				return lErr;
 		}
@@ -594,8 +1105,8 @@ long memtestHandle<T>::move_inv_test(size_t szStartOffset, size_t szCount, unsig
 		{
 			size_t szOffset = i * BLOCKSIZE;
 
-			kernel_move_inv_readwrite<T> << <grid, 1 >> > (ptr + szOffset, end_ptr, p1, p2, m_perr_count, m_rgerr_addr, m_rgerr_expect, m_rgerr_current, m_rgerr_second_read);
-			cudaThreadSynchronize();
+			kernel_move_inv_readwrite<T> << <grid, 1, 0, m_stream >> > (ptr + szOffset, end_ptr, p1, p2, m_perr_count, m_rgerr_addr, m_rgerr_expect, m_rgerr_current, m_rgerr_second_read);
+			cudaStreamSynchronize(m_stream);
 			if (lErr = cudaGetLastError())
 				return lErr;
 
@@ -612,8 +1123,8 @@ long memtestHandle<T>::move_inv_test(size_t szStartOffset, size_t szCount, unsig
 		{
 			size_t szOffset = i * BLOCKSIZE;
 
-			kernel_move_inv_read<T> << <grid, 1 >> > (ptr + szOffset, end_ptr, p2, m_perr_count, m_rgerr_addr, m_rgerr_expect, m_rgerr_current, m_rgerr_second_read);
-			cudaThreadSynchronize();
+			kernel_move_inv_read<T> << <grid, 1, 0, m_stream >> > (ptr + szOffset, end_ptr, p2, m_perr_count, m_rgerr_addr, m_rgerr_expect, m_rgerr_current, m_rgerr_second_read);
+			cudaStreamSynchronize(m_stream);
 			if (lErr = cudaGetLastError())
 				return lErr;
 
@@ -637,14 +1148,20 @@ long memtestHandle<T>::error_checking(int nHostIdx, size_t blockidx, unsigned in
 	long lErr;
 	unsigned int err = 0;
 
-	if (lErr = cudaMemcpy((void*)&err, (void*)m_perr_count, sizeof(unsigned int), cudaMemcpyDeviceToHost))
+	if (lErr = cudaMemcpyAsync((void*)&err, (void*)m_perr_count, sizeof(unsigned int), cudaMemcpyDeviceToHost, m_stream))
+		return lErr;
+
+	if (lErr = cudaStreamSynchronize(m_stream))
 		return lErr;
 
-	m_rgerr_count_host[nHostIdx] = err;
+	m_rgerr_count_host[nHostIdx] = MIN(err, MAX_ERR_RECORD_COUNT);
 
 	if (err > 0)
 	{
-		if (lErr = cudaMemcpy((void*)m_rgerr_addr_host[nHostIdx], (void*)m_rgerr_addr, sizeof(size_t) * err, cudaMemcpyDeviceToHost))
+		if (lErr = cudaMemcpyAsync((void*)m_rgerr_addr_host[nHostIdx], (void*)m_rgerr_addr, sizeof(size_t) * MIN(err, MAX_ERR_RECORD_COUNT), cudaMemcpyDeviceToHost, m_stream))
+			return lErr;
+
+		if (lErr = cudaStreamSynchronize(m_stream))
 			return lErr;
 
 		//if (lErr = cudaMemcpy((void*)&m_rgerr_expect_host[0], (void*)m_rgerr_expect, sizeof(unsigned long) * err, cudaMemcpyDeviceToHost))
@@ -665,4 +1182,269 @@ long memtestHandle<T>::error_checking(int nHostIdx, size_t blockidx, unsigned in
 template long memtestHandle<double>::error_checking(int nHostIdx, size_t blockidx, unsigned int* pErr);
 template long memtestHandle<float>::error_checking(int nHostIdx, size_t blockidx, unsigned int* pErr);
 
+
+template <class T>
+long memtestHandle<T>::alloc_host_regions(T fPctToAllocate)
+{
+	MEMORYSTATUSEX status;
+	ULONG nHighestNode = 0;
+	USHORT rgNodes[64];
+	int nNodes = 0;
+
+	status.dwLength = sizeof(status);
+	if (!GlobalMemoryStatusEx(&status))
+		return ERROR_MEMORY_OUT;
+
+	if (!GetNumaHighestNodeNumber(&nHighestNode))
+		nHighestNode = 0;
+
+	// Only test from nodes that have processors to run the test on.
+	for (ULONG i = 0; i <= nHighestNode && nNodes < 64; i++)
+	{
+		GROUP_AFFINITY aff;
+
+		if (GetNumaNodeProcessorMaskEx((USHORT)i, &aff) && aff.Mask != 0)
+			rgNodes[nNodes++] = (USHORT)i;
+	}
+
+	if (nNodes == 0)
+		rgNodes[nNodes++] = 0;
+
+	// Leave headroom for the OS and the rest of the process.
+	size_t szAvail = (size_t)status.ullAvailPhys;
+	size_t szTotal = (szAvail > 2 * HOST_HEADROOM) ? szAvail - HOST_HEADROOM : szAvail / 2;
+
+	if (fPctToAllocate > 0 && fPctToAllocate < 1)
+		szTotal = (size_t)(szTotal * fPctToAllocate);
+
+	size_t szLargePage = GetLargePageMinimum();
+	size_t szBlocksPerNode = (szTotal / nNodes) / BLOCKSIZE;
+
+	if ((m_rgHostRegions = new HostRegion[nNodes]) == NULL)
+		return ERROR_MEMORY_OUT;
+
+	m_nHostRegions = nNodes;
+	m_szTotalNumBlocks = 0;
+
+	for (int i = 0; i < nNodes; i++)
+	{
+		HostRegion* pRegion = &m_rgHostRegions[i];
+		size_t szBlocks = szBlocksPerNode;
+
+		pRegion->m_nNode = rgNodes[i];
+
+		while (szBlocks > 0 && pRegion->m_pData == NULL)
+		{
+			size_t szBytes = szBlocks * BLOCKSIZE;
+
+			// Large pages are locked in memory and avoid TLB misses, but need the
+			// 'Lock pages in memory' privilege - otherwise regular pages are used.
+			if (szLargePage > 0 && (szBytes % szLargePage) == 0)
+			{
+				pRegion->m_pData = (unsigned char*)VirtualAllocExNuma(GetCurrentProcess(), NULL, szBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, pRegion->m_nNode);
+				pRegion->m_bLargePages = (pRegion->m_pData != NULL) ? true : false;
+			}
+
+			if (pRegion->m_pData == NULL)
+				pRegion->m_pData = (unsigned char*)VirtualAllocExNuma(GetCurrentProcess(), NULL, szBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, pRegion->m_nNode);
+
+			if (pRegion->m_pData == NULL)
+				szBlocks = (szBlocks > 16) ? szBlocks - 16 : 0;
+		}
+
+		if (pRegion->m_pData == NULL)
+			return ERROR_MEMORY_OUT;
+
+		pRegion->m_szFirstBlock = m_szTotalNumBlocks;
+		pRegion->m_szBlocks = szBlocks;
+		m_szTotalNumBlocks += szBlocks;
+	}
+
+	return 0;
+}
+
+template long memtestHandle<double>::alloc_host_regions(double dfPctToAllocate);
+template long memtestHandle<float>::alloc_host_regions(float fPctToAllocate);
+
+
+template <class T>
+long memtestHandle<T>::free_host_regions()
+{
+	if (m_rgHostRegions != NULL)
+	{
+		for (int i = 0; i < m_nHostRegions; i++)
+		{
+			if (m_rgHostRegions[i].m_pData != NULL)
+				VirtualFree(m_rgHostRegions[i].m_pData, 0, MEM_RELEASE);
+		}
+
+		delete [] m_rgHostRegions;
+		m_rgHostRegions = NULL;
+	}
+
+	m_nHostRegions = 0;
+
+	return 0;
+}
+
+template long memtestHandle<double>::free_host_regions();
+template long memtestHandle<float>::free_host_regions();
+
+
+template <class T>
+void memtestHandle<T>::RecordHostError(int nHostIdx, void* pAddr)
+{
+	LONG lIdx = InterlockedIncrement(&m_rglHostErrCount[nHostIdx]) - 1;
+
+	// Like the device test, only the first MAX_ERR_RECORD_COUNT addresses are kept.
+	if ((unsigned long)lIdx < MAX_ERR_RECORD_COUNT)
+		m_rgerr_addr_host[nHostIdx][lIdx] = (size_t)pAddr;
+}
+
+template void memtestHandle<double>::RecordHostError(int nHostIdx, void* pAddr);
+template void memtestHandle<float>::RecordHostError(int nHostIdx, void* pAddr);
+
+
+template <class T>
+static void recordHostError(void* pOwner, int nHostIdx, void* pAddr)
+{
+	((memtestHandle<T>*)pOwner)->RecordHostError(nHostIdx, pAddr);
+}
+
+
+template <class T>
+DWORD WINAPI memtestHandle<T>::host_thread(LPVOID pParam)
+{
+	HostTestJob* pJob = (HostTestJob*)pParam;
+	GROUP_AFFINITY aff;
+
+	// Run on the node that owns the memory so that the traffic stays local.
+	if (GetNumaNodeProcessorMaskEx(pJob->m_pRegion->m_nNode, &aff) && aff.Mask != 0)
+		SetThreadGroupAffinity(GetCurrentThread(), &aff, NULL);
+
+	switch (pJob->m_testType)
+	{
+		case MOV_INV_8:
+			host_test_pattern(pJob, PatternUniform(0x80808080));
+			break;
+
+		case WALKING_ONES:
+			for (int i = 0; i < 32; i++)
+			{
+				host_test_pattern(pJob, PatternUniform(1u << i));
+			}
+			break;
+
+		case WALKING_ZEROS:
+			for (int i = 0; i < 32; i++)
+			{
+				host_test_pattern(pJob, PatternUniform(~(1u << i)));
+			}
+			break;
+
+		case MODULO_20:
+			for (int i = 0; i < 20; i++)
+			{
+				host_test_pattern(pJob, PatternModulo20(i, 0x55555555, 0xAAAAAAAA));
+			}
+			break;
+
+		case RANDOM_DATA:
+			host_test_pattern(pJob, PatternRandom(pJob->m_nSeed));
+			break;
+
+		default:
+			pJob->m_lErr = ERROR_PARAM_OUT_OF_RANGE;
+			break;
+	}
+
+	return 0;
+}
+
+template DWORD WINAPI memtestHandle<double>::host_thread(LPVOID pParam);
+template DWORD WINAPI memtestHandle<float>::host_thread(LPVOID pParam);
+
+
+template <class T>
+long memtestHandle<T>::run_host_test(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, bool bWrite, bool bReadWrite, bool bRead)
+{
+	LONG lErr = 0;
+	HostTestJob rgJobs[64];
+	HANDLE rgThreads[64];
+	int nThreads = 0;
+	size_t szEnd = MIN(szStartOffset + szCount, m_szTotalNumBlocks);
+
+	// The walking and modulo tests write and verify each of their sub-patterns
+	// in turn, so memory only holds the last one once the call returns.  A
+	// verify run in a separate call would report false errors.
+	if ((testType == WALKING_ONES || testType == WALKING_ZEROS || testType == MODULO_20) && (!bWrite || !bReadWrite))
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	m_pTestingStartAddress = NULL;
+	m_szAddressesTested = 0;
+
+	// One thread per NUMA node region that overlaps the blocks requested.
+	for (int i = 0; i < m_nHostRegions; i++)
+	{
+		HostRegion* pRegion = &m_rgHostRegions[i];
+		size_t szFirst = MAX(szStartOffset, pRegion->m_szFirstBlock);
+		size_t szLast = MIN(szEnd, pRegion->m_szFirstBlock + pRegion->m_szBlocks);
+
+		if (szFirst >= szLast)
+			continue;
+
+		HostTestJob* pJob = &rgJobs[nThreads];
+		pJob->m_pOwner = this;
+		pJob->m_pfnRecord = &recordHostError<T>;
+		pJob->m_pRegion = pRegion;
+		pJob->m_testType = testType;
+		pJob->m_szStartBlock = szFirst - pRegion->m_szFirstBlock;
+		pJob->m_szBlockCount = szLast - szFirst;
+		pJob->m_bWrite = bWrite;
+		pJob->m_bReadWrite = bReadWrite;
+		pJob->m_bRead = bRead;
+		pJob->m_nSeed = m_nRandomSeed;
+		pJob->m_lErr = 0;
+
+		if (m_pTestingStartAddress == NULL)
+			m_pTestingStartAddress = pRegion->m_pData + pJob->m_szStartBlock * BLOCKSIZE;
+
+		m_szAddressesTested += pJob->m_szBlockCount * BLOCKSIZE;
+
+		if ((rgThreads[nThreads] = CreateThread(NULL, 0, &memtestHandle<T>::host_thread, pJob, 0, NULL)) == NULL)
+		{
+			lErr = ERROR_PARAM_NULL;
+			break;
+		}
+
+		nThreads++;
+	}
+
+	if (nThreads > 0)
+		WaitForMultipleObjects(nThreads, rgThreads, TRUE, INFINITE);
+
+	for (int i = 0; i < nThreads; i++)
+	{
+		CloseHandle(rgThreads[i]);
+
+		if (lErr == 0 && rgJobs[i].m_lErr != 0)
+			lErr = rgJobs[i].m_lErr;
+	}
+
+	if (lErr)
+		return lErr;
+
+	// Sort the addresses as load_error_data merges the two lists in order.
+	for (int i = 0; i < 2; i++)
+	{
+		m_rgerr_count_host[i] = (unsigned int)MIN((unsigned long)m_rglHostErrCount[i], MAX_ERR_RECORD_COUNT);
+		std::sort(m_rgerr_addr_host[i], m_rgerr_addr_host[i] + m_rgerr_count_host[i]);
+	}
+
+	return 0;
+}
+
+template long memtestHandle<double>::run_host_test(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, bool bWrite, bool bReadWrite, bool bRead);
+template long memtestHandle<float>::run_host_test(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, bool bWrite, bool bReadWrite, bool bRead);
+
 // end
\ No newline at end of file
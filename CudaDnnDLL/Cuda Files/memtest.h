@@ -15,9 +15,19 @@
 
 enum MEMTEST_TYPE
 {
-	MOV_INV_8 = 1
+	MOV_INV_8 = 1,
+	WALKING_ONES = 2,		// host memory only.
+	WALKING_ZEROS = 3,		// host memory only.
+	MODULO_20 = 4,			// host memory only.
+	RANDOM_DATA = 5			// host memory only.
 };
 
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int MEMTEST_SCRUB_STATUS_COUNT = 10;
+
 
 //=============================================================================
 //	Classes
@@ -26,11 +36,25 @@ enum MEMTEST_TYPE
 template <class T>
 class Memory;
 
+class HostRegion;
+class HostTestJob;
+
 
 //-----------------------------------------------------------------------------
 //	MemoryTest Handle Class
 //
 //	This class stores the Memory Test description information.
+//
+//	When created for host memory, the memory tested is split into one region
+//	per NUMA node, each tested by its own thread bound to that node's
+//	processors using non-temporal (streaming) SSE2 stores.
+//
+//	The scrubber runs the test in the background, a slice of blocks at a
+//	time, rotating through the whole region.  Each second it only tests until
+//	its time budget (ms per second) or bandwidth budget (MB per second) is
+//	used up and then sleeps for the rest of the second.  On the GPU, the test
+//	kernels run on the handle's own non-blocking stream so that they do not
+//	serialize with the foreground work.
 //-----------------------------------------------------------------------------
 template <class T>
 class memtestHandle
@@ -53,6 +77,27 @@ class memtestHandle
 	unsigned int* m_perr_count;
 	unsigned char* m_pTestMem;
 	size_t m_szTotalNumBlocks;
+	bool m_bHost;
+	HostRegion* m_rgHostRegions;
+	int m_nHostRegions;
+	unsigned int m_nRandomSeed;		// seed of the random data test, set once per test.
+	volatile LONG m_rglHostErrCount[2];
+	int m_nDeviceID;
+	cudaStream_t m_stream;
+	CRITICAL_SECTION m_lock;		// serializes Run with the scrub slices.
+	HANDLE m_hScrubThread;
+	HANDLE m_hScrubCancel;
+	MEMTEST_TYPE m_scrubType;
+	int m_nScrubMsPerSec;			// time budget per second.
+	T m_fScrubMBPerSec;				// bandwidth budget per second, <= 0 for no bound.
+	size_t m_szScrubBlocksPerSlice;
+	volatile LONGLONG m_llScrubCursor;
+	volatile LONG m_lScrubPasses;
+	volatile LONGLONG m_llScrubBlocksTested;
+	volatile LONG m_lScrubErrorCount;
+	volatile LONGLONG m_llScrubErrorAddr;
+	volatile LONG m_lScrubErr;
+	volatile LONG m_lScrubBusyMs;	// time spent testing during the last second.
 
 	long allocate_small_mem();
 	long reset_small_mem();
@@ -62,6 +107,14 @@ class memtestHandle
 	long load_error_data(long* plCount, T** ppfData, bool bVerbose);
 	long alloc_mem(void** pp, size_t sz);
 	long free_mem(void* p);
+	long alloc_host_regions(T fPctToAllocate);
+	long free_host_regions();
+	long run_host_test(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, bool bWrite, bool bReadWrite, bool bRead);
+	static DWORD WINAPI host_thread(LPVOID pParam);
+	long run_test(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, bool bWrite, bool bReadWrite, bool bRead);
+	long scrub_slice(size_t szStartOffset, size_t szCount, unsigned int* pnErrCount, size_t* pszErrAddr);
+	long scrub();
+	static DWORD WINAPI scrub_thread(LPVOID pParam);
 
 public:
 	
@@ -86,11 +139,44 @@ public:
 		m_perr_count = NULL;
 		m_pTestMem = NULL;
 		m_szTotalNumBlocks = 0;
+		m_bHost = false;
+		m_rgHostRegions = NULL;
+		m_nHostRegions = 0;
+		m_nRandomSeed = 1;
+		m_rglHostErrCount[0] = 0;
+		m_rglHostErrCount[1] = 0;
+		m_nDeviceID = 0;
+		m_stream = NULL;
+		m_hScrubThread = NULL;
+		m_hScrubCancel = NULL;
+		m_scrubType = MOV_INV_8;
+		m_nScrubMsPerSec = 0;
+		m_fScrubMBPerSec = 0;
+		m_szScrubBlocksPerSlice = 1;
+		m_llScrubCursor = 0;
+		m_lScrubPasses = 0;
+		m_llScrubBlocksTested = 0;
+		m_lScrubErrorCount = 0;
+		m_llScrubErrorAddr = 0;
+		m_lScrubErr = 0;
+		m_lScrubBusyMs = 0;
+		InitializeCriticalSection(&m_lock);
+	}
+
+	~memtestHandle()
+	{
+		DeleteCriticalSection(&m_lock);
 	}
 
-	long Initialize(Memory<T>* pMem, T fPctToAllocate, size_t* szTotalNumBlocks, T* pfMemAllocated, T* pfMemStartAddress, T* pfMemBlockSize); 
+	long Initialize(Memory<T>* pMem, T fPctToAllocate, bool bHost, size_t* szTotalNumBlocks, T* pfMemAllocated, T* pfMemStartAddress, T* pfMemBlockSize); 
 	long Run(MEMTEST_TYPE testType, size_t szStartOffset, size_t szCount, long* plCount, T** ppfData, bool bVerbose, bool bWrite, bool bReadWrite, bool bRead);
 	long CleanUp();
+
+	long StartScrub(MEMTEST_TYPE testType, int nMsPerSec, T fMBPerSec, size_t szBlocksPerSlice, size_t szStartBlock, int nPasses);
+	long StopScrub();
+	long GetScrubStatus(T* rgStatus, int nCount);
+
+	void RecordHostError(int nHostIdx, void* pAddr);
 };
 
 
@@ -0,0 +1,625 @@
+//=============================================================================
+//	FILE:	modelavg.cu
+//
+//	DESC:	This file implements the asynchronous model averaging server used
+//			for local-SGD and elastic averaging across workers.
+//=============================================================================
+
+#include "util.h"
+#include "memory.h"
+#include "modelavg.h"
+
+
+//=============================================================================
+//	Private Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Model Averaging Slot Class
+//
+//	A queued delta - the copy is made on the pushing worker's stream and
+//	the event tells the averaging thread when it has landed.
+//-----------------------------------------------------------------------------
+class ModelAvgSlot
+{
+public:
+	long m_hData;
+	void* m_data;
+	cudaEvent_t m_evtReady;
+	int m_nWorker;
+	LONG m_lBaseVersion;
+
+	ModelAvgSlot()
+	{
+		m_hData = 0;
+		m_data = NULL;
+		m_evtReady = NULL;
+		m_nWorker = 0;
+		m_lBaseVersion = 0;
+	}
+};
+
+
+//=============================================================================
+//	Lock Free Queue Methods
+//=============================================================================
+
+long LockFreeQueue::Initialize(int nCapacity)
+{
+	CleanUp();
+
+	if (nCapacity <= 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	LONG lSize = 1;
+	while (lSize < nCapacity)
+	{
+		lSize <<= 1;
+	}
+
+	if ((m_rgCells = new Cell[lSize]) == NULL)
+		return ERROR_MEMORY_OUT;
+
+	for (LONG i = 0; i < lSize; i++)
+	{
+		m_rgCells[i].lSeq = i;
+		m_rgCells[i].lData = 0;
+	}
+
+	m_lMask = lSize - 1;
+	m_lEnqueue = 0;
+	m_lDequeue = 0;
+
+	return 0;
+}
+
+void LockFreeQueue::CleanUp()
+{
+	if (m_rgCells != NULL)
+	{
+		delete [] m_rgCells;
+		m_rgCells = NULL;
+	}
+}
+
+bool LockFreeQueue::Push(LONG lData)
+{
+	Cell* pCell;
+	LONG lPos = m_lEnqueue;
+
+	for (;;)
+	{
+		pCell = &m_rgCells[lPos & m_lMask];
+		LONG lDif = (LONG)((ULONG)pCell->lSeq - (ULONG)lPos);
+
+		if (lDif == 0)
+		{
+			if (InterlockedCompareExchange(&m_lEnqueue, lPos + 1, lPos) == lPos)
+				break;
+
+			lPos = m_lEnqueue;
+		}
+		else if (lDif < 0)
+		{
+			return false;	// full.
+		}
+		else
+		{
+			lPos = m_lEnqueue;
+		}
+	}
+
+	pCell->lData = lData;
+	InterlockedExchange(&pCell->lSeq, lPos + 1);
+
+	return true;
+}
+
+bool LockFreeQueue::Pop(LONG* plData)
+{
+	Cell* pCell;
+	LONG lPos = m_lDequeue;
+
+	for (;;)
+	{
+		pCell = &m_rgCells[lPos & m_lMask];
+		LONG lDif = (LONG)((ULONG)pCell->lSeq - (ULONG)(lPos + 1));
+
+		if (lDif == 0)
+		{
+			if (InterlockedCompareExchange(&m_lDequeue, lPos + 1, lPos) == lPos)
+				break;
+
+			lPos = m_lDequeue;
+		}
+		else if (lDif < 0)
+		{
+			return false;	// empty.
+		}
+		else
+		{
+			lPos = m_lDequeue;
+		}
+	}
+
+	*plData = pCell->lData;
+	InterlockedExchange(&pCell->lSeq, lPos + m_lMask + 1);
+
+	return true;
+}
+
+int LockFreeQueue::Count()
+{
+	return (int)(m_lEnqueue - m_lDequeue);
+}
+
+
+//=============================================================================
+//	Class Methods
+//=============================================================================
+
+template <class T>
+long modelAvgHandle<T>::Initialize(Memory<T>* pMem, Math<T>* pMath, long hInitialWeights, T* rgfWeight)
+{
+	LONG lErr;
+	MemoryItem* pItem;
+
+	if (m_nCount <= 0 || m_nWorkers <= 0 || m_nWorkers > MODELAVG_MAX_WORKERS || m_nQueueDepth <= 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (lErr = cudaGetDevice(&m_nDeviceID))
+		return lErr;
+
+	m_pMem = pMem;
+	m_pMath = pMath;
+
+	if (rgfWeight != NULL)
+	{
+		for (int i = 0; i < m_nWorkers; i++)
+		{
+			m_rgfWeight[i] = rgfWeight[i];
+		}
+	}
+
+	try
+	{
+		if (lErr = m_pMem->GetMemory(hInitialWeights, &pItem))
+			throw lErr;
+
+		if (pItem->Size() < m_nCount * sizeof(T))
+			throw (LONG)ERROR_PARAM_OUT_OF_RANGE;
+
+		if (lErr = m_pMem->AllocMemory(m_nDeviceID, m_nCount, NULL, 0, &m_hMaster))
+			throw lErr;
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (lErr = m_pMem->AllocMemory(m_nDeviceID, m_nCount, NULL, 0, &m_rghSnapshot[i]))
+				throw lErr;
+		}
+
+		// The averaging thread only ever touches the raw pointers, never the
+		// memory collection which is owned by the calling thread.
+		void* init = pItem->Data();
+
+		if (lErr = m_pMem->GetSharedMemory(m_hMaster, &pItem))
+			throw lErr;
+
+		m_master = (T*)pItem->Data();
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (lErr = m_pMem->GetSharedMemory(m_rghSnapshot[i], &pItem))
+				throw lErr;
+
+			m_rgSnapshot[i] = (T*)pItem->Data();
+
+			if (lErr = cudaMemcpy(m_rgSnapshot[i], init, m_nCount * sizeof(T), cudaMemcpyDeviceToDevice))
+				throw lErr;
+		}
+
+		if (lErr = cudaMemcpy(m_master, init, m_nCount * sizeof(T), cudaMemcpyDeviceToDevice))
+			throw lErr;
+
+		if ((m_rgSlots = new ModelAvgSlot[m_nQueueDepth]) == NULL)
+			throw (LONG)ERROR_MEMORY_OUT;
+
+		if (lErr = m_queue.Initialize(m_nQueueDepth))
+			throw lErr;
+
+		if (lErr = m_free.Initialize(m_nQueueDepth))
+			throw lErr;
+
+		for (int i = 0; i < m_nQueueDepth; i++)
+		{
+			if (lErr = m_pMem->AllocMemory(m_nDeviceID, m_nCount, NULL, 0, &m_rgSlots[i].m_hData))
+				throw lErr;
+
+			if (lErr = m_pMem->GetSharedMemory(m_rgSlots[i].m_hData, &pItem))
+				throw lErr;
+
+			m_rgSlots[i].m_data = pItem->Data();
+
+			if (lErr = cudaEventCreateWithFlags(&m_rgSlots[i].m_evtReady, cudaEventDisableTiming))
+				throw lErr;
+
+			m_free.Push(i);
+		}
+
+		if (lErr = cudaStreamCreateWithFlags(&m_stream, cudaStreamNonBlocking))
+			throw lErr;
+
+		if ((m_hEvtWork = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL)
+			throw (LONG)ERROR_PARAM_NULL;
+
+		if ((m_hEvtCancel = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL)
+			throw (LONG)ERROR_PARAM_NULL;
+
+		if ((m_hThread = CreateThread(NULL, 0, &modelAvgHandle<T>::threadProc, this, 0, NULL)) == NULL)
+			throw (LONG)ERROR_PARAM_NULL;
+	}
+	catch (LONG lErrEx)
+	{
+		CleanUp();
+		return lErrEx;
+	}
+
+	return 0;
+}
+
+template long modelAvgHandle<double>::Initialize(Memory<double>* pMem, Math<double>* pMath, long hInitialWeights, double* rgfWeight);
+template long modelAvgHandle<float>::Initialize(Memory<float>* pMem, Math<float>* pMath, long hInitialWeights, float* rgfWeight);
+
+
+template <class T>
+long modelAvgHandle<T>::CleanUp()
+{
+	if (m_hThread != NULL)
+	{
+		SetEvent(m_hEvtCancel);
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+		m_hThread = NULL;
+	}
+
+	if (m_hEvtWork != NULL)
+	{
+		CloseHandle(m_hEvtWork);
+		m_hEvtWork = NULL;
+	}
+
+	if (m_hEvtCancel != NULL)
+	{
+		CloseHandle(m_hEvtCancel);
+		m_hEvtCancel = NULL;
+	}
+
+	if (m_stream != NULL)
+	{
+		cudaStreamSynchronize(m_stream);
+		cudaStreamDestroy(m_stream);
+		m_stream = NULL;
+	}
+
+	if (m_rgSlots != NULL)
+	{
+		for (int i = 0; i < m_nQueueDepth; i++)
+		{
+			if (m_rgSlots[i].m_evtReady != NULL)
+				cudaEventDestroy(m_rgSlots[i].m_evtReady);
+
+			if (m_rgSlots[i].m_hData != 0)
+				m_pMem->FreeMemory(m_rgSlots[i].m_hData);
+		}
+
+		delete [] m_rgSlots;
+		m_rgSlots = NULL;
+	}
+
+	m_queue.CleanUp();
+	m_free.CleanUp();
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (m_rghSnapshot[i] != 0)
+		{
+			m_pMem->FreeMemory(m_rghSnapshot[i]);
+			m_rghSnapshot[i] = 0;
+			m_rgSnapshot[i] = NULL;
+		}
+	}
+
+	if (m_hMaster != 0)
+	{
+		m_pMem->FreeMemory(m_hMaster);
+		m_hMaster = 0;
+		m_master = NULL;
+	}
+
+	return 0;
+}
+
+template long modelAvgHandle<double>::CleanUp();
+template long modelAvgHandle<float>::CleanUp();
+
+
+template <class T>
+DWORD WINAPI modelAvgHandle<T>::threadProc(LPVOID pParam)
+{
+	modelAvgHandle<T>* pHandle = (modelAvgHandle<T>*)pParam;
+	LONG lErr = pHandle->run();
+
+	if (lErr)
+		InterlockedExchange(&pHandle->m_lErr, lErr);
+
+	return (DWORD)lErr;
+}
+
+template DWORD WINAPI modelAvgHandle<double>::threadProc(LPVOID pParam);
+template DWORD WINAPI modelAvgHandle<float>::threadProc(LPVOID pParam);
+
+
+template <class T>
+long modelAvgHandle<T>::run()
+{
+	LONG lErr;
+	HANDLE rgWait[2] = { m_hEvtCancel, m_hEvtWork };
+
+	if (lErr = cudaSetDevice(m_nDeviceID))
+		return lErr;
+
+	for (;;)
+	{
+		DWORD dwWait = WaitForMultipleObjects(2, rgWait, FALSE, INFINITE);
+
+		if (dwWait != WAIT_OBJECT_0 + 1)
+			break;
+
+		if (lErr = applyQueued())
+			return lErr;
+	}
+
+	return 0;
+}
+
+template long modelAvgHandle<double>::run();
+template long modelAvgHandle<float>::run();
+
+
+template <class T>
+long modelAvgHandle<T>::applyQueued()
+{
+	LONG lErr;
+	LONG lIdx;
+	std::vector<LONG> rgDone;
+
+	while (m_queue.Pop(&lIdx))
+	{
+		ModelAvgSlot* pSlot = &m_rgSlots[lIdx];
+		LONG lStaleness = m_lVersion - pSlot->m_lBaseVersion;
+
+		rgDone.push_back(lIdx);
+
+		if (m_nMaxStaleness >= 0 && lStaleness > m_nMaxStaleness)
+		{
+			InterlockedIncrement(&m_lDroppedStale);
+			continue;
+		}
+
+		if (lErr = cudaStreamWaitEvent(m_stream, pSlot->m_evtReady, 0))
+			return lErr;
+
+		T fPct = m_rgfWeight[pSlot->m_nWorker];
+
+		// With no original, combine_data adds delta * fPct to the master in place.
+		if (lErr = m_pMath->combine_data(m_nCount, NULL, (T*)pSlot->m_data, fPct, m_master, T(1), m_master, m_stream))
+			return lErr;
+
+		m_dfStalenessTotal += (lStaleness > 0) ? lStaleness : 0;
+		InterlockedIncrement(&m_lVersion);
+		InterlockedIncrement(&m_lApplied);
+	}
+
+	if (rgDone.size() == 0)
+		return 0;
+
+	if (lErr = publish())
+		return lErr;
+
+	// Dropped deltas may still be in flight on the worker's stream.
+	for (int i = 0; i < (int)rgDone.size(); i++)
+	{
+		if (lErr = cudaEventSynchronize(m_rgSlots[rgDone[i]].m_evtReady))
+			return lErr;
+
+		m_free.Push(rgDone[i]);
+	}
+
+	return 0;
+}
+
+template long modelAvgHandle<double>::applyQueued();
+template long modelAvgHandle<float>::applyQueued();
+
+
+template <class T>
+long modelAvgHandle<T>::publish()
+{
+	LONG lErr;
+	LONG nTarget = 1 - m_nPublished;
+
+	// Wait out any pull still reading from the older snapshot.
+	while (m_rgnReaders[nTarget] > 0)
+	{
+		YieldProcessor();
+	}
+
+	if (lErr = cudaMemcpyAsync(m_rgSnapshot[nTarget], m_master, m_nCount * sizeof(T), cudaMemcpyDeviceToDevice, m_stream))
+		return lErr;
+
+	if (lErr = cudaStreamSynchronize(m_stream))
+		return lErr;
+
+	m_rglSnapshotVersion[nTarget] = m_lVersion;
+	InterlockedExchange(&m_nPublished, nTarget);
+
+	return 0;
+}
+
+template long modelAvgHandle<double>::publish();
+template long modelAvgHandle<float>::publish();
+
+
+template <class T>
+long modelAvgHandle<T>::Push(long hStream, int nWorker, long hDelta, long lBaseVersion, bool* pbAccepted)
+{
+	LONG lErr;
+	LONG lIdx;
+	MemoryItem* pDelta;
+
+	if (pbAccepted == NULL)
+		return ERROR_PARAM_NULL;
+
+	*pbAccepted = false;
+
+	if (m_lErr)
+		return m_lErr;
+
+	if (nWorker < 0 || nWorker >= m_nWorkers)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (lErr = m_pMem->GetMemory(hDelta, &pDelta))
+		return lErr;
+
+	if (pDelta->Size() < m_nCount * sizeof(T))
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	// With every slot queued the delta is dropped rather than stalling the worker.
+	if (!m_free.Pop(&lIdx))
+	{
+		InterlockedIncrement(&m_lDroppedFull);
+		return 0;
+	}
+
+	ModelAvgSlot* pSlot = &m_rgSlots[lIdx];
+	cudaStream_t stream = (hStream > 0) ? m_pMem->GetStream(hStream) : NULL;
+
+	if (lErr = cudaMemcpyAsync(pSlot->m_data, pDelta->Data(), m_nCount * sizeof(T), cudaMemcpyDeviceToDevice, stream))
+	{
+		m_free.Push(lIdx);
+		return lErr;
+	}
+
+	if (lErr = cudaEventRecord(pSlot->m_evtReady, stream))
+	{
+		m_free.Push(lIdx);
+		return lErr;
+	}
+
+	pSlot->m_nWorker = nWorker;
+	pSlot->m_lBaseVersion = (LONG)lBaseVersion;
+
+	m_queue.Push(lIdx);
+	InterlockedIncrement(&m_lPushed);
+	SetEvent(m_hEvtWork);
+
+	*pbAccepted = true;
+
+	return 0;
+}
+
+template long modelAvgHandle<double>::Push(long hStream, int nWorker, long hDelta, long lBaseVersion, bool* pbAccepted);
+template long modelAvgHandle<float>::Push(long hStream, int nWorker, long hDelta, long lBaseVersion, bool* pbAccepted);
+
+
+template <class T>
+long modelAvgHandle<T>::Pull(long hStream, long hDst, long* plVersion)
+{
+	LONG lErr;
+	MemoryItem* pDst;
+
+	if (m_lErr)
+		return m_lErr;
+
+	if (lErr = m_pMem->GetMemory(hDst, &pDst))
+		return lErr;
+
+	if (pDst->Size() < m_nCount * sizeof(T))
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	// Pin the latest snapshot - re-check after registering as a reader
+	// for the averaging thread may have switched snapshots in between.
+	LONG nIdx;
+
+	for (;;)
+	{
+		nIdx = m_nPublished;
+		InterlockedIncrement(&m_rgnReaders[nIdx]);
+
+		if (m_nPublished == nIdx)
+			break;
+
+		InterlockedDecrement(&m_rgnReaders[nIdx]);
+	}
+
+	cudaStream_t stream = (hStream > 0) ? m_pMem->GetStream(hStream) : NULL;
+
+	lErr = cudaMemcpyAsync(pDst->Data(), m_rgSnapshot[nIdx], m_nCount * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+
+	if (!lErr)
+		lErr = cudaStreamSynchronize(stream);
+
+	if (plVersion != NULL)
+		*plVersion = (long)m_rglSnapshotVersion[nIdx];
+
+	InterlockedDecrement(&m_rgnReaders[nIdx]);
+
+	return lErr;
+}
+
+template long modelAvgHandle<double>::Pull(long hStream, long hDst, long* plVersion);
+template long modelAvgHandle<float>::Pull(long hStream, long hDst, long* plVersion);
+
+
+template <class T>
+long modelAvgHandle<T>::SetWeight(int nWorker, T fWeight)
+{
+	if (nWorker < 0 || nWorker >= m_nWorkers)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	m_rgfWeight[nWorker] = fWeight;
+
+	return 0;
+}
+
+template long modelAvgHandle<double>::SetWeight(int nWorker, double fWeight);
+template long modelAvgHandle<float>::SetWeight(int nWorker, float fWeight);
+
+
+template <class T>
+long modelAvgHandle<T>::GetStats(T* rgStats, int nCount)
+{
+	if (rgStats == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nCount < MODELAVG_STATS_COUNT)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	LONG lApplied = m_lApplied;
+
+	rgStats[0] = T(m_lVersion);
+	rgStats[1] = T(m_lPushed);
+	rgStats[2] = T(lApplied);
+	rgStats[3] = T(m_lDroppedStale);
+	rgStats[4] = T(m_lDroppedFull);
+	rgStats[5] = (lApplied > 0) ? T(m_dfStalenessTotal / lApplied) : T(0);
+	rgStats[6] = T(m_queue.Count());
+	rgStats[7] = T(m_lErr);
+
+	return 0;
+}
+
+template long modelAvgHandle<double>::GetStats(double* rgStats, int nCount);
+template long modelAvgHandle<float>::GetStats(float* rgStats, int nCount);
+
+// end
@@ -0,0 +1,184 @@
+//=============================================================================
+//	FILE:	modelavg.h
+//
+//	DESC:	This file manages the asynchronous model averaging server.
+//=============================================================================
+#ifndef __MODELAVG_CU__
+#define __MODELAVG_CU__
+
+#include "util.h"
+#include "math.h"
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int MODELAVG_MAX_WORKERS = 64;
+const int MODELAVG_STATS_COUNT = 8;
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+template <class T>
+class Memory;
+
+class ModelAvgSlot;
+
+
+//-----------------------------------------------------------------------------
+//	Lock Free Queue Class
+//
+//	Bounded multi-producer, multi-consumer queue of slot indexes.  Each cell
+//	carries a sequence number that tells a producer (or consumer) whether the
+//	cell is free (or filled) for its position, so only the head and tail
+//	counters are ever contended.  The capacity is rounded up to a power of 2.
+//-----------------------------------------------------------------------------
+class LockFreeQueue
+{
+	struct Cell
+	{
+		volatile LONG lSeq;
+		LONG lData;
+	};
+
+	Cell* m_rgCells;
+	LONG m_lMask;
+	volatile LONG m_lEnqueue;
+	volatile LONG m_lDequeue;
+
+public:
+	LockFreeQueue()
+	{
+		m_rgCells = NULL;
+		m_lMask = 0;
+		m_lEnqueue = 0;
+		m_lDequeue = 0;
+	}
+
+	~LockFreeQueue()
+	{
+		CleanUp();
+	}
+
+	long Initialize(int nCapacity);
+	void CleanUp();
+
+	bool Push(LONG lData);
+	bool Pop(LONG* plData);
+	int Count();
+};
+
+
+//-----------------------------------------------------------------------------
+//	Model Averaging Handle Class
+//
+//	Workers push weight deltas, each tagged with the master version they
+//	were computed from, into a lock free queue.  A background thread applies
+//	them to the master copy in arrival order with Math::combine_data:
+//
+//		master = master + delta * weight[worker]
+//
+//	deltas older than the staleness bound are dropped.  After each batch the
+//	master is published into one of two snapshot buffers which the workers
+//	copy from when they pull, so a pull never waits on the averaging thread.
+//-----------------------------------------------------------------------------
+template <class T>
+class modelAvgHandle
+{
+	Memory<T>* m_pMem;
+	Math<T>* m_pMath;
+	int m_nDeviceID;
+	int m_nCount;				// number of weights.
+	int m_nWorkers;				// number of workers.
+	int m_nMaxStaleness;		// maximum versions a delta may lag behind, < 0 for no bound.
+	int m_nQueueDepth;			// number of deltas that may be queued at once.
+	long m_hMaster;
+	long m_rghSnapshot[2];
+	T* m_master;
+	T* m_rgSnapshot[2];
+	volatile LONG m_rglSnapshotVersion[2];
+	volatile LONG m_nPublished;
+	volatile LONG m_rgnReaders[2];
+	volatile LONG m_lVersion;
+	volatile T m_rgfWeight[MODELAVG_MAX_WORKERS];
+	ModelAvgSlot* m_rgSlots;
+	LockFreeQueue m_queue;
+	LockFreeQueue m_free;
+	cudaStream_t m_stream;
+	HANDLE m_hThread;
+	HANDLE m_hEvtWork;
+	HANDLE m_hEvtCancel;
+	volatile LONG m_lErr;
+	volatile LONG m_lPushed;
+	volatile LONG m_lApplied;
+	volatile LONG m_lDroppedStale;
+	volatile LONG m_lDroppedFull;
+	double m_dfStalenessTotal;
+
+	static DWORD WINAPI threadProc(LPVOID pParam);
+	long run();
+	long applyQueued();
+	long publish();
+
+public:
+
+	modelAvgHandle(int nCount, int nWorkers, int nMaxStaleness, int nQueueDepth)
+	{
+		m_pMem = NULL;
+		m_pMath = NULL;
+		m_nDeviceID = 0;
+		m_nCount = nCount;
+		m_nWorkers = nWorkers;
+		m_nMaxStaleness = nMaxStaleness;
+		m_nQueueDepth = nQueueDepth;
+		m_hMaster = 0;
+		m_rghSnapshot[0] = 0;
+		m_rghSnapshot[1] = 0;
+		m_master = NULL;
+		m_rgSnapshot[0] = NULL;
+		m_rgSnapshot[1] = NULL;
+		m_rglSnapshotVersion[0] = 0;
+		m_rglSnapshotVersion[1] = 0;
+		m_nPublished = 0;
+		m_rgnReaders[0] = 0;
+		m_rgnReaders[1] = 0;
+		m_lVersion = 0;
+		m_rgSlots = NULL;
+		m_stream = NULL;
+		m_hThread = NULL;
+		m_hEvtWork = NULL;
+		m_hEvtCancel = NULL;
+		m_lErr = 0;
+		m_lPushed = 0;
+		m_lApplied = 0;
+		m_lDroppedStale = 0;
+		m_lDroppedFull = 0;
+		m_dfStalenessTotal = 0;
+
+		for (int i = 0; i < MODELAVG_MAX_WORKERS; i++)
+		{
+			m_rgfWeight[i] = (nWorkers > 0) ? T(1.0) / T(nWorkers) : T(1.0);
+		}
+	}
+
+	long Initialize(Memory<T>* pMem, Math<T>* pMath, long hInitialWeights, T* rgfWeight); // Allocates the master, snapshots and queue slots, starts the thread.
+	long CleanUp();			// Stops the thread and frees memory.
+
+	long Push(long hStream, int nWorker, long hDelta, long lBaseVersion, bool* pbAccepted);
+	long Pull(long hStream, long hDst, long* plVersion);
+	long SetWeight(int nWorker, T fWeight);
+	long GetStats(T* rgStats, int nCount);
+};
+
+
+//=============================================================================
+//	Inline Methods
+//=============================================================================
+
+
+#endif
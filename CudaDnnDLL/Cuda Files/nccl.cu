@@ -11,6 +11,8 @@
 #include "memory.h"
 #include "..\_nccl\nccl.h"
 #include <nvapi.h>
+#include <vector>
+#include <map>
 
 
 //=============================================================================
@@ -23,6 +25,9 @@ typedef ncclResult_t (*LPNCCLCOMMDESTROY)(ncclComm_t comm);
 typedef const char* (*LPNCCLGETERRORSTRING)(ncclResult_t result);
 typedef ncclResult_t (*LPNCCLALLREDUCE)(const void* sendbuff, void* recvbuff, int count, ncclDataType_t datatype, ncclRedOp_t op, ncclComm_t comm, cudaStream_t stream);
 typedef ncclResult_t (*LPNCCLBCAST)(void* buff, int count, ncclDataType_t datatype, int root, ncclComm_t comm, cudaStream_t stream);
+typedef ncclResult_t (*LPNCCLALLGATHER)(const void* sendbuff, int count, ncclDataType_t datatype, void* recvbuff, ncclComm_t comm, cudaStream_t stream);
+typedef ncclResult_t (*LPNCCLREDUCE)(const void* sendbuff, void* recvbuf, int count, ncclDataType_t datatype, ncclRedOp_t op, int root, ncclComm_t comm, cudaStream_t stream);
+typedef ncclResult_t (*LPNCCLREDUCESCATTER)(const void* sendbuff, void* recvbuff, int recvcount, ncclDataType_t datatype, ncclRedOp_t op, ncclComm_t comm, cudaStream_t stream);
 
 
 //=============================================================================
@@ -42,6 +47,9 @@ public:
 	LPNCCLCOMMDESTROY m_pCommDestroy;
 	LPNCCLALLREDUCE m_pAllReduce;
 	LPNCCLBCAST m_pBcast;
+	LPNCCLALLGATHER m_pAllGather;
+	LPNCCLREDUCE m_pReduce;
+	LPNCCLREDUCESCATTER m_pReduceScatter;
 	LPNCCLGETERRORSTRING m_pGetErrorString;
 
 	Data(int nCount, int nRank, char* szId)
@@ -99,6 +107,18 @@ public:
 		if (m_pBcast == NULL)
 			return ERROR_PARAM_NULL;
 
+		m_pAllGather = (LPNCCLALLGATHER)GetProcAddress(m_hDLL, "ncclAllGather");
+		if (m_pAllGather == NULL)
+			return ERROR_PARAM_NULL;
+
+		m_pReduce = (LPNCCLREDUCE)GetProcAddress(m_hDLL, "ncclReduce");
+		if (m_pReduce == NULL)
+			return ERROR_PARAM_NULL;
+
+		m_pReduceScatter = (LPNCCLREDUCESCATTER)GetProcAddress(m_hDLL, "ncclReduceScatter");
+		if (m_pReduceScatter == NULL)
+			return ERROR_PARAM_NULL;
+
 		m_pGetErrorString = (LPNCCLGETERRORSTRING)GetProcAddress(m_hDLL, "ncclGetErrorString");
 		if (m_pGetErrorString == NULL)
 			return ERROR_PARAM_NULL;
@@ -136,6 +156,21 @@ public:
 		return (*m_pBcast)(buff, count, datatype, root, comm, stream);
 	}
 
+	ncclResult_t NcclAllGather(const void* sendbuff, int count, ncclDataType_t datatype, void* recvbuff, ncclComm_t comm, cudaStream_t stream)
+	{
+		return (*m_pAllGather)(sendbuff, count, datatype, recvbuff, comm, stream);
+	}
+
+	ncclResult_t NcclReduce(const void* sendbuff, void* recvbuf, int count, ncclDataType_t datatype, ncclRedOp_t op, int root, ncclComm_t comm, cudaStream_t stream)
+	{
+		return (*m_pReduce)(sendbuff, recvbuf, count, datatype, op, root, comm, stream);
+	}
+
+	ncclResult_t NcclReduceScatter(const void* sendbuff, void* recvbuff, int recvcount, ncclDataType_t datatype, ncclRedOp_t op, ncclComm_t comm, cudaStream_t stream)
+	{
+		return (*m_pReduceScatter)(sendbuff, recvbuff, recvcount, datatype, op, comm, stream);
+	}
+
 	~Data()
 	{
 		if (m_comm != NULL)
@@ -153,312 +188,1789 @@ public:
 			m_pCommInitRank = NULL;
 			m_pAllReduce = NULL;
 			m_pBcast = NULL;
+			m_pAllGather = NULL;
+			m_pReduce = NULL;
+			m_pReduceScatter = NULL;
 			m_pGetErrorString = NULL;
 		}
 	}
 };
 
 
-//=============================================================================
-//	Class Methods
-//=============================================================================
-
-template <class T>
-long ncclHandle<T>::isDisplayConnectedToGpu(int nGpuID, bool* pbIsDisplayOn)
+//-----------------------------------------------------------------------------
+//	Bucket Item Class
+//
+//	This class describes a single bucket of gradients that are reduced with
+//	one NCCL call.  When the gradients of the bucket are laid out back to
+//	back in GPU memory the bucket is reduced in place (m_hBuffer = 0),
+//	otherwise the gradients are packed into (and unpacked from) the
+//	flattened m_hBuffer.
+//-----------------------------------------------------------------------------
+class BucketItem
 {
-	LONG lErr;
+public:
+	int m_nFirst;
+	int m_nCount;
+	long m_lItems;
+	long m_hBuffer;
+	int m_nReady;
 
-	char rgID[256];
-	if (lErr = cudaDeviceGetPCIBusId(rgID, 255, nGpuID))
-		return lErr;
+	BucketItem(int nFirst)
+	{
+		m_nFirst = nFirst;
+		m_nCount = 0;
+		m_lItems = 0;
+		m_hBuffer = 0;
+		m_nReady = 0;
+	}
+};
 
-	char* psz = strtok(rgID, ":");
-	if (psz == NULL)
-		return ERROR_PARAM_OUT_OF_RANGE;
 
-	psz = strtok(NULL, ":");
-	if (psz == NULL)
-		return ERROR_PARAM_OUT_OF_RANGE;
+//-----------------------------------------------------------------------------
+//	Bucket Data Class
+//
+//	This class stores the registered gradients and the buckets they are
+//	packed into.  Buckets are launched strictly in order so that every
+//	rank issues the same sequence of NCCL calls.  Once all buckets of a
+//	pass are launched the pass is done, and the state is only reset when
+//	the next pass starts so that a flush after a full pass does not reduce
+//	the buckets a second time.
+//-----------------------------------------------------------------------------
+class BucketData
+{
+public:
+	void* m_pMem;
+	NCCL_OP m_op;
+	double m_dfScale;
+	std::vector<long> m_rghGrad;
+	std::vector<long> m_rglGradCount;
+	std::vector<int> m_rgnGradBucket;
+	std::vector<bool> m_rgbGradReady;
+	std::vector<BucketItem> m_rgBuckets;
+	int m_nNextBucket;
+	bool m_bPassDone;
+
+	BucketData(void* pMem, NCCL_OP op, double dfScale)
+	{
+		m_pMem = pMem;
+		m_op = op;
+		m_dfScale = dfScale;
+		m_nNextBucket = 0;
+		m_bPassDone = false;
+	}
 
-	int nCudaBusID = atoi(psz);
+	void Reset()
+	{
+		for (int i = 0; i < (int)m_rgbGradReady.size(); i++)
+		{
+			m_rgbGradReady[i] = false;
+		}
 
-	NvAPI_Status status;
+		for (int i = 0; i < (int)m_rgBuckets.size(); i++)
+		{
+			m_rgBuckets[i].m_nReady = 0;
+		}
 
-	if ((status = NvAPI_Initialize()) != NVAPI_OK)
-		return status;
+		m_nNextBucket = 0;
+		m_bPassDone = false;
+	}
+};
 
-	NvPhysicalGpuHandle gpuHandles[256];
-	NvPhysicalGpuHandle gpuTccHandles[256];
-	NvU32 numOfGPUs;
-	NvU32 numOfTccGPUs;
 
-	if ((status = NvAPI_EnumPhysicalGPUs(gpuHandles, &numOfGPUs)) != NVAPI_OK)
+//-----------------------------------------------------------------------------
+//	Compression Data Class
+//
+//	This class stores the gradient compression settings of a handle along
+//	with its scratch buffers, the per-gradient error-feedback residuals
+//	used by top-k sparsification and the running compression statistics.
+//-----------------------------------------------------------------------------
+struct CompressionState
+{
+	int nCount;
+	int nCleanCalls;
+	int nOverflows;
+	float fLossScale;
+	double dfResidualSumSq;
+};
+
+class CompressionData
+{
+public:
+	NCCL_COMPRESSION m_type;
+	double m_dfRatio;
+	double m_dfLossScale;
+	CompressionState* m_pState;
+	cudaEvent_t m_evtState;
+	bool m_bStatePending;
+	void* m_pPack;
+	size_t m_lPack;
+	void* m_pGather;
+	size_t m_lGather;
+	void* m_pScratch;
+	size_t m_lScratch;
+	std::map<long, std::pair<void*, size_t>> m_rgResidual;
+	double m_dfCalls;
+	double m_dfLastRatio;
+	double m_dfLastResidualNorm;
+	double m_dfOverflows;
+	double m_dfBytesSent;
+	double m_dfBytesRaw;
+
+	CompressionData(NCCL_COMPRESSION type, double dfParam)
 	{
-		NvAPI_Unload();
-		return status;
+		m_type = type;
+		m_dfRatio = 0.01;
+		m_dfLossScale = 1.0;
+		m_pState = NULL;
+		m_evtState = NULL;
+		m_bStatePending = false;
+		m_pPack = NULL;
+		m_lPack = 0;
+		m_pGather = NULL;
+		m_lGather = 0;
+		m_pScratch = NULL;
+		m_lScratch = 0;
+		m_dfCalls = 0;
+		m_dfLastRatio = 1.0;
+		m_dfLastResidualNorm = 0;
+		m_dfOverflows = 0;
+		m_dfBytesSent = 0;
+		m_dfBytesRaw = 0;
+
+		if (type == NCCL_COMPRESS_TOPK)
+		{
+			if (dfParam > 0)
+				m_dfRatio = dfParam;
+		}
+		else if (type == NCCL_COMPRESS_FP16)
+		{
+			m_dfLossScale = (dfParam > 0) ? dfParam : 1024.0;
+		}
+		else if (dfParam > 0)
+		{
+			m_dfLossScale = dfParam;
+		}
 	}
 
-	if ((status = NvAPI_EnumTCCPhysicalGPUs(gpuTccHandles, &numOfTccGPUs)) != NVAPI_OK)
+	~CompressionData()
 	{
-		NvAPI_Unload();
-		return status;
-	}
+		if (m_pPack != NULL)
+			cudaFree(m_pPack);
 
-	int nIdx = -1;
-	int nIdxTcc = -1;
+		if (m_pGather != NULL)
+			cudaFree(m_pGather);
 
-	for (int i = 0; i < (int)numOfGPUs; i++)
-	{
-		NvU32 busID = 0;
+		if (m_pScratch != NULL)
+			cudaFree(m_pScratch);
 
-		if ((status = NvAPI_GPU_GetBusId(gpuHandles[i], &busID)) != NVAPI_OK)
+		if (m_pState != NULL)
+			cudaFree(m_pState);
+
+		if (m_evtState != NULL)
+			cudaEventDestroy(m_evtState);
+
+		std::map<long, std::pair<void*, size_t>>::iterator it;
+		for (it = m_rgResidual.begin(); it != m_rgResidual.end(); it++)
 		{
-			NvAPI_Unload();
-			return status;
+			cudaFree(it->second.first);
 		}
+	}
 
-		if (nCudaBusID == (int)busID)
+	LONG Initialize()
+	{
+		LONG lErr;
+
+		if (m_type == NCCL_COMPRESS_TOPK && (m_dfRatio <= 0 || m_dfRatio > 1))
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		if (lErr = cudaEventCreateWithFlags(&m_evtState, cudaEventDisableTiming))
+			return lErr;
+
+		if (lErr = cudaMalloc(&m_pState, sizeof(CompressionState)))
+			return lErr;
+
+		CompressionState state;
+		memset(&state, 0, sizeof(state));
+		state.fLossScale = (float)m_dfLossScale;
+
+		return cudaMemcpy(m_pState, &state, sizeof(state), cudaMemcpyHostToDevice);
+	}
+
+	LONG Reserve(void** ppBuf, size_t* plSize, size_t lSize)
+	{
+		if (*plSize >= lSize)
+			return 0;
+
+		if (*ppBuf != NULL)
 		{
-			nIdx = i;
-			break;
+			cudaFree(*ppBuf);
+			*ppBuf = NULL;
+			*plSize = 0;
 		}
+
+		LONG lErr = cudaMalloc(ppBuf, lSize);
+		if (lErr)
+			return lErr;
+
+		*plSize = lSize;
+		return 0;
 	}
 
-	if (nIdx == -1)
+	LONG GetResidual(long hX, size_t lSize, void** ppResidual)
 	{
-		for (int i = 0; i < (int)numOfTccGPUs; i++)
-		{
-			NvU32 busID = 0;
+		std::map<long, std::pair<void*, size_t>>::iterator it = m_rgResidual.find(hX);
 
-			if ((status = NvAPI_GPU_GetBusId(gpuTccHandles[i], &busID)) != NVAPI_OK)
+		if (it != m_rgResidual.end())
+		{
+			if (it->second.second == lSize)
 			{
-				NvAPI_Unload();
-				return status;
+				*ppResidual = it->second.first;
+				return 0;
 			}
 
-			if (nCudaBusID == (int)busID)
-			{
-				nIdxTcc = i;
-				break;
-			}
+			cudaFree(it->second.first);
+			m_rgResidual.erase(it);
 		}
-	}
 
-	if (nIdx == -1 && nIdxTcc == -1)
-		return ERROR_PARAM_OUT_OF_RANGE;
+		void* pResidual = NULL;
+		LONG lErr;
 
-	NvU32 connectedDisplays = 0;
+		if (lErr = cudaMalloc(&pResidual, lSize))
+			return lErr;
 
-	if (nIdx > 0)
-	{
-		if ((status = NvAPI_GPU_GetConnectedDisplayIds(gpuHandles[nIdx], NULL, &connectedDisplays, NULL)) != NVAPI_OK)
+		if (lErr = cudaMemset(pResidual, 0, lSize))
 		{
-			NvAPI_Unload();
-			return status;
+			cudaFree(pResidual);
+			return lErr;
 		}
-	}
 
-	*pbIsDisplayOn = (connectedDisplays > 0) ? true : false;
-	NvAPI_Unload();
+		m_rgResidual[hX] = std::make_pair(pResidual, lSize);
+		*ppResidual = pResidual;
 
-	return 0;
-}
+		return 0;
+	}
 
-template <class T>
-void ncclHandle<T>::setBufferSize(long lBufferCount)
-{
-	if (lBufferCount > 0)
+	void AddStats(size_t lSent, size_t lRaw)
 	{
-		lBufferCount *= sizeof(T);
-		lBufferCount /= 64;
-		lBufferCount = (lBufferCount + 1) * 64;
-
-		char szBuffer[256];
-		snprintf(szBuffer, 255, "NCCL_BUFFSIZE=%ld", lBufferCount);
-		putenv(szBuffer);
+		m_dfCalls++;
+		m_dfLastRatio = (double)lSent / (double)lRaw;
+		m_dfBytesSent += (double)lSent;
+		m_dfBytesRaw += (double)lRaw;
 	}
-}
-
-template <class T>
-long ncclHandle<T>::Initialize(Memory<T>* pMem, Math<T>* pMath, int nGpuID, int nCount, int nRank, char* szId)
-{
-	long lErr;
-	int nDevCount;
 
-	m_nGpuID = nGpuID;
-	Update(pMem, pMath);
+	// The loss scale, overflows and residual norm stay on the device so that
+	// the reductions never wait on the stream, they are only read back when
+	// the statistics are queried.
+	LONG MarkStatePending(cudaStream_t stream)
+	{
+		LONG lErr;
 
-	if (lErr = cudaGetDeviceCount(&nDevCount))
-		return lErr;
+		if (lErr = cudaEventRecord(m_evtState, stream))
+			return lErr;
 
-	if (nGpuID < 0 || nGpuID >= nDevCount)
-		return ERROR_PARAM_OUT_OF_RANGE;
+		m_bStatePending = true;
+		return 0;
+	}
 
-	bool bDisplayOn = false;
-	if (lErr = isDisplayConnectedToGpu(nGpuID, &bDisplayOn))
-		return lErr;
+	LONG LoadState()
+	{
+		LONG lErr;
 
-	if (bDisplayOn)
-		return ERROR_CUDA_NOTSUPPORED_ON_DISPLAYGPU;
+		if (!m_bStatePending)
+			return 0;
 
-	m_pData = new Data(nCount, nRank, szId);
-	if (m_pData == NULL)
-		return ERROR_MEMORY_OUT;
+		if (lErr = cudaEventSynchronize(m_evtState))
+			return lErr;
 
-	if (lErr = m_pData->Initialize())
-		return lErr;
+		CompressionState state;
+		if (lErr = cudaMemcpy(&state, m_pState, sizeof(state), cudaMemcpyDeviceToHost))
+			return lErr;
 
-	return 0;
-}
+		if (m_type == NCCL_COMPRESS_FP16)
+		{
+			m_dfLossScale = state.fLossScale;
+			m_dfOverflows = state.nOverflows;
+		}
+		else if (m_type == NCCL_COMPRESS_TOPK)
+		{
+			m_dfLastResidualNorm = sqrt(state.dfResidualSumSq);
+		}
 
-template long ncclHandle<double>::Initialize(Memory<double>* pMem, Math<double>* pMath, int nGpuID, int nCount, int nRank, char* szId);
-template long ncclHandle<float>::Initialize(Memory<float>* pMem, Math<float>* pMath, int nGpuID, int nCount, int nRank, char* szId);
+		m_bStatePending = false;
+		return 0;
+	}
+};
 
 
-template <class T>
-long ncclHandle<T>::Update(Memory<T>* pMem, Math<T>* pMath)
+//-----------------------------------------------------------------------------
+//	Hierarchy Data Class
+//
+//	This class stores the communicators a handle uses for the hierarchical
+//	collectives - one shared with the other ranks of its group and one shared
+//	with the ranks of the other groups (m_commCross is NULL when the rank does
+//	not take part in the inter-group step).
+//-----------------------------------------------------------------------------
+class HierarchyData
 {
-	m_pMem = pMem;
-	m_pMath = pMath;
-	m_pMemCol = pMem->GetMemoryCollection();
-	m_nRefCount++;
-	return 0;
-}
+public:
+	ncclComm_t m_commGroup;
+	ncclComm_t m_commCross;
+	int m_nGroupSize;
+	int m_nLocalRank;
+	int m_nCrossSize;
+	bool m_bUniform;
+
+	HierarchyData()
+	{
+		m_commGroup = NULL;
+		m_commCross = NULL;
+		m_nGroupSize = 0;
+		m_nLocalRank = 0;
+		m_nCrossSize = 0;
+		m_bUniform = true;
+	}
+};
 
-template long ncclHandle<double>::Update(Memory<double>* pMem, Math<double>* pMath);
-template long ncclHandle<float>::Update(Memory<float>* pMem, Math<float>* pMath);
 
+//=============================================================================
+//	Local Functions
+//=============================================================================
 
-template <class T>
-long ncclHandle<T>::CleanUp()
+static ncclRedOp_t getNcclOp(NCCL_OP op)
 {
-	m_nRefCount--;
-
-	if (m_nRefCount == 0)
-	{
-		if (m_pData != NULL)
-		{
-			delete m_pData;
-			m_pData = NULL;
-		}
-	}
+	if (op == NCCL_PROD)
+		return ncclProd;
+	else if (op == NCCL_MIN)
+		return ncclMin;
+	else if (op == NCCL_MAX)
+		return ncclMax;
 
-	return 0;
+	return ncclSum;
 }
 
-template long ncclHandle<double>::CleanUp();
-template long ncclHandle<float>::CleanUp();
-
-
 template <class T>
-LPCSTR ncclHandle<T>::GetErrorString(long lErr)
+__global__ void compress_half_kernel(const int n, const T* x, __half* y, const CompressionState* pState)
 {
-	return m_pData->NcclGetErrorString((ncclResult_t)lErr);
+	float fLossScale = pState->fLossScale;
+
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		y[i] = __float2half((float)x[i] * fLossScale);
+	}
 }
 
-template LPCSTR ncclHandle<double>::GetErrorString(long lErr);
-template LPCSTR ncclHandle<float>::GetErrorString(long lErr);
+__global__ void count_nonfinite_half_kernel(const int n, const __half* y, int* pCount)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		float f = __half2float(y[i]);
 
+		if (isinf(f) || isnan(f))
+			atomicAdd(pCount, 1);
+	}
+}
 
+// An overflowed sum is identical on every rank, so every rank zeroes its
+// values and skips the step, as the usual dynamic loss scaling does.
 template <class T>
-long ncclHandle<T>::InitSingleProcess(long lBufferCount, int nCount, ncclHandle<T>* rgHandles[])
+__global__ void decompress_half_kernel(const int n, const __half* y, T* x, const T fScale, const CompressionState* pState)
 {
-	LONG lErr;
-	ncclComm_t* rgComm = (ncclComm_t*)malloc(sizeof(ncclComm_t) * nCount);
-	if (rgComm == NULL)
-		return ERROR_MEMORY_OUT;
+	bool bOverflow = (pState->nCount > 0);
+	T fUnscale = fScale / (T)pState->fLossScale;
 
-	int* rgGpu = (int*)malloc(sizeof(int) * nCount);
-	if (rgGpu == NULL)
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
 	{
-		free(rgComm);
-		return ERROR_MEMORY_OUT;
+		x[i] = (bOverflow) ? T(0) : (T)__half2float(y[i]) * fUnscale;
 	}
+}
 
-	for (int i = 0; i < nCount; i++)
+__global__ void update_loss_scale_kernel(CompressionState* pState)
+{
+	if (pState->nCount > 0)
 	{
-		rgGpu[i] = rgHandles[i]->m_nGpuID;
-	}
+		pState->nOverflows++;
+		pState->nCleanCalls = 0;
 
-	setBufferSize(lBufferCount);
-	lErr = m_pData->NcclCommInitAll(rgComm, nCount, rgGpu);
-	if (!lErr)
+		if (pState->fLossScale > 1.0f)
+			pState->fLossScale /= 2.0f;
+	}
+	else
 	{
-		for (int i = 0; i < nCount; i++)
+		pState->nCleanCalls++;
+
+		if (pState->nCleanCalls >= 1000 && pState->fLossScale < 65536.0f)
 		{
-			rgHandles[i]->m_pData->m_comm = rgComm[i];
+			pState->fLossScale *= 2.0f;
+			pState->nCleanCalls = 0;
 		}
 	}
-
-	free(rgComm);
-	free(rgGpu);
-
-	return lErr;
 }
 
-template long ncclHandle<double>::InitSingleProcess(long lBufferCount, int nCount, ncclHandle<double>* rgHandles[]);
-template long ncclHandle<float>::InitSingleProcess(long lBufferCount, int nCount, ncclHandle<float>* rgHandles[]);
-
-
+template <class T>
+__global__ void compress_bf16_kernel(const int n, const T* x, unsigned short* y, const float fLossScale)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		y[i] = float_to_bf16((float)x[i] * fLossScale);
+	}
+}
+
+template <class T>
+__global__ void decompress_bf16_kernel(const int n, const int nRanks, const unsigned short* y, T* x, const T fScale)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		float fSum = 0;
+
+		for (int r=0; r<nRanks; r++)
+		{
+			fSum += bf16_to_float(y[r * n + i]);
+		}
+
+		x[i] = (T)fSum * fScale;
+	}
+}
+
+template <class T>
+__global__ void accumulate_residual_kernel(const int n, const T* x, T* r)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		r[i] += x[i];
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	The top-k threshold is found with a radix select over the bits of the
+//	absolute values, which order the same as the values themselves.  Each
+//	pass counts the next 8 bits of the keys that match the prefix found so
+//	far and keeps the bin holding the k'th largest key, so the threshold
+//	stays on the device and no sort of the whole buffer is needed.
+//-----------------------------------------------------------------------------
+const int TOPK_RADIX_BITS = 8;
+const int TOPK_RADIX = 1 << TOPK_RADIX_BITS;
+
+struct TopKState
+{
+	unsigned long long llPrefix;
+	unsigned long long llMask;
+	unsigned int nK;
+};
+
+__device__ inline unsigned long long topk_key(float f)
+{
+	return (unsigned long long)__float_as_uint(fabsf(f));
+}
+
+__device__ inline unsigned long long topk_key(double f)
+{
+	return (unsigned long long)__double_as_longlong(fabs(f));
+}
+
+__global__ void topk_init_kernel(TopKState* pState, const int k)
+{
+	pState->llPrefix = 0;
+	pState->llMask = 0;
+	pState->nK = (unsigned int)k;
+}
+
+template <class T>
+__global__ void topk_histogram_kernel(const int n, const T* r, const int nShift, const TopKState* pState, unsigned int* rgHist)
+{
+	__shared__ unsigned int rgLocal[TOPK_RADIX];
+	unsigned long long llPrefix = pState->llPrefix;
+	unsigned long long llMask = pState->llMask;
+
+	for (int i=threadIdx.x; i<TOPK_RADIX; i += blockDim.x)
+	{
+		rgLocal[i] = 0;
+	}
+
+	__syncthreads();
+
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		unsigned long long llKey = topk_key(r[i]);
+
+		if ((llKey & llMask) == llPrefix)
+			atomicAdd(&rgLocal[(llKey >> nShift) & (TOPK_RADIX - 1)], 1);
+	}
+
+	__syncthreads();
+
+	for (int i=threadIdx.x; i<TOPK_RADIX; i += blockDim.x)
+	{
+		if (rgLocal[i] > 0)
+			atomicAdd(&rgHist[i], rgLocal[i]);
+	}
+}
+
+__global__ void topk_pick_kernel(const int nShift, const unsigned int* rgHist, TopKState* pState)
+{
+	unsigned int nK = pState->nK;
+
+	// Walk down from the largest bin, the k'th largest key is in the first
+	// bin that holds at least the keys still to be passed.
+	for (int b=TOPK_RADIX - 1; b>=0; b--)
+	{
+		if (rgHist[b] >= nK || b == 0)
+		{
+			pState->llPrefix |= (unsigned long long)b << nShift;
+			pState->llMask |= (unsigned long long)(TOPK_RADIX - 1) << nShift;
+			pState->nK = nK;
+			return;
+		}
+
+		nK -= rgHist[b];
+	}
+}
+
+template <class T>
+__global__ void select_topk_kernel(const int n, const int k, const TopKState* pState, const bool bAbove, T* r, T* rgVal, int* rgIdx, int* pSlot)
+{
+	unsigned long long llThreshold = pState->llPrefix;
+
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		T fVal = r[i];
+		unsigned long long llKey = topk_key(fVal);
+		bool bSelect = (bAbove) ? (llKey > llThreshold) : (llKey == llThreshold && fVal != 0);
+
+		if (bSelect)
+		{
+			int nSlot = atomicAdd(pSlot, 1);
+
+			if (nSlot < k)
+			{
+				rgVal[nSlot] = fVal;
+				rgIdx[nSlot] = i;
+				r[i] = 0;
+			}
+		}
+	}
+}
+
+template <class T>
+__global__ void scatter_add_kernel(const int k, const T* rgVal, const int* rgIdx, T* x)
+{
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<k; i += blockDim.x * gridDim.x)
+	{
+		int nIdx = rgIdx[i];
+
+		if (nIdx >= 0)
+			x[nIdx] += rgVal[i];
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	The residual sum of squares is reduced in two steps, each block sums
+//	its part into one partial and a single thread adds up the partials into
+//	the compression state, so the result stays on the device.
+//-----------------------------------------------------------------------------
+const int SUMSQ_BLOCKS = 128;
+const int SUMSQ_THREADS = 256;
+
+template <class T>
+__global__ void sumsq_partial_kernel(const int n, const T* r, double* rgPartial)
+{
+	__shared__ double rgLocal[SUMSQ_THREADS];
+	double dfSum = 0;
+
+	for (int i=blockIdx.x * blockDim.x + threadIdx.x; i<n; i += blockDim.x * gridDim.x)
+	{
+		dfSum += (double)r[i] * (double)r[i];
+	}
+
+	rgLocal[threadIdx.x] = dfSum;
+	__syncthreads();
+
+	for (int s=blockDim.x / 2; s>0; s >>= 1)
+	{
+		if (threadIdx.x < s)
+			rgLocal[threadIdx.x] += rgLocal[threadIdx.x + s];
+
+		__syncthreads();
+	}
+
+	if (threadIdx.x == 0)
+		rgPartial[blockIdx.x] = rgLocal[0];
+}
+
+__global__ void sumsq_final_kernel(const double* rgPartial, CompressionState* pState)
+{
+	double dfSum = 0;
+
+	for (int i=0; i<SUMSQ_BLOCKS; i++)
+	{
+		dfSum += rgPartial[i];
+	}
+
+	pState->dfResidualSumSq = dfSum;
+}
+
+
+//=============================================================================
+//	Class Methods
+//=============================================================================
+
+long ncclHierarchy::FindGroups(int nCount, const bool* rgbPeer, int* rgGroupId)
+{
+	if (nCount <= 0 || rgbPeer == NULL || rgGroupId == NULL)
+		return ERROR_PARAM_NULL;
+
+	for (int i = 0; i < nCount; i++)
+	{
+		rgGroupId[i] = -1;
+	}
+
+	// Ranks that can access one another (both ways) share a group; groups
+	// are the connected components, numbered by their lowest rank.
+	int nGroup = 0;
+
+	for (int i = 0; i < nCount; i++)
+	{
+		if (rgGroupId[i] >= 0)
+			continue;
+
+		std::vector<int> rgStack;
+		rgStack.push_back(i);
+		rgGroupId[i] = nGroup;
+
+		while (rgStack.size() > 0)
+		{
+			int nRank = rgStack.back();
+			rgStack.pop_back();
+
+			for (int j = 0; j < nCount; j++)
+			{
+				if (rgGroupId[j] >= 0)
+					continue;
+
+				if (rgbPeer[nRank * nCount + j] && rgbPeer[j * nCount + nRank])
+				{
+					rgGroupId[j] = nGroup;
+					rgStack.push_back(j);
+				}
+			}
+		}
+
+		nGroup++;
+	}
+
+	return 0;
+}
+
+long ncclHierarchy::Build(int nCount, const int* rgGroupId)
+{
+	if (nCount <= 0 || rgGroupId == NULL)
+		return ERROR_PARAM_NULL;
+
+	std::vector<int> rgId;
+
+	m_rgGroups.clear();
+	m_rgCross.clear();
+
+	// Groups are ordered by their first rank, ranks within a group by rank.
+	for (int i = 0; i < nCount; i++)
+	{
+		if (rgGroupId[i] < 0)
+			return ERROR_PARAM_OUT_OF_RANGE;
+
+		int nGroup = -1;
+
+		for (int g = 0; g < (int)rgId.size(); g++)
+		{
+			if (rgId[g] == rgGroupId[i])
+			{
+				nGroup = g;
+				break;
+			}
+		}
+
+		if (nGroup < 0)
+		{
+			rgId.push_back(rgGroupId[i]);
+			m_rgGroups.push_back(std::vector<int>());
+			nGroup = (int)m_rgGroups.size() - 1;
+		}
+
+		m_rgGroups[nGroup].push_back(i);
+	}
+
+	m_bUniform = true;
+
+	for (int g = 1; g < (int)m_rgGroups.size(); g++)
+	{
+		if (m_rgGroups[g].size() != m_rgGroups[0].size())
+		{
+			m_bUniform = false;
+			break;
+		}
+	}
+
+	// Uniform groups exchange shard j between the j'th ranks of every group,
+	// otherwise only the group leaders (local rank 0) talk across groups.
+	int nCrossCount = (m_bUniform) ? (int)m_rgGroups[0].size() : 1;
+
+	for (int j = 0; j < nCrossCount; j++)
+	{
+		std::vector<int> rgCross;
+
+		for (int g = 0; g < (int)m_rgGroups.size(); g++)
+		{
+			rgCross.push_back(m_rgGroups[g][j]);
+		}
+
+		m_rgCross.push_back(rgCross);
+	}
+
+	return 0;
+}
+
+int ncclHierarchy::GroupOf(int nRank)
+{
+	for (int g = 0; g < (int)m_rgGroups.size(); g++)
+	{
+		for (int i = 0; i < (int)m_rgGroups[g].size(); i++)
+		{
+			if (m_rgGroups[g][i] == nRank)
+				return g;
+		}
+	}
+
+	return -1;
+}
+
+int ncclHierarchy::LocalRank(int nRank)
+{
+	int nGroup = GroupOf(nRank);
+	if (nGroup < 0)
+		return -1;
+
+	for (int i = 0; i < (int)m_rgGroups[nGroup].size(); i++)
+	{
+		if (m_rgGroups[nGroup][i] == nRank)
+			return i;
+	}
+
+	return -1;
+}
+
+int ncclHierarchy::CrossOf(int nRank)
+{
+	for (int c = 0; c < (int)m_rgCross.size(); c++)
+	{
+		for (int i = 0; i < (int)m_rgCross[c].size(); i++)
+		{
+			if (m_rgCross[c][i] == nRank)
+				return c;
+		}
+	}
+
+	return -1;
+}
+
+
+template <class T>
+long ncclHandle<T>::isDisplayConnectedToGpu(int nGpuID, bool* pbIsDisplayOn)
+{
+	LONG lErr;
+
+	char rgID[256];
+	if (lErr = cudaDeviceGetPCIBusId(rgID, 255, nGpuID))
+		return lErr;
+
+	char* psz = strtok(rgID, ":");
+	if (psz == NULL)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	psz = strtok(NULL, ":");
+	if (psz == NULL)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	int nCudaBusID = atoi(psz);
+
+	NvAPI_Status status;
+
+	if ((status = NvAPI_Initialize()) != NVAPI_OK)
+		return status;
+
+	NvPhysicalGpuHandle gpuHandles[256];
+	NvPhysicalGpuHandle gpuTccHandles[256];
+	NvU32 numOfGPUs;
+	NvU32 numOfTccGPUs;
+
+	if ((status = NvAPI_EnumPhysicalGPUs(gpuHandles, &numOfGPUs)) != NVAPI_OK)
+	{
+		NvAPI_Unload();
+		return status;
+	}
+
+	if ((status = NvAPI_EnumTCCPhysicalGPUs(gpuTccHandles, &numOfTccGPUs)) != NVAPI_OK)
+	{
+		NvAPI_Unload();
+		return status;
+	}
+
+	int nIdx = -1;
+	int nIdxTcc = -1;
+
+	for (int i = 0; i < (int)numOfGPUs; i++)
+	{
+		NvU32 busID = 0;
+
+		if ((status = NvAPI_GPU_GetBusId(gpuHandles[i], &busID)) != NVAPI_OK)
+		{
+			NvAPI_Unload();
+			return status;
+		}
+
+		if (nCudaBusID == (int)busID)
+		{
+			nIdx = i;
+			break;
+		}
+	}
+
+	if (nIdx == -1)
+	{
+		for (int i = 0; i < (int)numOfTccGPUs; i++)
+		{
+			NvU32 busID = 0;
+
+			if ((status = NvAPI_GPU_GetBusId(gpuTccHandles[i], &busID)) != NVAPI_OK)
+			{
+				NvAPI_Unload();
+				return status;
+			}
+
+			if (nCudaBusID == (int)busID)
+			{
+				nIdxTcc = i;
+				break;
+			}
+		}
+	}
+
+	if (nIdx == -1 && nIdxTcc == -1)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	NvU32 connectedDisplays = 0;
+
+	if (nIdx > 0)
+	{
+		if ((status = NvAPI_GPU_GetConnectedDisplayIds(gpuHandles[nIdx], NULL, &connectedDisplays, NULL)) != NVAPI_OK)
+		{
+			NvAPI_Unload();
+			return status;
+		}
+	}
+
+	*pbIsDisplayOn = (connectedDisplays > 0) ? true : false;
+	NvAPI_Unload();
+
+	return 0;
+}
+
+template <class T>
+void ncclHandle<T>::setBufferSize(long lBufferCount)
+{
+	if (lBufferCount > 0)
+	{
+		lBufferCount *= sizeof(T);
+		lBufferCount /= 64;
+		lBufferCount = (lBufferCount + 1) * 64;
+
+		char szBuffer[256];
+		snprintf(szBuffer, 255, "NCCL_BUFFSIZE=%ld", lBufferCount);
+		putenv(szBuffer);
+	}
+}
+
+template <class T>
+long ncclHandle<T>::Initialize(Memory<T>* pMem, Math<T>* pMath, int nGpuID, int nCount, int nRank, char* szId)
+{
+	long lErr;
+	int nDevCount;
+
+	m_nGpuID = nGpuID;
+	Update(pMem, pMath);
+
+	if (lErr = cudaGetDeviceCount(&nDevCount))
+		return lErr;
+
+	if (nGpuID < 0 || nGpuID >= nDevCount)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	bool bDisplayOn = false;
+	if (lErr = isDisplayConnectedToGpu(nGpuID, &bDisplayOn))
+		return lErr;
+
+	if (bDisplayOn)
+		return ERROR_CUDA_NOTSUPPORED_ON_DISPLAYGPU;
+
+	m_pData = new Data(nCount, nRank, szId);
+	if (m_pData == NULL)
+		return ERROR_MEMORY_OUT;
+
+	if (lErr = m_pData->Initialize())
+		return lErr;
+
+	return 0;
+}
+
+template long ncclHandle<double>::Initialize(Memory<double>* pMem, Math<double>* pMath, int nGpuID, int nCount, int nRank, char* szId);
+template long ncclHandle<float>::Initialize(Memory<float>* pMem, Math<float>* pMath, int nGpuID, int nCount, int nRank, char* szId);
+
+
+template <class T>
+long ncclHandle<T>::Update(Memory<T>* pMem, Math<T>* pMath)
+{
+	m_pMem = pMem;
+	m_pMath = pMath;
+	m_pMemCol = pMem->GetMemoryCollection();
+	m_nRefCount++;
+	return 0;
+}
+
+template long ncclHandle<double>::Update(Memory<double>* pMem, Math<double>* pMath);
+template long ncclHandle<float>::Update(Memory<float>* pMem, Math<float>* pMath);
+
+
+template <class T>
+long ncclHandle<T>::CleanUp()
+{
+	m_nRefCount--;
+
+	if (m_nRefCount == 0)
+	{
+		freeBuckets();
+		freeHierarchy();
+
+		if (m_pCompression != NULL)
+		{
+			delete m_pCompression;
+			m_pCompression = NULL;
+		}
+
+		if (m_pData != NULL)
+		{
+			delete m_pData;
+			m_pData = NULL;
+		}
+	}
+
+	return 0;
+}
+
+template long ncclHandle<double>::CleanUp();
+template long ncclHandle<float>::CleanUp();
+
+
+template <class T>
+LPCSTR ncclHandle<T>::GetErrorString(long lErr)
+{
+	return m_pData->NcclGetErrorString((ncclResult_t)lErr);
+}
+
+template LPCSTR ncclHandle<double>::GetErrorString(long lErr);
+template LPCSTR ncclHandle<float>::GetErrorString(long lErr);
+
+
+template <class T>
+long ncclHandle<T>::InitSingleProcess(long lBufferCount, int nCount, ncclHandle<T>* rgHandles[])
+{
+	LONG lErr;
+	ncclComm_t* rgComm = (ncclComm_t*)malloc(sizeof(ncclComm_t) * nCount);
+	if (rgComm == NULL)
+		return ERROR_MEMORY_OUT;
+
+	int* rgGpu = (int*)malloc(sizeof(int) * nCount);
+	if (rgGpu == NULL)
+	{
+		free(rgComm);
+		return ERROR_MEMORY_OUT;
+	}
+
+	for (int i = 0; i < nCount; i++)
+	{
+		rgGpu[i] = rgHandles[i]->m_nGpuID;
+	}
+
+	setBufferSize(lBufferCount);
+	lErr = m_pData->NcclCommInitAll(rgComm, nCount, rgGpu);
+	if (!lErr)
+	{
+		for (int i = 0; i < nCount; i++)
+		{
+			rgHandles[i]->m_pData->m_comm = rgComm[i];
+		}
+	}
+
+	free(rgComm);
+	free(rgGpu);
+
+	return lErr;
+}
+
+template long ncclHandle<double>::InitSingleProcess(long lBufferCount, int nCount, ncclHandle<double>* rgHandles[]);
+template long ncclHandle<float>::InitSingleProcess(long lBufferCount, int nCount, ncclHandle<float>* rgHandles[]);
+
+
 template <class T>
 long ncclHandle<T>::InitMultiProcess(long lBufferCount)
 {
-	setBufferSize(lBufferCount);
-	return m_pData->NcclCommInitRank(&m_pData->m_comm, m_pData->m_nCount, m_pData->m_id, m_pData->m_nRank);
+	setBufferSize(lBufferCount);
+	return m_pData->NcclCommInitRank(&m_pData->m_comm, m_pData->m_nCount, m_pData->m_id, m_pData->m_nRank);
+}
+
+template long ncclHandle<double>::InitMultiProcess(long lBufferCount);
+template long ncclHandle<float>::InitMultiProcess(long lBufferCount);
+
+
+template <class T>
+long ncclHandle<T>::freeHierarchy()
+{
+	if (m_pHierarchy == NULL)
+		return 0;
+
+	if (m_pData != NULL)
+	{
+		if (m_pHierarchy->m_commGroup != NULL)
+			m_pData->NcclCommDestroy(m_pHierarchy->m_commGroup);
+
+		if (m_pHierarchy->m_commCross != NULL)
+			m_pData->NcclCommDestroy(m_pHierarchy->m_commCross);
+	}
+
+	delete m_pHierarchy;
+	m_pHierarchy = NULL;
+
+	return 0;
+}
+
+template long ncclHandle<double>::freeHierarchy();
+template long ncclHandle<float>::freeHierarchy();
+
+
+template <class T>
+long ncclHandle<T>::InitHierarchical(long lBufferCount, int nCount, ncclHandle<T>* rgHandles[], int* rgGroupId, int* pnGroups)
+{
+	LONG lErr;
+	std::vector<int> rgGroup(nCount, -1);
+	bool bAuto = true;
+
+	if (nCount <= 0 || rgHandles == NULL)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (rgGroupId != NULL)
+	{
+		for (int i = 0; i < nCount; i++)
+		{
+			rgGroup[i] = rgGroupId[i];
+
+			if (rgGroupId[i] >= 0)
+				bAuto = false;
+		}
+	}
+
+	// Without explicit groups, GPUs with peer access to one another are grouped.
+	if (bAuto)
+	{
+		bool* rgbPeer = new bool[nCount * nCount];
+		if (rgbPeer == NULL)
+			return ERROR_MEMORY_OUT;
+
+		for (int i = 0; i < nCount; i++)
+		{
+			for (int j = 0; j < nCount; j++)
+			{
+				int nAccess = 1;
+
+				if (i != j)
+				{
+					if (lErr = cudaDeviceCanAccessPeer(&nAccess, rgHandles[i]->m_nGpuID, rgHandles[j]->m_nGpuID))
+					{
+						delete [] rgbPeer;
+						return lErr;
+					}
+				}
+
+				rgbPeer[i * nCount + j] = (nAccess != 0) ? true : false;
+			}
+		}
+
+		lErr = ncclHierarchy::FindGroups(nCount, rgbPeer, &rgGroup[0]);
+		delete [] rgbPeer;
+
+		if (lErr)
+			return lErr;
+	}
+
+	ncclHierarchy hier;
+	if (lErr = hier.Build(nCount, &rgGroup[0]))
+		return lErr;
+
+	// The flat communicator remains in use by Broadcast.
+	if (lErr = InitSingleProcess(lBufferCount, nCount, rgHandles))
+		return lErr;
+
+	for (int i = 0; i < nCount; i++)
+	{
+		rgHandles[i]->freeHierarchy();
+
+		if ((rgHandles[i]->m_pHierarchy = new HierarchyData()) == NULL)
+			return ERROR_MEMORY_OUT;
+
+		int nGroup = hier.GroupOf(i);
+		int nCross = hier.CrossOf(i);
+
+		rgHandles[i]->m_pHierarchy->m_nGroupSize = (int)hier.m_rgGroups[nGroup].size();
+		rgHandles[i]->m_pHierarchy->m_nLocalRank = hier.LocalRank(i);
+		rgHandles[i]->m_pHierarchy->m_nCrossSize = (nCross >= 0) ? (int)hier.m_rgCross[nCross].size() : 0;
+		rgHandles[i]->m_pHierarchy->m_bUniform = hier.m_bUniform;
+	}
+
+	// Create one communicator per group and one per cross-group set, the
+	// rank within each follows the order of the ranks listed.
+	for (int nPass = 0; nPass < 2; nPass++)
+	{
+		std::vector<std::vector<int>>& rgSets = (nPass == 0) ? hier.m_rgGroups : hier.m_rgCross;
+
+		for (int s = 0; s < (int)rgSets.size(); s++)
+		{
+			int nSetCount = (int)rgSets[s].size();
+			std::vector<int> rgGpu;
+			std::vector<ncclComm_t> rgComm(nSetCount, (ncclComm_t)NULL);
+
+			for (int i = 0; i < nSetCount; i++)
+			{
+				rgGpu.push_back(rgHandles[rgSets[s][i]]->m_nGpuID);
+			}
+
+			if (lErr = m_pData->NcclCommInitAll(&rgComm[0], nSetCount, &rgGpu[0]))
+			{
+				for (int i = 0; i < nCount; i++)
+				{
+					rgHandles[i]->freeHierarchy();
+				}
+
+				return lErr;
+			}
+
+			for (int i = 0; i < nSetCount; i++)
+			{
+				HierarchyData* pH = rgHandles[rgSets[s][i]]->m_pHierarchy;
+
+				if (nPass == 0)
+					pH->m_commGroup = rgComm[i];
+				else
+					pH->m_commCross = rgComm[i];
+			}
+		}
+	}
+
+	if (pnGroups != NULL)
+		*pnGroups = (int)hier.m_rgGroups.size();
+
+	return 0;
+}
+
+template long ncclHandle<double>::InitHierarchical(long lBufferCount, int nCount, ncclHandle<double>* rgHandles[], int* rgGroupId, int* pnGroups);
+template long ncclHandle<float>::InitHierarchical(long lBufferCount, int nCount, ncclHandle<float>* rgHandles[], int* rgGroupId, int* pnGroups);
+
+
+template <class T>
+long ncclHandle<T>::reduceHierarchical(cudaStream_t stream, T* x, int nCount, NCCL_OP op)
+{
+	LONG lErr;
+	HierarchyData* pH = m_pHierarchy;
+	ncclDataType_t type = (sizeof(T) == sizeof(double)) ? ncclDouble : ncclFloat;
+	ncclRedOp_t ncclop = getNcclOp(op);
+	bool bLeader = (pH->m_nLocalRank == 0) ? true : false;
+
+	if (!pH->m_bUniform)
+	{
+		if (lErr = m_pData->NcclReduce(x, x, nCount, type, ncclop, 0, pH->m_commGroup, stream))
+			return lErr;
+
+		if (bLeader && pH->m_nCrossSize > 1)
+		{
+			if (lErr = m_pData->NcclAllReduce(x, x, nCount, type, ncclop, pH->m_commCross, stream))
+				return lErr;
+		}
+
+		return m_pData->NcclBcast(x, nCount, type, 0, pH->m_commGroup, stream);
+	}
+
+	int nGroupSize = pH->m_nGroupSize;
+	int nShard = nCount / nGroupSize;
+	int nTail = nCount - nShard * nGroupSize;
+	T* shard = x + pH->m_nLocalRank * nShard;
+
+	if (nShard > 0)
+	{
+		if (nGroupSize > 1)
+		{
+			if (lErr = m_pData->NcclReduceScatter(x, shard, nShard, type, ncclop, pH->m_commGroup, stream))
+				return lErr;
+		}
+
+		if (pH->m_nCrossSize > 1)
+		{
+			if (lErr = m_pData->NcclAllReduce(shard, shard, nShard, type, ncclop, pH->m_commCross, stream))
+				return lErr;
+		}
+
+		if (nGroupSize > 1)
+		{
+			if (lErr = m_pData->NcclAllGather(shard, nShard, type, x, pH->m_commGroup, stream))
+				return lErr;
+		}
+	}
+
+	// The items left over by the even split go through the group leaders,
+	// whose cross-group communicator links all of the leaders.
+	if (nTail > 0)
+	{
+		T* tail = x + nShard * nGroupSize;
+
+		if (nGroupSize > 1)
+		{
+			if (lErr = m_pData->NcclReduce(tail, tail, nTail, type, ncclop, 0, pH->m_commGroup, stream))
+				return lErr;
+		}
+
+		if (bLeader && pH->m_nCrossSize > 1)
+		{
+			if (lErr = m_pData->NcclAllReduce(tail, tail, nTail, type, ncclop, pH->m_commCross, stream))
+				return lErr;
+		}
+
+		if (nGroupSize > 1)
+		{
+			if (lErr = m_pData->NcclBcast(tail, nTail, type, 0, pH->m_commGroup, stream))
+				return lErr;
+		}
+	}
+
+	return 0;
+}
+
+template long ncclHandle<double>::reduceHierarchical(cudaStream_t stream, double* x, int nCount, NCCL_OP op);
+template long ncclHandle<float>::reduceHierarchical(cudaStream_t stream, float* x, int nCount, NCCL_OP op);
+
+
+template <class T>
+long ncclHandle<T>::Broadcast(long hStream, long hX, int nCount)
+{
+	ncclDataType_t type = (sizeof(T) == sizeof(double)) ? ncclDouble : ncclFloat;
+	MemoryItem* pX;
+	LONG lErr;
+
+	if (lErr = m_pMemCol->GetData(hX, &pX))
+		return lErr;
+
+	T* x = (T*)pX->Data();
+
+	if (lErr = cudaSetDevice(m_nGpuID))
+		return lErr;
+
+	cudaStream_t stream = cudaStreamDefault;
+	if (hStream != 0)
+		stream = m_pMem->GetStream(hStream);
+
+	TraceScope trace("ncclBroadcast", TRACE_CAT_NCCL, hX, hStream, (LONGLONG)nCount * sizeof(T));
+
+	if (lErr = m_pData->NcclBcast(x, nCount, type, 0, m_pData->m_comm, stream))
+		return lErr;
+
+	return 0;
+}
+
+template long ncclHandle<double>::Broadcast(long hStream, long hData, int nCount);
+template long ncclHandle<float>::Broadcast(long hStream, long hData, int nCount);
+
+
+template <class T>
+long ncclHandle<T>::AllReduce(long hStream, long hX, int nCount, NCCL_OP op, T fScale)
+{
+	long lErr;
+	MemoryItem* pX;
+
+	if (lErr = m_pMemCol->GetData(hX, &pX))
+		return lErr;
+
+	T* x = (T*)pX->Data();
+
+	TraceScope trace("ncclAllReduce", TRACE_CAT_NCCL, hX, hStream, (LONGLONG)nCount * sizeof(T));
+
+	return reduce(hStream, hX, x, nCount, op, fScale);
+}
+
+template long ncclHandle<double>::AllReduce(long hStream, long hData, int nCount, NCCL_OP op, double dfScale);
+template long ncclHandle<float>::AllReduce(long hStream, long hData, int nCount, NCCL_OP op, float fScale);
+
+
+template <class T>
+long ncclHandle<T>::reduce(long hStream, long hX, T* x, int nCount, NCCL_OP op, T fScale)
+{
+	LONG lErr;
+
+	if (lErr = cudaSetDevice(m_nGpuID))
+		return lErr;
+
+	cudaStream_t stream = cudaStreamDefault;
+	if (hStream != 0)
+		stream = m_pMem->GetStream(hStream);
+
+	// Compression only applies to sums.
+	if (m_pCompression != NULL && op == NCCL_SUM)
+	{
+		switch (m_pCompression->m_type)
+		{
+			case NCCL_COMPRESS_FP16:
+				return reduceHalf(stream, hStream, hX, x, nCount, fScale);
+
+			case NCCL_COMPRESS_BF16:
+				return reduceBFloat16(stream, hStream, hX, x, nCount, fScale);
+
+			case NCCL_COMPRESS_TOPK:
+				return reduceTopK(stream, hStream, hX, x, nCount, fScale);
+		}
+	}
+
+	if (m_pHierarchy != NULL)
+	{
+		if (lErr = reduceHierarchical(stream, x, nCount, op))
+			return lErr;
+	}
+	else
+	{
+		ncclDataType_t type = (sizeof(T) == sizeof(double)) ? ncclDouble : ncclFloat;
+		if (lErr = m_pData->NcclAllReduce(x, x, nCount, type, getNcclOp(op), m_pData->m_comm, stream))
+			return lErr;
+	}
+
+	if (fScale != T(1.0))
+		return m_pMath->scal(nCount, fScale, hX, 0, hStream);
+
+	return 0;
+}
+
+template long ncclHandle<double>::reduce(long hStream, long hX, double* x, int nCount, NCCL_OP op, double dfScale);
+template long ncclHandle<float>::reduce(long hStream, long hX, float* x, int nCount, NCCL_OP op, float fScale);
+
+
+template <class T>
+long ncclHandle<T>::reduceHalf(cudaStream_t stream, long hStream, long hX, T* x, int nCount, T fScale)
+{
+	LONG lErr;
+	CompressionData* pC = m_pCompression;
+
+	if (lErr = pC->Reserve(&pC->m_pPack, &pC->m_lPack, nCount * sizeof(__half)))
+		return lErr;
+
+	__half* y = (__half*)pC->m_pPack;
+
+	// The loss scale and the overflow count stay on the device, so nothing
+	// here waits on the stream.
+	compress_half_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, x, y, pC->m_pState);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	if (lErr = m_pData->NcclAllReduce(y, y, nCount, ncclHalf, ncclSum, m_pData->m_comm, stream))
+		return lErr;
+
+	if (lErr = cudaMemsetAsync(&pC->m_pState->nCount, 0, sizeof(int), stream))
+		return lErr;
+
+	count_nonfinite_half_kernel<<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, y, &pC->m_pState->nCount);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	decompress_half_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, y, x, fScale, pC->m_pState);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	update_loss_scale_kernel<<<1, 1, 0, stream>>>(pC->m_pState);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	pC->AddStats(nCount * sizeof(__half), nCount * sizeof(T));
+
+	return pC->MarkStatePending(stream);
+}
+
+template long ncclHandle<double>::reduceHalf(cudaStream_t stream, long hStream, long hX, double* x, int nCount, double dfScale);
+template long ncclHandle<float>::reduceHalf(cudaStream_t stream, long hStream, long hX, float* x, int nCount, float fScale);
+
+
+template <class T>
+long ncclHandle<T>::reduceBFloat16(cudaStream_t stream, long hStream, long hX, T* x, int nCount, T fScale)
+{
+	LONG lErr;
+	CompressionData* pC = m_pCompression;
+	int nRanks = m_pData->m_nCount;
+
+	// NCCL has no bfloat16 reduction, so the packed values are gathered from
+	// all ranks and summed locally at full precision.
+	if (lErr = pC->Reserve(&pC->m_pPack, &pC->m_lPack, nCount * sizeof(unsigned short)))
+		return lErr;
+
+	if (lErr = pC->Reserve(&pC->m_pGather, &pC->m_lGather, nRanks * nCount * sizeof(unsigned short)))
+		return lErr;
+
+	unsigned short* y = (unsigned short*)pC->m_pPack;
+	unsigned short* rgAll = (unsigned short*)pC->m_pGather;
+	float fLossScale = (float)pC->m_dfLossScale;
+
+	compress_bf16_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, x, y, fLossScale);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	if (lErr = m_pData->NcclAllGather(y, nCount * sizeof(unsigned short), ncclChar, rgAll, m_pData->m_comm, stream))
+		return lErr;
+
+	decompress_bf16_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, nRanks, rgAll, x, fScale / (T)fLossScale);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	pC->AddStats(nCount * sizeof(unsigned short), nCount * sizeof(T));
+
+	return 0;
 }
 
-template long ncclHandle<double>::InitMultiProcess(long lBufferCount);
-template long ncclHandle<float>::InitMultiProcess(long lBufferCount);
+template long ncclHandle<double>::reduceBFloat16(cudaStream_t stream, long hStream, long hX, double* x, int nCount, double dfScale);
+template long ncclHandle<float>::reduceBFloat16(cudaStream_t stream, long hStream, long hX, float* x, int nCount, float fScale);
 
 
 template <class T>
-long ncclHandle<T>::Broadcast(long hStream, long hX, int nCount)
+long ncclHandle<T>::reduceTopK(cudaStream_t stream, long hStream, long hX, T* x, int nCount, T fScale)
 {
-	ncclDataType_t type = (sizeof(T) == sizeof(double)) ? ncclDouble : ncclFloat;
-	MemoryItem* pX;
 	LONG lErr;
+	CompressionData* pC = m_pCompression;
+	int nRanks = m_pData->m_nCount;
+	int nK = (int)ceil(pC->m_dfRatio * nCount);
 
-	if (lErr = m_pMemCol->GetData(hX, &pX))
+	if (nK < 1)
+		nK = 1;
+
+	if (nK > nCount)
+		nK = nCount;
+
+	// Each rank sends k values followed by their k indexes, padded so
+	// that the values of every rank stay aligned within the gather buffer.
+	size_t lValSize = nK * sizeof(T);
+	size_t lIdxSize = ((nK * sizeof(int) + sizeof(T) - 1) / sizeof(T)) * sizeof(T);
+	size_t lPairSize = lValSize + lIdxSize;
+	T* r = NULL;
+
+	if (lErr = pC->GetResidual(hX, nCount * sizeof(T), (void**)&r))
 		return lErr;
 
-	T* x = (T*)pX->Data();
+	if (lErr = pC->Reserve(&pC->m_pPack, &pC->m_lPack, lPairSize))
+		return lErr;
+
+	if (lErr = pC->Reserve(&pC->m_pGather, &pC->m_lGather, nRanks * lPairSize))
+		return lErr;
+
+	if (lErr = pC->Reserve(&pC->m_pScratch, &pC->m_lScratch, SUMSQ_BLOCKS * sizeof(double) + TOPK_RADIX * sizeof(unsigned int) + sizeof(TopKState)))
+		return lErr;
+
+	T* rgVal = (T*)pC->m_pPack;
+	int* rgIdx = (int*)((char*)pC->m_pPack + lValSize);
+	double* rgPartial = (double*)pC->m_pScratch;
+	unsigned int* rgHist = (unsigned int*)(rgPartial + SUMSQ_BLOCKS);
+	TopKState* pState = (TopKState*)(rgHist + TOPK_RADIX);
+
+	// Error feedback - add the residual left over from earlier calls.
+	accumulate_residual_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, x, r);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	// Find the k'th largest absolute value, most significant bits first.
+	topk_init_kernel<<<1, 1, 0, stream>>>(pState, nK);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	for (int nShift = (int)sizeof(T) * 8 - TOPK_RADIX_BITS; nShift >= 0; nShift -= TOPK_RADIX_BITS)
+	{
+		if (lErr = cudaMemsetAsync(rgHist, 0, TOPK_RADIX * sizeof(unsigned int), stream))
+			return lErr;
+
+		topk_histogram_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, r, nShift, pState, rgHist);
+		if (lErr = cudaGetLastError())
+			return lErr;
+
+		topk_pick_kernel<<<1, 1, 0, stream>>>(nShift, rgHist, pState);
+		if (lErr = cudaGetLastError())
+			return lErr;
+	}
+
+	if (lErr = cudaMemsetAsync(rgVal, 0, lValSize, stream))
+		return lErr;
+
+	if (lErr = cudaMemsetAsync(rgIdx, 0xFF, nK * sizeof(int), stream))
+		return lErr;
+
+	if (lErr = cudaMemsetAsync(&pC->m_pState->nCount, 0, sizeof(int), stream))
+		return lErr;
+
+	// Values above the threshold always fit, ties fill the remaining slots.
+	select_topk_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, nK, pState, true, r, rgVal, rgIdx, &pC->m_pState->nCount);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	select_topk_kernel<T><<<CAFFE_GET_BLOCKS(nCount), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nCount, nK, pState, false, r, rgVal, rgIdx, &pC->m_pState->nCount);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	if (lErr = m_pData->NcclAllGather(pC->m_pPack, (int)lPairSize, ncclChar, pC->m_pGather, m_pData->m_comm, stream))
+		return lErr;
+
+	if (lErr = cudaMemsetAsync(x, 0, nCount * sizeof(T), stream))
+		return lErr;
+
+	// Indexes are unique within a rank, so each rank is added separately.
+	for (int i = 0; i < nRanks; i++)
+	{
+		char* pRank = (char*)pC->m_pGather + i * lPairSize;
+		scatter_add_kernel<T><<<CAFFE_GET_BLOCKS(nK), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(nK, (T*)pRank, (int*)(pRank + lValSize), x);
+		if (lErr = cudaGetLastError())
+			return lErr;
+	}
+
+	if (fScale != T(1.0))
+	{
+		if (lErr = m_pMath->scal(nCount, fScale, hX, 0, hStream))
+			return lErr;
+	}
+
+	sumsq_partial_kernel<T><<<SUMSQ_BLOCKS, SUMSQ_THREADS, 0, stream>>>(nCount, r, rgPartial);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	sumsq_final_kernel<<<1, 1, 0, stream>>>(rgPartial, pC->m_pState);
+	if (lErr = cudaGetLastError())
+		return lErr;
+
+	pC->AddStats(lPairSize, nCount * sizeof(T));
+
+	return pC->MarkStatePending(stream);
+}
+
+template long ncclHandle<double>::reduceTopK(cudaStream_t stream, long hStream, long hX, double* x, int nCount, double dfScale);
+template long ncclHandle<float>::reduceTopK(cudaStream_t stream, long hStream, long hX, float* x, int nCount, float fScale);
+
+
+template <class T>
+long ncclHandle<T>::SetCompression(NCCL_COMPRESSION type, double dfParam)
+{
+	LONG lErr;
+
+	if (type < NCCL_COMPRESS_NONE || type > NCCL_COMPRESS_TOPK)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (m_pCompression != NULL)
+	{
+		delete m_pCompression;
+		m_pCompression = NULL;
+	}
+
+	if (type == NCCL_COMPRESS_NONE)
+		return 0;
 
 	if (lErr = cudaSetDevice(m_nGpuID))
 		return lErr;
 
-	cudaStream_t stream = cudaStreamDefault;
-	if (hStream != 0)
-		stream = m_pMem->GetStream(hStream);
+	if ((m_pCompression = new CompressionData(type, dfParam)) == NULL)
+		return ERROR_MEMORY_OUT;
 
-	if (lErr = m_pData->NcclBcast(x, nCount, type, 0, m_pData->m_comm, stream))
+	if (lErr = m_pCompression->Initialize())
+	{
+		delete m_pCompression;
+		m_pCompression = NULL;
 		return lErr;
+	}
 
 	return 0;
 }
 
-template long ncclHandle<double>::Broadcast(long hStream, long hData, int nCount);
-template long ncclHandle<float>::Broadcast(long hStream, long hData, int nCount);
+template long ncclHandle<double>::SetCompression(NCCL_COMPRESSION type, double dfParam);
+template long ncclHandle<float>::SetCompression(NCCL_COMPRESSION type, double dfParam);
 
 
 template <class T>
-long ncclHandle<T>::AllReduce(long hStream, long hX, int nCount, NCCL_OP op, T fScale)
+long ncclHandle<T>::GetCompressionStats(T* rgStats, int nCount)
 {
-	long lErr;
-	ncclRedOp_t ncclop = ncclSum;
+	if (rgStats == NULL || nCount < NCCL_COMPRESSION_STATS_COUNT)
+		return ERROR_PARAM_OUT_OF_RANGE;
 
-	if (op == NCCL_PROD)
-		ncclop = ncclProd;
-	else if (op == NCCL_MIN)
-		ncclop = ncclMin;
-	else if (op == NCCL_MAX)
-		ncclop = ncclMax;
+	memset(rgStats, 0, sizeof(T) * NCCL_COMPRESSION_STATS_COUNT);
 
-	MemoryItem* pX;
+	if (m_pCompression == NULL)
+		return 0;
 
-	if (lErr = m_pMemCol->GetData(hX, &pX))
+	LONG lErr;
+
+	if (lErr = cudaSetDevice(m_nGpuID))
 		return lErr;
 
-	T* x = (T*)pX->Data();
+	if (lErr = m_pCompression->LoadState())
+		return lErr;
+
+	rgStats[0] = (T)m_pCompression->m_type;
+	rgStats[1] = (T)m_pCompression->m_dfCalls;
+	rgStats[2] = (T)m_pCompression->m_dfLastRatio;
+	rgStats[3] = (T)m_pCompression->m_dfLastResidualNorm;
+	rgStats[4] = (T)m_pCompression->m_dfLossScale;
+	rgStats[5] = (T)m_pCompression->m_dfOverflows;
+	rgStats[6] = (T)m_pCompression->m_dfBytesSent;
+	rgStats[7] = (T)m_pCompression->m_dfBytesRaw;
+
+	return 0;
+}
+
+template long ncclHandle<double>::GetCompressionStats(double* rgStats, int nCount);
+template long ncclHandle<float>::GetCompressionStats(float* rgStats, int nCount);
+
+
+template <class T>
+long ncclHandle<T>::freeBuckets()
+{
+	if (m_pBuckets == NULL)
+		return 0;
+
+	Memory<T>* pMem = (Memory<T>*)m_pBuckets->m_pMem;
+
+	for (int i = 0; i < (int)m_pBuckets->m_rgBuckets.size(); i++)
+	{
+		if (m_pBuckets->m_rgBuckets[i].m_hBuffer != 0)
+			pMem->FreeMemory(m_pBuckets->m_rgBuckets[i].m_hBuffer);
+	}
+
+	delete m_pBuckets;
+	m_pBuckets = NULL;
+
+	return 0;
+}
+
+template long ncclHandle<double>::freeBuckets();
+template long ncclHandle<float>::freeBuckets();
+
+
+template <class T>
+long ncclHandle<T>::SetBuckets(long lBucketSizeInBytes, NCCL_OP op, T fScale, int nCount, long* rghGrad, long* rglGradCount, int* pnBucketCount)
+{
+	LONG lErr;
+
+	if (lErr = freeBuckets())
+		return lErr;
+
+	if (pnBucketCount != NULL)
+		*pnBucketCount = 0;
+
+	// A count of zero only releases the existing buckets.
+	if (nCount == 0)
+		return 0;
+
+	if (nCount < 0 || rghGrad == NULL || rglGradCount == NULL)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (lBucketSizeInBytes <= 0)
+		lBucketSizeInBytes = NCCL_DEFAULT_BUCKET_SIZE;
+
+	long lBucketItems = lBucketSizeInBytes / sizeof(T);
+	if (lBucketItems == 0)
+		lBucketItems = 1;
+
+	if ((m_pBuckets = new BucketData(m_pMem, op, (double)fScale)) == NULL)
+		return ERROR_MEMORY_OUT;
+
+	std::vector<T*> rgData;
+
+	for (int i = 0; i < nCount; i++)
+	{
+		MemoryItem* pGrad;
+
+		if (rglGradCount[i] <= 0)
+		{
+			freeBuckets();
+			return ERROR_PARAM_OUT_OF_RANGE;
+		}
+
+		if (lErr = m_pMemCol->GetData(rghGrad[i], &pGrad))
+		{
+			freeBuckets();
+			return lErr;
+		}
+
+		if (pGrad->Size() < (long)(rglGradCount[i] * sizeof(T)))
+		{
+			freeBuckets();
+			return ERROR_PARAM_OUT_OF_RANGE;
+		}
+
+		m_pBuckets->m_rghGrad.push_back(rghGrad[i]);
+		m_pBuckets->m_rglGradCount.push_back(rglGradCount[i]);
+		m_pBuckets->m_rgbGradReady.push_back(false);
+		rgData.push_back((T*)pGrad->Data());
+
+		// Start a new bucket once the current one is full.  A gradient
+		// larger than the bucket size gets a bucket of its own.
+		if (m_pBuckets->m_rgBuckets.size() == 0 ||
+			m_pBuckets->m_rgBuckets.back().m_lItems + rglGradCount[i] > lBucketItems)
+			m_pBuckets->m_rgBuckets.push_back(BucketItem(i));
+
+		BucketItem& bucket = m_pBuckets->m_rgBuckets.back();
+		bucket.m_nCount++;
+		bucket.m_lItems += rglGradCount[i];
+		m_pBuckets->m_rgnGradBucket.push_back((int)m_pBuckets->m_rgBuckets.size() - 1);
+	}
+
+	// Only buckets whose gradients are not contiguous need a flattened buffer.
+	for (int i = 0; i < (int)m_pBuckets->m_rgBuckets.size(); i++)
+	{
+		BucketItem& bucket = m_pBuckets->m_rgBuckets[i];
+		bool bContiguous = true;
+
+		for (int j = bucket.m_nFirst; j < bucket.m_nFirst + bucket.m_nCount - 1; j++)
+		{
+			if (rgData[j] + m_pBuckets->m_rglGradCount[j] != rgData[j + 1])
+			{
+				bContiguous = false;
+				break;
+			}
+		}
+
+		if (!bContiguous)
+		{
+			if (lErr = m_pMem->AllocMemory(m_nGpuID, bucket.m_lItems, NULL, 0, &bucket.m_hBuffer))
+			{
+				bucket.m_hBuffer = 0;
+				freeBuckets();
+				return lErr;
+			}
+		}
+	}
+
+	if (pnBucketCount != NULL)
+		*pnBucketCount = (int)m_pBuckets->m_rgBuckets.size();
+
+	return 0;
+}
+
+template long ncclHandle<double>::SetBuckets(long lBucketSizeInBytes, NCCL_OP op, double dfScale, int nCount, long* rghGrad, long* rglGradCount, int* pnBucketCount);
+template long ncclHandle<float>::SetBuckets(long lBucketSizeInBytes, NCCL_OP op, float fScale, int nCount, long* rghGrad, long* rglGradCount, int* pnBucketCount);
+
+
+template <class T>
+long ncclHandle<T>::reduceBucket(long hStream, int nBucket)
+{
+	LONG lErr;
+	BucketItem& bucket = m_pBuckets->m_rgBuckets[nBucket];
+	MemoryItem* pItem;
 
 	if (lErr = cudaSetDevice(m_nGpuID))
 		return lErr;
@@ -467,17 +1979,147 @@ long ncclHandle<T>::AllReduce(long hStream, long hX, int nCount, NCCL_OP op, T f
 	if (hStream != 0)
 		stream = m_pMem->GetStream(hStream);
 
-	ncclDataType_t type = (sizeof(T) == sizeof(double)) ? ncclDouble : ncclFloat;
-	if (lErr = m_pData->NcclAllReduce(x, x, nCount, type, ncclop, m_pData->m_comm, stream))
+	long hReduce = bucket.m_hBuffer;
+	if (hReduce == 0)
+		hReduce = m_pBuckets->m_rghGrad[bucket.m_nFirst];
+
+	if (lErr = m_pMemCol->GetData(hReduce, &pItem))
 		return lErr;
 
-	if (fScale != T(1.0))
-		return m_pMath->scal(nCount, fScale, hX, 0, hStream);
+	T* buffer = (T*)pItem->Data();
+
+	// Pack the gradients into the flattened buffer.
+	if (bucket.m_hBuffer != 0)
+	{
+		T* dst = buffer;
+
+		for (int i = bucket.m_nFirst; i < bucket.m_nFirst + bucket.m_nCount; i++)
+		{
+			long lCount = m_pBuckets->m_rglGradCount[i];
+
+			if (lErr = m_pMemCol->GetData(m_pBuckets->m_rghGrad[i], &pItem))
+				return lErr;
+
+			if (lErr = cudaMemcpyAsync(dst, pItem->Data(), lCount * sizeof(T), cudaMemcpyDeviceToDevice, stream))
+				return lErr;
+
+			dst += lCount;
+		}
+	}
+
+	if (lErr = reduce(hStream, hReduce, buffer, (int)bucket.m_lItems, m_pBuckets->m_op, (T)m_pBuckets->m_dfScale))
+		return lErr;
+
+	// Scatter the reduced values back to the gradients.
+	if (bucket.m_hBuffer != 0)
+	{
+		T* src = buffer;
+
+		for (int i = bucket.m_nFirst; i < bucket.m_nFirst + bucket.m_nCount; i++)
+		{
+			long lCount = m_pBuckets->m_rglGradCount[i];
+
+			if (lErr = m_pMemCol->GetData(m_pBuckets->m_rghGrad[i], &pItem))
+				return lErr;
+
+			if (lErr = cudaMemcpyAsync(pItem->Data(), src, lCount * sizeof(T), cudaMemcpyDeviceToDevice, stream))
+				return lErr;
+
+			src += lCount;
+		}
+	}
 
 	return 0;
 }
 
-template long ncclHandle<double>::AllReduce(long hStream, long hData, int nCount, NCCL_OP op, double dfScale);
-template long ncclHandle<float>::AllReduce(long hStream, long hData, int nCount, NCCL_OP op, float fScale);
+template long ncclHandle<double>::reduceBucket(long hStream, int nBucket);
+template long ncclHandle<float>::reduceBucket(long hStream, int nBucket);
+
+
+template <class T>
+long ncclHandle<T>::launchReadyBuckets(long hStream)
+{
+	LONG lErr;
+
+	while (m_pBuckets->m_nNextBucket < (int)m_pBuckets->m_rgBuckets.size())
+	{
+		BucketItem& bucket = m_pBuckets->m_rgBuckets[m_pBuckets->m_nNextBucket];
+
+		if (bucket.m_nReady < bucket.m_nCount)
+			return 0;
+
+		if (lErr = reduceBucket(hStream, m_pBuckets->m_nNextBucket))
+			return lErr;
+
+		m_pBuckets->m_nNextBucket++;
+	}
+
+	// All buckets have been launched, the state is reset when the next
+	// pass starts.
+	m_pBuckets->m_bPassDone = true;
+
+	return 0;
+}
+
+template long ncclHandle<double>::launchReadyBuckets(long hStream);
+template long ncclHandle<float>::launchReadyBuckets(long hStream);
+
+
+template <class T>
+long ncclHandle<T>::MarkReady(long hStream, int nIdx)
+{
+	if (m_pBuckets == NULL)
+		return ERROR_PARAM_NULL;
+
+	if (nIdx < 0 || nIdx >= (int)m_pBuckets->m_rghGrad.size())
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (m_pBuckets->m_bPassDone)
+		m_pBuckets->Reset();
+
+	if (m_pBuckets->m_rgbGradReady[nIdx])
+		return 0;
+
+	m_pBuckets->m_rgbGradReady[nIdx] = true;
+	m_pBuckets->m_rgBuckets[m_pBuckets->m_rgnGradBucket[nIdx]].m_nReady++;
+
+	return launchReadyBuckets(hStream);
+}
+
+template long ncclHandle<double>::MarkReady(long hStream, int nIdx);
+template long ncclHandle<float>::MarkReady(long hStream, int nIdx);
+
+
+template <class T>
+long ncclHandle<T>::AllReduceBuckets(long hStream)
+{
+	if (m_pBuckets == NULL)
+		return ERROR_PARAM_NULL;
+
+	TraceScope trace("ncclAllReduceBuckets", TRACE_CAT_NCCL, 0, hStream);
+
+	LONG lErr;
+
+	// Flush - any gradient not yet marked is treated as ready, the buckets
+	// already launched in this pass are not launched again.
+	if (!m_pBuckets->m_bPassDone)
+	{
+		for (int i = m_pBuckets->m_nNextBucket; i < (int)m_pBuckets->m_rgBuckets.size(); i++)
+		{
+			m_pBuckets->m_rgBuckets[i].m_nReady = m_pBuckets->m_rgBuckets[i].m_nCount;
+		}
+
+		if (lErr = launchReadyBuckets(hStream))
+			return lErr;
+	}
+
+	// The flush ends the pass.
+	m_pBuckets->Reset();
+
+	return 0;
+}
+
+template long ncclHandle<double>::AllReduceBuckets(long hStream);
+template long ncclHandle<float>::AllReduceBuckets(long hStream);
 
 // end
\ No newline at end of file
@@ -10,6 +10,15 @@
 #include "math.h"
 #include "memorycol.h"
 #include "handlecol.h"
+#include <vector>
+
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const long NCCL_DEFAULT_BUCKET_SIZE = 25 * 1024 * 1024;
+const int NCCL_COMPRESSION_STATS_COUNT = 8;
 
 
 //=============================================================================
@@ -23,17 +32,58 @@ typedef enum {
 	NCCL_MIN = 3
 } NCCL_OP;
 
+typedef enum {
+	NCCL_COMPRESS_NONE = 0,
+	NCCL_COMPRESS_FP16 = 1,
+	NCCL_COMPRESS_BF16 = 2,
+	NCCL_COMPRESS_TOPK = 3
+} NCCL_COMPRESSION;
+
 
 //=============================================================================
 //	Classes
 //=============================================================================
 
 class Data;
+class BucketData;
+class CompressionData;
+class HierarchyData;
 
 template <class T>
 class Memory;
 
 
+//-----------------------------------------------------------------------------
+//	NCCL Hierarchy Class
+//
+//	This host-only class describes a hierarchical collective schedule.  Ranks
+//	are split into groups (e.g. the GPUs sharing a switch or socket).  When
+//	all groups have the same size, each reduction runs as an intra-group
+//	reduce-scatter, an all-reduce of each shard across the groups and an
+//	intra-group all-gather.  Otherwise the groups reduce to their leaders,
+//	the leaders all-reduce and then broadcast back within their groups.
+//-----------------------------------------------------------------------------
+class ncclHierarchy
+{
+public:
+	std::vector<std::vector<int>> m_rgGroups;
+	std::vector<std::vector<int>> m_rgCross;
+	bool m_bUniform;
+
+	ncclHierarchy()
+	{
+		m_bUniform = true;
+	}
+
+	long Build(int nCount, const int* rgGroupId);
+	int GroupOf(int nRank);
+	int LocalRank(int nRank);
+	int CrossOf(int nRank);
+
+	static long FindGroups(int nCount, const bool* rgbPeer, int* rgGroupId);
+};
+
+
 //-----------------------------------------------------------------------------
 //	NCCL Handle Class
 //
@@ -48,16 +98,31 @@ class ncclHandle
 	MemoryCollection* m_pMemCol;
 	Math<T>* m_pMath;
 	Data* m_pData;
+	BucketData* m_pBuckets;
+	CompressionData* m_pCompression;
+	HierarchyData* m_pHierarchy;
 	bool m_bOwner;
 
 	long isDisplayConnectedToGpu(int nGpuID, bool* pbIsDisplayOn);
 	void setBufferSize(long lBufferCount);
+	long freeBuckets();
+	long reduceBucket(long hStream, int nBucket);
+	long launchReadyBuckets(long hStream);
+	long reduce(long hStream, long hX, T* x, int nCount, NCCL_OP op, T fScale);
+	long reduceHalf(cudaStream_t stream, long hStream, long hX, T* x, int nCount, T fScale);
+	long reduceBFloat16(cudaStream_t stream, long hStream, long hX, T* x, int nCount, T fScale);
+	long reduceTopK(cudaStream_t stream, long hStream, long hX, T* x, int nCount, T fScale);
+	long reduceHierarchical(cudaStream_t stream, T* x, int nCount, NCCL_OP op);
+	long freeHierarchy();
 
 public:
 	
 	ncclHandle()
 	{
 		m_pData = NULL;
+		m_pBuckets = NULL;
+		m_pCompression = NULL;
+		m_pHierarchy = NULL;
 		m_bOwner = true;
 	}
 
@@ -89,8 +154,16 @@ public:
 
 	long InitSingleProcess(long lBufferCount, int nCount, ncclHandle<T>* rgHandles[]);
 	long InitMultiProcess(long lBufferCount);
+	long InitHierarchical(long lBufferCount, int nCount, ncclHandle<T>* rgHandles[], int* rgGroupId, int* pnGroups);
 	long Broadcast(long hStream, long hX, int nCount);
 	long AllReduce(long hStream, long hX, int nCount, NCCL_OP op, T fScale);
+
+	long SetBuckets(long lBucketSizeInBytes, NCCL_OP op, T fScale, int nCount, long* rghGrad, long* rglGradCount, int* pnBucketCount);
+	long MarkReady(long hStream, int nIdx);
+	long AllReduceBuckets(long hStream);
+
+	long SetCompression(NCCL_COMPRESSION type, double dfParam);
+	long GetCompressionStats(T* rgStats, int nCount);
 };
 
 
@@ -98,5 +171,28 @@ public:
 //	Inline Methods
 //=============================================================================
 
+//-----------------------------------------------------------------------------
+//	BFloat16 conversion used by the compressed all-reduce.  The value keeps
+//	the upper 16 bits of the float, rounded to nearest even.
+//-----------------------------------------------------------------------------
+inline __host__ __device__ unsigned short float_to_bf16(float f)
+{
+	union { float f; unsigned int u; } v;
+	v.f = f;
+
+	if ((v.u & 0x7fffffff) > 0x7f800000)	// NaN, keep it quiet.
+		return (unsigned short)((v.u >> 16) | 0x0040);
+
+	v.u += 0x7fff + ((v.u >> 16) & 1);
+	return (unsigned short)(v.u >> 16);
+}
+
+inline __host__ __device__ float bf16_to_float(unsigned short h)
+{
+	union { float f; unsigned int u; } v;
+	v.u = ((unsigned int)h) << 16;
+	return v.f;
+}
+
 
 #endif
\ No newline at end of file
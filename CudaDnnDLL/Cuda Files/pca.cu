@@ -71,16 +71,16 @@ long pcaHandle<T>::Initialize(Memory<T>* pMem, Math<T>* pMath)
 		MemoryItem* pLoads;
 		MemoryItem* pSums;
 
-		if (lErr = m_pMem->GetMemory(m_hResiduals, &pResiduals))
+		if (lErr = m_pMem->GetSharedMemory(m_hResiduals, &pResiduals))
 			return lErr;
 
-		if (lErr = m_pMem->GetMemory(m_hScores, &pScores))
+		if (lErr = m_pMem->GetSharedMemory(m_hScores, &pScores))
 			return lErr;
 
-		if (lErr = m_pMem->GetMemory(m_hLoads, &pLoads))
+		if (lErr = m_pMem->GetSharedMemory(m_hLoads, &pLoads))
 			return lErr;
 
-		if (lErr = m_pMem->GetMemory(m_hMeanCenter, &pSums))
+		if (lErr = m_pMem->GetSharedMemory(m_hMeanCenter, &pSums))
 			return lErr;
 
 		m_pfR = (T*)pResiduals->Data();
@@ -0,0 +1,240 @@
+//=============================================================================
+//	FILE:	profiler.cu
+//
+//	DESC:	This file implements the per function latency profiler used by the
+//			kernel.
+//=============================================================================
+
+#include "util.h"
+#include "profiler.h"
+#include <intrin.h>
+#include <vector>
+#include <algorithm>
+
+//=============================================================================
+//	FunctionProfile Methods
+//=============================================================================
+
+int FunctionProfile::BucketOf(LONGLONG llNs)
+{
+	if (llNs < 0)
+		llNs = 0;
+
+	if (llNs < PROFILER_SUB_BUCKETS * 2)
+		return (int)llNs;
+
+	unsigned long nMsb;
+	_BitScanReverse64(&nMsb, (unsigned __int64)llNs);
+
+	int nSub = (int)((llNs >> (nMsb - PROFILER_SUB_BITS)) & (PROFILER_SUB_BUCKETS - 1));
+
+	return PROFILER_SUB_BUCKETS * 2 + ((int)nMsb - PROFILER_SUB_BITS - 1) * PROFILER_SUB_BUCKETS + nSub;
+}
+
+LONGLONG FunctionProfile::BucketValue(int nBucket)
+{
+	if (nBucket < PROFILER_SUB_BUCKETS * 2)
+		return nBucket;
+
+	int nIdx = nBucket - PROFILER_SUB_BUCKETS * 2;
+	int nMsb = nIdx / PROFILER_SUB_BUCKETS + PROFILER_SUB_BITS + 1;
+	int nSub = nIdx % PROFILER_SUB_BUCKETS;
+	LONGLONG llWidth = 1LL << (nMsb - PROFILER_SUB_BITS);
+	LONGLONG llLower = (1LL << nMsb) | ((LONGLONG)nSub * llWidth);
+
+	return llLower + llWidth / 2;
+}
+
+void FunctionProfile::Record(LONGLONG llNs, LONGLONG llBytes, bool bError)
+{
+	InterlockedIncrement64(&m_llCalls);
+	InterlockedExchangeAdd64(&m_llTotalNs, llNs);
+	InterlockedIncrement64(&m_rgllBuckets[BucketOf(llNs)]);
+
+	if (llBytes > 0)
+		InterlockedExchangeAdd64(&m_llBytes, llBytes);
+
+	if (bError)
+		InterlockedIncrement64(&m_llErrors);
+
+	LONGLONG llMin = m_llMinNs;
+	while (llNs < llMin)
+	{
+		LONGLONG llPrev = InterlockedCompareExchange64(&m_llMinNs, llNs, llMin);
+		if (llPrev == llMin)
+			break;
+		llMin = llPrev;
+	}
+
+	LONGLONG llMax = m_llMaxNs;
+	while (llNs > llMax)
+	{
+		LONGLONG llPrev = InterlockedCompareExchange64(&m_llMaxNs, llNs, llMax);
+		if (llPrev == llMax)
+			break;
+		llMax = llPrev;
+	}
+}
+
+LONGLONG FunctionProfile::Percentile(double dfPct)
+{
+	LONGLONG llTotal = 0;
+
+	for (int i = 0; i < PROFILER_BUCKETS; i++)
+	{
+		llTotal += m_rgllBuckets[i];
+	}
+
+	if (llTotal == 0)
+		return 0;
+
+	LONGLONG llTarget = (LONGLONG)ceil(dfPct * llTotal);
+	LONGLONG llCount = 0;
+
+	if (llTarget < 1)
+		llTarget = 1;
+
+	for (int i = 0; i < PROFILER_BUCKETS; i++)
+	{
+		llCount += m_rgllBuckets[i];
+
+		if (llCount >= llTarget)
+		{
+			LONGLONG llVal = BucketValue(i);
+			return (llVal < m_llMaxNs) ? llVal : m_llMaxNs;
+		}
+	}
+
+	return m_llMaxNs;
+}
+
+
+//=============================================================================
+//	Profiler Methods
+//=============================================================================
+
+void Profiler::CleanUp()
+{
+	m_bEnabled = false;
+
+	for (int i = 0; i < PROFILER_MAX_FUNCTIONS; i++)
+	{
+		if (m_rgProfiles[i] != NULL)
+		{
+			delete m_rgProfiles[i];
+			m_rgProfiles[i] = NULL;
+		}
+	}
+}
+
+void Profiler::Enable(bool bEnable)
+{
+	if (bEnable && !m_bEnabled)
+		QueryPerformanceCounter(&m_liStart);
+
+	m_bEnabled = bEnable;
+}
+
+void Profiler::Reset()
+{
+	for (int i = 0; i < PROFILER_MAX_FUNCTIONS; i++)
+	{
+		if (m_rgProfiles[i] != NULL)
+			m_rgProfiles[i]->Reset();
+	}
+
+	QueryPerformanceCounter(&m_liStart);
+}
+
+FunctionProfile* Profiler::getProfile(long lfnIdx)
+{
+	if (lfnIdx < 0 || lfnIdx >= PROFILER_MAX_FUNCTIONS)
+		return NULL;
+
+	FunctionProfile* pProfile = m_rgProfiles[lfnIdx];
+
+	if (pProfile != NULL)
+		return pProfile;
+
+	// Two threads may see the same function for the first time, only one wins.
+	FunctionProfile* pNew = new FunctionProfile();
+	if (pNew == NULL)
+		return NULL;
+
+	pProfile = (FunctionProfile*)InterlockedCompareExchangePointer((PVOID volatile*)&m_rgProfiles[lfnIdx], pNew, NULL);
+	if (pProfile != NULL)
+	{
+		delete pNew;
+		return pProfile;
+	}
+
+	return pNew;
+}
+
+void Profiler::Record(long lfnIdx, LONGLONG llStart, LONGLONG llEnd, LONGLONG llBytes, long lErr)
+{
+	FunctionProfile* pProfile = getProfile(lfnIdx);
+
+	if (pProfile == NULL)
+		return;
+
+	LONGLONG llNs = (LONGLONG)((double)(llEnd - llStart) * 1000000000.0 / (double)m_liFreq.QuadPart);
+
+	pProfile->Record(llNs, llBytes, (lErr != 0) ? true : false);
+}
+
+long Profiler::ToJson(std::string& str)
+{
+	std::vector<std::pair<LONGLONG, int>> rgOrder;
+	LARGE_INTEGER liNow;
+	char szBuffer[1024];
+
+	for (int i = 0; i < PROFILER_MAX_FUNCTIONS; i++)
+	{
+		FunctionProfile* pProfile = m_rgProfiles[i];
+
+		if (pProfile != NULL && pProfile->m_llCalls > 0)
+			rgOrder.push_back(std::make_pair((LONGLONG)pProfile->m_llTotalNs, i));
+	}
+
+	// Functions that take the most wall time are listed first.
+	std::sort(rgOrder.begin(), rgOrder.end(), [](const std::pair<LONGLONG, int>& a, const std::pair<LONGLONG, int>& b) { return a.first > b.first; });
+
+	QueryPerformanceCounter(&liNow);
+	double dfElapsedMs = (double)(liNow.QuadPart - m_liStart.QuadPart) * 1000.0 / (double)m_liFreq.QuadPart;
+
+	_snprintf(szBuffer, 1023, "{\"enabled\":%s,\"elapsed_ms\":%.3lf,\"functions\":[", (m_bEnabled) ? "true" : "false", dfElapsedMs);
+	szBuffer[1023] = NULL;
+	str = szBuffer;
+
+	for (size_t i = 0; i < rgOrder.size(); i++)
+	{
+		FunctionProfile* pProfile = m_rgProfiles[rgOrder[i].second];
+		LONGLONG llCalls = pProfile->m_llCalls;
+		double dfTotalMs = (double)pProfile->m_llTotalNs / 1000000.0;
+		double dfMeanUs = (double)pProfile->m_llTotalNs / 1000.0 / (double)llCalls;
+
+		_snprintf(szBuffer, 1023, "%s{\"fn\":%d,\"calls\":%lld,\"errors\":%lld,\"total_ms\":%.3lf,\"mean_us\":%.3lf,\"min_us\":%.3lf,\"p50_us\":%.3lf,\"p90_us\":%.3lf,\"p99_us\":%.3lf,\"p999_us\":%.3lf,\"max_us\":%.3lf,\"bytes\":%lld}",
+			(i == 0) ? "" : ",",
+			rgOrder[i].second,
+			llCalls,
+			(LONGLONG)pProfile->m_llErrors,
+			dfTotalMs,
+			dfMeanUs,
+			(double)pProfile->m_llMinNs / 1000.0,
+			(double)pProfile->Percentile(0.50) / 1000.0,
+			(double)pProfile->Percentile(0.90) / 1000.0,
+			(double)pProfile->Percentile(0.99) / 1000.0,
+			(double)pProfile->Percentile(0.999) / 1000.0,
+			(double)pProfile->m_llMaxNs / 1000.0,
+			(LONGLONG)pProfile->m_llBytes);
+		szBuffer[1023] = NULL;
+		str += szBuffer;
+	}
+
+	str += "]}";
+
+	return 0;
+}
+
+// end
\ No newline at end of file
@@ -0,0 +1,133 @@
+//=============================================================================
+//	FILE:	profiler.h
+//
+//	DESC:	This file manages the per function latency profiler used by the
+//			kernel.
+//=============================================================================
+#ifndef __PROFILER_CU__
+#define __PROFILER_CU__
+
+#include "util.h"
+#include <string>
+#include <limits.h>
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int PROFILER_MAX_FUNCTIONS = 1024;
+const int PROFILER_SUB_BITS = 4;
+const int PROFILER_SUB_BUCKETS = (1 << PROFILER_SUB_BITS);
+const int PROFILER_BUCKETS = PROFILER_SUB_BUCKETS * 2 + (63 - PROFILER_SUB_BITS) * PROFILER_SUB_BUCKETS;
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Function Profile Class
+//
+//	The counters of a single function index.  Latencies are kept in an HDR
+//	style log-linear histogram of nanoseconds: values below 32 have their own
+//	bucket, larger values share a bucket with those that have the same
+//	leading bit and next 4 bits, so every bucket is within ~6% of its values.
+//-----------------------------------------------------------------------------
+class FunctionProfile
+{
+public:
+	volatile LONGLONG m_llCalls;
+	volatile LONGLONG m_llErrors;
+	volatile LONGLONG m_llTotalNs;
+	volatile LONGLONG m_llMinNs;
+	volatile LONGLONG m_llMaxNs;
+	volatile LONGLONG m_llBytes;
+	volatile LONGLONG m_rgllBuckets[PROFILER_BUCKETS];
+
+	FunctionProfile()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_llCalls = 0;
+		m_llErrors = 0;
+		m_llTotalNs = 0;
+		m_llMinNs = LLONG_MAX;
+		m_llMaxNs = 0;
+		m_llBytes = 0;
+		memset((void*)m_rgllBuckets, 0, sizeof(m_rgllBuckets));
+	}
+
+	void Record(LONGLONG llNs, LONGLONG llBytes, bool bError);
+	LONGLONG Percentile(double dfPct);
+
+	static int BucketOf(LONGLONG llNs);
+	static LONGLONG BucketValue(int nBucket);
+};
+
+
+//-----------------------------------------------------------------------------
+//	Profiler Class
+//
+//	Collects the call counts, latencies and bytes moved of each function index
+//	run by a kernel.  The profiles are allocated the first time a function is
+//	seen and are only ever updated with interlocked operations, so the callers
+//	never take a lock.  When disabled, the only cost to the caller is the test
+//	of IsEnabled.
+//-----------------------------------------------------------------------------
+class Profiler
+{
+	volatile bool m_bEnabled;
+	FunctionProfile* volatile m_rgProfiles[PROFILER_MAX_FUNCTIONS];
+	LARGE_INTEGER m_liFreq;
+	LARGE_INTEGER m_liStart;
+
+	FunctionProfile* getProfile(long lfnIdx);
+
+public:
+	Profiler()
+	{
+		m_bEnabled = false;
+		memset((void*)m_rgProfiles, 0, sizeof(m_rgProfiles));
+		QueryPerformanceFrequency(&m_liFreq);
+		QueryPerformanceCounter(&m_liStart);
+	}
+
+	~Profiler()
+	{
+		CleanUp();
+	}
+
+	void CleanUp();
+
+	bool IsEnabled()
+	{
+		return m_bEnabled;
+	}
+
+	void Enable(bool bEnable);
+	void Reset();
+
+	LONGLONG Now()
+	{
+		LARGE_INTEGER li;
+		QueryPerformanceCounter(&li);
+		return li.QuadPart;
+	}
+
+	void Record(long lfnIdx, LONGLONG llStart, LONGLONG llEnd, LONGLONG llBytes, long lErr);
+	long ToJson(std::string& str);
+};
+
+
+//=============================================================================
+//	Inline Methods
+//=============================================================================
+
+
+#endif
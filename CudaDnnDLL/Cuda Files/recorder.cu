@@ -0,0 +1,253 @@
+//=============================================================================
+//	FILE:	recorder.cu
+//
+//	DESC:	This file implements the call recorder that logs the calls made
+//			through the DLL_InvokeFloat and DLL_InvokeDouble exports.
+//=============================================================================
+
+#include "util.h"
+#include "main.h"
+#include "recorder.h"
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const size_t CALLLOG_FILE_BUFFER = 4 * 1024 * 1024;
+
+//=============================================================================
+//	Globals
+//=============================================================================
+
+CallRecorder g_recorder;
+
+
+//=============================================================================
+//	Local Functions
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Returns true for the functions that return a new handle in their first
+//	output, the replay uses these to verify that it sees the same handles
+//	as the recorded session.
+//-----------------------------------------------------------------------------
+static bool isHandleFunction(LONG lFunctionIdx)
+{
+	switch (lFunctionIdx)
+	{
+		case CUDA_DLL_INITIALIZE:
+		case CUDA_FN_CREATE_MEMORYPOINTER:
+		case CUDA_FN_ALLOCMEM:
+		case CUDA_FN_ALLOCHOSTBUFFER:
+		case CUDA_FN_CREATE_STREAM:
+		case CUDA_FN_CREATE_MEMTEST:
+		case CUDA_FN_CREATE_NCCL:
+		case CUDNN_FN_CREATE_CUDNN:
+		case CUDNN_FN_CREATE_TENSORDESC:
+		case CUDNN_FN_CREATE_FILTERDESC:
+		case CUDNN_FN_CREATE_CONVDESC:
+		case CUDNN_FN_CREATE_POOLDESC:
+		case CUDNN_FN_CREATE_LRNDESC:
+		case CUDNN_FN_CREATE_DROPOUTDESC:
+		case CUDA_FN_CREATE_PCA:
+		case CUDA_FN_CREATE_TSNE_GAUSSIAN_PERPLEXITY:
+		case CUDA_FN_CREATE_TSNE:
+		case CUDA_FN_CREATE_MODELAVG:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+
+//=============================================================================
+//	CallRecorder Methods
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Opens the log named by the environment once, on the first call.
+//-----------------------------------------------------------------------------
+void CallRecorder::start()
+{
+	EnterCriticalSection(&m_lock);
+
+	if (!m_bStarted)
+	{
+		OpenFromEnvironment();
+		m_bStarted = true;
+	}
+
+	LeaveCriticalSection(&m_lock);
+}
+
+long CallRecorder::Open(LPCSTR pszFile, bool bPayloads)
+{
+	Close();
+
+	EnterCriticalSection(&m_lock);
+
+	m_bStarted = true;
+
+	m_pFile = fopen(pszFile, "wb");
+	if (m_pFile == NULL)
+	{
+		LeaveCriticalSection(&m_lock);
+		return ERROR_PARAM_NULL;
+	}
+
+	setvbuf(m_pFile, NULL, _IOFBF, CALLLOG_FILE_BUFFER);
+
+	LARGE_INTEGER liFreq;
+	QueryPerformanceFrequency(&liFreq);
+
+	CALLLOG_HEADER hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.dwMagic = CALLLOG_MAGIC;
+	hdr.dwVersion = CALLLOG_VERSION;
+	hdr.dwFlags = (bPayloads) ? CALLLOG_FLAG_PAYLOADS : 0;
+	hdr.llFrequency = liFreq.QuadPart;
+
+	fwrite(&hdr, sizeof(hdr), 1, m_pFile);
+
+	m_bPayloads = bPayloads;
+	m_llCalls = 0;
+	m_bEnabled = true;
+
+	LeaveCriticalSection(&m_lock);
+
+	return 0;
+}
+
+long CallRecorder::OpenFromEnvironment()
+{
+	char szFile[MAX_PATH + 1];
+	char szPayloads[16];
+
+	DWORD dwLen = GetEnvironmentVariableA(CALLLOG_ENV_FILE, szFile, MAX_PATH);
+	if (dwLen == 0 || dwLen >= MAX_PATH)
+		return 0;
+
+	bool bPayloads = false;
+
+	dwLen = GetEnvironmentVariableA(CALLLOG_ENV_PAYLOADS, szPayloads, 15);
+	if (dwLen > 0 && dwLen < 15 && szPayloads[0] == '1')
+		bPayloads = true;
+
+	return Open(szFile, bPayloads);
+}
+
+void CallRecorder::Close()
+{
+	m_bStarted = true;
+	m_bEnabled = false;
+
+	EnterCriticalSection(&m_lock);
+
+	if (m_pFile != NULL)
+	{
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+
+	LeaveCriticalSection(&m_lock);
+}
+
+//-----------------------------------------------------------------------------
+//	Returns the number of inputs to store, when payloads are not kept only
+//	the handle, count and offset inputs of the memory setters are stored.
+//-----------------------------------------------------------------------------
+template <class T>
+long CallRecorder::getStoredCount(LONG lFunctionIdx, T* pInput, LONG lInput)
+{
+	if (pInput == NULL || lInput <= 0)
+		return 0;
+
+	switch (lFunctionIdx)
+	{
+		// The input is a host pointer that has already been freed.
+		case CUDA_DLL_FREEMEM:
+			return 0;
+
+		case CUDA_FN_SETMEM:
+		case CUDA_FN_SETMEMAT:
+		case CUDA_FN_SETHOSTMEM:
+			if (!m_bPayloads && lInput > 2)
+			{
+				long lCount = (long)pInput[1];
+
+				if (lCount > 0 && lCount < lInput)
+					return lInput - lCount;
+			}
+			return lInput;
+
+		default:
+			return lInput;
+	}
+}
+
+template long CallRecorder::getStoredCount<double>(LONG lFunctionIdx, double* pInput, LONG lInput);
+template long CallRecorder::getStoredCount<float>(LONG lFunctionIdx, float* pInput, LONG lInput);
+
+
+void CallRecorder::write(CALLLOG_RECORD* pRec, void* pData, size_t szData)
+{
+	EnterCriticalSection(&m_lock);
+
+	if (m_pFile != NULL)
+	{
+		fwrite(pRec, sizeof(CALLLOG_RECORD), 1, m_pFile);
+
+		if (szData > 0)
+			fwrite(pData, szData, 1, m_pFile);
+
+		// Keep the log usable if the process is killed.
+		m_llCalls++;
+		if ((m_llCalls % 4096) == 0)
+			fflush(m_pFile);
+	}
+
+	LeaveCriticalSection(&m_lock);
+}
+
+template <class T>
+void CallRecorder::Record(LONG lKernelIdx, LONG lFunctionIdx, T* pInput, LONG lInput, T** ppOutput, LONG* plOutput, LONG lErr, LONGLONG llBegin, LONGLONG llEnd)
+{
+	CALLLOG_RECORD rec;
+	long lStored = getStoredCount(lFunctionIdx, pInput, lInput);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.nType = (sizeof(T) == sizeof(double)) ? CALLLOG_TYPE_DOUBLE : CALLLOG_TYPE_FLOAT;
+	rec.dwThreadID = GetCurrentThreadId();
+	rec.lKernelIdx = lKernelIdx;
+	rec.lFunctionIdx = lFunctionIdx;
+	rec.lInput = (lFunctionIdx == CUDA_DLL_FREEMEM) ? 0 : lInput;
+	rec.lInputStored = lStored;
+	rec.lErr = lErr;
+	rec.llBegin = llBegin;
+	rec.llEnd = llEnd;
+
+	if (lStored < rec.lInput)
+		rec.nFlags |= CALLLOG_REC_TRUNCATED;
+
+	if (lErr == 0 && plOutput != NULL)
+	{
+		rec.lOutput = *plOutput;
+
+		if (rec.lOutput > 0 && ppOutput != NULL && *ppOutput != NULL)
+		{
+			rec.dfOutput0 = (double)(*ppOutput)[0];
+			rec.nFlags |= CALLLOG_REC_OUTPUT;
+
+			if (isHandleFunction(lFunctionIdx))
+				rec.nFlags |= CALLLOG_REC_HANDLE;
+		}
+	}
+
+	write(&rec, pInput, lStored * sizeof(T));
+}
+
+template void CallRecorder::Record<double>(LONG lKernelIdx, LONG lFunctionIdx, double* pInput, LONG lInput, double** ppOutput, LONG* plOutput, LONG lErr, LONGLONG llBegin, LONGLONG llEnd);
+template void CallRecorder::Record<float>(LONG lKernelIdx, LONG lFunctionIdx, float* pInput, LONG lInput, float** ppOutput, LONG* plOutput, LONG lErr, LONGLONG llBegin, LONGLONG llEnd);
+
+// end
\ No newline at end of file
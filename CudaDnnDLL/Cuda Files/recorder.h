@@ -0,0 +1,159 @@
+//=============================================================================
+//	FILE:	recorder.h
+//
+//	DESC:	This file manages the call recorder that logs the calls made
+//			through the DLL_InvokeFloat and DLL_InvokeDouble exports so that
+//			they can be replayed later by CudaDnnReplay.
+//
+//			NOTE: this file is also included by the replay tool, so it must
+//			not depend on the CUDA headers.
+//=============================================================================
+#ifndef __RECORDER_CU__
+#define __RECORDER_CU__
+
+#include <windows.h>
+#include <stdio.h>
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+enum CALLLOG_TYPE
+{
+	CALLLOG_TYPE_FLOAT = 0,
+	CALLLOG_TYPE_DOUBLE = 1
+};
+
+const DWORD CALLLOG_FLAG_PAYLOADS	= 0x0001;	// header: the SetMemory payloads are stored.
+
+const BYTE CALLLOG_REC_TRUNCATED	= 0x01;		// record: the payload was not stored.
+const BYTE CALLLOG_REC_HANDLE		= 0x02;		// record: the first output is a new handle.
+const BYTE CALLLOG_REC_OUTPUT		= 0x04;		// record: dfOutput0 holds the first output.
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const DWORD CALLLOG_MAGIC = 0x4C52434D;		// 'MCRL'
+const DWORD CALLLOG_VERSION = 1;
+
+const LPCSTR CALLLOG_ENV_FILE = "MYCAFFE_CALL_LOG";
+const LPCSTR CALLLOG_ENV_PAYLOADS = "MYCAFFE_CALL_LOG_PAYLOADS";
+
+//=============================================================================
+//	Types
+//=============================================================================
+
+#pragma pack(push, 1)
+
+//-----------------------------------------------------------------------------
+//	The log starts with a single header followed by one record per call.
+//	Each record is followed by lInputStored values of the record type, when
+//	fewer than lInput values are stored, the replay fills the rest with 0.
+//-----------------------------------------------------------------------------
+typedef struct CALLLOG_HEADER
+{
+	DWORD dwMagic;
+	DWORD dwVersion;
+	DWORD dwFlags;
+	DWORD dwReserved;
+	LONGLONG llFrequency;	// performance counter ticks per second.
+} CALLLOG_HEADER;
+
+typedef struct CALLLOG_RECORD
+{
+	BYTE nType;
+	BYTE nFlags;
+	WORD wReserved;
+	DWORD dwThreadID;
+	LONG lKernelIdx;
+	LONG lFunctionIdx;
+	LONG lInput;
+	LONG lInputStored;
+	LONG lOutput;
+	LONG lErr;
+	double dfOutput0;
+	LONGLONG llBegin;
+	LONGLONG llEnd;
+} CALLLOG_RECORD;
+
+#pragma pack(pop)
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Call Recorder Class
+//
+//	Appends every call made through the invoke exports to a binary log.  The
+//	recorder is started on the first call when the MYCAFFE_CALL_LOG
+//	environment variable names the log file, rather than in DllMain where
+//	opening a file under the loader lock may deadlock, and SetMemory style payloads are only kept
+//	when MYCAFFE_CALL_LOG_PAYLOADS=1, which keeps the log small enough to
+//	capture a full training session.  When disabled, the cost to each call
+//	is the test of IsEnabled.
+//-----------------------------------------------------------------------------
+class CallRecorder
+{
+	volatile bool m_bStarted;
+	volatile bool m_bEnabled;
+	bool m_bPayloads;
+	FILE* m_pFile;
+	CRITICAL_SECTION m_lock;
+	LONGLONG m_llCalls;
+
+	template <class T>
+	long getStoredCount(LONG lFunctionIdx, T* pInput, LONG lInput);
+	void write(CALLLOG_RECORD* pRec, void* pData, size_t szData);
+	void start();
+
+public:
+	CallRecorder()
+	{
+		m_bStarted = false;
+		m_bEnabled = false;
+		m_bPayloads = false;
+		m_pFile = NULL;
+		m_llCalls = 0;
+		InitializeCriticalSection(&m_lock);
+	}
+
+	~CallRecorder()
+	{
+		Close();
+		DeleteCriticalSection(&m_lock);
+	}
+
+	bool IsEnabled()
+	{
+		if (!m_bStarted)
+			start();
+
+		return m_bEnabled;
+	}
+
+	static LONGLONG Now()
+	{
+		LARGE_INTEGER li;
+		QueryPerformanceCounter(&li);
+		return li.QuadPart;
+	}
+
+	long Open(LPCSTR pszFile, bool bPayloads);
+	long OpenFromEnvironment();
+	void Close();
+
+	template <class T>
+	void Record(LONG lKernelIdx, LONG lFunctionIdx, T* pInput, LONG lInput, T** ppOutput, LONG* plOutput, LONG lErr, LONGLONG llBegin, LONGLONG llEnd);
+};
+
+extern CallRecorder g_recorder;
+
+
+//=============================================================================
+//	Inline Methods
+//=============================================================================
+
+
+#endif
@@ -0,0 +1,252 @@
+//=============================================================================
+//	FILE:	streampool.cu
+//
+//	DESC:	This file implements the pool of streams used to overlap
+//			independent operations on a device.
+//=============================================================================
+
+#include "util.h"
+#include "streampool.h"
+
+
+//=============================================================================
+//	Local Functions
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Schedules an operation with one input and one output (either may be NULL)
+//	and returns true when the lanes it waits on are the ones expected.
+//-----------------------------------------------------------------------------
+static bool checkWait(HazardTracker& hazards, int nLane, const HAZARD_RANGE* pIn, const HAZARD_RANGE* pOut, DWORD dwExpected)
+{
+	DWORD dwWait = hazards.Schedule(nLane, pIn, (pIn != NULL) ? 1 : 0, pOut, (pOut != NULL) ? 1 : 0);
+	return (dwWait == dwExpected) ? true : false;
+}
+
+//=============================================================================
+//	StreamPool Methods
+//=============================================================================
+
+long StreamPool::Initialize(int nDeviceID, int nLanes)
+{
+	LONG lErr;
+
+	if (m_nLanes > 0 && m_nDeviceID == nDeviceID)
+		return 0;
+
+	if (nLanes < 1 || nLanes > HAZARD_MAX_LANES)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	CleanUp();
+
+	for (int i = 0; i < nLanes; i++)
+	{
+		if (lErr = cudaStreamCreate(&m_rgStreams[i]))
+		{
+			CleanUp();
+			return lErr;
+		}
+
+		m_nLanes++;
+
+		if (lErr = cudaEventCreateWithFlags(&m_rgEvents[i], cudaEventDisableTiming))
+		{
+			CleanUp();
+			return lErr;
+		}
+	}
+
+	m_nDeviceID = nDeviceID;
+	m_nNext = 0;
+	m_dwUsed = 0;
+
+	return 0;
+}
+
+void StreamPool::CleanUp()
+{
+	for (int i = 0; i < m_nLanes; i++)
+	{
+		if (m_rgEvents[i] != NULL)
+		{
+			cudaEventDestroy(m_rgEvents[i]);
+			m_rgEvents[i] = NULL;
+		}
+
+		if (m_rgStreams[i] != NULL)
+		{
+			cudaStreamDestroy(m_rgStreams[i]);
+			m_rgStreams[i] = NULL;
+		}
+	}
+
+	m_hazards.Reset();
+	m_nLanes = 0;
+	m_nDeviceID = -1;
+	m_dwUsed = 0;
+}
+
+long StreamPool::Begin(int nLane, const HAZARD_RANGE* rgIn, int nIn, const HAZARD_RANGE* rgOut, int nOut)
+{
+	LONG lErr;
+
+	if (nLane < 0 || nLane >= m_nLanes)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	DWORD dwWait = m_hazards.Schedule(nLane, rgIn, nIn, rgOut, nOut);
+
+	for (int i = 0; dwWait != 0 && i < m_nLanes; i++)
+	{
+		if (dwWait & (1 << i))
+		{
+			if (lErr = cudaStreamWaitEvent(m_rgStreams[nLane], m_rgEvents[i], 0))
+				return lErr;
+		}
+	}
+
+	m_dwUsed |= (1 << nLane);
+
+	return 0;
+}
+
+long StreamPool::End(int nLane)
+{
+	if (nLane < 0 || nLane >= m_nLanes)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	return cudaEventRecord(m_rgEvents[nLane], m_rgStreams[nLane]);
+}
+
+long StreamPool::Synchronize()
+{
+	LONG lErr = 0;
+
+	for (int i = 0; i < m_nLanes; i++)
+	{
+		if (m_dwUsed & (1 << i))
+		{
+			LONG lErr1 = cudaStreamSynchronize(m_rgStreams[i]);
+
+			if (lErr1 && !lErr)
+				lErr = lErr1;
+		}
+	}
+
+	m_hazards.Reset();
+	m_dwUsed = 0;
+
+	return lErr;
+}
+
+//-----------------------------------------------------------------------------
+//	Checks the hazard tracking and the lane assignment on the host, without
+//	creating any streams, and returns the number of the first check that
+//	failed, or 0 when all pass.
+//-----------------------------------------------------------------------------
+int StreamPool::Check()
+{
+	const long hA = 1;
+	const long hB = 2;
+	int nCheck = 0;
+	HazardTracker hazards;
+
+	HAZARD_RANGE a0_100 = { hA, 0, 100 };
+	HAZARD_RANGE a50_60 = { hA, 50, 60 };
+	HAZARD_RANGE a100_200 = { hA, 100, 200 };
+	HAZARD_RANGE a0_10 = { hA, 0, 10 };
+	HAZARD_RANGE a55_56 = { hA, 55, 56 };
+	HAZARD_RANGE aAll = { hA, 0, HAZARD_WHOLE_HANDLE };
+	HAZARD_RANGE bAll = { hB, 0, HAZARD_WHOLE_HANDLE };
+	HAZARD_RANGE b10_20 = { hB, 10, 20 };
+	HAZARD_RANGE b0_5 = { hB, 0, 5 };
+
+	// Nothing to wait for on the first write.
+	nCheck++;
+	if (!checkWait(hazards, 0, NULL, &a0_100, 0))
+		return nCheck;
+
+	// Read after write on another lane.
+	nCheck++;
+	if (!checkWait(hazards, 1, &a50_60, NULL, 1 << 0))
+		return nCheck;
+
+	// Ranges that do not overlap are independent.
+	nCheck++;
+	if (!checkWait(hazards, 2, &a100_200, NULL, 0))
+		return nCheck;
+
+	// Operations on the same lane are already ordered.
+	nCheck++;
+	if (!checkWait(hazards, 0, &a0_10, NULL, 0))
+		return nCheck;
+
+	// Write after write and write after read.
+	nCheck++;
+	if (!checkWait(hazards, 3, NULL, &a55_56, (1 << 0) | (1 << 1)))
+		return nCheck;
+
+	// A whole handle read overlaps any later write.
+	nCheck++;
+	if (!checkWait(hazards, 1, &bAll, NULL, 0))
+		return nCheck;
+
+	nCheck++;
+	if (!checkWait(hazards, 2, NULL, &b10_20, 1 << 1))
+		return nCheck;
+
+	// Reads never wait on reads.
+	nCheck++;
+	if (!checkWait(hazards, 0, &b0_5, NULL, 0))
+		return nCheck;
+
+	// A whole handle write waits on every other lane and replaces the
+	// accesses it covers.
+	nCheck++;
+	if (!checkWait(hazards, 3, NULL, &aAll, (1 << 0) | (1 << 1) | (1 << 2)))
+		return nCheck;
+
+	nCheck++;
+	if (hazards.GetAccessCount(hA) != 1)
+		return nCheck;
+
+	// Nothing is remembered once the lanes are synchronized.
+	hazards.Reset();
+
+	nCheck++;
+	if (hazards.GetAccessCount(hA) != 0 || hazards.GetAccessCount(hB) != 0)
+		return nCheck;
+
+	nCheck++;
+	if (!checkWait(hazards, 1, &a0_10, NULL, 0))
+		return nCheck;
+
+	// The lanes are leased round-robin.  Each item below reads its own
+	// range and writes the range of the item three before it, the same
+	// pattern as calc_batch_dist with repeated target offsets, so it only
+	// waits on the lane of that item.
+	StreamPool pool;
+	pool.m_nLanes = 4;
+
+	for (int i = 0; i < 10; i++)
+	{
+		int nLane = pool.Lease();
+		int nOffset = (i % 3) * 10;
+		HAZARD_RANGE rgIn[2] = { { hA, i * 10, i * 10 + 10 }, { hB, nOffset, nOffset + 10 } };
+		HAZARD_RANGE rgOut[1] = { { hB + 1, nOffset, nOffset + 10 } };
+		DWORD dwExpected = (i >= 3) ? (1 << ((i - 3) % 4)) : 0;
+
+		nCheck++;
+		if (nLane != i % 4)
+			return nCheck;
+
+		nCheck++;
+		if (pool.m_hazards.Schedule(nLane, rgIn, 2, rgOut, 1) != dwExpected)
+			return nCheck;
+	}
+
+	pool.m_nLanes = 0;
+
+	return 0;
+}
+
+// end
\ No newline at end of file
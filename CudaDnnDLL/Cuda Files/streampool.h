@@ -0,0 +1,89 @@
+//=============================================================================
+//	FILE:	streampool.h
+//
+//	DESC:	This file manages the pool of streams used to overlap independent
+//			operations on a device.
+//=============================================================================
+#ifndef __STREAMPOOL_CU__
+#define __STREAMPOOL_CU__
+
+#include "util.h"
+#include "hazard.h"
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int STREAMPOOL_DEFAULT_LANES = 4;
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Stream Pool Class
+//
+//	Holds a fixed set of streams (lanes) created once per device, which are
+//	leased round-robin rather than created and destroyed on each call.  An
+//	operation is bracketed by Begin and End: Begin declares the handle ranges
+//	it reads and writes and makes its lane wait on the events of the lanes
+//	it conflicts with, End records the lane's event.  Independent operations
+//	therefore run concurrently, and Synchronize waits for all lanes used.
+//
+//	The lanes are blocking streams, so they stay ordered with the work on
+//	the legacy default stream used by the other kernels.
+//-----------------------------------------------------------------------------
+class StreamPool
+{
+	int m_nDeviceID;
+	int m_nLanes;
+	int m_nNext;
+	DWORD m_dwUsed;
+	cudaStream_t m_rgStreams[HAZARD_MAX_LANES];
+	cudaEvent_t m_rgEvents[HAZARD_MAX_LANES];
+	HazardTracker m_hazards;
+
+public:
+	StreamPool()
+	{
+		m_nDeviceID = -1;
+		m_nLanes = 0;
+		m_nNext = 0;
+		m_dwUsed = 0;
+		memset(m_rgStreams, 0, sizeof(m_rgStreams));
+		memset(m_rgEvents, 0, sizeof(m_rgEvents));
+	}
+
+	~StreamPool()
+	{
+		CleanUp();
+	}
+
+	long Initialize(int nDeviceID, int nLanes = STREAMPOOL_DEFAULT_LANES);
+	void CleanUp();
+
+	int Lease()
+	{
+		int nLane = m_nNext;
+		m_nNext = (m_nNext + 1) % m_nLanes;
+		return nLane;
+	}
+
+	cudaStream_t GetStream(int nLane)
+	{
+		return m_rgStreams[nLane];
+	}
+
+	long Begin(int nLane, const HAZARD_RANGE* rgIn, int nIn, const HAZARD_RANGE* rgOut, int nOut);
+	long End(int nLane);
+	long Synchronize();
+
+	static int Check();
+};
+
+
+//=============================================================================
+//	Inline Methods
+//=============================================================================
+
+#endif
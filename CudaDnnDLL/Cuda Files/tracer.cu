@@ -0,0 +1,189 @@
+//=============================================================================
+//	FILE:	tracer.cu
+//
+//	DESC:	This file implements the timeline tracer used to record the native
+//			calls, transfers and synchronization points.
+//=============================================================================
+
+#include "util.h"
+#include "tracer.h"
+#include <vector>
+
+//=============================================================================
+//	Globals
+//=============================================================================
+
+Tracer g_tracer;
+
+static __declspec(thread) TraceBuffer* t_pTraceBuffer = NULL;
+static __declspec(thread) LONG t_lTraceGeneration = 0;
+
+static LPCSTR g_rgszTraceCategory[] = { "call", "h2d", "d2h", "readback", "sync", "nccl" };
+
+
+//=============================================================================
+//	Tracer Methods
+//=============================================================================
+
+void Tracer::CleanUp()
+{
+	m_bEnabled = false;
+
+	EnterCriticalSection(&m_lock);
+
+	// The buffers cached by each thread are only used while the generation
+	// they were made in is current.
+	InterlockedIncrement(&m_lGeneration);
+
+	TraceBuffer* pBuf = m_pBuffers;
+	m_pBuffers = NULL;
+
+	while (pBuf != NULL)
+	{
+		TraceBuffer* pNext = pBuf->m_pNext;
+		delete pBuf;
+		pBuf = pNext;
+	}
+
+	LeaveCriticalSection(&m_lock);
+}
+
+void Tracer::Enable(bool bEnable, int nCapacity)
+{
+	// The capacity only applies to the buffers of threads not yet traced.
+	if (nCapacity > 0)
+		m_nCapacity = nCapacity;
+
+	m_bEnabled = bEnable;
+}
+
+TraceBuffer* Tracer::getBuffer()
+{
+	LONG lGeneration = m_lGeneration;
+
+	if (t_pTraceBuffer != NULL && t_lTraceGeneration == lGeneration)
+		return t_pTraceBuffer;
+
+	t_pTraceBuffer = NULL;
+
+	TraceBuffer* pBuf = new TraceBuffer(GetCurrentThreadId(), m_nCapacity);
+	if (pBuf == NULL || pBuf->m_rgEvents == NULL)
+	{
+		if (pBuf != NULL)
+			delete pBuf;
+
+		return NULL;
+	}
+
+	EnterCriticalSection(&m_lock);
+	pBuf->m_pNext = m_pBuffers;
+	m_pBuffers = pBuf;
+	LeaveCriticalSection(&m_lock);
+
+	t_pTraceBuffer = pBuf;
+	t_lTraceGeneration = lGeneration;
+
+	return pBuf;
+}
+
+void Tracer::Add(LPCSTR pszName, int nCategory, int nFunction, long h1, long h2, LONGLONG llBytes, LONGLONG llBegin, LONGLONG llEnd)
+{
+	TraceBuffer* pBuf = getBuffer();
+
+	if (pBuf == NULL)
+		return;
+
+	LONGLONG llHead = pBuf->m_llHead;
+	TraceEvent* pEvent = &pBuf->m_rgEvents[llHead % pBuf->m_llCapacity];
+
+	pEvent->m_llBegin = llBegin;
+	pEvent->m_llEnd = llEnd;
+	pEvent->m_llBytes = llBytes;
+	pEvent->m_pszName = pszName;
+	pEvent->m_nCategory = nCategory;
+	pEvent->m_nFunction = nFunction;
+	pEvent->m_h1 = h1;
+	pEvent->m_h2 = h2;
+
+	// Publish the event only after it is fully written.
+	InterlockedExchange64(&pBuf->m_llHead, llHead + 1);
+}
+
+long Tracer::Flush(std::string& str)
+{
+	char szBuffer[512];
+	char szName[64];
+	LONGLONG llDropped = 0;
+	bool bFirst = true;
+	DWORD dwPid = GetCurrentProcessId();
+	double dfUsPerTick = 1000000.0 / (double)m_liFreq.QuadPart;
+
+	EnterCriticalSection(&m_lock);
+
+	str = "{\"traceEvents\":[";
+
+	for (TraceBuffer* pBuf = m_pBuffers; pBuf != NULL; pBuf = pBuf->m_pNext)
+	{
+		LONGLONG llHead = InterlockedCompareExchange64(&pBuf->m_llHead, 0, 0);
+		LONGLONG llFirst = llHead - pBuf->m_llCapacity;
+
+		if (llFirst < pBuf->m_llTail)
+			llFirst = pBuf->m_llTail;
+
+		std::vector<TraceEvent> rgEvents;
+
+		for (LONGLONG i = llFirst; i < llHead; i++)
+		{
+			rgEvents.push_back(pBuf->m_rgEvents[i % pBuf->m_llCapacity]);
+		}
+
+		// Any event the owning thread may have overwritten while copying is dropped.
+		LONGLONG llHead2 = InterlockedCompareExchange64(&pBuf->m_llHead, 0, 0);
+		LONGLONG llValid = llHead2 - pBuf->m_llCapacity + 1;
+
+		if (llValid < llFirst)
+			llValid = llFirst;
+
+		llDropped += llValid - pBuf->m_llTail;
+		pBuf->m_llTail = llHead;
+
+		for (LONGLONG i = llValid; i < llHead; i++)
+		{
+			TraceEvent* pEvent = &rgEvents[(size_t)(i - llFirst)];
+			LPCSTR pszName = pEvent->m_pszName;
+
+			if (pszName == NULL)
+			{
+				_snprintf(szName, 63, "fn %d", pEvent->m_nFunction);
+				szName[63] = NULL;
+				pszName = szName;
+			}
+
+			_snprintf(szBuffer, 511, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3lf,\"dur\":%.3lf,\"pid\":%u,\"tid\":%u,\"args\":{\"fn\":%d,\"h1\":%ld,\"h2\":%ld,\"bytes\":%lld}}",
+				(bFirst) ? "" : ",",
+				pszName,
+				g_rgszTraceCategory[pEvent->m_nCategory],
+				(double)(pEvent->m_llBegin - m_liStart.QuadPart) * dfUsPerTick,
+				(double)(pEvent->m_llEnd - pEvent->m_llBegin) * dfUsPerTick,
+				dwPid,
+				pBuf->m_dwThreadID,
+				pEvent->m_nFunction,
+				pEvent->m_h1,
+				pEvent->m_h2,
+				pEvent->m_llBytes);
+			szBuffer[511] = NULL;
+			str += szBuffer;
+			bFirst = false;
+		}
+	}
+
+	LeaveCriticalSection(&m_lock);
+
+	_snprintf(szBuffer, 511, "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%lld}}", llDropped);
+	szBuffer[511] = NULL;
+	str += szBuffer;
+
+	return 0;
+}
+
+// end
\ No newline at end of file
@@ -0,0 +1,192 @@
+//=============================================================================
+//	FILE:	tracer.h
+//
+//	DESC:	This file manages the timeline tracer used to record the native
+//			calls, transfers and synchronization points.
+//=============================================================================
+#ifndef __TRACER_CU__
+#define __TRACER_CU__
+
+#include "util.h"
+#include <string>
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+enum TRACE_CATEGORY
+{
+	TRACE_CAT_CALL = 0,
+	TRACE_CAT_COPY_H2D = 1,
+	TRACE_CAT_COPY_D2H = 2,
+	TRACE_CAT_READBACK = 3,
+	TRACE_CAT_SYNC = 4,
+	TRACE_CAT_NCCL = 5
+};
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int TRACE_DEFAULT_CAPACITY = 64 * 1024;
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Trace Event Class
+//-----------------------------------------------------------------------------
+class TraceEvent
+{
+public:
+	LONGLONG m_llBegin;
+	LONGLONG m_llEnd;
+	LONGLONG m_llBytes;
+	LPCSTR m_pszName;		// NULL for kernel calls, named by their function index.
+	int m_nCategory;
+	int m_nFunction;
+	long m_h1;
+	long m_h2;
+};
+
+
+//-----------------------------------------------------------------------------
+//	Trace Buffer Class
+//
+//	A ring buffer of events written only by the thread that owns it.  The
+//	head is published after each event is written, so the flushing thread
+//	can tell which events may have been overwritten while it copied them.
+//-----------------------------------------------------------------------------
+class TraceBuffer
+{
+public:
+	DWORD m_dwThreadID;
+	TraceEvent* m_rgEvents;
+	LONGLONG m_llCapacity;
+	volatile LONGLONG m_llHead;
+	LONGLONG m_llTail;		// next event to flush, only used by the flushing thread.
+	TraceBuffer* m_pNext;
+
+	TraceBuffer(DWORD dwThreadID, int nCapacity)
+	{
+		m_dwThreadID = dwThreadID;
+		m_llCapacity = nCapacity;
+		m_rgEvents = new TraceEvent[nCapacity];
+		m_llHead = 0;
+		m_llTail = 0;
+		m_pNext = NULL;
+	}
+
+	~TraceBuffer()
+	{
+		if (m_rgEvents != NULL)
+		{
+			delete [] m_rgEvents;
+			m_rgEvents = NULL;
+		}
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+//	Tracer Class
+//
+//	Records begin/end events into per thread ring buffers and flushes them as
+//	Chrome Trace Event JSON (viewable in chrome://tracing or Perfetto).  The
+//	buffers are found through a thread local pointer, so recording an event
+//	never takes a lock; only registering a new thread's buffer and flushing
+//	are serialized.  When disabled, the cost to each traced site is the test
+//	of IsEnabled.
+//-----------------------------------------------------------------------------
+class Tracer
+{
+	volatile bool m_bEnabled;
+	volatile LONG m_lGeneration;
+	int m_nCapacity;
+	TraceBuffer* volatile m_pBuffers;
+	CRITICAL_SECTION m_lock;
+	LARGE_INTEGER m_liFreq;
+	LARGE_INTEGER m_liStart;
+
+	TraceBuffer* getBuffer();
+
+public:
+	Tracer()
+	{
+		m_bEnabled = false;
+		m_lGeneration = 1;
+		m_nCapacity = TRACE_DEFAULT_CAPACITY;
+		m_pBuffers = NULL;
+		InitializeCriticalSection(&m_lock);
+		QueryPerformanceFrequency(&m_liFreq);
+		QueryPerformanceCounter(&m_liStart);
+	}
+
+	~Tracer()
+	{
+		CleanUp();
+		DeleteCriticalSection(&m_lock);
+	}
+
+	void CleanUp();
+
+	bool IsEnabled()
+	{
+		return m_bEnabled;
+	}
+
+	static LONGLONG Now()
+	{
+		LARGE_INTEGER li;
+		QueryPerformanceCounter(&li);
+		return li.QuadPart;
+	}
+
+	void Enable(bool bEnable, int nCapacity);
+	void Add(LPCSTR pszName, int nCategory, int nFunction, long h1, long h2, LONGLONG llBytes, LONGLONG llBegin, LONGLONG llEnd);
+	long Flush(std::string& str);
+};
+
+extern Tracer g_tracer;
+
+
+//-----------------------------------------------------------------------------
+//	Trace Scope Class
+//
+//	Records an event covering the lifetime of the scope when tracing is on.
+//-----------------------------------------------------------------------------
+class TraceScope
+{
+	LONGLONG m_llBegin;
+	LPCSTR m_pszName;
+	int m_nCategory;
+	long m_h1;
+	long m_h2;
+	LONGLONG m_llBytes;
+
+public:
+	TraceScope(LPCSTR pszName, TRACE_CATEGORY cat, long h1 = 0, long h2 = 0, LONGLONG llBytes = 0)
+	{
+		m_llBegin = (g_tracer.IsEnabled()) ? Tracer::Now() : 0;
+		m_pszName = pszName;
+		m_nCategory = (int)cat;
+		m_h1 = h1;
+		m_h2 = h2;
+		m_llBytes = llBytes;
+	}
+
+	~TraceScope()
+	{
+		if (m_llBegin != 0)
+			g_tracer.Add(m_pszName, m_nCategory, -1, m_h1, m_h2, m_llBytes, m_llBegin, Tracer::Now());
+	}
+};
+
+
+//=============================================================================
+//	Inline Methods
+//=============================================================================
+
+
+#endif
@@ -35,6 +35,7 @@
 #include "util.h"
 #include "memory.h"
 #include "tsne_g.h"
+#include "benchmark.h"
 #include <algorithm>
 #include <vector>
 #include <queue>
@@ -1146,4 +1147,133 @@ long tsnegHandle<T>::SymmetrizeMatrix(unsigned int* pnRowCount)
 template long tsnegHandle<double>::SymmetrizeMatrix(unsigned int* pnRowCount);
 template long tsnegHandle<float>::SymmetrizeMatrix(unsigned int* pnRowCount);
 
+template <class T>
+long tsnegHandle<T>::Benchmark(BenchmarkRunner* pRunner)
+{
+	LONG lErr = 0;
+	LPCSTR pszType = (sizeof(T) == sizeof(float)) ? "float" : "double";
+	const unsigned int nD = 2;		// output map width.
+	const unsigned int nK = 90;		// 3 * perplexity of 30.
+	const T fTheta = T(0.5);
+
+	if (!pRunner->IsSelected(BENCH_SUITE_SPTREE | BENCH_SUITE_SYMMETRIZE))
+		return 0;
+
+	for (unsigned int nN = pRunner->MinSize(); nN <= (unsigned int)pRunner->MaxSize() && !lErr; nN *= 4)
+	{
+		unsigned int nKnn = (nK < nN) ? nK : nN - 1;
+		std::vector<T> rgY(nN * nD);
+		std::vector<T> rgRowP(nN + 1);
+		std::vector<T> rgColP(nN * nKnn);
+		std::vector<T> rgValP(nN * nKnn);
+
+		srand(1701);
+
+		for (unsigned int i = 0; i < nN * nD; i++)
+		{
+			rgY[i] = T(rand()) / T(RAND_MAX) - T(0.5);
+		}
+
+		// A random k-nearest neighbor graph, as built by the gaussian perplexity.
+		for (unsigned int n = 0; n < nN; n++)
+		{
+			rgRowP[n] = T(n * nKnn);
+
+			for (unsigned int k = 0; k < nKnn; k++)
+			{
+				rgColP[n * nKnn + k] = T((n + 1 + rand() % (nN - 1)) % nN);
+				rgValP[n * nKnn + k] = T(1) / T(nKnn);
+			}
+		}
+
+		rgRowP[nN] = T(nN * nKnn);
+
+		if (pRunner->IsSelected(BENCH_SUITE_SPTREE))
+		{
+			std::vector<T> rgPosF(nN * nD);
+			std::vector<T> rgNegF(nN * nD);
+
+			lErr = pRunner->Run("sptree_build", pszType, nN, nN, [&](LONGLONG llIterations)
+			{
+				for (LONGLONG i = 0; i < llIterations; i++)
+				{
+					SpTree<T>* pTree = new SpTree<T>(nD, &rgY[0], nN);
+					delete pTree;
+				}
+
+				return 0;
+			});
+
+			if (!lErr)
+			{
+				SpTree<T>* pTree = new SpTree<T>(nD, &rgY[0], nN);
+
+				lErr = pRunner->Run("sptree_edge_forces", pszType, nN, nN * nKnn, [&](LONGLONG llIterations)
+				{
+					for (LONGLONG i = 0; i < llIterations; i++)
+					{
+						memset(&rgPosF[0], 0, sizeof(T) * nN * nD);
+						pTree->computeEdgeForces(&rgRowP[0], &rgColP[0], &rgValP[0], nN, &rgPosF[0]);
+					}
+
+					return 0;
+				});
+
+				if (!lErr)
+				{
+					lErr = pRunner->Run("sptree_nonedge_forces", pszType, nN, nN, [&](LONGLONG llIterations)
+					{
+						for (LONGLONG i = 0; i < llIterations; i++)
+						{
+							T fSumQ = 0;
+							memset(&rgNegF[0], 0, sizeof(T) * nN * nD);
+
+							for (unsigned int n = 0; n < nN; n++)
+							{
+								pTree->computeNonEdgeForces(n, fTheta, &rgNegF[n * nD], &fSumQ);
+							}
+						}
+
+						return 0;
+					});
+				}
+
+				delete pTree;
+			}
+		}
+
+		if (!lErr && pRunner->IsSelected(BENCH_SUITE_SYMMETRIZE))
+		{
+			tsnegHandle<T> tsne(nN, nD, 0, 0, 0, 0, 0, fTheta);
+
+			// The symmetrized matrix has up to twice the elements and is
+			// written in place, so each iteration starts from a fresh copy.
+			std::vector<T> rgRowP2(nN + 1);
+			std::vector<T> rgColP2(nN * nKnn * 2);
+			std::vector<T> rgValP2(nN * nKnn * 2);
+			unsigned int nRowCount = 0;
+
+			lErr = pRunner->Run("symmetrize_matrix", pszType, nN, nN * nKnn, [&](LONGLONG llIterations)
+			{
+				LONG lErr1 = 0;
+
+				for (LONGLONG i = 0; i < llIterations && !lErr1; i++)
+				{
+					memcpy(&rgRowP2[0], &rgRowP[0], sizeof(T) * rgRowP.size());
+					memcpy(&rgColP2[0], &rgColP[0], sizeof(T) * rgColP.size());
+					memcpy(&rgValP2[0], &rgValP[0], sizeof(T) * rgValP.size());
+					lErr1 = tsne.symmetrizeMatrix(&rgRowP2[0], &rgColP2[0], &rgValP2[0], &nRowCount);
+				}
+
+				return lErr1;
+			});
+		}
+	}
+
+	return lErr;
+}
+
+template long tsnegHandle<double>::Benchmark(BenchmarkRunner* pRunner);
+template long tsnegHandle<float>::Benchmark(BenchmarkRunner* pRunner);
+
 // end
\ No newline at end of file
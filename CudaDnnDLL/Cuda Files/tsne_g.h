@@ -22,6 +22,8 @@
 template <class T>
 class Memory;
 
+class BenchmarkRunner;
+
 
 //-----------------------------------------------------------------------------
 //	PCA Handle Class
@@ -104,6 +106,9 @@ public:
 
 	// Frees memory.
 	long CleanUp();	
+
+	// Times the SpTree build and force passes and the matrix symmetrization.
+	static long Benchmark(BenchmarkRunner* pRunner);
 };
 
 
@@ -35,6 +35,7 @@
 #include "util.h"
 #include "memory.h"
 #include "tsne_gp.h"
+#include "benchmark.h"
 #include <algorithm>
 #include <vector>
 #include <queue>
@@ -564,4 +565,77 @@ long tsnegpHandle<T>::Run(bool *pbDone, int* pnCurrentIteration, int* pnMaxItera
 template long tsnegpHandle<double>::Run(bool *pbDone, int* pnCurrentIteration, int* pnMaxIteration);
 template long tsnegpHandle<float>::Run(bool *pbDone, int* pnCurrentIteration, int* pnMaxIteration);
 
+template <class T>
+long tsnegpHandle<T>::Benchmark(BenchmarkRunner* pRunner)
+{
+	LONG lErr = 0;
+	LPCSTR pszType = (sizeof(T) == sizeof(float)) ? "float" : "double";
+	const unsigned int nD = 50;		// typical input width after PCA.
+	const unsigned int nK = 90;		// 3 * perplexity of 30.
+
+	if (!pRunner->IsSelected(BENCH_SUITE_VPTREE))
+		return 0;
+
+	for (unsigned int nN = pRunner->MinSize(); nN <= (unsigned int)pRunner->MaxSize() && !lErr; nN *= 4)
+	{
+		std::vector<DataPoint<T>*> rgObjX(nN, NULL);
+		std::vector<T> rgX(nD);
+
+		srand(1701);
+
+		for (unsigned int n = 0; n < nN; n++)
+		{
+			for (unsigned int d = 0; d < nD; d++)
+			{
+				rgX[d] = T(rand()) / T(RAND_MAX);
+			}
+
+			rgObjX[n] = new DataPoint<T>(nD, n, &rgX[0]);
+		}
+
+		lErr = pRunner->Run("vptree_build", pszType, nN, nN, [&](LONGLONG llIterations)
+		{
+			for (LONGLONG i = 0; i < llIterations; i++)
+			{
+				VpTree<T> tree;
+				tree.create(rgObjX);
+			}
+
+			return 0;
+		});
+
+		if (!lErr)
+		{
+			VpTree<T> tree;
+			tree.create(rgObjX);
+
+			std::vector<DataPoint<T>*> rgIndices;
+			std::vector<T> rgDistances;
+			unsigned int nKnn = (nK + 1 < nN) ? nK + 1 : nN;
+			unsigned int nIdx = 0;
+
+			lErr = pRunner->Run("vptree_search", pszType, nN, 1, [&](LONGLONG llIterations)
+			{
+				for (LONGLONG i = 0; i < llIterations; i++)
+				{
+					tree.search(rgObjX[nIdx], nKnn, &rgIndices, &rgDistances);
+					nIdx = (nIdx + 1) % nN;
+				}
+
+				return 0;
+			});
+		}
+
+		for (unsigned int n = 0; n < nN; n++)
+		{
+			delete rgObjX[n];
+		}
+	}
+
+	return lErr;
+}
+
+template long tsnegpHandle<double>::Benchmark(BenchmarkRunner* pRunner);
+template long tsnegpHandle<float>::Benchmark(BenchmarkRunner* pRunner);
+
 // end
\ No newline at end of file
@@ -28,6 +28,8 @@ class VpTree;
 template <class T>
 class DataPoint;
 
+class BenchmarkRunner;
+
 
 //-----------------------------------------------------------------------------
 //	PCA Handle Class
@@ -100,6 +102,9 @@ public:
 
 	// Frees memory.
 	long CleanUp();	
+
+	// Times the VpTree build and search.
+	static long Benchmark(BenchmarkRunner* pRunner);
 };
 
 
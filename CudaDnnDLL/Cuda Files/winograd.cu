@@ -0,0 +1,426 @@
+//=============================================================================
+//	FILE:	winograd.cu
+//
+//	DESC:	This file implements the Winograd convolution engine, which runs
+//			the 3x3 stride 1 convolutions on the host.
+//=============================================================================
+
+#include "util.h"
+#include "winograd.h"
+#include "hostblas.h"
+
+//=============================================================================
+//	Local Data
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	The transforms of F(2x2,3x3) and F(4x4,3x3) as given by Lavin and Gray,
+//	'Fast Algorithms for Convolutional Neural Networks', Y = At[(G g Gt) *
+//	(Bt d B)]A for the 3x3 filter g and the (m+2)x(m+2) input tile d.
+//-----------------------------------------------------------------------------
+static const double s_rgBt2[4 * 4] =
+{
+	1,  0, -1,  0,
+	0,  1,  1,  0,
+	0, -1,  1,  0,
+	0,  1,  0, -1
+};
+
+static const double s_rgG2[4 * 3] =
+{
+	1.0,  0.0, 0.0,
+	0.5,  0.5, 0.5,
+	0.5, -0.5, 0.5,
+	0.0,  0.0, 1.0
+};
+
+static const double s_rgAt2[2 * 4] =
+{
+	1, 1,  1,  0,
+	0, 1, -1, -1
+};
+
+static const double s_rgBt4[6 * 6] =
+{
+	4,  0, -5,  0, 1, 0,
+	0, -4, -4,  1, 1, 0,
+	0,  4, -4, -1, 1, 0,
+	0, -2, -1,  2, 1, 0,
+	0,  2, -1, -2, 1, 0,
+	0,  4,  0, -5, 0, 1
+};
+
+static const double s_rgG4[6 * 3] =
+{
+	 1.0 / 4.0,   0.0,         0.0,
+	-1.0 / 6.0,  -1.0 / 6.0,  -1.0 / 6.0,
+	-1.0 / 6.0,   1.0 / 6.0,  -1.0 / 6.0,
+	 1.0 / 24.0,  1.0 / 12.0,  1.0 / 6.0,
+	 1.0 / 24.0, -1.0 / 12.0,  1.0 / 6.0,
+	 0.0,         0.0,         1.0
+};
+
+static const double s_rgAt4[4 * 6] =
+{
+	1, 1,  1, 1,  1, 0,
+	0, 1, -1, 2, -2, 0,
+	0, 1,  1, 4,  4, 0,
+	0, 1, -1, 8, -8, 1
+};
+
+
+//=============================================================================
+//	Local Functions
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Calculates Out = L X Lt, where L is nRows x nCols and X is nCols x nCols.
+//-----------------------------------------------------------------------------
+template <class T>
+static void sandwich(const double* pL, int nRows, int nCols, const T* pX, T* pOut)
+{
+	T rgTmp[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+
+	for (int i = 0; i < nRows; i++)
+	{
+		for (int j = 0; j < nCols; j++)
+		{
+			T fSum = 0;
+
+			for (int k = 0; k < nCols; k++)
+			{
+				if (pL[i * nCols + k] != 0)
+					fSum += (T)pL[i * nCols + k] * pX[k * nCols + j];
+			}
+
+			rgTmp[i * nCols + j] = fSum;
+		}
+	}
+
+	for (int i = 0; i < nRows; i++)
+	{
+		for (int j = 0; j < nRows; j++)
+		{
+			T fSum = 0;
+
+			for (int k = 0; k < nCols; k++)
+			{
+				if (pL[j * nCols + k] != 0)
+					fSum += rgTmp[i * nCols + k] * (T)pL[j * nCols + k];
+			}
+
+			pOut[i * nRows + j] = fSum;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Calculates Out = G g Gt for the 3x3 filter g.
+//-----------------------------------------------------------------------------
+template <class T>
+static void filterTransform(const double* pG, int nAlpha, const T* g, T* pOut)
+{
+	T rgTmp[WINOGRAD_MAX_ALPHA * 3];
+
+	for (int i = 0; i < nAlpha; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			rgTmp[i * 3 + j] = (T)pG[i * 3 + 0] * g[0 * 3 + j] + (T)pG[i * 3 + 1] * g[1 * 3 + j] + (T)pG[i * 3 + 2] * g[2 * 3 + j];
+		}
+	}
+
+	for (int i = 0; i < nAlpha; i++)
+	{
+		for (int j = 0; j < nAlpha; j++)
+		{
+			pOut[i * nAlpha + j] = rgTmp[i * 3 + 0] * (T)pG[j * 3 + 0] + rgTmp[i * 3 + 1] * (T)pG[j * 3 + 1] + rgTmp[i * 3 + 2] * (T)pG[j * 3 + 2];
+		}
+	}
+}
+
+
+//=============================================================================
+//	Winograd Methods
+//=============================================================================
+
+template <class T>
+int Winograd<T>::GetTile()
+{
+	static int s_nTile = 0;
+
+	if (s_nTile == 0)
+	{
+		int nTile = WINOGRAD_TILE_4;
+		char szValue[32];
+
+		DWORD dwLen = GetEnvironmentVariableA(WINOGRAD_ENV_TILE, szValue, 31);
+		if (dwLen > 0 && dwLen < 31 && atoi(szValue) == WINOGRAD_TILE_2)
+			nTile = WINOGRAD_TILE_2;
+
+		s_nTile = nTile;
+	}
+
+	return s_nTile;
+}
+
+template int Winograd<double>::GetTile();
+template int Winograd<float>::GetTile();
+
+
+//-----------------------------------------------------------------------------
+//	Transforms the K x C x 3 x 3 filter w into U[xi][k][c], or when bBackward
+//	is set, the flipped filter of the transposed convolution into U[xi][c][k].
+//-----------------------------------------------------------------------------
+template <class T>
+long Winograd<T>::TransformFilter(int nTile, int nK, int nC, const T* w, bool bBackward, std::vector<T>& rgU)
+{
+	if (nTile != WINOGRAD_TILE_2 && nTile != WINOGRAD_TILE_4)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	const double* pG = (nTile == WINOGRAD_TILE_2) ? s_rgG2 : s_rgG4;
+	int nAlpha = nTile + 2;
+	int nXi = nAlpha * nAlpha;
+	size_t lKC = (size_t)nK * nC;
+	T rgG[9];
+	T rgTU[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+
+	rgU.resize(nXi * lKC);
+
+	for (int k = 0; k < nK; k++)
+	{
+		for (int c = 0; c < nC; c++)
+		{
+			const T* g = w + ((size_t)k * nC + c) * 9;
+			size_t lIdx = (bBackward) ? (size_t)c * nK + k : (size_t)k * nC + c;
+
+			if (bBackward)
+			{
+				for (int i = 0; i < 9; i++)
+				{
+					rgG[i] = g[8 - i];
+				}
+
+				g = rgG;
+			}
+
+			filterTransform(pG, nAlpha, g, rgTU);
+
+			for (int xi = 0; xi < nXi; xi++)
+			{
+				rgU[xi * lKC + lIdx] = rgTU[xi];
+			}
+		}
+	}
+
+	return 0;
+}
+
+template long Winograd<double>::TransformFilter(int nTile, int nK, int nC, const double* w, bool bBackward, std::vector<double>& rgU);
+template long Winograd<float>::TransformFilter(int nTile, int nK, int nC, const float* w, bool bBackward, std::vector<float>& rgU);
+
+
+//-----------------------------------------------------------------------------
+//	Returns the cached transform of the filter, or NULL when the filter has
+//	not been transformed at the version given.
+//-----------------------------------------------------------------------------
+template <class T>
+const T* Winograd<T>::FindFilter(const WINOGRAD_KEY& key, LONGLONG llVersion)
+{
+	typename std::map<WINOGRAD_KEY, Filter>::iterator it = m_rgFilters.find(key);
+
+	if (it == m_rgFilters.end() || it->second.m_llVersion != llVersion)
+		return NULL;
+
+	return it->second.m_rgU.data();
+}
+
+template const double* Winograd<double>::FindFilter(const WINOGRAD_KEY& key, LONGLONG llVersion);
+template const float* Winograd<float>::FindFilter(const WINOGRAD_KEY& key, LONGLONG llVersion);
+
+
+//-----------------------------------------------------------------------------
+//	Transforms the filter and caches it at the version given, replacing any
+//	older transform of the same filter.
+//-----------------------------------------------------------------------------
+template <class T>
+const T* Winograd<T>::AddFilter(const WINOGRAD_KEY& key, LONGLONG llVersion, const T* w)
+{
+	if (m_rgFilters.size() >= WINOGRAD_MAX_FILTERS && m_rgFilters.find(key) == m_rgFilters.end())
+		m_rgFilters.clear();
+
+	Filter& filter = m_rgFilters[key];
+
+	if (TransformFilter(key.nTile, key.nK, key.nC, w, (key.nBackward != 0), filter.m_rgU))
+	{
+		m_rgFilters.erase(key);
+		return NULL;
+	}
+
+	filter.m_llVersion = llVersion;
+
+	return filter.m_rgU.data();
+}
+
+template const double* Winograd<double>::AddFilter(const WINOGRAD_KEY& key, LONGLONG llVersion, const double* w);
+template const float* Winograd<float>::AddFilter(const WINOGRAD_KEY& key, LONGLONG llVersion, const float* w);
+
+
+template <class T>
+void Winograd<T>::ClearFilters()
+{
+	m_rgFilters.clear();
+	m_rgV.clear();
+	m_rgV.shrink_to_fit();
+	m_rgM.clear();
+	m_rgM.shrink_to_fit();
+}
+
+template void Winograd<double>::ClearFilters();
+template void Winograd<float>::ClearFilters();
+
+
+//-----------------------------------------------------------------------------
+//	Calculates y = alpha * conv(x, w) + beta * y for the N x C x H x W input
+//	x, the N x K x TopH x TopW output y and the transformed filter u of the
+//	K x C x 3 x 3 filter w.  The padding may be negative, which crops x.
+//-----------------------------------------------------------------------------
+template <class T>
+long Winograd<T>::Forward(int nTile, int nN, int nC, int nH, int nW, int nK, int nPadH, int nPadW, int nTopH, int nTopW, T fAlpha, const T* x, const T* u, T fBeta, T* y)
+{
+	LONG lErr;
+
+	if (nTile != WINOGRAD_TILE_2 && nTile != WINOGRAD_TILE_4)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (nN <= 0 || nC <= 0 || nK <= 0 || nTopH <= 0 || nTopW <= 0)
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	const double* pBt = (nTile == WINOGRAD_TILE_2) ? s_rgBt2 : s_rgBt4;
+	const double* pAt = (nTile == WINOGRAD_TILE_2) ? s_rgAt2 : s_rgAt4;
+	int nAlpha = nTile + 2;
+	int nXi = nAlpha * nAlpha;
+	int nTilesH = (nTopH + nTile - 1) / nTile;
+	int nTilesW = (nTopW + nTile - 1) / nTile;
+	int nTilesPerImg = nTilesH * nTilesW;
+	int nImgPerGemm = WINOGRAD_MAX_TILES_PER_GEMM / nTilesPerImg;
+
+	if (nImgPerGemm < 1)
+		nImgPerGemm = 1;
+
+	if (nImgPerGemm > nN)
+		nImgPerGemm = nN;
+
+	size_t lP = (size_t)nImgPerGemm * nTilesPerImg;
+	size_t lXSize = (size_t)nC * nH * nW;
+	size_t lYSize = (size_t)nK * nTopH * nTopW;
+
+	m_rgV.resize(nXi * nC * lP);
+	m_rgM.resize(nXi * nK * lP);
+
+	T rgD[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+	T rgTD[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+	T rgY[WINOGRAD_MAX_TILE * WINOGRAD_MAX_TILE];
+
+	for (int n0 = 0; n0 < nN; n0 += nImgPerGemm)
+	{
+		int nImg = (nN - n0 < nImgPerGemm) ? nN - n0 : nImgPerGemm;
+		int nP = nImg * nTilesPerImg;
+
+		// Input transform, V[xi][c][p] = (Bt d B)[xi] for each tile p.
+		for (int n = 0; n < nImg; n++)
+		{
+			for (int c = 0; c < nC; c++)
+			{
+				const T* pX = x + (n0 + n) * lXSize + (size_t)c * nH * nW;
+
+				for (int th = 0; th < nTilesH; th++)
+				{
+					for (int tw = 0; tw < nTilesW; tw++)
+					{
+						int nY0 = th * nTile - nPadH;
+						int nX0 = tw * nTile - nPadW;
+
+						for (int i = 0; i < nAlpha; i++)
+						{
+							int nY = nY0 + i;
+
+							for (int j = 0; j < nAlpha; j++)
+							{
+								int nX = nX0 + j;
+								rgD[i * nAlpha + j] = (nY >= 0 && nY < nH && nX >= 0 && nX < nW) ? pX[nY * nW + nX] : (T)0;
+							}
+						}
+
+						sandwich(pBt, nAlpha, nAlpha, rgD, rgTD);
+
+						size_t lIdx = (size_t)c * lP + (size_t)n * nTilesPerImg + th * nTilesW + tw;
+
+						for (int xi = 0; xi < nXi; xi++)
+						{
+							m_rgV[xi * nC * lP + lIdx] = rgTD[xi];
+						}
+					}
+				}
+			}
+		}
+
+		// M[xi] = U[xi] V[xi], K x P for each transform element, given to the
+		// column major gemm2 as the transposes.
+		for (int xi = 0; xi < nXi; xi++)
+		{
+			const T* pU = u + (size_t)xi * nK * nC;
+			const T* pV = m_rgV.data() + xi * nC * lP;
+			T* pM = m_rgM.data() + xi * nK * lP;
+
+			if (lErr = HostBlas<T>::gemm2(false, false, nP, nK, nC, (T)1, pV, (int)lP, pU, nC, (T)0, pM, (int)lP))
+				return lErr;
+		}
+
+		// Output transform, y = alpha (At m A) + beta y over the valid region.
+		for (int n = 0; n < nImg; n++)
+		{
+			for (int k = 0; k < nK; k++)
+			{
+				T* pY = y + (n0 + n) * lYSize + (size_t)k * nTopH * nTopW;
+
+				for (int th = 0; th < nTilesH; th++)
+				{
+					for (int tw = 0; tw < nTilesW; tw++)
+					{
+						size_t lIdx = (size_t)k * lP + (size_t)n * nTilesPerImg + th * nTilesW + tw;
+
+						for (int xi = 0; xi < nXi; xi++)
+						{
+							rgD[xi] = m_rgM[xi * nK * lP + lIdx];
+						}
+
+						sandwich(pAt, nTile, nAlpha, rgD, rgY);
+
+						for (int i = 0; i < nTile && th * nTile + i < nTopH; i++)
+						{
+							T* pRow = pY + (th * nTile + i) * nTopW + tw * nTile;
+
+							for (int j = 0; j < nTile && tw * nTile + j < nTopW; j++)
+							{
+								T fVal = fAlpha * rgY[i * nTile + j];
+
+								if (fBeta != 0)
+									fVal += fBeta * pRow[j];
+
+								pRow[j] = fVal;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+template long Winograd<double>::Forward(int nTile, int nN, int nC, int nH, int nW, int nK, int nPadH, int nPadW, int nTopH, int nTopW, double fAlpha, const double* x, const double* u, double fBeta, double* y);
+template long Winograd<float>::Forward(int nTile, int nN, int nC, int nH, int nW, int nK, int nPadH, int nPadW, int nTopH, int nTopW, float fAlpha, const float* x, const float* u, float fBeta, float* y);
+
+// end
\ No newline at end of file
@@ -0,0 +1,117 @@
+//=============================================================================
+//	FILE:	winograd.h
+//
+//	DESC:	This file manages the Winograd convolution engine, which runs the
+//			3x3 stride 1 convolutions on the host.
+//=============================================================================
+#ifndef __WINOGRAD_CU__
+#define __WINOGRAD_CU__
+
+#include "util.h"
+#include <vector>
+#include <map>
+
+//=============================================================================
+//	Flags
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	The algorithm passed in place of the cuDNN forward or backward data
+//	algorithm to run the convolution with the host Winograd engine.
+//-----------------------------------------------------------------------------
+const int CONV_ALGO_HOST_WINOGRAD = 100;
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+const int WINOGRAD_TILE_2 = 2;		// F(2x2,3x3), 4x4 transform tiles.
+const int WINOGRAD_TILE_4 = 4;		// F(4x4,3x3), 6x6 transform tiles.
+const int WINOGRAD_MAX_TILE = 4;
+const int WINOGRAD_MAX_ALPHA = WINOGRAD_MAX_TILE + 2;
+const int WINOGRAD_MAX_TILES_PER_GEMM = 4096;
+const int WINOGRAD_MAX_FILTERS = 256;
+
+const LPCSTR WINOGRAD_ENV_TILE = "MYCAFFE_WINOGRAD_TILE";
+
+//=============================================================================
+//	Types
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Identifies a transformed filter, the key is compared as raw memory so it
+//	must be cleared before it is filled.
+//-----------------------------------------------------------------------------
+typedef struct WINOGRAD_KEY
+{
+	long hWeight;
+	int nWeightOffset;
+	int nTile;
+	int nBackward;
+	int nK;
+	int nC;
+} WINOGRAD_KEY;
+
+inline bool operator<(const WINOGRAD_KEY& a, const WINOGRAD_KEY& b)
+{
+	return memcmp(&a, &b, sizeof(WINOGRAD_KEY)) < 0;
+}
+
+//=============================================================================
+//	Classes
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+//	Winograd Class
+//
+//	Runs the 3x3 stride 1 convolutions of packed NCHW tensors on the host
+//	with the F(2x2,3x3) or F(4x4,3x3) minimal filtering algorithms.  The
+//	input tiles of a group of images are transformed into V[xi][c][tile],
+//	multiplied by the transformed filter U[xi][k][c] with one host gemm per
+//	transform element xi, and the products are transformed back into the
+//	output tiles.  The backward data pass is the forward pass of the top
+//	diff with the flipped and transposed filter.
+//
+//	The transformed filters are cached per weight handle along with the
+//	version of the handle they were made at, which writes through the memory
+//	pointers into the handle bump too, so that they are only made again once
+//	the weights may have changed.
+//
+//	The tile defaults to 4 and may be set to 2 with MYCAFFE_WINOGRAD_TILE,
+//	the smaller tile is more accurate but does more arithmetic.
+//-----------------------------------------------------------------------------
+template <class T>
+class Winograd
+{
+	class Filter
+	{
+	public:
+		LONGLONG m_llVersion;
+		std::vector<T> m_rgU;
+	};
+
+	std::map<WINOGRAD_KEY, Filter> m_rgFilters;
+	std::vector<T> m_rgV;
+	std::vector<T> m_rgM;
+
+public:
+	Winograd()
+	{
+	}
+
+	~Winograd()
+	{
+	}
+
+	static int GetTile();
+
+	static long TransformFilter(int nTile, int nK, int nC, const T* w, bool bBackward, std::vector<T>& rgU);
+
+	const T* FindFilter(const WINOGRAD_KEY& key, LONGLONG llVersion);
+	const T* AddFilter(const WINOGRAD_KEY& key, LONGLONG llVersion, const T* w);
+	void ClearFilters();
+
+	long Forward(int nTile, int nN, int nC, int nH, int nW, int nK, int nPadH, int nPadW, int nTopH, int nTopW, T fAlpha, const T* x, const T* u, T fBeta, T* y);
+};
+
+#endif
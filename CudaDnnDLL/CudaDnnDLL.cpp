@@ -3,6 +3,7 @@
 
 #include "stdafx.h"
 #include "Cuda Files\main.h"
+#include "Cuda Files\recorder.h"
 
 
 //=============================================================================
@@ -11,6 +12,7 @@
 
 const LONG MAX_BUFFER = 1024;
 const LONG MAX_ERROR = 1024;
+const LONG PIPELINE_CHUNK_BYTES = 4 * 1024 * 1024;
 
 
 //=============================================================================
@@ -46,8 +48,17 @@ LONG copyMemKernelToKernel(Kernel<float>* pKernel, LONG lInput, float* pInput);
 LONG addKernelToKernel(Kernel<double>* pKernel, LONG lInput, double* pInput);
 LONG copyMemKernelToKernel(Kernel<double>* pKernel, LONG lInput, double* pInput);
 
+template <class T>
+LONG copyStaged(T* dst, T* src, int nCount, HostBuffer<T>* pHost, cudaStream_t stream, bool bSync);
+
+template <class T>
+LONG copyStagedPipelined(T* dst, int nDstDeviceID, T* src, int nSrcDeviceID, int nCount, HostBuffer<T>* pHost, cudaStream_t stream, bool bSync);
+
 void getError(long lErr, LPTSTR szErr, LONG lszErrMax);
 
+LONG invokeFloat(LONG lKernelIdx, LONG lFunctionIdx, float* pInput, LONG lInput, float** ppOutput, LONG* plOutput, LPTSTR szErr, LONG lszErrMax);
+LONG invokeDouble(LONG lKernelIdx, LONG lFunctionIdx, double* pInput, LONG lInput, double** ppOutput, LONG* plOutput, LPTSTR szErr, LONG lszErrMax);
+
 
 //=============================================================================
 //	Main DLL Function
@@ -58,6 +69,38 @@ extern "C" LONG WINAPI DLL_InvokeFloat(LONG lKernelIdx,
 		   							   float* pInput, LONG lInput,
 							           float** ppOutput, LONG* plOutput,
 								       LPTSTR szErr, LONG lszErrMax)
+{
+	if (!g_recorder.IsEnabled())
+		return invokeFloat(lKernelIdx, lFunctionIdx, pInput, lInput, ppOutput, plOutput, szErr, lszErrMax);
+
+	LONGLONG llBegin = CallRecorder::Now();
+	LONG lErr = invokeFloat(lKernelIdx, lFunctionIdx, pInput, lInput, ppOutput, plOutput, szErr, lszErrMax);
+	g_recorder.Record(lKernelIdx, lFunctionIdx, pInput, lInput, ppOutput, plOutput, lErr, llBegin, CallRecorder::Now());
+
+	return lErr;
+}
+
+extern "C" LONG WINAPI DLL_InvokeDouble(LONG lKernelIdx,
+										LONG lFunctionIdx,
+		   							    double* pInput, LONG lInput,
+							            double** ppOutput, LONG* plOutput,
+								        LPTSTR szErr, LONG lszErrMax)
+{
+	if (!g_recorder.IsEnabled())
+		return invokeDouble(lKernelIdx, lFunctionIdx, pInput, lInput, ppOutput, plOutput, szErr, lszErrMax);
+
+	LONGLONG llBegin = CallRecorder::Now();
+	LONG lErr = invokeDouble(lKernelIdx, lFunctionIdx, pInput, lInput, ppOutput, plOutput, szErr, lszErrMax);
+	g_recorder.Record(lKernelIdx, lFunctionIdx, pInput, lInput, ppOutput, plOutput, lErr, llBegin, CallRecorder::Now());
+
+	return lErr;
+}
+
+LONG invokeFloat(LONG lKernelIdx,
+				 LONG lFunctionIdx,
+				 float* pInput, LONG lInput,
+				 float** ppOutput, LONG* plOutput,
+				 LPTSTR szErr, LONG lszErrMax)
 {
 	Kernel<float>* pKernel = NULL;
 	LONG lErr = 0;
@@ -221,11 +264,11 @@ extern "C" LONG WINAPI DLL_InvokeFloat(LONG lKernelIdx,
 	return lErr;
 }
 
-extern "C" LONG WINAPI DLL_InvokeDouble(LONG lKernelIdx,
-										LONG lFunctionIdx,
-		   							    double* pInput, LONG lInput,
-							            double** ppOutput, LONG* plOutput,
-								        LPTSTR szErr, LONG lszErrMax)
+LONG invokeDouble(LONG lKernelIdx,
+				  LONG lFunctionIdx,
+				  double* pInput, LONG lInput,
+				  double** ppOutput, LONG* plOutput,
+				  LPTSTR szErr, LONG lszErrMax)
 {
 	Kernel<double>* pKernel = NULL;
 	LONG lErr = 0;
@@ -632,17 +675,12 @@ LONG copyMemKernelToKernel(Kernel<float>* pSrcKernel, LONG lInput, float* pInput
 					return ERROR_PARAM_NULL;
 			}
 
-			float* pHost = pHostKernel->GetHostBuffer(hHost)->Data();
-
-			if (lErr = cudaMemcpy(pHost, src, nSize, cudaMemcpyDeviceToHost))
-				return lErr;
+			HostBuffer<float>* pHost = pHostKernel->GetHostBuffer(hHost);
+			if (pHost == NULL)
+				return ERROR_PARAM_NULL;
 
-			if (hStream < 0)
-				lErr = cudaMemcpy(dst, pHost, nSize, cudaMemcpyHostToDevice);
-			else if (hStream == 0)
-				lErr = cudaMemcpyAsync(dst, pHost, nSize, cudaMemcpyHostToDevice, cudaStreamDefault);
-			else
-				lErr = cudaMemcpyAsync(dst, pHost, nSize, cudaMemcpyHostToDevice, pSrcKernel->GetStream(hStream));
+			cudaStream_t stream = (hStream > 0) ? pSrcKernel->GetStream(hStream) : cudaStreamDefault;
+			lErr = copyStagedPipelined(dst, nDstDeviceID, src, nSrcDeviceID, nCount, pHost, stream, (hStream < 0) ? true : false);
 		}
 	}
 
@@ -807,17 +845,12 @@ LONG copyMemKernelToKernel(Kernel<double>* pSrcKernel, LONG lInput, double* pInp
 					return ERROR_PARAM_NULL;
 			}
 
-			double* pHost = pHostKernel->GetHostBuffer(hHost)->Data();
-
-			if (lErr = cudaMemcpy(pHost, src, nSize, cudaMemcpyDeviceToHost))
-				return lErr;
+			HostBuffer<double>* pHost = pHostKernel->GetHostBuffer(hHost);
+			if (pHost == NULL)
+				return ERROR_PARAM_NULL;
 
-			if (hStream < 0)
-				lErr = cudaMemcpy(dst, pHost, nSize, cudaMemcpyHostToDevice);
-			else if (hStream == 0)
-				lErr = cudaMemcpyAsync(dst, pHost, nSize, cudaMemcpyHostToDevice, cudaStreamDefault);
-			else
-				lErr = cudaMemcpyAsync(dst, pHost, nSize, cudaMemcpyHostToDevice, pSrcKernel->GetStream(hStream));
+			cudaStream_t stream = (hStream > 0) ? pSrcKernel->GetStream(hStream) : cudaStreamDefault;
+			lErr = copyStagedPipelined(dst, nDstDeviceID, src, nSrcDeviceID, nCount, pHost, stream, (hStream < 0) ? true : false);
 		}
 	}
 
@@ -915,5 +948,115 @@ LONG getKernelFloatIndex(LONG* plIdx)
 	return 0;
 }
 
+//-----------------------------------------------------------------------------
+//	Copy memory between two devices through the pinned host buffer in one
+//	piece, so the host buffer must hold all nCount items.
+//-----------------------------------------------------------------------------
+template <class T>
+LONG copyStaged(T* dst, T* src, int nCount, HostBuffer<T>* pHost, cudaStream_t stream, bool bSync)
+{
+	LONG lErr;
+	size_t nSize = (size_t)nCount * sizeof(T);
+
+	if (nCount > pHost->Count())
+		return ERROR_PARAM_OUT_OF_RANGE;
+
+	if (lErr = cudaMemcpy(pHost->Data(), src, nSize, cudaMemcpyDeviceToHost))
+		return lErr;
+
+	if (bSync)
+		return cudaMemcpy(dst, pHost->Data(), nSize, cudaMemcpyHostToDevice);
+
+	return cudaMemcpyAsync(dst, pHost->Data(), nSize, cudaMemcpyHostToDevice, stream);
+}
+
+//-----------------------------------------------------------------------------
+//	Copy memory between two devices that cannot access one another by
+//	staging it through the pinned host buffer.  The copy is split into
+//	chunks that alternate between two staging slots, so the device to host
+//	copy of chunk i+1 (on the source stream) overlaps the host to device
+//	copy of chunk i (on a stream of the destination device).  The host
+//	buffer only needs room for two chunks, and one too small for two slots
+//	of an item each is copied in one piece by copyStaged.  The stream and
+//	events are kept with the host buffer for the device pair.
+//
+//	Once queued, work on the source stream and on the default stream of the
+//	destination device waits for the last upload, so either may read dst.
+//-----------------------------------------------------------------------------
+template <class T>
+LONG copyStagedPipelined(T* dst, int nDstDeviceID, T* src, int nSrcDeviceID, int nCount, HostBuffer<T>* pHost, cudaStream_t stream, bool bSync)
+{
+	LONG lErr;
+	long lChunk = PIPELINE_CHUNK_BYTES / sizeof(T);
+
+	if (lChunk * 2 > pHost->Count())
+		lChunk = pHost->Count() / 2;
+
+	if (lChunk <= 0)
+		return copyStaged(dst, src, nCount, pHost, stream, bSync);
+
+	int nCurrentDeviceID = -1;
+	if (lErr = cudaGetDevice(&nCurrentDeviceID))
+		return lErr;
+
+	HostStaging* pStaging = NULL;
+	int nLastSlot = 0;
+
+	lErr = pHost->GetStaging(nSrcDeviceID, nDstDeviceID, &pStaging);
+
+	for (long lOffset = 0, i = 0; !lErr && lOffset < nCount; lOffset += lChunk, i++)
+	{
+		int nSlot = (int)(i % 2);
+		long lItems = min(lChunk, nCount - lOffset);
+		T* pStage = pHost->Data() + nSlot * lChunk;
+
+		// Wait for the previous user of the slot, which may be an earlier
+		// copy, to finish its upload before staging the next chunk into it.
+		if (lErr = cudaSetDevice(nSrcDeviceID))
+			break;
+
+		if (lErr = cudaStreamWaitEvent(stream, pStaging->rgevtFree[nSlot], 0))
+			break;
+
+		if (lErr = cudaMemcpyAsync(pStage, src + lOffset, lItems * sizeof(T), cudaMemcpyDeviceToHost, stream))
+			break;
+
+		if (lErr = cudaEventRecord(pStaging->rgevtStaged[nSlot], stream))
+			break;
+
+		if (lErr = cudaSetDevice(nDstDeviceID))
+			break;
+
+		if (lErr = cudaStreamWaitEvent(pStaging->streamDst, pStaging->rgevtStaged[nSlot], 0))
+			break;
+
+		if (lErr = cudaMemcpyAsync(dst + lOffset, pStage, lItems * sizeof(T), cudaMemcpyHostToDevice, pStaging->streamDst))
+			break;
+
+		if (lErr = cudaEventRecord(pStaging->rgevtFree[nSlot], pStaging->streamDst))
+			break;
+
+		nLastSlot = nSlot;
+	}
+
+	// The uploads run on a non-blocking stream, so the default stream of the
+	// destination device must wait for them explicitly.
+	if (!lErr && nCount > 0)
+	{
+		if (!(lErr = cudaStreamWaitEvent(cudaStreamDefault, pStaging->rgevtFree[nLastSlot], 0)))
+		{
+			if (!(lErr = cudaSetDevice(nSrcDeviceID)))
+				lErr = cudaStreamWaitEvent(stream, pStaging->rgevtFree[nLastSlot], 0);
+		}
+	}
+
+	if (!lErr && bSync)
+		lErr = cudaStreamSynchronize(pStaging->streamDst);
+
+	cudaSetDevice(nCurrentDeviceID);
+
+	return lErr;
+}
+
 //end CudaDLL.cpp
 
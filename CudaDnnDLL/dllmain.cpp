@@ -1,6 +1,7 @@
 // dllmain.cpp : Defines the entry point for the DLL application.
 #include "stdafx.h"
 #include "Cuda Files\main.h"
+#include "Cuda Files\recorder.h"
 
 const int MAX_KERNELS = 2048;
 
@@ -32,6 +33,7 @@ BOOL APIENTRY DllMain( HMODULE hModule, DWORD  ul_reason_for_call, LPVOID lpRese
 			break;
 
 		case DLL_PROCESS_DETACH:
+			g_recorder.Close();
 			freeKernelTables();
 			g_hModule = NULL;
 			break;
@@ -0,0 +1,434 @@
+// CudaDnnReplay.cpp : Replays a call log recorded by the CudaDnnDll against
+// a fresh set of kernels and reports the per call and total timings.
+//
+//	Usage: CudaDnnReplay <log file> [-dll <path>] [-repeat <n>] [-calls]
+//
+//	Record a log by setting MYCAFFE_CALL_LOG=<log file> (and optionally
+//	MYCAFFE_CALL_LOG_PAYLOADS=1) before the process that loads the CudaDnnDll
+//	starts.  The calls are re-issued in the order they completed through the
+//	same DLL_InvokeFloat/DLL_InvokeDouble exports, so the replay measures the
+//	native layer without the managed stack.
+//
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "..\CudaDnnDLL\Cuda Files\recorder.h"
+
+
+//=============================================================================
+//	Defines
+//=============================================================================
+
+// These must match the values in CudaDnnDLL\Cuda Files\main.h
+const LONG CUDA_DLL_FREEMEM				= -1;
+const LONG CUDA_DLL_INITIALIZE			= -2;
+const LONG CUDA_DLL_CLEANUP				= -3;
+const LONG CUDA_DLL_KERNEL_MEMCPY		= -4;
+const LONG CUDA_DLL_KERNEL_ADD			= -5;
+const LONG CUDA_DLL_KERNEL_COPY_NCCL	= -10;
+const LONG CUDA_FN_GETHOSTMEM			= 27;
+
+const LONG MAX_ERROR = 1024;
+const LONG MAX_OUTPUT = 64;
+const LPCSTR DEFAULT_DLL = "CudaDnnDll.9.dll";
+
+typedef LONG (WINAPI *LPFNINVOKEFLOAT)(LONG, LONG, float*, LONG, float**, LONG*, LPTSTR, LONG);
+typedef LONG (WINAPI *LPFNINVOKEDOUBLE)(LONG, LONG, double*, LONG, double**, LONG*, LPTSTR, LONG);
+
+
+//=============================================================================
+//	Types
+//=============================================================================
+
+typedef struct CALL
+{
+	CALLLOG_RECORD rec;
+	size_t szOffset;		// offset of the stored inputs in the data buffer.
+} CALL;
+
+typedef struct FUNCTION_STATS
+{
+	LONGLONG llCalls;
+	LONGLONG llRecordedTicks;
+	LONGLONG llReplayedTicks;
+	LONGLONG llErrors;
+} FUNCTION_STATS;
+
+typedef struct REPLAY_STATS
+{
+	LONGLONG llCalls;
+	LONGLONG llRecordedTicks;
+	LONGLONG llReplayedTicks;
+	LONGLONG llErrorMismatches;
+	LONGLONG llHandleMismatches;
+	LONGLONG llTruncated;
+	std::map<std::pair<int, LONG>, FUNCTION_STATS> rgFunctions;
+} REPLAY_STATS;
+
+
+//=============================================================================
+//	Local Function Prototypes
+//=============================================================================
+
+bool loadLog(LPCSTR pszFile, CALLLOG_HEADER* pHdr, std::vector<CALL>& rgCalls, std::vector<BYTE>& rgData);
+
+template <class T, class FN>
+LONG replayCall(FN pfn, CALL* pCall, BYTE* pData, std::map<LONG, LONG>& rgKernels, REPLAY_STATS* pStats, LONGLONG* pllTicks);
+
+template <class T, class FN>
+void cleanupKernels(FN pfn, std::map<LONG, LONG>& rgKernels);
+
+void report(REPLAY_STATS* pStats, LONGLONG llFreq, int nRepeat);
+
+
+//=============================================================================
+//	Main Function
+//=============================================================================
+
+int main(int argc, char* argv[])
+{
+	LPCSTR pszLog = NULL;
+	LPCSTR pszDll = DEFAULT_DLL;
+	int nRepeat = 1;
+	bool bShowCalls = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (_stricmp(argv[i], "-dll") == 0 && i + 1 < argc)
+			pszDll = argv[++i];
+		else if (_stricmp(argv[i], "-repeat") == 0 && i + 1 < argc)
+			nRepeat = atoi(argv[++i]);
+		else if (_stricmp(argv[i], "-calls") == 0)
+			bShowCalls = true;
+		else if (pszLog == NULL)
+			pszLog = argv[i];
+	}
+
+	if (pszLog == NULL || nRepeat < 1)
+	{
+		printf("Usage: CudaDnnReplay <log file> [-dll <path>] [-repeat <n>] [-calls]\n");
+		return 1;
+	}
+
+	// The recorder is started by the DLL when it loads, never record the replay itself.
+	SetEnvironmentVariableA(CALLLOG_ENV_FILE, NULL);
+
+	CALLLOG_HEADER hdr;
+	std::vector<CALL> rgCalls;
+	std::vector<BYTE> rgData;
+
+	if (!loadLog(pszLog, &hdr, rgCalls, rgData))
+		return 2;
+
+	printf("Loaded %u calls from '%s' (payloads %s).\n", (unsigned)rgCalls.size(), pszLog, (hdr.dwFlags & CALLLOG_FLAG_PAYLOADS) ? "stored" : "not stored");
+
+	HMODULE hDll = LoadLibraryA(pszDll);
+	if (hDll == NULL)
+	{
+		printf("ERROR: Could not load '%s' (error %u).\n", pszDll, GetLastError());
+		return 3;
+	}
+
+	LPFNINVOKEFLOAT pfnFloat = (LPFNINVOKEFLOAT)GetProcAddress(hDll, "DLL_InvokeFloat");
+	LPFNINVOKEDOUBLE pfnDouble = (LPFNINVOKEDOUBLE)GetProcAddress(hDll, "DLL_InvokeDouble");
+
+	if (pfnFloat == NULL || pfnDouble == NULL)
+	{
+		printf("ERROR: '%s' does not export the invoke functions.\n", pszDll);
+		FreeLibrary(hDll);
+		return 3;
+	}
+
+	LARGE_INTEGER liFreq;
+	QueryPerformanceFrequency(&liFreq);
+
+	REPLAY_STATS stats;
+	stats.llCalls = 0;
+	stats.llRecordedTicks = 0;
+	stats.llReplayedTicks = 0;
+	stats.llErrorMismatches = 0;
+	stats.llHandleMismatches = 0;
+	stats.llTruncated = 0;
+
+	for (int nPass = 0; nPass < nRepeat; nPass++)
+	{
+		// Each pass starts with fresh kernels, the recorded kernel indexes
+		// are mapped to the ones created by the replay.
+		std::map<LONG, LONG> rgFloatKernels;
+		std::map<LONG, LONG> rgDoubleKernels;
+
+		for (size_t i = 0; i < rgCalls.size(); i++)
+		{
+			CALL* pCall = &rgCalls[i];
+			BYTE* pData = (rgData.size() > 0) ? &rgData[pCall->szOffset] : NULL;
+			LONGLONG llTicks = 0;
+			LONG lErr;
+
+			if (pCall->rec.nType == CALLLOG_TYPE_DOUBLE)
+				lErr = replayCall<double>(pfnDouble, pCall, pData, rgDoubleKernels, &stats, &llTicks);
+			else
+				lErr = replayCall<float>(pfnFloat, pCall, pData, rgFloatKernels, &stats, &llTicks);
+
+			if (bShowCalls && nPass == 0)
+			{
+				printf("%8u %s k=%-4d fn=%-5d in=%-8d rec=%10.3lf us  replay=%10.3lf us  err=%d/%d\n",
+					(unsigned)i,
+					(pCall->rec.nType == CALLLOG_TYPE_DOUBLE) ? "dbl" : "flt",
+					pCall->rec.lKernelIdx,
+					pCall->rec.lFunctionIdx,
+					pCall->rec.lInput,
+					(double)(pCall->rec.llEnd - pCall->rec.llBegin) * 1000000.0 / (double)hdr.llFrequency,
+					(double)llTicks * 1000000.0 / (double)liFreq.QuadPart,
+					pCall->rec.lErr,
+					lErr);
+			}
+		}
+
+		cleanupKernels<double>(pfnDouble, rgDoubleKernels);
+		cleanupKernels<float>(pfnFloat, rgFloatKernels);
+	}
+
+	// Convert the recorded ticks when the log came from a machine with another counter frequency.
+	if (hdr.llFrequency != liFreq.QuadPart && hdr.llFrequency > 0)
+	{
+		double dfScale = (double)liFreq.QuadPart / (double)hdr.llFrequency;
+
+		stats.llRecordedTicks = (LONGLONG)(stats.llRecordedTicks * dfScale);
+
+		for (std::map<std::pair<int, LONG>, FUNCTION_STATS>::iterator it = stats.rgFunctions.begin(); it != stats.rgFunctions.end(); it++)
+		{
+			it->second.llRecordedTicks = (LONGLONG)(it->second.llRecordedTicks * dfScale);
+		}
+	}
+
+	report(&stats, liFreq.QuadPart, nRepeat);
+
+	FreeLibrary(hDll);
+
+	return (stats.llErrorMismatches > 0 || stats.llHandleMismatches > 0) ? 4 : 0;
+}
+
+
+//=============================================================================
+//	Local Functions
+//=============================================================================
+
+bool loadLog(LPCSTR pszFile, CALLLOG_HEADER* pHdr, std::vector<CALL>& rgCalls, std::vector<BYTE>& rgData)
+{
+	FILE* pFile = fopen(pszFile, "rb");
+	if (pFile == NULL)
+	{
+		printf("ERROR: Could not open '%s'.\n", pszFile);
+		return false;
+	}
+
+	if (fread(pHdr, sizeof(CALLLOG_HEADER), 1, pFile) != 1 ||
+		pHdr->dwMagic != CALLLOG_MAGIC ||
+		pHdr->dwVersion != CALLLOG_VERSION)
+	{
+		printf("ERROR: '%s' is not a version %u call log.\n", pszFile, CALLLOG_VERSION);
+		fclose(pFile);
+		return false;
+	}
+
+	CALL call;
+
+	while (fread(&call.rec, sizeof(CALLLOG_RECORD), 1, pFile) == 1)
+	{
+		size_t szItem = (call.rec.nType == CALLLOG_TYPE_DOUBLE) ? sizeof(double) : sizeof(float);
+		size_t szData = (size_t)call.rec.lInputStored * szItem;
+
+		if (call.rec.lInputStored < 0 || call.rec.lInputStored > call.rec.lInput)
+			break;
+
+		call.szOffset = rgData.size();
+
+		if (szData > 0)
+		{
+			rgData.resize(call.szOffset + szData);
+
+			// A log cut short by a killed process ends with a partial record.
+			if (fread(&rgData[call.szOffset], szData, 1, pFile) != 1)
+			{
+				rgData.resize(call.szOffset);
+				break;
+			}
+		}
+
+		rgCalls.push_back(call);
+	}
+
+	fclose(pFile);
+
+	return true;
+}
+
+static LONG mapKernel(std::map<LONG, LONG>& rgKernels, LONG lKernelIdx)
+{
+	std::map<LONG, LONG>::iterator it = rgKernels.find(lKernelIdx);
+
+	if (it == rgKernels.end())
+		return lKernelIdx;
+
+	return it->second;
+}
+
+template <class T, class FN>
+LONG replayCall(FN pfn, CALL* pCall, BYTE* pData, std::map<LONG, LONG>& rgKernels, REPLAY_STATS* pStats, LONGLONG* pllTicks)
+{
+	CALLLOG_RECORD* pRec = &pCall->rec;
+	TCHAR szErr[MAX_ERROR + 1];
+
+	// The recorded outputs were freed by the recorded session, the
+	// replay frees its own outputs after each call.
+	if (pRec->lFunctionIdx == CUDA_DLL_FREEMEM)
+		return 0;
+
+	std::vector<T> rgInput((pRec->lInput > 0) ? pRec->lInput : 1, (T)0);
+
+	if (pRec->lInputStored > 0)
+		memcpy(&rgInput[0], pData, pRec->lInputStored * sizeof(T));
+
+	if (pRec->nFlags & CALLLOG_REC_TRUNCATED)
+		pStats->llTruncated++;
+
+	switch (pRec->lFunctionIdx)
+	{
+		case CUDA_DLL_KERNEL_MEMCPY:
+			if (pRec->lInput == 9)
+			{
+				rgInput[3] = (T)mapKernel(rgKernels, (LONG)rgInput[3]);
+				rgInput[7] = (T)mapKernel(rgKernels, (LONG)rgInput[7]);
+			}
+			break;
+
+		case CUDA_DLL_KERNEL_ADD:
+			if (pRec->lInput == 5)
+				rgInput[2] = (T)mapKernel(rgKernels, (LONG)rgInput[2]);
+			break;
+
+		case CUDA_DLL_KERNEL_COPY_NCCL:
+			if (pRec->lInput == 2)
+				rgInput[0] = (T)mapKernel(rgKernels, (LONG)rgInput[0]);
+			break;
+	}
+
+	// Like the managed caller, small outputs are written to the caller's
+	// buffer and larger ones are returned in memory allocated by the DLL.
+	T rgOutput[MAX_OUTPUT];
+	T* pOutput = rgOutput;
+	LONG lOutput = MAX_OUTPUT;
+	LONG lKernelIdx = mapKernel(rgKernels, pRec->lKernelIdx);
+	LARGE_INTEGER liBegin;
+	LARGE_INTEGER liEnd;
+
+	szErr[0] = NULL;
+
+	QueryPerformanceCounter(&liBegin);
+	LONG lErr = pfn(lKernelIdx, pRec->lFunctionIdx, &rgInput[0], pRec->lInput, &pOutput, &lOutput, szErr, MAX_ERROR);
+	QueryPerformanceCounter(&liEnd);
+
+	*pllTicks = liEnd.QuadPart - liBegin.QuadPart;
+
+	if (lErr == 0 && pRec->lFunctionIdx == CUDA_DLL_INITIALIZE && lOutput > 0)
+		rgKernels[(LONG)pRec->dfOutput0] = (LONG)pOutput[0];
+
+	if (pRec->lFunctionIdx == CUDA_DLL_CLEANUP)
+		rgKernels.erase(pRec->lKernelIdx);
+
+	// Handles are not remapped, so a fresh kernel must hand them out in the
+	// same order as the recorded one for the rest of the replay to be valid.
+	if (lErr == 0 && (pRec->nFlags & CALLLOG_REC_HANDLE) && pRec->lFunctionIdx != CUDA_DLL_INITIALIZE)
+	{
+		if (lOutput < 1 || pOutput == NULL || (double)pOutput[0] != pRec->dfOutput0)
+			pStats->llHandleMismatches++;
+	}
+
+	if ((lErr != 0) != (pRec->lErr != 0))
+		pStats->llErrorMismatches++;
+
+	// Host buffer memory is returned directly and owned by the kernel.
+	if (pOutput != NULL && pOutput != rgOutput && pRec->lFunctionIdx != CUDA_FN_GETHOSTMEM)
+		pfn(lKernelIdx, CUDA_DLL_FREEMEM, pOutput, 0, NULL, NULL, szErr, MAX_ERROR);
+
+	FUNCTION_STATS* pFn = &pStats->rgFunctions[std::make_pair((int)pRec->nType, pRec->lFunctionIdx)];
+
+	pFn->llCalls++;
+	pFn->llRecordedTicks += pRec->llEnd - pRec->llBegin;
+	pFn->llReplayedTicks += *pllTicks;
+
+	if (lErr != 0)
+		pFn->llErrors++;
+
+	pStats->llCalls++;
+	pStats->llRecordedTicks += pRec->llEnd - pRec->llBegin;
+	pStats->llReplayedTicks += *pllTicks;
+
+	return lErr;
+}
+
+template <class T, class FN>
+void cleanupKernels(FN pfn, std::map<LONG, LONG>& rgKernels)
+{
+	TCHAR szErr[MAX_ERROR + 1];
+
+	for (std::map<LONG, LONG>::iterator it = rgKernels.begin(); it != rgKernels.end(); it++)
+	{
+		pfn(it->second, CUDA_DLL_CLEANUP, NULL, 0, NULL, NULL, szErr, MAX_ERROR);
+	}
+
+	rgKernels.clear();
+}
+
+void report(REPLAY_STATS* pStats, LONGLONG llFreq, int nRepeat)
+{
+	double dfMsPerTick = 1000.0 / (double)llFreq;
+	std::vector<std::pair<LONGLONG, std::pair<int, LONG>>> rgOrder;
+
+	for (std::map<std::pair<int, LONG>, FUNCTION_STATS>::iterator it = pStats->rgFunctions.begin(); it != pStats->rgFunctions.end(); it++)
+	{
+		rgOrder.push_back(std::make_pair(it->second.llReplayedTicks, it->first));
+	}
+
+	// Functions that take the most replay time are listed first.
+	std::sort(rgOrder.begin(), rgOrder.end(), [](const std::pair<LONGLONG, std::pair<int, LONG>>& a, const std::pair<LONGLONG, std::pair<int, LONG>>& b) { return a.first > b.first; });
+
+	printf("\n type      fn        calls  recorded ms  replayed ms  rec mean us  rep mean us   errors\n");
+
+	for (size_t i = 0; i < rgOrder.size(); i++)
+	{
+		FUNCTION_STATS* pFn = &pStats->rgFunctions[rgOrder[i].second];
+
+		printf(" %s  %6d  %11lld  %11.3lf  %11.3lf  %11.3lf  %11.3lf  %7lld\n",
+			(rgOrder[i].second.first == CALLLOG_TYPE_DOUBLE) ? "dbl" : "flt",
+			rgOrder[i].second.second,
+			pFn->llCalls,
+			(double)pFn->llRecordedTicks * dfMsPerTick,
+			(double)pFn->llReplayedTicks * dfMsPerTick,
+			(double)pFn->llRecordedTicks * dfMsPerTick * 1000.0 / (double)pFn->llCalls,
+			(double)pFn->llReplayedTicks * dfMsPerTick * 1000.0 / (double)pFn->llCalls,
+			pFn->llErrors);
+	}
+
+	printf("\nTotal: %lld calls over %d pass(es), recorded %.3lf ms, replayed %.3lf ms.\n",
+		pStats->llCalls,
+		nRepeat,
+		(double)pStats->llRecordedTicks * dfMsPerTick,
+		(double)pStats->llReplayedTicks * dfMsPerTick);
+
+	if (pStats->llTruncated > 0)
+		printf("%lld calls had their payloads replaced with zeros.\n", pStats->llTruncated);
+
+	if (pStats->llErrorMismatches > 0)
+		printf("WARNING: %lld calls did not fail or succeed as recorded.\n", pStats->llErrorMismatches);
+
+	if (pStats->llHandleMismatches > 0)
+		printf("WARNING: %lld handles differ from the recorded session, later calls may not be valid.\n", pStats->llHandleMismatches);
+}
+
+//end CudaDnnReplay.cpp
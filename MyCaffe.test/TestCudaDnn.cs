@@ -7,6 +7,9 @@ using MyCaffe.common;
 using System.Diagnostics;
 using MyCaffe.param;
 using MyCaffe.basecode;
+using System.Threading;
+using System.Text.RegularExpressions;
+using System.IO;
 
 namespace MyCaffe.test
 {
@@ -1301,7 +1304,7 @@ namespace MyCaffe.test
         }
 
         [TestMethod]
-        public void TestMemoryPointers()
+        public void TestMemoryTestHost()
         {
             CudaDnnTest test = new CudaDnnTest();
 
@@ -1309,7 +1312,7 @@ namespace MyCaffe.test
             {
                 foreach (ITestCudaDnn t in test.Tests)
                 {
-                    t.TestMemoryPointers();
+                    t.TestMemoryTestHost();
                 }
             }
             finally
@@ -1319,7 +1322,7 @@ namespace MyCaffe.test
         }
 
         [TestMethod]
-        public void TestGemm()
+        public void TestMemoryTestScrub()
         {
             CudaDnnTest test = new CudaDnnTest();
 
@@ -1327,7 +1330,7 @@ namespace MyCaffe.test
             {
                 foreach (ITestCudaDnn t in test.Tests)
                 {
-                    t.TestGemm();
+                    t.TestMemoryTestScrub();
                 }
             }
             finally
@@ -1337,7 +1340,7 @@ namespace MyCaffe.test
         }
 
         [TestMethod]
-        public void TestGemv()
+        public void TestProfiler()
         {
             CudaDnnTest test = new CudaDnnTest();
 
@@ -1345,7 +1348,7 @@ namespace MyCaffe.test
             {
                 foreach (ITestCudaDnn t in test.Tests)
                 {
-                    t.TestGemv();
+                    t.TestProfiler();
                 }
             }
             finally
@@ -1355,7 +1358,7 @@ namespace MyCaffe.test
         }
 
         [TestMethod]
-        public void TestHammingDistance()
+        public void TestTracer()
         {
             CudaDnnTest test = new CudaDnnTest();
 
@@ -1363,7 +1366,7 @@ namespace MyCaffe.test
             {
                 foreach (ITestCudaDnn t in test.Tests)
                 {
-                    t.TestHammingDistance();
+                    t.TestTracer();
                 }
             }
             finally
@@ -1371,307 +1374,2169 @@ namespace MyCaffe.test
                 test.Dispose();
             }
         }
-    }
 
-    public interface ITestCudaDnn : ITest
-    {
-        void TestGemm();
-        void TestGemv();
-        void TestMemoryTestByBlock();
-        void TestMemoryTestAll();
-        void TestMemoryPointers();
-        void TestHammingDistance();
-    }
+        [TestMethod]
+        public void TestAllocTracker()
+        {
+            CudaDnnTest test = new CudaDnnTest();
 
-    class CudaDnnTest : TestBase
-    {
-        public CudaDnnTest()
-            : base("CudaDnn Test")
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestAllocTracker();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestStreamPoolHazards()
         {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestStreamPoolHazards();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
         }
 
-        protected override ITest create(DataType dt, string strName, int nDeviceID, EngineParameter.Engine engine = EngineParameter.Engine.DEFAULT)
+        [TestMethod]
+        public void TestConvolutionAlgoCache()
         {
-            if (dt == common.DataType.DOUBLE)
-                return new CudaDnnTest<double>(strName, nDeviceID, engine);
-            else
-                return new CudaDnnTest<float>(strName, nDeviceID, engine);
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestConvolutionAlgoCache();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
         }
-    }
 
-    class CudaDnnTest<T> : TestEx<T>, ITestCudaDnn
-    {
-        Blob<T> m_temp;
-        Blob<T> m_A = null;
-        Blob<T> m_B = null;
-        Blob<T> m_C = null;
-        Blob<T> m_x = null;
-        Blob<T> m_y = null;
+        [TestMethod]
+        public void TestHostMirror()
+        {
+            CudaDnnTest test = new CudaDnnTest();
 
-        public CudaDnnTest(string strName, int nDeviceID, EngineParameter.Engine engine)
-            : base(strName, null, nDeviceID)
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestHostMirror();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestFusedExpression()
         {
-            m_temp = new Blob<T>(m_cuda, m_log);
-            m_A = new Blob<T>(m_cuda, m_log, 1, 1, 2, 3);
-            m_B = new Blob<T>(m_cuda, m_log, 1, 1, 3, 4);
-            m_C = new Blob<T>(m_cuda, m_log, 1, 1, 2, 4);
-            m_x = new Blob<T>(m_cuda, m_log, 1, 1, 1, 3);
-            m_y = new Blob<T>(m_cuda, m_log, 1, 1, 1, 2);
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestFusedExpression();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
         }
 
-        protected override void dispose()
+        [TestMethod]
+        public void TestStats()
         {
-            if (m_temp != null)
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
             {
-                m_temp.Dispose();
-                m_temp = null;
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestStats();
+                }
+            }
+            finally
+            {
+                test.Dispose();
             }
+        }
 
-            if (m_A != null)
+        [TestMethod]
+        public void TestConvolutionHostWinograd()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
             {
-                m_A.Dispose();
-                m_A = null;
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestConvolutionHostWinograd();
+                }
+            }
+            finally
+            {
+                test.Dispose();
             }
+        }
 
-            if (m_B != null)
+        [TestMethod]
+        public void TestPoolingCompactMask()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
             {
-                m_B.Dispose();
-                m_B = null;
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestPoolingCompactMask();
+                }
+            }
+            finally
+            {
+                test.Dispose();
             }
+        }
 
-            if (m_C != null)
+        [TestMethod]
+        public void TestSoftmaxLossFused()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
             {
-                m_C.Dispose();
-                m_C = null;
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestSoftmaxLossFused();
+                }
+            }
+            finally
+            {
+                test.Dispose();
             }
+        }
 
-            if (m_x != null)
+        [TestMethod]
+        public void TestUpdateForeach()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
             {
-                m_x.Dispose();
-                m_x = null;
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestUpdateForeach();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestLstmSequence()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestLstmSequence();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestRngPhilox()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestRngPhilox();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestDropoutBits()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestDropoutBits();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestHostSoftmaxLoss()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestHostSoftmaxLoss();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestHostUpdateForeach()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestHostUpdateForeach();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestHostLstmSequence()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestHostLstmSequence();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestHostRngPhilox()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestHostRngPhilox();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestHostPooling()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestHostPooling();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestMemoryPointers()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestMemoryPointers();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestGemm()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestGemm();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestGemv()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestGemv();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestHammingDistance()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestHammingDistance();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestModelAverager()
+        {
+            CudaDnnTest test = new CudaDnnTest();
+
+            try
+            {
+                foreach (ITestCudaDnn t in test.Tests)
+                {
+                    t.TestModelAverager();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+    }
+
+    public interface ITestCudaDnn : ITest
+    {
+        void TestGemm();
+        void TestGemv();
+        void TestMemoryTestByBlock();
+        void TestMemoryTestAll();
+        void TestMemoryTestHost();
+        void TestMemoryTestScrub();
+        void TestProfiler();
+        void TestTracer();
+        void TestAllocTracker();
+        void TestStreamPoolHazards();
+        void TestConvolutionAlgoCache();
+        void TestHostMirror();
+        void TestFusedExpression();
+        void TestStats();
+        void TestConvolutionHostWinograd();
+        void TestPoolingCompactMask();
+        void TestSoftmaxLossFused();
+        void TestUpdateForeach();
+        void TestLstmSequence();
+        void TestRngPhilox();
+        void TestDropoutBits();
+        void TestHostSoftmaxLoss();
+        void TestHostUpdateForeach();
+        void TestHostLstmSequence();
+        void TestHostRngPhilox();
+        void TestHostPooling();
+        void TestMemoryPointers();
+        void TestHammingDistance();
+        void TestModelAverager();
+    }
+
+    class CudaDnnTest : TestBase
+    {
+        public CudaDnnTest()
+            : base("CudaDnn Test")
+        {
+        }
+
+        protected override ITest create(DataType dt, string strName, int nDeviceID, EngineParameter.Engine engine = EngineParameter.Engine.DEFAULT)
+        {
+            if (dt == common.DataType.DOUBLE)
+                return new CudaDnnTest<double>(strName, nDeviceID, engine);
+            else
+                return new CudaDnnTest<float>(strName, nDeviceID, engine);
+        }
+    }
+
+    class CudaDnnTest<T> : TestEx<T>, ITestCudaDnn
+    {
+        Blob<T> m_temp;
+        Blob<T> m_A = null;
+        Blob<T> m_B = null;
+        Blob<T> m_C = null;
+        Blob<T> m_x = null;
+        Blob<T> m_y = null;
+
+        public CudaDnnTest(string strName, int nDeviceID, EngineParameter.Engine engine)
+            : base(strName, null, nDeviceID)
+        {
+            m_temp = new Blob<T>(m_cuda, m_log);
+            m_A = new Blob<T>(m_cuda, m_log, 1, 1, 2, 3);
+            m_B = new Blob<T>(m_cuda, m_log, 1, 1, 3, 4);
+            m_C = new Blob<T>(m_cuda, m_log, 1, 1, 2, 4);
+            m_x = new Blob<T>(m_cuda, m_log, 1, 1, 1, 3);
+            m_y = new Blob<T>(m_cuda, m_log, 1, 1, 1, 2);
+        }
+
+        protected override void dispose()
+        {
+            if (m_temp != null)
+            {
+                m_temp.Dispose();
+                m_temp = null;
+            }
+
+            if (m_A != null)
+            {
+                m_A.Dispose();
+                m_A = null;
+            }
+
+            if (m_B != null)
+            {
+                m_B.Dispose();
+                m_B = null;
+            }
+
+            if (m_C != null)
+            {
+                m_C.Dispose();
+                m_C = null;
+            }
+
+            if (m_x != null)
+            {
+                m_x.Dispose();
+                m_x = null;
+            }
+
+            if (m_y != null)
+            {
+                m_y.Dispose();
+                m_y = null;
+            }
+            
+            base.dispose();
+        }
+
+        public void TestGemm()
+        {
+            double[] rgData = new double[] { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+            double[] A_reshape_data = new double[] { 1, 4, 2, 5, 3, 6 };
+            double[] B_reshape_data = new double[] { 1, 5, 9, 2, 6, 10, 3, 7, 11, 4, 8, 12 };
+            double[] rgResult = new double[] { 38, 44, 50, 56, 83, 98, 113, 128 };
+
+            m_temp.Reshape(new List<int>() { rgData.Length, 1, 1, 1 });
+            m_temp.mutable_cpu_data = convert(rgData);
+            m_cuda.copy(6, m_temp.gpu_data, m_A.mutable_gpu_data);
+            m_cuda.copy(12, m_temp.gpu_data, m_B.mutable_gpu_data);
+
+            // [1, 2, 3; 4, 5, 6] * [1, 2, 3, 4; 5, 6, 7, 8; 9, 10, 11, 12];
+            m_cuda.gemm(false, false, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+
+            for (int i = 0; i < 8; i++)
+            {
+                double dfVal = convert(m_C.GetData(i));
+                double dfRes = rgResult[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+            m_cuda.gemm(false, false, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+
+            for (int i = 0; i < 8; i++)
+            {
+                double dfVal = convert(m_C.GetData(i));
+                double dfRes = rgResult[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+            // Test when we have a transposed A.
+            m_A.Reshape(1, 1, 3, 2);
+            m_temp.mutable_cpu_data = convert(A_reshape_data);
+            m_cuda.copy(6, m_temp.gpu_data, m_A.mutable_gpu_data);
+
+            m_cuda.gemm(true, false, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+
+            for (int i = 0; i < 8; i++)
+            {
+                double dfVal = convert(m_C.GetData(i));
+                double dfRes = rgResult[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+            m_cuda.gemm(true, false, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+
+            for (int i = 0; i < 8; i++)
+            {
+                double dfVal = convert(m_C.GetData(i));
+                double dfRes = rgResult[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+
+            // Test when we have a transposed A and a transposed B too.
+            m_B.Reshape(1, 1, 4, 3);
+            m_temp.mutable_cpu_data = convert(B_reshape_data);
+            m_cuda.copy(12, m_temp.gpu_data, m_B.mutable_gpu_data);
+
+            m_cuda.gemm(true, true, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+
+            for (int i = 0; i < 8; i++)
+            {
+                double dfVal = convert(m_C.GetData(i));
+                double dfRes = rgResult[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+            m_cuda.gemm(true, true, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+
+            for (int i = 0; i < 8; i++)
+            {
+                double dfVal = convert(m_C.GetData(i));
+                double dfRes = rgResult[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+            // Test when we have a transposed B.
+            m_A.Reshape(1, 1, 2, 3);
+            m_temp.mutable_cpu_data = convert(rgData);
+            m_cuda.copy(6, m_temp.gpu_data, m_A.mutable_gpu_data);
+
+            m_cuda.gemm(false, true, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+
+            for (int i = 0; i < 8; i++)
+            {
+                double dfVal = convert(m_C.GetData(i));
+                double dfRes = rgResult[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+            m_cuda.gemm(false, true, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+
+            for (int i = 0; i < 8; i++)
+            {
+                double dfVal = convert(m_C.GetData(i));
+                double dfRes = rgResult[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+        }
+
+        public void TestGemv()
+        {
+            double[] rgData = new double[] { 1, 2, 3, 4, 5, 6 };
+            double[] result_2 = new double[] { 14, 32 };
+            double[] result_3 = new double[] { 9, 12, 15 };
+
+            m_temp.Reshape(new List<int>() { rgData.Length, 1, 1, 1 });
+            m_temp.mutable_cpu_data = convert(rgData);
+            m_cuda.copy(6, m_temp.gpu_data, m_A.mutable_gpu_data);
+            m_cuda.copy(3, m_temp.gpu_data, m_x.mutable_gpu_data);
+
+            m_cuda.gemv(false, 2, 3, 1.0, m_A.gpu_data, m_x.gpu_data, 0.0, m_y.mutable_gpu_data);
+
+            for (int i = 0; i < 2; i++)
+            {
+                double dfVal = convert(m_y.GetData(i));
+                double dfRes = result_2[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+            m_cuda.gemv(false, 2, 3, 1.0, m_A.gpu_data, m_x.gpu_data, 0.0, m_y.mutable_gpu_data);
+
+            for (int i = 0; i < 2; i++)
+            {
+                double dfVal = convert(m_y.GetData(i));
+                double dfRes = result_2[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+
+            // Test transpose case
+            m_cuda.copy(2, m_temp.gpu_data, m_y.mutable_gpu_data);
+
+            m_cuda.gemv(true, 2, 3, 1.0, m_A.gpu_data, m_y.gpu_data, 0.0, m_x.mutable_gpu_data);
+
+            for (int i = 0; i < 3; i++)
+            {
+                double dfVal = convert(m_x.GetData(i));
+                double dfRes = result_3[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+
+            m_cuda.gemv(true, 2, 3, 1.0, m_A.gpu_data, m_y.gpu_data, 0.0, m_x.mutable_gpu_data);
+
+            for (int i = 0; i < 3; i++)
+            {
+                double dfVal = convert(m_x.GetData(i));
+                double dfRes = result_3[i];
+                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+            }
+        }
+
+        public void TestMemoryTestByBlock()
+        {
+            ulong ulTotalBlocks;
+            double dfTotalMemAllocated;
+            ulong ulMemStartAddr;
+            ulong ulBlockSize;
+            long hMemTest = m_cuda.CreateMemoryTest(out ulTotalBlocks, out dfTotalMemAllocated, out ulMemStartAddr, out ulBlockSize);
+
+            for (ulong ulIdx = 0; ulIdx < ulTotalBlocks; ulIdx++)
+            {
+                T[] rg = m_cuda.RunMemoryTest(hMemTest, MEMTEST_TYPE.MOV_INV_8, ulIdx, 1, true, true, true, true);
+                double[] rgData = convert(rg);
+
+                ulong ulStartAddr = (ulong)rgData[0];
+                ulong ulAddrCount = (ulong)rgData[1];
+                int nErrCount = (int)rgData[2];
+
+                Trace.WriteLine("Start address = 0x" + ulStartAddr.ToString("X"));
+                Trace.WriteLine("address count = " + ulAddrCount.ToString("N0"));
+                Trace.WriteLine("error count = " + nErrCount.ToString("N0"));
+
+                for (int i = 0; i < nErrCount; i++)
+                {
+                    Trace.WriteLine("error address " + i.ToString() + " = " + rgData[3 + i].ToString("X"));
+                }
+
+                double dfPct = (double)ulIdx / (double)ulTotalBlocks;
+                Trace.WriteLine("Percentage Complete: " + dfPct.ToString("P"));
+            }
+
+            m_cuda.FreeMemoryTest(hMemTest);
+        }
+
+        public void TestMemoryTestAll()
+        {
+            ulong ulTotalBlocks;
+            double dfTotalMemAllocated;
+            ulong ulMemStartAddr;
+            ulong ulBlockSize;
+            long hMemTest = m_cuda.CreateMemoryTest(out ulTotalBlocks, out dfTotalMemAllocated, out ulMemStartAddr, out ulBlockSize);
+
+            T[] rg = m_cuda.RunMemoryTest(hMemTest, MEMTEST_TYPE.MOV_INV_8, 0, ulTotalBlocks, true, true, true, true);
+            double[] rgData = convert(rg);
+
+            ulong ulStartAddr = (ulong)rgData[0];
+            ulong ulAddrCount = (ulong)rgData[1];
+            int nErrCount = (int)rgData[2];
+
+            Trace.WriteLine("Start address = 0x" + ulStartAddr.ToString("X"));
+            Trace.WriteLine("address count = " + ulAddrCount.ToString("N0"));
+            Trace.WriteLine("error count = " + nErrCount.ToString("N0"));
+
+            for (int i = 0; i < nErrCount; i++)
+            {
+                Trace.WriteLine("error address " + i.ToString() + " = " + rgData[3 + i].ToString("X"));
+            }
+
+            m_cuda.FreeMemoryTest(hMemTest);
+        }
+
+        public void TestMemoryTestHost()
+        {
+            ulong ulTotalBlocks;
+            double dfTotalMemAllocated;
+            ulong ulMemStartAddr;
+            ulong ulBlockSize;
+            long hMemTest = m_cuda.CreateMemoryTest(out ulTotalBlocks, out dfTotalMemAllocated, out ulMemStartAddr, out ulBlockSize, 0.01, true);
+
+            try
+            {
+                m_log.CHECK_GT(ulTotalBlocks, 0, "There should be at least one block of host memory to test.");
+
+                ulong ulCount = Math.Min(ulTotalBlocks, 16);
+                MEMTEST_TYPE[] rgTypes = new MEMTEST_TYPE[] { MEMTEST_TYPE.MOV_INV_8, MEMTEST_TYPE.WALKING_ONES, MEMTEST_TYPE.WALKING_ZEROS, MEMTEST_TYPE.MODULO_20, MEMTEST_TYPE.RANDOM_DATA };
+
+                foreach (MEMTEST_TYPE type in rgTypes)
+                {
+                    T[] rg = m_cuda.RunMemoryTest(hMemTest, type, 0, ulCount, true, true, true, true);
+                    double[] rgData = convert(rg);
+
+                    ulong ulAddrCount = (ulong)rgData[1];
+                    int nErrCount = (int)rgData[2];
+
+                    m_log.CHECK_EQ(ulAddrCount, ulCount * ulBlockSize, "The address count is incorrect for the " + type.ToString() + " test.");
+                    m_log.CHECK_EQ(nErrCount, 0, "The " + type.ToString() + " test should not find any errors.");
+                }
+
+                // Single pattern tests may write and verify in separate calls.
+                foreach (MEMTEST_TYPE type in new MEMTEST_TYPE[] { MEMTEST_TYPE.MOV_INV_8, MEMTEST_TYPE.RANDOM_DATA })
+                {
+                    m_cuda.RunMemoryTest(hMemTest, type, 0, ulCount, true, true, false, false);
+                    T[] rg = m_cuda.RunMemoryTest(hMemTest, type, 0, ulCount, true, false, true, true);
+                    double[] rgData = convert(rg);
+
+                    int nErrCount = (int)rgData[2];
+                    m_log.CHECK_EQ(nErrCount, 0, "The split " + type.ToString() + " test should not find any errors.");
+                }
+
+                // Multi-pattern tests only hold their last sub-pattern, so a split run is rejected.
+                foreach (MEMTEST_TYPE type in new MEMTEST_TYPE[] { MEMTEST_TYPE.WALKING_ONES, MEMTEST_TYPE.WALKING_ZEROS, MEMTEST_TYPE.MODULO_20 })
+                {
+                    bool bRejected = false;
+
+                    try
+                    {
+                        m_cuda.RunMemoryTest(hMemTest, type, 0, ulCount, true, true, false, false);
+                    }
+                    catch (Exception)
+                    {
+                        bRejected = true;
+                    }
+
+                    m_log.CHECK(bRejected, "The split " + type.ToString() + " test should be rejected.");
+                }
+            }
+            finally
+            {
+                m_cuda.FreeMemoryTest(hMemTest);
+            }
+        }
+
+        private double runForegroundWork(long hA, long hB, long hC, int nCount, int nIterations)
+        {
+            Stopwatch sw = new Stopwatch();
+            sw.Start();
+
+            for (int i = 0; i < nIterations; i++)
+            {
+                m_cuda.add(nCount, hA, hB, hC);
+                m_cuda.add(nCount, hC, hB, hA);
+            }
+
+            m_cuda.SynchronizeDevice();
+
+            return sw.Elapsed.TotalMilliseconds;
+        }
+
+        public void TestMemoryTestScrub()
+        {
+            ulong ulTotalBlocks;
+            double dfTotalMemAllocated;
+            ulong ulMemStartAddr;
+            ulong ulBlockSize;
+            int nCount = 4 * 1024 * 1024;
+            int nIterations = 2000;
+            long hA = m_cuda.AllocMemory(nCount);
+            long hB = m_cuda.AllocMemory(nCount);
+            long hC = m_cuda.AllocMemory(nCount);
+            long hMemTest = m_cuda.CreateMemoryTest(out ulTotalBlocks, out dfTotalMemAllocated, out ulMemStartAddr, out ulBlockSize, 0.25);
+
+            try
+            {
+                m_cuda.set(nCount, hA, 0);
+                m_cuda.set(nCount, hB, 0);
+
+                // Benchmark the foreground work without, and then with, the scrubber running at a 10% time budget.
+                runForegroundWork(hA, hB, hC, nCount, 10);
+                double dfBaseMs = runForegroundWork(hA, hB, hC, nCount, nIterations);
+
+                m_cuda.StartMemoryTestScrub(hMemTest, MEMTEST_TYPE.MOV_INV_8, 100, 0, 16);
+                double dfScrubMs = runForegroundWork(hA, hB, hC, nCount, nIterations);
+                Thread.Sleep(2000);
+
+                double[] rgStatus = convert(m_cuda.GetMemoryTestScrubStatus(hMemTest));
+                m_cuda.StopMemoryTestScrub(hMemTest);
+
+                Trace.WriteLine("Foreground without scrub = " + dfBaseMs.ToString("N2") + " ms");
+                Trace.WriteLine("Foreground with scrub = " + dfScrubMs.ToString("N2") + " ms");
+                Trace.WriteLine("Scrub overhead = " + ((dfScrubMs - dfBaseMs) / dfBaseMs).ToString("P"));
+                Trace.WriteLine("Blocks tested = " + rgStatus[3].ToString("N0") + " of " + rgStatus[8].ToString("N0"));
+                Trace.WriteLine("Busy ms in last second = " + rgStatus[7].ToString("N0"));
+
+                m_log.CHECK_EQ(rgStatus[0], 1, "The scrubber should still be running.");
+                m_log.CHECK_GT(rgStatus[3], 0, "The scrubber should have tested some blocks.");
+                m_log.CHECK_EQ(rgStatus[6], 0, "The scrubber should not have hit an error.");
+                m_log.CHECK_EQ(rgStatus[4], 0, "The scrubber should not find any memory errors.");
+
+                // Resume from the saved progress.
+                ulong ulCursor = (ulong)rgStatus[1];
+                int nPasses = (int)rgStatus[2];
+                m_cuda.StartMemoryTestScrub(hMemTest, MEMTEST_TYPE.MOV_INV_8, 100, 0, 16, ulCursor, nPasses);
+                rgStatus = convert(m_cuda.GetMemoryTestScrubStatus(hMemTest));
+                m_cuda.StopMemoryTestScrub(hMemTest);
+
+                m_log.CHECK_GE(rgStatus[2], nPasses, "The pass count should be resumed.");
+
+                rgStatus = convert(m_cuda.GetMemoryTestScrubStatus(hMemTest));
+                m_log.CHECK_EQ(rgStatus[0], 0, "The scrubber should be stopped.");
+            }
+            finally
+            {
+                m_cuda.FreeMemoryTest(hMemTest);
+                m_cuda.FreeMemory(hA);
+                m_cuda.FreeMemory(hB);
+                m_cuda.FreeMemory(hC);
+            }
+        }
+
+        public void TestProfiler()
+        {
+            int nCount = 1000;
+            long hA = m_cuda.AllocMemory(nCount);
+            long hB = m_cuda.AllocMemory(nCount);
+
+            try
+            {
+                m_cuda.ResetProfiler();
+                m_cuda.EnableProfiler(true);
+
+                for (int i = 0; i < 10; i++)
+                {
+                    m_cuda.set(nCount, hA, 1.0);
+                    m_cuda.copy(nCount, hA, hB);
+                }
+
+                m_cuda.GetMemory(hB);
+                m_cuda.EnableProfiler(false);
+
+                // Calls made while disabled are not counted.
+                m_cuda.copy(nCount, hA, hB);
+
+                string strJson = m_cuda.GetProfilerStats();
+                Trace.WriteLine(strJson);
+
+                m_log.CHECK(strJson.StartsWith("{\"enabled\":false"), "The profiler should be disabled.");
+                m_log.CHECK(strJson.Contains("{\"fn\":202,\"calls\":10,"), "The copy function should have been called 10 times.");
+                m_log.CHECK(strJson.Contains("{\"fn\":22,\"calls\":1,"), "The get memory function should have been called once.");
+                m_log.CHECK(strJson.EndsWith("]}"), "The JSON should be complete.");
+            }
+            finally
+            {
+                m_cuda.EnableProfiler(false);
+                m_cuda.FreeMemory(hA);
+                m_cuda.FreeMemory(hB);
+            }
+        }
+
+        public void TestTracer()
+        {
+            int nCount = 1000;
+            long hA = m_cuda.AllocMemory(nCount);
+            long hB = m_cuda.AllocMemory(nCount);
+
+            try
+            {
+                m_cuda.GetTrace(); // discard any earlier events.
+                m_cuda.EnableTracer(true);
+
+                m_cuda.SetMemory(hA, convert(new double[nCount]));
+                m_cuda.copy(nCount, hA, hB);
+                m_cuda.GetMemory(hB);
+                m_cuda.SynchronizeDevice();
+
+                m_cuda.EnableTracer(false);
+
+                string strJson = m_cuda.GetTrace();
+                Trace.WriteLine(strJson);
+
+                m_log.CHECK(strJson.StartsWith("{\"traceEvents\":["), "The trace should start with the event list.");
+                m_log.CHECK(strJson.Contains("\"name\":\"fn 202\""), "The copy call should have been traced.");
+                m_log.CHECK(strJson.Contains("\"cat\":\"h2d\""), "The host to device transfer should have been traced.");
+                m_log.CHECK(strJson.Contains("\"cat\":\"d2h\""), "The device to host transfer should have been traced.");
+                m_log.CHECK(strJson.Contains("\"cat\":\"sync\""), "The synchronization should have been traced.");
+                m_log.CHECK(strJson.EndsWith("}}"), "The JSON should be complete.");
+
+                // Events are consumed by each flush.
+                strJson = m_cuda.GetTrace();
+                m_log.CHECK(!strJson.Contains("fn 202"), "The events should have been consumed.");
+            }
+            finally
+            {
+                m_cuda.EnableTracer(false);
+                m_cuda.FreeMemory(hA);
+                m_cuda.FreeMemory(hB);
+            }
+        }
+
+        public void TestAllocTracker()
+        {
+            int nCount = 1000;
+            long hUntagged = 0;
+            long hA = 0;
+            long hB = 0;
+
+            try
+            {
+                m_cuda.EnableAllocTracker(true);
+
+                hUntagged = m_cuda.AllocMemory(nCount);
+                m_cuda.SetAllocTag(7, "conv1");
+                hA = m_cuda.AllocMemory(nCount);
+                hB = m_cuda.AllocMemory(nCount);
+                m_cuda.SetAllocTag(0);
+
+                string strJson = m_cuda.GetAllocReport();
+                Trace.WriteLine(strJson);
+
+                long lBytes = nCount * ((typeof(T) == typeof(double)) ? 8 : 4);
+
+                m_log.CHECK(strJson.Contains("{\"tag\":7,\"label\":\"conv1\",\"live_count\":2,\"live_bytes\":" + (lBytes * 2).ToString() + ","), "The tagged allocations should be attributed to tag 7.");
+                m_log.CHECK(strJson.Contains("{\"tag\":0,\"label\":\"\",\"live_count\":1,"), "The untagged allocation should be attributed to tag 0.");
+                m_log.CHECK(strJson.Contains("\"handle\":" + hA.ToString() + ",\"tag\":7"), "The outstanding handles should be listed.");
+
+                m_cuda.FreeMemory(hA);
+                hA = 0;
+
+                strJson = m_cuda.GetAllocReport(false);
+                m_log.CHECK(strJson.Contains("\"live_count\":1,\"live_bytes\":" + lBytes.ToString() + ",\"high_water_bytes\":" + (lBytes * 2).ToString() + ",\"allocs\":2,\"frees\":1}"), "The high-water mark should be kept after the free.");
+                m_log.CHECK(!strJson.Contains("outstanding"), "The outstanding handles should not be listed.");
+            }
+            finally
+            {
+                m_cuda.SetAllocTag(0);
+                m_cuda.EnableAllocTracker(false);
+
+                if (hUntagged != 0)
+                    m_cuda.FreeMemory(hUntagged);
+
+                if (hA != 0)
+                    m_cuda.FreeMemory(hA);
+
+                if (hB != 0)
+                    m_cuda.FreeMemory(hB);
+            }
+        }
+
+        private long getStat(string strJson, string strName)
+        {
+            Match m = Regex.Match(strJson, "\"" + strName + "\":([0-9]+)");
+            m_log.CHECK(m.Success, "Could not find the '" + strName + "' stat.");
+            return long.Parse(m.Groups[1].Value);
+        }
+
+        public void TestStreamPoolHazards()
+        {
+            int nFailed = m_cuda.CheckStreamPool();
+            m_log.CHECK_EQ(0, nFailed, "The stream pool check " + nFailed.ToString() + " failed.");
+        }
+
+        public void TestConvolutionAlgoCache()
+        {
+            long hCuDnn = m_cuda.CreateCuDNN();
+            long hBottomDesc = m_cuda.CreateTensorDesc();
+            long hTopDesc = m_cuda.CreateTensorDesc();
+            long hFilterDesc = m_cuda.CreateFilterDesc();
+            long hConvDesc = m_cuda.CreateConvolutionDesc();
+            string strFile = Path.Combine(Path.GetTempPath(), "mycaffe_conv_algo_" + Guid.NewGuid().ToString() + ".cache");
+            string strStubFile = Path.Combine(Path.GetTempPath(), "mycaffe_conv_algo_stub_" + Guid.NewGuid().ToString() + ".cache");
+
+            try
+            {
+                // The selection, persistence and version checks on a stub selector.
+                int nFailed = m_cuda.CheckConvolutionAlgoCache(strStubFile);
+                m_log.CHECK_EQ(0, nFailed, "The convolution algorithm cache check " + nFailed.ToString() + " failed.");
+                m_log.CHECK(!File.Exists(strStubFile), "The stub cache file should be deleted.");
+
+                m_cuda.SetTensorDesc(hBottomDesc, 2, 3, 32, 32);
+                m_cuda.SetTensorDesc(hTopDesc, 2, 8, 32, 32);
+                m_cuda.SetFilterDesc(hFilterDesc, 8, 3, 3, 3);
+                m_cuda.SetConvolutionDesc(hConvDesc, 1, 1, 1, 1);
+
+                // Use a temporary file so that the user's cache is not touched.
+                m_cuda.SetConvolutionAlgoCacheFile(strFile);
+                m_log.CHECK(File.Exists(strFile), "The cache file should have been created.");
+
+                CONV_FWD_ALGO algoFwd1;
+                CONV_BWD_FILTER_ALGO algoBwdFilter1;
+                CONV_BWD_DATA_ALGO algoBwdData1;
+                long lWsFwd1;
+                long lWsBwdFilter1;
+                long lWsBwdData1;
+                Stopwatch sw = new Stopwatch();
+
+                sw.Start();
+                m_cuda.GetConvolutionInfo(hCuDnn, hBottomDesc, hFilterDesc, hConvDesc, hTopDesc, 1024 * 1024, out algoFwd1, out lWsFwd1, out algoBwdFilter1, out lWsBwdFilter1, out algoBwdData1, out lWsBwdData1);
+                double dfFirstMs = sw.Elapsed.TotalMilliseconds;
+
+                string strJson = m_cuda.GetConvolutionAlgoCacheStats();
+                m_log.CHECK_EQ(1, getStat(strJson, "misses"), "The first lookup should select the algorithms.");
+                m_log.CHECK_EQ(0, getStat(strJson, "hits"), "The first lookup should not hit the cache.");
+
+                CONV_FWD_ALGO algoFwd2;
+                CONV_BWD_FILTER_ALGO algoBwdFilter2;
+                CONV_BWD_DATA_ALGO algoBwdData2;
+                long lWsFwd2;
+                long lWsBwdFilter2;
+                long lWsBwdData2;
+
+                sw.Restart();
+                m_cuda.GetConvolutionInfo(hCuDnn, hBottomDesc, hFilterDesc, hConvDesc, hTopDesc, 1024 * 1024, out algoFwd2, out lWsFwd2, out algoBwdFilter2, out lWsBwdFilter2, out algoBwdData2, out lWsBwdData2);
+                double dfSecondMs = sw.Elapsed.TotalMilliseconds;
+
+                strJson = m_cuda.GetConvolutionAlgoCacheStats();
+                Trace.WriteLine(strJson);
+                Trace.WriteLine("First lookup = " + dfFirstMs.ToString("N3") + " ms, cached lookup = " + dfSecondMs.ToString("N3") + " ms.");
+
+                m_log.CHECK_EQ(1, getStat(strJson, "misses"), "The second lookup should not select the algorithms.");
+                m_log.CHECK_EQ(1, getStat(strJson, "hits"), "The second lookup should hit the cache.");
+                m_log.CHECK(algoFwd1 == algoFwd2 && lWsFwd1 == lWsFwd2, "The forward algorithm should be the same.");
+                m_log.CHECK(algoBwdFilter1 == algoBwdFilter2 && lWsBwdFilter1 == lWsBwdFilter2, "The backward filter algorithm should be the same.");
+                m_log.CHECK(algoBwdData1 == algoBwdData2 && lWsBwdData1 == lWsBwdData2, "The backward data algorithm should be the same.");
+
+                // A different workspace limit is a different entry.
+                m_cuda.GetConvolutionInfo(hCuDnn, hBottomDesc, hFilterDesc, hConvDesc, hTopDesc, 0, out algoFwd2, out lWsFwd2, out algoBwdFilter2, out lWsBwdFilter2, out algoBwdData2, out lWsBwdData2);
+                strJson = m_cuda.GetConvolutionAlgoCacheStats();
+                m_log.CHECK_EQ(2, getStat(strJson, "misses"), "A new workspace limit should select the algorithms.");
+                m_log.CHECK_EQ(2, getStat(strJson, "entries"), "There should be an entry per workspace limit.");
+
+                // Selecting again after clearing the entries in memory does not grow the loaded cache.
+                m_cuda.ClearConvolutionAlgoCache();
+                m_cuda.GetConvolutionInfo(hCuDnn, hBottomDesc, hFilterDesc, hConvDesc, hTopDesc, 1024 * 1024, out algoFwd2, out lWsFwd2, out algoBwdFilter2, out lWsBwdFilter2, out algoBwdData2, out lWsBwdData2);
+
+                // Reloading the file, as a new process would, loads both entries.
+                m_cuda.SetConvolutionAlgoCacheFile(strFile);
+                strJson = m_cuda.GetConvolutionAlgoCacheStats();
+                m_log.CHECK_EQ(2, getStat(strJson, "loaded"), "Both entries should be loaded from the file.");
+                m_log.CHECK_EQ(2, getStat(strJson, "entries"), "The duplicate entry should be dropped on load.");
+
+                m_cuda.GetConvolutionInfo(hCuDnn, hBottomDesc, hFilterDesc, hConvDesc, hTopDesc, 1024 * 1024, out algoFwd2, out lWsFwd2, out algoBwdFilter2, out lWsBwdFilter2, out algoBwdData2, out lWsBwdData2);
+                strJson = m_cuda.GetConvolutionAlgoCacheStats();
+                m_log.CHECK_EQ(0, getStat(strJson, "misses"), "The loaded entry should not select the algorithms.");
+                m_log.CHECK_EQ(1, getStat(strJson, "hits"), "The loaded entry should hit the cache.");
+                m_log.CHECK(algoFwd1 == algoFwd2 && lWsFwd1 == lWsFwd2, "The loaded forward algorithm should be the same.");
+
+                // A file written by another version of the cache is discarded.
+                byte[] rgHeader = File.ReadAllBytes(strFile);
+                rgHeader[4]++;
+                File.WriteAllBytes(strFile, rgHeader);
+
+                m_cuda.SetConvolutionAlgoCacheFile(strFile);
+                strJson = m_cuda.GetConvolutionAlgoCacheStats();
+                m_log.CHECK_EQ(0, getStat(strJson, "loaded"), "A file from another version should not be loaded.");
+                m_log.CHECK_EQ(0, getStat(strJson, "entries"), "A file from another version should not add entries.");
+            }
+            finally
+            {
+                m_cuda.SetConvolutionAlgoCacheFile(null);
+
+                if (File.Exists(strFile))
+                    File.Delete(strFile);
+
+                m_cuda.FreeConvolutionDesc(hConvDesc);
+                m_cuda.FreeFilterDesc(hFilterDesc);
+                m_cuda.FreeTensorDesc(hTopDesc);
+                m_cuda.FreeTensorDesc(hBottomDesc);
+                m_cuda.FreeCuDNN(hCuDnn);
+            }
+        }
+
+        public void TestHostMirror()
+        {
+            long hMem = m_cuda.AllocMemory(1000);
+            long hMem1 = 0;
+
+            try
+            {
+                m_cuda.set(1000, hMem, 1);
+                m_cuda.EnableHostMirror(true);
+
+                double[] rgData = convert(m_cuda.GetMemory(hMem));
+                rgData = convert(m_cuda.GetMemory(hMem));
+
+                Tuple<long, long, long> stats = m_cuda.GetHostMirrorStats();
+                m_log.CHECK_EQ(1, stats.Item1, "The second read should hit the mirror.");
+                m_log.CHECK_EQ(1, stats.Item2, "The first read should miss the mirror.");
+                m_log.CHECK_GT(stats.Item3, 0, "The handle should be mirrored.");
+
+                // A kernel taking the handle invalidates the mirror.
+                m_cuda.scal(1000, 2.0, hMem);
+                rgData = convert(m_cuda.GetMemory(hMem));
+
+                stats = m_cuda.GetHostMirrorStats();
+                m_log.CHECK_EQ(2, stats.Item2, "The read after the kernel should miss the mirror.");
+
+                for (int i = 0; i < rgData.Length; i++)
+                {
+                    m_log.CHECK_EQ(2.0, rgData[i], "The data should reflect the kernel.");
+                }
+
+                // So does a write through a memory pointer.
+                hMem1 = m_cuda.CreateMemoryPointer(hMem, 100, 100);
+                m_cuda.set(100, hMem1, 3);
+                rgData = convert(m_cuda.GetMemory(hMem));
+
+                stats = m_cuda.GetHostMirrorStats();
+                m_log.CHECK_EQ(3, stats.Item2, "The read after the memory pointer write should miss the mirror.");
+
+                for (int i = 0; i < rgData.Length; i++)
+                {
+                    double dfExpected = (i >= 100 && i < 200) ? 3.0 : 2.0;
+                    m_log.CHECK_EQ(dfExpected, rgData[i], "The data should reflect the memory pointer write.");
+                }
+
+                m_cuda.SetMemory(hMem, rgData);
+                rgData = convert(m_cuda.GetMemory(hMem));
+
+                stats = m_cuda.GetHostMirrorStats();
+                m_log.CHECK_EQ(4, stats.Item2, "The read after SetMemory should miss the mirror.");
+
+                m_cuda.EnableHostMirror(false);
+
+                stats = m_cuda.GetHostMirrorStats();
+                m_log.CHECK_EQ(0, stats.Item3, "Disabling the mirror should release the host copies.");
+            }
+            finally
+            {
+                m_cuda.EnableHostMirror(false);
+
+                if (hMem1 != 0)
+                    m_cuda.FreeMemoryPointer(hMem1);
+
+                m_cuda.FreeMemory(hMem);
+            }
+        }
+
+        public void TestFusedExpression()
+        {
+            int nCount = 1000;
+            long hA = m_cuda.AllocMemory(nCount);
+            long hB = m_cuda.AllocMemory(nCount);
+            long hC = m_cuda.AllocMemory(nCount);
+            long hY = m_cuda.AllocMemory(nCount);
+            double[] rgA = new double[nCount];
+            double[] rgB = new double[nCount];
+            double[] rgC = new double[nCount];
+
+            try
+            {
+                for (int i = 0; i < nCount; i++)
+                {
+                    rgA[i] = (i % 17) * 0.25;
+                    rgB[i] = (i % 5) - 2.0;
+                    rgC[i] = 0.5 + (i % 3);
+                }
+
+                m_cuda.SetMemory(hA, rgA);
+                m_cuda.SetMemory(hB, rgB);
+                m_cuda.SetMemory(hC, rgC);
+
+                // (A - B)^2 with a sum, matching sumsqdiff.
+                List<Tuple<FUSED_OP, double>> rgOps = new List<Tuple<FUSED_OP, double>>();
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.LOAD, 0));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.LOAD, 1));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.SUB, 0));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.SQUARE, 0));
+
+                double dfSum = m_cuda.fused_expr(nCount, hY, new long[] { hA, hB }, rgOps, FUSED_REDUCTION.SUM);
+                double[] rgY = convert(m_cuda.GetMemory(hY));
+                double dfExpected = 0;
+
+                for (int i = 0; i < nCount; i++)
+                {
+                    double dfDiff = rgA[i] - rgB[i];
+                    m_log.EXPECT_NEAR(dfDiff * dfDiff, rgY[i], 1e-5, "The squared difference is wrong.");
+                    dfExpected += dfDiff * dfDiff;
+                }
+
+                m_log.EXPECT_NEAR(dfExpected, dfSum, 1e-2, "The sum is wrong.");
+                m_log.EXPECT_NEAR(dfExpected, m_cuda.sumsqdiff(nCount, hY, hA, hB), 1e-2, "The sumsqdiff is wrong.");
+
+                // sqrt(exp(A * 0.5) * C + 1) / (B + 3), using the generic kernel.
+                rgOps = new List<Tuple<FUSED_OP, double>>();
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.LOAD, 0));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.MUL_SCALAR, 0.5));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.EXP, 0));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.LOAD, 2));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.MUL, 0));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.ADD_SCALAR, 1));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.SQRT, 0));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.LOAD, 1));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.CONST, 3));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.ADD, 0));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.DIV, 0));
+
+                double dfAsum = m_cuda.fused_expr(nCount, hY, new long[] { hA, hB, hC }, rgOps, FUSED_REDUCTION.ASUM);
+                rgY = convert(m_cuda.GetMemory(hY));
+                dfExpected = 0;
+
+                for (int i = 0; i < nCount; i++)
+                {
+                    double dfVal = Math.Sqrt(Math.Exp(rgA[i] * 0.5) * rgC[i] + 1) / (rgB[i] + 3);
+                    m_log.EXPECT_NEAR(dfVal, rgY[i], 1e-4, "The expression is wrong.");
+                    dfExpected += Math.Abs(dfVal);
+                }
+
+                m_log.EXPECT_NEAR(dfExpected, dfAsum, 1e-1, "The absolute sum is wrong.");
+
+                // An unbalanced expression is rejected.
+                rgOps = new List<Tuple<FUSED_OP, double>>();
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.LOAD, 0));
+                rgOps.Add(new Tuple<FUSED_OP, double>(FUSED_OP.ADD, 0));
+
+                bool bError = false;
+
+                try
+                {
+                    m_cuda.fused_expr(nCount, hY, new long[] { hA }, rgOps);
+                }
+                catch (Exception)
+                {
+                    bError = true;
+                }
+
+                m_log.CHECK(bError, "The unbalanced expression should fail.");
+            }
+            finally
+            {
+                m_cuda.FreeMemory(hA);
+                m_cuda.FreeMemory(hB);
+                m_cuda.FreeMemory(hC);
+                m_cuda.FreeMemory(hY);
+            }
+        }
+
+        public void TestStats()
+        {
+            int nCount = 100000;
+            long hA = m_cuda.AllocMemory(nCount);
+            double[] rgA = new double[nCount];
+
+            try
+            {
+                double dfMin = double.MaxValue;
+                double dfMax = -double.MaxValue;
+                double dfSum = 0;
+                double dfSumSq = 0;
+
+                for (int i = 0; i < nCount; i++)
+                {
+                    rgA[i] = ((i * 7919) % 1001) * 0.01 - 5.0;
+                }
+
+                rgA[10] = double.NaN;
+                rgA[20] = double.NaN;
+                rgA[30] = double.PositiveInfinity;
+
+                // The min and max include the Infinity values, the sums do not.
+                for (int i = 0; i < nCount; i++)
+                {
+                    if (double.IsNaN(rgA[i]) || double.IsInfinity(rgA[i]))
+                        continue;
+
+                    dfMin = Math.Min(dfMin, rgA[i]);
+                    dfMax = Math.Max(dfMax, rgA[i]);
+                    dfSum += rgA[i];
+                    dfSumSq += rgA[i] * rgA[i];
+                }
+
+                m_cuda.SetMemory(hA, rgA);
+
+                double[] rgStats = m_cuda.calculate_stats(nCount, hA);
+
+                m_log.CHECK_EQ(6, rgStats.Length, "There should be 6 statistics.");
+                m_log.EXPECT_NEAR(dfMin, rgStats[0], 1e-5, "The minimum is wrong.");
+                m_log.CHECK(double.IsPositiveInfinity(rgStats[1]), "The maximum should be Infinity.");
+                m_log.EXPECT_NEAR(dfSum, rgStats[2], Math.Abs(dfSum) * 1e-4, "The sum is wrong.");
+                m_log.EXPECT_NEAR(dfSumSq, rgStats[3], dfSumSq * 1e-4, "The sum of squares is wrong.");
+                m_log.CHECK_EQ(2, rgStats[4], "There should be 2 NaN values.");
+                m_log.CHECK_EQ(1, rgStats[5], "There should be 1 Infinity value.");
+
+                // minmax shares the same single pass.
+                Tuple<double, double, double, double> minmax = m_cuda.minmax(nCount, hA, 0, 0, true);
+                m_log.EXPECT_NEAR(dfMin, minmax.Item1, 1e-5, "The minmax minimum is wrong.");
+                m_log.CHECK(double.IsPositiveInfinity(minmax.Item2), "The minmax maximum should be Infinity.");
+                m_log.CHECK_EQ(2, minmax.Item3, "The minmax NaN count is wrong.");
+                m_log.CHECK_EQ(1, minmax.Item4, "The minmax Infinity count is wrong.");
+
+                // Without the Infinity value, the max is the finite max.
+                rgA[30] = 0;
+                m_cuda.SetMemory(hA, rgA);
+
+                rgStats = m_cuda.calculate_stats(nCount, hA);
+                m_log.EXPECT_NEAR(dfMax, rgStats[1], 1e-5, "The finite maximum is wrong.");
+                m_log.CHECK_EQ(0, rgStats[5], "There should be no Infinity values.");
+
+                // A -Infinity value is the minimum.
+                rgA[30] = double.NegativeInfinity;
+                m_cuda.SetMemory(hA, rgA);
+
+                minmax = m_cuda.minmax(nCount, hA, 0, 0, true);
+                m_log.CHECK(double.IsNegativeInfinity(minmax.Item1), "The minmax minimum should be -Infinity.");
+                m_log.EXPECT_NEAR(dfMax, minmax.Item2, 1e-5, "The minmax maximum is wrong.");
+
+                // The min and max are not pulled toward 0, so an all positive input
+                // has a positive minimum and an all negative input a negative maximum.
+                for (int i = 0; i < nCount; i++)
+                {
+                    rgA[i] = 1.0 + ((i * 7919) % 1001) * 0.002;
+                }
+
+                m_cuda.SetMemory(hA, rgA);
+
+                minmax = m_cuda.minmax(nCount, hA, 0, 0, true);
+                m_log.EXPECT_NEAR(1.0, minmax.Item1, 1e-5, "The all positive minimum is wrong.");
+                m_log.EXPECT_NEAR(3.0, minmax.Item2, 1e-5, "The all positive maximum is wrong.");
+
+                for (int i = 0; i < nCount; i++)
+                {
+                    rgA[i] = -rgA[i];
+                }
+
+                m_cuda.SetMemory(hA, rgA);
+
+                minmax = m_cuda.minmax(nCount, hA, 0, 0, true);
+                m_log.EXPECT_NEAR(-3.0, minmax.Item1, 1e-5, "The all negative minimum is wrong.");
+                m_log.EXPECT_NEAR(-1.0, minmax.Item2, 1e-5, "The all negative maximum is wrong.");
+            }
+            finally
+            {
+                m_cuda.FreeMemory(hA);
+            }
+        }
+
+        private void checkConvolution(long hExpected, long hActual, int nCount, string strMsg)
+        {
+            double[] rgExpected = convert(m_cuda.GetMemory(hExpected));
+            double[] rgActual = convert(m_cuda.GetMemory(hActual));
+
+            for (int i = 0; i < nCount; i++)
+            {
+                m_log.EXPECT_NEAR(rgExpected[i], rgActual[i], 2e-3, strMsg);
+            }
+        }
+
+        public void TestConvolutionHostWinograd()
+        {
+            int nN = 2;
+            int nC = 3;
+            int nK = 4;
+            int nH = 9;
+            int nW = 11;
+            int nBtmCount = nN * nC * nH * nW;
+            int nTopCount = nN * nK * nH * nW;
+            int nWtCount = nK * nC * 3 * 3;
+            long hCuDnn = m_cuda.CreateCuDNN();
+            long hBottomDesc = m_cuda.CreateTensorDesc();
+            long hTopDesc = m_cuda.CreateTensorDesc();
+            long hFilterDesc = m_cuda.CreateFilterDesc();
+            long hConvDesc = m_cuda.CreateConvolutionDesc();
+            long hBottom = m_cuda.AllocMemory(nBtmCount);
+            long hBottom2 = m_cuda.AllocMemory(nBtmCount);
+            long hTop = m_cuda.AllocMemory(nTopCount);
+            long hTop2 = m_cuda.AllocMemory(nTopCount);
+            long hWeight = m_cuda.AllocMemory(nWtCount);
+
+            try
+            {
+                m_cuda.SetTensorDesc(hBottomDesc, nN, nC, nH, nW);
+                m_cuda.SetTensorDesc(hTopDesc, nN, nK, nH, nW);
+                m_cuda.SetFilterDesc(hFilterDesc, nK, nC, 3, 3);
+                m_cuda.SetConvolutionDesc(hConvDesc, 1, 1, 1, 1);
+
+                m_cuda.rng_uniform(nBtmCount, -1, 1, hBottom);
+                m_cuda.rng_uniform(nTopCount, -1, 1, hTop);
+                m_cuda.rng_uniform(nWtCount, -1, 1, hWeight);
+
+                // Forward, the cuDNN result is the reference.
+                m_cuda.ConvolutionForward(hCuDnn, hBottomDesc, hBottom, 0, hFilterDesc, hWeight, 0, hConvDesc, CONV_FWD_ALGO.IMPLICIT_GEMM, 0, 0, 0, hTopDesc, hTop, 0);
+                m_cuda.ConvolutionForward(hCuDnn, hBottomDesc, hBottom, 0, hFilterDesc, hWeight, 0, hConvDesc, CONV_FWD_ALGO.HOST_WINOGRAD, 0, 0, 0, hTopDesc, hTop2, 0);
+                checkConvolution(hTop, hTop2, nTopCount, "The host Winograd forward result is wrong.");
+
+                // Backward data.
+                m_cuda.ConvolutionBackwardData(hCuDnn, hFilterDesc, hWeight, 0, hTopDesc, hTop, 0, hConvDesc, CONV_BWD_DATA_ALGO.ALGO_0, 0, 0, 0, hBottomDesc, hBottom, 0);
+                m_cuda.ConvolutionBackwardData(hCuDnn, hFilterDesc, hWeight, 0, hTopDesc, hTop, 0, hConvDesc, CONV_BWD_DATA_ALGO.HOST_WINOGRAD, 0, 0, 0, hBottomDesc, hBottom2, 0);
+                checkConvolution(hBottom, hBottom2, nBtmCount, "The host Winograd backward data result is wrong.");
+
+                // Updating the weights must invalidate the cached filter transform.
+                m_cuda.scal(nWtCount, 2.0, hWeight);
+                m_cuda.ConvolutionForward(hCuDnn, hBottomDesc, hBottom, 0, hFilterDesc, hWeight, 0, hConvDesc, CONV_FWD_ALGO.IMPLICIT_GEMM, 0, 0, 0, hTopDesc, hTop, 0);
+                m_cuda.ConvolutionForward(hCuDnn, hBottomDesc, hBottom, 0, hFilterDesc, hWeight, 0, hConvDesc, CONV_FWD_ALGO.HOST_WINOGRAD, 0, 0, 0, hTopDesc, hTop2, 0);
+                checkConvolution(hTop, hTop2, nTopCount, "The host Winograd forward result is wrong after the weight update.");
+
+                // So must a write through a memory pointer into the weights.
+                long hWeightPtr = m_cuda.CreateMemoryPointer(hWeight, nWtCount / 2, nWtCount - nWtCount / 2);
+
+                try
+                {
+                    m_cuda.scal(nWtCount - nWtCount / 2, -0.5, hWeightPtr);
+                }
+                finally
+                {
+                    m_cuda.FreeMemoryPointer(hWeightPtr);
+                }
+
+                m_cuda.ConvolutionForward(hCuDnn, hBottomDesc, hBottom, 0, hFilterDesc, hWeight, 0, hConvDesc, CONV_FWD_ALGO.IMPLICIT_GEMM, 0, 0, 0, hTopDesc, hTop, 0);
+                m_cuda.ConvolutionForward(hCuDnn, hBottomDesc, hBottom, 0, hFilterDesc, hWeight, 0, hConvDesc, CONV_FWD_ALGO.HOST_WINOGRAD, 0, 0, 0, hTopDesc, hTop2, 0);
+                checkConvolution(hTop, hTop2, nTopCount, "The host Winograd forward result is wrong after a write through a memory pointer.");
+            }
+            finally
+            {
+                m_cuda.FreeMemory(hWeight);
+                m_cuda.FreeMemory(hTop2);
+                m_cuda.FreeMemory(hTop);
+                m_cuda.FreeMemory(hBottom2);
+                m_cuda.FreeMemory(hBottom);
+                m_cuda.FreeConvolutionDesc(hConvDesc);
+                m_cuda.FreeFilterDesc(hFilterDesc);
+                m_cuda.FreeTensorDesc(hTopDesc);
+                m_cuda.FreeTensorDesc(hBottomDesc);
+                m_cuda.FreeCuDNN(hCuDnn);
+            }
+        }
+
+        public void TestPoolingCompactMask()
+        {
+            int nN = 2;
+            int nC = 3;
+            int nH = 8;
+            int nW = 8;
+            int nPH = nH / 2;
+            int nPW = nW / 2;
+            int nBtmCount = nN * nC * nH * nW;
+            int nTopCount = nN * nC * nPH * nPW;
+            long hBottom = m_cuda.AllocMemory(nBtmCount);
+            long hBottomDiff = m_cuda.AllocMemory(nBtmCount);
+            long hTop = m_cuda.AllocMemory(nTopCount);
+            long hTopDiff = m_cuda.AllocMemory(nTopCount);
+            long hMask = m_cuda.AllocMemory(nTopCount);
+
+            try
+            {
+                m_cuda.rng_uniform(nBtmCount, -1, 1, hBottom);
+                m_cuda.rng_uniform(nTopCount, -1, 1, hTopDiff);
+
+                double[] rgBottom = convert(m_cuda.GetMemory(hBottom));
+                double[] rgTopDiff = convert(m_cuda.GetMemory(hTopDiff));
+                double[] rgTopExpected = new double[nTopCount];
+                double[] rgBottomDiffExpected = new double[nBtmCount];
+
+                for (int i = 0; i < nTopCount; i++)
+                {
+                    int pw = i % nPW;
+                    int ph = (i / nPW) % nPH;
+                    int nOffset = (i / nPW / nPH) * nH * nW;
+                    int nMaxIdx = -1;
+                    double dfMax = -double.MaxValue;
+
+                    for (int h = ph * 2; h < ph * 2 + 2; h++)
+                    {
+                        for (int w = pw * 2; w < pw * 2 + 2; w++)
+                        {
+                            if (rgBottom[nOffset + h * nW + w] > dfMax)
+                            {
+                                dfMax = rgBottom[nOffset + h * nW + w];
+                                nMaxIdx = nOffset + h * nW + w;
+                            }
+                        }
+                    }
+
+                    rgTopExpected[i] = dfMax;
+                    rgBottomDiffExpected[nMaxIdx] += rgTopDiff[i];
+                }
+
+                // 2x2 stride 2 max pooling runs the specialised kernels, the mask holds one byte per item.
+                m_cuda.pooling_fwd(POOLING_METHOD.MAX, nTopCount, hBottom, nN, nC, nH, nW, nPH, nPW, 2, 2, 2, 2, 0, 0, hTop, hMask, 0, true);
+                m_cuda.pooling_bwd(POOLING_METHOD.MAX, nBtmCount, hTopDiff, nN, nC, nH, nW, nPH, nPW, 2, 2, 2, 2, 0, 0, hBottomDiff, hMask, 0, true);
+
+                double[] rgTop = convert(m_cuda.GetMemory(hTop));
+                double[] rgBottomDiff = convert(m_cuda.GetMemory(hBottomDiff));
+
+                for (int i = 0; i < nTopCount; i++)
+                {
+                    m_log.CHECK_EQ(rgTopExpected[i], rgTop[i], "The compact mask max pooling forward result is wrong.");
+                }
+
+                for (int i = 0; i < nBtmCount; i++)
+                {
+                    m_log.EXPECT_NEAR(rgBottomDiffExpected[i], rgBottomDiff[i], 1e-6, "The compact mask max pooling backward result is wrong.");
+                }
+
+                // The full size mask must give the same results.
+                m_cuda.pooling_fwd(POOLING_METHOD.MAX, nTopCount, hBottom, nN, nC, nH, nW, nPH, nPW, 2, 2, 2, 2, 0, 0, hTop, hMask, 0);
+                m_cuda.pooling_bwd(POOLING_METHOD.MAX, nBtmCount, hTopDiff, nN, nC, nH, nW, nPH, nPW, 2, 2, 2, 2, 0, 0, hBottomDiff, hMask, 0);
+
+                rgBottomDiff = convert(m_cuda.GetMemory(hBottomDiff));
+
+                for (int i = 0; i < nBtmCount; i++)
+                {
+                    m_log.EXPECT_NEAR(rgBottomDiffExpected[i], rgBottomDiff[i], 1e-6, "The max pooling backward result is wrong.");
+                }
+
+                // A window covering the whole image runs the global average kernels.
+                int nChannels = nN * nC;
+                m_cuda.pooling_fwd(POOLING_METHOD.AVE, nChannels, hBottom, nN, nC, nH, nW, 1, 1, nH, nW, 1, 1, 0, 0, hTop, 0, 0);
+                m_cuda.pooling_bwd(POOLING_METHOD.AVE, nBtmCount, hTopDiff, nN, nC, nH, nW, 1, 1, nH, nW, 1, 1, 0, 0, hBottomDiff, 0, 0);
+
+                rgTop = convert(m_cuda.GetMemory(hTop));
+                rgBottomDiff = convert(m_cuda.GetMemory(hBottomDiff));
+
+                for (int i = 0; i < nChannels; i++)
+                {
+                    double dfSum = 0;
+
+                    for (int j = 0; j < nH * nW; j++)
+                    {
+                        dfSum += rgBottom[i * nH * nW + j];
+                    }
+
+                    m_log.EXPECT_NEAR(dfSum / (nH * nW), rgTop[i], 1e-5, "The global average pooling forward result is wrong.");
+
+                    for (int j = 0; j < nH * nW; j++)
+                    {
+                        m_log.EXPECT_NEAR(rgTopDiff[i] / (nH * nW), rgBottomDiff[i * nH * nW + j], 1e-6, "The global average pooling backward result is wrong.");
+                    }
+                }
+            }
+            finally
+            {
+                m_cuda.FreeMemory(hMask);
+                m_cuda.FreeMemory(hTopDiff);
+                m_cuda.FreeMemory(hTop);
+                m_cuda.FreeMemory(hBottomDiff);
+                m_cuda.FreeMemory(hBottom);
+            }
+        }
+
+        public void TestSoftmaxLossFused()
+        {
+            // The classifier head layout (inner num 1) and a spatial layout.
+            int[,] rgShapes = new int[,] { { 3, 1000, 1 }, { 2, 5, 7 } };
+
+            for (int t = 0; t < rgShapes.GetLength(0); t++)
+            {
+                int nOuterNum = rgShapes[t, 0];
+                int nChannels = rgShapes[t, 1];
+                int nInnerNum = rgShapes[t, 2];
+                int nDim = nChannels * nInnerNum;
+                int nCount = nOuterNum * nDim;
+                int nItems = nOuterNum * nInnerNum;
+                int nIgnoreLabel = 3;
+                long hBottom = m_cuda.AllocMemory(nCount);
+                long hProb = m_cuda.AllocMemory(nCount);
+                long hDiff = m_cuda.AllocMemory(nCount);
+                long hLabel = m_cuda.AllocMemory(nItems);
+                long hLoss = m_cuda.AllocMemory(nItems);
+                long hCounts = m_cuda.AllocMemory(nItems);
+
+                try
+                {
+                    Random random = new Random(1701);
+                    double[] rgLabel = new double[nItems];
+
+                    for (int i = 0; i < nItems; i++)
+                    {
+                        rgLabel[i] = random.Next(nChannels);
+                    }
+
+                    rgLabel[0] = nIgnoreLabel;
+
+                    m_cuda.rng_uniform(nCount, -10, 10, hBottom);
+                    m_cuda.SetMemory(hLabel, convert(rgLabel));
+                    m_cuda.softmaxloss_fused(nItems, hBottom, hLabel, hLoss, nOuterNum, nDim, nInnerNum, hCounts, nIgnoreLabel, hProb, hDiff);
+
+                    double[] rgBottom = convert(m_cuda.GetMemory(hBottom));
+                    double[] rgProb = convert(m_cuda.GetMemory(hProb));
+                    double[] rgDiff = convert(m_cuda.GetMemory(hDiff));
+                    double[] rgLoss = convert(m_cuda.GetMemory(hLoss));
+                    double[] rgCounts = convert(m_cuda.GetMemory(hCounts));
+
+                    for (int n = 0; n < nOuterNum; n++)
+                    {
+                        for (int s = 0; s < nInnerNum; s++)
+                        {
+                            int nItem = n * nInnerNum + s;
+                            int nLabel = (int)rgLabel[nItem];
+                            bool bIgnore = (nLabel == nIgnoreLabel);
+                            double dfMax = -double.MaxValue;
+                            double dfSum = 0;
+
+                            for (int c = 0; c < nChannels; c++)
+                            {
+                                dfMax = Math.Max(dfMax, rgBottom[n * nDim + c * nInnerNum + s]);
+                            }
+
+                            for (int c = 0; c < nChannels; c++)
+                            {
+                                dfSum += Math.Exp(rgBottom[n * nDim + c * nInnerNum + s] - dfMax);
+                            }
+
+                            double dfLoss = (bIgnore) ? 0 : dfMax + Math.Log(dfSum) - rgBottom[n * nDim + nLabel * nInnerNum + s];
+
+                            m_log.EXPECT_NEAR(dfLoss, rgLoss[nItem], 1e-4, "The fused softmax loss is wrong.");
+                            m_log.CHECK_EQ((bIgnore) ? 0 : 1, rgCounts[nItem], "The fused softmax loss count is wrong.");
+
+                            for (int c = 0; c < nChannels; c++)
+                            {
+                                int nIdx = n * nDim + c * nInnerNum + s;
+                                double dfProb = Math.Exp(rgBottom[nIdx] - dfMax) / dfSum;
+                                double dfDiff = (bIgnore) ? 0 : (c == nLabel) ? dfProb - 1 : dfProb;
+
+                                m_log.EXPECT_NEAR(dfProb, rgProb[nIdx], 1e-5, "The fused softmax probability is wrong.");
+                                m_log.EXPECT_NEAR(dfDiff, rgDiff[nIdx], 1e-5, "The fused softmax loss gradient is wrong.");
+                            }
+                        }
+                    }
+                }
+                finally
+                {
+                    m_cuda.FreeMemory(hCounts);
+                    m_cuda.FreeMemory(hLoss);
+                    m_cuda.FreeMemory(hLabel);
+                    m_cuda.FreeMemory(hDiff);
+                    m_cuda.FreeMemory(hProb);
+                    m_cuda.FreeMemory(hBottom);
+                }
+            }
+        }
+
+        public void TestUpdateForeach()
+        {
+            foreach (UPDATE_METHOD method in Enum.GetValues(typeof(UPDATE_METHOD)))
+            {
+                testUpdateForeach(method, UPDATE_REGULARIZATION.L2);
+                testUpdateForeach(method, UPDATE_REGULARIZATION.L1);
+            }
+        }
+
+        private void testUpdateForeach(UPDATE_METHOD method, UPDATE_REGULARIZATION reg)
+        {
+            // Sizes below, at and across the chunk size of the foreach kernel.
+            int[] rgnCount = new int[] { 5, 16384, 40000 };
+            double dfGradScale = 0.5;
+            double dfMomentum = 0.9;
+            double dfMomentum2 = 0.999;
+            double dfDelta = (method == UPDATE_METHOD.ADAM) ? 1e-8 : 1e-6;
+            double dfDecay = 0.0005;
+            List<long> rghMem = new List<long>();
+            string strCase = method.ToString() + " with " + reg.ToString();
+
+            try
+            {
+                List<long> rghData = new List<long>();
+                List<long> rghDiff = new List<long>();
+                List<long> rghHistory1 = new List<long>();
+                List<long> rghHistory2 = new List<long>();
+                List<T> rgfLocalRate = new List<T>();
+                List<T> rgfLocalDecay = new List<T>();
+
+                for (int i = 0; i < rgnCount.Length; i++)
+                {
+                    int nCount = rgnCount[i];
+                    double dfRate = 0.01 * (i + 1);
+                    long[] rgh = new long[9];
+
+                    for (int j = 0; j < rgh.Length; j++)
+                    {
+                        rgh[j] = m_cuda.AllocMemory(nCount);
+                        rghMem.Add(rgh[j]);
+                    }
+
+                    // Items 0-3 are updated in one call, items 4-7 with the separate calls
+                    // used by the solvers, and item 8 holds the sign for the L1 decay.
+                    m_cuda.rng_uniform(nCount, -1, 1, rgh[0]);
+                    m_cuda.rng_uniform(nCount, -1, 1, rgh[1]);
+                    m_cuda.rng_uniform(nCount, 0, 1, rgh[2]);
+                    m_cuda.rng_uniform(nCount, 0, 1, rgh[3]);
+
+                    for (int j = 0; j < 4; j++)
+                    {
+                        m_cuda.copy(nCount, rgh[j], rgh[j + 4]);
+                    }
+
+                    m_cuda.scal(nCount, dfGradScale, rgh[5]);
+
+                    if (reg == UPDATE_REGULARIZATION.L2)
+                    {
+                        m_cuda.axpy(nCount, dfDecay, rgh[4], rgh[5]);
+                    }
+                    else if (reg == UPDATE_REGULARIZATION.L1)
+                    {
+                        m_cuda.sign(nCount, rgh[4], rgh[8]);
+                        m_cuda.axpy(nCount, dfDecay, rgh[8], rgh[5]);
+                    }
+
+                    switch (method)
+                    {
+                        case UPDATE_METHOD.SGD:
+                            m_cuda.sgd_update(nCount, rgh[5], rgh[6], convert(dfMomentum), convert(dfRate));
+                            break;
+
+                        case UPDATE_METHOD.NESTEROV:
+                            m_cuda.nesterov_update(nCount, rgh[5], rgh[6], convert(dfMomentum), convert(dfRate));
+                            break;
+
+                        case UPDATE_METHOD.ADAGRAD:
+                            m_cuda.adagrad_update(nCount, rgh[5], rgh[6], convert(dfDelta), convert(dfRate));
+                            break;
+
+                        case UPDATE_METHOD.ADADELTA:
+                            m_cuda.adadelta_update(nCount, rgh[5], rgh[6], rgh[7], convert(dfMomentum), convert(dfDelta), convert(dfRate));
+                            break;
+
+                        case UPDATE_METHOD.ADAM:
+                            m_cuda.adam_update(nCount, rgh[5], rgh[6], rgh[7], convert(dfMomentum), convert(dfMomentum2), convert(dfDelta), convert(dfRate));
+                            break;
+
+                        case UPDATE_METHOD.RMSPROP:
+                            m_cuda.rmsprop_update(nCount, rgh[5], rgh[6], convert(dfMomentum), convert(dfDelta), convert(dfRate));
+                            break;
+                    }
+
+                    m_cuda.axpy(nCount, -1.0, rgh[5], rgh[4]);
+
+                    rghData.Add(rgh[0]);
+                    rghDiff.Add(rgh[1]);
+                    rghHistory1.Add(rgh[2]);
+                    rghHistory2.Add(rgh[3]);
+                    rgfLocalRate.Add(convert(dfRate));
+                    rgfLocalDecay.Add(convert(dfDecay));
+                }
+
+                m_cuda.update_foreach(method, reg, convert(dfGradScale), convert(dfMomentum), convert(dfMomentum2), convert(dfDelta), true, rghData, rghDiff, rghHistory1, rghHistory2, rgnCount.ToList(), rgfLocalRate, rgfLocalDecay);
+
+                for (int i = 0; i < rgnCount.Length; i++)
+                {
+                    for (int j = 0; j < 4; j++)
+                    {
+                        double[] rgActual = convert(m_cuda.GetMemory(rghMem[i * 9 + j]));
+                        double[] rgExpected = convert(m_cuda.GetMemory(rghMem[i * 9 + j + 4]));
+
+                        for (int k = 0; k < rgnCount[i]; k++)
+                        {
+                            double dfTol = 1e-5 * Math.Max(1.0, Math.Abs(rgExpected[k]));
+                            m_log.EXPECT_NEAR(rgExpected[k], rgActual[k], dfTol, "The foreach update is wrong for " + strCase + ".");
+                        }
+                    }
+                }
             }
-
-            if (m_y != null)
+            finally
             {
-                m_y.Dispose();
-                m_y = null;
+                foreach (long hMem in rghMem)
+                {
+                    m_cuda.FreeMemory(hMem);
+                }
             }
-            
-            base.dispose();
         }
 
-        public void TestGemm()
+        public void TestLstmSequence()
         {
-            double[] rgData = new double[] { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
-            double[] A_reshape_data = new double[] { 1, 4, 2, 5, 3, 6 };
-            double[] B_reshape_data = new double[] { 1, 5, 9, 2, 6, 10, 3, 7, 11, 4, 8, 12 };
-            double[] rgResult = new double[] { 38, 44, 50, 56, 83, 98, 113, 128 };
-
-            m_temp.Reshape(new List<int>() { rgData.Length, 1, 1, 1 });
-            m_temp.mutable_cpu_data = convert(rgData);
-            m_cuda.copy(6, m_temp.gpu_data, m_A.mutable_gpu_data);
-            m_cuda.copy(12, m_temp.gpu_data, m_B.mutable_gpu_data);
+            int nT = 4;
+            int nN = 3;
+            int nH = 5;
+            int nI = 6;
+            int nNH = nN * nH;
+            double dfClippingThreshold = 0.1;
+            List<long> rghMem = new List<long>();
 
-            // [1, 2, 3; 4, 5, 6] * [1, 2, 3, 4; 5, 6, 7, 8; 9, 10, 11, 12];
-            m_cuda.gemm(false, false, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+            Func<int, long> alloc = (nCount) =>
+            {
+                long hMem = m_cuda.AllocMemory(nCount);
+                rghMem.Add(hMem);
+                return hMem;
+            };
 
-            for (int i = 0; i < 8; i++)
+            Action<long, long, int, string> compare = (h1, h2, nCount, strName) =>
             {
-                double dfVal = convert(m_C.GetData(i));
-                double dfRes = rgResult[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
-            }
+                double[] rgExpected = convert(m_cuda.GetMemory(h1));
+                double[] rgActual = convert(m_cuda.GetMemory(h2));
 
-            m_cuda.gemm(false, false, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+                for (int i = 0; i < nCount; i++)
+                {
+                    m_log.EXPECT_NEAR(rgExpected[i], rgActual[i], 1e-5, "The sequence " + strName + " is wrong.");
+                }
+            };
 
-            for (int i = 0; i < 8; i++)
+            try
             {
-                double dfVal = convert(m_C.GetData(i));
-                double dfRes = rgResult[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
-            }
+                long hWeight_i = alloc(4 * nH * nI);
+                long hWeight_h = alloc(4 * nH * nH);
+                long hBias = alloc(4 * nH);
+                long hBottom = alloc(nT * nN * nI);
+                long hClip = alloc(nT * nN);
+                long hOnes = alloc(nT * nN);
+                long hH0 = alloc(nNH);
+                long hC0 = alloc(nNH);
+                long hHtoGate = alloc(4 * nNH);
+                long hHtoH = alloc(nNH);
+                long[] rghTop = new long[] { alloc(nT * nNH), alloc(nT * nNH) };
+                long[] rghCell = new long[] { alloc(nT * nNH), alloc(nT * nNH) };
+                long[] rghPreGate = new long[] { alloc(nT * 4 * nNH), alloc(nT * 4 * nNH) };
+                long[] rghGate = new long[] { alloc(nT * 4 * nNH), alloc(nT * 4 * nNH) };
+                long[] rghTopDiff = new long[] { alloc(nT * nNH), alloc(nT * nNH) };
+                long[] rghCellDiff = new long[] { alloc(nT * nNH), alloc(nT * nNH) };
+                long[] rghPreGateDiff = new long[] { alloc(nT * 4 * nNH), alloc(nT * 4 * nNH) };
+                long[] rghGateDiff = new long[] { alloc(nT * 4 * nNH), alloc(nT * 4 * nNH) };
+                long[] rghH0Diff = new long[] { alloc(nNH), alloc(nNH) };
+                long[] rghC0Diff = new long[] { alloc(nNH), alloc(nNH) };
+                double[] rgClip = new double[nT * nN];
+
+                for (int i = 0; i < rgClip.Length; i++)
+                {
+                    rgClip[i] = (i % 4 == 1) ? 0 : 1;
+                }
 
-            // Test when we have a transposed A.
-            m_A.Reshape(1, 1, 3, 2);
-            m_temp.mutable_cpu_data = convert(A_reshape_data);
-            m_cuda.copy(6, m_temp.gpu_data, m_A.mutable_gpu_data);
+                m_cuda.rng_uniform(4 * nH * nI, -0.5, 0.5, hWeight_i);
+                m_cuda.rng_uniform(4 * nH * nH, -0.5, 0.5, hWeight_h);
+                m_cuda.rng_uniform(4 * nH, -0.5, 0.5, hBias);
+                m_cuda.rng_uniform(nT * nN * nI, -1, 1, hBottom);
+                m_cuda.rng_uniform(nNH, -1, 1, hH0);
+                m_cuda.rng_uniform(nNH, -1, 1, hC0);
+                m_cuda.set(nT * nN, hOnes, 1.0);
+                m_cuda.SetMemory(hClip, convert(rgClip));
+
+                // Run with and without the clip data.
+                for (int nClip = 0; nClip < 2; nClip++)
+                {
+                    long hClipData = (nClip == 0) ? 0 : hClip;
 
-            m_cuda.gemm(true, false, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+                    // The per step forward pass, as run by the LSTMSimple layer.
+                    m_cuda.gemm(false, true, nT * nN, 4 * nH, nI, 1.0, hBottom, hWeight_i, 0.0, rghPreGate[0]);
+                    m_cuda.gemm(false, false, nT * nN, 4 * nH, 1, 1.0, hOnes, hBias, 1.0, rghPreGate[0]);
 
-            for (int i = 0; i < 8; i++)
-            {
-                double dfVal = convert(m_C.GetData(i));
-                double dfRes = rgResult[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
-            }
+                    for (int t = 0; t < nT; t++)
+                    {
+                        long hHT1 = (t == 0) ? hH0 : rghTop[0];
+                        long hCT1 = (t == 0) ? hC0 : rghCell[0];
+                        int nT1Offset = (t == 0) ? 0 : -nNH;
 
-            m_cuda.gemm(true, false, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+                        m_cuda.lstm_fwd(t, nN, nH, hWeight_h, hWeight_i, hClipData, t * nN, rghTop[0], t * nNH, rghCell[0], t * nNH, rghPreGate[0], t * 4 * nNH, rghGate[0], t * 4 * nNH, hHT1, nT1Offset, hCT1, nT1Offset, hHtoGate);
+                    }
 
-            for (int i = 0; i < 8; i++)
-            {
-                double dfVal = convert(m_C.GetData(i));
-                double dfRes = rgResult[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
-            }
+                    m_cuda.lstm_seq_fwd(nT, nN, nH, nI, hWeight_i, hWeight_h, hBias, hBottom, hClipData, hH0, hC0, rghTop[1], rghCell[1], rghPreGate[1], rghGate[1], hHtoGate);
 
+                    compare(rghTop[0], rghTop[1], nT * nNH, "top");
+                    compare(rghCell[0], rghCell[1], nT * nNH, "cell");
+                    compare(rghPreGate[0], rghPreGate[1], nT * 4 * nNH, "pre-gate");
+                    compare(rghGate[0], rghGate[1], nT * 4 * nNH, "gate");
 
-            // Test when we have a transposed A and a transposed B too.
-            m_B.Reshape(1, 1, 4, 3);
-            m_temp.mutable_cpu_data = convert(B_reshape_data);
-            m_cuda.copy(12, m_temp.gpu_data, m_B.mutable_gpu_data);
+                    m_cuda.rng_uniform(nT * nNH, -1, 1, rghTopDiff[0]);
+                    m_cuda.rng_uniform(nT * nNH, -1, 1, rghCellDiff[0]);
+                    m_cuda.rng_uniform(nNH, -1, 1, rghH0Diff[0]);
+                    m_cuda.copy(nT * nNH, rghTopDiff[0], rghTopDiff[1]);
+                    m_cuda.copy(nT * nNH, rghCellDiff[0], rghCellDiff[1]);
+                    m_cuda.copy(nNH, rghH0Diff[0], rghH0Diff[1]);
 
-            m_cuda.gemm(true, true, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+                    // The per step backward pass, as run by the LSTMSimple layer.
+                    for (int t = nT - 1; t >= 0; t--)
+                    {
+                        long hCT1 = (t == 0) ? hC0 : rghCell[0];
+                        long hDHT1 = (t == 0) ? rghH0Diff[0] : rghTopDiff[0];
+                        long hDCT1 = (t == 0) ? rghC0Diff[0] : rghCellDiff[0];
+                        int nT1Offset = (t == 0) ? 0 : (t - 1) * nNH;
 
-            for (int i = 0; i < 8; i++)
+                        m_cuda.lstm_bwd(t, nN, nH, dfClippingThreshold, hWeight_h, hClipData, t * nN, rghTopDiff[0], t * nNH, rghCell[0], rghCellDiff[0], t * nNH, rghPreGateDiff[0], t * 4 * nNH, rghGate[0], rghGateDiff[0], t * 4 * nNH, hCT1, nT1Offset, hDHT1, nT1Offset, hDCT1, nT1Offset, hHtoH);
+                    }
+
+                    m_cuda.lstm_seq_bwd(nT, nN, nH, dfClippingThreshold, hWeight_h, hClipData, rghTopDiff[1], rghCell[1], rghCellDiff[1], rghPreGateDiff[1], rghGate[1], rghGateDiff[1], hC0, rghH0Diff[1], rghC0Diff[1], hHtoH);
+
+                    compare(rghTopDiff[0], rghTopDiff[1], nT * nNH, "top diff");
+                    compare(rghCellDiff[0], rghCellDiff[1], nT * nNH, "cell diff");
+                    compare(rghPreGateDiff[0], rghPreGateDiff[1], nT * 4 * nNH, "pre-gate diff");
+                    compare(rghGateDiff[0], rghGateDiff[1], nT * 4 * nNH, "gate diff");
+                    compare(rghH0Diff[0], rghH0Diff[1], nNH, "H0 diff");
+                    compare(rghC0Diff[0], rghC0Diff[1], nNH, "C0 diff");
+                }
+            }
+            finally
             {
-                double dfVal = convert(m_C.GetData(i));
-                double dfRes = rgResult[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+                foreach (long hMem in rghMem)
+                {
+                    m_cuda.FreeMemory(hMem);
+                }
             }
+        }
 
-            m_cuda.gemm(true, true, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+        public void TestRngPhilox()
+        {
+            int nCount = 10000;
+            int nSplit = 1234;
+            long lSeed = 0x123456789AB;
+            long lOffset = 1L << 40;
+            List<long> rghMem = new List<long>();
 
-            for (int i = 0; i < 8; i++)
+            try
             {
-                double dfVal = convert(m_C.GetData(i));
-                double dfRes = rgResult[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
-            }
+                long hA = m_cuda.AllocMemory(nCount);
+                rghMem.Add(hA);
+                long hB = m_cuda.AllocMemory(nSplit);
+                rghMem.Add(hB);
+                long hC = m_cuda.AllocMemory(nCount - nSplit);
+                rghMem.Add(hC);
+                long hD = m_cuda.AllocMemory(nCount);
+                rghMem.Add(hD);
+
+                // The items of a range split between two calls must match those of one call.
+                m_cuda.rng_philox(PHILOX_METHOD.UNIFORM, nCount, convert(-1.0), convert(2.0), lSeed, 3, lOffset, hA);
+                m_cuda.rng_philox(PHILOX_METHOD.UNIFORM, nSplit, convert(-1.0), convert(2.0), lSeed, 3, lOffset, hB);
+                m_cuda.rng_philox(PHILOX_METHOD.UNIFORM, nCount - nSplit, convert(-1.0), convert(2.0), lSeed, 3, lOffset + nSplit, hC);
+                m_cuda.rng_philox(PHILOX_METHOD.UNIFORM, nCount, convert(-1.0), convert(2.0), lSeed, 4, lOffset, hD);
+
+                double[] rgA = convert(m_cuda.GetMemory(hA));
+                double[] rgB = convert(m_cuda.GetMemory(hB));
+                double[] rgC = convert(m_cuda.GetMemory(hC));
+                double[] rgD = convert(m_cuda.GetMemory(hD));
+                double dfSum = 0;
+                int nSame = 0;
+
+                for (int i = 0; i < nCount; i++)
+                {
+                    double dfExpected = (i < nSplit) ? rgB[i] : rgC[i - nSplit];
 
-            // Test when we have a transposed B.
-            m_A.Reshape(1, 1, 2, 3);
-            m_temp.mutable_cpu_data = convert(rgData);
-            m_cuda.copy(6, m_temp.gpu_data, m_A.mutable_gpu_data);
+                    m_log.CHECK_EQ(dfExpected, rgA[i], "The item at " + i.ToString() + " should not depend on how the range is split.");
+                    m_log.CHECK_GE(rgA[i], -1.0, "The uniform items should be >= -1.");
+                    m_log.CHECK_LE(rgA[i], 2.0, "The uniform items should be <= 2.");
 
-            m_cuda.gemm(false, true, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+                    if (rgA[i] == rgD[i])
+                        nSame++;
 
-            for (int i = 0; i < 8; i++)
-            {
-                double dfVal = convert(m_C.GetData(i));
-                double dfRes = rgResult[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
-            }
+                    dfSum += rgA[i];
+                }
 
-            m_cuda.gemm(false, true, 2, 4, 3, 1.0, m_A.gpu_data, m_B.gpu_data, 0.0, m_C.mutable_gpu_data);
+                m_log.EXPECT_NEAR(0.5, dfSum / nCount, 0.05, "The uniform mean is wrong.");
+                m_log.CHECK_LT(nSame, 10, "The streams should differ.");
 
-            for (int i = 0; i < 8; i++)
-            {
-                double dfVal = convert(m_C.GetData(i));
-                double dfRes = rgResult[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
-            }
-        }
+                m_cuda.rng_philox(PHILOX_METHOD.GAUSSIAN, nCount, convert(1.0), convert(2.0), lSeed, 0, 0, hA);
+                rgA = convert(m_cuda.GetMemory(hA));
+                dfSum = 0;
+                double dfSumSq = 0;
 
-        public void TestGemv()
-        {
-            double[] rgData = new double[] { 1, 2, 3, 4, 5, 6 };
-            double[] result_2 = new double[] { 14, 32 };
-            double[] result_3 = new double[] { 9, 12, 15 };
+                for (int i = 0; i < nCount; i++)
+                {
+                    dfSum += rgA[i];
+                    dfSumSq += rgA[i] * rgA[i];
+                }
 
-            m_temp.Reshape(new List<int>() { rgData.Length, 1, 1, 1 });
-            m_temp.mutable_cpu_data = convert(rgData);
-            m_cuda.copy(6, m_temp.gpu_data, m_A.mutable_gpu_data);
-            m_cuda.copy(3, m_temp.gpu_data, m_x.mutable_gpu_data);
+                double dfMean = dfSum / nCount;
+                m_log.EXPECT_NEAR(1.0, dfMean, 0.1, "The gaussian mean is wrong.");
+                m_log.EXPECT_NEAR(2.0, Math.Sqrt(dfSumSq / nCount - dfMean * dfMean), 0.1, "The gaussian standard deviation is wrong.");
 
-            m_cuda.gemv(false, 2, 3, 1.0, m_A.gpu_data, m_x.gpu_data, 0.0, m_y.mutable_gpu_data);
+                // Streams past 22 bits would not be exact in the float parameters.
+                bool bRejected = false;
 
-            for (int i = 0; i < 2; i++)
+                try
+                {
+                    m_cuda.rng_philox(PHILOX_METHOD.UNIFORM, nCount, convert(-1.0), convert(2.0), lSeed, 0x400000, lOffset, hA);
+                }
+                catch (ArgumentOutOfRangeException)
+                {
+                    bRejected = true;
+                }
+
+                m_log.CHECK(bRejected, "A stream past 22 bits should be rejected.");
+            }
+            finally
             {
-                double dfVal = convert(m_y.GetData(i));
-                double dfRes = result_2[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+                foreach (long hMem in rghMem)
+                {
+                    m_cuda.FreeMemory(hMem);
+                }
             }
+        }
 
-            m_cuda.gemv(false, 2, 3, 1.0, m_A.gpu_data, m_x.gpu_data, 0.0, m_y.mutable_gpu_data);
+        public void TestDropoutBits()
+        {
+            int nCount = 1000;
+            double dfRatio = 0.3;
+            double dfScale = 1.0 / (1.0 - dfRatio);
+            uint uiThreshold = (uint)(uint.MaxValue * dfRatio);
+            long lSeed = 1701;
+            long lOffset = 5000;
+            List<long> rghMem = new List<long>();
 
-            for (int i = 0; i < 2; i++)
+            Func<int, long> alloc = (n) =>
             {
-                double dfVal = convert(m_y.GetData(i));
-                double dfRes = result_2[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
-            }
+                long hMem = m_cuda.AllocMemory(n);
+                rghMem.Add(hMem);
+                return hMem;
+            };
 
+            try
+            {
+                long hBottom = alloc(nCount);
+                long hTopDiff = alloc(nCount);
+                long hMaskBits = alloc((nCount + 31) / 32);
+                long hTop1 = alloc(nCount);
+                long hTop2 = alloc(nCount);
+                long hDiff1 = alloc(nCount);
+                long hDiff2 = alloc(nCount);
+
+                m_cuda.rng_uniform(nCount, 1.0, 2.0, hBottom);
+                m_cuda.set(nCount, hTopDiff, 1.0);
+
+                m_cuda.dropout_fwd_bits(nCount, hBottom, hMaskBits, uiThreshold, convert(dfScale), lSeed, 0, lOffset, hTop1);
+                m_cuda.dropout_fwd_bits(nCount, hBottom, 0, uiThreshold, convert(dfScale), lSeed, 0, lOffset, hTop2);
+                m_cuda.dropout_bwd_bits(nCount, hTopDiff, hMaskBits, uiThreshold, convert(dfScale), lSeed, 0, lOffset, hDiff1);
+                m_cuda.dropout_bwd_bits(nCount, hTopDiff, 0, uiThreshold, convert(dfScale), lSeed, 0, lOffset, hDiff2);
+
+                double[] rgBottom = convert(m_cuda.GetMemory(hBottom));
+                double[] rgTop1 = convert(m_cuda.GetMemory(hTop1));
+                double[] rgTop2 = convert(m_cuda.GetMemory(hTop2));
+                double[] rgDiff1 = convert(m_cuda.GetMemory(hDiff1));
+                double[] rgDiff2 = convert(m_cuda.GetMemory(hDiff2));
+                int nDropped = 0;
+
+                for (int i = 0; i < nCount; i++)
+                {
+                    m_log.CHECK_EQ(rgTop1[i], rgTop2[i], "The top at " + i.ToString() + " should not depend on the bit mask.");
+                    m_log.CHECK_EQ(rgDiff1[i], rgDiff2[i], "The mask made again should match the bit mask at " + i.ToString() + ".");
 
-            // Test transpose case
-            m_cuda.copy(2, m_temp.gpu_data, m_y.mutable_gpu_data);
-
-            m_cuda.gemv(true, 2, 3, 1.0, m_A.gpu_data, m_y.gpu_data, 0.0, m_x.mutable_gpu_data);
+                    if (rgTop1[i] == 0)
+                    {
+                        m_log.CHECK_EQ(0, rgDiff1[i], "The diff of a dropped item should be 0.");
+                        nDropped++;
+                    }
+                    else
+                    {
+                        m_log.EXPECT_NEAR(rgBottom[i] * dfScale, rgTop1[i], 1e-5, "The kept item should be scaled.");
+                        m_log.EXPECT_NEAR(dfScale, rgDiff1[i], 1e-5, "The diff of a kept item should be scaled.");
+                    }
+                }
 
-            for (int i = 0; i < 3; i++)
+                m_log.EXPECT_NEAR(dfRatio, (double)nDropped / nCount, 0.06, "The dropout ratio is wrong.");
+            }
+            finally
             {
-                double dfVal = convert(m_x.GetData(i));
-                double dfRes = result_3[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+                foreach (long hMem in rghMem)
+                {
+                    m_cuda.FreeMemory(hMem);
+                }
             }
+        }
 
-            m_cuda.gemv(true, 2, 3, 1.0, m_A.gpu_data, m_y.gpu_data, 0.0, m_x.mutable_gpu_data);
+        public void TestHostSoftmaxLoss()
+        {
+            double dfTol = (typeof(T) == typeof(double)) ? 1e-8 : 1e-4;
 
-            for (int i = 0; i < 3; i++)
+            // Rows of classes (0) and spatial maps (1).
+            for (int nShape = 0; nShape < 2; nShape++)
             {
-                double dfVal = convert(m_x.GetData(i));
-                double dfRes = result_3[i];
-                m_log.CHECK_EQ(dfVal, dfRes, "The value does not match the expected result.");
+                double dfDiff = m_cuda.CheckHostBlas(HOSTBLAS_CHECK.SOFTMAXLOSS, nShape);
+                m_log.CHECK_LE(dfDiff, dfTol, "The host softmax loss does not match the GPU at shape " + nShape.ToString() + ".");
             }
         }
 
-        public void TestMemoryTestByBlock()
+        public void TestHostUpdateForeach()
         {
-            ulong ulTotalBlocks;
-            double dfTotalMemAllocated;
-            ulong ulMemStartAddr;
-            ulong ulBlockSize;
-            long hMemTest = m_cuda.CreateMemoryTest(out ulTotalBlocks, out dfTotalMemAllocated, out ulMemStartAddr, out ulBlockSize);
+            double dfTol = (typeof(T) == typeof(double)) ? 1e-10 : 1e-4;
 
-            for (ulong ulIdx = 0; ulIdx < ulTotalBlocks; ulIdx++)
+            foreach (UPDATE_METHOD method in Enum.GetValues(typeof(UPDATE_METHOD)))
             {
-                T[] rg = m_cuda.RunMemoryTest(hMemTest, MEMTEST_TYPE.MOV_INV_8, ulIdx, 1, true, true, true, true);
-                double[] rgData = convert(rg);
-
-                ulong ulStartAddr = (ulong)rgData[0];
-                ulong ulAddrCount = (ulong)rgData[1];
-                int nErrCount = (int)rgData[2];
-
-                Trace.WriteLine("Start address = 0x" + ulStartAddr.ToString("X"));
-                Trace.WriteLine("address count = " + ulAddrCount.ToString("N0"));
-                Trace.WriteLine("error count = " + nErrCount.ToString("N0"));
+                double dfDiff = m_cuda.CheckHostBlas(HOSTBLAS_CHECK.UPDATE_FOREACH, (int)method);
+                m_log.CHECK_LE(dfDiff, dfTol, "The host foreach update does not match the GPU for " + method.ToString() + ".");
+            }
+        }
 
-                for (int i = 0; i < nErrCount; i++)
-                {
-                    Trace.WriteLine("error address " + i.ToString() + " = " + rgData[3 + i].ToString("X"));
-                }
+        public void TestHostLstmSequence()
+        {
+            double dfTol = (typeof(T) == typeof(double)) ? 1e-9 : 1e-4;
 
-                double dfPct = (double)ulIdx / (double)ulTotalBlocks;
-                Trace.WriteLine("Percentage Complete: " + dfPct.ToString("P"));
+            // Without clip data (0) and with clip data, bias and gradient clipping (1).
+            for (int nClip = 0; nClip < 2; nClip++)
+            {
+                double dfDiff = m_cuda.CheckHostBlas(HOSTBLAS_CHECK.LSTM_SEQ, nClip);
+                m_log.CHECK_LE(dfDiff, dfTol, "The host LSTM sequence does not match the GPU with clip option " + nClip.ToString() + ".");
             }
-
-            m_cuda.FreeMemoryTest(hMemTest);
         }
 
-        public void TestMemoryTestAll()
+        public void TestHostRngPhilox()
         {
-            ulong ulTotalBlocks;
-            double dfTotalMemAllocated;
-            ulong ulMemStartAddr;
-            ulong ulBlockSize;
-            long hMemTest = m_cuda.CreateMemoryTest(out ulTotalBlocks, out dfTotalMemAllocated, out ulMemStartAddr, out ulBlockSize);
+            double dfTol = (typeof(T) == typeof(double)) ? 1e-10 : 1e-4;
 
-            T[] rg = m_cuda.RunMemoryTest(hMemTest, MEMTEST_TYPE.MOV_INV_8, 0, ulTotalBlocks, true, true, true, true);
-            double[] rgData = convert(rg);
+            foreach (PHILOX_METHOD method in Enum.GetValues(typeof(PHILOX_METHOD)))
+            {
+                double dfDiff = m_cuda.CheckHostBlas(HOSTBLAS_CHECK.RNG_PHILOX, (int)method);
 
-            ulong ulStartAddr = (ulong)rgData[0];
-            ulong ulAddrCount = (ulong)rgData[1];
-            int nErrCount = (int)rgData[2];
+                // The bernoulli items are 0 or 1, so any difference is a wrong item.
+                if (method == PHILOX_METHOD.BERNOULLI)
+                    m_log.CHECK_EQ(dfDiff, 0, "The host Philox bernoulli items do not match the GPU.");
+                else
+                    m_log.CHECK_LE(dfDiff, dfTol, "The host Philox items do not match the GPU for " + method.ToString() + ".");
+            }
+        }
 
-            Trace.WriteLine("Start address = 0x" + ulStartAddr.ToString("X"));
-            Trace.WriteLine("address count = " + ulAddrCount.ToString("N0"));
-            Trace.WriteLine("error count = " + nErrCount.ToString("N0"));
+        public void TestHostPooling()
+        {
+            double dfTol = (typeof(T) == typeof(double)) ? 1e-10 : 1e-5;
 
-            for (int i = 0; i < nErrCount; i++)
+            // The 2x2/s2, 3x3/s2, 3x3/s2 pad 1 and 3x3/s1 pad 1 windows (0-3), a generic window (4) and a global window (5).
+            for (int nGeometry = 0; nGeometry < 6; nGeometry++)
             {
-                Trace.WriteLine("error address " + i.ToString() + " = " + rgData[3 + i].ToString("X"));
+                double dfDiff = m_cuda.CheckHostBlas(HOSTBLAS_CHECK.POOLING, nGeometry);
+                m_log.CHECK_LE(dfDiff, dfTol, "The host pooling does not match the GPU with geometry " + nGeometry.ToString() + ".");
             }
-
-            m_cuda.FreeMemoryTest(hMemTest);
         }
 
         public void TestMemoryPointers()
@@ -1761,5 +3626,91 @@ namespace MyCaffe.test
                 m_log.CHECK_EQ(rgExpected[i], rgDataC[i], "The values at " + i.ToString() + " are not as expected.");
             }
         }
+
+        private long waitForVersion(long hAvg, long hStream, Blob<T> dst, long lVersion)
+        {
+            Stopwatch sw = new Stopwatch();
+            sw.Start();
+
+            while (sw.ElapsedMilliseconds < 5000)
+            {
+                long lPulled = m_cuda.ModelAveragerPull(hAvg, hStream, dst.mutable_gpu_data);
+                if (lPulled >= lVersion)
+                    return lPulled;
+
+                Thread.Sleep(10);
+            }
+
+            return -1;
+        }
+
+        public void TestModelAverager()
+        {
+            int nCount = 1000;
+            Blob<T> master = new Blob<T>(m_cuda, m_log, nCount, 1, 1, 1);
+            Blob<T> delta = new Blob<T>(m_cuda, m_log, nCount, 1, 1, 1);
+            long hStream = m_cuda.CreateStream();
+            long hAvg = 0;
+
+            try
+            {
+                m_cuda.set(nCount, master.mutable_gpu_data, 1.0);
+
+                // Two workers, each mixed in at 0.5 with deltas at most one version old.
+                hAvg = m_cuda.CreateModelAverager(nCount, master.gpu_data, 2, 1, 4, new List<double>() { 0.5, 0.5 });
+
+                m_cuda.set(nCount, delta.mutable_gpu_data, 2.0);
+                m_log.CHECK(m_cuda.ModelAveragerPush(hAvg, hStream, 0, delta.gpu_data, 0), "The push should be accepted.");
+                m_cuda.SynchronizeStream(hStream);
+                m_log.CHECK_EQ(waitForVersion(hAvg, hStream, master, 1), 1, "The master should be at version 1.");
+
+                double[] rgData = convert(master.update_cpu_data());
+                for (int i = 0; i < nCount; i++)
+                {
+                    m_log.CHECK_EQ(rgData[i], 2.0, "The master value is incorrect.");
+                }
+
+                // Computed from version 0, one version behind and still applied.
+                m_cuda.set(nCount, delta.mutable_gpu_data, 4.0);
+                m_log.CHECK(m_cuda.ModelAveragerPush(hAvg, hStream, 1, delta.gpu_data, 0), "The push should be accepted.");
+                m_cuda.SynchronizeStream(hStream);
+                m_log.CHECK_EQ(waitForVersion(hAvg, hStream, master, 2), 2, "The master should be at version 2.");
+
+                rgData = convert(master.update_cpu_data());
+                for (int i = 0; i < nCount; i++)
+                {
+                    m_log.CHECK_EQ(rgData[i], 4.0, "The master value is incorrect.");
+                }
+
+                // Computed from version 0, now two versions behind and dropped.
+                m_log.CHECK(m_cuda.ModelAveragerPush(hAvg, hStream, 0, delta.gpu_data, 0), "The push should be accepted.");
+                m_cuda.SynchronizeStream(hStream);
+
+                Stopwatch sw = new Stopwatch();
+                sw.Start();
+
+                double[] rgStats = convert(m_cuda.GetModelAveragerStats(hAvg));
+                while (rgStats[3] < 1 && sw.ElapsedMilliseconds < 5000)
+                {
+                    Thread.Sleep(10);
+                    rgStats = convert(m_cuda.GetModelAveragerStats(hAvg));
+                }
+
+                m_log.CHECK_EQ(rgStats[0], 2, "The version should still be 2.");
+                m_log.CHECK_EQ(rgStats[1], 3, "There should have been 3 pushes.");
+                m_log.CHECK_EQ(rgStats[2], 2, "There should have been 2 deltas applied.");
+                m_log.CHECK_EQ(rgStats[3], 1, "There should have been 1 stale delta dropped.");
+                m_log.CHECK_EQ(rgStats[7], 0, "There should be no error.");
+            }
+            finally
+            {
+                if (hAvg != 0)
+                    m_cuda.FreeModelAverager(hAvg);
+
+                m_cuda.FreeStream(hStream);
+                master.Dispose();
+                delta.Dispose();
+            }
+        }
     }
 }
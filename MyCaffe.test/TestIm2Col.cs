@@ -29,6 +29,24 @@ namespace MyCaffe.test
                 test.Dispose();
             }
         }
+
+        [TestMethod]
+        public void Test2DCol2Im()
+        {
+            Im2ColTest test = new Im2ColTest();
+
+            try
+            {
+                foreach (IIm2ColTest t in test.Tests)
+                {
+                    t.Test2DCol2Im();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
     }
 
     class Im2ColTest : TestBase
@@ -50,6 +68,7 @@ namespace MyCaffe.test
     interface IIm2ColTest
     {
         void Test2D();
+        void Test2DCol2Im();
     }
 
     class Im2ColTest<T> : Test<T>, IIm2ColTest
@@ -266,6 +285,88 @@ namespace MyCaffe.test
             }
         }
 
+        public void Test2DCol2Im()
+        {
+            // Reshape the blobs to correct size for the col2im input.
+            m_blobTop.Reshape(m_blobBottom.num,
+                              m_nChannels * m_nKernelSize * m_nKernelSize,
+                              m_nHeightCol,
+                              m_nWidthCol);
+            m_blobTopCpu.ReshapeLike(m_blobBottom);
+
+            FillerParameter fp = new FillerParameter("uniform");
+            Filler<T> filler = Filler<T>.Create(m_cuda, m_log, fp);
+            filler.Fill(m_blobTop);
+
+            Blob<T> blobBottomNd = new Blob<T>(m_cuda, m_log);
+            blobBottomNd.ReshapeLike(m_blobBottom);
+
+            try
+            {
+                // 2D version
+                for (int n = 0; n < m_blobBottom.num; n++)
+                {
+                    m_cuda.col2im(m_blobTop.gpu_data,
+                                  m_blobTop.offset(n),
+                                  m_nChannels,
+                                  m_nHeight,
+                                  m_nWidth,
+                                  m_nKernelSize, m_nKernelSize,
+                                  m_nPad, m_nPad,
+                                  m_nStride, m_nStride,
+                                  m_nDilation, m_nDilation,
+                                  m_blobTopCpu.mutable_gpu_data,
+                                  m_blobTopCpu.offset(n));
+                }
+
+                int nImCount = m_nChannels * m_nHeight * m_nWidth;
+                T[] rgFirst = null;
+
+                // ND Version, run twice so that the second run uses the cached tables.
+                for (int nPass = 0; nPass < 2; nPass++)
+                {
+                    for (int n = 0; n < m_blobBottom.num; n++)
+                    {
+                        m_cuda.col2im_nd(m_blobTop.gpu_data,
+                                      m_blobTop.offset(n),
+                                      2,
+                                      nImCount,
+                                      1,
+                                      m_blobBottom.gpu_shape,
+                                      m_blobTop.gpu_shape,
+                                      m_blobKernelShape.gpu_data,
+                                      m_blobPad.gpu_data,
+                                      m_blobStride.gpu_data,
+                                      m_blobDilation.gpu_data,
+                                      blobBottomNd.mutable_gpu_data,
+                                      blobBottomNd.offset(n));
+                    }
+
+                    T[] rgBottom = blobBottomNd.update_cpu_data();
+                    T[] rgBottomCpu = m_blobTopCpu.update_cpu_data();
+
+                    m_log.CHECK_EQ(rgBottom.Length, rgBottomCpu.Length, "The bottom lengths must be the same.");
+
+                    for (int i = 0; i < rgBottom.Length; i++)
+                    {
+                        double df1 = (double)Convert.ChangeType(rgBottom[i], typeof(double));
+                        double df2 = (double)Convert.ChangeType(rgBottomCpu[i], typeof(double));
+
+                        m_log.EXPECT_NEAR(df1, df2, 1e-5, "The values at " + i.ToString() + " are not equal.");
+
+                        if (rgFirst != null)
+                            m_log.CHECK(rgBottom[i].Equals(rgFirst[i]), "The col2im_nd result should be deterministic at " + i.ToString() + ".");
+                    }
+
+                    rgFirst = rgBottom;
+                }
+            }
+            finally
+            {
+                blobBottomNd.Dispose();
+            }
+        }
+
         private int CAFFE_GET_BLOCKS(int n)
         {
             return (n + 512 - 1) / 512;
@@ -54,12 +54,126 @@ namespace MyCaffe.test
                 test.Dispose();
             }
         }
+
+        [TestMethod]
+        public void TestAllReduceBuckets()
+        {
+            NCCLTest test = new NCCLTest();
+
+            try
+            {
+                foreach (INcclTest t in test.Tests)
+                {
+                    t.TestAllReduceBuckets();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestAllReduceBucketsFlush()
+        {
+            NCCLTest test = new NCCLTest();
+
+            try
+            {
+                foreach (INcclTest t in test.Tests)
+                {
+                    t.TestAllReduceBucketsFlush();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestAllReduceCompressed()
+        {
+            NCCLTest test = new NCCLTest();
+
+            try
+            {
+                foreach (INcclTest t in test.Tests)
+                {
+                    t.TestAllReduceCompressed();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestAllReduceCompressedTopK()
+        {
+            NCCLTest test = new NCCLTest();
+
+            try
+            {
+                foreach (INcclTest t in test.Tests)
+                {
+                    t.TestAllReduceCompressedTopK();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestAllReduceHierarchical()
+        {
+            NCCLTest test = new NCCLTest();
+
+            try
+            {
+                foreach (INcclTest t in test.Tests)
+                {
+                    t.TestAllReduceHierarchical();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
+
+        [TestMethod]
+        public void TestHierarchyLayout()
+        {
+            NCCLTest test = new NCCLTest();
+
+            try
+            {
+                foreach (INcclTest t in test.Tests)
+                {
+                    t.TestHierarchyLayout();
+                }
+            }
+            finally
+            {
+                test.Dispose();
+            }
+        }
     }
 
     interface INcclTest : ITest
     {
         void TestBroadcast();
         void TestAllReduce();
+        void TestAllReduceBuckets();
+        void TestAllReduceBucketsFlush();
+        void TestAllReduceCompressed();
+        void TestAllReduceCompressedTopK();
+        void TestAllReduceHierarchical();
+        void TestHierarchyLayout();
     }
 
     class NCCLTest : TestBase
@@ -93,6 +207,9 @@ namespace MyCaffe.test
         int m_nGpu1 = 3;
         int m_nGpu2 = 4;
         int m_nDataCount = 4000000;
+        int m_nTopKCount = 12800;
+        int m_nBucketPasses = 1;
+        NCCL_COMPRESSION m_compression = NCCL_COMPRESSION.NONE;
 
         public NCCLTest(string strName, int nDeviceID, EngineParameter.Engine engine)
             : base(strName, new List<int>() { 1000, 1, 1, 1 }, nDeviceID)
@@ -316,5 +433,536 @@ namespace MyCaffe.test
             data.Dispose();
             cuda.Dispose();
         }
+
+        private List<Blob<T>> createBucketGradients(CudaDnn<T> cuda, double dfFill)
+        {
+            // Mix tiny (bias-like) and large gradients so that several
+            //  buckets are created, some holding many gradients.
+            List<int> rgCounts = new List<int>() { 10, 1000, 300000, 20, 50000 };
+            List<Blob<T>> rgGrad = new List<Blob<T>>();
+            Filler<T> filler = Filler<T>.Create(cuda, m_log, new FillerParameter("constant", dfFill));
+
+            foreach (int nCount in rgCounts)
+            {
+                Blob<T> grad = new Blob<T>(cuda, m_log, nCount, 1, 1, 1);
+                filler.Fill(grad);
+                rgGrad.Add(grad);
+            }
+
+            return rgGrad;
+        }
+
+        private int reduceBuckets(CudaDnn<T> cuda, long hNccl, long hStream, List<Blob<T>> rgGrad)
+        {
+            List<long> rghGrad = new List<long>();
+            List<int> rgnCount = new List<int>();
+
+            foreach (Blob<T> grad in rgGrad)
+            {
+                rghGrad.Add(grad.mutable_gpu_data);
+                rgnCount.Add(grad.count());
+            }
+
+            int nBuckets = cuda.NcclSetBuckets(hNccl, rghGrad, rgnCount, NCCL_REDUCTION_OP.SUM, 1.0, 1024 * 1024);
+
+            for (int nPass = 0; nPass < m_nBucketPasses; nPass++)
+            {
+                for (int i = 0; i < rgGrad.Count; i++)
+                {
+                    cuda.NcclMarkReady(hNccl, hStream, i);
+                }
+
+                // Flushing after every gradient was marked must not reduce the buckets again.
+                if (m_nBucketPasses > 1)
+                    cuda.NcclAllReduceBuckets(hNccl, hStream);
+            }
+
+            cuda.SynchronizeStream(hStream);
+            cuda.NcclFreeBuckets(hNccl);
+
+            return nBuckets;
+        }
+
+        private int processTestReduceBuckets(object arg)
+        {
+            Tuple<long, long> param = arg as Tuple<long, long>;
+            CudaDnn<T> cuda = new CudaDnn<T>(m_nGpu2);
+            long hStream = cuda.CreateStream();
+
+            List<Blob<T>> rgGrad = createBucketGradients(cuda, 2.0);
+
+            long hNccl2 = cuda.KernelCopyNccl(param.Item1, param.Item2);
+            m_evtThreadCreated.Set();
+
+            reduceBuckets(cuda, hNccl2, hStream, rgGrad);
+            m_evtNcclDone.Set();
+
+            while (!m_evtCancel.WaitOne(50))
+            {
+            }
+
+            cuda.FreeNCCL(hNccl2);
+            cuda.FreeStream(hStream);
+
+            foreach (Blob<T> grad in rgGrad)
+            {
+                grad.Dispose();
+            }
+
+            cuda.Dispose();
+
+            return 0;
+        }
+
+        public void TestAllReduceBuckets()
+        {
+            if (!setGpus())
+            {
+                m_log.WriteLine("WARNING: You must have 2 P2P capable GPU's that do not have a monitor connected to perform NCCL tests.");
+                return;
+            }
+
+            CudaDnn<T> cuda = new CudaDnn<T>(m_nGpu1);
+            long hNccl1 = cuda.CreateNCCL(m_nGpu1, 2, 0, m_guid);
+            long hNccl2 = cuda.CreateNCCL(m_nGpu2, 2, 1, m_guid);
+            long hStream = cuda.CreateStream();
+
+            List<Blob<T>> rgGrad = createBucketGradients(cuda, 1.0);
+
+            cuda.NcclInitializeSingleProcess(hNccl1, hNccl2);
+            m_evtNcclInitialized.Set();
+
+            m_task1 = Task.Factory.StartNew(new Func<object, int>(processTestReduceBuckets), new Tuple<long, long>(cuda.KernelHandle, hNccl2));
+            m_evtThreadCreated.WaitOne();
+
+            int nBuckets = reduceBuckets(cuda, hNccl1, hStream, rgGrad);
+            m_evtNcclDone.WaitOne();
+
+            m_log.CHECK_GT(nBuckets, 1, "There should be more than one bucket.");
+            m_log.CHECK_LT(nBuckets, rgGrad.Count, "Some buckets should hold more than one gradient.");
+
+            // Each gradient should hold the sum of the 1's
+            //  from this thread and the 2's from the test thread.
+            foreach (Blob<T> grad in rgGrad)
+            {
+                double[] rgData = convert(grad.update_cpu_data());
+
+                for (int i = 0; i < rgData.Length; i++)
+                {
+                    Assert.AreEqual(rgData[i], 3.0);
+                }
+            }
+
+            m_evtCancel.Set();
+            cuda.FreeNCCL(hNccl1);
+            cuda.FreeNCCL(hNccl2);
+            cuda.FreeStream(hStream);
+
+            foreach (Blob<T> grad in rgGrad)
+            {
+                grad.Dispose();
+            }
+
+            cuda.Dispose();
+        }
+
+        public void TestAllReduceBucketsFlush()
+        {
+            if (!setGpus())
+            {
+                m_log.WriteLine("WARNING: You must have 2 P2P capable GPU's that do not have a monitor connected to perform NCCL tests.");
+                return;
+            }
+
+            CudaDnn<T> cuda = new CudaDnn<T>(m_nGpu1);
+            long hNccl1 = cuda.CreateNCCL(m_nGpu1, 2, 0, m_guid);
+            long hNccl2 = cuda.CreateNCCL(m_nGpu2, 2, 1, m_guid);
+            long hStream = cuda.CreateStream();
+
+            List<Blob<T>> rgGrad = createBucketGradients(cuda, 1.0);
+
+            cuda.NcclInitializeSingleProcess(hNccl1, hNccl2);
+            m_evtNcclInitialized.Set();
+
+            m_nBucketPasses = 2;
+            m_task1 = Task.Factory.StartNew(new Func<object, int>(processTestReduceBuckets), new Tuple<long, long>(cuda.KernelHandle, hNccl2));
+            m_evtThreadCreated.WaitOne();
+
+            reduceBuckets(cuda, hNccl1, hStream, rgGrad);
+            m_evtNcclDone.WaitOne();
+
+            // The first pass sums the 1's and 2's to 3 on both ranks, and the
+            //  second pass sums those to 6.  A flush that reduced the launched
+            //  buckets again would double the sums.
+            foreach (Blob<T> grad in rgGrad)
+            {
+                double[] rgData = convert(grad.update_cpu_data());
+
+                for (int i = 0; i < rgData.Length; i++)
+                {
+                    Assert.AreEqual(rgData[i], 6.0);
+                }
+            }
+
+            m_evtCancel.Set();
+            cuda.FreeNCCL(hNccl1);
+            cuda.FreeNCCL(hNccl2);
+            cuda.FreeStream(hStream);
+
+            foreach (Blob<T> grad in rgGrad)
+            {
+                grad.Dispose();
+            }
+
+            cuda.Dispose();
+        }
+
+        private int processTestReduceCompressed(object arg)
+        {
+            Tuple<long, long> param = arg as Tuple<long, long>;
+            CudaDnn<T> cuda = new CudaDnn<T>(m_nGpu2);
+            long hStream = cuda.CreateStream();
+
+            Blob<T> data = new Blob<T>(cuda, m_log, m_nDataCount, 1, 1, 1);
+            Filler<T> filler = Filler<T>.Create(cuda, m_log, new FillerParameter("constant", 2.0));
+            filler.Fill(data);
+
+            long hNccl2 = cuda.KernelCopyNccl(param.Item1, param.Item2);
+            cuda.NcclSetCompression(hNccl2, m_compression);
+            m_evtThreadCreated.Set();
+
+            cuda.NcclAllReduce(hNccl2, hStream, data.mutable_gpu_data, data.count(), NCCL_REDUCTION_OP.SUM);
+            cuda.SynchronizeStream(hStream);
+            m_evtNcclDone.Set();
+
+            while (!m_evtCancel.WaitOne(50))
+            {
+            }
+
+            cuda.NcclSetCompression(hNccl2, NCCL_COMPRESSION.NONE);
+            cuda.FreeNCCL(hNccl2);
+            cuda.FreeStream(hStream);
+            data.Dispose();
+            cuda.Dispose();
+
+            return 0;
+        }
+
+        public void TestAllReduceCompressed()
+        {
+            if (!setGpus())
+            {
+                m_log.WriteLine("WARNING: You must have 2 P2P capable GPU's that do not have a monitor connected to perform NCCL tests.");
+                return;
+            }
+
+            List<NCCL_COMPRESSION> rgCompression = new List<NCCL_COMPRESSION>() { NCCL_COMPRESSION.FP16, NCCL_COMPRESSION.BF16 };
+
+            foreach (NCCL_COMPRESSION compression in rgCompression)
+            {
+                m_compression = compression;
+
+                CudaDnn<T> cuda = new CudaDnn<T>(m_nGpu1);
+                long hNccl1 = cuda.CreateNCCL(m_nGpu1, 2, 0, m_guid);
+                long hNccl2 = cuda.CreateNCCL(m_nGpu2, 2, 1, m_guid);
+                long hStream = cuda.CreateStream();
+
+                Blob<T> data = new Blob<T>(cuda, m_log, m_nDataCount, 1, 1, 1);
+                Filler<T> filler = Filler<T>.Create(cuda, m_log, new FillerParameter("constant", 1.0));
+                filler.Fill(data);
+
+                cuda.NcclInitializeSingleProcess(hNccl1, hNccl2);
+                cuda.NcclSetCompression(hNccl1, compression);
+                m_evtNcclInitialized.Set();
+
+                m_task1 = Task.Factory.StartNew(new Func<object, int>(processTestReduceCompressed), new Tuple<long, long>(cuda.KernelHandle, hNccl2));
+                m_evtThreadCreated.WaitOne();
+
+                cuda.NcclAllReduce(hNccl1, hStream, data.mutable_gpu_data, data.count(), NCCL_REDUCTION_OP.SUM);
+                cuda.SynchronizeStream(hStream);
+                m_evtNcclDone.WaitOne();
+
+                // 1's and 2's (and their sum) are exact in both
+                //  FP16 and BF16, so no precision is lost.
+                double[] rgData = convert(data.update_cpu_data());
+
+                for (int i = 0; i < data.count(); i++)
+                {
+                    Assert.AreEqual(rgData[i], 3.0);
+                }
+
+                double[] rgStats = convert(cuda.NcclGetCompressionStats(hNccl1));
+                double dfExpectedRatio = 2.0 / ((typeof(T) == typeof(double)) ? 8.0 : 4.0);
+
+                m_log.CHECK_EQ(rgStats[0], (double)compression, "The compression type is incorrect.");
+                m_log.CHECK_EQ(rgStats[1], 1, "There should have been one compressed reduction.");
+                m_log.CHECK_EQ(rgStats[2], dfExpectedRatio, "The compression ratio is incorrect.");
+
+                m_evtCancel.Set();
+                m_task1.Wait();
+
+                cuda.NcclSetCompression(hNccl1, NCCL_COMPRESSION.NONE);
+                cuda.FreeNCCL(hNccl1);
+                cuda.FreeNCCL(hNccl2);
+                cuda.FreeStream(hStream);
+                data.Dispose();
+                cuda.Dispose();
+            }
+        }
+
+        private double[] getTopKData(int nCount, bool bAscending)
+        {
+            double[] rg = new double[nCount];
+
+            // Every magnitude is distinct so that the top-k items are known.
+            for (int i = 0; i < nCount; i++)
+            {
+                double dfSign = (i % 2 == 0) ? 1.0 : -1.0;
+                rg[i] = dfSign * ((bAscending) ? (i + 1) : (nCount - i));
+            }
+
+            return rg;
+        }
+
+        private double getTopKResidualNorm(double[] rg, int nStart, int nEnd)
+        {
+            double dfSumSq = 0;
+
+            for (int i = nStart; i < nEnd; i++)
+            {
+                dfSumSq += rg[i] * rg[i];
+            }
+
+            return Math.Sqrt(dfSumSq);
+        }
+
+        private int processTestReduceTopK(object arg)
+        {
+            Tuple<long, long, double> param = arg as Tuple<long, long, double>;
+            CudaDnn<T> cuda = new CudaDnn<T>(m_nGpu2);
+            long hStream = cuda.CreateStream();
+
+            Blob<T> data = new Blob<T>(cuda, m_log, m_nTopKCount, 1, 1, 1);
+            data.mutable_cpu_data = convert(getTopKData(m_nTopKCount, false));
+
+            long hNccl2 = cuda.KernelCopyNccl(param.Item1, param.Item2);
+            cuda.NcclSetCompression(hNccl2, NCCL_COMPRESSION.TOPK, param.Item3);
+            m_evtThreadCreated.Set();
+
+            cuda.NcclAllReduce(hNccl2, hStream, data.mutable_gpu_data, data.count(), NCCL_REDUCTION_OP.SUM);
+            cuda.SynchronizeStream(hStream);
+
+            // The second call only sends what the residual held back.
+            data.SetData(0);
+            cuda.NcclAllReduce(hNccl2, hStream, data.mutable_gpu_data, data.count(), NCCL_REDUCTION_OP.SUM);
+            cuda.SynchronizeStream(hStream);
+            m_evtNcclDone.Set();
+
+            while (!m_evtCancel.WaitOne(50))
+            {
+            }
+
+            cuda.NcclSetCompression(hNccl2, NCCL_COMPRESSION.NONE);
+            cuda.FreeNCCL(hNccl2);
+            cuda.FreeStream(hStream);
+            data.Dispose();
+            cuda.Dispose();
+
+            return 0;
+        }
+
+        public void TestAllReduceCompressedTopK()
+        {
+            if (!setGpus())
+            {
+                m_log.WriteLine("WARNING: You must have 2 P2P capable GPU's that do not have a monitor connected to perform NCCL tests.");
+                return;
+            }
+
+            // A power of two ratio keeps k exact in both float and double.
+            int nCount = m_nTopKCount;
+            double dfRatio = 1.0 / 128.0;
+            int nK = nCount / 128;
+            double dfTol = (typeof(T) == typeof(double)) ? 1e-9 : 1e-3;
+
+            CudaDnn<T> cuda = new CudaDnn<T>(m_nGpu1);
+            long hNccl1 = cuda.CreateNCCL(m_nGpu1, 2, 0, m_guid);
+            long hNccl2 = cuda.CreateNCCL(m_nGpu2, 2, 1, m_guid);
+            long hStream = cuda.CreateStream();
+
+            // Rank 0 has its largest values at the end, rank 1 at the start.
+            double[] rgX0 = getTopKData(nCount, true);
+            double[] rgX1 = getTopKData(nCount, false);
+
+            Blob<T> data = new Blob<T>(cuda, m_log, nCount, 1, 1, 1);
+            data.mutable_cpu_data = convert(rgX0);
+
+            cuda.NcclInitializeSingleProcess(hNccl1, hNccl2);
+            cuda.NcclSetCompression(hNccl1, NCCL_COMPRESSION.TOPK, dfRatio);
+            m_evtNcclInitialized.Set();
+
+            m_task1 = Task.Factory.StartNew(new Func<object, int>(processTestReduceTopK), new Tuple<long, long, double>(cuda.KernelHandle, hNccl2, dfRatio));
+            m_evtThreadCreated.WaitOne();
+
+            cuda.NcclAllReduce(hNccl1, hStream, data.mutable_gpu_data, data.count(), NCCL_REDUCTION_OP.SUM);
+            cuda.SynchronizeStream(hStream);
+
+            // Only the k largest magnitudes of each rank are summed.
+            double[] rgData = convert(data.update_cpu_data());
+
+            for (int i = 0; i < nCount; i++)
+            {
+                double dfExpected = 0;
+
+                if (i >= nCount - nK)
+                    dfExpected += rgX0[i];
+
+                if (i < nK)
+                    dfExpected += rgX1[i];
+
+                m_log.CHECK_EQ(rgData[i], dfExpected, "The top-k item at " + i.ToString() + " is incorrect.");
+            }
+
+            // The residual holds everything that was not sent.
+            double[] rgStats = convert(cuda.NcclGetCompressionStats(hNccl1));
+            double dfExpectedNorm = getTopKResidualNorm(rgX0, 0, nCount - nK);
+            int nSize = (typeof(T) == typeof(double)) ? 8 : 4;
+            int nIdxSize = ((nK * 4 + nSize - 1) / nSize) * nSize;
+            double dfExpectedRatio = (double)(nK * nSize + nIdxSize) / (nCount * nSize);
+
+            m_log.CHECK_EQ(rgStats[0], (double)NCCL_COMPRESSION.TOPK, "The compression type is incorrect.");
+            m_log.CHECK_EQ(rgStats[1], 1, "There should have been one compressed reduction.");
+            m_log.EXPECT_NEAR(rgStats[2], dfExpectedRatio, 1e-6, "The compression ratio is incorrect.");
+            m_log.EXPECT_NEAR(rgStats[3], dfExpectedNorm, dfExpectedNorm * dfTol, "The residual norm is incorrect.");
+
+            // With no new gradient, the error feedback sends the next k largest items.
+            data.SetData(0);
+            cuda.NcclAllReduce(hNccl1, hStream, data.mutable_gpu_data, data.count(), NCCL_REDUCTION_OP.SUM);
+            cuda.SynchronizeStream(hStream);
+            m_evtNcclDone.WaitOne();
+
+            rgData = convert(data.update_cpu_data());
+
+            for (int i = 0; i < nCount; i++)
+            {
+                double dfExpected = 0;
+
+                if (i >= nCount - 2 * nK && i < nCount - nK)
+                    dfExpected += rgX0[i];
+
+                if (i >= nK && i < 2 * nK)
+                    dfExpected += rgX1[i];
+
+                m_log.CHECK_EQ(rgData[i], dfExpected, "The residual item at " + i.ToString() + " is incorrect.");
+            }
+
+            rgStats = convert(cuda.NcclGetCompressionStats(hNccl1));
+            dfExpectedNorm = getTopKResidualNorm(rgX0, 0, nCount - 2 * nK);
+
+            m_log.CHECK_EQ(rgStats[1], 2, "There should have been two compressed reductions.");
+            m_log.EXPECT_NEAR(rgStats[3], dfExpectedNorm, dfExpectedNorm * dfTol, "The residual norm is incorrect.");
+
+            m_evtCancel.Set();
+            m_task1.Wait();
+
+            cuda.NcclSetCompression(hNccl1, NCCL_COMPRESSION.NONE);
+            cuda.FreeNCCL(hNccl1);
+            cuda.FreeNCCL(hNccl2);
+            cuda.FreeStream(hStream);
+            data.Dispose();
+            cuda.Dispose();
+        }
+
+        public void TestAllReduceHierarchical()
+        {
+            if (!setGpus())
+            {
+                m_log.WriteLine("WARNING: You must have 2 P2P capable GPU's that do not have a monitor connected to perform NCCL tests.");
+                return;
+            }
+
+            CudaDnn<T> cuda = new CudaDnn<T>(m_nGpu1);
+            long hNccl1 = cuda.CreateNCCL(m_nGpu1, 2, 0, m_guid);
+            long hNccl2 = cuda.CreateNCCL(m_nGpu2, 2, 1, m_guid);
+            long hStream = cuda.CreateStream();
+
+            Blob<T> data = new Blob<T>(cuda, m_log, m_nDataCount, 1, 1, 1);
+            Filler<T> filler = Filler<T>.Create(cuda, m_log, new FillerParameter("constant", 1.0));
+            filler.Fill(data);
+
+            // Place each GPU in its own group so that the
+            //  reduction runs over the cross-group step.
+            int nGroups = cuda.NcclInitializeHierarchical(new List<long>() { hNccl1, hNccl2 }, new List<int>() { 0, 1 });
+            m_log.CHECK_EQ(nGroups, 2, "There should be two groups.");
+            m_evtNcclInitialized.Set();
+
+            m_task1 = Task.Factory.StartNew(new Func<object, int>(processTestReduce), new Tuple<long, long>(cuda.KernelHandle, hNccl2));
+            m_evtThreadCreated.WaitOne();
+
+            cuda.NcclBroadcast(hNccl1, hStream, data.gpu_data, data.count());
+            cuda.SynchronizeStream(hStream);
+
+            cuda.NcclAllReduce(hNccl1, hStream, data.mutable_gpu_data, data.count(), NCCL_REDUCTION_OP.SUM);
+            cuda.SynchronizeStream(hStream);
+            m_evtNcclDone.WaitOne();
+
+            double[] rgBottom = convert(data.update_cpu_data());
+
+            for (int i = 0; i < data.count(); i++)
+            {
+                Assert.AreEqual(rgBottom[i], 3.0);
+            }
+
+            m_evtCancel.Set();
+            cuda.FreeNCCL(hNccl1);
+            cuda.FreeNCCL(hNccl2);
+            cuda.FreeStream(hStream);
+            data.Dispose();
+            cuda.Dispose();
+        }
+
+        public void TestHierarchyLayout()
+        {
+            // Two nodes of four GPUs, where the ranks alternate between the nodes and
+            // only the GPUs of a node have peer access to one another.
+            int nCount = 8;
+            bool[,] rgbPeer = new bool[nCount, nCount];
+
+            for (int i = 0; i < nCount; i++)
+            {
+                for (int j = 0; j < nCount; j++)
+                {
+                    rgbPeer[i, j] = (i % 2 == j % 2);
+                }
+            }
+
+            // Access one way only does not join the nodes.
+            rgbPeer[0, 1] = true;
+
+            int[] rg = m_cuda.NcclGetHierarchy(rgbPeer);
+            m_log.CHECK_EQ(rg.Length, 3 + nCount * 3, "The hierarchy output has the wrong length.");
+            m_log.CHECK_EQ(rg[0], 2, "There should be one group per node.");
+            m_log.CHECK_EQ(rg[1], 1, "The groups should be uniform.");
+            m_log.CHECK_EQ(rg[2], 4, "There should be one cross-group set per local rank.");
+
+            for (int i = 0; i < nCount; i++)
+            {
+                m_log.CHECK_EQ(rg[3 + i * 3 + 0], i % 2, "Rank " + i.ToString() + " is in the wrong group.");
+                m_log.CHECK_EQ(rg[3 + i * 3 + 1], i / 2, "Rank " + i.ToString() + " has the wrong local rank.");
+                m_log.CHECK_EQ(rg[3 + i * 3 + 2], i / 2, "Rank " + i.ToString() + " is in the wrong cross-group set.");
+            }
+
+            // Uneven groups are ordered by their first rank, and only their
+            // leaders (local rank 0) form the one cross-group set.
+            rg = m_cuda.NcclGetHierarchy(new List<int>() { 7, 7, 2, 7, 2 });
+            int[] rgExpected = new int[] { 2, 0, 1, 0, 0, 0, 0, 1, -1, 1, 0, 0, 0, 2, -1, 1, 1, -1 };
+
+            m_log.CHECK_EQ(rg.Length, rgExpected.Length, "The hierarchy output has the wrong length.");
+
+            for (int i = 0; i < rgExpected.Length; i++)
+            {
+                m_log.CHECK_EQ(rg[i], rgExpected[i], "The uneven hierarchy is wrong at item " + i.ToString() + ".");
+            }
+        }
     }
 }
@@ -91,7 +91,14 @@ namespace MyCaffe.common
         IMPLICIT_PRECOMP_GEMM = 1,
         ALGO_GEMM = 2,
         ALGO_DIRECT = 3,
-        ALGO_FFT = 4
+        ALGO_FFT = 4,
+        /// <summary>
+        /// Runs the convolution on the host with the Winograd engine, only 3x3 stride 1 convolutions are supported.
+        /// </summary>
+        /// <remarks>
+        /// The tile size defaults to F(4x4,3x3) and may be set to F(2x2,3x3) with the MYCAFFE_WINOGRAD_TILE environment variable.
+        /// </remarks>
+        HOST_WINOGRAD = 100
     }
 
     /// <summary>
@@ -127,7 +134,11 @@ namespace MyCaffe.common
         /// </summary>
         ALGO_0 = 0,     
         ALGO_1 = 1,
-        ALGO_FFT = 2
+        ALGO_FFT = 2,
+        /// <summary>
+        /// Runs the convolution on the host with the Winograd engine, only 3x3 stride 1 convolutions are supported.
+        /// </summary>
+        HOST_WINOGRAD = 100
     }
 
     /// <summary>
@@ -234,6 +245,103 @@ namespace MyCaffe.common
         MIN = 2
     }
 
+    /// <summary>
+    /// Specifies an operation of a fused element-wise expression.
+    /// </summary>
+    /// <remarks>
+    /// The operations are listed in postfix order and evaluated on a small stack for each item.
+    /// @see CudaDnn::fused_expr
+    /// </remarks>
+    public enum FUSED_OP
+    {
+        /// <summary>
+        /// Push the item of the input whose index is given by the argument.
+        /// </summary>
+        LOAD = 0,
+        /// <summary>
+        /// Push the argument.
+        /// </summary>
+        CONST = 1,
+        /// <summary>
+        /// Pop b and a, and push a + b.
+        /// </summary>
+        ADD = 2,
+        /// <summary>
+        /// Pop b and a, and push a - b.
+        /// </summary>
+        SUB = 3,
+        /// <summary>
+        /// Pop b and a, and push a * b.
+        /// </summary>
+        MUL = 4,
+        /// <summary>
+        /// Pop b and a, and push a / b.
+        /// </summary>
+        DIV = 5,
+        /// <summary>
+        /// Add the argument to the top value.
+        /// </summary>
+        ADD_SCALAR = 6,
+        /// <summary>
+        /// Multiply the top value by the argument.
+        /// </summary>
+        MUL_SCALAR = 7,
+        /// <summary>
+        /// Replace the top value x with exp(x).
+        /// </summary>
+        EXP = 8,
+        /// <summary>
+        /// Replace the top value x with log(x).
+        /// </summary>
+        LOG = 9,
+        /// <summary>
+        /// Replace the top value x with x raised to the power of the argument.
+        /// </summary>
+        POWX = 10,
+        /// <summary>
+        /// Replace the top value x with sqrt(x).
+        /// </summary>
+        SQRT = 11,
+        /// <summary>
+        /// Replace the top value x with 1/x, or 0 when x = 0.
+        /// </summary>
+        RECIPROCOL = 12,
+        /// <summary>
+        /// Replace the top value x with |x|.
+        /// </summary>
+        ABS = 13,
+        /// <summary>
+        /// Replace the top value x with x * x.
+        /// </summary>
+        SQUARE = 14,
+        /// <summary>
+        /// Replace the top value x with -x.
+        /// </summary>
+        NEG = 15
+    }
+
+    /// <summary>
+    /// Specifies the reduction applied to the result of a fused element-wise expression.
+    /// </summary>
+    /// <remarks>
+    /// @see CudaDnn::fused_expr
+    /// </remarks>
+    public enum FUSED_REDUCTION
+    {
+        /// <summary>
+        /// No reduction is performed.
+        /// </summary>
+        NONE = 0,
+        /// <summary>
+        /// Sum the results.
+        /// </summary>
+        SUM = 1,
+        /// <summary>
+        /// Sum the absolute values of the results.
+        /// </summary>
+        ASUM = 2
+    }
+
     /// <summary>
     /// Specifies the memory test to perform.
     /// </summary>
@@ -242,7 +350,26 @@ namespace MyCaffe.common
     /// </remarks>
     public enum MEMTEST_TYPE
     {
-        MOV_INV_8 = 1
+        /// <summary>
+        /// Specifies the moving inversions test using the 0x80808080 pattern.
+        /// </summary>
+        MOV_INV_8 = 1,
+        /// <summary>
+        /// Specifies the walking ones test (host memory only).
+        /// </summary>
+        WALKING_ONES = 2,
+        /// <summary>
+        /// Specifies the walking zeros test (host memory only).
+        /// </summary>
+        WALKING_ZEROS = 3,
+        /// <summary>
+        /// Specifies the modulo-20 test (host memory only).
+        /// </summary>
+        MODULO_20 = 4,
+        /// <summary>
+        /// Specifies the random data moving inversions test (host memory only).
+        /// </summary>
+        RANDOM_DATA = 5
     }
 
     /// <summary>
@@ -271,6 +398,147 @@ namespace MyCaffe.common
         MIN = 3
     }
 
+    /// <summary>
+    /// Specifies the gradient compression applied around the 'Nickel' NCCL sum reductions.
+    /// </summary>
+    /// <remarks>
+    /// @see CudaDnn::NcclSetCompression
+    /// </remarks>
+    public enum NCCL_COMPRESSION
+    {
+        /// <summary>
+        /// No compression, values are reduced at full precision.
+        /// </summary>
+        NONE = 0,
+        /// <summary>
+        /// Values are loss-scaled and down-cast to FP16 before the reduction, a reduction that overflows zeroes the values
+        /// so that the step is skipped and halves the loss scale.
+        /// </summary>
+        FP16 = 1,
+        /// <summary>
+        /// Values are loss-scaled and down-cast to BF16, gathered from all ranks and summed at full precision.
+        /// </summary>
+        BF16 = 2,
+        /// <summary>
+        /// Only the top-k values (by magnitude) are exchanged, the rest are kept in per-gradient error-feedback residuals.
+        /// </summary>
+        TOPK = 3
+    }
+
+    /// <summary>
+    /// Specifies the optimizer step applied by the foreach update.
+    /// </summary>
+    /// <remarks>
+    /// @see CudaDnn::update_foreach
+    /// </remarks>
+    public enum UPDATE_METHOD
+    {
+        /// <summary>
+        /// Specifies the SGD step with momentum.
+        /// </summary>
+        SGD = 0,
+        /// <summary>
+        /// Specifies the Nesterov step.
+        /// </summary>
+        NESTEROV = 1,
+        /// <summary>
+        /// Specifies the AdaGrad step.
+        /// </summary>
+        ADAGRAD = 2,
+        /// <summary>
+        /// Specifies the AdaDelta step.
+        /// </summary>
+        ADADELTA = 3,
+        /// <summary>
+        /// Specifies the Adam step.
+        /// </summary>
+        ADAM = 4,
+        /// <summary>
+        /// Specifies the RmsProp step.
+        /// </summary>
+        RMSPROP = 5
+    }
+
+    /// <summary>
+    /// Specifies the weight decay applied by the foreach update.
+    /// </summary>
+    /// <remarks>
+    /// @see CudaDnn::update_foreach
+    /// </remarks>
+    public enum UPDATE_REGULARIZATION
+    {
+        /// <summary>
+        /// No weight decay is applied.
+        /// </summary>
+        NONE = 0,
+        /// <summary>
+        /// Specifies L2 weight decay.
+        /// </summary>
+        L2 = 1,
+        /// <summary>
+        /// Specifies L1 weight decay.
+        /// </summary>
+        L1 = 2
+    }
+
+    /// <summary>
+    /// Specifies the distribution of the items made by the Philox generator.
+    /// </summary>
+    /// <remarks>
+    /// @see CudaDnn::rng_philox
+    /// </remarks>
+    public enum PHILOX_METHOD
+    {
+        /// <summary>
+        /// Specifies a uniform distribution in (A, B].
+        /// </summary>
+        UNIFORM = 0,
+        /// <summary>
+        /// Specifies a gaussian distribution with mean A and standard deviation B.
+        /// </summary>
+        GAUSSIAN = 1,
+        /// <summary>
+        /// Specifies a bernoulli distribution of 0 and 1 where P(1) = A.
+        /// </summary>
+        BERNOULLI = 2
+    }
+
+    /// <summary>
+    /// Specifies the host BLAS routine checked against its GPU routine.
+    /// </summary>
+    /// <remarks>
+    /// @see CudaDnn::CheckHostBlas
+    /// </remarks>
+    public enum HOSTBLAS_CHECK
+    {
+        /// <summary>
+        /// Specifies to check the host softmax loss against softmaxloss_fused, where the option selects rows of classes (0) or
+        /// spatial maps (1).
+        /// </summary>
+        SOFTMAXLOSS = 0,
+        /// <summary>
+        /// Specifies to check the host foreach update against update_foreach with each regularization, where the option is the
+        /// UPDATE_METHOD.
+        /// </summary>
+        UPDATE_FOREACH = 1,
+        /// <summary>
+        /// Specifies to check the host LSTM sequence forward and backward passes against lstm_seq_fwd and lstm_seq_bwd, where the
+        /// option selects no clip data (0) or clip data with a bias and gradient clipping (1).
+        /// </summary>
+        LSTM_SEQ = 2,
+        /// <summary>
+        /// Specifies to check the host Philox items against rng_philox when the range is filled in one or several parts, where
+        /// the option is the PHILOX_METHOD.
+        /// </summary>
+        RNG_PHILOX = 3,
+        /// <summary>
+        /// Specifies to check the host max and average pooling forward and backward passes against pooling_fwd and pooling_bwd,
+        /// with both the item and the compact max masks, where the option selects the window geometry: 2x2/s2 (0), 3x3/s2 (1),
+        /// 3x3/s2 with pad 1 (2), 3x3/s1 with pad 1 (3), a generic 3x2 window (4) or a global window (5).
+        /// </summary>
+        POOLING = 4
+    }
+
     /// <summary>
     /// Specifies the general cuda device interface.
     /// </summary>
@@ -484,7 +752,27 @@ namespace MyCaffe.common
             /// <summary>
             /// Query the device (GPU) general information such as memory and processor usage.
             /// </summary>
-            DEVICE_INFO = 1002
+            DEVICE_INFO = 1002,
+            /// <summary>
+            /// Query the per function call counts and latencies collected by the profiler, as JSON.
+            /// </summary>
+            PROFILER_STATS = 1003,
+            /// <summary>
+            /// Query the timeline events collected by the tracer, as Chrome Trace Event JSON.
+            /// </summary>
+            TRACE = 1004,
+            /// <summary>
+            /// Run the built-in benchmark suites and query the results, as Google Benchmark JSON.
+            /// </summary>
+            BENCHMARK = 1005,
+            /// <summary>
+            /// Query the per tag allocation stats and outstanding memory handles, as JSON.
+            /// </summary>
+            ALLOC_REPORT = 1006,
+            /// <summary>
+            /// Query the entries, hits and misses of the convolution algorithm cache, as JSON.
+            /// </summary>
+            CONV_ALGO_CACHE = 1007
         }
 
         /// <summary>
@@ -535,6 +823,9 @@ namespace MyCaffe.common
             CREATE_MEMTEST = 34,
             FREE_MEMTEST = 35,
             RUN_MEMTEST = 36,
+            START_MEMTEST_SCRUB = 37,
+            STOP_MEMTEST_SCRUB = 38,
+            GET_MEMTEST_SCRUB_STATUS = 39,
 
             CREATE_NCCL = 40,
             FREE_NCCL = 41,
@@ -542,6 +833,13 @@ namespace MyCaffe.common
             NCCL_INIT_MULTIPROCESS = 43,
             NCCL_BROADCAST = 44,
             NCCL_ALLREDUCE = 45,
+            NCCL_SET_BUCKETS = 130,
+            NCCL_MARK_READY = 131,
+            NCCL_ALLREDUCE_BUCKETS = 132,
+            NCCL_SET_COMPRESSION = 133,
+            NCCL_GET_COMPRESSION_STATS = 134,
+            NCCL_INIT_HIERARCHICAL = 135,
+            NCCL_GET_HIERARCHY = 136,
 
             CREATE_CUDNN = 47,
             FREE_CUDNN = 48,
@@ -638,6 +936,8 @@ namespace MyCaffe.common
             CUDA_DENAN = 252,
             CUDA_SUB_AND_DOT = 253,
             CUDA_MINMAXVAL = 254,
+            CUDA_FUSED_EXPR = 255,
+            CUDA_STATS = 256,
 
             CUDA_IM2COL = 280,
             CUDA_IM2COL_ND = 281,
@@ -655,6 +955,7 @@ namespace MyCaffe.common
             CUDA_RNG_UNIFORM = 350,
             CUDA_RNG_GAUSSIAN = 351,
 //            CUDA_RNG_BERNOULLI = 352,   // Not implemented yet.
+            CUDA_RNG_PHILOX = 353,
 
             CUDA_BATCHREIDX_FWD = 386,
             CUDA_BATCHREIDX_BWD = 387,
@@ -674,6 +975,9 @@ namespace MyCaffe.common
             CUDA_SIGMOID_FWD = 424,
             CUDA_SIGMOID_BWD = 425,
 
+            CUDA_DROPOUT_FWD_BITS = 426,
+            CUDA_DROPOUT_BWD_BITS = 427,
+
             CUDA_RELU_FWD = 428,
             CUDA_RELU_BWD = 429,
 
@@ -692,6 +996,7 @@ namespace MyCaffe.common
 
             CUDA_SOFTMAXLOSS_FWD = 444,
             CUDA_SOFTMAXLOSS_BWD = 445,
+            CUDA_SOFTMAXLOSS_FUSED = 446,
 
             CUDA_MAX_FWD = 448,
             CUDA_MAX_BWD = 449,
@@ -725,6 +1030,8 @@ namespace MyCaffe.common
 
             CUDA_LSTM_UNIT_FWD = 482,
             CUDA_LSTM_UNIT_BWD = 483,
+            CUDA_LSTM_SEQ_FWD = 484,
+            CUDA_LSTM_SEQ_BWD = 485,
 
             CUDA_COEFF_SUM_FWD = 490,
             CUDA_COEFF_SUM_BWD = 491,
@@ -738,6 +1045,7 @@ namespace MyCaffe.common
             CUDA_ADADELTA_UPDATE = 503,
             CUDA_ADAM_UPDATE = 504,
             CUDA_RMSPROP_UPDATE = 505,
+            CUDA_UPDATE_FOREACH = 506,
 
             CUDA_COMBINE_DATA = 550,
 
@@ -775,6 +1083,27 @@ namespace MyCaffe.common
             CUDA_TSNE_COMPUTE_GRADIENT1 = 877,
             CUDA_TSNE_COMPUTE_ERROR1 = 878,
 
+            CUDA_CREATE_MODELAVG = 880,
+            CUDA_FREE_MODELAVG = 881,
+            CUDA_MODELAVG_PUSH = 882,
+            CUDA_MODELAVG_PULL = 883,
+            CUDA_MODELAVG_SET_WEIGHT = 884,
+            CUDA_MODELAVG_GET_STATS = 885,
+
+            CUDA_CONV_ALGO_CACHE_SET_FILE = 888,
+            CUDA_CONV_ALGO_CACHE_CHECK = 889,
+
+            CUDA_PROFILER_ENABLE = 890,
+            CUDA_PROFILER_RESET = 891,
+            CUDA_TRACE_ENABLE = 892,
+            CUDA_ALLOC_TRACE_ENABLE = 893,
+            CUDA_SET_ALLOC_TAG = 894,
+            CUDA_CONV_ALGO_CACHE_CLEAR = 895,
+            CUDA_HOST_MIRROR_ENABLE = 896,
+            CUDA_GET_HOST_MIRROR_STATS = 897,
+            CUDA_HOST_BLAS_CHECK = 898,
+            CUDA_STREAM_POOL_CHECK = 899,
+
             CUDA_GUASSIAN_BLUR = 900,
             CUDA_HAMMING_DIFF = 901,
             CUDA_CALC_BATCH_DIST = 902
@@ -967,6 +1296,10 @@ namespace MyCaffe.common
         /// <summary>
         /// Copy memory from the look-up tables in one kernel to another.
         /// </summary>
+        /// <remarks>
+        /// When the two devices cannot access one another, the data is staged through the host buffer in chunks that
+        /// alternate between two halves of the buffer so that the download of one chunk overlaps the upload of the previous one.
+        /// </remarks>
         /// <param name="nCount">Specifies the number of items to copy.</param>
         /// <param name="hSrc">Specifies the handle to the source memory.</param>
         /// <param name="nSrcOffset">Specifies the offset (in items, not bytes) from which to start the copy in the source memory.</param>
@@ -1203,129 +1536,432 @@ namespace MyCaffe.common
         }
 
         /// <summary>
-        /// Synchronize the operations on the current device.
+        /// Enables or disables the low-level profiler that collects the call counts, latencies and bytes moved of each function.
         /// </summary>
-        public void SynchronizeDevice()
+        /// <param name="bEnable">Specifies whether to enable or disable the profiler.</param>
+        public void EnableProfiler(bool bEnable)
         {
             if (m_dt == DataType.DOUBLE)
-                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.SYNCHRONIZEDEVICE, null);
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_PROFILER_ENABLE, new double[] { (bEnable) ? 1 : 0 });
             else
-                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.SYNCHRONIZEDEVICE, null);
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_PROFILER_ENABLE, new float[] { (bEnable) ? 1 : 0 });
         }
 
         /// <summary>
-        /// Query the mutli-gpu board group id for a device.
+        /// Clears the counters collected by the low-level profiler.
         /// </summary>
-        /// <param name="nDeviceID">Specifies the device id.</param>
-        /// <returns>The mutli-gpu board group id is returned.</returns>
-        public int GetMultiGpuBoardGroupID(int nDeviceID)
+        public void ResetProfiler()
         {
             if (m_dt == DataType.DOUBLE)
-            {
-                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.GETDEVICEPROP, new double[] { nDeviceID, (int)DEVPROP.MULTIGPUBOARDGROUPID });
-                return (int)rg[0];
-            }
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_PROFILER_RESET, null);
             else
-            {
-                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.GETDEVICEPROP, new float[] { nDeviceID, (int)DEVPROP.MULTIGPUBOARDGROUPID });
-                return (int)rg[0];
-            }
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_PROFILER_RESET, null);
         }
 
         /// <summary>
-        /// Query the number of devices (gpu's) installed.
+        /// Returns the counters collected by the low-level profiler as JSON.
         /// </summary>
-        /// <returns>The number of GPU's is returned.</returns>
-        public int GetDeviceCount()
+        /// <remarks>
+        /// Each function entry contains its index ('fn'), the number of calls and errors, the total time in ms, the
+        /// mean, min, 50th, 90th, 99th, 99.9th percentile and max latencies in us, and the bytes moved by the memory
+        /// functions.  The entries are ordered by their total time.
+        /// </remarks>
+        /// <returns>The profiler statistics are returned as a JSON string.</returns>
+        public string GetProfilerStats()
         {
-            if (m_dt == DataType.DOUBLE)
-            {
-                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.GETDEVICEPROP, new double[] { 0, (int)DEVPROP.DEVICECOUNT });
-                return (int)rg[0];
-            }
-            else
-            {
-                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.GETDEVICEPROP, new float[] { 0, (int)DEVPROP.DEVICECOUNT });
-                return (int)rg[0];
-            }
+            string[] rgstr = m_cuda.QueryString((int)m_hKernel, (int)CUDAQRY.PROFILER_STATS, new int[] { 0 });
+            return string.Join(",", rgstr);
         }
 
         /// <summary>
-        /// Check the memory attributes of two memory blocks on different devices to see if they are compatible
-        /// for peer-to-peer memory transfers.
+        /// Enables or disables the low-level tracer that records a timeline of the function calls, host/device transfers,
+        /// scalar read-backs, synchronizations and NCCL collectives.
         /// </summary>
-        /// <param name="hSrc">Specifies the handle to the source memory.</param>
-        /// <param name="nSrcDeviceID">Specifies the device id where the source memory resides.</param>
-        /// <param name="hDst">Specifies the handle to the destination memory.</param>
-        /// <param name="nDstDeviceID">Specifies the device id where the destination memory resides.</param>
-        /// <returns>This function returns <code>true</code> when both devices support peer-to-peer communcation, <code>false</code> otherwise.</returns>
-        public bool CheckMemoryAttributes(long hSrc, int nSrcDeviceID, long hDst, int nDstDeviceID)
+        /// <remarks>
+        /// Each thread records into its own ring buffer holding the last 'nCapacity' events, older events are dropped
+        /// when the trace is not collected often enough.
+        /// </remarks>
+        /// <param name="bEnable">Specifies whether to enable or disable the tracer.</param>
+        /// <param name="nCapacity">Optionally, specifies the number of events held per thread (default = 0, which keeps the current capacity).</param>
+        public void EnableTracer(bool bEnable, int nCapacity = 0)
         {
             if (m_dt == DataType.DOUBLE)
-            {
-                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CHECKMEMORYATTRIB, new double[] { hSrc, nSrcDeviceID, hDst, nDstDeviceID });
-                return (rg[0] == 0) ? false : true;
-            }
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_TRACE_ENABLE, new double[] { (bEnable) ? 1 : 0, nCapacity });
             else
-            {
-                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CHECKMEMORYATTRIB, new float[] { hSrc, nSrcDeviceID, hDst, nDstDeviceID });
-                return (rg[0] == 0) ? false : true;
-            }
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_TRACE_ENABLE, new float[] { (bEnable) ? 1 : 0, nCapacity });
         }
 
         /// <summary>
-        /// Queries the amount of total, free and used memory on a given GPU.
+        /// Returns the events recorded by the low-level tracer since the last call, as Chrome Trace Event JSON.
         /// </summary>
-        /// <param name="dfFree">Specifies the amount of free memory in GB.</param>
-        /// <param name="dfUsed">Specifies the amount of used memory in GB.</param>
-        /// <param name="bCudaCallUsed">Specifies whether or not the used memory is an estimate calculated using the Low-Level Cuda DNN Dll handle table.</param>
-        /// <param name="nDeviceID">Specifies the specific device id to query, or if -1, uses calculates an estimate of the memory used using the current low-level Cuda DNN Dll handle table.</param>
-        /// <returns>The device's total amount of memory in GB is returned.</returns>
-        public double GetDeviceMemory(out double dfFree, out double dfUsed, out bool bCudaCallUsed, int nDeviceID = -1)
+        /// <remarks>
+        /// The JSON can be loaded into chrome://tracing or Perfetto.  Function calls are named 'fn N' where N is the
+        /// function index, and the number of events lost to full buffers is returned in 'otherData.dropped_events'.
+        /// </remarks>
+        /// <returns>The trace is returned as a JSON string.</returns>
+        public string GetTrace()
         {
-            if (nDeviceID == -1)
-                nDeviceID = m_nDeviceId;
+            string[] rgstr = m_cuda.QueryString((int)m_hKernel, (int)CUDAQRY.TRACE, new int[] { 0 });
+            return string.Join(",", rgstr);
+        }
 
-            if (m_dt == DataType.DOUBLE)
-            {
-                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.GETDEVICEMEMORY, new double[] { nDeviceID });
-                dfFree = rg[1];
-                dfUsed = rg[2];
-                bCudaCallUsed = (rg[3] == 0) ? false : true;
-                return rg[0];
-            }
-            else
-            {
-                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.GETDEVICEMEMORY, new float[] { nDeviceID });
-                dfFree = (double)rg[1];
-                dfUsed = (double)rg[2];
-                bCudaCallUsed = (rg[3] == 0) ? false : true;
-                return (double)rg[0];
-            }
+        /// <summary>
+        /// Saves the events recorded by the low-level tracer since the last call to a Chrome Trace Event JSON file.
+        /// </summary>
+        /// <param name="strFile">Specifies the file to write.</param>
+        public void SaveTrace(string strFile)
+        {
+            File.WriteAllText(strFile, GetTrace());
         }
 
         /// <summary>
-        /// Query whether or not two devices can access each other via peer-to-peer memory copies.
+        /// Enables or disables the allocation tracker that attributes each memory handle to the current allocation tag.
         /// </summary>
-        /// <param name="nSrcDeviceID">Specifies the device id of the source.</param>
-        /// <param name="nPeerDeviceID">Specifies the device id of the peer to the source device.</param>
-        /// <returns><code>true</code> is returned if the source device can access the peer device via peer-to-peer communcation, <code>false</code> otherwise.</returns>
-        public bool DeviceCanAccessPeer(int nSrcDeviceID, int nPeerDeviceID)
+        /// <remarks>
+        /// Enabling starts a new session, handles allocated before then are not tracked.  When the tracker is enabled
+        /// at clean-up, the outstanding handles are written to the debug output, or to the file named by the
+        /// MYCAFFE_ALLOC_TRACE environment variable, which also enables the tracker when the kernel is created.
+        /// </remarks>
+        /// <param name="bEnable">Specifies whether to enable or disable the tracker.</param>
+        public void EnableAllocTracker(bool bEnable)
         {
             if (m_dt == DataType.DOUBLE)
-            {
-                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.DEVICE_CANACCESSPEER, new double[] { nSrcDeviceID, nPeerDeviceID });
-                return (rg[0] == 0) ? false : true;
-            }
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_ALLOC_TRACE_ENABLE, new double[] { (bEnable) ? 1 : 0 });
             else
-            {
-                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.DEVICE_CANACCESSPEER, new float[] { nSrcDeviceID, nPeerDeviceID });
-                return (rg[0] == 0) ? false : true;
-            }
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_ALLOC_TRACE_ENABLE, new float[] { (bEnable) ? 1 : 0 });
         }
 
         /// <summary>
-        /// Enables peer-to-peer access between the current device used by the CudaDnn instance and a peer device.
+        /// Sets the tag that the following memory allocations are attributed to by the allocation tracker.
+        /// </summary>
+        /// <param name="nTag">Specifies the tag, where 0 is used for untagged allocations.</param>
+        /// <param name="strLabel">Optionally, specifies a short label (up to 31 characters) reported with the tag.</param>
+        public void SetAllocTag(int nTag, string strLabel = null)
+        {
+            List<double> rgInput = new List<double>() { nTag };
+
+            if (strLabel != null)
+            {
+                for (int i = 0; i < strLabel.Length && i < 31; i++)
+                {
+                    rgInput.Add(strLabel[i]);
+                }
+            }
+
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_SET_ALLOC_TAG, rgInput.ToArray());
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_SET_ALLOC_TAG, rgInput.Select(p => (float)p).ToArray());
+        }
+
+        /// <summary>
+        /// Returns the live bytes, high-water bytes and counts of each allocation tag, and optionally the outstanding handles, as JSON.
+        /// </summary>
+        /// <param name="bOutstanding">Optionally, specifies whether to list the outstanding handles (default = true).</param>
+        /// <returns>The report is returned as a JSON string.</returns>
+        public string GetAllocReport(bool bOutstanding = true)
+        {
+            string[] rgstr = m_cuda.QueryString((int)m_hKernel, (int)CUDAQRY.ALLOC_REPORT, new int[] { (bOutstanding) ? 1 : 0 });
+            return string.Join(",", rgstr);
+        }
+
+        /// <summary>
+        /// Clears the cache of the convolution algorithms chosen by GetConvolutionInfo for each layer geometry.
+        /// </summary>
+        /// <remarks>
+        /// The cache is shared by all kernels and persists to the file named by the MYCAFFE_CONV_ALGO_CACHE environment
+        /// variable (by default 'MyCaffe\conv_algo.cache' under LOCALAPPDATA), set the variable to 0 to only cache within the process.
+        /// </remarks>
+        /// <param name="bDeleteFile">Optionally, specifies to also empty the persisted file (default = false).</param>
+        public void ClearConvolutionAlgoCache(bool bDeleteFile = false)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_CONV_ALGO_CACHE_CLEAR, new double[] { (bDeleteFile) ? 1 : 0 });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_CONV_ALGO_CACHE_CLEAR, new float[] { (bDeleteFile) ? 1 : 0 });
+        }
+
+        /// <summary>
+        /// Returns the number of entries, the entries loaded from file, the hits, the misses and the total time spent selecting
+        /// algorithms on misses of the convolution algorithm cache, as JSON.
+        /// </summary>
+        /// <returns>The stats are returned as a JSON string.</returns>
+        public string GetConvolutionAlgoCacheStats()
+        {
+            string[] rgstr = m_cuda.QueryString((int)m_hKernel, (int)CUDAQRY.CONV_ALGO_CACHE, new int[] { 0 });
+            return string.Join(",", rgstr);
+        }
+
+        /// <summary>
+        /// Clears the convolution algorithm cache and loads its entries from a different file.
+        /// </summary>
+        /// <remarks>
+        /// A missing file, or one written by a different version of the cache or of cuDNN, is replaced with an empty file.
+        /// </remarks>
+        /// <param name="strFile">Specifies the file, '0' to only cache within the process, or <i>null</i> to return to the file
+        /// named by the MYCAFFE_CONV_ALGO_CACHE environment variable.</param>
+        public void SetConvolutionAlgoCacheFile(string strFile)
+        {
+            List<double> rgInput = new List<double>();
+
+            if (strFile != null)
+            {
+                for (int i = 0; i < strFile.Length; i++)
+                {
+                    rgInput.Add(strFile[i]);
+                }
+            }
+
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_CONV_ALGO_CACHE_SET_FILE, rgInput.ToArray());
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_CONV_ALGO_CACHE_SET_FILE, rgInput.Select(p => (float)p).ToArray());
+        }
+
+        /// <summary>
+        /// Checks the selection, persistence and version handling of the convolution algorithm cache on a stub selector,
+        /// using separate cache instances that do not touch the cache used by GetConvolutionInfo.
+        /// </summary>
+        /// <param name="strFile">Specifies a temporary file used by the checks, it is deleted when done.</param>
+        /// <returns>Returns the number of the first check that failed, or 0 when all checks pass.</returns>
+        public int CheckConvolutionAlgoCache(string strFile)
+        {
+            List<double> rgInput = new List<double>();
+
+            for (int i = 0; i < strFile.Length; i++)
+            {
+                rgInput.Add(strFile[i]);
+            }
+
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_CONV_ALGO_CACHE_CHECK, rgInput.ToArray());
+                return (int)rg[0];
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_CONV_ALGO_CACHE_CHECK, rgInput.Select(p => (float)p).ToArray());
+                return (int)rg[0];
+            }
+        }
+
+        /// <summary>
+        /// Enables or disables the host mirror used by GetMemory.
+        /// </summary>
+        /// <remarks>
+        /// When enabled, each read of a memory handle keeps a host copy of its data that is returned by the next read, as long
+        /// as the handle has not been written (or passed to any other function) since.  The mirror can also be enabled for all
+        /// kernels by setting the MYCAFFE_HOST_MIRROR environment variable to 1.  Disabling the mirror releases the host copies.
+        /// </remarks>
+        /// <param name="bEnable">Specifies whether to enable the mirror.</param>
+        public void EnableHostMirror(bool bEnable)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_HOST_MIRROR_ENABLE, new double[] { (bEnable) ? 1 : 0 });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_HOST_MIRROR_ENABLE, new float[] { (bEnable) ? 1 : 0 });
+        }
+
+        /// <summary>
+        /// Returns the hits, misses and host bytes of the host mirror since it was last enabled.
+        /// </summary>
+        /// <returns>A tuple containing the hits, misses and mirrored bytes is returned.</returns>
+        public Tuple<long, long, long> GetHostMirrorStats()
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_GET_HOST_MIRROR_STATS, null);
+                return new Tuple<long, long, long>((long)rg[0], (long)rg[1], (long)rg[2]);
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_GET_HOST_MIRROR_STATS, null);
+                return new Tuple<long, long, long>((long)rg[0], (long)rg[1], (long)rg[2]);
+            }
+        }
+
+        /// <summary>
+        /// Runs a host BLAS routine of the low-level DLL with several thread counts and compares its results to those of the
+        /// matching GPU routine on the same random inputs.
+        /// </summary>
+        /// <param name="check">Specifies the host routine to check.</param>
+        /// <param name="nOption">Optionally, specifies the option of the check (default = 0).</param>
+        /// <returns>The largest absolute difference between the host and GPU results is returned.</returns>
+        public double CheckHostBlas(HOSTBLAS_CHECK check, int nOption = 0)
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_HOST_BLAS_CHECK, new double[] { (int)check, nOption });
+                return rg[0];
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_HOST_BLAS_CHECK, new float[] { (int)check, nOption });
+                return rg[0];
+            }
+        }
+
+        /// <summary>
+        /// Checks the read/write hazard tracking and the round-robin lane assignment of the stream pool used by calc_batch_dist,
+        /// on the host without creating any streams.
+        /// </summary>
+        /// <returns>Returns the number of the first check that failed, or 0 when all checks pass.</returns>
+        public int CheckStreamPool()
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_STREAM_POOL_CHECK, null);
+                return (int)rg[0];
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_STREAM_POOL_CHECK, null);
+                return (int)rg[0];
+            }
+        }
+
+        /// <summary>
+        /// Runs the benchmark suites built into the low-level DLL and returns the results as Google Benchmark JSON.
+        /// </summary>
+        /// <remarks>
+        /// The suites time the function dispatch, handle lookups, allocator, the host side t-SNE code and the host BLAS gemm.  The
+        /// CudaDnnBench console application runs the same suites without the managed layer.
+        /// </remarks>
+        /// <param name="nSuites">Optionally, specifies a bit mask of the suites to run (default = 0, all suites).</param>
+        /// <param name="nMinTimeMs">Optionally, specifies the minimum time in ms of each timed run (default = 0, 500 ms).</param>
+        /// <param name="nRepetitions">Optionally, specifies the number of timed runs per benchmark (default = 0, 3 runs).</param>
+        /// <param name="nMaxSize">Optionally, specifies the largest size to sweep to (default = 0, 4096).</param>
+        /// <returns>The results are returned as a JSON string.</returns>
+        public string RunBenchmarks(int nSuites = 0, int nMinTimeMs = 0, int nRepetitions = 0, int nMaxSize = 0)
+        {
+            string[] rgstr = m_cuda.QueryString((int)m_hKernel, (int)CUDAQRY.BENCHMARK, new int[] { nSuites, nMinTimeMs, nRepetitions, nMaxSize });
+            return string.Join(",", rgstr);
+        }
+
+        /// <summary>
+        /// Synchronize the operations on the current device.
+        /// </summary>
+        public void SynchronizeDevice()
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.SYNCHRONIZEDEVICE, null);
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.SYNCHRONIZEDEVICE, null);
+        }
+
+        /// <summary>
+        /// Query the mutli-gpu board group id for a device.
+        /// </summary>
+        /// <param name="nDeviceID">Specifies the device id.</param>
+        /// <returns>The mutli-gpu board group id is returned.</returns>
+        public int GetMultiGpuBoardGroupID(int nDeviceID)
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.GETDEVICEPROP, new double[] { nDeviceID, (int)DEVPROP.MULTIGPUBOARDGROUPID });
+                return (int)rg[0];
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.GETDEVICEPROP, new float[] { nDeviceID, (int)DEVPROP.MULTIGPUBOARDGROUPID });
+                return (int)rg[0];
+            }
+        }
+
+        /// <summary>
+        /// Query the number of devices (gpu's) installed.
+        /// </summary>
+        /// <returns>The number of GPU's is returned.</returns>
+        public int GetDeviceCount()
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.GETDEVICEPROP, new double[] { 0, (int)DEVPROP.DEVICECOUNT });
+                return (int)rg[0];
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.GETDEVICEPROP, new float[] { 0, (int)DEVPROP.DEVICECOUNT });
+                return (int)rg[0];
+            }
+        }
+
+        /// <summary>
+        /// Check the memory attributes of two memory blocks on different devices to see if they are compatible
+        /// for peer-to-peer memory transfers.
+        /// </summary>
+        /// <param name="hSrc">Specifies the handle to the source memory.</param>
+        /// <param name="nSrcDeviceID">Specifies the device id where the source memory resides.</param>
+        /// <param name="hDst">Specifies the handle to the destination memory.</param>
+        /// <param name="nDstDeviceID">Specifies the device id where the destination memory resides.</param>
+        /// <returns>This function returns <code>true</code> when both devices support peer-to-peer communcation, <code>false</code> otherwise.</returns>
+        public bool CheckMemoryAttributes(long hSrc, int nSrcDeviceID, long hDst, int nDstDeviceID)
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CHECKMEMORYATTRIB, new double[] { hSrc, nSrcDeviceID, hDst, nDstDeviceID });
+                return (rg[0] == 0) ? false : true;
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CHECKMEMORYATTRIB, new float[] { hSrc, nSrcDeviceID, hDst, nDstDeviceID });
+                return (rg[0] == 0) ? false : true;
+            }
+        }
+
+        /// <summary>
+        /// Queries the amount of total, free and used memory on a given GPU.
+        /// </summary>
+        /// <param name="dfFree">Specifies the amount of free memory in GB.</param>
+        /// <param name="dfUsed">Specifies the amount of used memory in GB.</param>
+        /// <param name="bCudaCallUsed">Specifies whether or not the used memory is an estimate calculated using the Low-Level Cuda DNN Dll handle table.</param>
+        /// <param name="nDeviceID">Specifies the specific device id to query, or if -1, uses calculates an estimate of the memory used using the current low-level Cuda DNN Dll handle table.</param>
+        /// <returns>The device's total amount of memory in GB is returned.</returns>
+        public double GetDeviceMemory(out double dfFree, out double dfUsed, out bool bCudaCallUsed, int nDeviceID = -1)
+        {
+            if (nDeviceID == -1)
+                nDeviceID = m_nDeviceId;
+
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.GETDEVICEMEMORY, new double[] { nDeviceID });
+                dfFree = rg[1];
+                dfUsed = rg[2];
+                bCudaCallUsed = (rg[3] == 0) ? false : true;
+                return rg[0];
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.GETDEVICEMEMORY, new float[] { nDeviceID });
+                dfFree = (double)rg[1];
+                dfUsed = (double)rg[2];
+                bCudaCallUsed = (rg[3] == 0) ? false : true;
+                return (double)rg[0];
+            }
+        }
+
+        /// <summary>
+        /// Query whether or not two devices can access each other via peer-to-peer memory copies.
+        /// </summary>
+        /// <param name="nSrcDeviceID">Specifies the device id of the source.</param>
+        /// <param name="nPeerDeviceID">Specifies the device id of the peer to the source device.</param>
+        /// <returns><code>true</code> is returned if the source device can access the peer device via peer-to-peer communcation, <code>false</code> otherwise.</returns>
+        public bool DeviceCanAccessPeer(int nSrcDeviceID, int nPeerDeviceID)
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.DEVICE_CANACCESSPEER, new double[] { nSrcDeviceID, nPeerDeviceID });
+                return (rg[0] == 0) ? false : true;
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.DEVICE_CANACCESSPEER, new float[] { nSrcDeviceID, nPeerDeviceID });
+                return (rg[0] == 0) ? false : true;
+            }
+        }
+
+        /// <summary>
+        /// Enables peer-to-peer access between the current device used by the CudaDnn instance and a peer device.
         /// </summary>
         /// <param name="nPeerDeviceID">Specifies the device id of the peer device.</param>
         public void DeviceEnablePeerAccess(int nPeerDeviceID)
@@ -1924,19 +2560,24 @@ namespace MyCaffe.common
         }
 
         /// <summary>
-        /// Creates a new memory test on the current GPU.
+        /// Creates a new memory test on the current GPU, or on the host RAM when <i>bHostMemory</i> = <i>true</i>.
         /// </summary>
+        /// <remarks>
+        /// The host memory test allocates its memory on each NUMA node and tests each node's memory from a
+        /// thread running on that node.
+        /// </remarks>
         /// <param name="ulTotalNumBlocks">Returns the total number of blocks available to test.</param>
         /// <param name="dfMemAllocatedInGB">Returns the total amount of allocated memory, specified in GB.</param>
         /// <param name="ulMemStartAddr">Returns the start address of the memory test.</param>
         /// <param name="ulBlockSize">Returns the block size of the memory to be tested.</param>
         /// <param name="dfPctToAllocate">Specifies the percentage of avaiable memory to test, where 1.0 = 100%.</param>
+        /// <param name="bHostMemory">Optionally, specifies to test the host RAM instead of the GPU memory (default = <i>false</i>).</param>
         /// <returns></returns>
-        public long CreateMemoryTest(out ulong ulTotalNumBlocks, out double dfMemAllocatedInGB, out ulong ulMemStartAddr, out ulong ulBlockSize, double dfPctToAllocate = 1.0)
+        public long CreateMemoryTest(out ulong ulTotalNumBlocks, out double dfMemAllocatedInGB, out ulong ulMemStartAddr, out ulong ulBlockSize, double dfPctToAllocate = 1.0, bool bHostMemory = false)
         {
             if (m_dt == DataType.DOUBLE)
             {
-                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CREATE_MEMTEST, new double[] { dfPctToAllocate });
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CREATE_MEMTEST, new double[] { dfPctToAllocate, (bHostMemory) ? 1 : 0 });
                 ulTotalNumBlocks = (ulong)rg[1];
                 dfMemAllocatedInGB = (double)rg[2];
                 ulMemStartAddr = (ulong)rg[3];
@@ -1945,7 +2586,7 @@ namespace MyCaffe.common
             }
             else
             {
-                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CREATE_MEMTEST, new float[] { (float)dfPctToAllocate });
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CREATE_MEMTEST, new float[] { (float)dfPctToAllocate, (bHostMemory) ? 1 : 0 });
                 ulTotalNumBlocks = (ulong)rg[1];
                 dfMemAllocatedInGB = (double)rg[2];
                 ulMemStartAddr = (ulong)rg[3];
@@ -1986,6 +2627,8 @@ namespace MyCaffe.common
         /// <param name="bReadWrite">Specifies to perform a read/write test.</param>
         /// <param name="bRead">Specifies to peroform a read test.</param>
         /// </returns>
+        /// <remarks>On the host memory test, the WALKING_ONES, WALKING_ZEROS and MODULO_20 tests write and verify each of
+        /// their sub-patterns in turn, so they must run with both <i>bWrite</i> and <i>bReadWrite</i> set in the same call.</remarks>
         public T[] RunMemoryTest(long h, MEMTEST_TYPE type, ulong ulBlockStartOffset, ulong ulBlockCount, bool bVerbose, bool bWrite, bool bReadWrite, bool bRead)
         {
             List<ulong> rgErrorAddresses = new List<ulong>();
@@ -2002,22 +2645,77 @@ namespace MyCaffe.common
             }
         }
 
-        #endregion
-
-        //---------------------------------------------------------------------
-        //  ICudaDnn Methods
-        //---------------------------------------------------------------------
-        #region ICudaDnn Methods
-
         /// <summary>
-        /// Create a new stream on the current GPU.
+        /// Starts scrubbing the memory of a memory test in the background, rotating through all of its blocks.
         /// </summary>
-        /// <param name="bNonBlocking">When <code>false</code> (the default) the created stream is a 'blocking' stream, otherwise it is an asynchronous, non-blocking stream.</param>
-        /// <returns>The handle to the stream is returned.</returns>
-        public long CreateStream(bool bNonBlocking = false)
-        {
-            if (m_dt == DataType.DOUBLE)
-            {
+        /// <remarks>
+        /// Each second, the scrubber tests slices of blocks until either its time or bandwidth budget is used up and
+        /// then sleeps for the rest of the second.  To resume a scrub across sessions, save the block cursor and pass
+        /// count returned by GetMemoryTestScrubStatus and pass them back in here.
+        /// </remarks>
+        /// <param name="h">Specifies the handle to the memory test.</param>
+        /// <param name="type">Specifies the type of memory test to run.</param>
+        /// <param name="nMsPerSec">Specifies the time budget, in milliseconds of testing per second (1-1000).</param>
+        /// <param name="dfMBPerSec">Specifies the bandwidth budget, in MB tested per second, or 0 for no bandwidth bound.</param>
+        /// <param name="ulBlocksPerSlice">Specifies the number of blocks tested in each slice.</param>
+        /// <param name="ulStartBlock">Optionally, specifies the block to start (or resume) from (default = 0).</param>
+        /// <param name="nPasses">Optionally, specifies the number of full passes already completed (default = 0).</param>
+        public void StartMemoryTestScrub(long h, MEMTEST_TYPE type, int nMsPerSec, double dfMBPerSec, ulong ulBlocksPerSlice, ulong ulStartBlock = 0, int nPasses = 0)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.START_MEMTEST_SCRUB, new double[] { h, (double)type, nMsPerSec, dfMBPerSec, ulBlocksPerSlice, ulStartBlock, nPasses });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.START_MEMTEST_SCRUB, new float[] { h, (float)type, nMsPerSec, (float)dfMBPerSec, ulBlocksPerSlice, ulStartBlock, nPasses });
+        }
+
+        /// <summary>
+        /// Stops the background scrubbing of a memory test, waiting for the current slice to complete.
+        /// </summary>
+        /// <param name="h">Specifies the handle to the memory test.</param>
+        public void StopMemoryTestScrub(long h)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.STOP_MEMTEST_SCRUB, new double[] { h });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.STOP_MEMTEST_SCRUB, new float[] { h });
+        }
+
+        /// <summary>
+        /// Returns the progress of the background scrubbing of a memory test.
+        /// </summary>
+        /// <param name="h">Specifies the handle to the memory test.</param>
+        /// <returns>The status is returned as: [running, block cursor, passes completed, blocks tested, error count,
+        /// first error address, last error code, ms spent testing in the last second, total blocks, errors found flag].</returns>
+        public T[] GetMemoryTestScrubStatus(long h)
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.GET_MEMTEST_SCRUB_STATUS, new double[] { h });
+                return (T[])Convert.ChangeType(rg, typeof(T[]));
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.GET_MEMTEST_SCRUB_STATUS, new float[] { h });
+                return (T[])Convert.ChangeType(rg, typeof(T[]));
+            }
+        }
+
+        #endregion
+
+        //---------------------------------------------------------------------
+        //  ICudaDnn Methods
+        //---------------------------------------------------------------------
+        #region ICudaDnn Methods
+
+        /// <summary>
+        /// Create a new stream on the current GPU.
+        /// </summary>
+        /// <param name="bNonBlocking">When <code>false</code> (the default) the created stream is a 'blocking' stream, otherwise it is an asynchronous, non-blocking stream.</param>
+        /// <returns>The handle to the stream is returned.</returns>
+        public long CreateStream(bool bNonBlocking = false)
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
                 double[] rgInput = null;
 
                 if (bNonBlocking)
@@ -2144,125 +2842,516 @@ namespace MyCaffe.common
             string str = guid.ToString();
             string[] rgstr = str.Split('-');
 
-            foreach (string str1 in rgstr)
+            foreach (string str1 in rgstr)
+            {
+                long val = Convert.ToInt64(str1, 16);
+                rgdf.Add(val);
+            }
+
+            return rgdf;
+        }
+
+        private List<float> guidToArrayFloat(Guid guid)
+        {
+            List<double> rgDf = guidToArrayDouble(guid);
+            List<float> rg = new List<float>();
+
+            foreach (double df in rgDf)
+            {
+                rg.Add((float)df);
+            }
+
+            return rg;
+        }
+
+        /// <summary>
+        /// Free an instance of NCCL.
+        /// </summary>
+        /// <param name="hNccl">Specifies the handle to NCCL.</param>
+        public void FreeNCCL(long hNccl)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.FREE_NCCL, new double[] { hNccl });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.FREE_NCCL, new float[] { hNccl });
+        }
+
+        /// <summary>
+        /// Initializes a set of NCCL instances for use in a single process.
+        /// </summary>
+        /// <remarks>
+        /// See [Fast Multi-GPU collectives with NCCL](https://devblogs.nvidia.com/parallelforall/fast-multi-gpu-collectives-nccl/).
+        /// </remarks>
+        /// <param name="rghNccl">Specifies the array of NCCL handles that will be working together.</param>
+        public void NcclInitializeSingleProcess(params long[] rghNccl)
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                List<double> rg = new List<double>() { 0, rghNccl.Length };
+
+                for (int i = 0; i < rghNccl.Length; i++)
+                {
+                    rg.Add(rghNccl[i]);
+                }
+
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_INIT_SINGLEPROCESS, rg.ToArray());
+            }
+            else
+            {
+                List<float> rg = new List<float>() { 0, rghNccl.Length };
+
+                for (int i = 0; i < rghNccl.Length; i++)
+                {
+                    rg.Add(rghNccl[i]);
+                }
+
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_INIT_SINGLEPROCESS, rg.ToArray());
+            }
+        }
+
+        /// <summary>
+        /// Initializes a set of NCCL instances for use in a single process with a hierarchical (two level) reduction schedule.
+        /// </summary>
+        /// <remarks>
+        /// The GPUs are split into groups of fast (peer-to-peer) connected devices.  Each sum is first reduced within the group,
+        /// then across the groups, and then shared back within the group so that the slower links between groups only carry
+        /// a part of the data.  When all groups have the same size, each GPU exchanges its own shard with the matching GPU of the
+        /// other groups; otherwise only the group leaders exchange the full buffer.  Broadcast continues to use the flat ring.
+        /// </remarks>
+        /// <param name="rghNccl">Specifies the array of NCCL handles that will be working together.</param>
+        /// <param name="rgGroup">Optionally, specifies the group id of each NCCL handle.  When <i>null</i> the groups are found from the peer access between the GPUs.</param>
+        /// <returns>The number of groups used is returned.</returns>
+        public int NcclInitializeHierarchical(List<long> rghNccl, List<int> rgGroup = null)
+        {
+            if (rgGroup != null && rgGroup.Count != rghNccl.Count)
+                throw new ArgumentOutOfRangeException("rgGroup", "The group list must have one entry per NCCL handle.");
+
+            if (m_dt == DataType.DOUBLE)
+            {
+                List<double> rg = new List<double>() { 0, rghNccl.Count };
+
+                for (int i = 0; i < rghNccl.Count; i++)
+                {
+                    rg.Add(rghNccl[i]);
+                }
+
+                if (rgGroup != null)
+                {
+                    for (int i = 0; i < rgGroup.Count; i++)
+                    {
+                        rg.Add(rgGroup[i]);
+                    }
+                }
+
+                double[] rgOut = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_INIT_HIERARCHICAL, rg.ToArray());
+                return (int)rgOut[0];
+            }
+            else
+            {
+                List<float> rg = new List<float>() { 0, rghNccl.Count };
+
+                for (int i = 0; i < rghNccl.Count; i++)
+                {
+                    rg.Add(rghNccl[i]);
+                }
+
+                if (rgGroup != null)
+                {
+                    for (int i = 0; i < rgGroup.Count; i++)
+                    {
+                        rg.Add(rgGroup[i]);
+                    }
+                }
+
+                float[] rgOut = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_INIT_HIERARCHICAL, rg.ToArray());
+                return (int)rgOut[0];
+            }
+        }
+
+        /// <summary>
+        /// Returns the hierarchy that NcclInitializeHierarchical builds for GPUs with the given peer access, without using any GPUs.
+        /// </summary>
+        /// <param name="rgbPeer">Specifies the peer access of each rank, where rgbPeer[i,j] is <i>true</i> when rank i can access rank j.</param>
+        /// <returns>An array with the number of groups, 1 when the groups have the same size (0 otherwise) and the number of
+        /// cross-group sets is returned, followed by the group, local rank and cross-group set (-1 for none) of each rank.</returns>
+        public int[] NcclGetHierarchy(bool[,] rgbPeer)
+        {
+            int nCount = rgbPeer.GetLength(0);
+            List<double> rg = new List<double>() { nCount, 1 };
+
+            if (rgbPeer.GetLength(1) != nCount)
+                throw new ArgumentOutOfRangeException("rgbPeer", "The peer access must have one row and one column per rank.");
+
+            for (int i = 0; i < nCount; i++)
+            {
+                for (int j = 0; j < nCount; j++)
+                {
+                    rg.Add((rgbPeer[i, j]) ? 1 : 0);
+                }
+            }
+
+            return getHierarchy(rg);
+        }
+
+        /// <summary>
+        /// Returns the hierarchy that NcclInitializeHierarchical builds for the given groups, without using any GPUs.
+        /// </summary>
+        /// <param name="rgGroup">Specifies the group id of each rank.</param>
+        /// <returns>An array with the number of groups, 1 when the groups have the same size (0 otherwise) and the number of
+        /// cross-group sets is returned, followed by the group, local rank and cross-group set (-1 for none) of each rank.</returns>
+        public int[] NcclGetHierarchy(List<int> rgGroup)
+        {
+            List<double> rg = new List<double>() { rgGroup.Count, 0 };
+
+            for (int i = 0; i < rgGroup.Count; i++)
+            {
+                rg.Add(rgGroup[i]);
+            }
+
+            return getHierarchy(rg);
+        }
+
+        private int[] getHierarchy(List<double> rg)
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rgOut = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_GET_HIERARCHY, rg.ToArray());
+                return rgOut.Select(p => (int)p).ToArray();
+            }
+            else
+            {
+                float[] rgOut = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_GET_HIERARCHY, rg.Select(p => (float)p).ToArray());
+                return rgOut.Select(p => (int)p).ToArray();
+            }
+        }
+
+        /// <summary>
+        /// Initializes a set of NCCL instances for use in different processes.
+        /// </summary>
+        /// <remarks>
+        /// See [Fast Multi-GPU collectives with NCCL](https://devblogs.nvidia.com/parallelforall/fast-multi-gpu-collectives-nccl/).
+        /// </remarks>
+        /// <param name="hNccl">Specifies the handle of NCCL to initialize.</param>
+        public void NcclInitializeMultiProcess(long hNccl)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_INIT_MULTIPROCESS, new double[] { hNccl });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_INIT_MULTIPROCESS, new float[] { hNccl });
+        }
+
+        /// <summary>
+        /// Broadcasts a block of GPU data to all NCCL instances.
+        /// </summary>
+        /// <remarks>
+        /// See [Fast Multi-GPU collectives with NCCL](https://devblogs.nvidia.com/parallelforall/fast-multi-gpu-collectives-nccl/).
+        /// </remarks>
+        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
+        /// <param name="hStream">Specifies a handle to the stream to use for synchronization.</param>
+        /// <param name="hX">Specifies a handle to the GPU data to be broadcasted (or recieved).</param>
+        /// <param name="nCount">Specifies the number of items (not bytes) in the data.</param>
+        public void NcclBroadcast(long hNccl, long hStream, long hX, int nCount)
+        {
+            Trace.WriteLine("Broadcasting from device ID " + GetDeviceID().ToString());
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_BROADCAST, new double[] { hNccl, hStream, hX, nCount });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_BROADCAST, new float[] { hNccl, hStream, hX, nCount });
+        }
+
+        /// <summary>
+        /// Performs a reduction on all NCCL instances as specified by the reduction operation.
+        /// </summary>
+        /// <remarks>
+        /// See [Fast Multi-GPU collectives with NCCL](https://devblogs.nvidia.com/parallelforall/fast-multi-gpu-collectives-nccl/).
+        /// </remarks>
+        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
+        /// <param name="hStream">Specifies a handle to the stream to use for synchronization.</param>
+        /// <param name="hX">Specifies a handle to the GPU data to reduce with the other instances of NCCL.</param>
+        /// <param name="nCount">Specifies the number of items (not bytes) in the data.</param>
+        /// <param name="op">Specifies the reduction operation to perform.</param>
+        /// <param name="dfScale">Optionally, specifies a scaling to be applied to the final reduction.</param>
+        public void NcclAllReduce(long hNccl, long hStream, long hX, int nCount, NCCL_REDUCTION_OP op, double dfScale = 1.0)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_ALLREDUCE, new double[] { hNccl, hStream, hX, nCount, (int)op, dfScale });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_ALLREDUCE, new float[] { hNccl, hStream, hX, nCount, (int)op, (float)dfScale });
+        }
+
+        /// <summary>
+        /// Registers a set of gradients with an NCCL instance so that they may be reduced in fused buckets.
+        /// </summary>
+        /// <remarks>
+        /// The gradients are packed, in order, into buckets of at most <i>lBucketSizeInBytes</i> each.  Buckets whose
+        /// gradients are laid out contiguously in GPU memory are reduced in place; all others are packed into a flattened
+        /// buffer, reduced with a single call and then scattered back.  Gradients should be registered in the order they
+        /// become ready (e.g. reverse layer order during the backward pass), and all ranks must register the same layout.
+        /// </remarks>
+        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
+        /// <param name="rghGrad">Specifies the handles to the GPU gradient data.</param>
+        /// <param name="rgnCount">Specifies the number of items (not bytes) in each gradient.</param>
+        /// <param name="op">Specifies the reduction operation to perform.</param>
+        /// <param name="dfScale">Optionally, specifies a scaling to be applied to the final reduction.</param>
+        /// <param name="lBucketSizeInBytes">Optionally, specifies the maximum bucket size in bytes (default = 0, which uses 25 MB).</param>
+        /// <returns>The number of buckets created is returned.</returns>
+        public int NcclSetBuckets(long hNccl, List<long> rghGrad, List<int> rgnCount, NCCL_REDUCTION_OP op, double dfScale = 1.0, long lBucketSizeInBytes = 0)
+        {
+            if (rghGrad.Count != rgnCount.Count)
+                throw new ArgumentOutOfRangeException("rgnCount", "The gradient and count lists must have the same number of items.");
+
+            if (m_dt == DataType.DOUBLE)
+            {
+                List<double> rgParam = new List<double>() { hNccl, lBucketSizeInBytes, (int)op, dfScale, rghGrad.Count };
+
+                for (int i = 0; i < rghGrad.Count; i++)
+                {
+                    rgParam.Add(rghGrad[i]);
+                    rgParam.Add(rgnCount[i]);
+                }
+
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_SET_BUCKETS, rgParam.ToArray());
+                return (int)rg[0];
+            }
+            else
+            {
+                List<float> rgParam = new List<float>() { hNccl, lBucketSizeInBytes, (int)op, (float)dfScale, rghGrad.Count };
+
+                for (int i = 0; i < rghGrad.Count; i++)
+                {
+                    rgParam.Add(rghGrad[i]);
+                    rgParam.Add(rgnCount[i]);
+                }
+
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_SET_BUCKETS, rgParam.ToArray());
+                return (int)rg[0];
+            }
+        }
+
+        /// <summary>
+        /// Releases the buckets previously registered with NcclSetBuckets.
+        /// </summary>
+        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
+        public void NcclFreeBuckets(long hNccl)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_SET_BUCKETS, new double[] { hNccl, 0, 0, 1, 0 });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_SET_BUCKETS, new float[] { hNccl, 0, 0, 1, 0 });
+        }
+
+        /// <summary>
+        /// Marks a registered gradient as ready.  When the last gradient of a bucket is marked (and all earlier buckets
+        /// have been launched) the bucket's reduction is started on the stream.
+        /// </summary>
+        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
+        /// <param name="hStream">Specifies a handle to the stream to use for synchronization.</param>
+        /// <param name="nIdx">Specifies the index of the gradient within the list passed to NcclSetBuckets.</param>
+        public void NcclMarkReady(long hNccl, long hStream, int nIdx)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_MARK_READY, new double[] { hNccl, hStream, nIdx });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_MARK_READY, new float[] { hNccl, hStream, nIdx });
+        }
+
+        /// <summary>
+        /// Reduces all buckets that have not yet been launched, treating any unmarked gradient as ready.
+        /// </summary>
+        /// <remarks>
+        /// The flush ends the pass, buckets already launched by NcclMarkReady in the pass are not reduced again.
+        /// </remarks>
+        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
+        /// <param name="hStream">Specifies a handle to the stream to use for synchronization.</param>
+        public void NcclAllReduceBuckets(long hNccl, long hStream)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_ALLREDUCE_BUCKETS, new double[] { hNccl, hStream });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_ALLREDUCE_BUCKETS, new float[] { hNccl, hStream });
+        }
+
+        /// <summary>
+        /// Sets the gradient compression used by the SUM reductions of an NCCL instance.
+        /// </summary>
+        /// <remarks>
+        /// The compression applies to both NcclAllReduce and the bucketed reductions.  All ranks must use the same setting.
+        /// </remarks>
+        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
+        /// <param name="type">Specifies the compression type.</param>
+        /// <param name="dfParam">Optionally, specifies the initial loss scale for FP16 (default = 1024) and BF16 (default = 1),
+        /// or the ratio of values kept in the range (0, 1] for TOPK (default = 0.01).</param>
+        public void NcclSetCompression(long hNccl, NCCL_COMPRESSION type, double dfParam = 0)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_SET_COMPRESSION, new double[] { hNccl, (int)type, dfParam });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_SET_COMPRESSION, new float[] { hNccl, (int)type, (float)dfParam });
+        }
+
+        /// <summary>
+        /// Returns the compression statistics of an NCCL instance.
+        /// </summary>
+        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
+        /// <returns>The format of the array returned is as follows:
+        /// rg[0] - specifies the compression type (see NCCL_COMPRESSION).
+        /// rg[1] - specifies the number of compressed reductions run.
+        /// rg[2] - specifies the compression ratio (bytes sent / uncompressed bytes) of the last call.
+        /// rg[3] - specifies the L2 norm of the error-feedback residual after the last call (TOPK only).
+        /// rg[4] - specifies the current loss scale (FP16 and BF16 only).
+        /// rg[5] - specifies the number of FP16 overflows, each of which zeroed the reduced values so that the step is skipped.
+        /// rg[6] - specifies the total number of bytes sent.
+        /// rg[7] - specifies the total number of uncompressed bytes.
+        /// </returns>
+        public T[] NcclGetCompressionStats(long hNccl)
+        {
+            if (m_dt == DataType.DOUBLE)
             {
-                long val = Convert.ToInt64(str1, 16);
-                rgdf.Add(val);
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_GET_COMPRESSION_STATS, new double[] { hNccl });
+                return (T[])Convert.ChangeType(rg, typeof(T[]));
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_GET_COMPRESSION_STATS, new float[] { hNccl });
+                return (T[])Convert.ChangeType(rg, typeof(T[]));
             }
-
-            return rgdf;
         }
 
-        private List<float> guidToArrayFloat(Guid guid)
+        /// <summary>
+        /// Creates a new asynchronous model averaging server and returns the handle to it.
+        /// </summary>
+        /// <remarks>
+        /// Workers push weight deltas with <see cref="ModelAveragerPush"/> which are queued and applied to a master copy
+        /// of the weights by a background thread (master = master + delta * weight[worker]).  Workers read the latest
+        /// published master with <see cref="ModelAveragerPull"/> which never waits on the averaging.  This supports local-SGD
+        /// and elastic averaging style training where workers run at their own pace instead of in lock-step.
+        /// </remarks>
+        /// <param name="nCount">Specifies the number of weights.</param>
+        /// <param name="hInitialWeights">Specifies a handle to the GPU memory holding the initial weights.</param>
+        /// <param name="nWorkers">Specifies the number of workers (max 64).</param>
+        /// <param name="nMaxStaleness">Optionally, specifies the maximum number of master versions a delta may lag behind before it is dropped, -1 for no bound (default = -1).</param>
+        /// <param name="nQueueDepth">Optionally, specifies the number of deltas that may be queued at once, further pushes are rejected until the server catches up (default = 4).</param>
+        /// <param name="rgWeights">Optionally, specifies the mixing weight of each worker (default = 1/nWorkers each).</param>
+        /// <returns>The handle to the model averaging server is returned.</returns>
+        public long CreateModelAverager(int nCount, long hInitialWeights, int nWorkers, int nMaxStaleness = -1, int nQueueDepth = 4, List<double> rgWeights = null)
         {
-            List<double> rgDf = guidToArrayDouble(guid);
-            List<float> rg = new List<float>();
+            if (rgWeights != null && rgWeights.Count != nWorkers)
+                throw new ArgumentOutOfRangeException("rgWeights", "There must be one mixing weight per worker.");
 
-            foreach (double df in rgDf)
+            if (m_dt == DataType.DOUBLE)
             {
-                rg.Add((float)df);
+                List<double> rgArg = new List<double>() { nCount, nWorkers, nMaxStaleness, nQueueDepth, hInitialWeights };
+
+                if (rgWeights != null)
+                    rgArg.AddRange(rgWeights);
+
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_CREATE_MODELAVG, rgArg.ToArray());
+                return (long)rg[0];
             }
+            else
+            {
+                List<float> rgArg = new List<float>() { nCount, nWorkers, nMaxStaleness, nQueueDepth, hInitialWeights };
 
-            return rg;
+                if (rgWeights != null)
+                {
+                    for (int i = 0; i < rgWeights.Count; i++)
+                    {
+                        rgArg.Add((float)rgWeights[i]);
+                    }
+                }
+
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_CREATE_MODELAVG, rgArg.ToArray());
+                return (long)rg[0];
+            }
         }
 
         /// <summary>
-        /// Free an instance of NCCL.
+        /// Stops and frees the model averaging server associated with the handle.
         /// </summary>
-        /// <param name="hNccl">Specifies the handle to NCCL.</param>
-        public void FreeNCCL(long hNccl)
+        /// <param name="hAvg">Specifies the handle to the model averaging server.</param>
+        public void FreeModelAverager(long hAvg)
         {
             if (m_dt == DataType.DOUBLE)
-                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.FREE_NCCL, new double[] { hNccl });
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_FREE_MODELAVG, new double[] { hAvg });
             else
-                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.FREE_NCCL, new float[] { hNccl });
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_FREE_MODELAVG, new float[] { hAvg });
         }
 
         /// <summary>
-        /// Initializes a set of NCCL instances for use in a single process.
+        /// Queues a weight delta for the model averaging server without waiting for it to be applied.
         /// </summary>
-        /// <remarks>
-        /// See [Fast Multi-GPU collectives with NCCL](https://devblogs.nvidia.com/parallelforall/fast-multi-gpu-collectives-nccl/).
-        /// </remarks>
-        /// <param name="rghNccl">Specifies the array of NCCL handles that will be working together.</param>
-        public void NcclInitializeSingleProcess(params long[] rghNccl)
+        /// <param name="hAvg">Specifies the handle to the model averaging server.</param>
+        /// <param name="hStream">Specifies the stream on which the delta is copied into the queue (0 for the default stream).</param>
+        /// <param name="nWorker">Specifies the index of the pushing worker.</param>
+        /// <param name="hDelta">Specifies a handle to the GPU memory holding the weight delta.</param>
+        /// <param name="lBaseVersion">Specifies the master version (returned by <see cref="ModelAveragerPull"/>) the delta was computed from.</param>
+        /// <returns>Returns <i>true</i> when the delta was queued, or <i>false</i> when the queue was full and the delta was dropped.</returns>
+        public bool ModelAveragerPush(long hAvg, long hStream, int nWorker, long hDelta, long lBaseVersion)
         {
             if (m_dt == DataType.DOUBLE)
             {
-                List<double> rg = new List<double>() { 0, rghNccl.Length };
-
-                for (int i = 0; i < rghNccl.Length; i++)
-                {
-                    rg.Add(rghNccl[i]);
-                }
-
-                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_INIT_SINGLEPROCESS, rg.ToArray());
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_MODELAVG_PUSH, new double[] { hAvg, hStream, nWorker, hDelta, lBaseVersion });
+                return (rg[0] == 1.0) ? true : false;
             }
             else
             {
-                List<float> rg = new List<float>() { 0, rghNccl.Length };
-
-                for (int i = 0; i < rghNccl.Length; i++)
-                {
-                    rg.Add(rghNccl[i]);
-                }
-
-                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_INIT_SINGLEPROCESS, rg.ToArray());
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_MODELAVG_PUSH, new float[] { hAvg, hStream, nWorker, hDelta, lBaseVersion });
+                return (rg[0] == 1.0f) ? true : false;
             }
         }
 
         /// <summary>
-        /// Initializes a set of NCCL instances for use in different processes.
+        /// Copies the latest published master weights into the destination memory.
         /// </summary>
-        /// <remarks>
-        /// See [Fast Multi-GPU collectives with NCCL](https://devblogs.nvidia.com/parallelforall/fast-multi-gpu-collectives-nccl/).
-        /// </remarks>
-        /// <param name="hNccl">Specifies the handle of NCCL to initialize.</param>
-        public void NcclInitializeMultiProcess(long hNccl)
+        /// <param name="hAvg">Specifies the handle to the model averaging server.</param>
+        /// <param name="hStream">Specifies the stream used for the copy (0 for the default stream), use a dedicated stream to avoid waiting on other work.</param>
+        /// <param name="hDst">Specifies a handle to the GPU memory that receives the master weights.</param>
+        /// <returns>The version of the master weights copied is returned.</returns>
+        public long ModelAveragerPull(long hAvg, long hStream, long hDst)
         {
             if (m_dt == DataType.DOUBLE)
-                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_INIT_MULTIPROCESS, new double[] { hNccl });
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_MODELAVG_PULL, new double[] { hAvg, hStream, hDst });
+                return (long)rg[0];
+            }
             else
-                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_INIT_MULTIPROCESS, new float[] { hNccl });
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_MODELAVG_PULL, new float[] { hAvg, hStream, hDst });
+                return (long)rg[0];
+            }
         }
 
         /// <summary>
-        /// Broadcasts a block of GPU data to all NCCL instances.
+        /// Changes the mixing weight used when applying the deltas of a worker.
         /// </summary>
-        /// <remarks>
-        /// See [Fast Multi-GPU collectives with NCCL](https://devblogs.nvidia.com/parallelforall/fast-multi-gpu-collectives-nccl/).
-        /// </remarks>
-        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
-        /// <param name="hStream">Specifies a handle to the stream to use for synchronization.</param>
-        /// <param name="hX">Specifies a handle to the GPU data to be broadcasted (or recieved).</param>
-        /// <param name="nCount">Specifies the number of items (not bytes) in the data.</param>
-        public void NcclBroadcast(long hNccl, long hStream, long hX, int nCount)
+        /// <param name="hAvg">Specifies the handle to the model averaging server.</param>
+        /// <param name="nWorker">Specifies the index of the worker.</param>
+        /// <param name="dfWeight">Specifies the new mixing weight.</param>
+        public void ModelAveragerSetWeight(long hAvg, int nWorker, double dfWeight)
         {
-            Trace.WriteLine("Broadcasting from device ID " + GetDeviceID().ToString());
             if (m_dt == DataType.DOUBLE)
-                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_BROADCAST, new double[] { hNccl, hStream, hX, nCount });
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_MODELAVG_SET_WEIGHT, new double[] { hAvg, nWorker, dfWeight });
             else
-                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_BROADCAST, new float[] { hNccl, hStream, hX, nCount });
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_MODELAVG_SET_WEIGHT, new float[] { hAvg, nWorker, (float)dfWeight });
         }
 
         /// <summary>
-        /// Performs a reduction on all NCCL instances as specified by the reduction operation.
+        /// Returns the statistics of the model averaging server.
         /// </summary>
-        /// <remarks>
-        /// See [Fast Multi-GPU collectives with NCCL](https://devblogs.nvidia.com/parallelforall/fast-multi-gpu-collectives-nccl/).
-        /// </remarks>
-        /// <param name="hNccl">Specifies a handle to an NCCL instance.</param>
-        /// <param name="hStream">Specifies a handle to the stream to use for synchronization.</param>
-        /// <param name="hX">Specifies a handle to the GPU data to reduce with the other instances of NCCL.</param>
-        /// <param name="nCount">Specifies the number of items (not bytes) in the data.</param>
-        /// <param name="op">Specifies the reduction operation to perform.</param>
-        /// <param name="dfScale">Optionally, specifies a scaling to be applied to the final reduction.</param>
-        public void NcclAllReduce(long hNccl, long hStream, long hX, int nCount, NCCL_REDUCTION_OP op, double dfScale = 1.0)
+        /// <param name="hAvg">Specifies the handle to the model averaging server.</param>
+        /// <returns>The statistics are returned as: [version, pushed, applied, dropped stale, dropped full, average staleness, queued, last error].</returns>
+        public T[] GetModelAveragerStats(long hAvg)
         {
             if (m_dt == DataType.DOUBLE)
-                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.NCCL_ALLREDUCE, new double[] { hNccl, hStream, hX, nCount, (int)op, dfScale });
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_MODELAVG_GET_STATS, new double[] { hAvg });
+                return (T[])Convert.ChangeType(rg, typeof(T[]));
+            }
             else
-                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.NCCL_ALLREDUCE, new float[] { hNccl, hStream, hX, nCount, (int)op, (float)dfScale });
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_MODELAVG_GET_STATS, new float[] { hAvg });
+                return (T[])Convert.ChangeType(rg, typeof(T[]));
+            }
         }
 
         /// <summary>
@@ -4446,8 +5535,8 @@ namespace MyCaffe.common
         /// </summary>
         /// <param name="n">Specifies the number of items (not bytes) in the vector A.</param>
         /// <param name="hA">Specifies a handle to the vector A in GPU memory.</param>
-        /// <param name="hWork1">Specifies a handle to workspace data in GPU memory.  To get the size of the workspace memoory, call this function with hA = 0.</param>
-        /// <param name="hWork2">Specifies a handle to workspace data in GPU memory.  To get the size of the workspace memoory, call this function with hA = 0.</param>
+        /// <param name="hWork1">Specifies a handle to workspace data in GPU memory.  To get the size of the workspace memoory, call this function with hA = 0.  The workspace is no longer used, see calculate_stats.</param>
+        /// <param name="hWork2">Specifies a handle to workspace data in GPU memory.  To get the size of the workspace memoory, call this function with hA = 0.  The workspace is no longer used, see calculate_stats.</param>
         /// <param name="bDetectNans">Optionally, specifies whether or not to detect Nans.</param>
         /// <param name="nAOff">Optionally, specifies an offset (in items, not bytes) into the memory of A.</param>
         /// <returns>A four element tuple is returned where the first item contains the minimum, the second item contains the maximum, the third contains the number
@@ -4467,6 +5556,31 @@ namespace MyCaffe.common
             }
         }
 
+        /// <summary>
+        /// Calculates the statistics of A in a single pass over the data.
+        /// </summary>
+        /// <remarks>
+        /// The minimum and maximum include the Infinity values, the same as minmax, and are 0 when all values are NaN.  The
+        /// sum and sum of squares only include the finite values.  No workspace is needed.
+        /// </remarks>
+        /// <param name="n">Specifies the number of items (not bytes) in the vector A.</param>
+        /// <param name="hA">Specifies a handle to the vector A in GPU memory.</param>
+        /// <param name="nAOff">Optionally, specifies an offset (in items, not bytes) into the memory of A.</param>
+        /// <returns>A six element array is returned containing the minimum, maximum, sum, sum of squares, number of NaN values
+        /// and number of Infinity values.</returns>
+        public double[] calculate_stats(int n, long hA, int nAOff = 0)
+        {
+            if (m_dt == DataType.DOUBLE)
+            {
+                return m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_STATS, new double[] { n, hA, nAOff });
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_STATS, new float[] { n, hA, nAOff });
+                return rg.Select(p => (double)p).ToArray();
+            }
+        }
+
         /// <summary>
         /// Calculates the sum of squares of A.
         /// </summary>
@@ -4513,6 +5627,52 @@ namespace MyCaffe.common
             }
         }
 
+        /// <summary>
+        /// Evaluates a chain of element-wise operations over the inputs in a single pass.
+        /// </summary>
+        /// <remarks>
+        /// Each input is read and Y is written just once, rather than once for each operation in the chain.  For example
+        /// the sum of squared differences between A and B is given by the operations LOAD 0, LOAD 1, SUB, SQUARE with a
+        /// SUM reduction.  Up to 8 inputs and 32 operations are supported.
+        /// </remarks>
+        /// <param name="n">Specifies the number of items (not bytes) in the vectors.</param>
+        /// <param name="hY">Specifies a handle to the output vector Y in GPU memory, or 0 to only return the reduction.</param>
+        /// <param name="rghInputs">Specifies the handles to the input vectors in GPU memory.</param>
+        /// <param name="rgOps">Specifies the operations and their arguments in postfix order.</param>
+        /// <param name="reduction">Optionally, specifies the reduction of the results to return (default = NONE).</param>
+        /// <param name="nYOff">Optionally, specifies an offset (in items, not bytes) into the memory of Y.</param>
+        /// <param name="rgnInputOffsets">Optionally, specifies an offset (in items, not bytes) into the memory of each input.</param>
+        /// <returns>The reduction of the results is returned, or 0 when no reduction is performed.</returns>
+        public double fused_expr(int n, long hY, long[] rghInputs, List<Tuple<FUSED_OP, double>> rgOps, FUSED_REDUCTION reduction = FUSED_REDUCTION.NONE, int nYOff = 0, int[] rgnInputOffsets = null)
+        {
+            List<double> rgArg = new List<double>() { n, hY, nYOff, (int)reduction, rghInputs.Length };
+
+            for (int i = 0; i < rghInputs.Length; i++)
+            {
+                rgArg.Add(rghInputs[i]);
+                rgArg.Add((rgnInputOffsets == null) ? 0 : rgnInputOffsets[i]);
+            }
+
+            rgArg.Add(rgOps.Count);
+
+            foreach (Tuple<FUSED_OP, double> op in rgOps)
+            {
+                rgArg.Add((int)op.Item1);
+                rgArg.Add(op.Item2);
+            }
+
+            if (m_dt == DataType.DOUBLE)
+            {
+                double[] rg = m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_FUSED_EXPR, rgArg.ToArray());
+                return rg[0];
+            }
+            else
+            {
+                float[] rg = m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_FUSED_EXPR, rgArg.Select(p => (float)p).ToArray());
+                return rg[0];
+            }
+        }
+
         public void width(int n, long hMean, long hMin, long hMax, double dfAlpha, long hWidth) /** @private */
         {
             if (m_dt == DataType.DOUBLE)
@@ -4926,6 +6086,58 @@ namespace MyCaffe.common
             SetMemory(hY, rg);
         }
 
+        /// <summary>
+        /// Fill Y with items of a Philox counter based random stream.
+        /// </summary>
+        /// <remarks>
+        /// Each item only depends on the seed, the stream and its index lOffset + i, so the same items are made no
+        /// matter how a range is split between calls and without any generator state.  See [Parallel Random Numbers: As Easy as 1, 2, 3](http://www.thesalmons.org/john/random123/papers/random123sc11.pdf) by Salmon, et al., 2011.
+        /// 
+        /// Every method uses one word of the stream per item, where the GAUSSIAN items 2k and 2k+1 share the words 2k and 2k+1,
+        /// so the methods must not be used on the same range of the same stream.
+        /// </remarks>
+        /// <param name="method">Specifies the distribution of the items.</param>
+        /// <param name="n">Specifies the number of items (not bytes) in the vector Y.</param>
+        /// <param name="fA">Specifies the minimum, mean or non zero probability of the distribution.</param>
+        /// <param name="fB">Specifies the maximum or standard deviation of the distribution (not used by BERNOULLI).</param>
+        /// <param name="lSeed">Specifies the 64-bit seed.</param>
+        /// <param name="nStream">Specifies the stream of the seed, which must lie within [0, 0x3FFFFF].</param>
+        /// <param name="lOffset">Specifies the index of the first item within the stream.</param>
+        /// <param name="hY">Specifies a handle to the vector Y in GPU memory.</param>
+        public void rng_philox(PHILOX_METHOD method, int n, T fA, T fB, long lSeed, int nStream, long lOffset, long hY)
+        {
+            checkStream(nStream);
+
+            long[] rgSeed = splitLong(lSeed);
+            long[] rgOffset = splitLong(lOffset);
+
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_RNG_PHILOX, new double[] { (int)method, n, convertD(fA), convertD(fB), rgSeed[0], rgSeed[1], rgSeed[2], nStream, rgOffset[0], rgOffset[1], rgOffset[2], hY });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_RNG_PHILOX, new float[] { (int)method, n, convertF(fA), convertF(fB), rgSeed[0], rgSeed[1], rgSeed[2], nStream, rgOffset[0], rgOffset[1], rgOffset[2], hY });
+        }
+
+        /// <summary>
+        /// Splits a 64-bit value into three 22-bit parts, low part first, which are exact in the float parameters too.
+        /// </summary>
+        /// <param name="lVal">Specifies the value to split.</param>
+        /// <returns>The three parts are returned.</returns>
+        private static long[] splitLong(long lVal)
+        {
+            ulong ulVal = (ulong)lVal;
+            return new long[] { (long)(ulVal & 0x3FFFFF), (long)((ulVal >> 22) & 0x3FFFFF), (long)(ulVal >> 44) };
+        }
+
+        /// <summary>
+        /// Checks that a Philox stream lies within 22 bits, like the parts of splitLong, so that it is exact in the float parameters.
+        /// </summary>
+        /// <param name="nStream">Specifies the stream to check.</param>
+        private static void checkStream(int nStream)
+        {
+            if (nStream < 0 || nStream > 0x3FFFFF)
+                throw new ArgumentOutOfRangeException("nStream", "The Philox stream must lie within [0, 0x3FFFFF].");
+        }
+
         public void fill_random(T fNonZeroProb, T[] rg) /** @private */
         {
             double dfNonZeroProb = Utility.ConvertVal<T>(fNonZeroProb);
@@ -5028,12 +6240,14 @@ namespace MyCaffe.common
         /// <param name="hTopData">Specifies a handle to the top data in GPU memory.</param>
         /// <param name="hMask">Specifies a handle to the mask data in GPU memory.</param>
         /// <param name="hTopMask">Specifies a handle to the top mask data in GPU memory.</param>
-        public void pooling_fwd(POOLING_METHOD method, int nCount, long hBottomData, int num, int nChannels, int nHeight, int nWidth, int nPooledHeight, int nPooledWidth, int nKernelH, int nKernelW, int nStrideH, int nStrideW, int nPadH, int nPadW, long hTopData, long hMask, long hTopMask)
+        /// <param name="bUseCompactMask">Optionally, specifies to store the MAX mask in hMask as one byte per item holding the index of the maximum within its window (default = false).
+        /// The hMask memory then only needs one byte per pooled item (num * nChannels * nPooledHeight * nPooledWidth bytes), the same setting must be used on the backward pass, and the kernel size must be less than 255.</param>
+        public void pooling_fwd(POOLING_METHOD method, int nCount, long hBottomData, int num, int nChannels, int nHeight, int nWidth, int nPooledHeight, int nPooledWidth, int nKernelH, int nKernelW, int nStrideH, int nStrideW, int nPadH, int nPadW, long hTopData, long hMask, long hTopMask, bool bUseCompactMask = false)
         {
             if (m_dt == DataType.DOUBLE)
-                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_POOL_FWD, new double[] { (int)method, nCount, hBottomData, num, nChannels, nHeight, nWidth, nPooledHeight, nPooledWidth, nKernelH, nKernelW, nStrideH, nStrideW, nPadH, nPadW, hTopData, hMask, hTopMask });
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_POOL_FWD, new double[] { (int)method, nCount, hBottomData, num, nChannels, nHeight, nWidth, nPooledHeight, nPooledWidth, nKernelH, nKernelW, nStrideH, nStrideW, nPadH, nPadW, hTopData, hMask, hTopMask, (bUseCompactMask) ? 1 : 0 });
             else
-                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_POOL_FWD, new float[] { (int)method, nCount, hBottomData, num, nChannels, nHeight, nWidth, nPooledHeight, nPooledWidth, nKernelH, nKernelW, nStrideH, nStrideW, nPadH, nPadW, hTopData, hMask, hTopMask });
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_POOL_FWD, new float[] { (int)method, nCount, hBottomData, num, nChannels, nHeight, nWidth, nPooledHeight, nPooledWidth, nKernelH, nKernelW, nStrideH, nStrideW, nPadH, nPadW, hTopData, hMask, hTopMask, (bUseCompactMask) ? 1 : 0 });
         }
 
         /// <summary>
@@ -5057,12 +6271,14 @@ namespace MyCaffe.common
         /// <param name="hBottomDiff">Specifies a handle to the bottom diff in GPU memory.</param>
         /// <param name="hMask">Specifies a handle to the mask data in GPU memory.</param>
         /// <param name="hTopMask">Specifies a handle to the top mask data in GPU memory.</param>
-        public void pooling_bwd(POOLING_METHOD method, int nCount, long hTopDiff, int num, int nChannels, int nHeight, int nWidth, int nPooledHeight, int nPooledWidth, int nKernelH, int nKernelW, int nStrideH, int nStrideW, int nPadH, int nPadW, long hBottomDiff, long hMask, long hTopMask)
+        /// <param name="bUseCompactMask">Optionally, specifies to store the MAX mask in hMask as one byte per item holding the index of the maximum within its window (default = false).
+        /// The hMask memory then only needs one byte per pooled item (num * nChannels * nPooledHeight * nPooledWidth bytes), the same setting must be used on the backward pass, and the kernel size must be less than 255.</param>
+        public void pooling_bwd(POOLING_METHOD method, int nCount, long hTopDiff, int num, int nChannels, int nHeight, int nWidth, int nPooledHeight, int nPooledWidth, int nKernelH, int nKernelW, int nStrideH, int nStrideW, int nPadH, int nPadW, long hBottomDiff, long hMask, long hTopMask, bool bUseCompactMask = false)
         {
             if (m_dt == DataType.DOUBLE)
-                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_POOL_BWD, new double[] { (int)method, nCount, hTopDiff, num, nChannels, nHeight, nWidth, nPooledHeight, nPooledWidth, nKernelH, nKernelW, nStrideH, nStrideW, nPadH, nPadW, hBottomDiff, hMask, hTopMask });
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_POOL_BWD, new double[] { (int)method, nCount, hTopDiff, num, nChannels, nHeight, nWidth, nPooledHeight, nPooledWidth, nKernelH, nKernelW, nStrideH, nStrideW, nPadH, nPadW, hBottomDiff, hMask, hTopMask, (bUseCompactMask) ? 1 : 0 });
             else
-                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_POOL_BWD, new float[] { (int)method, nCount, hTopDiff, num, nChannels, nHeight, nWidth, nPooledHeight, nPooledWidth, nKernelH, nKernelW, nStrideH, nStrideW, nPadH, nPadW, hBottomDiff, hMask, hTopMask });
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_POOL_BWD, new float[] { (int)method, nCount, hTopDiff, num, nChannels, nHeight, nWidth, nPooledHeight, nPooledWidth, nKernelH, nKernelW, nStrideH, nStrideW, nPadH, nPadW, hBottomDiff, hMask, hTopMask, (bUseCompactMask) ? 1 : 0 });
         }
 
         /// <summary>
@@ -5318,6 +6534,64 @@ namespace MyCaffe.common
                 m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_DROPOUT_BWD, new float[] { nCount, hTopDiff, hMask, uiThreshold, convertF(fScale), hBottomDiff });
         }
 
+        /// <summary>
+        /// Performs a dropout forward pass in Cuda with the mask made from a Philox random stream.
+        /// </summary>
+        /// <remarks>
+        /// Item i is kept when word lOffset + i of the stream is above the threshold, so no mask needs to be kept between
+        /// the passes: the backward pass makes the same mask again from the same seed, stream and offset.  When hMaskBits
+        /// is not 0 the mask is also stored with one bit per item, which needs (nCount + 31) / 32 32-bit words.
+        /// </remarks>
+        /// <param name="nCount">Specifies the number of items.</param>
+        /// <param name="hBottomData">Specifies a handle to the bottom data in GPU memory.</param>
+        /// <param name="hMaskBits">Optionally, specifies a handle to the bit mask in GPU memory, or 0 to not store the mask.</param>
+        /// <param name="uiThreshold">Specifies the threshold value: when the random word is not above the threshold, the data item is 'dropped out' by setting the data item to zero.</param>
+        /// <param name="fScale">Specifies a scale value applied to each item that is not dropped out.</param>
+        /// <param name="lSeed">Specifies the 64-bit seed of the random stream.</param>
+        /// <param name="nStream">Specifies the random stream of the seed, which must lie within [0, 0x3FFFFF].</param>
+        /// <param name="lOffset">Specifies the index of the word used by the first item.</param>
+        /// <param name="hTopData">Specifies a handle to the top data in GPU memory.</param>
+        public void dropout_fwd_bits(int nCount, long hBottomData, long hMaskBits, uint uiThreshold, T fScale, long lSeed, int nStream, long lOffset, long hTopData)
+        {
+            checkStream(nStream);
+
+            long[] rgSeed = splitLong(lSeed);
+            long[] rgOffset = splitLong(lOffset);
+
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_DROPOUT_FWD_BITS, new double[] { nCount, hBottomData, hMaskBits, uiThreshold, convertD(fScale), rgSeed[0], rgSeed[1], rgSeed[2], nStream, rgOffset[0], rgOffset[1], rgOffset[2], hTopData });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_DROPOUT_FWD_BITS, new float[] { nCount, hBottomData, hMaskBits, uiThreshold, convertF(fScale), rgSeed[0], rgSeed[1], rgSeed[2], nStream, rgOffset[0], rgOffset[1], rgOffset[2], hTopData });
+        }
+
+        /// <summary>
+        /// Performs a dropout backward pass in Cuda with the mask of dropout_fwd_bits.
+        /// </summary>
+        /// <remarks>
+        /// When hMaskBits is 0 the mask is made again from the seed, stream and offset, which must be those used by the forward pass.
+        /// </remarks>
+        /// <param name="nCount">Specifies the number of items.</param>
+        /// <param name="hTopDiff">Specifies a handle to the top diff in GPU memory.</param>
+        /// <param name="hMaskBits">Optionally, specifies a handle to the bit mask stored by the forward pass, or 0 to make the mask again.</param>
+        /// <param name="uiThreshold">Specifies the threshold value used by the forward pass.</param>
+        /// <param name="fScale">Specifies a scale value applied to each item that is not dropped out.</param>
+        /// <param name="lSeed">Specifies the 64-bit seed used by the forward pass.</param>
+        /// <param name="nStream">Specifies the random stream used by the forward pass.</param>
+        /// <param name="lOffset">Specifies the offset used by the forward pass.</param>
+        /// <param name="hBottomDiff">Specifies a handle to the bottom diff in GPU memory.</param>
+        public void dropout_bwd_bits(int nCount, long hTopDiff, long hMaskBits, uint uiThreshold, T fScale, long lSeed, int nStream, long lOffset, long hBottomDiff)
+        {
+            checkStream(nStream);
+
+            long[] rgSeed = splitLong(lSeed);
+            long[] rgOffset = splitLong(lOffset);
+
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_DROPOUT_BWD_BITS, new double[] { nCount, hTopDiff, hMaskBits, uiThreshold, convertD(fScale), rgSeed[0], rgSeed[1], rgSeed[2], nStream, rgOffset[0], rgOffset[1], rgOffset[2], hBottomDiff });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_DROPOUT_BWD_BITS, new float[] { nCount, hTopDiff, hMaskBits, uiThreshold, convertF(fScale), rgSeed[0], rgSeed[1], rgSeed[2], nStream, rgOffset[0], rgOffset[1], rgOffset[2], hBottomDiff });
+        }
+
         /// <summary>
         /// Performs a binomial normal log liklihod (BNLL) forward pass in Cuda.
         /// </summary>
@@ -5487,6 +6761,35 @@ namespace MyCaffe.common
             }
         }
 
+        /// <summary>
+        /// Performs the Softmax and Softmax Loss forward passes in one step in Cuda, and optionally the backward pass.
+        /// </summary>
+        /// <remarks>
+        /// The log softmax is calculated straight from the bottom data with a running max and sum, so the probabilities
+        /// do not need to be written and read back.  The loss and counts are the same as softmax followed by softmaxloss_fwd,
+        /// and hBottomDiff receives the unscaled gradient of softmaxloss_bwd.
+        /// </remarks>
+        /// <param name="nCount">Specifies the number of items, which is nOuterNum * nInnerNum.</param>
+        /// <param name="hBottomData">Specifies a handle to the bottom data (the inputs to the softmax) in GPU memory.</param>
+        /// <param name="hLabel">Specifies a handle to the label data in GPU memory.</param>
+        /// <param name="hLossData">Specifies a handle to the loss data in GPU memory.</param>
+        /// <param name="nOuterNum">Specifies the outer count, the items before the softmax axis.</param>
+        /// <param name="nDim">Specifies the number of items per outer item, the channels times nInnerNum.</param>
+        /// <param name="nInnerNum">Specifies the inner count, the items after the softmax axis.</param>
+        /// <param name="hCounts">Specifies a handle to the counts in GPU memory.</param>
+        /// <param name="nIgnoreLabel">Optionally, specifies a label to ignore.</param>
+        /// <param name="hProbData">Optionally, specifies a handle to the GPU memory that receives the probabilities (default = 0 to skip).</param>
+        /// <param name="hBottomDiff">Optionally, specifies a handle to the GPU memory that receives the bottom diff (default = 0 to skip).</param>
+        public void softmaxloss_fused(int nCount, long hBottomData, long hLabel, long hLossData, int nOuterNum, int nDim, int nInnerNum, long hCounts, int? nIgnoreLabel, long hProbData = 0, long hBottomDiff = 0)
+        {
+            int nIgnore = (nIgnoreLabel.HasValue) ? nIgnoreLabel.Value : -1;
+
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_SOFTMAXLOSS_FUSED, new double[] { nCount, hBottomData, hLabel, hLossData, nOuterNum, nDim, nInnerNum, hCounts, nIgnore, hProbData, hBottomDiff });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_SOFTMAXLOSS_FUSED, new float[] { nCount, hBottomData, hLabel, hLossData, nOuterNum, nDim, nInnerNum, hCounts, nIgnore, hProbData, hBottomDiff });
+        }
+
 
         /// <summary>
         /// Performs a max forward pass in Cuda.
@@ -5937,6 +7240,60 @@ namespace MyCaffe.common
                 m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_RMSPROP_UPDATE, new float[] { nCount, hNetParamsDiff, hHistoryData, convertF(fRmsDecay), convertF(fDelta), convertF(fLocalRate) });
         }
 
+        /// <summary>
+        /// Perform the weight decay and optimizer step of a list of parameters in a single call.
+        /// </summary>
+        /// <remarks>
+        /// Each diff is scaled by the gradient scale, the weight decay is added and the step of the method is
+        /// applied, the update is then written to the diff and, when 'bUpdateData' is <i>true</i>, subtracted
+        /// from the data.  The items of all parameters are split into equal chunks so that many small parameters
+        /// are updated with one kernel launch.
+        /// </remarks>
+        /// <param name="method">Specifies the optimizer step to apply.</param>
+        /// <param name="reg">Specifies the weight decay to apply.</param>
+        /// <param name="fGradScale">Specifies the scale applied to each diff, such as the gradient clipping scale.</param>
+        /// <param name="fMomentum">Specifies the momentum, Adam beta1 or RmsProp decay.</param>
+        /// <param name="fMomentum2">Specifies the Adam beta2.</param>
+        /// <param name="fDelta">Specifies the delta, or the Adam eps_hat.</param>
+        /// <param name="bUpdateData">Specifies whether or not to subtract the update from the data.</param>
+        /// <param name="rghData">Specifies the handles to the data of each parameter in GPU memory.</param>
+        /// <param name="rghDiff">Specifies the handles to the diff of each parameter in GPU memory.</param>
+        /// <param name="rghHistory1">Specifies the handles to the first history of each parameter in GPU memory.</param>
+        /// <param name="rghHistory2">Specifies the handles to the second history of each parameter in GPU memory, only used by AdaDelta and Adam.</param>
+        /// <param name="rgnCount">Specifies the number of items of each parameter.</param>
+        /// <param name="rgfLocalRate">Specifies the local learning rate of each parameter, including the learning rate schedule.</param>
+        /// <param name="rgfLocalDecay">Specifies the local weight decay of each parameter.</param>
+        public void update_foreach(UPDATE_METHOD method, UPDATE_REGULARIZATION reg, T fGradScale, T fMomentum, T fMomentum2, T fDelta, bool bUpdateData, List<long> rghData, List<long> rghDiff, List<long> rghHistory1, List<long> rghHistory2, List<int> rgnCount, List<T> rgfLocalRate, List<T> rgfLocalDecay)
+        {
+            int nTensors = rgnCount.Count;
+
+            if (rghData.Count != nTensors || rghDiff.Count != nTensors || rghHistory1.Count != nTensors || rghHistory2.Count != nTensors || rgfLocalRate.Count != nTensors || rgfLocalDecay.Count != nTensors)
+                throw new Exception("The parameter lists must all have the same count.");
+
+            if (m_dt == DataType.DOUBLE)
+            {
+                List<double> rgArg = new List<double>() { (int)method, (int)reg, convertD(fGradScale), convertD(fMomentum), convertD(fMomentum2), convertD(fDelta), (bUpdateData) ? 1 : 0, nTensors };
+
+                for (int i = 0; i < nTensors; i++)
+                {
+                    rgArg.AddRange(new double[] { rghData[i], rghDiff[i], rghHistory1[i], rghHistory2[i], rgnCount[i], convertD(rgfLocalRate[i]), convertD(rgfLocalDecay[i]) });
+                }
+
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_UPDATE_FOREACH, rgArg.ToArray());
+            }
+            else
+            {
+                List<float> rgArg = new List<float>() { (int)method, (int)reg, convertF(fGradScale), convertF(fMomentum), convertF(fMomentum2), convertF(fDelta), (bUpdateData) ? 1 : 0, nTensors };
+
+                for (int i = 0; i < nTensors; i++)
+                {
+                    rgArg.AddRange(new float[] { rghData[i], rghDiff[i], rghHistory1[i], rghHistory2[i], rgnCount[i], convertF(rgfLocalRate[i]), convertF(rgfLocalDecay[i]) });
+                }
+
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_UPDATE_FOREACH, rgArg.ToArray());
+            }
+        }
+
         /// <summary>
         /// Peforms the simple LSTM foward pass in Cuda.
         /// </summary>
@@ -6009,6 +7366,70 @@ namespace MyCaffe.common
                 m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_LSTM_BWD, new float[] { t, nN, nH, (float)dfClippingThreshold, hWeight_h, hClipData, nClipOffset, hTopDiff, nTopOffset, hCellData, hCellDiff, nCellOffset, hPreGateDiff, nPreGateOffset, hGateData, hGateDiff, nGateOffset, hCT1Data, nCT1Offset, hDHT1Diff, nDHT1Offset, hDCT1Diff, nDCT1Offset, hHtoHData });
         }
 
+        /// <summary>
+        /// Performs the simple LSTM forward pass of a whole sequence in Cuda.
+        /// </summary>
+        /// <remarks>
+        /// This is the same as the input projection followed by calling lstm_fwd for each step, but the input projection
+        /// of all steps is made with one gemm and the activations and cell update of each step are fused into one kernel.
+        /// The data is ordered (T, N, ...).
+        /// </remarks>
+        /// <param name="nT">Specifies the number of steps.</param>
+        /// <param name="nN">Specifies the number of batch items.</param>
+        /// <param name="nH">Specifies the hidden size.</param>
+        /// <param name="nI">Specifies the input size.</param>
+        /// <param name="hWeight_i">Specifies a handle to the input weights (4H x I) in GPU memory.</param>
+        /// <param name="hWeight_h">Specifies a handle to the recurrent weights (4H x H) in GPU memory.</param>
+        /// <param name="hBias">Optionally, specifies a handle to the bias (4H) in GPU memory, or 0 to ignore.</param>
+        /// <param name="hBottomData">Specifies a handle to the input data (T x N x I) in GPU memory.</param>
+        /// <param name="hClipData">Optionally, specifies a handle to the clip data (T x N) in GPU memory, or 0 to ignore.</param>
+        /// <param name="hH0Data">Specifies a handle to the initial hidden state (N x H) in GPU memory.</param>
+        /// <param name="hC0Data">Specifies a handle to the initial cell state (N x H) in GPU memory.</param>
+        /// <param name="hTopData">Specifies a handle to the hidden states (T x N x H) in GPU memory.</param>
+        /// <param name="hCellData">Specifies a handle to the cell states (T x N x H) in GPU memory.</param>
+        /// <param name="hPreGateData">Specifies a handle to the pre-gate data (T x N x 4H) in GPU memory.</param>
+        /// <param name="hGateData">Specifies a handle to the gate data (T x N x 4H) in GPU memory.</param>
+        /// <param name="hHtoGateData">Specifies a handle to the recurrent product workspace (N x 4H) in GPU memory.</param>
+        public void lstm_seq_fwd(int nT, int nN, int nH, int nI, long hWeight_i, long hWeight_h, long hBias, long hBottomData, long hClipData, long hH0Data, long hC0Data, long hTopData, long hCellData, long hPreGateData, long hGateData, long hHtoGateData)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_LSTM_SEQ_FWD, new double[] { nT, nN, nH, nI, hWeight_i, hWeight_h, hBias, hBottomData, hClipData, hH0Data, hC0Data, hTopData, hCellData, hPreGateData, hGateData, hHtoGateData });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_LSTM_SEQ_FWD, new float[] { nT, nN, nH, nI, hWeight_i, hWeight_h, hBias, hBottomData, hClipData, hH0Data, hC0Data, hTopData, hCellData, hPreGateData, hGateData, hHtoGateData });
+        }
+
+        /// <summary>
+        /// Performs the simple LSTM backward pass of a whole sequence in Cuda.
+        /// </summary>
+        /// <remarks>
+        /// This is the same as calling lstm_bwd for each step from the last to the first, where each step runs one fused
+        /// kernel and the recurrent gemm.  The diff of the last cell must already be in the cell diff, and the recurrent
+        /// diff of the first step is added to the H0 diff.
+        /// </remarks>
+        /// <param name="nT">Specifies the number of steps.</param>
+        /// <param name="nN">Specifies the number of batch items.</param>
+        /// <param name="nH">Specifies the hidden size.</param>
+        /// <param name="dfClippingThreshold">Specifies the threshold the pre-gate diffs are clipped to, or 0 to ignore.</param>
+        /// <param name="hWeight_h">Specifies a handle to the recurrent weights (4H x H) in GPU memory.</param>
+        /// <param name="hClipData">Optionally, specifies a handle to the clip data (T x N) in GPU memory, or 0 to ignore.</param>
+        /// <param name="hTopDiff">Specifies a handle to the hidden state diffs (T x N x H) in GPU memory, the recurrent diffs are added in.</param>
+        /// <param name="hCellData">Specifies a handle to the cell states (T x N x H) in GPU memory.</param>
+        /// <param name="hCellDiff">Specifies a handle to the cell state diffs (T x N x H) in GPU memory.</param>
+        /// <param name="hPreGateDiff">Specifies a handle to the pre-gate diffs (T x N x 4H) in GPU memory.</param>
+        /// <param name="hGateData">Specifies a handle to the gate data (T x N x 4H) in GPU memory.</param>
+        /// <param name="hGateDiff">Specifies a handle to the gate diffs (T x N x 4H) in GPU memory.</param>
+        /// <param name="hC0Data">Specifies a handle to the initial cell state (N x H) in GPU memory.</param>
+        /// <param name="hH0Diff">Specifies a handle to the initial hidden state diff (N x H) in GPU memory.</param>
+        /// <param name="hC0Diff">Specifies a handle to the initial cell state diff (N x H) in GPU memory.</param>
+        /// <param name="hHtoHData">Specifies a handle to the recurrent diff workspace (N x H) in GPU memory.</param>
+        public void lstm_seq_bwd(int nT, int nN, int nH, double dfClippingThreshold, long hWeight_h, long hClipData, long hTopDiff, long hCellData, long hCellDiff, long hPreGateDiff, long hGateData, long hGateDiff, long hC0Data, long hH0Diff, long hC0Diff, long hHtoHData)
+        {
+            if (m_dt == DataType.DOUBLE)
+                m_cuda.RunDouble((int)m_hKernel, (int)CUDAFN.CUDA_LSTM_SEQ_BWD, new double[] { nT, nN, nH, dfClippingThreshold, hWeight_h, hClipData, hTopDiff, hCellData, hCellDiff, hPreGateDiff, hGateData, hGateDiff, hC0Data, hH0Diff, hC0Diff, hHtoHData });
+            else
+                m_cuda.RunFloat((int)m_hKernel, (int)CUDAFN.CUDA_LSTM_SEQ_BWD, new float[] { nT, nN, nH, (float)dfClippingThreshold, hWeight_h, hClipData, hTopDiff, hCellData, hCellDiff, hPreGateDiff, hGateData, hGateDiff, hC0Data, hH0Diff, hC0Diff, hHtoHData });
+        }
+
         /// <summary>
         /// Peforms the simple LSTM foward pass in Cuda for a given LSTM unit.
         /// </summary>
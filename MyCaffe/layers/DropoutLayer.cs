@@ -20,10 +20,6 @@ namespace MyCaffe.layers
     /// <typeparam name="T">Specifies the base type <i>float</i> or <i>double</i>.  Using <i>float</i> is recommended to conserve GPU memory.</typeparam>
     public class DropoutLayer<T> : NeuronLayer<T>
     {
-        /// <summary>
-        /// When divided by UINT_MAX, the randomly generated values of u\sim U(0,1)
-        /// </summary>
-        Blob<T> m_blobRand;
         /// <summary>
         /// The probability p of dropping any input.
         /// </summary>
@@ -33,6 +29,14 @@ namespace MyCaffe.layers
         /// </summary>
         double m_dfScale;
         uint m_uiThreshold;
+        /// <summary>
+        /// The seed and stream of the Philox random stream, where each forward pass
+        /// uses the next count() words of the stream as the values of u.
+        /// </summary>
+        long m_lSeed;
+        int m_nStream;
+        long m_lOffset = 0;
+        long m_lMaskOffset = 0;
 
         long m_hCuda = 0;
         long m_hBottomDesc = 0;
@@ -58,18 +62,11 @@ namespace MyCaffe.layers
             : base(cuda, log, p)
         {
             m_type = LayerParameter.LayerType.DROPOUT;
-            m_blobRand = new Blob<T>(cuda, log);
         }
 
         /** @copydoc Layer::dispose */
         protected override void dispose()
         {
-            if (m_blobRand != null)
-            {
-                m_blobRand.Dispose();
-                m_blobRand = null;
-            }
-
             if (m_hDropoutDesc != 0)
             {
                 m_cuda.FreeDropoutDesc(m_hDropoutDesc);
@@ -119,13 +116,65 @@ namespace MyCaffe.layers
             m_uiThreshold = (uint)(uint.MaxValue * m_dfThreshold);
 
             if (!m_param.dropout_param.useCudnn())
+            {
+                // When no seed is given it is drawn from the seeded cuRand generator
+                // so that the solver's random_seed makes the masks reproducible, and
+                // each layer uses its own stream so that layers of the same shape do
+                // not share masks.
+                m_lSeed = m_param.dropout_param.seed;
+                m_nStream = getStream(m_param.name);
+
+                if (m_lSeed == 0)
+                    m_lSeed = drawSeed();
+
                 return;
+            }
 
             m_hCuda = m_cuda.CreateCuDNN();
             m_hBottomDesc = m_cuda.CreateTensorDesc();
             m_hDropoutDesc = m_cuda.CreateDropoutDesc();
         }
 
+        private long drawSeed()
+        {
+            long hSeed = m_cuda.AllocMemory(3);
+
+            try
+            {
+                // Draw three 22-bit parts, which are exact in float.
+                m_cuda.rng_uniform(3, 0.0, 4194304.0, hSeed);
+                double[] rgSeed = convertD(m_cuda.GetMemory(hSeed));
+                long lSeed = 0;
+
+                for (int i = 0; i < 3; i++)
+                {
+                    lSeed |= (Math.Min((long)rgSeed[i], 0x3FFFFF)) << (22 * i);
+                }
+
+                return lSeed;
+            }
+            finally
+            {
+                m_cuda.FreeMemory(hSeed);
+            }
+        }
+
+        private static int getStream(string strName)
+        {
+            // FNV-1a hash of the layer name, kept to 22 bits so that it is exact in float.
+            uint uiHash = 2166136261;
+
+            if (strName != null)
+            {
+                foreach (char ch in strName)
+                {
+                    uiHash = (uiHash ^ ch) * 16777619;
+                }
+            }
+
+            return (int)(uiHash & 0x3FFFFF);
+        }
+
         /// <summary>
         /// Reshape the bottom (input) and top (output) blobs.
         /// </summary>
@@ -135,9 +184,6 @@ namespace MyCaffe.layers
         {
             base.Reshape(colBottom, colTop);
 
-            // Setup the cache for random number generation
-            m_blobRand.ReshapeLike(colBottom[0]);
-
             if (!m_param.dropout_param.useCudnn())
                 return;
 
@@ -227,7 +273,9 @@ namespace MyCaffe.layers
         ///         0 & \mbox{otherwise}
         ///       \end{array} \right.
         ///     @f$, where @f$ u \sim U(0,1) @f$ is generated independently for each
-        ///     input at each iteration.  At test time, we simply have
+        ///     input at each iteration from a Philox counter based random stream.  No
+        ///     mask is stored, the backward pass makes the same values of @f$ u @f$ again
+        ///     from the seed and the stream offset of the forward pass.  At test time, we simply have
         ///     @f$ y_{\mbox{test}} = \mathbb{E}[y_{\mbox{train}}] = x @f$.
         ///     
         /// Note: during TESTING and RUN, this layer merely acts as a pass-through.
@@ -247,11 +295,10 @@ namespace MyCaffe.layers
 
             if (m_phase == Phase.TRAIN)
             {
-                long hMask = m_blobRand.mutable_gpu_data;
+                m_lMaskOffset = m_lOffset;
+                m_lOffset += nCount;
 
-                m_cuda.rng_uniform(nCount, m_tZero, convert(uint.MaxValue), hMask);
-                // set thresholds
-                m_cuda.dropout_fwd(nCount, hBottomData, hMask, m_uiThreshold, convert(m_dfScale), hTopData);
+                m_cuda.dropout_fwd_bits(nCount, hBottomData, 0, m_uiThreshold, convert(m_dfScale), m_lSeed, m_nStream, m_lMaskOffset, hTopData);
             }
             else
             {
@@ -275,10 +322,9 @@ namespace MyCaffe.layers
 
             if (m_phase == Phase.TRAIN)
             {
-                long hMask = m_blobRand.gpu_data;
                 int nCount = colBottom[0].count();
 
-                m_cuda.dropout_bwd(nCount, hTopDiff, hMask, m_uiThreshold, convert(m_dfScale), hBottomDiff);
+                m_cuda.dropout_bwd_bits(nCount, hTopDiff, 0, m_uiThreshold, convert(m_dfScale), m_lSeed, m_nStream, m_lMaskOffset, hBottomDiff);
             }
             else
             {
@@ -288,59 +288,24 @@ namespace MyCaffe.layers
                 m_blob_H_0.SetData(0.0);
             }
 
-            // Compute input to hidden forward propagation.
-            m_cuda.gemm(false, true, m_nT * m_nN, 4 * m_nH, m_nI, m_tOne, hBottomData, hWeight_i, m_tZero, hPreGateData);
-            m_cuda.gemm(false, false, m_nT * m_nN, 4 * m_nH, 1, m_tOne, m_blobBiasMultiplier.gpu_data, hBias, m_tOne, hPreGateData);
-
-            // Compute recurrent forward propagation                
-            for (int t = 0; t < m_nT; t++)
-            {
-                int nTopOffset = m_blobTop.offset(t);
-                int nCellOffset = m_blobCell.offset(t);
-                int nPreGateOffset = m_blobPreGate.offset(t);
-                int nGateOffset = m_blobGate.offset(t);
-                int nClipOffset = (hClipData != 0) ? colBottom[1].offset(t) : 0;
-                int nHT1Offset;
-                long hHT1Data;
-                int nCT1Offset;
-                long hCT1Data;
-
-                if (t == 0)
-                {
-                    hHT1Data = m_blob_H_0.gpu_data;
-                    nHT1Offset = 0;
-                    hCT1Data = m_blob_C_0.gpu_data;
-                    nCT1Offset = 0;
-                }
-                else
-                {
-                    hHT1Data = m_blob_H_T.gpu_data;
-                    nHT1Offset = -m_blobTop.offset(1);
-                    hCT1Data = m_blob_C_T.gpu_data;
-                    nCT1Offset = -m_blobCell.offset(1);
-                }
-
-                m_cuda.lstm_fwd(t,
+            // Compute the input to hidden projection of all steps and the
+            // recurrent forward propagation in one call.
+            m_cuda.lstm_seq_fwd(m_nT,
                                 m_nN,
                                 m_nH,
-                                hWeight_h,
+                                m_nI,
                                 hWeight_i,
+                                hWeight_h,
+                                hBias,
+                                hBottomData,
                                 hClipData,
-                                nClipOffset,
-                                hTopData,       // h_t data
-                                nTopOffset,     // h_t offset
-                                hCellData,      // c_t data
-                                nCellOffset,    // c_t offset
+                                m_blob_H_0.gpu_data,
+                                m_blob_C_0.gpu_data,
+                                hTopData,
+                                hCellData,
                                 hPreGateData,
-                                nPreGateOffset,
                                 hGateData,
-                                nGateOffset,
-                                hHT1Data,
-                                nHT1Offset,
-                                hCT1Data,
-                                nCT1Offset,
                                 hHtoGateData);
-            }
 
             // Preserve cell state and output value for truncated BPTT
             m_cuda.copy(m_nN * m_nH, hCellData, m_blob_C_T.mutable_gpu_data, m_blobCell.offset(m_nT - 1));
@@ -382,64 +347,22 @@ namespace MyCaffe.layers
 
             m_cuda.copy(m_nN * m_nH, m_blob_C_T.gpu_diff, hCellDiff, 0, m_blobCell.offset(m_nT - 1));
 
-            for (int t = m_nT - 1; t >= 0; t--)
-            {
-                int nTopOffset = m_blobTop.offset(t);
-                int nCellOffset = m_blobCell.offset(t);
-                int nGateOffset = m_blobGate.offset(t);
-                int nPreGateOffset = m_blobPreGate.offset(t);
-                int nClipOffset = (hClipData == 0) ? 0 : colBottom[1].offset(t);
-                int nCT1Offset;
-                long hCT1Data;
-                int nDHT1Offset;
-                long hDHT1Diff;
-                int nDCT1Offset;
-                long hDCT1Diff;
-
-                if (t == 0)
-                {
-                    nCT1Offset = 0;
-                    hCT1Data = m_blob_C_0.gpu_data;
-                    nDHT1Offset = 0;
-                    hDHT1Diff = m_blob_H_0.mutable_gpu_diff;
-                    nDCT1Offset = 0;
-                    hDCT1Diff = m_blob_C_0.mutable_gpu_diff;
-                }
-                else
-                {
-                    nCT1Offset = m_blobCell.offset(t - 1);
-                    hCT1Data = hCellData;
-                    nDHT1Offset = m_blobTop.offset(t - 1);
-                    hDHT1Diff = hTopDiff;
-                    nDCT1Offset = m_blobCell.offset(t - 1);
-                    hDCT1Diff = hCellDiff;
-                }
-
-                m_cuda.lstm_bwd(t, 
-                                m_nN, 
-                                m_nH, 
-                                m_dfClippingThreshold, 
-                                hWeight_h, 
-                                hClipData, 
-                                nClipOffset, 
-                                hTopDiff, 
-                                nTopOffset, 
-                                hCellData, 
-                                hCellDiff, 
-                                nCellOffset, 
-                                hPreGateDiff, 
-                                nPreGateOffset, 
-                                hGateData, 
-                                hGateDiff, 
-                                nGateOffset, 
-                                hCT1Data, 
-                                nCT1Offset, 
-                                hDHT1Diff, 
-                                nDHT1Offset, 
-                                hDCT1Diff, 
-                                nDCT1Offset, 
+            m_cuda.lstm_seq_bwd(m_nT,
+                                m_nN,
+                                m_nH,
+                                m_dfClippingThreshold,
+                                hWeight_h,
+                                hClipData,
+                                hTopDiff,
+                                hCellData,
+                                hCellDiff,
+                                hPreGateDiff,
+                                hGateData,
+                                hGateDiff,
+                                m_blob_C_0.gpu_data,
+                                m_blob_H_0.mutable_gpu_diff,
+                                m_blob_C_0.mutable_gpu_diff,
                                 hHtoHData);
-            }
 
             if (m_rgbParamPropagateDown[0])
             {
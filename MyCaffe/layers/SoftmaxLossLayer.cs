@@ -98,6 +98,8 @@ namespace MyCaffe.layers
         {
             base.LayerSetUp(colBottom, colTop);
 
+            // The softmax layer only shapes the probabilities, which the forward
+            // pass computes together with the loss.
             LayerParameter p = m_param.Clone(false);
             p.type = LayerParameter.LayerType.SOFTMAX;        
             m_softmaxLayer = new SoftmaxLayer<T>(m_cuda, m_log, p);
@@ -204,9 +206,8 @@ namespace MyCaffe.layers
         ///     @f$ for softmax output class probabilities @f$ \hat{p} @f$.</param>
         protected override void forward(BlobCollection<T> colBottom, BlobCollection<T> colTop)
         {
-            m_softmaxLayer.Forward(m_colSoftmaxBottom, m_colSoftmaxTop);
-
-            long hProbData = m_blobProb.gpu_data;
+            long hBottomData = colBottom[0].gpu_data;
+            long hProbData = m_blobProb.mutable_gpu_data;
             long hLabel = colBottom[1].gpu_data;
             int nDim = m_blobProb.count() / m_nOuterNum;
             int nCount = m_nOuterNum * m_nInnerNum;
@@ -220,7 +221,9 @@ namespace MyCaffe.layers
             // to avoid having to allocate additional GPU memory.
             long hCounts = m_blobProb.mutable_gpu_diff;
 
-            m_cuda.softmaxloss_fwd(nCount, hProbData, hLabel, hLossData, m_nOuterNum, nDim, m_nInnerNum, hCounts, m_nIgnoreLabel);
+            // The softmax and the loss are run in one pass over the bottom data,
+            // the probabilities are still written for the backward pass.
+            m_cuda.softmaxloss_fused(nCount, hBottomData, hLabel, hLossData, m_nOuterNum, nDim, m_nInnerNum, hCounts, m_nIgnoreLabel, hProbData);
             T fLoss = m_cuda.asum(nCount, hLossData);
             T fValidCount = convert(-1);
 
@@ -64,9 +64,13 @@ namespace MyCaffe.param
         }
 
         /// <summary>
-        /// Specifies the seed used by cuDnn for random number generation.
+        /// Specifies the seed used by cuDnn or by the Philox random stream of the CAFFE engine for random number generation.
         /// </summary>
-        [Description("Specifies the random number generator seed used with the cuDnn dropout - the default value of '0' uses a random seed.")]
+        /// <remarks>
+        /// With the CAFFE engine, the default value of '0' draws the seed from the cuRand generator, which is seeded by the
+        /// solver's random_seed.
+        /// </remarks>
+        [Description("Specifies the random number generator seed used with the dropout - the default value of '0' uses a random seed.")]
         public long seed
         {
             get { return m_lSeed; }